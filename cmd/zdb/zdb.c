@@ -44,6 +44,7 @@
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
 #include <sys/metaslab_impl.h>
+#include <sys/vdev_indirect_mapping.h>
 #include <sys/dmu_objset.h>
 #include <sys/dsl_dir.h>
 #include <sys/dsl_dataset.h>
@@ -654,7 +655,11 @@ get_metaslab_refcount(vdev_t *vd)
 	int refcount = 0;
 	int c, m;
 
-	if (vd->vdev_top == vd && !vd->vdev_removing) {
+	/*
+	 * The metaslabs of a data vdev being removed are kept until all of
+	 * its data has been copied.
+	 */
+	if (vd->vdev_top == vd && (!vd->vdev_removing || !vd->vdev_islog)) {
 		for (m = 0; m < vd->vdev_ms_count; m++) {
 			space_map_t *sm = vd->vdev_ms[m]->ms_sm;
 
@@ -669,6 +674,25 @@ get_metaslab_refcount(vdev_t *vd)
 	return (refcount);
 }
 
+static int
+get_log_spacemap_refcount(spa_t *spa)
+{
+	int refcount = 0;
+	spa_log_sm_t *sls;
+
+	for (sls = avl_first(&spa->spa_sm_logs_by_txg); sls != NULL;
+	    sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
+		space_map_t *sm = NULL;
+
+		VERIFY0(space_map_open(&sm, spa->spa_meta_objset,
+		    sls->sls_sm_obj, 0, UINT64_MAX, SPA_MINBLOCKSHIFT, NULL));
+		if (sm->sm_dbuf->db_size == sizeof (space_map_phys_t))
+			refcount++;
+		space_map_close(sm);
+	}
+	return (refcount);
+}
+
 static int
 verify_spacemap_refcounts(spa_t *spa)
 {
@@ -680,6 +704,7 @@ verify_spacemap_refcounts(spa_t *spa)
 	    &expected_refcount);
 	actual_refcount = get_dtl_refcount(spa->spa_root_vdev);
 	actual_refcount += get_metaslab_refcount(spa->spa_root_vdev);
+	actual_refcount += get_log_spacemap_refcount(spa);
 
 	if (expected_refcount != actual_refcount) {
 		(void) printf("space map refcount mismatch: expected %lld != "
@@ -767,7 +792,7 @@ dump_metaslab(metaslab_t *msp)
 	space_map_t *sm = msp->ms_sm;
 	char freebuf[32];
 
-	zdb_nicenum(msp->ms_size - space_map_allocated(sm), freebuf);
+	zdb_nicenum(msp->ms_size - msp->ms_allocated_space, freebuf);
 
 	(void) printf(
 	    "\tmetaslab %6llu   offset %12llx   spacemap %6llu   free    %5s\n",
@@ -807,6 +832,24 @@ dump_metaslab(metaslab_t *msp)
 	}
 }
 
+static void
+dump_log_spacemaps(spa_t *spa)
+{
+	spa_log_sm_t *sls;
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+		return;
+
+	(void) printf("\nLog Space Maps in Pool:\n");
+	for (sls = avl_first(&spa->spa_sm_logs_by_txg); sls != NULL;
+	    sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
+		(void) printf("\ttxg %10llu   spacemap %6llu   blocks %6llu\n",
+		    (u_longlong_t)sls->sls_txg,
+		    (u_longlong_t)sls->sls_sm_obj,
+		    (u_longlong_t)sls->sls_nblocks);
+	}
+}
+
 static void
 print_vdev_metaslab_header(vdev_t *vd)
 {
@@ -2653,7 +2696,8 @@ dump_one_dir(const char *dsname, void *arg)
 	objset_t *os;
 	spa_feature_t f;
 
-	error = dmu_objset_own(dsname, DMU_OST_ANY, B_TRUE, FTAG, &os);
+	error = dmu_objset_own(dsname, DMU_OST_ANY, B_TRUE, B_FALSE,
+	    FTAG, &os);
 	if (error) {
 		(void) printf("Could not open %s, error %d\n", dsname, error);
 		return (0);
@@ -2668,7 +2712,7 @@ dump_one_dir(const char *dsname, void *arg)
 	}
 
 	dump_dir(os);
-	dmu_objset_disown(os, FTAG);
+	dmu_objset_disown(os, B_FALSE, FTAG);
 	fuid_table_destroy();
 	sa_loaded = B_FALSE;
 	return (0);
@@ -2709,6 +2753,7 @@ typedef struct zdb_cb {
 	zdb_blkstats_t	zcb_type[ZB_TOTAL + 1][ZDB_OT_TOTAL + 1];
 	uint64_t	zcb_dedup_asize;
 	uint64_t	zcb_dedup_blocks;
+	uint64_t	zcb_removing_size;
 	uint64_t	zcb_embedded_blocks[NUM_BP_EMBEDDED_TYPES];
 	uint64_t	zcb_embedded_histogram[NUM_BP_EMBEDDED_TYPES]
 	    [BPE_PAYLOAD_SIZE + 1];
@@ -2989,6 +3034,23 @@ zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 	ASSERT(error == ENOENT);
 }
 
+/*
+ * The segments of a vdev being removed which are already copied are
+ * claimed at their copies, through the vdev's mapping.
+ */
+static void
+zdb_leak_init_removing(zdb_cb_t *zcb, metaslab_t *msp, uint64_t synced)
+{
+	uint64_t space = range_tree_space(msp->ms_tree);
+
+	if (msp->ms_start >= synced)
+		return;
+
+	range_tree_clear(msp->ms_tree, msp->ms_start,
+	    MIN(synced, msp->ms_start + msp->ms_size) - msp->ms_start);
+	zcb->zcb_removing_size += space - range_tree_space(msp->ms_tree);
+}
+
 static void
 zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 {
@@ -2997,6 +3059,14 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 
 	if (!dump_opt['L']) {
 		vdev_t *rvd = spa->spa_root_vdev;
+		vdev_t *rmvd = NULL;
+		uint64_t synced = 0;
+
+		if (spa->spa_vdev_removal != NULL) {
+			rmvd = spa->spa_vdev_removal->svr_vdev;
+			synced = vdev_indirect_mapping_max_offset(
+			    rmvd->vdev_indirect_mapping);
+		}
 
 		/*
 		 * We are going to be changing the meaning of the metaslab's
@@ -3005,6 +3075,7 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 		 */
 		spa->spa_normal_class->mc_ops = &zdb_metaslab_ops;
 		spa->spa_log_class->mc_ops = &zdb_metaslab_ops;
+		spa->spa_special_class->mc_ops = &zdb_metaslab_ops;
 
 		for (c = 0; c < rvd->vdev_children; c++) {
 			vdev_t *vd = rvd->vdev_child[c];
@@ -3042,6 +3113,21 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 					VERIFY0(space_map_load(msp->ms_sm,
 					    msp->ms_tree, SM_ALLOC));
 
+					/*
+					 * Add the changes that are only
+					 * in the log space maps.
+					 */
+					range_tree_walk(
+					    msp->ms_unflushed_allocs,
+					    range_tree_add, msp->ms_tree);
+					range_tree_walk(
+					    msp->ms_unflushed_frees,
+					    range_tree_remove, msp->ms_tree);
+
+					if (vd == rmvd)
+						zdb_leak_init_removing(zcb,
+						    msp, synced);
+
 					if (!msp->ms_loaded)
 						msp->ms_loaded = B_TRUE;
 				}
@@ -3157,7 +3243,8 @@ dump_block_stats(spa_t *spa)
 	if (dump_opt['c'] > 1)
 		flags |= TRAVERSE_PREFETCH_DATA;
 
-	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa));
+	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa)) +
+	    metaslab_class_get_alloc(spa_special_class(spa));
 	zcb.zcb_start = zcb.zcb_lastprint = gethrtime();
 	zcb.zcb_haderrors |= traverse_pool(spa, 0, flags, zdb_blkptr_cb, &zcb);
 
@@ -3196,7 +3283,9 @@ dump_block_stats(spa_t *spa)
 	norm_alloc = metaslab_class_get_alloc(spa_normal_class(spa));
 	norm_space = metaslab_class_get_space(spa_normal_class(spa));
 
-	total_alloc = norm_alloc + metaslab_class_get_alloc(spa_log_class(spa));
+	total_alloc = norm_alloc + metaslab_class_get_alloc(spa_log_class(spa)) +
+	    metaslab_class_get_alloc(spa_special_class(spa)) -
+	    zcb.zcb_removing_size;
 	total_found = tzb->zb_asize - zcb.zcb_dedup_asize;
 
 	if (total_found == total_alloc) {
@@ -3483,8 +3572,10 @@ dump_zpool(spa_t *spa)
 	if (dump_opt['D'])
 		dump_all_ddts(spa);
 
-	if (dump_opt['d'] > 2 || dump_opt['m'])
+	if (dump_opt['d'] > 2 || dump_opt['m']) {
 		dump_metaslabs(spa);
+		dump_log_spacemaps(spa);
+	}
 	if (dump_opt['M'])
 		dump_metaslab_groups(spa);
 
@@ -4257,7 +4348,7 @@ main(int argc, char **argv)
 			}
 		} else {
 			error = dmu_objset_own(target, DMU_OST_ANY,
-			    B_TRUE, FTAG, &os);
+			    B_TRUE, B_FALSE, FTAG, &os);
 		}
 	}
 	nvlist_free(policy);
@@ -4300,7 +4391,8 @@ main(int argc, char **argv)
 			zdb_read_block(argv[i], spa);
 	}
 
-	(os != NULL) ? dmu_objset_disown(os, FTAG) : spa_close(spa, FTAG);
+	(os != NULL) ? dmu_objset_disown(os, B_FALSE, FTAG) :
+	    spa_close(spa, FTAG);
 
 	fuid_table_destroy();
 	sa_loaded = B_FALSE;
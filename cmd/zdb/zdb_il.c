@@ -289,6 +289,7 @@ static zil_rec_info_t zil_rec_info[TX_MAX_TYPE] = {
 	{ (zil_prt_rec_func_t)zil_prt_rec_create,	"TX_MKDIR_ATTR      " },
 	{ (zil_prt_rec_func_t)zil_prt_rec_create,	"TX_MKDIR_ACL_ATTR  " },
 	{ (zil_prt_rec_func_t)zil_prt_rec_write,	"TX_WRITE2          " },
+	{ NULL,						"TX_COMMIT          " },
 };
 
 /* ARGSUSED */
@@ -86,6 +86,7 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_scrub(int, char **);
+static int zpool_do_trim(int, char **);
 
 static int zpool_do_import(int, char **);
 static int zpool_do_export(int, char **);
@@ -135,6 +136,7 @@ typedef enum {
 	HELP_REPLACE,
 	HELP_REMOVE,
 	HELP_SCRUB,
+	HELP_TRIM,
 	HELP_STATUS,
 	HELP_UPGRADE,
 	HELP_EVENTS,
@@ -259,6 +261,7 @@ static zpool_command_t command_table[] = {
 	{ "split",	zpool_do_split,		HELP_SPLIT		},
 	{ NULL },
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -336,6 +339,8 @@ get_usage(zpool_help_t idx)
 		return (gettext("\treopen <pool>\n"));
 	case HELP_SCRUB:
 		return (gettext("\tscrub [-s] <pool> ...\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-s] <pool> ...\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-c CMD] [-gLPvxD] [-T d|u] [pool]"
 		    " ... [interval [count]]\n"));
@@ -448,9 +453,34 @@ usage(boolean_t requested)
 	exit(requested ? 0 : 2);
 }
 
+/*
+ * Returns true if a top-level vdev belongs to the given class: VDEV_TYPE_LOG,
+ * VDEV_TYPE_SPECIAL, or NULL for the normal class.  Removed (indirect) vdevs
+ * belong to none, so that they are not displayed.
+ */
+static boolean_t
+vdev_is_class(nvlist_t *nv, const char *class)
+{
+	uint64_t is_log = B_FALSE, is_special = B_FALSE;
+	char *type;
+
+	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0 &&
+	    strcmp(type, VDEV_TYPE_INDIRECT) == 0)
+		return (B_FALSE);
+
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG, &is_log);
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL, &is_special);
+
+	if (class == NULL)
+		return (!is_log && !is_special);
+	if (strcmp(class, VDEV_TYPE_LOG) == 0)
+		return (is_log);
+	return (is_special);
+}
+
 void
 print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
-    boolean_t print_logs, int name_flags)
+    const char *class, int name_flags)
 {
 	nvlist_t **child;
 	uint_t c, children;
@@ -464,16 +494,12 @@ print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if ((is_log && !print_logs) || (!is_log && print_logs))
+		if (!vdev_is_class(child[c], class))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c], name_flags);
 		print_vdev_tree(zhp, vname, child[c], indent + 2,
-		    B_FALSE, name_flags);
+		    NULL, name_flags);
 		free(vname);
 	}
 }
@@ -698,21 +724,32 @@ zpool_do_add(int argc, char **argv)
 		    "configuration:\n"), zpool_get_name(zhp));
 
 		/* print original main pool and new tree */
-		print_vdev_tree(zhp, poolname, poolnvroot, 0, B_FALSE,
+		print_vdev_tree(zhp, poolname, poolnvroot, 0, NULL,
 		    name_flags);
-		print_vdev_tree(zhp, NULL, nvroot, 0, B_FALSE, name_flags);
+		print_vdev_tree(zhp, NULL, nvroot, 0, NULL, name_flags);
 
 		/* Do the same for the logs */
 		if (num_logs(poolnvroot) > 0) {
-			print_vdev_tree(zhp, "logs", poolnvroot, 0, B_TRUE,
-			    name_flags);
-			print_vdev_tree(zhp, NULL, nvroot, 0, B_TRUE,
+			print_vdev_tree(zhp, "logs", poolnvroot, 0,
+			    VDEV_TYPE_LOG, name_flags);
+			print_vdev_tree(zhp, NULL, nvroot, 0, VDEV_TYPE_LOG,
 			    name_flags);
 		} else if (num_logs(nvroot) > 0) {
-			print_vdev_tree(zhp, "logs", nvroot, 0, B_TRUE,
+			print_vdev_tree(zhp, "logs", nvroot, 0, VDEV_TYPE_LOG,
 			    name_flags);
 		}
 
+		/* And for the special vdevs */
+		if (num_special(poolnvroot) > 0) {
+			print_vdev_tree(zhp, "special", poolnvroot, 0,
+			    VDEV_TYPE_SPECIAL, name_flags);
+			print_vdev_tree(zhp, NULL, nvroot, 0,
+			    VDEV_TYPE_SPECIAL, name_flags);
+		} else if (num_special(nvroot) > 0) {
+			print_vdev_tree(zhp, "special", nvroot, 0,
+			    VDEV_TYPE_SPECIAL, name_flags);
+		}
+
 		/* Do the same for the caches */
 		if (nvlist_lookup_nvlist_array(poolnvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2child, &l2children) == 0 && l2children) {
@@ -1182,9 +1219,13 @@ zpool_do_create(int argc, char **argv)
 		(void) printf(gettext("would create '%s' with the "
 		    "following layout:\n\n"), poolname);
 
-		print_vdev_tree(NULL, poolname, nvroot, 0, B_FALSE, 0);
+		print_vdev_tree(NULL, poolname, nvroot, 0, NULL, 0);
 		if (num_logs(nvroot) > 0)
-			print_vdev_tree(NULL, "logs", nvroot, 0, B_TRUE, 0);
+			print_vdev_tree(NULL, "logs", nvroot, 0,
+			    VDEV_TYPE_LOG, 0);
+		if (num_special(nvroot) > 0)
+			print_vdev_tree(NULL, "special", nvroot, 0,
+			    VDEV_TYPE_SPECIAL, 0);
 
 		ret = 0;
 	} else {
@@ -1668,14 +1709,12 @@ print_status_config(zpool_handle_t *zhp, status_cbdata_t *cb, const char *name,
 	(void) printf("\n");
 
 	for (c = 0; c < children; c++) {
-		uint64_t islog = B_FALSE, ishole = B_FALSE;
+		uint64_t ishole = B_FALSE;
 
-		/* Don't print logs or holes here */
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
+		/* Don't print logs, special vdevs or holes here */
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
-		if (islog || ishole)
+		if (!vdev_is_class(child[c], NULL) || ishole)
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags | VDEV_NAME_TYPE_ID);
@@ -1700,7 +1739,8 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 
 	verify(nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0);
 	if (strcmp(type, VDEV_TYPE_MISSING) == 0 ||
-	    strcmp(type, VDEV_TYPE_HOLE) == 0)
+	    strcmp(type, VDEV_TYPE_HOLE) == 0 ||
+	    strcmp(type, VDEV_TYPE_INDIRECT) == 0)
 		return;
 
 	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
@@ -1749,11 +1789,7 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (is_log)
+		if (!vdev_is_class(child[c], NULL))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c],
@@ -1786,15 +1822,16 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 }
 
 /*
- * Print log vdevs.
- * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * Print log or special vdevs.
+ * Logs and special vdevs are recorded as top level vdevs in the main pool
+ * child array but with "is_log" or "is_special" set to 1. We use either
+ * print_status_config() or print_import_config() to print the top level
+ * vdevs then any children (eg mirrored slogs) are printed recursively -
+ * which works because only the top level vdev is marked.
  */
 static void
-print_logs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv)
+print_class_vdevs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv,
+    const char *class)
 {
 	uint_t c, children;
 	nvlist_t **child;
@@ -1803,15 +1840,15 @@ print_logs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv)
 	    &children) != 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
+	if (strcmp(class, VDEV_TYPE_LOG) == 0)
+		(void) printf(gettext("\tlogs\n"));
+	else
+		(void) printf(gettext("\tspecial\n"));
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
 		char *name;
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (!is_log)
+		if (!vdev_is_class(child[c], class))
 			continue;
 		name = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags | VDEV_NAME_TYPE_ID);
@@ -2074,7 +2111,9 @@ show_import(nvlist_t *config)
 
 	print_import_config(&cb, name, nvroot, 0);
 	if (num_logs(nvroot) > 0)
-		print_logs(NULL, &cb, nvroot);
+		print_class_vdevs(NULL, &cb, nvroot, VDEV_TYPE_LOG);
+	if (num_special(nvroot) > 0)
+		print_class_vdevs(NULL, &cb, nvroot, VDEV_TYPE_SPECIAL);
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -3453,15 +3492,12 @@ children:
 		return (ret);
 
 	for (c = 0; c < children; c++) {
-		uint64_t ishole = B_FALSE, islog = B_FALSE;
+		uint64_t ishole = B_FALSE;
 
 		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
 
-		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
-
-		if (ishole || islog)
+		if (ishole || !vdev_is_class(newchild[c], NULL))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
@@ -3498,6 +3534,28 @@ children:
 
 	}
 
+	/*
+	 * Special device section
+	 */
+
+	if (num_special(newnv) > 0) {
+		if ((!(cb->cb_flags & IOS_ANYHISTO_M)) && !cb->cb_scripted &&
+		    !cb->cb_vdev_names) {
+			print_iostat_dashes(cb, 0, "special");
+		}
+
+		for (c = 0; c < children; c++) {
+			if (!vdev_is_class(newchild[c], VDEV_TYPE_SPECIAL))
+				continue;
+
+			vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
+			    cb->cb_name_flags);
+			ret += print_vdev_stats(zhp, vname, oldnv ?
+			    oldchild[c] : NULL, newchild[c], cb, depth + 2);
+			free(vname);
+		}
+	}
+
 	/*
 	 * Include level 2 ARC devices in iostat output
 	 */
@@ -4568,6 +4626,9 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 			continue;
 		}
 
+		if (!vdev_is_class(child[c], NULL))
+			continue;
+
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags);
 		print_list_stats(zhp, vname, child[c], cb, depth + 2);
@@ -4588,6 +4649,19 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 		}
 	}
 
+	if (num_special(nv) > 0) {
+		/* LINTED E_SEC_PRINTF_VAR_FMT */
+		(void) printf(dashes, cb->cb_namewidth, "special");
+		for (c = 0; c < children; c++) {
+			if (!vdev_is_class(child[c], VDEV_TYPE_SPECIAL))
+				continue;
+			vname = zpool_vdev_name(g_zfs, zhp, child[c],
+			    cb->cb_name_flags);
+			print_list_stats(zhp, vname, child[c], cb, depth + 2);
+			free(vname);
+		}
+	}
+
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_L2CACHE,
 	    &child, &children) == 0 && children > 0) {
 		/* LINTED E_SEC_PRINTF_VAR_FMT */
@@ -5071,7 +5145,7 @@ zpool_do_split(int argc, char **argv)
 		if (flags.dryrun) {
 			(void) printf(gettext("would create '%s' with the "
 			    "following layout:\n\n"), newpool);
-			print_vdev_tree(NULL, newpool, config, 0, B_FALSE,
+			print_vdev_tree(NULL, newpool, config, 0, NULL,
 			    flags.name_flags);
 		}
 	}
@@ -5483,6 +5557,58 @@ zpool_do_scrub(int argc, char **argv)
 	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
 }
 
+int
+trim_callback(zpool_handle_t *zhp, void *data)
+{
+	pool_trim_func_t *func = data;
+
+	/*
+	 * Ignore faulted pools.
+	 */
+	if (zpool_get_state(zhp) == POOL_STATE_UNAVAIL) {
+		(void) fprintf(stderr, gettext("cannot trim '%s': pool is "
+		    "currently unavailable\n"), zpool_get_name(zhp));
+		return (1);
+	}
+
+	return (zpool_trim(zhp, *func) != 0);
+}
+
+/*
+ * zpool trim [-s] <pool> ...
+ *
+ *	-s	Stop.  Stops trimming free space which has not been trimmed yet.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	int c;
+	pool_trim_func_t func = POOL_TRIM_START;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "s")) != -1) {
+		switch (c) {
+		case 's':
+			func = POOL_TRIM_STOP;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+
+	return (for_each_pool(argc, argv, B_TRUE, NULL, trim_callback, &func));
+}
+
 /*
  * Print out detailed scrub status.
  */
@@ -5595,6 +5721,95 @@ print_scan_status(pool_scan_stat_t *ps)
 	}
 }
 
+/*
+ * Print out the progress of any raidz expansion.
+ */
+static void
+print_expand_status(zpool_handle_t *zhp, nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t c, children, n;
+	uint64_t *stats;
+	char copied_buf[7], total_buf[7];
+	char *name;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return;
+
+	for (c = 0; c < children; c++) {
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_RAIDZ_EXPAND_STATS, &stats, &n) != 0 ||
+		    n < 2 || stats[1] == 0)
+			continue;
+
+		name = zpool_vdev_name(g_zfs, zhp, child[c],
+		    VDEV_NAME_TYPE_ID);
+		zfs_nicenum(stats[0], copied_buf, sizeof (copied_buf));
+		zfs_nicenum(stats[1], total_buf, sizeof (total_buf));
+		(void) printf(gettext("expand: %s in progress, %s of %s "
+		    "reflowed, %.2f%% done\n"), name, copied_buf, total_buf,
+		    100 * (double)stats[0] / stats[1]);
+		free(name);
+	}
+}
+
+/*
+ * Print out the progress or result of the last top-level vdev removal.
+ */
+static void
+print_removal_status(zpool_handle_t *zhp, pool_removal_stat_t *prs)
+{
+	char copied_buf[7], total_buf[7];
+	nvlist_t *config, *nvroot, **child;
+	uint_t children;
+	char *vname;
+	time_t start, end;
+
+	if (prs == NULL || prs->prs_state == DSS_NONE)
+		return;
+
+	/*
+	 * The vdev is no longer there once the removal is done, so it can
+	 * only be named by its id.
+	 */
+	config = zpool_get_config(zhp, NULL);
+	verify(nvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE,
+	    &nvroot) == 0);
+	verify(nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) == 0);
+	if (prs->prs_removing_vdev < children &&
+	    prs->prs_state == DSS_SCANNING) {
+		vname = zpool_vdev_name(g_zfs, zhp,
+		    child[prs->prs_removing_vdev], VDEV_NAME_TYPE_ID);
+	} else {
+		vname = safe_malloc(32);
+		(void) snprintf(vname, 32, "vdev %llu",
+		    (u_longlong_t)prs->prs_removing_vdev);
+	}
+
+	zfs_nicenum(prs->prs_copied, copied_buf, sizeof (copied_buf));
+	zfs_nicenum(prs->prs_to_copy, total_buf, sizeof (total_buf));
+	start = prs->prs_start_time;
+	end = prs->prs_end_time;
+
+	if (prs->prs_state == DSS_SCANNING) {
+		(void) printf(gettext("remove: Removal of %s in progress "
+		    "since %s"), vname, ctime(&start));
+		(void) printf(gettext("\t%s copied out of %s, %.2f%% done\n"),
+		    copied_buf, total_buf, prs->prs_to_copy == 0 ? 100 :
+		    100 * (double)prs->prs_copied / prs->prs_to_copy);
+	} else if (prs->prs_state == DSS_FINISHED) {
+		(void) printf(gettext("remove: Removal of %s copied %s "
+		    "in %lluh%um%us, completed on %s"), vname, copied_buf,
+		    (u_longlong_t)((end - start) / 3600),
+		    (uint_t)((end - start) % 3600 / 60),
+		    (uint_t)((end - start) % 60), ctime(&end));
+	}
+
+	free(vname);
+}
+
 static void
 print_error_log(zpool_handle_t *zhp)
 {
@@ -6001,10 +6216,17 @@ status_callback(zpool_handle_t *zhp, void *data)
 		nvlist_t **spares, **l2cache;
 		uint_t nspares, nl2cache;
 		pool_scan_stat_t *ps = NULL;
+		pool_removal_stat_t *prs;
 
 		(void) nvlist_lookup_uint64_array(nvroot,
 		    ZPOOL_CONFIG_SCAN_STATS, (uint64_t **)&ps, &c);
 		print_scan_status(ps);
+		print_expand_status(zhp, nvroot);
+
+		prs = NULL;
+		(void) nvlist_lookup_uint64_array(nvroot,
+		    ZPOOL_CONFIG_REMOVAL_STATS, (uint64_t **)&prs, &c);
+		print_removal_status(zhp, prs);
 
 		cbp->cb_namewidth = max_width(zhp, nvroot, 0, 0,
 		    cbp->cb_name_flags | VDEV_NAME_TYPE_ID);
@@ -6019,7 +6241,9 @@ status_callback(zpool_handle_t *zhp, void *data)
 		    B_FALSE);
 
 		if (num_logs(nvroot) > 0)
-			print_logs(zhp, cbp, nvroot);
+			print_class_vdevs(zhp, cbp, nvroot, VDEV_TYPE_LOG);
+		if (num_special(nvroot) > 0)
+			print_class_vdevs(zhp, cbp, nvroot, VDEV_TYPE_SPECIAL);
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, cbp, l2cache, nl2cache);
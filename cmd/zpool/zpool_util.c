@@ -86,6 +86,28 @@ num_logs(nvlist_t *nv)
 	return (nlogs);
 }
 
+uint_t
+num_special(nvlist_t *nv)
+{
+	uint_t nspecial = 0;
+	uint_t c, children;
+	nvlist_t **child;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (0);
+
+	for (c = 0; c < children; c++) {
+		uint64_t is_special = B_FALSE;
+
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_SPECIAL,
+		    &is_special);
+		if (is_special)
+			nspecial++;
+	}
+	return (nspecial);
+}
+
 /* Find the max element in an array of uint64_t values */
 uint64_t
 array64_max(uint64_t array[], unsigned int len)
@@ -36,6 +36,7 @@
  *
  * 	Group vdevs
  * 		raidz[1|2]=(...)
+ * 		draid[1|2|3][:<data>d][:<spares>s]=(...)
  * 		mirror=(...)
  *
  * 	Hot spares
@@ -630,6 +631,21 @@ make_leaf_vdev(nvlist_t *props, const char *arg, uint64_t is_log)
 	uint64_t ashift = 0;
 	int err;
 
+	/*
+	 * Distributed spares (i.e. draid1-0-0) are named after their dRAID
+	 * vdev rather than a device, and only exist inside the pool.
+	 */
+	if (strncmp(arg, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0 &&
+	    strchr(arg, '-') != NULL) {
+		verify(nvlist_alloc(&vdev, NV_UNIQUE_NAME, 0) == 0);
+		verify(nvlist_add_string(vdev, ZPOOL_CONFIG_PATH, arg) == 0);
+		verify(nvlist_add_string(vdev, ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_DRAID_SPARE) == 0);
+		verify(nvlist_add_uint64(vdev, ZPOOL_CONFIG_IS_LOG,
+		    is_log) == 0);
+		return (vdev);
+	}
+
 	/*
 	 * Determine what type of vdev this is, and put the full path into
 	 * 'path'.  We detect whether this is a device of file afterwards by
@@ -825,7 +841,8 @@ get_replication(nvlist_t *nvroot, boolean_t fatal)
 			rep.zprl_type = type;
 			rep.zprl_children = 0;
 
-			if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
+			if (strcmp(type, VDEV_TYPE_RAIDZ) == 0 ||
+			    strcmp(type, VDEV_TYPE_DRAID) == 0) {
 				verify(nvlist_lookup_uint64(nv,
 				    ZPOOL_CONFIG_NPARITY,
 				    &rep.zprl_parity) == 0);
@@ -1367,9 +1384,68 @@ is_device_in_use(nvlist_t *config, nvlist_t *nv, boolean_t force,
 	return (anyinuse);
 }
 
+/*
+ * Parse a dRAID specification of the form draid[<parity>][:<data>d]
+ * [:<spares>s].  A data count of zero means that each redundancy group
+ * spans all of the children which are not set aside for spares.
+ */
+static boolean_t
+is_draid_spec(const char *type, long *nparity, long *ndata, long *nspares)
+{
+	const char *p = type + strlen(VDEV_TYPE_DRAID);
+	char *end;
+	long value;
+
+	*nparity = 1;
+	*ndata = 0;
+	*nspares = 0;
+
+	if (isdigit(*p)) {
+		if (*p == '0')
+			return (B_FALSE); /* no zero prefixes allowed */
+		errno = 0;
+		*nparity = strtol(p, &end, 10);
+		if (errno != 0 || *nparity > 3)
+			return (B_FALSE);
+		p = end;
+	}
+
+	while (*p == ':') {
+		p++;
+		if (!isdigit(*p))
+			return (B_FALSE);
+		errno = 0;
+		value = strtol(p, &end, 10);
+		if (errno != 0 || value > 255)
+			return (B_FALSE);
+		if (*end == 'd' && value > 0)
+			*ndata = value;
+		else if (*end == 's')
+			*nspares = value;
+		else
+			return (B_FALSE);
+		p = end + 1;
+	}
+
+	return (*p == '\0');
+}
+
 static const char *
 is_grouping(const char *type, int *mindev, int *maxdev)
 {
+	if (strncmp(type, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0) {
+		long nparity, ndata, nspares;
+
+		if (!is_draid_spec(type, &nparity, &ndata, &nspares))
+			return (NULL);
+
+		if (mindev != NULL)
+			*mindev = nparity + MAX(ndata, 1) + nspares;
+		if (maxdev != NULL)
+			*maxdev = 255;
+		return (VDEV_TYPE_DRAID);
+	}
+
 	if (strncmp(type, "raidz", 5) == 0) {
 		const char *p = type + 5;
 		char *end;
@@ -1415,6 +1491,12 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_LOG);
 	}
 
+	if (strcmp(type, "special") == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_TYPE_SPECIAL);
+	}
+
 	if (strcmp(type, "cache") == 0) {
 		if (mindev != NULL)
 			*mindev = 1;
@@ -1434,10 +1516,10 @@ nvlist_t *
 construct_spec(nvlist_t *props, int argc, char **argv)
 {
 	nvlist_t *nvroot, *nv, **top, **spares, **l2cache;
-	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache;
+	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache, nspecial;
 	const char *type;
-	uint64_t is_log;
-	boolean_t seen_logs;
+	uint64_t is_log, is_special;
+	boolean_t seen_logs, seen_special;
 
 	top = NULL;
 	toplevels = 0;
@@ -1446,8 +1528,11 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	nspares = 0;
 	nlogs = 0;
 	nl2cache = 0;
+	nspecial = 0;
 	is_log = B_FALSE;
+	is_special = B_FALSE;
 	seen_logs = B_FALSE;
+	seen_special = B_FALSE;
 	nvroot = NULL;
 
 	while (argc > 0) {
@@ -1459,6 +1544,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		 */
 		if ((type = is_grouping(argv[0], &mindev, &maxdev)) != NULL) {
 			nvlist_t **child = NULL;
+			const char *spec = argv[0];
 			int c, children = 0;
 
 			if (strcmp(type, VDEV_TYPE_SPARE) == 0) {
@@ -1470,6 +1556,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					goto spec_out;
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
 			}
 
 			if (strcmp(type, VDEV_TYPE_LOG) == 0) {
@@ -1482,6 +1569,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				}
 				seen_logs = B_TRUE;
 				is_log = B_TRUE;
+				is_special = B_FALSE;
 				argc--;
 				argv++;
 				/*
@@ -1491,6 +1579,26 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				continue;
 			}
 
+			if (strcmp(type, VDEV_TYPE_SPECIAL) == 0) {
+				if (seen_special) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: 'special' can be "
+					    "specified only once\n"));
+					goto spec_out;
+				}
+				seen_special = B_TRUE;
+				is_special = B_TRUE;
+				is_log = B_FALSE;
+				argc--;
+				argv++;
+				/*
+				 * Like a log, special is not a real grouping
+				 * device.  We just set is_special and continue.
+				 */
+				continue;
+			}
+
 			if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
 				if (l2cache != NULL) {
 					(void) fprintf(stderr,
@@ -1500,6 +1608,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					goto spec_out;
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
 			}
 
 			if (is_log) {
@@ -1513,6 +1622,17 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				nlogs++;
 			}
 
+			if (is_special) {
+				if (strcmp(type, VDEV_TYPE_MIRROR) != 0) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: unsupported "
+					    "'special' device: %s\n"), type);
+					goto spec_out;
+				}
+				nspecial++;
+			}
+
 			for (c = 1; c < argc; c++) {
 				if (is_grouping(argv[c], NULL, NULL) != NULL)
 					break;
@@ -1570,11 +1690,34 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				    type) == 0);
 				verify(nvlist_add_uint64(nv,
 				    ZPOOL_CONFIG_IS_LOG, is_log) == 0);
+				if (is_special) {
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_IS_SPECIAL,
+					    is_special) == 0);
+				}
 				if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
 					verify(nvlist_add_uint64(nv,
 					    ZPOOL_CONFIG_NPARITY,
 					    mindev - 1) == 0);
 				}
+				if (strcmp(type, VDEV_TYPE_DRAID) == 0) {
+					long nparity, ndata, nspares;
+
+					verify(is_draid_spec(spec, &nparity,
+					    &ndata, &nspares));
+					if (ndata == 0)
+						ndata = children - nparity -
+						    nspares;
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_NPARITY,
+					    nparity) == 0);
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_DRAID_NDATA,
+					    ndata) == 0);
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_DRAID_NSPARES,
+					    nspares) == 0);
+				}
 				verify(nvlist_add_nvlist_array(nv,
 				    ZPOOL_CONFIG_CHILDREN, child,
 				    children) == 0);
@@ -1594,6 +1737,11 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 
 			if (is_log)
 				nlogs++;
+			if (is_special) {
+				verify(nvlist_add_uint64(nv,
+				    ZPOOL_CONFIG_IS_SPECIAL, is_special) == 0);
+				nspecial++;
+			}
 			argc--;
 			argv++;
 		}
@@ -1618,6 +1766,12 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		goto spec_out;
 	}
 
+	if (seen_special && nspecial == 0) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "special requires at least 1 device\n"));
+		goto spec_out;
+	}
+
 	/*
 	 * Finally, create nvroot and add all top-level vdevs to it.
 	 */
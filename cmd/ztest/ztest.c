@@ -104,6 +104,7 @@
 #include <sys/zfs_rlock.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
+#include <sys/vdev_draid.h>
 #include <sys/spa_impl.h>
 #include <sys/metaslab_impl.h>
 #include <sys/dsl_prop.h>
@@ -114,7 +115,9 @@
 #include <sys/refcount.h>
 #include <sys/zfeature.h>
 #include <sys/dsl_userhold.h>
+#include <sys/dsl_crypt.h>
 #include <sys/abd.h>
+#include <sys/sha2_mb.h>
 #include <stdio.h>
 #include <stdio_ext.h>
 #include <stdlib.h>
@@ -157,6 +160,9 @@ typedef struct ztest_shared_opts {
 	int zo_mirrors;
 	int zo_raidz;
 	int zo_raidz_parity;
+	char zo_raid_type[8];
+	int zo_draid_data;
+	int zo_draid_spares;
 	int zo_datasets;
 	int zo_threads;
 	uint64_t zo_passtime;
@@ -178,6 +184,9 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_mirrors = 2,
 	.zo_raidz = 4,
 	.zo_raidz_parity = 1,
+	.zo_raid_type = VDEV_TYPE_RAIDZ,
+	.zo_draid_data = 2,
+	.zo_draid_spares = 1,
 	.zo_vdev_size = SPA_MINDEVSIZE * 4,	/* 256m default size */
 	.zo_datasets = 7,
 	.zo_threads = 23,
@@ -207,8 +216,15 @@ static ztest_shared_ds_t *ztest_shared_ds;
 #define	ZTEST_GET_SHARED_DS(d) (&ztest_shared_ds[d])
 
 #define	BT_MAGIC	0x123456789abcdefULL
+#define	ZTEST_DRAID()	\
+	(strcmp(ztest_opts.zo_raid_type, VDEV_TYPE_DRAID) == 0)
+/*
+ * The columns of an active distributed spare live on the other children
+ * of the dRAID vdev, so keep one level of parity in reserve for them.
+ */
 #define	MAXFAULTS() \
-	(MAX(zs->zs_mirrors, 1) * (ztest_opts.zo_raidz_parity + 1) - 1)
+	(MAX(zs->zs_mirrors, 1) * (ztest_opts.zo_raidz_parity + 1) - 1 - \
+	(ZTEST_DRAID() ? 1 : 0))
 
 enum ztest_io_type {
 	ZTEST_IO_WRITE_TAG,
@@ -327,14 +343,17 @@ ztest_func_t ztest_spa_rename;
 ztest_func_t ztest_scrub;
 ztest_func_t ztest_dsl_dataset_promote_busy;
 ztest_func_t ztest_vdev_attach_detach;
+ztest_func_t ztest_vdev_raidz_attach;
 ztest_func_t ztest_vdev_LUN_growth;
 ztest_func_t ztest_vdev_add_remove;
 ztest_func_t ztest_vdev_aux_add_remove;
+ztest_func_t ztest_device_removal;
 ztest_func_t ztest_split_pool;
 ztest_func_t ztest_reguid;
 ztest_func_t ztest_spa_upgrade;
 ztest_func_t ztest_fletcher;
 ztest_func_t ztest_fletcher_incr;
+ztest_func_t ztest_sha2_batch;
 ztest_func_t ztest_verify_dnode_bt;
 
 uint64_t zopt_always = 0ULL * NANOSEC;		/* all the time */
@@ -378,11 +397,14 @@ ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_spa_upgrade, 1, &zopt_rarely),
 	ZTI_INIT(ztest_dsl_dataset_promote_busy, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_attach_detach, 1, &zopt_sometimes),
+	ZTI_INIT(ztest_vdev_raidz_attach, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_LUN_growth, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_add_remove, 1, &ztest_opts.zo_vdevtime),
 	ZTI_INIT(ztest_vdev_aux_add_remove, 1, &ztest_opts.zo_vdevtime),
+	ZTI_INIT(ztest_device_removal, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_fletcher, 1, &zopt_rarely),
 	ZTI_INIT(ztest_fletcher_incr, 1, &zopt_rarely),
+	ZTI_INIT(ztest_sha2_batch, 1, &zopt_rarely),
 	ZTI_INIT(ztest_verify_dnode_bt, 1, &zopt_sometimes),
 };
 
@@ -441,6 +463,13 @@ static rwlock_t ztest_name_lock;
 static boolean_t ztest_dump_core = B_TRUE;
 static boolean_t ztest_exiting;
 
+/*
+ * Set, under ztest_vdev_lock, while a vdev is being removed and the pool
+ * scrubbed afterwards.  ztest_fault_inject() spreads the damage it does
+ * by offset, which the removal doesn't preserve.
+ */
+static boolean_t ztest_device_removal_active;
+
 /* Global commit callback list */
 static ztest_cb_list_t zcl;
 /* Commit cb delay */
@@ -616,6 +645,9 @@ usage(boolean_t requested)
 	    "\t[-m mirror_copies (default: %d)]\n"
 	    "\t[-r raidz_disks (default: %d)]\n"
 	    "\t[-R raidz_parity (default: %d)]\n"
+	    "\t[-K raid_kind (default: %s)] raidz or draid\n"
+	    "\t[-D draid_data (default: %d)] data disks per dRAID group\n"
+	    "\t[-S draid_spares (default: %d)] distributed spares\n"
 	    "\t[-d datasets (default: %d)]\n"
 	    "\t[-t threads (default: %d)]\n"
 	    "\t[-g gang_block_threshold (default: %s)]\n"
@@ -640,6 +672,9 @@ usage(boolean_t requested)
 	    zo->zo_mirrors,				/* -m */
 	    zo->zo_raidz,				/* -r */
 	    zo->zo_raidz_parity,			/* -R */
+	    zo->zo_raid_type,				/* -K */
+	    zo->zo_draid_data,				/* -D */
+	    zo->zo_draid_spares,			/* -S */
 	    zo->zo_datasets,				/* -d */
 	    zo->zo_threads,				/* -t */
 	    nice_gang_bang,				/* -g */
@@ -666,7 +701,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:hF:B:o:")) != EOF) {
+	    "v:s:a:m:r:R:K:D:S:d:t:g:i:k:p:f:VET:P:hF:B:o:")) != EOF) {
 		value = 0;
 		switch (opt) {
 		case 'v':
@@ -675,6 +710,8 @@ process_options(int argc, char **argv)
 		case 'm':
 		case 'r':
 		case 'R':
+		case 'D':
+		case 'S':
 		case 'd':
 		case 't':
 		case 'g':
@@ -704,6 +741,16 @@ process_options(int argc, char **argv)
 		case 'R':
 			zo->zo_raidz_parity = MIN(MAX(value, 1), 3);
 			break;
+		case 'K':
+			(void) strlcpy(zo->zo_raid_type, optarg,
+			    sizeof (zo->zo_raid_type));
+			break;
+		case 'D':
+			zo->zo_draid_data = MAX(1, value);
+			break;
+		case 'S':
+			zo->zo_draid_spares = value;
+			break;
 		case 'd':
 			zo->zo_datasets = MAX(1, value);
 			break;
@@ -768,6 +815,18 @@ process_options(int argc, char **argv)
 		}
 	}
 
+	if (strcmp(zo->zo_raid_type, VDEV_TYPE_DRAID) == 0) {
+		/*
+		 * dRAID vdevs can only be top-level vdevs, and need enough
+		 * children for a full group plus the distributed spares.
+		 */
+		zo->zo_mirrors = 0;
+		zo->zo_raidz = MAX(zo->zo_raidz, zo->zo_raidz_parity +
+		    zo->zo_draid_data + zo->zo_draid_spares);
+	} else if (strcmp(zo->zo_raid_type, VDEV_TYPE_RAIDZ) != 0) {
+		usage(B_FALSE);
+	}
+
 	zo->zo_raidz_parity = MIN(zo->zo_raidz_parity, zo->zo_raidz - 1);
 
 	zo->zo_vdevtime =
@@ -933,9 +992,15 @@ make_vdev_raidz(char *path, char *aux, char *pool, size_t size,
 
 	VERIFY(nvlist_alloc(&raidz, NV_UNIQUE_NAME, 0) == 0);
 	VERIFY(nvlist_add_string(raidz, ZPOOL_CONFIG_TYPE,
-	    VDEV_TYPE_RAIDZ) == 0);
+	    ztest_opts.zo_raid_type) == 0);
 	VERIFY(nvlist_add_uint64(raidz, ZPOOL_CONFIG_NPARITY,
 	    ztest_opts.zo_raidz_parity) == 0);
+	if (ZTEST_DRAID()) {
+		VERIFY(nvlist_add_uint64(raidz, ZPOOL_CONFIG_DRAID_NDATA,
+		    ztest_opts.zo_draid_data) == 0);
+		VERIFY(nvlist_add_uint64(raidz, ZPOOL_CONFIG_DRAID_NSPARES,
+		    ztest_opts.zo_draid_spares) == 0);
+	}
 	VERIFY(nvlist_add_nvlist_array(raidz, ZPOOL_CONFIG_CHILDREN,
 	    child, r) == 0);
 
@@ -1093,6 +1158,7 @@ ztest_random_vdev_top(spa_t *spa, boolean_t log_ok)
 		top = ztest_random(rvd->vdev_children);
 		tvd = rvd->vdev_child[top];
 	} while (tvd->vdev_ishole || (tvd->vdev_islog && !log_ok) ||
+	    tvd->vdev_ops == &vdev_indirect_ops ||
 	    tvd->vdev_mg == NULL || tvd->vdev_mg->mg_class == NULL);
 
 	return (top);
@@ -2086,14 +2152,15 @@ ztest_get_done(zgd_t *zgd, int error)
 	ztest_object_unlock(zd, object);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	umem_free(zgd, sizeof (*zgd));
 	umem_free(zzp, sizeof (*zzp));
 }
 
 static int
-ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	ztest_ds_t *zd = arg;
 	objset_t *os = zd->zd_os;
@@ -2129,7 +2196,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	db = NULL;
 
 	zgd = umem_zalloc(sizeof (*zgd), UMEM_NOFAIL);
-	zgd->zgd_zilog = zd->zd_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd_private = umem_zalloc(sizeof (ztest_zgd_private_t), UMEM_NOFAIL);
 	zgd_private->z_zd = zd;
 	zgd_private->z_object = object;
@@ -2666,6 +2733,13 @@ ztest_spa_upgrade(ztest_ds_t *zd, uint64_t id)
 	nvlist_t *nvroot, *props;
 	char *name;
 
+	/*
+	 * dRAID requires feature flags, so there is no older version of
+	 * the pool to upgrade from.
+	 */
+	if (ZTEST_DRAID())
+		return;
+
 	mutex_enter(&ztest_vdev_lock);
 	name = kmem_asprintf("%s_upgrade", ztest_opts.zo_pool);
 
@@ -2776,7 +2850,9 @@ ztest_vdev_add_remove(ztest_ds_t *zd, uint64_t id)
 	spa_t *spa = ztest_spa;
 	uint64_t leaves;
 	uint64_t guid;
-	nvlist_t *nvroot;
+	nvlist_t *nvroot, **child;
+	uint_t children;
+	boolean_t log;
 	int error;
 
 	mutex_enter(&ztest_vdev_lock);
@@ -2815,12 +2891,25 @@ ztest_vdev_add_remove(ztest_ds_t *zd, uint64_t id)
 		spa_config_exit(spa, SCL_VDEV, FTAG);
 
 		/*
-		 * Make 1/4 of the devices be log devices.
+		 * Make 1/4 of the devices be log devices, and 1/8 of the
+		 * remaining ones special devices.  dRAID log devices are
+		 * not supported, so mirror them instead.
 		 */
-		nvroot = make_vdev_root(NULL, NULL, NULL,
-		    ztest_opts.zo_vdev_size, 0,
-		    ztest_random(4) == 0, ztest_opts.zo_raidz,
-		    zs->zs_mirrors, 1);
+		log = (ztest_random(4) == 0);
+		if (log && ZTEST_DRAID()) {
+			nvroot = make_vdev_root(NULL, NULL, NULL,
+			    ztest_opts.zo_vdev_size, 0, log, 1, 2, 1);
+		} else {
+			nvroot = make_vdev_root(NULL, NULL, NULL,
+			    ztest_opts.zo_vdev_size, 0, log,
+			    ztest_opts.zo_raidz, zs->zs_mirrors, 1);
+		}
+		if (!log && ztest_random(8) == 0) {
+			VERIFY0(nvlist_lookup_nvlist_array(nvroot,
+			    ZPOOL_CONFIG_CHILDREN, &child, &children));
+			VERIFY0(nvlist_add_uint64(child[0],
+			    ZPOOL_CONFIG_IS_SPECIAL, 1));
+		}
 
 		error = spa_vdev_add(spa, nvroot);
 		nvlist_free(nvroot);
@@ -2911,8 +3000,12 @@ ztest_vdev_aux_add_remove(ztest_ds_t *zd, uint64_t id)
 		if (ztest_random(2) == 0)
 			(void) vdev_online(spa, guid, 0, NULL);
 
+		/*
+		 * Distributed spares cannot be removed.
+		 */
 		error = spa_vdev_remove(spa, guid, B_FALSE);
-		if (error != 0 && error != EBUSY)
+		if (error != 0 && error != EBUSY &&
+		    (error != ENOTSUP || !ZTEST_DRAID()))
 			fatal(0, "spa_vdev_remove(%llu) = %d", guid, error);
 	}
 
@@ -2963,7 +3056,8 @@ ztest_split_pool(ztest_ds_t *zd, uint64_t id)
 		nvlist_t **mchild;
 		uint_t mchildren;
 
-		if (tvd->vdev_islog || tvd->vdev_ops == &vdev_hole_ops) {
+		if (tvd->vdev_islog || tvd->vdev_ops == &vdev_hole_ops ||
+		    tvd->vdev_ops == &vdev_indirect_ops) {
 			VERIFY(nvlist_alloc(&schild[schildren], NV_UNIQUE_NAME,
 			    0) == 0);
 			VERIFY(nvlist_add_string(schild[schildren],
@@ -3017,6 +3111,72 @@ ztest_split_pool(ztest_ds_t *zd, uint64_t id)
 
 }
 
+/*
+ * Remove a random top-level vdev, and wait for its data to be copied to
+ * the others.
+ */
+/* ARGSUSED */
+void
+ztest_device_removal(ztest_ds_t *zd, uint64_t id)
+{
+	spa_t *spa = ztest_spa;
+	vdev_t *vd;
+	uint64_t guid, top;
+	int error;
+
+	/*
+	 * Only mirror and disk vdevs of a single ashift can be removed,
+	 * and any vdev added meanwhile must match them.
+	 */
+	if (ztest_opts.zo_raidz > 1 || ztest_opts.zo_ashift == 0)
+		return;
+
+	mutex_enter(&ztest_vdev_lock);
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	top = ztest_random_vdev_top(spa, B_FALSE);
+	vd = spa->spa_root_vdev->vdev_child[top];
+	guid = vd->vdev_guid;
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	error = spa_vdev_remove(spa, guid, B_FALSE);
+
+	/*
+	 * The vdev may be the last one of its class, there may not be
+	 * enough space elsewhere, or it may be degraded by the fault
+	 * injection.
+	 */
+	if (error == ENOSPC)
+		ztest_record_enospc("spa_vdev_remove");
+	else if (error != 0 && error != EINVAL && error != EBUSY)
+		fatal(0, "spa_vdev_remove() = %d", error);
+
+	if (error != 0) {
+		mutex_exit(&ztest_vdev_lock);
+		return;
+	}
+
+	if (ztest_opts.zo_verbose >= 5)
+		(void) printf("removing vdev %llu\n", (u_longlong_t)top);
+
+	ztest_device_removal_active = B_TRUE;
+	while (spa->spa_vdev_removal != NULL)
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+	/*
+	 * Repair any damage which was copied along, before more is done
+	 * at the new offsets.
+	 */
+	if (spa_scan(spa, POOL_SCAN_SCRUB) == 0) {
+		while (spa_get_dsl(spa)->dp_scan->scn_phys.scn_state ==
+		    DSS_SCANNING)
+			txg_wait_synced(spa_get_dsl(spa), 0);
+	}
+	ztest_device_removal_active = B_FALSE;
+
+	mutex_exit(&ztest_vdev_lock);
+}
+
 /*
  * Verify that we can attach and detach devices.
  */
@@ -3039,6 +3199,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	int replacing;
 	int oldvd_has_siblings = B_FALSE;
 	int newvd_is_spare = B_FALSE;
+	int newvd_is_dspare = B_FALSE;
 	int oldvd_is_log;
 	int error, expected_error;
 
@@ -3074,9 +3235,10 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 		ASSERT(oldvd->vdev_children >= zs->zs_mirrors);
 		oldvd = oldvd->vdev_child[leaf / ztest_opts.zo_raidz];
 	}
-	if (ztest_opts.zo_raidz > 1) {
-		ASSERT(oldvd->vdev_ops == &vdev_raidz_ops);
-		ASSERT(oldvd->vdev_children == ztest_opts.zo_raidz);
+	if (ztest_opts.zo_raidz > 1 && !(ZTEST_DRAID() && oldvd->vdev_islog)) {
+		ASSERT(oldvd->vdev_ops == (ZTEST_DRAID() ?
+		    &vdev_draid_ops : &vdev_raidz_ops));
+		ASSERT(oldvd->vdev_children >= ztest_opts.zo_raidz);
 		oldvd = oldvd->vdev_child[leaf % ztest_opts.zo_raidz];
 	}
 
@@ -3116,6 +3278,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	if (sav->sav_count != 0 && ztest_random(3) == 0) {
 		newvd = sav->sav_vdevs[ztest_random(sav->sav_count)];
 		newvd_is_spare = B_TRUE;
+		newvd_is_dspare = (newvd->vdev_ops == &vdev_draid_spare_ops);
 		(void) strcpy(newpath, newvd->vdev_path);
 	} else {
 		(void) snprintf(newpath, MAXPATHLEN, ztest_dev_template,
@@ -3153,6 +3316,9 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 		expected_error = ENOTSUP;
 	else if (newvd_is_spare && (!replacing || oldvd_is_log))
 		expected_error = ENOTSUP;
+	else if (newvd_is_dspare &&
+	    vdev_draid_spare_get_parent(newvd) != oldvd->vdev_top)
+		expected_error = ENOTSUP;
 	else if (newvd == oldvd)
 		expected_error = replacing ? 0 : EBUSY;
 	else if (vdev_lookup_by_path(rvd, newpath) != NULL)
@@ -3171,6 +3337,15 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	 */
 	root = make_vdev_root(newpath, NULL, NULL, newvd == NULL ? newsize : 0,
 	    ashift, 0, 0, 0, 1);
+	if (newvd_is_dspare) {
+		nvlist_t **child;
+		uint_t children;
+
+		VERIFY0(nvlist_lookup_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+		    &child, &children));
+		VERIFY0(nvlist_add_string(child[0], ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_DRAID_SPARE));
+	}
 
 	error = spa_vdev_attach(spa, oldguid, root, replacing);
 
@@ -3205,6 +3380,80 @@ out:
 	umem_free(newpath, MAXPATHLEN);
 }
 
+/*
+ * Widen a random raidz vdev by attaching a new child to it.
+ */
+/* ARGSUSED */
+void
+ztest_vdev_raidz_attach(ztest_ds_t *zd, uint64_t id)
+{
+	ztest_shared_t *zs = ztest_shared;
+	spa_t *spa = ztest_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *tvd;
+	nvlist_t *root;
+	uint64_t leaves, top, guid, ashift, c;
+	uint64_t newsize = 0;
+	char *newpath;
+	int error;
+
+	if (zs->zs_mirrors != 0 || ZTEST_DRAID() || ztest_opts.zo_raidz < 2)
+		return;
+
+	newpath = umem_alloc(MAXPATHLEN, UMEM_NOFAIL);
+
+	mutex_enter(&ztest_vdev_lock);
+	leaves = ztest_opts.zo_raidz;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+
+	top = ztest_random_vdev_top(spa, B_TRUE);
+	tvd = rvd->vdev_child[top];
+
+	/*
+	 * Each top-level vdev gets 2 * leaves names for its new children,
+	 * which is as wide as it is allowed to grow.
+	 */
+	if (tvd->vdev_ops != &vdev_raidz_ops ||
+	    tvd->vdev_children >= 2 * leaves) {
+		spa_config_exit(spa, SCL_VDEV, FTAG);
+		goto out;
+	}
+
+	guid = tvd->vdev_guid;
+	ashift = tvd->vdev_ashift;
+	for (c = 0; c < tvd->vdev_children; c++)
+		newsize = MAX(newsize, tvd->vdev_child[c]->vdev_psize);
+	(void) snprintf(newpath, MAXPATHLEN, ztest_dev_template,
+	    ztest_opts.zo_dir, ztest_opts.zo_pool,
+	    2 * top * leaves + tvd->vdev_children);
+	newpath[strlen(newpath) - 1] = 'x';
+
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	root = make_vdev_root(newpath, NULL, NULL, newsize, ashift, 0, 0, 0, 1);
+
+	error = spa_vdev_attach(spa, guid, root, B_FALSE);
+
+	nvlist_free(root);
+
+	/*
+	 * Another expansion may be in progress, the vdev may be degraded
+	 * by the fault injection, or a child may have grown.
+	 */
+	if (error != 0 && error != EALREADY && error != ENXIO &&
+	    error != ENOTSUP && error != EBUSY && error != EOVERFLOW)
+		fatal(0, "raidz attach (%s) returned %d", newpath, error);
+
+	if (error == 0 && ztest_opts.zo_verbose >= 5)
+		(void) printf("expanding raidz vdev %llu with %s\n",
+		    (u_longlong_t)top, newpath);
+out:
+	mutex_exit(&ztest_vdev_lock);
+
+	umem_free(newpath, MAXPATHLEN);
+}
+
 /*
  * Callback function which expands the physical size of the vdev.
  */
@@ -3464,12 +3713,98 @@ ztest_objset_create_cb(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx)
 	    DMU_OT_ZAP_OTHER, DMU_OT_NONE, 0, tx) == 0);
 }
 
+/*
+ * Raw wrapping key of every encrypted ztest dataset.  They are all
+ * encryption roots directly beneath the pool, so the key can be reloaded
+ * from their name alone after the pool is reopened.
+ */
+static uint8_t ztest_wkeydata[WRAPPING_KEY_LEN] = {
+	'z', 't', 'e', 's', 't', '-', 'w', 'r', 'a', 'p', 'p', 'i', 'n', 'g',
+	'-', 'k', 'e', 'y', '-', '0', '1', '2', '3', '4', '5', '6', '7', '8',
+	'9', 'a', 'b', 'c'
+};
+
+static dsl_crypto_params_t *
+ztest_crypto_params(uint64_t crypt, zfs_keyformat_t keyformat)
+{
+	dsl_crypto_params_t *dcp;
+	nvlist_t *props = fnvlist_alloc();
+	nvlist_t *crypto_args = fnvlist_alloc();
+
+	if (crypt != ZIO_CRYPT_INHERIT) {
+		fnvlist_add_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_ENCRYPTION), crypt);
+	}
+	if (keyformat != ZFS_KEYFORMAT_NONE) {
+		fnvlist_add_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), keyformat);
+	}
+	fnvlist_add_uint8_array(crypto_args, "wkeydata", ztest_wkeydata,
+	    WRAPPING_KEY_LEN);
+
+	VERIFY0(dsl_crypto_params_create_nvlist(DCP_CMD_NONE, props,
+	    crypto_args, &dcp));
+
+	nvlist_free(crypto_args);
+	nvlist_free(props);
+	return (dcp);
+}
+
+/*
+ * Own an objset, loading the key of its encryption root first if it
+ * isn't loaded yet (e.g. because the pool has been reopened).
+ */
+static int
+ztest_dmu_objset_own(const char *name, dmu_objset_type_t type,
+    boolean_t readonly, boolean_t decrypt, void *tag, objset_t **osp)
+{
+	dsl_crypto_params_t *dcp;
+	char ddname[ZFS_MAX_DATASET_NAME_LEN];
+	char *cp;
+	int err;
+
+	err = dmu_objset_own(name, type, readonly, decrypt, tag, osp);
+	if (!decrypt || err != EACCES)
+		return (err);
+
+	(void) strlcpy(ddname, name, sizeof (ddname));
+	cp = strchr(ddname, '/');
+	if (cp == NULL)
+		return (err);
+	cp = strpbrk(cp + 1, "/@");
+	if (cp != NULL)
+		*cp = '\0';
+
+	dcp = ztest_crypto_params(ZIO_CRYPT_INHERIT, ZFS_KEYFORMAT_NONE);
+	err = spa_keystore_load_wkey(ddname, dcp, B_FALSE);
+	dsl_crypto_params_free(dcp, (err != 0));
+	if (err != 0 && err != EEXIST)
+		return (err);
+
+	return (dmu_objset_own(name, type, readonly, decrypt, tag, osp));
+}
+
 static int
 ztest_dataset_create(char *dsname)
 {
 	uint64_t zilset = ztest_random(100);
-	int err = dmu_objset_create(dsname, DMU_OST_OTHER, 0,
+	dsl_crypto_params_t *dcp = NULL;
+	int err;
+
+	/*
+	 * Encrypt half of the datasets, with a random encryption suite,
+	 * if the pool supports it.
+	 */
+	if (spa_feature_is_enabled(ztest_spa, SPA_FEATURE_ENCRYPTION) &&
+	    ztest_random(2) == 0) {
+		dcp = ztest_crypto_params(ZIO_CRYPT_AES_128_CCM +
+		    ztest_random(ZIO_CRYPT_FUNCTIONS - ZIO_CRYPT_AES_128_CCM),
+		    ZFS_KEYFORMAT_RAW);
+	}
+
+	err = dmu_objset_create(dsname, DMU_OST_OTHER, 0, dcp,
 	    ztest_objset_create_cb, NULL);
+	dsl_crypto_params_free(dcp, (err != 0));
 
 	if (err || zilset < 80)
 		return (err);
@@ -3491,7 +3826,8 @@ ztest_objset_destroy_cb(const char *name, void *arg)
 	/*
 	 * Verify that the dataset contains a directory object.
 	 */
-	VERIFY0(dmu_objset_own(name, DMU_OST_OTHER, B_TRUE, FTAG, &os));
+	VERIFY0(ztest_dmu_objset_own(name, DMU_OST_OTHER, B_TRUE, B_TRUE,
+	    FTAG, &os));
 	error = dmu_object_info(os, ZTEST_DIROBJ, &doi);
 	if (error != ENOENT) {
 		/* We could have crashed in the middle of destroying it */
@@ -3499,7 +3835,7 @@ ztest_objset_destroy_cb(const char *name, void *arg)
 		ASSERT3U(doi.doi_type, ==, DMU_OT_ZAP_OTHER);
 		ASSERT3S(doi.doi_physical_blocks_512, >=, 0);
 	}
-	dmu_objset_disown(os, FTAG);
+	dmu_objset_disown(os, B_TRUE, FTAG);
 
 	/*
 	 * Destroy the dataset.
@@ -3575,11 +3911,12 @@ ztest_dmu_objset_create_destroy(ztest_ds_t *zd, uint64_t id)
 	 * (invoked from ztest_objset_destroy_cb()) should just throw it away.
 	 */
 	if (ztest_random(2) == 0 &&
-	    dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, FTAG, &os) == 0) {
+	    ztest_dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, B_TRUE, FTAG,
+	    &os) == 0) {
 		ztest_zd_init(zdtmp, NULL, os);
 		zil_replay(os, zdtmp, ztest_replay_vector);
 		ztest_zd_fini(zdtmp);
-		dmu_objset_disown(os, FTAG);
+		dmu_objset_disown(os, B_TRUE, FTAG);
 	}
 
 	/*
@@ -3593,8 +3930,8 @@ ztest_dmu_objset_create_destroy(ztest_ds_t *zd, uint64_t id)
 	/*
 	 * Verify that the destroyed dataset is no longer in the namespace.
 	 */
-	VERIFY3U(ENOENT, ==, dmu_objset_own(name, DMU_OST_OTHER, B_TRUE,
-	    FTAG, &os));
+	VERIFY3U(ENOENT, ==, ztest_dmu_objset_own(name, DMU_OST_OTHER, B_TRUE,
+	    B_TRUE, FTAG, &os));
 
 	/*
 	 * Verify that we can create a new dataset.
@@ -3608,7 +3945,8 @@ ztest_dmu_objset_create_destroy(ztest_ds_t *zd, uint64_t id)
 		fatal(0, "dmu_objset_create(%s) = %d", name, error);
 	}
 
-	VERIFY0(dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, FTAG, &os));
+	VERIFY0(ztest_dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, B_TRUE,
+	    FTAG, &os));
 
 	ztest_zd_init(zdtmp, NULL, os);
 
@@ -3632,7 +3970,7 @@ ztest_dmu_objset_create_destroy(ztest_ds_t *zd, uint64_t id)
 	 * Verify that we cannot create an existing dataset.
 	 */
 	VERIFY3U(EEXIST, ==,
-	    dmu_objset_create(name, DMU_OST_OTHER, 0, NULL, NULL));
+	    dmu_objset_create(name, DMU_OST_OTHER, 0, NULL, NULL, NULL));
 
 	/*
 	 * Verify that we can hold an objset that is also owned.
@@ -3643,11 +3981,11 @@ ztest_dmu_objset_create_destroy(ztest_ds_t *zd, uint64_t id)
 	/*
 	 * Verify that we cannot own an objset that is already owned.
 	 */
-	VERIFY3U(EBUSY, ==,
-	    dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, FTAG, &os2));
+	VERIFY3U(EBUSY, ==, ztest_dmu_objset_own(name, DMU_OST_OTHER, B_FALSE,
+	    B_TRUE, FTAG, &os2));
 
 	zil_close(zilog);
-	dmu_objset_disown(os, FTAG);
+	dmu_objset_disown(os, B_TRUE, FTAG);
 	ztest_zd_fini(zdtmp);
 out:
 	(void) rw_unlock(&ztest_name_lock);
@@ -3801,19 +4139,20 @@ ztest_dsl_dataset_promote_busy(ztest_ds_t *zd, uint64_t id)
 		fatal(0, "dmu_objset_create(%s) = %d", clone2name, error);
 	}
 
-	error = dmu_objset_own(snap2name, DMU_OST_ANY, B_TRUE, FTAG, &os);
+	error = ztest_dmu_objset_own(snap2name, DMU_OST_ANY, B_TRUE, B_TRUE,
+	    FTAG, &os);
 	if (error)
 		fatal(0, "dmu_objset_own(%s) = %d", snap2name, error);
 	error = dsl_dataset_promote(clone2name, NULL);
 	if (error == ENOSPC) {
-		dmu_objset_disown(os, FTAG);
+		dmu_objset_disown(os, B_TRUE, FTAG);
 		ztest_record_enospc(FTAG);
 		goto out;
 	}
 	if (error != EBUSY)
 		fatal(0, "dsl_dataset_promote(%s), %d, not EBUSY", clone2name,
 		    error);
-	dmu_objset_disown(os, FTAG);
+	dmu_objset_disown(os, B_TRUE, FTAG);
 
 out:
 	ztest_dsl_dataset_cleanup(osname, id);
@@ -5052,6 +5391,12 @@ ztest_spa_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_DEDUPDITTO,
 	    ZIO_DEDUPDITTO_MIN + ztest_random(ZIO_DEDUPDITTO_MIN));
 
+	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_AUTOTRIM, ztest_random(2));
+
+	/* Occasionally trim all of the free space in the loaded metaslabs. */
+	if (ztest_random(4) == 0)
+		(void) spa_trim(ztest_spa, POOL_TRIM_START);
+
 	VERIFY0(spa_prop_get(ztest_spa, &props));
 
 	if (ztest_opts.zo_verbose >= 6)
@@ -5232,6 +5577,10 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 	pathrand = umem_alloc(MAXPATHLEN, UMEM_NOFAIL);
 
 	mutex_enter(&ztest_vdev_lock);
+	if (ztest_device_removal_active || spa->spa_vdev_removal != NULL) {
+		mutex_exit(&ztest_vdev_lock);
+		goto out;
+	}
 	maxfaults = MAXFAULTS();
 	leaves = MAX(zs->zs_mirrors, 1) * ztest_opts.zo_raidz;
 	mirror_save = zs->zs_mirrors;
@@ -5259,6 +5608,28 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 		top = ztest_random_vdev_top(spa, B_TRUE);
 		leaf = ztest_random(leaves) + zs->zs_splits;
 
+		/*
+		 * The rows of a block on an expanded raidz vdev may have
+		 * more than one sector on a child, so it can't take random
+		 * corruption on top of a fault.
+		 */
+		if (spa->spa_root_vdev->vdev_child[top]->vdev_ops ==
+		    &vdev_raidz_ops &&
+		    spa->spa_root_vdev->vdev_child[top]->vdev_tsd != NULL) {
+			spa_config_exit(spa, SCL_STATE, FTAG);
+			(void) rw_unlock(&ztest_name_lock);
+			goto out;
+		}
+
+		/*
+		 * A dRAID vdev permutes its children, so a block's columns
+		 * are not at the same offset on every child and the
+		 * injection ranges below can't keep faults apart.  Only
+		 * ever corrupt its last child instead.
+		 */
+		if (ZTEST_DRAID())
+			leaf = leaves - 1;
+
 		/*
 		 * Generate paths to the first leaf in this top-level vdev,
 		 * and to the random leaf we selected.  We'll induce transient
@@ -5481,6 +5852,10 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	int copies = 2 * ZIO_DEDUPDITTO_MIN;
 	int i;
 
+	/* encrypted blocks are never deduplicated */
+	if (os->os_encrypted)
+		return;
+
 	blocksize = ztest_random_blocksize();
 	blocksize = MIN(blocksize, 2048);	/* because we write so many */
 
@@ -5817,6 +6192,75 @@ ztest_fletcher_incr(ztest_ds_t *zd, uint64_t id)
 	}
 }
 
+/*
+ * Verify that batched SHA-256 and SHA-512 checksums computed by every
+ * implementation match the ICP digest of each buffer.
+ */
+void
+ztest_sha2_batch(ztest_ds_t *zd, uint64_t id)
+{
+	hrtime_t end = gethrtime() + NANOSEC;
+
+	while (gethrtime() <= end) {
+		int run_count = 10;
+		uint_t n = 1 + ztest_random(SHA2_MB_MAX_LANES + 2);
+		void *bufs[SHA2_MB_MAX_LANES + 2];
+		struct abd *abds[SHA2_MB_MAX_LANES + 2];
+		uint64_t sizes[SHA2_MB_MAX_LANES + 2];
+		zio_cksum_t ref256[SHA2_MB_MAX_LANES + 2];
+		zio_cksum_t ref512[SHA2_MB_MAX_LANES + 2];
+		zio_cksum_t zc[SHA2_MB_MAX_LANES + 2];
+		zio_cksum_t *ref;
+		SHA2_CTX ctx;
+		uint_t i, w;
+
+		for (i = 0; i < n; i++) {
+			uint64_t size = ztest_random_blocksize();
+			int *ptr;
+
+			/* odd sizes exercise the partial block handling */
+			if (ztest_random(2) == 0)
+				size -= ztest_random(SHA512_HMAC_BLOCK_SIZE);
+
+			bufs[i] = umem_alloc(size, UMEM_NOFAIL);
+			for (w = 0, ptr = bufs[i]; w < size / sizeof (*ptr);
+			    w++, ptr++)
+				*ptr = ztest_random(UINT_MAX);
+
+			abds[i] = abd_alloc(size, ztest_random(2));
+			abd_copy_from_buf_off(abds[i], bufs[i], 0, size);
+			sizes[i] = size;
+
+			SHA2Init(SHA256, &ctx);
+			SHA2Update(&ctx, bufs[i], size);
+			SHA2Final(&ref256[i], &ctx);
+			for (w = 0, ref = &ref256[i]; w < 4; w++)
+				ref->zc_word[w] = BE_64(ref->zc_word[w]);
+
+			SHA2Init(SHA512_256, &ctx);
+			SHA2Update(&ctx, bufs[i], size);
+			SHA2Final(&ref512[i], &ctx);
+		}
+
+		VERIFY0(sha2_mb_impl_set("cycle"));
+		while (run_count-- > 0) {
+			abd_checksum_SHA256_batch(abds, sizes, n, zc);
+			VERIFY0(bcmp(zc, ref256, n * sizeof (zio_cksum_t)));
+
+			abd_checksum_SHA512_native_batch(abds, sizes, n, zc);
+			VERIFY0(bcmp(zc, ref512, n * sizeof (zio_cksum_t)));
+
+			abd_checksum_SHA256(abds[0], sizes[0], NULL, &zc[0]);
+			VERIFY0(bcmp(&zc[0], &ref256[0], sizeof (zc[0])));
+		}
+
+		for (i = 0; i < n; i++) {
+			umem_free(bufs[i], sizes[i]);
+			abd_free(abds[i]);
+		}
+	}
+}
+
 static int
 ztest_check_path(char *path)
 {
@@ -6191,7 +6635,8 @@ ztest_dataset_open(int d)
 	}
 	ASSERT(error == 0 || error == EEXIST);
 
-	VERIFY0(dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, zd, &os));
+	VERIFY0(ztest_dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, B_TRUE, zd,
+	    &os));
 	(void) rw_unlock(&ztest_name_lock);
 
 	ztest_zd_init(zd, ZTEST_GET_SHARED_DS(d), os);
@@ -6232,7 +6677,7 @@ ztest_dataset_close(int d)
 	ztest_ds_t *zd = &ztest_ds[d];
 
 	zil_close(zd->zd_zilog);
-	dmu_objset_disown(zd->zd_os, zd);
+	dmu_objset_disown(zd->zd_os, B_TRUE, zd);
 
 	ztest_zd_fini(zd);
 }
@@ -6285,12 +6730,12 @@ ztest_run(ztest_shared_t *zs)
 
 	dmu_objset_stats_t dds;
 	VERIFY0(dmu_objset_own(ztest_opts.zo_pool,
-	    DMU_OST_ANY, B_TRUE, FTAG, &os));
+	    DMU_OST_ANY, B_TRUE, B_TRUE, FTAG, &os));
 	dsl_pool_config_enter(dmu_objset_pool(os), FTAG);
 	dmu_objset_fast_stat(os, &dds);
 	dsl_pool_config_exit(dmu_objset_pool(os), FTAG);
 	zs->zs_guid = dds.dds_guid;
-	dmu_objset_disown(os, FTAG);
+	dmu_objset_disown(os, B_TRUE, FTAG);
 
 	spa->spa_dedup_ditto = 2 * ZIO_DEDUPDITTO_MIN;
 
@@ -6447,9 +6892,9 @@ ztest_freeze(void)
 
 	kernel_init(FREAD | FWRITE);
 	VERIFY3U(0, ==, spa_open(ztest_opts.zo_pool, &spa, FTAG));
-	VERIFY3U(0, ==, ztest_dataset_open(0));
 	spa->spa_debug = B_TRUE;
 	ztest_spa = spa;
+	VERIFY3U(0, ==, ztest_dataset_open(0));
 
 	/*
 	 * Force the first log block to be transactionally allocated.
@@ -6516,11 +6961,11 @@ ztest_freeze(void)
 	kernel_init(FREAD | FWRITE);
 	VERIFY3U(0, ==, spa_open(ztest_opts.zo_pool, &spa, FTAG));
 	ASSERT(spa_freeze_txg(spa) == UINT64_MAX);
+	spa->spa_debug = B_TRUE;
+	ztest_spa = spa;
 	VERIFY3U(0, ==, ztest_dataset_open(0));
 	ztest_dataset_close(0);
 
-	spa->spa_debug = B_TRUE;
-	ztest_spa = spa;
 	txg_wait_synced(spa_get_dsl(spa), 0);
 	ztest_reguid(NULL, 0);
 
@@ -0,0 +1,20 @@
+dnl #
+dnl # 4.14 API, lib/zstd was added and exports ZSTD_initCCtx() et al.
+dnl # When available it is used for compression=zstd.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_ZSTD], [
+	AC_MSG_CHECKING([whether kernel provides zstd])
+	ZFS_LINUX_TRY_COMPILE_SYMBOL([
+		#include <linux/zstd.h>
+	], [
+		ZSTD_parameters params = ZSTD_getParams(3, 0, 0);
+		size_t size = ZSTD_CCtxWorkspaceBound(params.cParams);
+		ZSTD_CCtx *cctx __attribute__ ((unused)) =
+		    ZSTD_initCCtx(NULL, size);
+	], [ZSTD_initCCtx], [lib/zstd/compress.c], [
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_KERNEL_ZSTD, 1, [kernel provides lib/zstd])
+	], [
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,14 @@
+dnl #
+dnl # Check for libzstd.  It is optional, when missing compression=zstd
+dnl # is reported as unsupported.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_LIBZSTD], [
+	LIBZSTD=
+
+	AC_CHECK_HEADER([zstd.h], [
+		AC_SEARCH_LIBS([ZSTD_initStaticCCtx], [zstd], [
+			AC_SUBST([LIBZSTD], ["-lzstd"])
+			AC_DEFINE([HAVE_LIBZSTD], 1, [Define if you have libzstd])
+		])
+	])
+])
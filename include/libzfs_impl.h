@@ -32,6 +32,7 @@
 #include <sys/nvpair.h>
 #include <sys/dmu.h>
 #include <sys/zfs_ioctl.h>
+#include <pthread.h>
 
 #include <libuutil.h>
 #include <libzfs.h>
@@ -70,6 +71,12 @@ struct libzfs_handle {
 	void *libzfs_sharehdl; /* libshare handle */
 	uint_t libzfs_shareflags;
 	boolean_t libzfs_mnttab_enable;
+	/*
+	 * libzfs_mnttab_cache_lock protects libzfs_mnttab_cache and the
+	 * libzfs_mnttab FILE, which are used concurrently when datasets
+	 * are mounted in parallel.
+	 */
+	pthread_mutex_t libzfs_mnttab_cache_lock;
 	avl_tree_t libzfs_mnttab_cache;
 	int libzfs_pool_iter;
 #if defined(HAVE_LIBTOPO)
@@ -185,6 +192,7 @@ int create_parents(libzfs_handle_t *, char *, int);
 boolean_t isa_child_of(const char *dataset, const char *parent);
 
 zfs_handle_t *make_dataset_handle(libzfs_handle_t *, const char *);
+int zfs_parent_name(zfs_handle_t *, char *, size_t);
 zfs_handle_t *make_bookmark_handle(zfs_handle_t *, const char *,
     nvlist_t *props);
 
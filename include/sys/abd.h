@@ -67,6 +67,18 @@ typedef struct abd {
 
 typedef int abd_iter_func_t(void *buf, size_t len, void *private);
 typedef int abd_iter_func2_t(void *bufa, void *bufb, size_t len, void *private);
+typedef int abd_iter_multi_func_t(void **bufs, size_t len, void *private);
+
+/*
+ * Upper bound on the number of ABDs abd_iterate_multi_func() maps at once.
+ * Kernels without single argument kmap_atomic() only have a handful of
+ * atomic mapping slots to spare.
+ */
+#if defined(_KERNEL) && !defined(HAVE_1ARG_KMAP_ATOMIC)
+#define	ABD_ITER_MULTI_MAX	6
+#else
+#define	ABD_ITER_MULTI_MAX	8
+#endif
 
 extern int zfs_abd_scatter_enabled;
 
@@ -109,6 +121,8 @@ void abd_release_ownership_of_buf(abd_t *);
 int abd_iterate_func(abd_t *, size_t, size_t, abd_iter_func_t *, void *);
 int abd_iterate_func2(abd_t *, abd_t *, size_t, size_t, size_t,
     abd_iter_func2_t *, void *);
+int abd_iterate_multi_func(abd_t **, const uint64_t *, uint_t,
+    abd_iter_multi_func_t *, void *);
 void abd_copy_off(abd_t *, abd_t *, size_t, size_t, size_t);
 void abd_copy_from_buf_off(abd_t *, const void *, size_t, size_t);
 void abd_copy_to_buf_off(void *, abd_t *, size_t, size_t);
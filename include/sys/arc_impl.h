@@ -169,18 +169,133 @@ typedef struct l1arc_buf_hdr {
 	abd_t			*b_pabd;
 } l1arc_buf_hdr_t;
 
+/*
+ * Persistent L2ARC
+ *
+ * The headers of buffers written to a cache device are recorded on the
+ * device itself so that the L2ARC can be rebuilt when the pool is next
+ * imported, instead of starting out cold.
+ *
+ * The device header is written just after the front vdev labels.  It
+ * holds the state of the write and evict hands and a pointer to the most
+ * recently written log block.  Log blocks are written in line with the
+ * data as the write hand sweeps the device.  Each one describes up to
+ * L2ARC_LOG_BLK_MAX_ENTRIES buffers and points to the log block written
+ * before it, forming a chain from the newest to the oldest:
+ *
+ *	+-----+-----------+----+-----------+----+-----------+----
+ *	| dev |  payload  | LB |  payload  | LB |  payload  | ...
+ *	| hdr |           | 1  |           | 2  |           |
+ *	+-----+-----------+----+-----------+----+-----------+----
+ *	   |                ^                |  ^
+ *	   |                +----------------+  |
+ *	   +------------------------------------+
+ *
+ * A log block is written along with its payload, and the device header
+ * is rewritten once the whole batch has completed, so it only ever points
+ * at log blocks whose payload is on stable storage.  Log blocks are
+ * checksummed and optionally compressed.  Buffers read back through a
+ * restored header are verified against the block pointer's checksum like
+ * any other L2ARC read, so stale entries are harmless.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534341434845LLU	/* ASCII: "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844LLU	/* ASCII: "LOGBLKHD" */
+#define	L2ARC_PERSISTENT_VERSION	1
+
+/* Set in dh_flags while the write hand is on its first sweep */
+#define	L2ARC_DEV_HDR_EVICT_FIRST	(1ULL << 0)
+
+/*
+ * Log block pointer.  lbp_prop holds the logical (uncompressed) and
+ * allocated size of the log block, and its compression and checksum
+ * functions.  The payload fields describe the range of the device that
+ * holds the buffers the log block refers to.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address of log block */
+	uint64_t	lbp_payload_asize;	/* aligned size of payload */
+	uint64_t	lbp_payload_start;	/* device address of payload */
+	uint64_t	lbp_prop;
+	zio_cksum_t	lbp_cksum;		/* fletcher4 of log block */
+} l2arc_log_blkptr_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;		/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t	dh_version;		/* L2ARC_PERSISTENT_VERSION */
+	uint64_t	dh_spa_guid;
+	uint64_t	dh_vdev_guid;
+	uint64_t	dh_flags;		/* L2ARC_DEV_HDR_* */
+	uint64_t	dh_start;		/* mirror of l2ad_start */
+	uint64_t	dh_end;			/* mirror of l2ad_end */
+	uint64_t	dh_evict;		/* mirror of l2ad_evict */
+	l2arc_log_blkptr_t dh_start_lbp;	/* newest log block */
+	uint64_t	dh_pad[43];		/* pad to 512 bytes */
+	zio_eck_t	dh_tail;
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * A log entry describes one buffer on the device.  le_prop holds the
+ * buffer's logical and physical size, compression, type and whether
+ * its data is stored as it is on the main pool (ARC_FLAG_COMPRESSED_ARC).
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;			/* dva of buffer */
+	uint64_t	le_birth;		/* birth txg of buffer */
+	uint64_t	le_prop;
+	uint64_t	le_daddr;		/* device address of buffer */
+	uint64_t	le_pad[3];		/* pad to 64 bytes */
+} l2arc_log_ent_phys_t;
+
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	1022
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log block */
+	uint64_t		lb_pad[7];	/* pad to 128 bytes */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;				/* 64K total */
+
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	BF64_GET((field), 32, SPA_COMPRESSBITS)
+#define	L2BLK_SET_COMPRESS(field, x)	BF64_SET((field), 32, SPA_COMPRESSBITS, x)
+#define	L2BLK_GET_CHECKSUM(field)	BF64_GET((field), 40, 8)
+#define	L2BLK_SET_CHECKSUM(field, x)	BF64_SET((field), 40, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_COMPRESSED_ARC(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_COMPRESSED_ARC(field, x) BF64_SET((field), 56, 1, x)
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
 	uint64_t		l2ad_hand;	/* next write location */
 	uint64_t		l2ad_start;	/* first addr on device */
 	uint64_t		l2ad_end;	/* last addr on device */
+	uint64_t		l2ad_evict;	/* last addr evicted */
 	boolean_t		l2ad_first;	/* first sweep through */
 	boolean_t		l2ad_writing;	/* currently writing */
 	kmutex_t		l2ad_mtx;	/* lock for buffer list */
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	refcount_t		l2ad_alloc;	/* allocated bytes */
+	/* persistent L2ARC state, owned by the feed or rebuild thread */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* in-core device header */
+	uint64_t		l2ad_dev_hdr_asize; /* aligned hdr size */
+	l2arc_log_blk_phys_t	*l2ad_log_blk;	/* log block being built */
+	int			l2ad_log_ent_idx; /* next entry in log block */
+	uint64_t		l2ad_log_blk_payload_asize;
+	uint64_t		l2ad_log_blk_payload_start;
+	/* protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild pending or running */
+	boolean_t		l2ad_rebuild_began; /* rebuild thread started */
+	boolean_t		l2ad_rebuild_cancel; /* stop rebuilding */
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
@@ -195,8 +310,14 @@ typedef struct l2arc_buf_hdr {
 typedef struct l2arc_write_callback {
 	l2arc_dev_t	*l2wcb_dev;		/* device info */
 	arc_buf_hdr_t	*l2wcb_head;		/* head of write buflist */
+	list_t		l2wcb_abd_list;		/* log blocks being written */
 } l2arc_write_callback_t;
 
+typedef struct l2arc_lb_abd_buf {
+	abd_t		*lbb_abd;		/* log block buffer */
+	list_node_t	lbb_node;
+} l2arc_lb_abd_buf_t;
+
 struct arc_buf_hdr {
 	/* protected by hash lock */
 	dva_t			b_dva;
@@ -146,6 +146,16 @@ typedef struct dbuf_dirty_record {
 			override_states_t dr_override_state;
 			uint8_t dr_copies;
 			boolean_t dr_nopwrite;
+
+			/*
+			 * Set when dr_data holds an already encrypted block
+			 * (from a raw receive), along with the parameters
+			 * needed to decrypt it.
+			 */
+			boolean_t dr_has_raw_params;
+			uint8_t dr_salt[ZIO_DATA_SALT_LEN];
+			uint8_t dr_iv[ZIO_DATA_IV_LEN];
+			uint8_t dr_mac[ZIO_DATA_MAC_LEN];
 		} dl;
 	} dt;
 } dbuf_dirty_record_t;
@@ -261,13 +271,34 @@ typedef struct dmu_buf_impl {
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
-#define	DBUF_MUTEXES 8192
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module
+ *
+ * The table is striped over DBUF_HASH_LOCKS reader/writer locks.  A
+ * bucket is covered by the lock selected by the low bits of its index,
+ * so a bucket and all the buckets it is rehashed into when the table is
+ * resized share a lock.  Each lock caches the table and mask in use for
+ * its buckets, which lets the table be resized one stripe at a time.
+ */
+#define	DBUF_HASH_LOCKS 8192
+#define	DBUF_HASH_LOCK_ALIGN 64
+#define	DBUF_HASH_LOCK_PAD (P2NPHASE(sizeof (krwlock_t) + \
+	sizeof (void *) + sizeof (uint64_t), DBUF_HASH_LOCK_ALIGN))
+typedef struct dbuf_hash_lock {
+	krwlock_t dhl_lock;
+	struct dmu_buf_impl **dhl_table;	/* table for this stripe */
+	uint64_t dhl_mask;			/* mask of dhl_table */
+#ifdef _KERNEL
+	unsigned char dhl_pad[DBUF_HASH_LOCK_PAD];
+#endif
+} dbuf_hash_lock_t;
+
+#define	DBUF_HASH_LOCK(h, hv) (&(h)->hash_locks[(hv) & (DBUF_HASH_LOCKS-1)])
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	kmutex_t hash_resize_lock;
+	dbuf_hash_lock_t hash_locks[DBUF_HASH_LOCKS];
 } dbuf_hash_table_t;
 
 uint64_t dbuf_whichblock(const struct dnode *di, const int64_t level,
@@ -300,10 +331,14 @@ dmu_buf_impl_t *dbuf_find(struct objset *os, uint64_t object, uint8_t level,
     uint64_t blkid);
 
 int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
+int dbuf_read_missed(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
+    boolean_t *missedp);
 void dmu_buf_will_not_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
 void dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx);
+void dbuf_set_raw_params(dmu_buf_impl_t *db, const uint8_t *salt,
+    const uint8_t *iv, const uint8_t *mac, dmu_tx_t *tx);
 dbuf_dirty_record_t *dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx);
 arc_buf_t *dbuf_loan_arcbuf(dmu_buf_impl_t *db);
 void dmu_buf_write_embedded(dmu_buf_t *dbuf, void *data,
@@ -334,6 +369,7 @@ void dbuf_init(void);
 void dbuf_fini(void);
 
 boolean_t dbuf_is_metadata(dmu_buf_impl_t *db);
+boolean_t dbuf_is_encrypted(dmu_buf_impl_t *db);
 
 #define	DBUF_GET_BUFC_TYPE(_db)	\
 	(dbuf_is_metadata(_db) ? ARC_BUFC_METADATA : ARC_BUFC_DATA)
@@ -343,10 +379,12 @@ boolean_t dbuf_is_metadata(dmu_buf_impl_t *db);
 	(dbuf_is_metadata(_db) &&					\
 	((_db)->db_objset->os_primary_cache == ZFS_CACHE_METADATA)))
 
+/* encrypted blocks are never written to cache devices in the clear */
 #define	DBUF_IS_L2CACHEABLE(_db)					\
+	(!dbuf_is_encrypted(_db) &&					\
 	((_db)->db_objset->os_secondary_cache == ZFS_CACHE_ALL ||	\
 	(dbuf_is_metadata(_db) &&					\
-	((_db)->db_objset->os_secondary_cache == ZFS_CACHE_METADATA)))
+	((_db)->db_objset->os_secondary_cache == ZFS_CACHE_METADATA))))
 
 #ifdef ZFS_DEBUG
 
@@ -53,8 +53,8 @@ extern "C" {
  *
  * XXX try to improve evicting path?
  *
- * dp_config_rwlock > os_obj_lock > dn_struct_rwlock >
- * 	dn_dbufs_mtx > hash_mutexes > db_mtx > dd_lock > leafs
+ * dp_config_rwlock > doa_lock > os_obj_lock > dn_struct_rwlock >
+ * 	dn_dbufs_mtx > hash_locks > db_mtx > dd_lock > leafs
  *
  * dp_config_rwlock
  *    must be held before: everything
@@ -67,16 +67,25 @@ extern "C" {
  *    	dsl_dir_rename_sync/w:
  *    	dsl_prop_changed_notify/r:
  *
- * os_obj_lock
+ * doa_lock
  *   must be held before:
  *   	everything except dp_config_rwlock
- *   protects os_obj_next
+ *   protects doa_next, doa_end of one per-CPU object allocator
+ *   held from:
+ *   	dmu_object_alloc: os_obj_lock, dn_dbufs_mtx, db_mtx, hash_locks,
+ *   	    dn_struct_rwlock
+ *
+ * os_obj_lock
+ *   must be held before:
+ *   	everything except dp_config_rwlock and doa_lock
+ *   protects os_obj_next, the start of the next unclaimed chunk
  *   held from:
- *   	dmu_object_alloc: dn_dbufs_mtx, db_mtx, hash_mutexes, dn_struct_rwlock
+ *   	dmu_object_alloc_refill: dn_dbufs_mtx, db_mtx, hash_locks,
+ *   	    dn_struct_rwlock
  *
  * dn_struct_rwlock
  *   must be held before:
- *   	everything except dp_config_rwlock and os_obj_lock
+ *   	everything except dp_config_rwlock, doa_lock and os_obj_lock
  *   protects structure of dnode (eg. nlevels)
  *   	db_blkptr can change when syncing out change to nlevels
  *   	dn_maxblkid
@@ -91,9 +100,9 @@ extern "C" {
  *   	dbuf_new_size: db_mtx
  *   	dbuf_dirty: db_mtx
  *	dbuf_findbp: (callers, phys? - the real need)
- *	dbuf_create: dn_dbufs_mtx, hash_mutexes, db_mtx (phys?)
- *	dbuf_prefetch: dn_dirty_mtx, hash_mutexes, db_mtx, dn_dbufs_mtx
- *	dbuf_hold_impl: hash_mutexes, db_mtx, dn_dbufs_mtx, dbuf_findbp()
+ *	dbuf_create: dn_dbufs_mtx, hash_locks, db_mtx (phys?)
+ *	dbuf_prefetch: dn_dirty_mtx, hash_locks, db_mtx, dn_dbufs_mtx
+ *	dbuf_hold_impl: hash_locks, db_mtx, dn_dbufs_mtx, dbuf_findbp()
  *	dnode_sync/w (increase_indirection): db_mtx (phys)
  *	dnode_set_blksz/w: dn_dbufs_mtx (dn_*blksz*)
  *	dnode_new_blkid/w: (dn_maxblkid)
@@ -102,7 +111,7 @@ extern "C" {
  *
  * dn_dbufs_mtx
  *    must be held before:
- *    	db_mtx, hash_mutexes
+ *    	db_mtx, hash_locks
  *    protects:
  *    	dn_dbufs
  *    	dn_evicted
@@ -110,14 +119,15 @@ extern "C" {
  *    	dmu_evict_user: db_mtx (dn_dbufs)
  *    	dbuf_free_range: db_mtx (dn_dbufs)
  *    	dbuf_remove_ref: db_mtx, callees:
- *    		dbuf_hash_remove: hash_mutexes, db_mtx
- *    	dbuf_create: hash_mutexes, db_mtx (dn_dbufs)
+ *    		dbuf_hash_remove: hash_locks, db_mtx
+ *    	dbuf_create: hash_locks, db_mtx (dn_dbufs)
  *    	dnode_set_blksz: (dn_dbufs)
  *
- * hash_mutexes (global)
+ * hash_locks (global)
  *   must be held before:
  *   	db_mtx
- *   protects dbuf_hash_table (global) and db_hash_next
+ *   protects dbuf_hash_table (global) and db_hash_next; held as
+ *   reader for lookups and as writer for insertion and removal
  *   held from:
  *   	dbuf_find: db_mtx
  *   	dbuf_hash_insert: db_mtx
@@ -58,6 +58,17 @@ struct dmu_tx;
 #define	OBJSET_FLAG_USERACCOUNTING_COMPLETE	(1ULL<<0)
 #define	OBJSET_FLAG_USEROBJACCOUNTING_COMPLETE	(1ULL<<1)
 
+/*
+ * Each CPU allocates new objects from its own chunk of the object number
+ * space, see dmu_object_alloc_dnsize().  The chunk is [doa_next, doa_end);
+ * it is owned while doa_next < doa_end and is refilled from os_obj_next.
+ */
+typedef struct dmu_obj_alloc {
+	kmutex_t	doa_lock;
+	uint64_t	doa_next;	/* next object to try */
+	uint64_t	doa_end;	/* end of this CPU's chunk */
+} dmu_obj_alloc_t;
+
 typedef struct objset_phys {
 	dnode_phys_t os_meta_dnode;
 	zil_header_t os_zil_header;
@@ -94,6 +105,7 @@ struct objset {
 	uint64_t os_dnodesize; /* default dnode size for new objects */
 	enum zio_checksum os_checksum;
 	enum zio_compress os_compress;
+	uint64_t os_complevel;
 	uint8_t os_copies;
 	enum zio_checksum os_dedup_checksum;
 	boolean_t os_dedup_verify;
@@ -103,6 +115,7 @@ struct objset {
 	zfs_sync_type_t os_sync;
 	zfs_redundant_metadata_type_t os_redundant_metadata;
 	int os_recordsize;
+	uint64_t os_zpl_special_smallblock;
 
 	/*
 	 * Pointer is constant; the blkptr it points to is protected by
@@ -112,6 +125,7 @@ struct objset {
 
 	/* no lock needed: */
 	struct dmu_tx *os_synctx; /* XXX sketchy */
+	boolean_t os_encrypted; /* user data is encrypted */
 	zil_header_t os_zil_header;
 	list_t os_synced_dnodes;
 	uint64_t os_flags;
@@ -122,6 +136,10 @@ struct objset {
 	kmutex_t os_obj_lock;
 	uint64_t os_obj_next;
 
+	/* Per-CPU object allocators, each protected by its doa_lock */
+	dmu_obj_alloc_t *os_obj_alloc;
+	int os_obj_alloc_count;
+
 	/* Protected by os_lock */
 	kmutex_t os_lock;
 	list_t os_dirty_dnodes[TXG_SIZE];
@@ -156,12 +174,13 @@ struct objset {
 /* called from zpl */
 int dmu_objset_hold(const char *name, void *tag, objset_t **osp);
 int dmu_objset_own(const char *name, dmu_objset_type_t type,
-    boolean_t readonly, void *tag, objset_t **osp);
+    boolean_t readonly, boolean_t decrypt, void *tag, objset_t **osp);
 int dmu_objset_own_obj(struct dsl_pool *dp, uint64_t obj,
-    dmu_objset_type_t type, boolean_t readonly, void *tag, objset_t **osp);
+    dmu_objset_type_t type, boolean_t readonly, boolean_t decrypt,
+    void *tag, objset_t **osp);
 void dmu_objset_refresh_ownership(objset_t *os, void *tag);
 void dmu_objset_rele(objset_t *os, void *tag);
-void dmu_objset_disown(objset_t *os, void *tag);
+void dmu_objset_disown(objset_t *os, boolean_t decrypt, void *tag);
 int dmu_objset_from_ds(struct dsl_dataset *ds, objset_t **osp);
 
 void dmu_objset_stats(objset_t *os, nvlist_t *nv);
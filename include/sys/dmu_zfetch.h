@@ -50,6 +50,27 @@ typedef struct zstream {
 	 */
 	uint64_t	zs_ipf_blkid;
 
+	/*
+	 * Forward streams read block after block.  Backward streams read
+	 * the blocks right before their last access; zs_blkid is then where
+	 * the next access should end, and zs_pf_blkid the lowest block
+	 * prefetched.  Strided streams read zs_nblks blocks every
+	 * zs_stride blocks.
+	 */
+	boolean_t	zs_backward;
+	uint64_t	zs_stride;	/* blocks between accesses, or 0 */
+	uint64_t	zs_nblks;	/* blocks in the last access */
+	uint64_t	zs_last_blkid;	/* start of the last access */
+
+	/*
+	 * How far ahead the stream prefetches; grown as prefetched blocks
+	 * are found in memory, shrunk when they were evicted before use.
+	 */
+	uint64_t	zs_max_dist;	/* bytes */
+	uint64_t	zs_accesses;	/* accesses matching the stream */
+	uint64_t	zs_useful;	/* ... found prefetched in memory */
+	uint64_t	zs_wasted;	/* ... prefetched but evicted */
+
 	kmutex_t	zs_lock;	/* protects stream */
 	hrtime_t	zs_atime;	/* time last prefetch issued */
 	list_node_t	zs_node;	/* link for zf_stream */
@@ -66,7 +87,8 @@ void		zfetch_fini(void);
 
 void		dmu_zfetch_init(zfetch_t *, struct dnode *);
 void		dmu_zfetch_fini(zfetch_t *);
-void		dmu_zfetch(zfetch_t *, uint64_t, uint64_t, boolean_t);
+void		dmu_zfetch(zfetch_t *, uint64_t, uint64_t, boolean_t,
+		    boolean_t);
 
 
 #ifdef	__cplusplus
@@ -0,0 +1,174 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_DSL_CRYPT_H
+#define	_SYS_DSL_CRYPT_H
+
+#include <sys/dmu_tx.h>
+#include <sys/dmu.h>
+#include <sys/zio_crypt.h>
+#include <sys/spa.h>
+#include <sys/dsl_dataset.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * ZAP entries of a DSL crypto key object.  The key object of an
+ * encryption root also records how its wrapping key is derived.
+ */
+#define	DSL_CRYPTO_KEY_CRYPTO_SUITE	"DSL_CRYPTO_SUITE"
+#define	DSL_CRYPTO_KEY_GUID		"DSL_CRYPTO_GUID"
+#define	DSL_CRYPTO_KEY_IV		"DSL_CRYPTO_IV"
+#define	DSL_CRYPTO_KEY_MAC		"DSL_CRYPTO_MAC"
+#define	DSL_CRYPTO_KEY_MASTER_KEY	"DSL_CRYPTO_MASTER_KEY_1"
+#define	DSL_CRYPTO_KEY_ROOT_DDOBJ	"DSL_CRYPTO_ROOT_DDOBJ"
+#define	DSL_CRYPTO_KEY_REFCOUNT		"DSL_CRYPTO_REFCOUNT"
+
+/* a wrapping key, loaded for an encryption root */
+typedef struct dsl_wrapping_key {
+	/* link into the keystore's tree of wrapping keys */
+	avl_node_t wk_avl_link;
+
+	/* actual wrapping key */
+	crypto_key_t wk_key;
+	uint8_t wk_keydata[WRAPPING_KEY_LEN];
+
+	/* how the key was derived, recorded on the encryption root */
+	zfs_keyformat_t wk_keyformat;
+	uint64_t wk_salt;
+	uint64_t wk_iters;
+
+	/* holds from dsl crypto keys and in-progress operations */
+	refcount_t wk_refcnt;
+
+	/* dsl directory object of the encryption root */
+	uint64_t wk_ddobj;
+} dsl_wrapping_key_t;
+
+/*
+ * Encryption parameters passed in by the user when creating a dataset or
+ * changing its key.
+ */
+typedef struct dsl_crypto_params {
+	dcp_cmd_t cp_cmd;
+
+	/* the encryption suite, or ZIO_CRYPT_INHERIT */
+	enum zio_encrypt cp_crypt;
+
+	/* the wrapping key, if one was provided */
+	dsl_wrapping_key_t *cp_wkey;
+} dsl_crypto_params_t;
+
+/* an unwrapped master key, loaded for a DSL crypto key object */
+typedef struct dsl_crypto_key {
+	/* link into the keystore's tree of dsl crypto keys */
+	avl_node_t dck_avl_link;
+
+	/* holds from key mappings and in-progress I/O */
+	refcount_t dck_holds;
+
+	/* the wrapping key the master key was unwrapped with */
+	dsl_wrapping_key_t *dck_wkey;
+
+	/* the master key and its derived keys */
+	zio_crypt_key_t dck_key;
+
+	/* DSL crypto key object this key was loaded from */
+	uint64_t dck_obj;
+} dsl_crypto_key_t;
+
+/*
+ * Maps a dataset to its loaded dsl crypto key, which is what the zio
+ * pipeline uses to find the key of a block from its bookmark.
+ */
+typedef struct dsl_key_mapping {
+	/* link into the keystore's tree of key mappings */
+	avl_node_t km_avl_link;
+
+	/* holds from dataset owners and from dirty data being synced */
+	refcount_t km_refcnt;
+
+	/* dataset this mapping is for */
+	uint64_t km_dsobj;
+
+	/* the key the dataset's blocks are encrypted with */
+	dsl_crypto_key_t *km_key;
+} dsl_key_mapping_t;
+
+/* in-memory keys of a pool */
+typedef struct spa_keystore {
+	/* lock and tree of loaded dsl crypto keys */
+	krwlock_t sk_dk_lock;
+	avl_tree_t sk_dsl_keys;
+
+	/* lock and tree of key mappings */
+	krwlock_t sk_km_lock;
+	avl_tree_t sk_key_mappings;
+
+	/* lock and tree of loaded wrapping keys */
+	krwlock_t sk_wkeys_lock;
+	avl_tree_t sk_wkeys;
+} spa_keystore_t;
+
+int dsl_crypto_params_create_nvlist(dcp_cmd_t cmd, nvlist_t *props,
+    nvlist_t *crypto_args, dsl_crypto_params_t **dcp_out);
+void dsl_crypto_params_free(dsl_crypto_params_t *dcp, boolean_t unload);
+
+void spa_keystore_init(spa_keystore_t *sk);
+void spa_keystore_fini(spa_keystore_t *sk);
+
+int spa_keystore_load_wkey(const char *dsname, dsl_crypto_params_t *dcp,
+    boolean_t noop);
+int spa_keystore_unload_wkey(const char *dsname);
+int spa_keystore_change_key(const char *dsname, dsl_crypto_params_t *dcp);
+
+int spa_keystore_create_mapping(spa_t *spa, struct dsl_dataset *ds,
+    void *tag);
+int spa_keystore_hold_mapping(spa_t *spa, uint64_t dsobj, void *tag);
+void spa_keystore_remove_mapping(spa_t *spa, uint64_t dsobj, void *tag);
+int spa_keystore_lookup_key(spa_t *spa, uint64_t dsobj, void *tag,
+    dsl_crypto_key_t **dck_out);
+void spa_keystore_dsl_key_rele(spa_t *spa, dsl_crypto_key_t *dck, void *tag);
+
+zfs_keystatus_t dsl_dataset_get_keystatus(struct dsl_dir *dd);
+int dsl_dir_get_encryption_root_ddobj(struct dsl_dir *dd, uint64_t *rddobj);
+void dsl_dataset_crypt_stats(struct dsl_dataset *ds, nvlist_t *nv);
+
+int dmu_objset_create_crypt_check(struct dsl_dir *parentdd,
+    struct dsl_dataset *origin, dsl_crypto_params_t *dcp);
+void dsl_dataset_create_crypt_sync(uint64_t dsobj, struct dsl_dir *dd,
+    struct dsl_dataset *origin, dsl_crypto_params_t *dcp, dmu_tx_t *tx);
+int dsl_dir_destroy_crypt_check(struct dsl_dir *dd);
+void dsl_dir_destroy_crypt(struct dsl_dir *dd, dmu_tx_t *tx);
+int dsl_crypt_rename_check(struct dsl_dir *dd, struct dsl_dir *newparent);
+int dsl_crypto_can_set_keylocation(const char *dsname, const char *keylocation);
+
+int dsl_crypto_populate_key_nvlist(struct dsl_dataset *ds, nvlist_t **nvl_out);
+int dsl_crypto_recv_key(const char *poolname, uint64_t dsobj,
+    nvlist_t *nvl);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DSL_CRYPT_H */
@@ -47,6 +47,7 @@ struct dsl_dataset;
 
 #define	DD_FIELD_FILESYSTEM_COUNT	"com.joyent:filesystem_count"
 #define	DD_FIELD_SNAPSHOT_COUNT		"com.joyent:snapshot_count"
+#define	DD_FIELD_CRYPTO_KEY_OBJ		"com.datto:crypto_key_obj"
 
 typedef enum dd_used {
 	DD_USED_HEAD,
@@ -94,6 +95,9 @@ struct dsl_dir {
 	/* Stable until user eviction; no lock needed: */
 	dmu_buf_t *dd_dbuf;
 
+	/* DSL crypto key object, or 0 if unencrypted; protected by the tx */
+	uint64_t dd_crypto_obj;
+
 	/* protected by lock on pool's dp_dirty_dirs list */
 	txg_node_t dd_dirty_link;
 
@@ -92,6 +92,7 @@ typedef struct dsl_pool {
 	struct dsl_dataset *dp_origin_snap;
 	uint64_t dp_root_dir_obj;
 	struct taskq *dp_iput_taskq;
+	struct taskq *dp_zil_clean_taskq;
 
 	/* No lock needed - sync context only */
 	blkptr_t dp_meta_rootbp;
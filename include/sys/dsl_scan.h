@@ -98,6 +98,11 @@ typedef enum dsl_scan_flags {
  *			the scan but have not yet been processed (i.e deferred
  *			frees) are accounted for.
  *
+ * scn_sorted -		scrub/resilver reads discovered by the traversal are
+ *			queued per top-level vdev in scn_queues, sorted by
+ *			offset, rather than being issued immediately.  The
+ *			queues are drained before the scan state is synced.
+ *
  * This structure also maintains information about deferred frees which are
  * a special kind of traversal. Deferred free can exist in either a bptree or
  * a bpobj structure. The scn_is_bptree flag will indicate the type of
@@ -118,6 +123,11 @@ typedef struct dsl_scan {
 	boolean_t scn_async_destroying;
 	boolean_t scn_async_stalled;
 
+	/* for sorted scrub/resilver i/o */
+	boolean_t scn_sorted;
+	avl_tree_t scn_queues;
+	uint64_t scn_queues_mem;
+
 	/* for debugging / information */
 	uint64_t scn_visited_this_txg;
 
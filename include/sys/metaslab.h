@@ -55,6 +55,10 @@ void metaslab_unload(metaslab_t *);
 void metaslab_sync(metaslab_t *, uint64_t);
 void metaslab_sync_done(metaslab_t *, uint64_t);
 void metaslab_sync_reassess(metaslab_group_t *);
+void metaslab_recalculate_weight_and_sort(metaslab_t *);
+void metaslab_unflushed_replay(metaslab_t *, maptype_t, uint64_t, uint64_t);
+void metaslab_trim_all(metaslab_t *, uint64_t);
+void metaslab_trim_cancel(metaslab_t *);
 uint64_t metaslab_block_maxsize(metaslab_t *);
 
 #define	METASLAB_HINTBP_FAVOR		0x0
@@ -68,6 +72,8 @@ uint64_t metaslab_block_maxsize(metaslab_t *);
 int metaslab_alloc(spa_t *, metaslab_class_t *, uint64_t,
     blkptr_t *, int, uint64_t, blkptr_t *, int, zio_alloc_list_t *, zio_t *);
 void metaslab_free(spa_t *, const blkptr_t *, uint64_t, boolean_t);
+void metaslab_free_concrete(vdev_t *, uint64_t, uint64_t, uint64_t,
+    boolean_t);
 int metaslab_claim(spa_t *, const blkptr_t *, uint64_t);
 void metaslab_check_free(spa_t *, const blkptr_t *);
 void metaslab_fastwrite_mark(spa_t *, const blkptr_t *);
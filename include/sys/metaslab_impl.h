@@ -329,9 +329,49 @@ struct metaslab {
 	range_tree_t	*ms_freedtree; /* already freed this syncing txg */
 	range_tree_t	*ms_defertree[TXG_DEFER_SIZE];
 
+	/*
+	 * Free space waiting to be trimmed.  ms_trim holds the pending
+	 * ranges and ms_trimming the ranges with trims in flight.  Neither
+	 * is part of ms_tree, so the space can't be allocated until it has
+	 * been discarded.  ms_trim_cv is signalled when ms_trimming empties.
+	 */
+	range_tree_t	*ms_trim;
+	range_tree_t	*ms_trimming;
+	kcondvar_t	ms_trim_cv;
+
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
 
+	/*
+	 * With the log_spacemap feature the changes of a metaslab are
+	 * appended to the pool-wide log space map of each txg instead
+	 * of to ms_sm.  ms_unflushed_allocs and ms_unflushed_frees hold
+	 * the net effect of all the logged changes that ms_sm doesn't
+	 * reflect yet, i.e. the ones logged after ms_unflushed_txg.  A
+	 * flush writes them out to ms_sm and advances ms_unflushed_txg;
+	 * ms_flush_wanted asks for a flush in the next sync and
+	 * ms_flushing marks a flush whose in-core trees are vacated in
+	 * metaslab_sync_done().  ms_unflushed_node links the metaslab
+	 * into spa_metaslabs_by_flushed, which is protected by the
+	 * spa_flushed_ms_lock.
+	 */
+	range_tree_t	*ms_unflushed_allocs;
+	range_tree_t	*ms_unflushed_frees;
+	uint64_t	ms_unflushed_txg;
+	boolean_t	ms_unflushed_tracked;
+	boolean_t	ms_flush_wanted;
+	boolean_t	ms_flushing;
+	avl_node_t	ms_unflushed_node;
+
+	/*
+	 * Space allocated in this metaslab as of the last synced txg,
+	 * including the unflushed changes, and the net change of the
+	 * txg being synced.  Without log space maps these track
+	 * space_map_allocated() and space_map_alloc_delta() of ms_sm.
+	 */
+	uint64_t	ms_allocated_space;
+	int64_t		ms_allocated_this_txg;
+
 	/*
 	 * We must hold both ms_lock and ms_group->mg_lock in order to
 	 * modify ms_loaded.
@@ -0,0 +1,80 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SHA2_MB_H
+#define	_SYS_SHA2_MB_H
+
+#include <sys/types.h>
+#include <sys/sha2.h>
+#include <sys/spa_checksum.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct abd;
+
+/*
+ * Multi-buffer SHA-2 interface
+ *
+ * An implementation hashes whole 64 byte (SHA-256) or 128 byte (SHA-512)
+ * blocks of several independent messages per call. Each message is tracked
+ * by its own SHA2_CTX; implementations only update the chaining state in
+ * ctx->state, partial blocks and padding are always handled by SHA2Update()
+ * and SHA2Final().
+ */
+#define	SHA2_MB_MAX_LANES	8
+
+typedef void (*sha2_mb_blocks_f)(SHA2_CTX **, const uint8_t **, uint_t,
+    size_t);
+
+typedef struct sha2_mb_ops {
+	sha2_mb_blocks_f sha256_blocks;	/* NULL: use SHA2Update() */
+	uint_t sha256_lanes;		/* messages hashed per call */
+	sha2_mb_blocks_f sha512_blocks;	/* NULL: use SHA2Update() */
+	uint_t sha512_lanes;		/* messages hashed per call */
+	boolean_t (*valid)(void);
+	const char *name;
+} sha2_mb_ops_t;
+
+extern const uint32_t sha256_mb_k[64];
+extern const uint64_t sha512_mb_k[80];
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+extern const sha2_mb_ops_t sha2_mb_avx2_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+extern const sha2_mb_ops_t sha2_mb_shani_ops;
+#endif
+
+void sha2_mb_init(void);
+void sha2_mb_fini(void);
+int sha2_mb_impl_set(const char *);
+uint_t sha2_mb_lanes(uint64_t);
+void sha2_mb_abd(uint64_t, struct abd **, const uint64_t *, uint_t,
+    zio_cksum_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SHA2_MB_H */
@@ -33,8 +33,11 @@
 #include <sys/spa.h>
 #include <sys/vdev.h>
 #include <sys/metaslab.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/vdev_removal.h>
 #include <sys/dmu.h>
 #include <sys/dsl_pool.h>
+#include <sys/dsl_crypt.h>
 #include <sys/uberblock_impl.h>
 #include <sys/zfs_context.h>
 #include <sys/avl.h>
@@ -147,6 +150,7 @@ struct spa {
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	metaslab_class_t *spa_normal_class;	/* normal data class */
 	metaslab_class_t *spa_log_class;	/* intent log data class */
+	metaslab_class_t *spa_special_class;	/* metadata/small blocks */
 	uint64_t	spa_first_txg;		/* first txg after spa_open() */
 	uint64_t	spa_final_txg;		/* txg of export/destroy */
 	uint64_t	spa_freeze_txg;		/* freeze pool at this txg */
@@ -180,6 +184,8 @@ struct spa {
 	/* checksum context templates */
 	kmutex_t	spa_cksum_tmpls_lock;
 	void		*spa_cksum_tmpls[ZIO_CHECKSUM_FUNCTIONS];
+	/* async writes waiting for a batched checksum */
+	zio_cksum_batch_t spa_cksum_batch[ZIO_CHECKSUM_FUNCTIONS];
 	uberblock_t	spa_ubsync;		/* last synced uberblock */
 	uberblock_t	spa_uberblock;		/* current uberblock */
 	boolean_t	spa_extreme_rewind;	/* rewind past deferred frees */
@@ -238,6 +244,7 @@ struct spa {
 	int		spa_mode;		/* FREAD | FWRITE */
 	spa_log_state_t spa_log_state;		/* log state */
 	uint64_t	spa_autoexpand;		/* lun expansion on/off */
+	uint64_t	spa_autotrim;		/* trim freed space on/off */
 	ddt_t		*spa_ddt[ZIO_CHECKSUM_FUNCTIONS]; /* in-core DDTs */
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_dspace;	/* Cache get_dedup_dspace() */
@@ -269,6 +276,22 @@ struct spa {
 	uint64_t	spa_all_vdev_zaps;	/* ZAP of per-vd ZAP obj #s */
 	spa_avz_action_t	spa_avz_action;	/* destroy/rebuild AVZ? */
 	uint64_t	spa_errata;		/* errata issues detected */
+	spa_keystore_t	spa_keystore;		/* loaded crypto keys */
+
+	/*
+	 * Log space map state.  spa_metaslabs_by_flushed orders the
+	 * metaslabs by the txg of their last flush and is protected by
+	 * spa_flushed_ms_lock; spa_sm_logs_by_txg and the stats are
+	 * only touched in syncing context and during load.
+	 */
+	kmutex_t	spa_flushed_ms_lock;
+	avl_tree_t	spa_metaslabs_by_flushed;
+	avl_tree_t	spa_sm_logs_by_txg;
+	uint64_t	spa_log_sm_zap;		/* ZAP of log space maps */
+	space_map_t	*spa_syncing_log_sm;	/* log of the syncing txg */
+	spa_log_sm_stats_t spa_log_sm_stats;	/* log_spacemap kstat */
+	spa_vdev_removal_t *spa_vdev_removal;	/* active vdev removal */
+	spa_removing_phys_t spa_removing_phys;	/* last removal, on disk */
 	spa_stats_t	spa_stats;		/* assorted spa statistics */
 	hrtime_t	spa_ccw_fail_time;	/* Conf cache write fail time */
 	taskq_t		*spa_zvol_taskq;	/* Taskq for minor management */
@@ -0,0 +1,88 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SPA_LOG_SPACEMAP_H
+#define	_SYS_SPA_LOG_SPACEMAP_H
+
+#include <sys/avl.h>
+#include <sys/spa.h>
+#include <sys/space_map.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Key in the top-level vdev ZAP of the object that holds, for each
+ * metaslab of the vdev, the txg of its last flush.
+ */
+#define	VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS \
+	"com.delphix:ms_unflushed_phys_txgs"
+
+/*
+ * One log space map.  Each txg that changes any metaslab of the pool
+ * gets its own log space map object, registered in the
+ * DMU_POOL_LOG_SPACEMAP_ZAP under its txg.
+ */
+typedef struct spa_log_sm {
+	uint64_t	sls_sm_obj;	/* space map object ID */
+	uint64_t	sls_txg;	/* txg logged in the space map */
+	uint64_t	sls_nblocks;	/* number of blocks in this log */
+	avl_node_t	sls_node;	/* node in spa_sm_logs_by_txg */
+} spa_log_sm_t;
+
+/*
+ * Counters exported through the per-pool log_spacemap kstat.
+ */
+typedef struct spa_log_sm_stats {
+	uint64_t	slss_nblocks;	/* blocks in all log space maps */
+	uint64_t	slss_nsegs;	/* segments in unflushed trees */
+	uint64_t	slss_flushed;	/* metaslabs flushed since import */
+	uint64_t	slss_flushed_txg; /* metaslabs flushed last txg */
+	uint64_t	slss_destroyed;	/* log space maps destroyed */
+} spa_log_sm_stats_t;
+
+extern void spa_log_sm_init(spa_t *);
+extern void spa_log_sm_fini(spa_t *);
+
+extern int spa_ld_log_spacemaps(spa_t *);
+extern void spa_unload_log_sm_metadata(spa_t *);
+
+extern void spa_log_sm_sync_start(spa_t *, dmu_tx_t *);
+extern space_map_t *spa_log_sm_syncing(spa_t *, dmu_tx_t *);
+extern void spa_log_sm_cleanup(spa_t *, dmu_tx_t *);
+extern void spa_log_sm_sync_done(spa_t *, uint64_t);
+
+extern boolean_t spa_log_sm_enabled(spa_t *);
+extern boolean_t spa_log_sm_vdev_enabled(vdev_t *);
+extern void spa_log_sm_track_metaslab(metaslab_t *, uint64_t);
+extern void spa_log_sm_untrack_metaslab(metaslab_t *);
+extern void spa_log_sm_metaslab_flushed(metaslab_t *, dmu_tx_t *);
+extern void spa_log_sm_segs_update(spa_t *, int64_t);
+
+extern int metaslab_unflushed_txg_load(vdev_t *, uint64_t, uint64_t *);
+extern void metaslab_unflushed_txg_sync(metaslab_t *, dmu_tx_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SPA_LOG_SPACEMAP_H */
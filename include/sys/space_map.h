@@ -107,6 +107,28 @@ typedef struct space_map {
  *   63  62                          17   16   15               0
  */
 
+/*
+ * two-word entry (log space maps only)
+ *
+ *  first word
+ *    2    2               36                        24
+ *  ,----+-----+-------------------------+-------------------------.
+ *  | 11 | PAD |           run           |          vdev           |
+ *  `----+-----+-------------------------+-------------------------'
+ *   63 62 61 60 59                   24 23                        0
+ *
+ *  second word
+ *     1                            63
+ *  ,------+---------------------------------------------------------.
+ *  | type |                offset (sm_shift units)                  |
+ *  `------+---------------------------------------------------------'
+ *    63    62                                                       0
+ *
+ * The prefix of the first word has the debug bit set, so code that only
+ * understands one-word entries skips it, but it must never be used on
+ * the space map of a metaslab or a DTL.
+ */
+
 /* All this stuff takes and returns bytes */
 #define	SM_RUN_DECODE(x)	(BF64_DECODE(x, 0, 15) + 1)
 #define	SM_RUN_ENCODE(x)	BF64_ENCODE((x) - 1, 0, 15)
@@ -128,12 +150,45 @@ typedef struct space_map {
 
 #define	SM_RUN_MAX			SM_RUN_DECODE(~0ULL)
 
+#define	SM_PREFIX_DECODE(x)	BF64_DECODE(x, 62, 2)
+#define	SM2_PREFIX		3
+
+#define	SM2_RUN_DECODE(x)	(BF64_DECODE(x, 24, 36) + 1)
+#define	SM2_RUN_ENCODE(x)	BF64_ENCODE((x) - 1, 24, 36)
+#define	SM2_VDEV_DECODE(x)	BF64_DECODE(x, 0, 24)
+#define	SM2_VDEV_ENCODE(x)	BF64_ENCODE(x, 0, 24)
+#define	SM2_TYPE_DECODE(x)	BF64_DECODE(x, 63, 1)
+#define	SM2_TYPE_ENCODE(x)	BF64_ENCODE(x, 63, 1)
+#define	SM2_OFFSET_DECODE(x)	BF64_DECODE(x, 0, 63)
+#define	SM2_OFFSET_ENCODE(x)	BF64_ENCODE(x, 0, 63)
+
+#define	SM2_RUN_MAX			SM2_RUN_DECODE(~0ULL)
+
+/* vdev id of one-word entries, which don't record one */
+#define	SM_NO_VDEVID			(1ULL << 24)
+
 typedef enum {
 	SM_ALLOC,
 	SM_FREE
 } maptype_t;
 
+/*
+ * A decoded space map entry, as passed to space_map_iterate() callbacks.
+ * sme_vdev is SM_NO_VDEVID for one-word entries.
+ */
+typedef struct space_map_entry {
+	maptype_t	sme_type;
+	uint64_t	sme_vdev;
+	uint64_t	sme_offset;	/* in bytes */
+	uint64_t	sme_run;	/* in bytes */
+} space_map_entry_t;
+
+typedef int (*sm_cb_t)(space_map_entry_t *sme, void *arg);
+
+extern int space_map_blksz;
+
 int space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype);
+int space_map_iterate(space_map_t *sm, sm_cb_t callback, void *arg);
 
 void space_map_histogram_clear(space_map_t *sm);
 void space_map_histogram_add(space_map_t *sm, range_tree_t *rt,
@@ -147,9 +202,12 @@ uint64_t space_map_length(space_map_t *sm);
 
 void space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
     dmu_tx_t *tx);
+void space_map_write_log(space_map_t *sm, range_tree_t *rt,
+    maptype_t maptype, uint64_t vdev_id, dmu_tx_t *tx);
 void space_map_truncate(space_map_t *sm, dmu_tx_t *tx);
-uint64_t space_map_alloc(objset_t *os, dmu_tx_t *tx);
+uint64_t space_map_alloc(objset_t *os, int blocksize, dmu_tx_t *tx);
 void space_map_free(space_map_t *sm, dmu_tx_t *tx);
+void space_map_free_obj(objset_t *os, uint64_t smobj, dmu_tx_t *tx);
 
 int space_map_open(space_map_t **smp, objset_t *os, uint64_t object,
     uint64_t start, uint64_t size, uint8_t shift, kmutex_t *lp);
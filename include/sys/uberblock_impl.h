@@ -54,6 +54,9 @@ struct uberblock {
 
 	/* highest SPA_VERSION supported by software that wrote this txg */
 	uint64_t	ub_software_version;
+
+	/* durable RAIDZ expansion reflow offset, zero when none active */
+	uint64_t	ub_raidz_reflow_info;
 };
 
 #ifdef	__cplusplus
@@ -0,0 +1,87 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_DRAID_H
+#define	_SYS_VDEV_DRAID_H
+
+#include <sys/types.h>
+#include <sys/nvpair.h>
+#include <sys/vdev.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct zio;
+struct raidz_map;
+
+/*
+ * Limits of the dRAID layout.  Permutation entries are a single byte.
+ */
+#define	VDEV_DRAID_MAXPARITY	3
+#define	VDEV_DRAID_MAX_CHILDREN	255
+
+/*
+ * Number of distinct permutations of the children; rows of the layout
+ * cycle through them.  Together with VDEV_DRAID_SEED, which seeds the
+ * generator of the permutations, this is part of the on-disk format.
+ */
+#define	VDEV_DRAID_NPERMS	256
+#define	VDEV_DRAID_SEED		0xd7a1d5eed0ddba11ULL
+
+/*
+ * Minimum number of rows a new dRAID vdev is laid out in, when its
+ * children are large enough, so that the spare space and the rebuild
+ * I/O are spread over many permutations.
+ */
+#define	VDEV_DRAID_MIN_ROWS	64
+
+typedef struct vdev_draid_config {
+	uint64_t	vdc_ndata;	/* data columns per group */
+	uint64_t	vdc_nparity;	/* parity columns per group */
+	uint64_t	vdc_nspares;	/* distributed spares */
+	uint64_t	vdc_children;	/* number of children */
+	uint64_t	vdc_ndisks;	/* children holding groups in a row */
+	uint64_t	vdc_groupwidth;	/* ndata + nparity */
+	uint64_t	vdc_ngroups;	/* groups per row */
+	uint64_t	vdc_nslots;	/* group columns per child per row */
+	uint8_t		*vdc_perms;	/* VDEV_DRAID_NPERMS permutations */
+} vdev_draid_config_t;
+
+extern int vdev_draid_config_alloc(uint64_t, uint64_t, uint64_t, uint64_t,
+    vdev_draid_config_t **);
+extern void vdev_draid_config_free(vdev_draid_config_t *);
+extern uint64_t vdev_draid_row_size(const vdev_draid_config_t *, uint64_t,
+    uint64_t);
+extern struct raidz_map *vdev_draid_map_alloc(struct zio *,
+    const vdev_draid_config_t *, uint64_t, uint64_t);
+extern uint64_t vdev_draid_child_min_asize(vdev_t *);
+
+extern void vdev_draid_spare_create(nvlist_t *, vdev_t *);
+extern vdev_t *vdev_draid_spare_get_parent(vdev_t *);
+extern boolean_t vdev_draid_spare_inuse(vdev_t *, vdev_labeltype_t,
+    uint64_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_VDEV_DRAID_H */
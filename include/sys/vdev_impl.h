@@ -120,6 +120,7 @@ struct vdev_queue {
 	avl_tree_t	vq_active_tree;
 	avl_tree_t	vq_read_offset_tree;
 	avl_tree_t	vq_write_offset_tree;
+	avl_tree_t	vq_trim_offset_tree;
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
@@ -159,6 +160,7 @@ struct vdev {
 	boolean_t	vdev_expanding;	/* expand the vdev?		*/
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
+	boolean_t	vdev_notrim;	/* true if trim is unsupported	*/
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
@@ -181,11 +183,19 @@ struct vdev {
 	list_node_t	vdev_state_dirty_node; /* state dirty list	*/
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
+	uint64_t	vdev_isspecial;	/* is a special class device	*/
 	uint64_t	vdev_removing;	/* device is being removed?	*/
 	boolean_t	vdev_ishole;	/* is a hole in the namespace	*/
 	kmutex_t	vdev_queue_lock; /* protects vdev_queue_depth	*/
 	uint64_t	vdev_top_zap;
 
+	/*
+	 * Mapping of a removed or removing vdev to the new locations of
+	 * its segments.  See vdev_indirect.c and vdev_removal.c.
+	 */
+	uint64_t	vdev_im_object;	/* indirect mapping object	*/
+	struct vdev_indirect_mapping *vdev_indirect_mapping;
+
 	/*
 	 * The queue depth parameters determine how many async writes are
 	 * still pending (i.e. allocated by net yet issued to disk) per
@@ -355,10 +365,13 @@ extern vdev_ops_t vdev_root_ops;
 extern vdev_ops_t vdev_mirror_ops;
 extern vdev_ops_t vdev_replacing_ops;
 extern vdev_ops_t vdev_raidz_ops;
+extern vdev_ops_t vdev_draid_ops;
+extern vdev_ops_t vdev_draid_spare_ops;
 extern vdev_ops_t vdev_disk_ops;
 extern vdev_ops_t vdev_file_ops;
 extern vdev_ops_t vdev_missing_ops;
 extern vdev_ops_t vdev_hole_ops;
+extern vdev_ops_t vdev_indirect_ops;
 extern vdev_ops_t vdev_spare_ops;
 
 /*
@@ -368,6 +381,15 @@ extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
+/*
+ * Indirect vdevs
+ */
+typedef void vdev_remap_func_t(uint64_t split_offset, vdev_t *vd,
+    uint64_t offset, uint64_t size, void *arg);
+extern void vdev_indirect_remap(vdev_t *vd, uint64_t offset, uint64_t size,
+    vdev_remap_func_t *func, void *arg);
+extern void vdev_indirect_load(spa_t *spa);
+
 /*
  * Global variables
  */
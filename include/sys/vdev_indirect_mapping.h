@@ -0,0 +1,103 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_INDIRECT_MAPPING_H
+#define	_SYS_VDEV_INDIRECT_MAPPING_H
+
+#include <sys/dmu.h>
+#include <sys/list.h>
+#include <sys/spa.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * One entry of the mapping of a removed vdev: the segment starting at
+ * vimep_src on the removed vdev now lives at vimep_dst.  The length of
+ * the segment is the asize of the DVA.
+ */
+typedef struct vdev_indirect_mapping_entry_phys {
+	uint64_t	vimep_src;
+	dva_t		vimep_dst;
+} vdev_indirect_mapping_entry_phys_t;
+
+/*
+ * In-core copy of an entry, linked on the list of entries to append.
+ */
+typedef struct vdev_indirect_mapping_entry {
+	vdev_indirect_mapping_entry_phys_t	vime_mapping;
+	list_node_t				vime_node;
+} vdev_indirect_mapping_entry_t;
+
+/*
+ * Bonus buffer of the mapping object.  The entries are kept in the
+ * object's data, sorted by vimep_src and never overlapping.
+ */
+typedef struct vdev_indirect_mapping_phys {
+	uint64_t	vimp_max_offset;	/* end of the last entry */
+	uint64_t	vimp_bytes_mapped;	/* sum of the entry lengths */
+	uint64_t	vimp_num_entries;	/* number of entries */
+} vdev_indirect_mapping_phys_t;
+
+typedef struct vdev_indirect_mapping {
+	uint64_t	vim_object;
+	objset_t	*vim_objset;
+	dmu_buf_t	*vim_dbuf;
+	vdev_indirect_mapping_phys_t	*vim_phys;
+
+	/*
+	 * All of the entries, loaded when the mapping is opened and
+	 * appended to as they are synced.  vim_lock protects the array
+	 * against readers while it grows.
+	 */
+	krwlock_t	vim_lock;
+	vdev_indirect_mapping_entry_phys_t	*vim_entries;
+	uint64_t	vim_alloc;		/* entries allocated */
+} vdev_indirect_mapping_t;
+
+#define	DVA_MAPPING_GET_SRC_OFFSET(vimep)	((vimep)->vimep_src)
+#define	DVA_MAPPING_GET_SIZE(vimep)	DVA_GET_ASIZE(&(vimep)->vimep_dst)
+
+extern uint64_t vdev_indirect_mapping_alloc(objset_t *, dmu_tx_t *);
+extern void vdev_indirect_mapping_free(objset_t *, uint64_t, dmu_tx_t *);
+extern vdev_indirect_mapping_t *vdev_indirect_mapping_open(objset_t *,
+    uint64_t);
+extern void vdev_indirect_mapping_close(vdev_indirect_mapping_t *);
+
+extern uint64_t vdev_indirect_mapping_num_entries(vdev_indirect_mapping_t *);
+extern uint64_t vdev_indirect_mapping_max_offset(vdev_indirect_mapping_t *);
+extern uint64_t vdev_indirect_mapping_bytes_mapped(vdev_indirect_mapping_t *);
+extern uint64_t vdev_indirect_mapping_size(vdev_indirect_mapping_t *);
+
+extern vdev_indirect_mapping_entry_phys_t *
+    vdev_indirect_mapping_entry_for_offset(vdev_indirect_mapping_t *,
+    uint64_t);
+extern void vdev_indirect_mapping_add_entries(vdev_indirect_mapping_t *,
+    list_t *, dmu_tx_t *);
+extern void vdev_indirect_mapping_rewrite(vdev_indirect_mapping_t *,
+    dmu_tx_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_INDIRECT_MAPPING_H */
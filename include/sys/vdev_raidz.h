@@ -33,6 +33,9 @@ extern "C" {
 
 struct zio;
 struct raidz_map;
+struct vdev;
+struct spa;
+struct nvlist;
 #if !defined(_KERNEL)
 struct kernel_param {};
 #endif
@@ -42,9 +45,27 @@ struct kernel_param {};
  */
 struct raidz_map *vdev_raidz_map_alloc(struct zio *, uint64_t, uint64_t,
     uint64_t);
+struct raidz_map *vdev_raidz_map_alloc_offset(struct zio *, uint64_t,
+    uint64_t, uint64_t, uint64_t);
 void vdev_raidz_map_free(struct raidz_map *);
 void vdev_raidz_generate_parity(struct raidz_map *);
 int vdev_raidz_reconstruct(struct raidz_map *, const int *, int);
+void vdev_raidz_io_start_map(struct zio *, struct raidz_map *);
+void vdev_raidz_io_done(struct zio *);
+
+/*
+ * RAIDZ expansion
+ */
+void *vdev_raidz_expand_alloc(struct nvlist *);
+void vdev_raidz_expand_free(struct vdev *);
+void vdev_raidz_config_generate(struct vdev *, struct nvlist *, boolean_t);
+boolean_t vdev_raidz_expanding(struct vdev *);
+uint64_t vdev_raidz_physical_width(struct vdev *);
+uint64_t vdev_raidz_deflate_asize(struct vdev *, uint64_t);
+void vdev_raidz_expand_attach(struct vdev *, uint64_t);
+void vdev_raidz_expand_load(struct spa *);
+void vdev_raidz_expand_start(struct spa *);
+void vdev_raidz_expand_stop(struct spa *);
 
 /*
  * vdev_raidz_math interface
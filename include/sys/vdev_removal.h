@@ -0,0 +1,101 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_REMOVAL_H
+#define	_SYS_VDEV_REMOVAL_H
+
+#include <sys/spa.h>
+#include <sys/list.h>
+#include <sys/range_tree.h>
+#include <sys/txg.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * State of the last top-level vdev removal, kept in the MOS directory
+ * under DMU_POOL_REMOVING.  The state is a dsl_scan_state_t.
+ */
+typedef struct spa_removing_phys {
+	uint64_t	sr_state;
+	uint64_t	sr_removing_vdev;
+	uint64_t	sr_start_time;
+	uint64_t	sr_end_time;
+	uint64_t	sr_to_copy;	/* bytes allocated when removal began */
+	uint64_t	sr_copied;	/* bytes copied and synced */
+} spa_removing_phys_t;
+
+/*
+ * In-core state of the active removal.  The copying thread works through
+ * the vdev in offset order, one metaslab at a time:
+ *
+ *  - below the end of the synced mapping, the data lives at its copies,
+ *    and frees are redirected there;
+ *  - up to svr_inflight_end, the segments have been or are being copied,
+ *    and frees go to both the vdev and, once the mapping covering them
+ *    is synced, the copies;
+ *  - beyond it, the vdev is still authoritative.
+ *
+ * svr_lock protects all of the fields below.
+ */
+typedef struct spa_vdev_removal {
+	struct vdev	*svr_vdev;
+	kmutex_t	svr_lock;
+	kcondvar_t	svr_cv;
+	kthread_t	*svr_thread;
+	boolean_t	svr_thread_exit;
+
+	/* Allocated segments of the current metaslab left to copy */
+	range_tree_t	*svr_allocd_segs;
+
+	/* End of the segments copied or being copied */
+	uint64_t	svr_inflight_end;
+
+	/* Frees of copied segments whose mapping is not synced yet */
+	range_tree_t	*svr_frees;
+
+	/* Mapping entries written in each txg, and the bytes they map */
+	list_t		svr_new_segments[TXG_SIZE];
+	uint64_t	svr_bytes_done[TXG_SIZE];
+
+	/* Copies allocated by failed batches, freed as their txg syncs */
+	list_t		svr_unalloc[TXG_SIZE];
+} spa_vdev_removal_t;
+
+extern int spa_vdev_remove_top(struct vdev *, uint64_t *);
+extern void spa_vdev_remove_complete(spa_t *);
+extern int spa_removal_get_stats(spa_t *, pool_removal_stat_t *);
+extern int spa_vdev_removal_load(spa_t *);
+extern void spa_vdev_removal_resume(spa_t *);
+extern void spa_vdev_removal_stop(spa_t *);
+extern void spa_vdev_removal_unload(spa_t *);
+extern boolean_t vdev_removal_free(struct vdev *, uint64_t, uint64_t,
+    uint64_t);
+
+extern unsigned long zfs_remove_max_copy_bytes;
+extern int zfs_remove_max_segment;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_REMOVAL_H */
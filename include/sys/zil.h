@@ -39,6 +39,7 @@ extern "C" {
 
 struct dsl_pool;
 struct dsl_dataset;
+struct lwb;
 
 /*
  * Intent log format:
@@ -150,7 +151,8 @@ typedef enum zil_create {
 #define	TX_MKDIR_ATTR		18	/* mkdir with attr */
 #define	TX_MKDIR_ACL_ATTR	19	/* mkdir with ACL + attrs */
 #define	TX_WRITE2		20	/* dmu_sync EALREADY write */
-#define	TX_MAX_TYPE		21	/* Max transaction type */
+#define	TX_COMMIT		21	/* Commit marker (no on-disk state) */
+#define	TX_MAX_TYPE		22	/* Max transaction type */
 
 /*
  * The transactions for mkdir, symlink, remove, rmdir, link, and rename
@@ -391,6 +393,12 @@ typedef struct itx {
 	/* followed by type-specific part of lr_xx_t and its immediate data */
 } itx_t;
 
+/*
+ * Number of buckets in the zil kstat latency histograms; the slowest
+ * bucket collects everything from 2^(ZIL_LATENCY_BUCKETS - 2)us on.
+ */
+#define	ZIL_LATENCY_BUCKETS	25
+
 /*
  * Used for zil kstat.
  */
@@ -401,9 +409,9 @@ typedef struct zil_stats {
 	kstat_named_t zil_commit_count;
 
 	/*
-	 * Number of times the ZIL has been flushed to stable storage.
-	 * This is less than zil_commit_count when commits are "merged"
-	 * (see the documentation above zil_commit()).
+	 * Number of times a thread has taken the issuer role and written
+	 * out the pending itxs.  This is less than zil_commit_count when
+	 * commits are "merged" (see the documentation above zil_commit()).
 	 */
 	kstat_named_t zil_commit_writer_count;
 
@@ -441,6 +449,17 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_itx_metaslab_slog_count;
 	kstat_named_t zil_itx_metaslab_slog_bytes;
+
+	/*
+	 * Latency histograms, in power-of-two microsecond buckets.  The
+	 * entry named "<N>us" counts the events which took less than N
+	 * microseconds but at least N/2; the last entry also counts all
+	 * slower events.  "commit" is the time from entering zil_commit()
+	 * until the caller's records are stable, "lwb" is the time from
+	 * issuing a log block until its write and cache flushes complete.
+	 */
+	kstat_named_t zil_commit_latency[ZIL_LATENCY_BUCKETS];
+	kstat_named_t zil_lwb_latency[ZIL_LATENCY_BUCKETS];
 } zil_stats_t;
 
 extern zil_stats_t zil_stats;
@@ -455,7 +474,8 @@ typedef int zil_parse_blk_func_t(zilog_t *zilog, blkptr_t *bp, void *arg,
 typedef int zil_parse_lr_func_t(zilog_t *zilog, lr_t *lr, void *arg,
     uint64_t txg);
 typedef int (*const zil_replay_func_t)(void *, char *, boolean_t);
-typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf, zio_t *zio);
+typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf,
+    struct lwb *lwb, zio_t *zio);
 
 extern int zil_parse(zilog_t *zilog, zil_parse_blk_func_t *parse_blk_func,
     zil_parse_lr_func_t *parse_lr_func, void *arg, uint64_t txg);
@@ -492,7 +512,7 @@ extern void	zil_clean(zilog_t *zilog, uint64_t synced_txg);
 extern int	zil_suspend(const char *osname, void **cookiep);
 extern void	zil_resume(void *cookie);
 
-extern void	zil_add_block(zilog_t *zilog, const blkptr_t *bp);
+extern void	zil_lwb_add_block(struct lwb *lwb, const blkptr_t *bp);
 extern int	zil_bp_tree_add(zilog_t *zilog, const blkptr_t *bp);
 
 extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
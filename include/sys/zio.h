@@ -117,6 +117,31 @@ enum zio_checksum {
 
 #define	ZIO_COMPRESS_DEFAULT		ZIO_COMPRESS_OFF
 
+/*
+ * Encryption suites.  The suite is selected per dataset when it is created
+ * and applies to every encrypted block written to it.
+ */
+enum zio_encrypt {
+	ZIO_CRYPT_INHERIT = 0,
+	ZIO_CRYPT_ON,
+	ZIO_CRYPT_OFF,
+	ZIO_CRYPT_AES_128_CCM,
+	ZIO_CRYPT_AES_192_CCM,
+	ZIO_CRYPT_AES_256_CCM,
+	ZIO_CRYPT_AES_128_GCM,
+	ZIO_CRYPT_AES_192_GCM,
+	ZIO_CRYPT_AES_256_GCM,
+	ZIO_CRYPT_FUNCTIONS
+};
+
+#define	ZIO_CRYPT_ON_VALUE	ZIO_CRYPT_AES_256_GCM
+#define	ZIO_CRYPT_DEFAULT	ZIO_CRYPT_OFF
+
+/* size of the crypt parameters stored in an encrypted blkptr_t */
+#define	ZIO_DATA_SALT_LEN	8
+#define	ZIO_DATA_IV_LEN		12
+#define	ZIO_DATA_MAC_LEN	16
+
 #define	BOOTFS_COMPRESS_VALID(compress)			\
 	((compress) == ZIO_COMPRESS_LZJB ||		\
 	(compress) == ZIO_COMPRESS_LZ4 ||		\
@@ -179,16 +204,19 @@ enum zio_flag {
 	ZIO_FLAG_DONT_PROPAGATE	= 1 << 20,
 	ZIO_FLAG_IO_BYPASS	= 1 << 21,
 	ZIO_FLAG_IO_REWRITE	= 1 << 22,
-	ZIO_FLAG_RAW		= 1 << 23,
-	ZIO_FLAG_GANG_CHILD	= 1 << 24,
-	ZIO_FLAG_DDT_CHILD	= 1 << 25,
-	ZIO_FLAG_GODFATHER	= 1 << 26,
-	ZIO_FLAG_NOPWRITE	= 1 << 27,
-	ZIO_FLAG_REEXECUTED	= 1 << 28,
-	ZIO_FLAG_DELEGATED	= 1 << 29,
-	ZIO_FLAG_FASTWRITE	= 1 << 30
+	ZIO_FLAG_RAW_COMPRESS	= 1 << 23,
+	ZIO_FLAG_RAW_ENCRYPT	= 1 << 24,
+	ZIO_FLAG_GANG_CHILD	= 1 << 25,
+	ZIO_FLAG_DDT_CHILD	= 1 << 26,
+	ZIO_FLAG_GODFATHER	= 1 << 27,
+	ZIO_FLAG_NOPWRITE	= 1 << 28,
+	ZIO_FLAG_REEXECUTED	= 1 << 29,
+	ZIO_FLAG_DELEGATED	= 1 << 30,
+	ZIO_FLAG_FASTWRITE	= 1U << 31
 };
 
+#define	ZIO_FLAG_RAW	(ZIO_FLAG_RAW_COMPRESS | ZIO_FLAG_RAW_ENCRYPT)
+
 #define	ZIO_FLAG_MUSTSUCCEED		0
 
 #define	ZIO_DDT_CHILD_FLAGS(zio)				\
@@ -285,12 +313,18 @@ struct zbookmark_phys {
 typedef struct zio_prop {
 	enum zio_checksum	zp_checksum;
 	enum zio_compress	zp_compress;
+	uint64_t		zp_complevel;
 	dmu_object_type_t	zp_type;
 	uint8_t			zp_level;
 	uint8_t			zp_copies;
+	uint_t			zp_zpl_smallblk;
 	boolean_t		zp_dedup;
 	boolean_t		zp_dedup_verify;
 	boolean_t		zp_nopwrite;
+	boolean_t		zp_encrypt;
+	uint8_t			zp_salt[ZIO_DATA_SALT_LEN];
+	uint8_t			zp_iv[ZIO_DATA_IV_LEN];
+	uint8_t			zp_mac[ZIO_DATA_MAC_LEN];
 } zio_prop_t;
 
 typedef struct zio_cksum_report zio_cksum_report_t;
@@ -363,6 +397,20 @@ typedef struct zio_alloc_list {
 	uint64_t zal_size;
 } zio_alloc_list_t;
 
+/*
+ * Async writes waiting to have their checksums computed together, see
+ * zio_checksum_batch().
+ */
+typedef struct zio_cksum_batch {
+	kmutex_t	zcb_lock;
+	list_t		zcb_zios;	/* parked write zios */
+	uint_t		zcb_count;	/* number of zios in zcb_zios */
+	boolean_t	zcb_flush_pending; /* zcb_flush_ent is dispatched */
+	taskq_ent_t	zcb_flush_ent;
+	spa_t		*zcb_spa;
+	enum zio_checksum zcb_checksum;
+} zio_cksum_batch_t;
+
 typedef struct zio_link {
 	zio_t		*zl_parent;
 	zio_t		*zl_child;
@@ -452,6 +500,9 @@ struct zio {
 
 	/* Taskq dispatching state */
 	taskq_ent_t	io_tqent;
+
+	/* Checksum batching state */
+	list_node_t	io_batch_node;
 };
 
 extern int zio_timestamp_compare(const void *, const void *);
@@ -489,6 +540,9 @@ extern zio_t *zio_claim(zio_t *pio, spa_t *spa, uint64_t txg,
 extern zio_t *zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
     zio_done_func_t *done, void *private, enum zio_flag flags);
 
+extern zio_t *zio_trim(zio_t *pio, spa_t *spa, vdev_t *vd, uint64_t offset,
+    uint64_t size);
+
 extern zio_t *zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset,
     uint64_t size, struct abd *data, int checksum,
     zio_done_func_t *done, void *private, zio_priority_t priority,
@@ -558,6 +612,9 @@ extern void zio_suspend(spa_t *spa, zio_t *zio);
 extern int zio_resume(spa_t *spa);
 extern void zio_resume_wait(spa_t *spa);
 
+extern void zio_checksum_batch_init(spa_t *spa);
+extern void zio_checksum_batch_fini(spa_t *spa);
+
 /*
  * Initial setup and teardown.
  */
@@ -103,12 +103,21 @@ typedef struct zio_bad_cksum {
 
 extern zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS];
 
+/*
+ * Maximum number of blocks checksummed by one zio_checksum_compute_batch().
+ */
+#define	ZIO_CHECKSUM_BATCH_MAX	8
+
 /*
  * Checksum routines.
  */
 extern zio_checksum_t abd_checksum_SHA256;
 extern zio_checksum_t abd_checksum_SHA512_native;
 extern zio_checksum_t abd_checksum_SHA512_byteswap;
+extern void abd_checksum_SHA256_batch(struct abd **, const uint64_t *,
+    uint_t, zio_cksum_t *);
+extern void abd_checksum_SHA512_native_batch(struct abd **, const uint64_t *,
+    uint_t, zio_cksum_t *);
 
 /* Skein */
 extern zio_checksum_t abd_checksum_skein_native;
@@ -130,6 +139,8 @@ extern int zio_checksum_equal(spa_t *, blkptr_t *, enum zio_checksum,
     void *, uint64_t, uint64_t, zio_bad_cksum_t *);
 extern void zio_checksum_compute(zio_t *, enum zio_checksum,
     struct abd *, uint64_t);
+extern uint_t zio_checksum_batch_lanes(enum zio_checksum);
+extern void zio_checksum_compute_batch(zio_t **, uint_t, enum zio_checksum);
 extern int zio_checksum_error_impl(spa_t *, blkptr_t *, enum zio_checksum,
     struct abd *, uint64_t, uint64_t, zio_bad_cksum_t *);
 extern int zio_checksum_error(zio_t *zio, zio_bad_cksum_t *out);
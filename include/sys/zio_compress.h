@@ -29,6 +29,7 @@
 #define	_SYS_ZIO_COMPRESS_H
 
 #include <sys/abd.h>
+#include <zfeature_common.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -51,9 +52,35 @@ enum zio_compress {
 	ZIO_COMPRESS_GZIP_9,
 	ZIO_COMPRESS_ZLE,
 	ZIO_COMPRESS_LZ4,
+	ZIO_COMPRESS_ZSTD,
 	ZIO_COMPRESS_FUNCTIONS
 };
 
+/*
+ * The compression property value may carry an algorithm specific level in
+ * the bits above those which hold the algorithm itself.  Only the algorithm
+ * is ever stored in a block pointer, so the shift matches the width of the
+ * blkptr compression field.  Currently only zstd makes use of the level.
+ */
+#define	ZIO_COMPLEVEL_SHIFT		7
+#define	ZIO_COMPRESS_ALGO(val)		\
+	((enum zio_compress)((val) & ((1ULL << ZIO_COMPLEVEL_SHIFT) - 1)))
+#define	ZIO_COMPRESS_LEVEL(val)		((val) >> ZIO_COMPLEVEL_SHIFT)
+#define	ZIO_COMPRESS_RAW(algo, level)	\
+	((uint64_t)(algo) | ((uint64_t)(level) << ZIO_COMPLEVEL_SHIFT))
+
+/*
+ * zstd levels as encoded in the compression property.  Zero selects the
+ * default level, 1-19 map directly onto the zstd levels, and the "fast"
+ * levels zstd-fast-N are encoded as ZIO_ZSTD_LEVEL_FAST + N and map onto
+ * the negative zstd levels.
+ */
+#define	ZIO_ZSTD_LEVEL_DEFAULT		0
+#define	ZIO_ZSTD_LEVEL_MIN		1
+#define	ZIO_ZSTD_LEVEL_MAX		19
+#define	ZIO_ZSTD_LEVEL_FAST		1000
+#define	ZIO_ZSTD_LEVEL_FAST_MAX		(ZIO_ZSTD_LEVEL_FAST + 1000)
+
 /* Common signature for all zio compress functions. */
 typedef size_t zio_compress_func_t(void *src, void *dst,
     size_t s_len, size_t d_len, int);
@@ -86,6 +113,13 @@ extern zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS];
 extern void lz4_init(void);
 extern void lz4_fini(void);
 
+/*
+ * zstd compression init & free
+ */
+extern void zstd_init(void);
+extern void zstd_fini(void);
+extern boolean_t zstd_available(void);
+
 /*
  * Compression routines.
  */
@@ -107,15 +141,20 @@ extern int lz4_decompress_zfs(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
 extern int lz4_decompress_abd(abd_t *src, void *dst, size_t s_len, size_t d_len,
     int level);
+extern size_t zfs_zstd_compress(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
+extern int zfs_zstd_decompress(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
 /*
  * Compress and decompress data if necessary.
  */
 extern size_t zio_compress_data(enum zio_compress c, abd_t *src, void *dst,
-    size_t s_len);
+    size_t s_len, uint64_t level);
 extern int zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
     size_t s_len, size_t d_len);
 extern int zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len);
+extern spa_feature_t zio_compress_to_feature(enum zio_compress comp);
 
 #ifdef	__cplusplus
 }
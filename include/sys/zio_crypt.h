@@ -0,0 +1,124 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_ZIO_CRYPT_H
+#define	_SYS_ZIO_CRYPT_H
+
+#include <sys/zfs_context.h>
+#include <sys/crypto/api.h>
+#include <sys/spa.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* length of the parameters used to wrap a key */
+#define	WRAPPING_IV_LEN		ZIO_DATA_IV_LEN
+#define	WRAPPING_MAC_LEN	ZIO_DATA_MAC_LEN
+
+/* largest master key of any of the encryption suites */
+#define	MASTER_KEY_MAX_LEN	32
+
+/*
+ * A salt selects the key (derived from the master key) that a block is
+ * encrypted with.  Each salt is only used for a limited number of blocks
+ * before a new one is generated, which bounds the chance of two blocks
+ * sharing both a key and a randomly generated IV.
+ */
+#define	ZFS_KEY_MAX_SALT_USES_DEFAULT	400000000ULL
+extern unsigned long zfs_key_max_salt_uses;
+
+typedef enum zio_crypt_type {
+	ZC_TYPE_NONE = 0,
+	ZC_TYPE_CCM,
+	ZC_TYPE_GCM
+} zio_crypt_type_t;
+
+typedef struct zio_crypt_info {
+	/* mechanism name, as understood by the ICP */
+	crypto_mech_name_t	ci_mechname;
+
+	/* cipher mode of the suite */
+	zio_crypt_type_t	ci_crypt_type;
+
+	/* length of the master key in bytes */
+	size_t			ci_keylen;
+
+	/* human-readable name of the suite */
+	char			*ci_name;
+} zio_crypt_info_t;
+
+extern zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS];
+
+/*
+ * In-memory representation of an unwrapped master key, along with the key
+ * currently being used to encrypt new blocks.
+ */
+typedef struct zio_crypt_key {
+	/* encryption suite the key is used with */
+	uint64_t		zk_crypt;
+
+	/* unique identifier of the master key */
+	uint64_t		zk_guid;
+
+	/* the master key itself */
+	uint8_t			zk_master_keydata[MASTER_KEY_MAX_LEN];
+
+	/* key derived from the master key and the current salt */
+	uint8_t			zk_current_keydata[MASTER_KEY_MAX_LEN];
+	crypto_key_t		zk_current_key;
+	crypto_ctx_template_t	zk_current_tmpl;
+
+	/* salt and the number of blocks encrypted with it so far */
+	uint8_t			zk_salt[ZIO_DATA_SALT_LEN];
+	uint64_t		zk_salt_count;
+
+	/* protects the salt and the current key */
+	krwlock_t		zk_salt_lock;
+} zio_crypt_key_t;
+
+int zio_crypt_key_init(uint64_t crypt, zio_crypt_key_t *key);
+void zio_crypt_key_destroy(zio_crypt_key_t *key);
+int zio_crypt_key_get_salt(zio_crypt_key_t *key, uint8_t *salt);
+
+int zio_crypt_key_wrap(crypto_key_t *cwkey, zio_crypt_key_t *key,
+    uint8_t *iv, uint8_t *mac, uint8_t *keydata_out);
+int zio_crypt_key_unwrap(crypto_key_t *cwkey, uint64_t crypt, uint64_t guid,
+    uint8_t *keydata, uint8_t *iv, uint8_t *mac, zio_crypt_key_t *key);
+
+int zio_crypt_generate_iv(uint8_t *ivbuf);
+
+void zio_crypt_encode_params_bp(blkptr_t *bp, uint8_t *salt, uint8_t *iv);
+void zio_crypt_decode_params_bp(const blkptr_t *bp, uint8_t *salt,
+    uint8_t *iv);
+void zio_crypt_encode_mac_bp(blkptr_t *bp, uint8_t *mac);
+void zio_crypt_decode_mac_bp(const blkptr_t *bp, uint8_t *mac);
+
+int zio_do_crypt_abd(boolean_t encrypt, zio_crypt_key_t *key, uint8_t *salt,
+    uint8_t *iv, uint8_t *mac, uint_t datalen, abd_t *pabd, abd_t *cabd);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZIO_CRYPT_H */
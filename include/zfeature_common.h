@@ -55,6 +55,12 @@ typedef enum spa_feature {
 	SPA_FEATURE_SKEIN,
 	SPA_FEATURE_EDONR,
 	SPA_FEATURE_USEROBJ_ACCOUNTING,
+	SPA_FEATURE_ZSTD_COMPRESS,
+	SPA_FEATURE_LOG_SPACEMAP,
+	SPA_FEATURE_DRAID,
+	SPA_FEATURE_RAIDZ_EXPANSION,
+	SPA_FEATURE_DEVICE_REMOVAL,
+	SPA_FEATURE_ENCRYPTION,
 	SPA_FEATURES
 } spa_feature_t;
 
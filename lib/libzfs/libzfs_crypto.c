@@ -0,0 +1,1070 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2017, Datto, Inc. All rights reserved.
+ */
+
+/*
+ * Encryption key management for libzfs.
+ *
+ * The kernel never sees a user's key material in any form other than a
+ * 32 byte wrapping key.  This file is responsible for getting the key
+ * material from its keylocation (a prompt or a file), converting it to a
+ * wrapping key according to its keyformat (raw, hex or a passphrase
+ * stretched with PBKDF2-HMAC-SHA512) and handing it to the kernel along
+ * with the create, load-key and change-key operations.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/byteorder.h>
+#include <sys/sha2.h>
+#include <sys/sysmacros.h>
+#include <sys/zio.h>
+#include <libzfs.h>
+#include "libzfs_impl.h"
+#include "zfs_prop.h"
+
+#define	MIN_PASSPHRASE_LEN	8
+#define	MAX_PASSPHRASE_LEN	512
+#define	MAX_KEY_PROMPT_ATTEMPTS	3
+
+static const char *
+keyformat_name(zfs_keyformat_t keyformat)
+{
+	const char *str = "unknown";
+
+	(void) zfs_prop_index_to_string(ZFS_PROP_KEYFORMAT, keyformat, &str);
+	return (str);
+}
+
+/*
+ * HMAC-SHA512 of 'data' under 'key', as defined in RFC 2104.
+ */
+static void
+hmac_sha512(const uint8_t *key, size_t keylen, const uint8_t *data,
+    size_t datalen, const uint8_t *data2, size_t data2len, uint8_t *digest)
+{
+	uint8_t k[SHA512_HMAC_BLOCK_SIZE];
+	uint8_t ipad[SHA512_HMAC_BLOCK_SIZE], opad[SHA512_HMAC_BLOCK_SIZE];
+	uint8_t inner[SHA512_DIGEST_LENGTH];
+	SHA2_CTX ctx;
+	int i;
+
+	bzero(k, sizeof (k));
+	if (keylen > SHA512_HMAC_BLOCK_SIZE) {
+		SHA2Init(SHA512, &ctx);
+		SHA2Update(&ctx, key, keylen);
+		SHA2Final(k, &ctx);
+	} else {
+		bcopy(key, k, keylen);
+	}
+
+	for (i = 0; i < SHA512_HMAC_BLOCK_SIZE; i++) {
+		ipad[i] = k[i] ^ 0x36;
+		opad[i] = k[i] ^ 0x5c;
+	}
+
+	SHA2Init(SHA512, &ctx);
+	SHA2Update(&ctx, ipad, sizeof (ipad));
+	SHA2Update(&ctx, data, datalen);
+	if (data2 != NULL)
+		SHA2Update(&ctx, data2, data2len);
+	SHA2Final(inner, &ctx);
+
+	SHA2Init(SHA512, &ctx);
+	SHA2Update(&ctx, opad, sizeof (opad));
+	SHA2Update(&ctx, inner, sizeof (inner));
+	SHA2Final(digest, &ctx);
+
+	bzero(k, sizeof (k));
+	bzero(ipad, sizeof (ipad));
+	bzero(opad, sizeof (opad));
+	bzero(inner, sizeof (inner));
+}
+
+/*
+ * PBKDF2 (RFC 2898) with HMAC-SHA512 as its pseudorandom function.  The
+ * in-tree SHA2 implementation is used so that libzfs does not need an
+ * external crypto library for something this small.
+ */
+static void
+pbkdf2_hmac_sha512(const uint8_t *passphrase, size_t passlen,
+    const uint8_t *salt, size_t saltlen, uint64_t iters, uint8_t *out,
+    size_t outlen)
+{
+	uint8_t u[SHA512_DIGEST_LENGTH], t[SHA512_DIGEST_LENGTH];
+	uint8_t blkidx[4];
+	uint32_t blk;
+	size_t len;
+	uint64_t i;
+	int j;
+
+	for (blk = 1; outlen > 0; blk++) {
+		blkidx[0] = (blk >> 24) & 0xff;
+		blkidx[1] = (blk >> 16) & 0xff;
+		blkidx[2] = (blk >> 8) & 0xff;
+		blkidx[3] = blk & 0xff;
+
+		hmac_sha512(passphrase, passlen, salt, saltlen, blkidx,
+		    sizeof (blkidx), u);
+		bcopy(u, t, sizeof (t));
+
+		for (i = 1; i < iters; i++) {
+			hmac_sha512(passphrase, passlen, u, sizeof (u),
+			    NULL, 0, u);
+			for (j = 0; j < SHA512_DIGEST_LENGTH; j++)
+				t[j] ^= u[j];
+		}
+
+		len = MIN(outlen, sizeof (t));
+		bcopy(t, out, len);
+		out += len;
+		outlen -= len;
+	}
+
+	bzero(u, sizeof (u));
+	bzero(t, sizeof (t));
+}
+
+static int
+hex_key_to_raw(const char *hex, int hexlen, uint8_t *out)
+{
+	int i;
+	unsigned int c;
+
+	for (i = 0; i < hexlen; i += 2) {
+		if (!isxdigit(hex[i]) || !isxdigit(hex[i + 1]))
+			return (EINVAL);
+		if (sscanf(&hex[i], "%02x", &c) != 1)
+			return (EINVAL);
+		out[i / 2] = c;
+	}
+
+	return (0);
+}
+
+/*
+ * Read one line of key material from 'fd', with the trailing newline
+ * removed.  Echo is turned off while reading from a terminal.
+ */
+static int
+get_key_material_line(libzfs_handle_t *hdl, FILE *fd, const char *prompt,
+    char **buf, size_t *len_out)
+{
+	struct termios old_term, new_term;
+	boolean_t restore = B_FALSE;
+	size_t buflen = 0;
+	ssize_t bytes;
+	int ret = 0;
+
+	*buf = NULL;
+
+	if (prompt != NULL) {
+		(void) printf("%s", prompt);
+		(void) fflush(stdout);
+
+		if (tcgetattr(fileno(fd), &old_term) == 0) {
+			new_term = old_term;
+			new_term.c_lflag &= ~(ECHO | ECHOE | ECHOK | ECHONL);
+			if (tcsetattr(fileno(fd), TCSAFLUSH, &new_term) == 0)
+				restore = B_TRUE;
+		}
+	}
+
+	bytes = getline(buf, &buflen, fd);
+
+	if (restore) {
+		(void) tcsetattr(fileno(fd), TCSAFLUSH, &old_term);
+		(void) printf("\n");
+	}
+
+	if (bytes < 0) {
+		ret = (errno != 0) ? errno : EIO;
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Failed to read key material."));
+		free(*buf);
+		*buf = NULL;
+		return (ret);
+	}
+
+	if (bytes > 0 && (*buf)[bytes - 1] == '\n')
+		(*buf)[--bytes] = '\0';
+
+	*len_out = bytes;
+	return (0);
+}
+
+/*
+ * Check that the key material read is usable for 'keyformat'.
+ */
+static int
+validate_key_material(libzfs_handle_t *hdl, zfs_keyformat_t keyformat,
+    const char *km, size_t kmlen)
+{
+	switch (keyformat) {
+	case ZFS_KEYFORMAT_RAW:
+		if (kmlen != WRAPPING_KEY_LEN) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Raw key must be %u bytes."), WRAPPING_KEY_LEN);
+			return (EINVAL);
+		}
+		return (0);
+	case ZFS_KEYFORMAT_HEX:
+		if (kmlen != WRAPPING_KEY_LEN * 2) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Hex key must be %u characters."),
+			    WRAPPING_KEY_LEN * 2);
+			return (EINVAL);
+		}
+		return (0);
+	case ZFS_KEYFORMAT_PASSPHRASE:
+		if (kmlen < MIN_PASSPHRASE_LEN || kmlen > MAX_PASSPHRASE_LEN) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Passphrase must be between %u and %u "
+			    "characters."), MIN_PASSPHRASE_LEN,
+			    MAX_PASSPHRASE_LEN);
+			return (EINVAL);
+		}
+		return (0);
+	default:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Invalid keyformat."));
+		return (EINVAL);
+	}
+}
+
+/*
+ * Get the key material for 'fsname' from 'keylocation'.  New keys read
+ * from a terminal are asked for twice so that typos are caught before
+ * they become the only way into the dataset.
+ */
+static int
+get_key_material(libzfs_handle_t *hdl, boolean_t newkey,
+    zfs_keyformat_t keyformat, const char *keylocation, const char *fsname,
+    uint8_t **km_out, size_t *kmlen_out, boolean_t *can_retry)
+{
+	FILE *fd = NULL;
+	char *km = NULL, *km2 = NULL;
+	size_t kmlen = 0, kmlen2 = 0;
+	boolean_t istty = B_FALSE;
+	char prompt[ZFS_MAX_DATASET_NAME_LEN + 64];
+	int ret = 0;
+
+	*km_out = NULL;
+	*kmlen_out = 0;
+	if (can_retry != NULL)
+		*can_retry = B_FALSE;
+
+	if (strcmp(keylocation, "prompt") == 0) {
+		fd = stdin;
+		istty = isatty(fileno(fd));
+	} else if (strncmp(keylocation, "file://", 7) == 0) {
+		fd = fopen(&keylocation[7], "r");
+		if (fd == NULL) {
+			ret = errno;
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Failed to open key material file '%s'."),
+			    &keylocation[7]);
+			return (ret);
+		}
+	} else {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Invalid keylocation."));
+		return (EINVAL);
+	}
+
+	if (istty && newkey) {
+		(void) snprintf(prompt, sizeof (prompt), "Enter new %s: ",
+		    keyformat_name(keyformat));
+	} else if (istty) {
+		(void) snprintf(prompt, sizeof (prompt), "Enter %s for '%s': ",
+		    keyformat_name(keyformat), fsname);
+	}
+
+	if (keyformat == ZFS_KEYFORMAT_RAW && !istty) {
+		/* raw keys are binary and may contain newlines */
+		km = zfs_alloc(hdl, WRAPPING_KEY_LEN + 1);
+		if (km == NULL) {
+			ret = ENOMEM;
+			goto out;
+		}
+		kmlen = fread(km, 1, WRAPPING_KEY_LEN + 1, fd);
+	} else {
+		ret = get_key_material_line(hdl, fd, istty ? prompt : NULL,
+		    &km, &kmlen);
+		if (ret != 0)
+			goto out;
+	}
+
+	ret = validate_key_material(hdl, keyformat, km, kmlen);
+	if (ret != 0) {
+		if (can_retry != NULL)
+			*can_retry = istty;
+		goto out;
+	}
+
+	if (istty && newkey) {
+		(void) snprintf(prompt, sizeof (prompt), "Re-enter new %s: ",
+		    keyformat_name(keyformat));
+		ret = get_key_material_line(hdl, fd, prompt, &km2, &kmlen2);
+		if (ret != 0)
+			goto out;
+
+		if (kmlen != kmlen2 || bcmp(km, km2, kmlen) != 0) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Provided keys do not match."));
+			ret = EINVAL;
+			goto out;
+		}
+	}
+
+	*km_out = (uint8_t *)km;
+	*kmlen_out = kmlen;
+	km = NULL;
+
+out:
+	if (km != NULL) {
+		bzero(km, kmlen);
+		free(km);
+	}
+	if (km2 != NULL) {
+		bzero(km2, kmlen2);
+		free(km2);
+	}
+	if (fd != NULL && fd != stdin)
+		(void) fclose(fd);
+
+	return (ret);
+}
+
+/*
+ * Convert key material to a wrapping key according to its keyformat.
+ */
+static int
+derive_key(libzfs_handle_t *hdl, zfs_keyformat_t keyformat, uint64_t iters,
+    const uint8_t *km, size_t kmlen, uint64_t salt, uint8_t **key_out)
+{
+	uint8_t *key;
+	int ret = 0;
+
+	*key_out = NULL;
+
+	key = zfs_alloc(hdl, WRAPPING_KEY_LEN);
+	if (key == NULL)
+		return (ENOMEM);
+
+	switch (keyformat) {
+	case ZFS_KEYFORMAT_RAW:
+		bcopy(km, key, WRAPPING_KEY_LEN);
+		break;
+	case ZFS_KEYFORMAT_HEX:
+		ret = hex_key_to_raw((const char *)km, WRAPPING_KEY_LEN * 2,
+		    key);
+		if (ret != 0) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Invalid hex key provided."));
+		}
+		break;
+	case ZFS_KEYFORMAT_PASSPHRASE:
+		/* the salt is stored and hashed in little endian order */
+		salt = LE_64(salt);
+		pbkdf2_hmac_sha512(km, kmlen, (uint8_t *)&salt,
+		    sizeof (uint64_t), iters, key, WRAPPING_KEY_LEN);
+		break;
+	default:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Invalid keyformat."));
+		ret = EINVAL;
+		break;
+	}
+
+	if (ret != 0) {
+		bzero(key, WRAPPING_KEY_LEN);
+		free(key);
+		return (ret);
+	}
+
+	*key_out = key;
+	return (0);
+}
+
+static int
+random_salt(libzfs_handle_t *hdl, uint64_t *salt)
+{
+	int fd;
+	ssize_t bytes;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Failed to open /dev/urandom."));
+		return (errno);
+	}
+
+	do {
+		bytes = read(fd, salt, sizeof (uint64_t));
+	} while ((bytes == sizeof (uint64_t) && *salt == 0) ||
+	    (bytes < 0 && errno == EINTR));
+	(void) close(fd);
+
+	if (bytes != sizeof (uint64_t)) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Failed to generate salt."));
+		return (EIO);
+	}
+
+	return (0);
+}
+
+/*
+ * Fill in the parameters of a new key in 'props' and produce its wrapping
+ * key.  Passphrases get a new random salt and, unless the user picked
+ * one, the default number of PBKDF2 iterations.
+ */
+static int
+populate_create_encryption_params_nvlists(libzfs_handle_t *hdl,
+    const char *fsname, zfs_keyformat_t keyformat, char *keylocation,
+    nvlist_t *props, uint8_t **wkeydata, uint_t *wkeylen)
+{
+	uint64_t salt = 0, iters = 0;
+	uint8_t *key_material = NULL;
+	size_t key_material_len = 0;
+	uint8_t *key_data = NULL;
+	int ret;
+
+	if (keyformat == ZFS_KEYFORMAT_PASSPHRASE) {
+		ret = random_salt(hdl, &salt);
+		if (ret != 0)
+			return (ret);
+
+		if (nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS), &iters) != 0) {
+			iters = DEFAULT_PBKDF2_ITERATIONS;
+			ret = nvlist_add_uint64(props,
+			    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS), iters);
+			if (ret != 0)
+				return (ret);
+		}
+
+		ret = nvlist_add_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT), salt);
+		if (ret != 0)
+			return (ret);
+	} else if (nvlist_exists(props,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS))) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "Cannot specify pbkdf2iters with a non-passphrase "
+		    "keyformat."));
+		return (EINVAL);
+	}
+
+	ret = get_key_material(hdl, B_TRUE, keyformat, keylocation, fsname,
+	    &key_material, &key_material_len, NULL);
+	if (ret != 0)
+		return (ret);
+
+	ret = derive_key(hdl, keyformat, iters, key_material,
+	    key_material_len, salt, &key_data);
+	bzero(key_material, key_material_len);
+	free(key_material);
+	if (ret != 0)
+		return (ret);
+
+	*wkeydata = key_data;
+	*wkeylen = WRAPPING_KEY_LEN;
+	return (0);
+}
+
+static boolean_t
+encryption_feature_is_enabled(zpool_handle_t *zph)
+{
+	nvlist_t *features;
+	uint64_t feat_refcount;
+
+	if (zph == NULL)
+		return (B_FALSE);
+
+	features = zpool_get_features(zph);
+	if (features == NULL || nvlist_lookup_uint64(features,
+	    spa_feature_table[SPA_FEATURE_ENCRYPTION].fi_guid,
+	    &feat_refcount) != 0)
+		return (B_FALSE);
+
+	return (B_TRUE);
+}
+
+/*
+ * Called by zfs_create() before the dataset is created: decides from the
+ * properties given and those of the parent whether the new dataset will be
+ * an encryption root, and if so gets its wrapping key.  On success
+ * '*wkeydata' is either NULL or a WRAPPING_KEY_LEN byte key that the
+ * caller must free.  Errors are described with zfs_error_aux() and left
+ * for the caller to report.
+ */
+int
+zfs_crypto_create(libzfs_handle_t *hdl, char *parent_name, nvlist_t *props,
+    uint8_t **wkeydata_out, uint_t *wkeylen_out)
+{
+	uint64_t crypt = ZIO_CRYPT_INHERIT, pcrypt = ZIO_CRYPT_OFF;
+	uint64_t keyformat = ZFS_KEYFORMAT_NONE;
+	char *keylocation = NULL;
+	zfs_handle_t *pzhp = NULL;
+	zpool_handle_t *zph = NULL;
+	uint8_t *wkeydata = NULL;
+	uint_t wkeylen = 0;
+	boolean_t local_crypt = B_TRUE;
+	char *slash;
+	int ret = 0;
+
+	*wkeydata_out = NULL;
+	*wkeylen_out = 0;
+
+	if (nvlist_lookup_uint64(props,
+	    zfs_prop_to_name(ZFS_PROP_ENCRYPTION), &crypt) != 0)
+		local_crypt = B_FALSE;
+	(void) nvlist_lookup_uint64(props,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), &keyformat);
+	(void) nvlist_lookup_string(props,
+	    zfs_prop_to_name(ZFS_PROP_KEYLOCATION), &keylocation);
+
+	if (parent_name != NULL) {
+		pzhp = make_dataset_handle(hdl, parent_name);
+		if (pzhp == NULL) {
+			ret = ENOENT;
+			goto out;
+		}
+		pcrypt = zfs_prop_get_int(pzhp, ZFS_PROP_ENCRYPTION);
+	}
+
+	/* nothing to do for datasets that won't be encrypted */
+	if (pcrypt == ZIO_CRYPT_OFF && !local_crypt &&
+	    keyformat == ZFS_KEYFORMAT_NONE) {
+		if (keylocation != NULL && strcmp(keylocation, "none") != 0) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "keylocation may only be set on encryption "
+			    "roots."));
+			ret = EINVAL;
+			goto out;
+		}
+		goto out;
+	}
+
+	if (local_crypt && crypt == ZIO_CRYPT_OFF) {
+		if (pcrypt != ZIO_CRYPT_OFF) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Cannot create unencrypted dataset beneath an "
+			    "encrypted one."));
+			ret = EINVAL;
+		} else if (keyformat != ZFS_KEYFORMAT_NONE ||
+		    (keylocation != NULL && strcmp(keylocation, "none") != 0)) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Encryption properties given with "
+			    "encryption=off."));
+			ret = EINVAL;
+		}
+		goto out;
+	}
+
+	if (parent_name != NULL) {
+		char pool[ZFS_MAX_DATASET_NAME_LEN];
+
+		(void) strlcpy(pool, parent_name, sizeof (pool));
+		if ((slash = strchr(pool, '/')) != NULL)
+			*slash = '\0';
+		zph = zpool_open_canfail(hdl, pool);
+		if (!encryption_feature_is_enabled(zph)) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Encryption feature not enabled."));
+			ret = EINVAL;
+			goto out;
+		}
+	}
+
+	/* without a key of its own the dataset relies on its parent's */
+	if (keyformat == ZFS_KEYFORMAT_NONE) {
+		if (pcrypt == ZIO_CRYPT_OFF) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Keyformat required for new encryption root."));
+			ret = EINVAL;
+		} else if (zfs_prop_get_int(pzhp, ZFS_PROP_KEYSTATUS) !=
+		    ZFS_KEYSTATUS_AVAILABLE) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "Parent key must be loaded."));
+			ret = EACCES;
+		} else if (keylocation != NULL &&
+		    strcmp(keylocation, "none") != 0) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "keylocation may only be set on encryption "
+			    "roots."));
+			ret = EINVAL;
+		}
+		goto out;
+	}
+
+	if (keylocation == NULL) {
+		keylocation = "prompt";
+		ret = nvlist_add_string(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYLOCATION), keylocation);
+		if (ret != 0)
+			goto out;
+	} else if (strcmp(keylocation, "none") == 0) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "keylocation must not be 'none' for an encryption root."));
+		ret = EINVAL;
+		goto out;
+	}
+
+	ret = populate_create_encryption_params_nvlists(hdl, NULL, keyformat,
+	    keylocation, props, &wkeydata, &wkeylen);
+	if (ret != 0)
+		goto out;
+
+	*wkeydata_out = wkeydata;
+	*wkeylen_out = wkeylen;
+
+out:
+	if (pzhp != NULL)
+		zfs_close(pzhp);
+	if (zph != NULL)
+		zpool_close(zph);
+
+	return (ret);
+}
+
+/*
+ * Open the encryption root of 'zhp'.  Keys are always loaded, unloaded
+ * and changed on the encryption root.
+ */
+static int
+get_encryption_root(zfs_handle_t *zhp, zfs_handle_t **rzhp, boolean_t *is_root)
+{
+	char root[ZFS_MAX_DATASET_NAME_LEN];
+
+	*rzhp = NULL;
+
+	if (zfs_prop_get(zhp, ZFS_PROP_ENCRYPTION_ROOT, root, sizeof (root),
+	    NULL, NULL, 0, B_TRUE) != 0 || root[0] == '\0')
+		return (EINVAL);
+
+	if (is_root != NULL)
+		*is_root = (strcmp(root, zfs_get_name(zhp)) == 0);
+
+	*rzhp = make_dataset_handle(zhp->zfs_hdl, root);
+	return ((*rzhp == NULL) ? ENOENT : 0);
+}
+
+/*
+ * Load the wrapping key of the encryption root 'zhp'.  With 'noop' the key
+ * is only checked.  'alt_keylocation', if not NULL, overrides the dataset's
+ * keylocation for this one load.
+ */
+int
+zfs_crypto_load_key(zfs_handle_t *zhp, boolean_t noop, char *alt_keylocation)
+{
+	int ret, attempts = 0;
+	char errbuf[1024];
+	uint64_t keystatus, iters = 0, salt = 0;
+	uint64_t keyformat = ZFS_KEYFORMAT_NONE;
+	char prop_keylocation[MAXNAMELEN];
+	char *keylocation = NULL;
+	uint8_t *key_material = NULL, *key_data = NULL;
+	size_t key_material_len;
+	boolean_t is_encroot, can_retry = B_FALSE;
+	zfs_handle_t *rzhp = NULL;
+
+	(void) snprintf(errbuf, sizeof (errbuf),
+	    dgettext(TEXT_DOMAIN, "Key load error"));
+
+	if (zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS) == ZFS_KEYSTATUS_NONE) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "'%s' is not encrypted."), zfs_get_name(zhp));
+		ret = EINVAL;
+		goto error;
+	}
+
+	ret = get_encryption_root(zhp, &rzhp, &is_encroot);
+	if (ret != 0) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Failed to get encryption root for '%s'."),
+		    zfs_get_name(zhp));
+		goto error;
+	}
+	if (!is_encroot) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Keys must be loaded for encryption root of '%s' (%s)."),
+		    zfs_get_name(zhp), zfs_get_name(rzhp));
+		zfs_close(rzhp);
+		ret = EINVAL;
+		goto error;
+	}
+	zfs_close(rzhp);
+
+	keyformat = zfs_prop_get_int(zhp, ZFS_PROP_KEYFORMAT);
+
+	if (alt_keylocation != NULL) {
+		keylocation = alt_keylocation;
+	} else {
+		ret = zfs_prop_get(zhp, ZFS_PROP_KEYLOCATION,
+		    prop_keylocation, sizeof (prop_keylocation), NULL, NULL,
+		    0, B_TRUE);
+		if (ret != 0) {
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Failed to get keylocation for '%s'."),
+			    zfs_get_name(zhp));
+			goto error;
+		}
+		keylocation = prop_keylocation;
+	}
+
+	/* a dataset only loads its key once unless the caller just checks */
+	keystatus = zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS);
+	if (!noop && keystatus == ZFS_KEYSTATUS_AVAILABLE) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Key already loaded for '%s'."), zfs_get_name(zhp));
+		ret = EEXIST;
+		goto error;
+	}
+
+	if (keyformat == ZFS_KEYFORMAT_PASSPHRASE) {
+		salt = zfs_prop_get_int(zhp, ZFS_PROP_PBKDF2_SALT);
+		iters = zfs_prop_get_int(zhp, ZFS_PROP_PBKDF2_ITERS);
+	}
+
+try_again:
+	ret = get_key_material(zhp->zfs_hdl, B_FALSE, keyformat, keylocation,
+	    zfs_get_name(zhp), &key_material, &key_material_len, &can_retry);
+	if (ret != 0)
+		goto error;
+
+	ret = derive_key(zhp->zfs_hdl, keyformat, iters, key_material,
+	    key_material_len, salt, &key_data);
+	bzero(key_material, key_material_len);
+	free(key_material);
+	key_material = NULL;
+	if (ret != 0)
+		goto error;
+
+	ret = lzc_load_key(zfs_get_name(zhp), noop, key_data,
+	    WRAPPING_KEY_LEN);
+	bzero(key_data, WRAPPING_KEY_LEN);
+	free(key_data);
+	key_data = NULL;
+	if (ret != 0) {
+		can_retry = B_FALSE;
+		switch (ret) {
+		case EPERM:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Permission denied."));
+			break;
+		case EINVAL:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Invalid parameters provided for dataset %s."),
+			    zfs_get_name(zhp));
+			break;
+		case EEXIST:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Key already loaded for '%s'."),
+			    zfs_get_name(zhp));
+			break;
+		case EBUSY:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "'%s' is busy."), zfs_get_name(zhp));
+			break;
+		case EACCES:
+			/* a mistyped key may be tried again at the prompt */
+			can_retry = (strcmp(keylocation, "prompt") == 0 &&
+			    isatty(fileno(stdin)));
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Incorrect key provided for '%s'."),
+			    zfs_get_name(zhp));
+			break;
+		default:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Unknown error (%d)."), ret);
+			break;
+		}
+		goto error;
+	}
+
+	return (0);
+
+error:
+	(void) zfs_error(zhp->zfs_hdl, EZFS_CRYPTOFAILED, errbuf);
+	if (can_retry && ++attempts < MAX_KEY_PROMPT_ATTEMPTS) {
+		can_retry = B_FALSE;
+		goto try_again;
+	}
+
+	return (ret);
+}
+
+/*
+ * Unload the wrapping key of the encryption root 'zhp'.
+ */
+int
+zfs_crypto_unload_key(zfs_handle_t *zhp)
+{
+	int ret;
+	char errbuf[1024];
+	boolean_t is_encroot;
+	zfs_handle_t *rzhp = NULL;
+
+	(void) snprintf(errbuf, sizeof (errbuf),
+	    dgettext(TEXT_DOMAIN, "Key unload error"));
+
+	if (zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS) == ZFS_KEYSTATUS_NONE) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "'%s' is not encrypted."), zfs_get_name(zhp));
+		ret = EINVAL;
+		goto error;
+	}
+
+	ret = get_encryption_root(zhp, &rzhp, &is_encroot);
+	if (ret != 0) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Failed to get encryption root for '%s'."),
+		    zfs_get_name(zhp));
+		goto error;
+	}
+	if (!is_encroot) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Keys must be unloaded for encryption root of '%s' (%s)."),
+		    zfs_get_name(zhp), zfs_get_name(rzhp));
+		zfs_close(rzhp);
+		ret = EINVAL;
+		goto error;
+	}
+	zfs_close(rzhp);
+
+	if (zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS) ==
+	    ZFS_KEYSTATUS_UNAVAILABLE) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Key already unloaded for '%s'."), zfs_get_name(zhp));
+		ret = ENOENT;
+		goto error;
+	}
+
+	ret = lzc_unload_key(zfs_get_name(zhp));
+	if (ret != 0) {
+		switch (ret) {
+		case EPERM:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Permission denied."));
+			break;
+		case ENOENT:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Key already unloaded for '%s'."),
+			    zfs_get_name(zhp));
+			break;
+		case EBUSY:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "'%s' is busy."), zfs_get_name(zhp));
+			break;
+		}
+		(void) zfs_error(zhp->zfs_hdl, EZFS_CRYPTOFAILED, errbuf);
+	}
+
+	return (ret);
+
+error:
+	(void) zfs_error(zhp->zfs_hdl, EZFS_CRYPTOFAILED, errbuf);
+	return (ret);
+}
+
+/*
+ * Change the wrapping key of 'zhp'.  With 'inheritkey' the dataset stops
+ * being an encryption root and is rewrapped with its parent's key;
+ * otherwise it becomes (or stays) an encryption root with a new key
+ * described by the keyformat, keylocation and pbkdf2iters in 'raw_props'.
+ */
+int
+zfs_crypto_rewrap(zfs_handle_t *zhp, nvlist_t *raw_props, boolean_t inheritkey)
+{
+	int ret;
+	char errbuf[1024];
+	boolean_t is_encroot;
+	nvlist_t *props = NULL;
+	uint8_t *wkeydata = NULL;
+	uint_t wkeylen = 0;
+	dcp_cmd_t cmd = (inheritkey) ? DCP_CMD_INHERIT : DCP_CMD_NEW_KEY;
+	uint64_t keyformat, keystatus, pcrypt;
+	zfs_handle_t *pzhp = NULL, *rzhp = NULL;
+	char *keylocation = NULL;
+	char parent_name[ZFS_MAX_DATASET_NAME_LEN];
+	char prop_keylocation[MAXNAMELEN];
+
+	(void) snprintf(errbuf, sizeof (errbuf),
+	    dgettext(TEXT_DOMAIN, "Key change error"));
+
+	if (zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS) == ZFS_KEYSTATUS_NONE) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "'%s' is not encrypted."), zfs_get_name(zhp));
+		ret = EINVAL;
+		goto error;
+	}
+
+	/* the key of a dataset can only be changed while it is loaded */
+	keystatus = zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS);
+	if (keystatus != ZFS_KEYSTATUS_AVAILABLE) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Key must be loaded for '%s'."), zfs_get_name(zhp));
+		ret = EACCES;
+		goto error;
+	}
+
+	ret = get_encryption_root(zhp, &rzhp, &is_encroot);
+	if (ret != 0) {
+		zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+		    "Failed to get encryption root for '%s'."),
+		    zfs_get_name(zhp));
+		goto error;
+	}
+	zfs_close(rzhp);
+
+	if (inheritkey) {
+		if (!is_encroot) {
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Key inheritting can only be performed on "
+			    "encryption roots."));
+			ret = EINVAL;
+			goto error;
+		}
+
+		if (zfs_parent_name(zhp, parent_name,
+		    sizeof (parent_name)) != 0) {
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Root dataset cannot inherit key."));
+			ret = EINVAL;
+			goto error;
+		}
+
+		pzhp = make_dataset_handle(zhp->zfs_hdl, parent_name);
+		if (pzhp == NULL) {
+			ret = ENOENT;
+			goto error;
+		}
+
+		pcrypt = zfs_prop_get_int(pzhp, ZFS_PROP_ENCRYPTION);
+		keystatus = zfs_prop_get_int(pzhp, ZFS_PROP_KEYSTATUS);
+		zfs_close(pzhp);
+
+		if (pcrypt == ZIO_CRYPT_OFF) {
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Parent must be encrypted."));
+			ret = EINVAL;
+			goto error;
+		}
+
+		if (keystatus != ZFS_KEYSTATUS_AVAILABLE) {
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Parent key must be loaded."));
+			ret = EACCES;
+			goto error;
+		}
+	} else {
+		/* the key parameters are set once, just like at creation */
+		props = zfs_valid_proplist(zhp->zfs_hdl, zhp->zfs_type,
+		    raw_props, zfs_prop_get_int(zhp, ZFS_PROP_ZONED), NULL,
+		    NULL, errbuf);
+		if (props == NULL) {
+			ret = EINVAL;
+			goto error;
+		}
+
+		/* anything not given is carried over from the current key */
+		if (nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), &keyformat) != 0) {
+			keyformat = zfs_prop_get_int(zhp, ZFS_PROP_KEYFORMAT);
+			ret = nvlist_add_uint64(props,
+			    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), keyformat);
+			if (ret != 0)
+				goto error;
+		}
+
+		if (nvlist_lookup_string(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYLOCATION),
+		    &keylocation) != 0) {
+			if (is_encroot && zfs_prop_get(zhp,
+			    ZFS_PROP_KEYLOCATION, prop_keylocation,
+			    sizeof (prop_keylocation), NULL, NULL, 0,
+			    B_TRUE) == 0 &&
+			    strcmp(prop_keylocation, "none") != 0)
+				keylocation = prop_keylocation;
+			else
+				keylocation = "prompt";
+
+			ret = nvlist_add_string(props,
+			    zfs_prop_to_name(ZFS_PROP_KEYLOCATION),
+			    keylocation);
+			if (ret != 0)
+				goto error;
+		} else if (strcmp(keylocation, "none") == 0) {
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "keylocation must not be 'none' for an "
+			    "encryption root."));
+			ret = EINVAL;
+			goto error;
+		}
+
+		ret = populate_create_encryption_params_nvlists(zhp->zfs_hdl,
+		    zfs_get_name(zhp), keyformat, keylocation, props,
+		    &wkeydata, &wkeylen);
+		if (ret != 0)
+			goto error;
+	}
+
+	ret = lzc_change_key(zfs_get_name(zhp), cmd, props, wkeydata, wkeylen);
+	if (ret != 0) {
+		switch (ret) {
+		case EINVAL:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Invalid properties for key change."));
+			break;
+		case EACCES:
+			zfs_error_aux(zhp->zfs_hdl, dgettext(TEXT_DOMAIN,
+			    "Key is not currently loaded."));
+			break;
+		}
+		(void) zfs_error(zhp->zfs_hdl, EZFS_CRYPTOFAILED, errbuf);
+	}
+
+	nvlist_free(props);
+	if (wkeydata != NULL) {
+		bzero(wkeydata, wkeylen);
+		free(wkeydata);
+	}
+
+	return (ret);
+
+error:
+	nvlist_free(props);
+	if (wkeydata != NULL) {
+		bzero(wkeydata, wkeylen);
+		free(wkeydata);
+	}
+
+	(void) zfs_error(zhp->zfs_hdl, EZFS_CRYPTOFAILED, errbuf);
+	return (ret);
+}
@@ -102,6 +102,11 @@ typedef struct pool_list {
 
 #define	DEV_BYID_PATH	"/dev/disk/by-id/"
 
+/*
+ * Minimum number of threads used to read labels during import.
+ */
+#define	IMPORT_MIN_THREADS	32
+
 /*
  * Linux persistent device strings for vdev labels
  *
@@ -1307,13 +1312,17 @@ label_offset(uint64_t size, int l)
  * Given a file descriptor, read the label information and return an nvlist
  * describing the configuration, if there is one.  The number of valid
  * labels found will be returned in num_labels when non-NULL.
+ *
+ * The two labels at the front of the device and the two at the end are
+ * adjacent, so each pair is read with a single request.
  */
 int
 zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 {
 	struct stat64 statbuf;
 	int l, count = 0;
-	vdev_label_t *label;
+	vdev_label_t *labels;
+	boolean_t valid[VDEV_LABELS];
 	nvlist_t *expected_config = NULL;
 	uint64_t expected_guid = 0, size;
 	int error;
@@ -1324,15 +1333,25 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 		return (0);
 	size = P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t);
 
-	error = posix_memalign((void **)&label, PAGESIZE, sizeof (*label));
+	error = posix_memalign((void **)&labels, PAGESIZE,
+	    VDEV_LABELS * sizeof (vdev_label_t));
 	if (error)
 		return (-1);
 
+	for (l = 0; l < VDEV_LABELS; l += 2) {
+		size_t len = 2 * sizeof (vdev_label_t);
+		ssize_t rc;
+
+		rc = pread64(fd, &labels[l], len, label_offset(size, l));
+		valid[l] = (rc >= (ssize_t)sizeof (vdev_label_t));
+		valid[l + 1] = (rc == (ssize_t)len);
+	}
+
 	for (l = 0; l < VDEV_LABELS; l++) {
+		vdev_label_t *label = &labels[l];
 		uint64_t state, guid, txg;
 
-		if (pread64(fd, label, sizeof (vdev_label_t),
-		    label_offset(size, l)) != sizeof (vdev_label_t))
+		if (!valid[l])
 			continue;
 
 		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
@@ -1373,12 +1392,35 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 	if (num_labels != NULL)
 		*num_labels = count;
 
-	free(label);
+	free(labels);
 	*config = expected_config;
 
 	return (0);
 }
 
+/*
+ * The same device is usually reachable through several of the searched
+ * paths (by-id, by-path, /dev, ...).  Labels are cached by device identity
+ * so each device is only opened and read once, no matter how many names
+ * it has.  A name which is looked up while another thread is reading the
+ * same device waits for that read to complete.
+ */
+typedef struct label_cache {
+	kmutex_t	lc_lock;
+	kcondvar_t	lc_cv;
+	avl_tree_t	lc_tree;
+} label_cache_t;
+
+typedef struct label_cache_node {
+	dev_t		lcn_dev;	/* st_rdev, or st_dev for files */
+	ino64_t		lcn_ino;	/* 0 for block devices */
+	boolean_t	lcn_done;	/* label read completed */
+	int		lcn_error;	/* zpool_read_label() failed */
+	int		lcn_num_labels;	/* Number of valid labels */
+	nvlist_t	*lcn_config;	/* Label config */
+	avl_node_t	lcn_node;
+} label_cache_node_t;
+
 typedef struct rdsk_node {
 	char *rn_name;			/* Full path to device */
 	int rn_order;			/* Preferred order (low to high) */
@@ -1389,6 +1431,7 @@ typedef struct rdsk_node {
 	avl_tree_t *rn_avl;
 	avl_node_t rn_node;
 	kmutex_t *rn_lock;
+	label_cache_t *rn_label_cache;
 	boolean_t rn_labelpaths;
 } rdsk_node_t;
 
@@ -1417,6 +1460,141 @@ slice_cache_compare(const void *arg1, const void *arg2)
 	return (AVL_ISIGN(strcmp(nm1, nm2)));
 }
 
+static int
+label_cache_compare(const void *arg1, const void *arg2)
+{
+	const label_cache_node_t *lcn1 = arg1;
+	const label_cache_node_t *lcn2 = arg2;
+	int rv;
+
+	rv = AVL_CMP(lcn1->lcn_dev, lcn2->lcn_dev);
+	if (rv)
+		return (rv);
+
+	return (AVL_CMP(lcn1->lcn_ino, lcn2->lcn_ino));
+}
+
+static void
+label_cache_init(label_cache_t *lc)
+{
+	mutex_init(&lc->lc_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&lc->lc_cv, NULL, CV_DEFAULT, NULL);
+	avl_create(&lc->lc_tree, label_cache_compare,
+	    sizeof (label_cache_node_t), offsetof(label_cache_node_t, lcn_node));
+}
+
+static void
+label_cache_fini(label_cache_t *lc)
+{
+	label_cache_node_t *lcn;
+	void *cookie = NULL;
+
+	while ((lcn = avl_destroy_nodes(&lc->lc_tree, &cookie)) != NULL) {
+		nvlist_free(lcn->lcn_config);
+		free(lcn);
+	}
+	avl_destroy(&lc->lc_tree);
+	cv_destroy(&lc->lc_cv);
+	mutex_destroy(&lc->lc_lock);
+}
+
+/*
+ * Open the device and read its label.
+ */
+static int
+label_read_device(const char *name, struct stat64 *statbuf,
+    nvlist_t **config, int *num_labels)
+{
+	int error;
+	int fd;
+
+	*config = NULL;
+	*num_labels = 0;
+
+	/*
+	 * Preferentially open using O_DIRECT to bypass the block device
+	 * cache which may be stale for multipath devices.  An EINVAL errno
+	 * indicates O_DIRECT is unsupported so fallback to just O_RDONLY.
+	 */
+	fd = open(name, O_RDONLY | O_DIRECT);
+	if ((fd < 0) && (errno == EINVAL))
+		fd = open(name, O_RDONLY);
+
+	if (fd < 0)
+		return (-1);
+
+	/*
+	 * This file is too small to hold a zpool
+	 */
+	if (S_ISREG(statbuf->st_mode) && statbuf->st_size < SPA_MINDEVSIZE) {
+		(void) close(fd);
+		return (-1);
+	}
+
+	error = zpool_read_label(fd, config, num_labels);
+	(void) close(fd);
+
+	return (error);
+}
+
+/*
+ * Return the label of the device named by rn, reading it only if no other
+ * name for the same device has been read yet.  The caller owns the
+ * returned config.
+ */
+static int
+label_read_cached(rdsk_node_t *rn, struct stat64 *statbuf,
+    nvlist_t **config, int *num_labels)
+{
+	label_cache_t *lc = rn->rn_label_cache;
+	label_cache_node_t search, *lcn;
+	avl_index_t where;
+
+	if (lc == NULL)
+		return (label_read_device(rn->rn_name, statbuf, config,
+		    num_labels));
+
+	if (S_ISBLK(statbuf->st_mode)) {
+		search.lcn_dev = statbuf->st_rdev;
+		search.lcn_ino = 0;
+	} else {
+		search.lcn_dev = statbuf->st_dev;
+		search.lcn_ino = statbuf->st_ino;
+	}
+
+	mutex_enter(&lc->lc_lock);
+	lcn = avl_find(&lc->lc_tree, &search, &where);
+	if (lcn == NULL) {
+		lcn = zfs_alloc(rn->rn_hdl, sizeof (label_cache_node_t));
+		lcn->lcn_dev = search.lcn_dev;
+		lcn->lcn_ino = search.lcn_ino;
+		avl_insert(&lc->lc_tree, lcn, where);
+		mutex_exit(&lc->lc_lock);
+
+		lcn->lcn_error = label_read_device(rn->rn_name, statbuf,
+		    &lcn->lcn_config, &lcn->lcn_num_labels);
+
+		mutex_enter(&lc->lc_lock);
+		lcn->lcn_done = B_TRUE;
+		cv_broadcast(&lc->lc_cv);
+	} else {
+		while (!lcn->lcn_done)
+			cv_wait(&lc->lc_cv, &lc->lc_lock);
+	}
+	mutex_exit(&lc->lc_lock);
+
+	/*
+	 * The cached entry is read-only once lcn_done is set.
+	 */
+	*config = NULL;
+	*num_labels = lcn->lcn_num_labels;
+	if (lcn->lcn_config != NULL &&
+	    nvlist_dup(lcn->lcn_config, config, 0) != 0)
+		return (-1);
+
+	return (lcn->lcn_error);
+}
+
 static boolean_t
 is_watchdog_dev(char *dev)
 {
@@ -1505,7 +1683,6 @@ zpool_open_func(void *arg)
 	uint64_t vdev_guid = 0;
 	int error;
 	int num_labels;
-	int fd;
 
 	/*
 	 * Skip devices with well known prefixes there can be side effects
@@ -1528,34 +1705,13 @@ zpool_open_func(void *arg)
 	    (!S_ISREG(statbuf.st_mode) && !S_ISBLK(statbuf.st_mode)))
 		return;
 
-	/*
-	 * Preferentially open using O_DIRECT to bypass the block device
-	 * cache which may be stale for multipath devices.  An EINVAL errno
-	 * indicates O_DIRECT is unsupported so fallback to just O_RDONLY.
-	 */
-	fd = open(rn->rn_name, O_RDONLY | O_DIRECT);
-	if ((fd < 0) && (errno == EINVAL))
-		fd = open(rn->rn_name, O_RDONLY);
-
-	if (fd < 0)
-		return;
-
-	/*
-	 * This file is too small to hold a zpool
-	 */
-	if (S_ISREG(statbuf.st_mode) && statbuf.st_size < SPA_MINDEVSIZE) {
-		(void) close(fd);
-		return;
-	}
-
-	error = zpool_read_label(fd, &config, &num_labels);
+	error = label_read_cached(rn, &statbuf, &config, &num_labels);
 	if (error != 0) {
-		(void) close(fd);
+		nvlist_free(config);
 		return;
 	}
 
 	if (num_labels == 0) {
-		(void) close(fd);
 		nvlist_free(config);
 		return;
 	}
@@ -1567,13 +1723,10 @@ zpool_open_func(void *arg)
 	 */
 	error = nvlist_lookup_uint64(config, ZPOOL_CONFIG_GUID, &vdev_guid);
 	if (error || (rn->rn_vdev_guid && rn->rn_vdev_guid != vdev_guid)) {
-		(void) close(fd);
 		nvlist_free(config);
 		return;
 	}
 
-	(void) close(fd);
-
 	rn->rn_config = config;
 	rn->rn_num_labels = num_labels;
 
@@ -1600,6 +1753,7 @@ zpool_open_func(void *arg)
 			slice->rn_name = zfs_strdup(hdl, path);
 			slice->rn_vdev_guid = vdev_guid;
 			slice->rn_avl = rn->rn_avl;
+			slice->rn_label_cache = rn->rn_label_cache;
 			slice->rn_hdl = hdl;
 			slice->rn_order = IMPORT_ORDER_PREFERRED_1;
 			slice->rn_labelpaths = B_FALSE;
@@ -1626,6 +1780,7 @@ zpool_open_func(void *arg)
 
 			slice->rn_vdev_guid = vdev_guid;
 			slice->rn_avl = rn->rn_avl;
+			slice->rn_label_cache = rn->rn_label_cache;
 			slice->rn_hdl = hdl;
 			slice->rn_order = IMPORT_ORDER_PREFERRED_2;
 			slice->rn_labelpaths = B_FALSE;
@@ -1861,10 +2016,12 @@ zpool_find_import_impl(libzfs_handle_t *hdl, importargs_t *iarg)
 	config_entry_t *ce, *cenext;
 	name_entry_t *ne, *nenext;
 	kmutex_t lock;
+	label_cache_t label_cache;
 	avl_tree_t *cache;
 	rdsk_node_t *slice;
 	void *cookie;
 	taskq_t *t;
+	int threads;
 
 	verify(iarg->poolname == NULL || iarg->guid == 0);
 	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
@@ -1894,17 +2051,25 @@ zpool_find_import_impl(libzfs_handle_t *hdl, importargs_t *iarg)
 	/*
 	 * Create a thread pool to parallelize the process of reading and
 	 * validating labels, a large number of threads can be used due to
-	 * minimal contention.
+	 * minimal contention.  The work is dominated by waiting for label
+	 * reads, so allow at least IMPORT_MIN_THREADS of them to be
+	 * outstanding even on systems with few CPUs.
 	 */
-	t = taskq_create("z_import", 2 * boot_ncpus, defclsyspri,
-	    2 * boot_ncpus, INT_MAX, TASKQ_PREPOPULATE);
+	threads = MAX(2 * boot_ncpus, IMPORT_MIN_THREADS);
+	threads = MAX(MIN(threads, avl_numnodes(cache)), 1);
+	t = taskq_create("z_import", threads, defclsyspri, threads, INT_MAX,
+	    TASKQ_PREPOPULATE);
 
+	label_cache_init(&label_cache);
 	for (slice = avl_first(cache); slice;
-	    (slice = avl_walk(cache, slice, AVL_AFTER)))
+	    (slice = avl_walk(cache, slice, AVL_AFTER))) {
+		slice->rn_label_cache = &label_cache;
 		(void) taskq_dispatch(t, zpool_open_func, slice, TQ_SLEEP);
+	}
 
 	taskq_wait(t);
 	taskq_destroy(t);
+	label_cache_fini(&label_cache);
 
 	/*
 	 * Process the cache filtering out any entries which are not
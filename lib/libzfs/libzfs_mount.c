@@ -84,8 +84,16 @@
 
 #include <libshare.h>
 #include <sys/systeminfo.h>
+#include <sys/zfs_context.h>
 #define	MAXISALEN	257	/* based on sysinfo(2) man page */
 
+/*
+ * Maximum number of filesystems mounted concurrently by
+ * zfs_foreach_mountpoint().  Mounting is dominated by waiting for the
+ * pool and the mount helper rather than by CPU time.
+ */
+#define	MOUNT_MAX_THREADS	64
+
 static int zfs_share_proto(zfs_handle_t *, zfs_share_proto_t *);
 zfs_share_type_t zfs_is_shared_proto(zfs_handle_t *, char **,
     zfs_share_proto_t);
@@ -1152,6 +1160,12 @@ mount_cb(zfs_handle_t *zhp, void *data)
 	return (0);
 }
 
+/*
+ * Sort datasets by mountpoint, treating '/' as smaller than any other
+ * character.  This places every mountpoint directly before the
+ * mountpoints nested under it ("/a", "/a/b", "/a-b" rather than "/a",
+ * "/a-b", "/a/b"), which zfs_foreach_mountpoint() depends on.
+ */
 int
 libzfs_dataset_cmp(const void *a, const void *b)
 {
@@ -1159,6 +1173,8 @@ libzfs_dataset_cmp(const void *a, const void *b)
 	zfs_handle_t **zb = (zfs_handle_t **)b;
 	char mounta[MAXPATHLEN];
 	char mountb[MAXPATHLEN];
+	const char *ma = mounta;
+	const char *mb = mountb;
 	boolean_t gota, gotb;
 
 	if ((gota = (zfs_get_type(*za) == ZFS_TYPE_FILESYSTEM)) != 0)
@@ -1168,8 +1184,23 @@ libzfs_dataset_cmp(const void *a, const void *b)
 		verify(zfs_prop_get(*zb, ZFS_PROP_MOUNTPOINT, mountb,
 		    sizeof (mountb), NULL, NULL, 0, B_FALSE) == 0);
 
-	if (gota && gotb)
-		return (strcmp(mounta, mountb));
+	if (gota && gotb) {
+		while (*ma != '\0' && *ma == *mb) {
+			ma++;
+			mb++;
+		}
+		if (*ma == *mb)
+			return (0);
+		if (*ma == '\0')
+			return (-1);
+		if (*mb == '\0')
+			return (1);
+		if (*ma == '/')
+			return (-1);
+		if (*mb == '/')
+			return (1);
+		return (*ma < *mb ? -1 : 1);
+	}
 
 	if (gota)
 		return (-1);
@@ -1179,23 +1210,206 @@ libzfs_dataset_cmp(const void *a, const void *b)
 	return (strcmp(zfs_get_name(*za), zfs_get_name(*zb)));
 }
 
+/*
+ * Return B_TRUE if path2 is path1 or is nested under path1.  Datasets
+ * sharing a mountpoint are treated as nested so they are never mounted
+ * concurrently.
+ */
+static boolean_t
+libzfs_path_contains(const char *path1, const char *path2)
+{
+	size_t len = strlen(path1);
+
+	if (strncmp(path1, path2, len) != 0)
+		return (B_FALSE);
+
+	return (strcmp(path1, "/") == 0 || path2[len] == '/' ||
+	    path2[len] == '\0');
+}
+
+static void
+zfs_get_mountpoint(zfs_handle_t *zhp, char *buf, size_t len)
+{
+	if (zfs_get_type(zhp) != ZFS_TYPE_FILESYSTEM ||
+	    zfs_prop_get(zhp, ZFS_PROP_MOUNTPOINT, buf, len,
+	    NULL, NULL, 0, B_FALSE) != 0)
+		buf[0] = '\0';
+}
+
+/*
+ * Given a list of handles sorted by libzfs_dataset_cmp(), return the index
+ * of the first entry after idx which is not nested under handles[idx].
+ */
+static int
+non_descendant_idx(zfs_handle_t **handles, size_t num_handles, int idx)
+{
+	char parent[ZFS_MAXPROPLEN];
+	char child[ZFS_MAXPROPLEN];
+	int i;
+
+	zfs_get_mountpoint(handles[idx], parent, sizeof (parent));
+
+	for (i = idx + 1; i < num_handles; i++) {
+		zfs_get_mountpoint(handles[i], child, sizeof (child));
+		if (parent[0] == '\0' || !libzfs_path_contains(parent, child))
+			break;
+	}
+
+	return (i);
+}
+
+typedef struct mnt_param {
+	taskq_t		*mnt_tq;
+	zfs_handle_t	**mnt_zhps;	/* filesystems to mount */
+	size_t		mnt_num_handles;
+	int		mnt_idx;	/* Index of selected entry to mount */
+	zfs_iter_f	mnt_func;
+	void		*mnt_data;
+} mnt_param_t;
+
+static void zfs_mount_task(void *arg);
+
+/*
+ * Allocate and populate the parameter struct for the mount task, and
+ * schedule mounting of the entry selected by idx.
+ */
+static void
+zfs_dispatch_mount(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    size_t num_handles, int idx, zfs_iter_f func, void *data, taskq_t *tq)
+{
+	mnt_param_t *mp = zfs_alloc(hdl, sizeof (mnt_param_t));
+
+	mp->mnt_tq = tq;
+	mp->mnt_zhps = handles;
+	mp->mnt_num_handles = num_handles;
+	mp->mnt_idx = idx;
+	mp->mnt_func = func;
+	mp->mnt_data = data;
+
+	(void) taskq_dispatch(tq, zfs_mount_task, mp, TQ_SLEEP);
+}
+
+/*
+ * Taskq function to mount one filesystem.  Once it is mounted the
+ * filesystems with mountpoints directly below it are dispatched: the
+ * first nested mountpoint is dispatched, all of its own descendants are
+ * skipped (it will dispatch them itself), and so on.  A chain of nested
+ * mountpoints is therefore mounted serially, while independent subtrees
+ * are mounted concurrently.
+ */
+static void
+zfs_mount_task(void *arg)
+{
+	mnt_param_t *mp = arg;
+	zfs_handle_t **handles = mp->mnt_zhps;
+	size_t num_handles = mp->mnt_num_handles;
+	int idx = mp->mnt_idx;
+	char mountpoint[ZFS_MAXPROPLEN];
+	char child[ZFS_MAXPROPLEN];
+	int i;
+
+	(void) mp->mnt_func(handles[idx], mp->mnt_data);
+
+	zfs_get_mountpoint(handles[idx], mountpoint, sizeof (mountpoint));
+	if (mountpoint[0] == '\0')
+		goto out;
+
+	for (i = idx + 1; i < num_handles;
+	    i = non_descendant_idx(handles, num_handles, i)) {
+		zfs_get_mountpoint(handles[i], child, sizeof (child));
+		if (!libzfs_path_contains(mountpoint, child))
+			break;
+		zfs_dispatch_mount(zfs_get_handle(handles[idx]), handles,
+		    num_handles, i, mp->mnt_func, mp->mnt_data, mp->mnt_tq);
+	}
+out:
+	free(mp);
+}
+
+/*
+ * Call func for every handle, which must be sorted by libzfs_dataset_cmp(),
+ * in an order which makes it safe to mount the filesystems: a filesystem's
+ * callback only runs once the callbacks for all filesystems whose
+ * mountpoints contain its own have returned.  When parallel is set
+ * independent filesystems are processed concurrently, so func must be
+ * thread-safe.
+ */
+void
+zfs_foreach_mountpoint(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    size_t num_handles, zfs_iter_f func, void *data, boolean_t parallel)
+{
+	taskq_t *tq;
+	int i, threads;
+
+	if (!parallel) {
+		for (i = 0; i < num_handles; i++)
+			(void) func(handles[i], data);
+		return;
+	}
+
+	threads = MAX(MIN(num_handles, MOUNT_MAX_THREADS), 1);
+	tq = taskq_create("z_mount", threads, defclsyspri, threads, INT_MAX, 0);
+
+	for (i = 0; i < num_handles;
+	    i = non_descendant_idx(handles, num_handles, i)) {
+		zfs_dispatch_mount(hdl, handles, num_handles, i, func, data,
+		    tq);
+	}
+
+	taskq_wait(tq);
+	taskq_destroy(tq);
+}
+
+typedef struct mount_state {
+	/*
+	 * ms_status is set to -1 if any mount or share fails.  It is only
+	 * ever set to -1, so concurrent updates need no synchronization.
+	 */
+	int		ms_status;
+	int		ms_flags;
+	const char	*ms_mntopts;
+} mount_state_t;
+
+static int
+zfs_mount_one(zfs_handle_t *zhp, void *arg)
+{
+	mount_state_t *ms = arg;
+
+	if (zfs_mount(zhp, ms->ms_mntopts, ms->ms_flags) != 0)
+		ms->ms_status = -1;
+
+	return (0);
+}
+
+static int
+zfs_share_one(zfs_handle_t *zhp, void *arg)
+{
+	mount_state_t *ms = arg;
+
+	if (zfs_is_mounted(zhp, NULL) && zfs_share(zhp) != 0)
+		ms->ms_status = -1;
+
+	return (0);
+}
+
 /*
  * Mount and share all datasets within the given pool.  This assumes that no
  * datasets within the pool are currently mounted.  Because users can create
  * complicated nested hierarchies of mountpoints, we first gather all the
  * datasets and mountpoints within the pool, and sort them by mountpoint.  Once
- * we have the list of all filesystems, we iterate over them in order and mount
- * and/or share each one.
+ * we have the list of all filesystems, we mount them in parallel, mounting
+ * each filesystem only after the filesystems it is nested under, and then
+ * share each one.
  */
 #pragma weak zpool_mount_datasets = zpool_enable_datasets
 int
 zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 {
 	get_all_cb_t cb = { 0 };
+	mount_state_t ms = { 0 };
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
 	zfs_handle_t *zfsp;
 	int i, ret = -1;
-	int *good;
 
 	/*
 	 * Gather all non-snap datasets within the pool.
@@ -1213,34 +1427,23 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	    libzfs_dataset_cmp);
 
 	/*
-	 * And mount all the datasets, keeping track of which ones
-	 * succeeded or failed.
+	 * And mount all the datasets in parallel.
 	 */
-	if ((good = zfs_alloc(zhp->zpool_hdl,
-	    cb.cb_used * sizeof (int))) == NULL)
-		goto out;
-
-	ret = 0;
-	for (i = 0; i < cb.cb_used; i++) {
-		if (zfs_mount(cb.cb_handles[i], mntopts, flags) != 0)
-			ret = -1;
-		else
-			good[i] = 1;
-	}
+	ms.ms_mntopts = mntopts;
+	ms.ms_flags = flags;
+	zfs_foreach_mountpoint(hdl, cb.cb_handles, cb.cb_used,
+	    zfs_mount_one, &ms, B_TRUE);
 
 	/*
-	 * Then share all the ones that need to be shared. This needs
-	 * to be a separate pass in order to avoid excessive reloading
-	 * of the configuration. Good should never be NULL since
-	 * zfs_alloc is supposed to exit if memory isn't available.
+	 * Then share all the ones that were mounted. This needs to be a
+	 * separate pass in order to avoid excessive reloading of the
+	 * configuration, and is done serially because libshare is not
+	 * thread-safe.
 	 */
-	for (i = 0; i < cb.cb_used; i++) {
-		if (good[i] && zfs_share(cb.cb_handles[i]) != 0)
-			ret = -1;
-	}
-
-	free(good);
+	zfs_foreach_mountpoint(hdl, cb.cb_handles, cb.cb_used,
+	    zfs_share_one, &ms, B_FALSE);
 
+	ret = ms.ms_status;
 out:
 	for (i = 0; i < cb.cb_used; i++)
 		zfs_close(cb.cb_handles[i]);
@@ -942,6 +942,7 @@ zpool_name_valid(libzfs_handle_t *hdl, boolean_t isopen, const char *pool)
 	if (ret == 0 && !isopen &&
 	    (strncmp(pool, "mirror", 6) == 0 ||
 	    strncmp(pool, "raidz", 5) == 0 ||
+	    strncmp(pool, "draid", 5) == 0 ||
 	    strncmp(pool, "spare", 5) == 0 ||
 	    strcmp(pool, "log") == 0)) {
 		if (hdl != NULL)
@@ -1944,6 +1945,34 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func)
 	}
 }
 
+/*
+ * Trim the free space of the pool, or stop trimming it.
+ */
+int
+zpool_trim(zpool_handle_t *zhp, pool_trim_func_t func)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_cookie = func;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_POOL_TRIM, &zc) == 0)
+		return (0);
+
+	if (func == POOL_TRIM_START) {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot trim %s"), zc.zc_name);
+	} else {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot cancel trimming %s"),
+		    zc.zc_name);
+	}
+
+	return (zpool_standard_error(hdl, errno, msg));
+}
+
 /*
  * Find a vdev that matches the search criteria specified. We use the
  * the nvpair name to determine how we should look for the device.
@@ -2037,6 +2066,8 @@ vdev_to_nvlist_iter(nvlist_t *nv, nvlist_t *search, boolean_t *avail_spare,
 
 			verify(strncmp(type, VDEV_TYPE_RAIDZ,
 			    strlen(VDEV_TYPE_RAIDZ)) == 0 ||
+			    strncmp(type, VDEV_TYPE_DRAID,
+			    strlen(VDEV_TYPE_DRAID)) == 0 ||
 			    strncmp(type, VDEV_TYPE_MIRROR,
 			    strlen(VDEV_TYPE_MIRROR)) == 0);
 			verify(nvlist_lookup_uint64(nv, ZPOOL_CONFIG_ID,
@@ -2144,6 +2175,8 @@ zpool_find_vdev_by_physpath(zpool_handle_t *zhp, const char *ppath,
 
 /*
  * Determine if we have an "interior" top-level vdev (i.e mirror/raidz).
+ * Distributed spares (i.e. draid1-0-0) look like a dRAID vdev name with
+ * a second id appended, and are leaves.
  */
 boolean_t
 zpool_vdev_is_interior(const char *name)
@@ -2151,6 +2184,9 @@ zpool_vdev_is_interior(const char *name)
 	if (strncmp(name, VDEV_TYPE_RAIDZ, strlen(VDEV_TYPE_RAIDZ)) == 0 ||
 	    strncmp(name, VDEV_TYPE_MIRROR, strlen(VDEV_TYPE_MIRROR)) == 0)
 		return (B_TRUE);
+	if (strncmp(name, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0 &&
+	    strchr(name, '-') == strrchr(name, '-'))
+		return (B_TRUE);
 	return (B_FALSE);
 }
 
@@ -2262,6 +2298,7 @@ vdev_get_physpaths(nvlist_t *nv, char *physpath, size_t phypath_size,
 		}
 	} else if (strcmp(type, VDEV_TYPE_MIRROR) == 0 ||
 	    strcmp(type, VDEV_TYPE_RAIDZ) == 0 ||
+	    strcmp(type, VDEV_TYPE_DRAID) == 0 ||
 	    strcmp(type, VDEV_TYPE_REPLACING) == 0 ||
 	    (is_spare = (strcmp(type, VDEV_TYPE_SPARE) == 0))) {
 		nvlist_t **child;
@@ -2604,7 +2641,7 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 	nvlist_t *tgt;
 	boolean_t avail_spare, l2cache, islog;
 	uint64_t val;
-	char *newname;
+	char *newname, *type;
 	nvlist_t **child;
 	uint_t children;
 	nvlist_t *config_root;
@@ -2703,12 +2740,22 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 				    "cannot replace a replacing device"));
 		} else {
 			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "can only attach to mirrors and top-level "
-			    "disks"));
+			    "can only attach to mirrors, raidz vdevs and "
+			    "top-level disks; raidz requires the "
+			    "raidz_expansion feature"));
 		}
 		(void) zfs_error(hdl, EZFS_BADTARGET, msg);
 		break;
 
+	case EALREADY:
+		/*
+		 * Only one raidz vdev may be expanded at a time.
+		 */
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "a raidz expansion is already in progress"));
+		(void) zfs_error(hdl, EZFS_BADTARGET, msg);
+		break;
+
 	case EINVAL:
 		/*
 		 * The new device must be a single disk.
@@ -2750,6 +2797,21 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 		(void) zfs_error(hdl, EZFS_DEVOVERFLOW, msg);
 		break;
 
+	case ENXIO:
+		/*
+		 * A raidz vdev can only be expanded while all of its
+		 * children are present and up to date.
+		 */
+		if (nvlist_lookup_string(tgt, ZPOOL_CONFIG_TYPE, &type) == 0 &&
+		    strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "raidz vdev has a missing or resilvering child"));
+			(void) zfs_error(hdl, EZFS_BADTARGET, msg);
+			break;
+		}
+		(void) zpool_standard_error(hdl, errno, msg);
+		break;
+
 	default:
 		(void) zpool_standard_error(hdl, errno, msg);
 	}
@@ -3083,15 +3145,6 @@ zpool_vdev_remove(zpool_handle_t *zhp, const char *path)
 	if ((tgt = zpool_find_vdev(zhp, path, &avail_spare, &l2cache,
 	    &islog)) == 0)
 		return (zfs_error(hdl, EZFS_NODEVICE, msg));
-	/*
-	 * XXX - this should just go away.
-	 */
-	if (!avail_spare && !l2cache && !islog) {
-		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-		    "only inactive hot spares, cache, "
-		    "or log devices can be removed"));
-		return (zfs_error(hdl, EZFS_NODEVICE, msg));
-	}
 
 	version = zpool_get_prop_int(zhp, ZPOOL_PROP_VERSION, NULL);
 	if (islog && version < SPA_VERSION_HOLES) {
@@ -3105,6 +3158,25 @@ zpool_vdev_remove(zpool_handle_t *zhp, const char *path)
 	if (zfs_ioctl(hdl, ZFS_IOC_VDEV_REMOVE, &zc) == 0)
 		return (0);
 
+	switch (errno) {
+	case EINVAL:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "only inactive hot spares, cache, log, or top-level "
+		    "mirror and single-disk devices can be removed, and "
+		    "not from a pool with raidz vdevs or mixed ashifts"));
+		return (zfs_error(hdl, EZFS_NODEVICE, msg));
+
+	case ENOTSUP:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "pool must be upgraded to support device removal"));
+		return (zfs_error(hdl, EZFS_BADVERSION, msg));
+
+	case ENOSPC:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "out of space to copy the device's data to"));
+		return (zfs_error(hdl, EZFS_NOSPC, msg));
+	}
+
 	return (zpool_standard_error(hdl, errno, msg));
 }
 
@@ -3537,6 +3609,30 @@ zpool_vdev_name(libzfs_handle_t *hdl, zpool_handle_t *zhp, nvlist_t *nv,
 			path = buf;
 		}
 
+		/*
+		 * A dRAID device also needs its group and spare layout,
+		 * i.e. draid2:4d:11c:1s.
+		 */
+		if (strcmp(path, VDEV_TYPE_DRAID) == 0) {
+			uint64_t ndata, nspares;
+			uint_t children;
+			nvlist_t **child;
+
+			verify(nvlist_lookup_uint64(nv, ZPOOL_CONFIG_NPARITY,
+			    &value) == 0);
+			verify(nvlist_lookup_uint64(nv,
+			    ZPOOL_CONFIG_DRAID_NDATA, &ndata) == 0);
+			verify(nvlist_lookup_uint64(nv,
+			    ZPOOL_CONFIG_DRAID_NSPARES, &nspares) == 0);
+			verify(nvlist_lookup_nvlist_array(nv,
+			    ZPOOL_CONFIG_CHILDREN, &child, &children) == 0);
+			(void) snprintf(buf, sizeof (buf),
+			    "%s%llu:%llud:%uc:%llus", path,
+			    (u_longlong_t)value, (u_longlong_t)ndata, children,
+			    (u_longlong_t)nspares);
+			path = buf;
+		}
+
 		/*
 		 * We identify each top-level vdev by using a <type-id>
 		 * naming convention.
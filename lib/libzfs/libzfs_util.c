@@ -257,6 +257,8 @@ libzfs_error_description(libzfs_handle_t *hdl)
 		return (dgettext(TEXT_DOMAIN, "invalid diff data"));
 	case EZFS_POOLREADONLY:
 		return (dgettext(TEXT_DOMAIN, "pool is read-only"));
+	case EZFS_CRYPTOFAILED:
+		return (dgettext(TEXT_DOMAIN, "encryption failure"));
 	case EZFS_UNKNOWN:
 		return (dgettext(TEXT_DOMAIN, "unknown error"));
 	default:
@@ -878,6 +880,7 @@ libzfs_init(void)
 	zfs_prop_init();
 	zpool_prop_init();
 	zpool_feature_init();
+	(void) pthread_mutex_init(&hdl->libzfs_mnttab_cache_lock, NULL);
 	libzfs_mnttab_init(hdl);
 	fletcher_4_init();
 
@@ -901,6 +904,7 @@ libzfs_fini(libzfs_handle_t *hdl)
 	libzfs_fru_clear(hdl, B_TRUE);
 	namespace_clear(hdl);
 	libzfs_mnttab_fini(hdl);
+	(void) pthread_mutex_destroy(&hdl->libzfs_mnttab_cache_lock);
 	libzfs_core_fini();
 	fletcher_4_fini();
 	free(hdl);
@@ -817,6 +817,28 @@ fop_getattr(vnode_t *vp, vattr_t *vap)
 	return (0);
 }
 
+/*
+ * Only F_FREESP is supported, it punches a hole over the given range
+ * without changing the size of the file.
+ */
+/*ARGSUSED*/
+int
+fop_space(vnode_t *vp, int cmd, flock64_t *bfp, int flag, offset_t offset)
+{
+	if (cmd != F_FREESP)
+		return (EINVAL);
+
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+	if (fallocate(vp->v_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    bfp->l_start, bfp->l_len) == -1)
+		return (errno);
+
+	return (0);
+#else
+	return (EOPNOTSUPP);
+#endif
+}
+
 /*
  * =========================================================================
  * Figure out which debugging statements to print
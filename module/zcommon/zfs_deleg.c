@@ -46,6 +46,7 @@
 zfs_deleg_perm_tab_t zfs_deleg_perm_tab[] = {
 	{ZFS_DELEG_PERM_ALLOW},
 	{ZFS_DELEG_PERM_BOOKMARK},
+	{ZFS_DELEG_PERM_CHANGE_KEY},
 	{ZFS_DELEG_PERM_CLONE},
 	{ZFS_DELEG_PERM_CREATE},
 	{ZFS_DELEG_PERM_DESTROY},
@@ -68,6 +69,7 @@ zfs_deleg_perm_tab_t zfs_deleg_perm_tab[] = {
 	{ZFS_DELEG_PERM_USEROBJUSED},
 	{ZFS_DELEG_PERM_GROUPOBJUSED},
 	{ZFS_DELEG_PERM_HOLD},
+	{ZFS_DELEG_PERM_LOAD_KEY},
 	{ZFS_DELEG_PERM_RELEASE},
 	{NULL}
 };
@@ -116,6 +116,70 @@ zfs_prop_init(void)
 		{ "gzip-9",	ZIO_COMPRESS_GZIP_9 },
 		{ "zle",	ZIO_COMPRESS_ZLE },
 		{ "lz4",	ZIO_COMPRESS_LZ4 },
+		{ "zstd",	ZIO_COMPRESS_ZSTD },	/* zstd default */
+		{ "zstd-fast",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 1) },
+		{ "zstd-1",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 1) },
+		{ "zstd-2",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 2) },
+		{ "zstd-3",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 3) },
+		{ "zstd-4",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 4) },
+		{ "zstd-5",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 5) },
+		{ "zstd-6",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 6) },
+		{ "zstd-7",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 7) },
+		{ "zstd-8",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 8) },
+		{ "zstd-9",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 9) },
+		{ "zstd-10",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 10) },
+		{ "zstd-11",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 11) },
+		{ "zstd-12",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 12) },
+		{ "zstd-13",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 13) },
+		{ "zstd-14",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 14) },
+		{ "zstd-15",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 15) },
+		{ "zstd-16",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 16) },
+		{ "zstd-17",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 17) },
+		{ "zstd-18",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 18) },
+		{ "zstd-19",	ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, 19) },
+		{ "zstd-fast-1",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 1) },
+		{ "zstd-fast-2",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 2) },
+		{ "zstd-fast-3",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 3) },
+		{ "zstd-fast-4",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 4) },
+		{ "zstd-fast-5",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 5) },
+		{ "zstd-fast-6",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 6) },
+		{ "zstd-fast-7",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 7) },
+		{ "zstd-fast-8",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 8) },
+		{ "zstd-fast-9",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 9) },
+		{ "zstd-fast-10",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 10) },
+		{ "zstd-fast-20",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 20) },
+		{ "zstd-fast-30",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 30) },
+		{ "zstd-fast-40",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 40) },
+		{ "zstd-fast-50",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 50) },
+		{ "zstd-fast-60",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 60) },
+		{ "zstd-fast-70",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 70) },
+		{ "zstd-fast-80",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 80) },
+		{ "zstd-fast-90",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 90) },
+		{ "zstd-fast-100",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 100) },
+		{ "zstd-fast-500",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 500) },
+		{ "zstd-fast-1000",
+		    ZIO_COMPRESS_RAW(ZIO_COMPRESS_ZSTD, ZIO_ZSTD_LEVEL_FAST + 1000) },
 		{ NULL }
 	};
 
@@ -245,6 +309,33 @@ zfs_prop_init(void)
 		{ NULL }
 	};
 
+	static zprop_index_t crypto_table[] = {
+		{ "on",			ZIO_CRYPT_ON },
+		{ "off",		ZIO_CRYPT_OFF },
+		{ "aes-128-ccm",	ZIO_CRYPT_AES_128_CCM },
+		{ "aes-192-ccm",	ZIO_CRYPT_AES_192_CCM },
+		{ "aes-256-ccm",	ZIO_CRYPT_AES_256_CCM },
+		{ "aes-128-gcm",	ZIO_CRYPT_AES_128_GCM },
+		{ "aes-192-gcm",	ZIO_CRYPT_AES_192_GCM },
+		{ "aes-256-gcm",	ZIO_CRYPT_AES_256_GCM },
+		{ NULL }
+	};
+
+	static zprop_index_t keyformat_table[] = {
+		{ "none",	ZFS_KEYFORMAT_NONE },
+		{ "raw",	ZFS_KEYFORMAT_RAW },
+		{ "hex",	ZFS_KEYFORMAT_HEX },
+		{ "passphrase",	ZFS_KEYFORMAT_PASSPHRASE },
+		{ NULL }
+	};
+
+	static zprop_index_t keystatus_table[] = {
+		{ "none",		ZFS_KEYSTATUS_NONE},
+		{ "unavailable",	ZFS_KEYSTATUS_UNAVAILABLE},
+		{ "available",		ZFS_KEYSTATUS_AVAILABLE},
+		{ NULL }
+	};
+
 	/* inherit index properties */
 	zprop_register_index(ZFS_PROP_REDUNDANT_METADATA, "redundant_metadata",
 	    ZFS_REDUNDANT_METADATA_ALL,
@@ -267,7 +358,8 @@ zfs_prop_init(void)
 	zprop_register_index(ZFS_PROP_COMPRESSION, "compression",
 	    ZIO_COMPRESS_DEFAULT, PROP_INHERIT,
 	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
-	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4", "COMPRESS",
+	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4 | zstd | zstd-[1-19] "
+	    "| zstd-fast[-N]", "COMPRESS",
 	    compress_table);
 	zprop_register_index(ZFS_PROP_SNAPDIR, "snapdir", ZFS_SNAPDIR_HIDDEN,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM,
@@ -359,6 +451,20 @@ zfs_prop_init(void)
 	zprop_register_index(ZFS_PROP_UTF8ONLY, "utf8only", 0, PROP_ONETIME,
 	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_SNAPSHOT,
 	    "on | off", "UTF8ONLY", boolean_table);
+	zprop_register_index(ZFS_PROP_ENCRYPTION, "encryption",
+	    ZIO_CRYPT_DEFAULT, PROP_ONETIME, ZFS_TYPE_DATASET,
+	    "on | off | aes-128-ccm | aes-192-ccm | aes-256-ccm | "
+	    "aes-128-gcm | aes-192-gcm | aes-256-gcm", "ENCRYPTION",
+	    crypto_table);
+	zprop_register_index(ZFS_PROP_KEYFORMAT, "keyformat",
+	    ZFS_KEYFORMAT_NONE, PROP_ONETIME, ZFS_TYPE_FILESYSTEM |
+	    ZFS_TYPE_VOLUME, "none | raw | hex | passphrase", "KEYFORMAT",
+	    keyformat_table);
+
+	/* readonly index properties */
+	zprop_register_index(ZFS_PROP_KEYSTATUS, "keystatus",
+	    ZFS_KEYSTATUS_NONE, PROP_READONLY, ZFS_TYPE_DATASET,
+	    "none | unavailable | available", "KEYSTATUS", keystatus_table);
 
 	/* string properties */
 	zprop_register_string(ZFS_PROP_ORIGIN, "origin", NULL, PROP_READONLY,
@@ -380,6 +486,12 @@ zfs_prop_init(void)
 	zprop_register_string(ZFS_PROP_MLSLABEL, "mlslabel",
 	    ZFS_MLSLABEL_DEFAULT, PROP_INHERIT, ZFS_TYPE_DATASET,
 	    "<sensitivity label>", "MLSLABEL");
+	zprop_register_string(ZFS_PROP_KEYLOCATION, "keylocation",
+	    "none", PROP_DEFAULT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "prompt | <file URI>", "KEYLOCATION");
+	zprop_register_string(ZFS_PROP_ENCRYPTION_ROOT, "encryptionroot", NULL,
+	    PROP_READONLY, ZFS_TYPE_DATASET, "<filesystem | volume>",
+	    "ENCROOT");
 	zprop_register_string(ZFS_PROP_SELINUX_CONTEXT, "context",
 	    "none", PROP_DEFAULT, ZFS_TYPE_DATASET, "<selinux context>",
 	    "CONTEXT");
@@ -460,10 +572,19 @@ zfs_prop_init(void)
 	    UINT64_MAX, PROP_DEFAULT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
 	    "<count> | none", "SSLIMIT");
 
+	/* set once number properties */
+	zprop_register_number(ZFS_PROP_PBKDF2_ITERS, "pbkdf2iters",
+	    0, PROP_ONETIME, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<iters>", "PBKDF2ITERS");
+
 	/* inherit number properties */
 	zprop_register_number(ZFS_PROP_RECORDSIZE, "recordsize",
 	    SPA_OLD_MAXBLOCKSIZE, PROP_INHERIT,
 	    ZFS_TYPE_FILESYSTEM, "512 to 1M, power of 2", "RECSIZE");
+	zprop_register_number(ZFS_PROP_SPECIAL_SMALL_BLOCKS,
+	    "special_small_blocks", 0, PROP_INHERIT,
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "zero or 512 to 128K, power of 2", "SPECIAL_SMALL_BLOCKS");
 
 	/* hidden properties */
 	zprop_register_hidden(ZFS_PROP_CREATETXG, "createtxg", PROP_TYPE_NUMBER,
@@ -490,6 +611,9 @@ zfs_prop_init(void)
 	    PROP_TYPE_NUMBER, PROP_READONLY, ZFS_TYPE_DATASET, "INCONSISTENT");
 	zprop_register_hidden(ZFS_PROP_PREV_SNAP, "prevsnap", PROP_TYPE_STRING,
 	    PROP_READONLY, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME, "PREVSNAP");
+	zprop_register_hidden(ZFS_PROP_PBKDF2_SALT, "pbkdf2salt",
+	    PROP_TYPE_NUMBER, PROP_ONETIME, ZFS_TYPE_FILESYSTEM |
+	    ZFS_TYPE_VOLUME, "PBKDF2SALT");
 
 	/*
 	 * Property to be removed once libbe is integrated
@@ -649,6 +773,35 @@ zfs_prop_setonce(zfs_prop_t prop)
 	return (zfs_prop_table[prop].pd_attr == PROP_ONETIME);
 }
 
+/*
+ * Returns TRUE if the property is one of the encryption properties that is
+ * consumed when a dataset is created or its key is changed, rather than
+ * being stored as a regular dataset property.
+ */
+boolean_t
+zfs_prop_encryption_key_param(zfs_prop_t prop)
+{
+	return (prop == ZFS_PROP_PBKDF2_SALT || prop == ZFS_PROP_PBKDF2_ITERS ||
+	    prop == ZFS_PROP_KEYFORMAT);
+}
+
+/*
+ * Returns TRUE if the string is a valid key location.  "none" is only
+ * allowed for datasets that are not encryption roots.
+ */
+boolean_t
+zfs_prop_valid_keylocation(const char *str, boolean_t encrypted)
+{
+	if (strcmp("none", str) == 0)
+		return (!encrypted);
+	else if (strcmp("prompt", str) == 0)
+		return (B_TRUE);
+	else if (strlen(str) > 8 && strncmp("file:///", str, 8) == 0)
+		return (B_TRUE);
+
+	return (B_FALSE);
+}
+
 const char *
 zfs_prop_default_string(zfs_prop_t prop)
 {
@@ -762,6 +915,8 @@ EXPORT_SYMBOL(zfs_prop_default_numeric);
 EXPORT_SYMBOL(zfs_prop_readonly);
 EXPORT_SYMBOL(zfs_prop_inheritable);
 EXPORT_SYMBOL(zfs_prop_setonce);
+EXPORT_SYMBOL(zfs_prop_encryption_key_param);
+EXPORT_SYMBOL(zfs_prop_valid_keylocation);
 EXPORT_SYMBOL(zfs_prop_to_name);
 EXPORT_SYMBOL(zfs_name_to_prop);
 EXPORT_SYMBOL(zfs_prop_user);
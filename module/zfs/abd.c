@@ -1270,6 +1270,86 @@ abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
 	return (ret);
 }
 
+/*
+ * Iterate over up to ABD_ITER_MULTI_MAX ABDs in lockstep and call @func
+ * with one mapped segment per ABD. Every call covers the same number of
+ * bytes in each ABD that still has data left; ABDs that have been fully
+ * consumed are passed as NULL.
+ *
+ * @abds	ABDs to iterate over, starting at offset 0 of each
+ * @sizes	number of bytes to iterate over in each ABD
+ * @n		number of ABDs
+ */
+int
+abd_iterate_multi_func(abd_t **abds, const uint64_t *sizes, uint_t n,
+    abd_iter_multi_func_t *func, void *private)
+{
+	struct abd_iter aiters[ABD_ITER_MULTI_MAX];
+	void *bufs[ABD_ITER_MULTI_MAX];
+	uint64_t left[ABD_ITER_MULTI_MAX];
+#ifndef HAVE_1ARG_KMAP_ATOMIC
+	unsigned long flags;
+#endif
+	int i, ret = 0;
+
+	ASSERT3U(n, >, 0);
+	ASSERT3U(n, <=, ABD_ITER_MULTI_MAX);
+
+	for (i = 0; i < n; i++) {
+		ASSERT3U(sizes[i], <=, abds[i]->abd_size);
+#if defined(_KERNEL) && !defined(HAVE_1ARG_KMAP_ATOMIC)
+		abd_iter_init(&aiters[i], abds[i], i);
+#else
+		abd_iter_init(&aiters[i], abds[i], 0);
+#endif
+		left[i] = sizes[i];
+	}
+
+#ifndef HAVE_1ARG_KMAP_ATOMIC
+	/* the KM_BIO_*_IRQ slots may only be used with interrupts disabled */
+	local_irq_save(flags);
+#endif
+	for (;;) {
+		size_t len = 0;
+
+		for (i = 0; i < n; i++) {
+			size_t mlen;
+
+			if (left[i] == 0) {
+				bufs[i] = NULL;
+				continue;
+			}
+			abd_iter_map(&aiters[i]);
+			bufs[i] = aiters[i].iter_mapaddr;
+			mlen = MIN(aiters[i].iter_mapsize, left[i]);
+			ASSERT3U(mlen, >, 0);
+			len = (len == 0) ? mlen : MIN(len, mlen);
+		}
+
+		/* all ABDs have been consumed */
+		if (len == 0)
+			break;
+
+		ret = func(bufs, len, private);
+
+		for (i = n - 1; i >= 0; i--) {
+			if (left[i] == 0)
+				continue;
+			abd_iter_unmap(&aiters[i]);
+			abd_iter_advance(&aiters[i], len);
+			left[i] -= len;
+		}
+
+		if (ret != 0)
+			break;
+	}
+#ifndef HAVE_1ARG_KMAP_ATOMIC
+	local_irq_restore(flags);
+#endif
+
+	return (ret);
+}
+
 /*ARGSUSED*/
 static int
 abd_copy_off_cb(void *dbuf, void *sbuf, size_t size, void *private)
@@ -307,6 +307,20 @@ static kcondvar_t	arc_reclaim_waiters_cv;
  */
 int zfs_arc_evict_batch_limit = 10;
 
+/*
+ * The number of threads arc_evict_state() fans eviction out to.  The
+ * sublists of an arc state are independent, so each thread evicts from
+ * its own share of them.  Zero picks one thread per 8 cpus.
+ */
+int zfs_arc_evict_threads = 0;
+static int arc_evict_nthreads;
+static taskq_t *arc_evict_taskq;
+
+/*
+ * The least amount of eviction worth handing to an eviction thread.
+ */
+#define	ARC_EVICT_TASK_MIN	(1ULL << 20)
+
 /* number of seconds before growing cache again */
 static int		arc_grow_retry = 5;
 
@@ -435,6 +449,25 @@ typedef struct arc_stats {
 	 * buffers to reach its target amount.
 	 */
 	kstat_named_t arcstat_evict_not_enough;
+	/*
+	 * Number of times arc_evict_state() spread the eviction from an arc
+	 * state across the eviction threads.
+	 */
+	kstat_named_t arcstat_evict_parallel;
+	/*
+	 * Bytes evicted by, and nanoseconds spent in, arc_adjust() on
+	 * behalf of the reclaim thread; together they give the eviction
+	 * throughput.
+	 */
+	kstat_named_t arcstat_evict_reclaim_bytes;
+	kstat_named_t arcstat_evict_reclaim_time;
+	/*
+	 * Number of times, and nanoseconds spent, allocating threads
+	 * waited for the reclaim thread to get the ARC back under its
+	 * overflow limit.
+	 */
+	kstat_named_t arcstat_alloc_waits;
+	kstat_named_t arcstat_alloc_wait_time;
 	kstat_named_t arcstat_evict_l2_cached;
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_ineligible;
@@ -624,6 +657,30 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_size;
 	kstat_named_t arcstat_l2_asize;
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Number of log blocks written to cache devices, and the moving
+	 * average of their allocated size.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_log_blk_avg_asize;
+	/*
+	 * L2ARC rebuild statistics.  l2_rebuild_active is the number of
+	 * cache devices currently being rebuilt; l2_rebuild_bufs and
+	 * l2_rebuild_log_blks grow as a rebuild makes progress, and
+	 * l2_rebuild_time_ms accumulates the time spent in rebuilds.
+	 */
+	kstat_named_t arcstat_l2_rebuild_active;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_dh_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_time_ms;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
@@ -661,6 +718,11 @@ static arc_stats_t arc_stats = {
 	{ "mutex_miss",			KSTAT_DATA_UINT64 },
 	{ "evict_skip",			KSTAT_DATA_UINT64 },
 	{ "evict_not_enough",		KSTAT_DATA_UINT64 },
+	{ "evict_parallel",		KSTAT_DATA_UINT64 },
+	{ "evict_reclaim_bytes",	KSTAT_DATA_UINT64 },
+	{ "evict_reclaim_time",		KSTAT_DATA_UINT64 },
+	{ "alloc_waits",		KSTAT_DATA_UINT64 },
+	{ "alloc_wait_time",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_cached",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
@@ -719,6 +781,20 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_avg_asize",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_active",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_dh_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_time_ms",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -755,6 +831,13 @@ static arc_stats_t arc_stats = {
 #define	ARCSTAT_MAXSTAT(stat) \
 	ARCSTAT_MAX(stat##_max, arc_stats.stat.value.ui64)
 
+/*
+ * Update a moving average, weighting the newest value by 1/8th.  This
+ * is not atomic, so it is only used by single threaded callers.
+ */
+#define	ARCSTAT_F_AVG(stat, value) \
+	ARCSTAT(stat) = ARCSTAT(stat) - (ARCSTAT(stat) >> 3) + ((value) >> 3)
+
 /*
  * We define a macro to allow ARC hits/misses to be easily broken down by
  * two separate conditions, giving a total of four different subtypes for
@@ -933,6 +1016,7 @@ unsigned long l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
 int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild L2ARC on import */
 
 /*
  * L2ARC Internals
@@ -965,6 +1049,9 @@ static kmutex_t l2arc_feed_thr_lock;
 static kcondvar_t l2arc_feed_thr_cv;
 static uint8_t l2arc_thread_exit;
 
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
+
 static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
 static void arc_get_data_impl(arc_buf_hdr_t *, uint64_t, void *);
@@ -979,6 +1066,8 @@ static void arc_buf_watch(arc_buf_t *);
 static void arc_tuning_update(void);
 static void arc_prune_async(int64_t);
 static uint64_t arc_all_memory(void);
+static arc_buf_t *arc_alloc_compressed_buf_impl(spa_t *, void *,
+    arc_buf_contents_t, uint64_t, uint64_t, enum zio_compress);
 
 static arc_buf_contents_t arc_buf_type(arc_buf_hdr_t *);
 static uint32_t arc_bufc_to_flags(arc_buf_contents_t);
@@ -1414,16 +1503,22 @@ arc_cksum_is_equal(arc_buf_hdr_t *hdr, zio_t *zio)
 	 * uncompressed and won't match the block as it exists in the main
 	 * pool. When this is the case, we must first compress it if it is
 	 * compressed on the main pool before we can validate the checksum.
+	 *
+	 * The compression level used to write the block is not recorded in
+	 * the hdr, so blocks written with a non-default zstd level will not
+	 * verify.  Those reads fail over to the main pool as for any other
+	 * l2arc checksum error.
 	 */
 	if (!HDR_COMPRESSION_ENABLED(hdr) && compress != ZIO_COMPRESS_OFF) {
 		uint64_t lsize;
 		uint64_t csize;
-		void *cbuf;
+		abd_t *cdata;
 		ASSERT3U(HDR_GET_COMPRESS(hdr), ==, ZIO_COMPRESS_OFF);
 
-		cbuf = zio_buf_alloc(HDR_GET_PSIZE(hdr));
+		cdata = abd_alloc_linear(HDR_GET_PSIZE(hdr), B_TRUE);
 		lsize = HDR_GET_LSIZE(hdr);
-		csize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
+		csize = zio_compress_data(compress, zio->io_abd,
+		    abd_to_buf(cdata), lsize, 0);
 
 		ASSERT3U(csize, <=, HDR_GET_PSIZE(hdr));
 		if (csize < HDR_GET_PSIZE(hdr)) {
@@ -1439,10 +1534,10 @@ arc_cksum_is_equal(arc_buf_hdr_t *hdr, zio_t *zio)
 			 * and zero out any part that should not contain
 			 * data.
 			 */
-			bzero((char *)cbuf + csize, HDR_GET_PSIZE(hdr) - csize);
+			abd_zero_off(cdata, csize, HDR_GET_PSIZE(hdr) - csize);
 			csize = HDR_GET_PSIZE(hdr);
 		}
-		zio_push_transform(zio, cbuf, csize, HDR_GET_PSIZE(hdr), NULL);
+		zio_push_transform(zio, cdata, csize, HDR_GET_PSIZE(hdr), NULL);
 	}
 
 	/*
@@ -2450,6 +2545,30 @@ arc_loan_compressed_buf(spa_t *spa, uint64_t psize, uint64_t lsize,
 	return (buf);
 }
 
+/*
+ * Loan out a buf for a block exactly as it is stored on disk.  Raw
+ * receives use this for encrypted blocks, which may be metadata (e.g.
+ * ZAP blocks of directories) and still be compressed.
+ */
+arc_buf_t *
+arc_loan_raw_buf(spa_t *spa, boolean_t is_metadata, uint64_t psize,
+    uint64_t lsize, enum zio_compress compression_type)
+{
+	arc_buf_t *buf;
+
+	if (compression_type == ZIO_COMPRESS_OFF) {
+		ASSERT3U(psize, ==, lsize);
+		return (arc_loan_buf(spa, is_metadata, lsize));
+	}
+
+	buf = arc_alloc_compressed_buf_impl(spa, arc_onloan_tag,
+	    is_metadata ? ARC_BUFC_METADATA : ARC_BUFC_DATA, psize, lsize,
+	    compression_type);
+
+	atomic_add_64(&arc_loaned_bytes, psize);
+	return (buf);
+}
+
 
 /*
  * Return a loaned arc buffer to the arc.
@@ -2907,13 +3026,9 @@ arc_alloc_buf(spa_t *spa, void *tag, arc_buf_contents_t type, int32_t size)
 	return (buf);
 }
 
-/*
- * Allocate a compressed buf in the same manner as arc_alloc_buf. Don't use this
- * for bufs containing metadata.
- */
-arc_buf_t *
-arc_alloc_compressed_buf(spa_t *spa, void *tag, uint64_t psize, uint64_t lsize,
-    enum zio_compress compression_type)
+static arc_buf_t *
+arc_alloc_compressed_buf_impl(spa_t *spa, void *tag, arc_buf_contents_t type,
+    uint64_t psize, uint64_t lsize, enum zio_compress compression_type)
 {
 	arc_buf_hdr_t *hdr;
 	arc_buf_t *buf;
@@ -2923,7 +3038,7 @@ arc_alloc_compressed_buf(spa_t *spa, void *tag, uint64_t psize, uint64_t lsize,
 	ASSERT(compression_type < ZIO_COMPRESS_FUNCTIONS);
 
 	hdr = arc_hdr_alloc(spa_load_guid(spa), psize, lsize,
-	    compression_type, ARC_BUFC_DATA);
+	    compression_type, type);
 	ASSERT(!MUTEX_HELD(HDR_LOCK(hdr)));
 
 	buf = NULL;
@@ -2946,6 +3061,18 @@ arc_alloc_compressed_buf(spa_t *spa, void *tag, uint64_t psize, uint64_t lsize,
 	return (buf);
 }
 
+/*
+ * Allocate a compressed buf in the same manner as arc_alloc_buf. Don't use this
+ * for bufs containing metadata.
+ */
+arc_buf_t *
+arc_alloc_compressed_buf(spa_t *spa, void *tag, uint64_t psize, uint64_t lsize,
+    enum zio_compress compression_type)
+{
+	return (arc_alloc_compressed_buf_impl(spa, tag, ARC_BUFC_DATA,
+	    psize, lsize, compression_type));
+}
+
 static void
 arc_hdr_l2hdr_destroy(arc_buf_hdr_t *hdr)
 {
@@ -3284,6 +3411,85 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 	return (bytes_evicted);
 }
 
+/*
+ * The share of an arc_evict_state() scan handed to one eviction thread:
+ * eva_count sublists starting at eva_idx.
+ */
+typedef struct arc_evict_arg {
+	taskq_ent_t	eva_tqent;
+	multilist_t	*eva_ml;
+	arc_buf_hdr_t	**eva_markers;
+	int		eva_idx;
+	int		eva_count;
+	uint64_t	eva_spa;
+	uint64_t	eva_bytes;
+	uint64_t	eva_evicted;
+} arc_evict_arg_t;
+
+static void
+arc_evict_task(void *arg)
+{
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+	arc_evict_arg_t *eva = arg;
+	int num_sublists = multilist_get_num_sublists(eva->eva_ml);
+	int idx = eva->eva_idx;
+	int i;
+
+	eva->eva_evicted = 0;
+	for (i = 0; i < eva->eva_count && eva->eva_evicted < eva->eva_bytes;
+	    i++) {
+		eva->eva_evicted += arc_evict_state_impl(eva->eva_ml, idx,
+		    eva->eva_markers[idx], eva->eva_spa,
+		    eva->eva_bytes - eva->eva_evicted);
+
+		if (++idx >= num_sublists)
+			idx = 0;
+	}
+
+	spl_fstrans_unmark(cookie);
+}
+
+/*
+ * Run one scan of arc_evict_state() on the eviction threads, each
+ * evicting its share of 'bytes' from its share of the sublists.
+ * taskq_wait() may also wait for the tasks of a concurrent caller, which
+ * only delays us; our own arguments stay valid until our tasks are done.
+ */
+static uint64_t
+arc_evict_state_parallel(multilist_t *ml, arc_buf_hdr_t **markers,
+    int sublist_idx, uint64_t spa, uint64_t bytes, int nworkers)
+{
+	int num_sublists = multilist_get_num_sublists(ml);
+	arc_evict_arg_t *eva;
+	uint64_t evicted = 0;
+	int w;
+
+	eva = kmem_zalloc(sizeof (*eva) * nworkers, KM_SLEEP);
+	for (w = 0; w < nworkers; w++) {
+		int first = (w * num_sublists) / nworkers;
+		int last = ((w + 1) * num_sublists) / nworkers;
+
+		taskq_init_ent(&eva[w].eva_tqent);
+		eva[w].eva_ml = ml;
+		eva[w].eva_markers = markers;
+		eva[w].eva_idx = (sublist_idx + first) % num_sublists;
+		eva[w].eva_count = last - first;
+		eva[w].eva_spa = spa;
+		eva[w].eva_bytes = howmany(bytes, nworkers);
+		taskq_dispatch_ent(arc_evict_taskq, arc_evict_task, &eva[w], 0,
+		    &eva[w].eva_tqent);
+	}
+	taskq_wait(arc_evict_taskq);
+
+	for (w = 0; w < nworkers; w++)
+		evicted += eva[w].eva_evicted;
+	kmem_free(eva, sizeof (*eva) * nworkers);
+
+	ARCSTAT_BUMP(arcstat_evict_parallel);
+
+	return (evicted);
+}
+
 /*
  * Evict buffers from the given arc state, until we've removed the
  * specified number of bytes. Move the removed buffers to the
@@ -3343,6 +3549,7 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 	while (total_evicted < bytes || bytes == ARC_EVICT_ALL) {
 		int sublist_idx = multilist_get_random_index(ml);
 		uint64_t scan_evicted = 0;
+		int nworkers = 1;
 
 		/*
 		 * Try to reduce pinned dnodes with a floor of arc_dnode_limit.
@@ -3359,27 +3566,44 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		 * sublists. Always starting at the same sublist
 		 * (e.g. index 0) would cause evictions to favor certain
 		 * sublists over others.
+		 *
+		 * A large enough target is spread across the eviction
+		 * threads.  Evicting everything stays on this thread, it's
+		 * only done when tearing down the ARC or a pool.
 		 */
-		for (i = 0; i < num_sublists; i++) {
-			uint64_t bytes_remaining;
-			uint64_t bytes_evicted;
-
-			if (bytes == ARC_EVICT_ALL)
-				bytes_remaining = ARC_EVICT_ALL;
-			else if (total_evicted < bytes)
-				bytes_remaining = bytes - total_evicted;
-			else
-				break;
-
-			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
-			    markers[sublist_idx], spa, bytes_remaining);
-
-			scan_evicted += bytes_evicted;
-			total_evicted += bytes_evicted;
+		if (arc_evict_taskq != NULL && bytes != ARC_EVICT_ALL) {
+			nworkers = MIN(MIN(arc_evict_nthreads, num_sublists),
+			    (bytes - total_evicted) / ARC_EVICT_TASK_MIN);
+		}
 
-			/* we've reached the end, wrap to the beginning */
-			if (++sublist_idx >= num_sublists)
-				sublist_idx = 0;
+		if (nworkers > 1) {
+			scan_evicted = arc_evict_state_parallel(ml, markers,
+			    sublist_idx, spa, bytes - total_evicted, nworkers);
+			total_evicted += scan_evicted;
+		} else {
+			for (i = 0; i < num_sublists; i++) {
+				uint64_t bytes_remaining;
+				uint64_t bytes_evicted;
+
+				if (bytes == ARC_EVICT_ALL)
+					bytes_remaining = ARC_EVICT_ALL;
+				else if (total_evicted < bytes)
+					bytes_remaining =
+					    bytes - total_evicted;
+				else
+					break;
+
+				bytes_evicted = arc_evict_state_impl(ml,
+				    sublist_idx, markers[sublist_idx], spa,
+				    bytes_remaining);
+
+				scan_evicted += bytes_evicted;
+				total_evicted += bytes_evicted;
+
+				/* reached the end, wrap to the beginning */
+				if (++sublist_idx >= num_sublists)
+					sublist_idx = 0;
+			}
 		}
 
 		/*
@@ -4218,7 +4442,10 @@ arc_reclaim_thread(void)
 		 * arc_kmem_reap_now(), so that we can wake up
 		 * arc_get_data_buf() sooner.
 		 */
+		hrtime_t start = gethrtime();
 		evicted = arc_adjust();
+		ARCSTAT_INCR(arcstat_evict_reclaim_bytes, evicted);
+		ARCSTAT_INCR(arcstat_evict_reclaim_time, gethrtime() - start);
 
 		int64_t free_memory = arc_available_memory();
 		if (free_memory < 0) {
@@ -4597,8 +4824,14 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 		 * shouldn't cause any harm.
 		 */
 		if (arc_is_overflowing()) {
+			hrtime_t start = gethrtime();
+
 			cv_signal(&arc_reclaim_thread_cv);
 			cv_wait(&arc_reclaim_waiters_cv, &arc_reclaim_lock);
+
+			ARCSTAT_BUMP(arcstat_alloc_waits);
+			ARCSTAT_INCR(arcstat_alloc_wait_time,
+			    gethrtime() - start);
 		}
 
 		mutex_exit(&arc_reclaim_lock);
@@ -5053,7 +5286,7 @@ arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp, arc_done_func_t *done,
 	kmutex_t *hash_lock = NULL;
 	zio_t *rzio;
 	uint64_t guid = spa_load_guid(spa);
-	boolean_t compressed_read = (zio_flags & ZIO_FLAG_RAW) != 0;
+	boolean_t compressed_read = (zio_flags & ZIO_FLAG_RAW_COMPRESS) != 0;
 	int rc = 0;
 
 	ASSERT(!BP_IS_EMBEDDED(bp) ||
@@ -5250,7 +5483,7 @@ top:
 		 * the uncompressed data.
 		 */
 		if (HDR_GET_COMPRESS(hdr) != ZIO_COMPRESS_OFF) {
-			zio_flags |= ZIO_FLAG_RAW;
+			zio_flags |= ZIO_FLAG_RAW_COMPRESS;
 		}
 
 		if (*arc_flags & ARC_FLAG_PREFETCH)
@@ -5780,9 +6013,23 @@ arc_write_ready(zio_t *zio)
 	HDR_SET_PSIZE(hdr, psize);
 	arc_hdr_set_compress(hdr, compress);
 
+	/*
+	 * The zio of an encrypted block holds the ciphertext, but the ARC
+	 * only caches plaintext.  Unless the buf itself is compressed, the
+	 * compressed plaintext is not available here, so the hdr is left
+	 * uncompressed and filled from the buf.
+	 */
+	if (!BP_IS_HOLE(zio->io_bp) && BP_IS_ENCRYPTED(zio->io_bp) &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_ENCRYPT) &&
+	    !ARC_BUF_COMPRESSED(buf)) {
+		arc_hdr_clear_flags(hdr, ARC_FLAG_COMPRESSED_ARC);
+		HDR_SET_COMPRESS(hdr, ZIO_COMPRESS_OFF);
+	}
+
 	/*
 	 * Fill the hdr with data. If the hdr is compressed, the data we want
-	 * is available from the zio, otherwise we can take it from the buf.
+	 * is available from the zio (or, for encrypted blocks, from the
+	 * compressed buf), otherwise we can take it from the buf.
 	 *
 	 * We might be able to share the buf's data with the hdr here. However,
 	 * doing so would cause the ARC to be full of linear ABDs if we write a
@@ -5805,7 +6052,15 @@ arc_write_ready(zio_t *zio)
 			    ZIO_COMPRESS_OFF);
 			ASSERT3U(psize, >, 0);
 
-			abd_copy(hdr->b_l1hdr.b_pabd, zio->io_abd, psize);
+			if (BP_IS_ENCRYPTED(zio->io_bp) &&
+			    !(zio->io_flags & ZIO_FLAG_RAW_ENCRYPT)) {
+				ASSERT(ARC_BUF_COMPRESSED(buf));
+				abd_copy_from_buf(hdr->b_l1hdr.b_pabd,
+				    buf->b_data, psize);
+			} else {
+				abd_copy(hdr->b_l1hdr.b_pabd, zio->io_abd,
+				    psize);
+			}
 		} else {
 			ASSERT3U(zio->io_orig_size, ==, arc_hdr_size(hdr));
 
@@ -5857,7 +6112,12 @@ arc_write_done(zio_t *zio)
 	if (zio->io_error == 0) {
 		arc_hdr_verify(hdr, zio->io_bp);
 
-		if (BP_IS_HOLE(zio->io_bp) || BP_IS_EMBEDDED(zio->io_bp)) {
+		/*
+		 * Raw encrypted writes leave ciphertext in the hdr, which
+		 * must never be found by a lookup of the block.
+		 */
+		if (BP_IS_HOLE(zio->io_bp) || BP_IS_EMBEDDED(zio->io_bp) ||
+		    (zio->io_flags & ZIO_FLAG_RAW_ENCRYPT)) {
 			buf_discard_identity(hdr);
 		} else {
 			hdr->b_dva = *BP_IDENTITY(zio->io_bp);
@@ -5951,7 +6211,7 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 		arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
 	if (ARC_BUF_COMPRESSED(buf)) {
 		ASSERT3U(zp->zp_compress, !=, ZIO_COMPRESS_OFF);
-		zio_flags |= ZIO_FLAG_RAW;
+		zio_flags |= ZIO_FLAG_RAW_COMPRESS;
 	}
 	callback = kmem_zalloc(sizeof (arc_write_callback_t), KM_SLEEP);
 	callback->awcb_ready = ready;
@@ -6467,6 +6727,15 @@ arc_init(void)
 	arc_prune_taskq = taskq_create("arc_prune", max_ncpus, defclsyspri,
 	    max_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
 
+	arc_evict_nthreads = zfs_arc_evict_threads;
+	if (arc_evict_nthreads <= 0)
+		arc_evict_nthreads = MAX(max_ncpus / 8, 1);
+	if (arc_evict_nthreads > 1) {
+		arc_evict_taskq = taskq_create("arc_evict", arc_evict_nthreads,
+		    defclsyspri, arc_evict_nthreads, INT_MAX,
+		    TASKQ_PREPOPULATE);
+	}
+
 	arc_reclaim_thread_exit = B_FALSE;
 
 	arc_ksp = kstat_create("zfs", 0, "arcstats", "misc", KSTAT_TYPE_NAMED,
@@ -6538,6 +6807,11 @@ arc_fini(void)
 	taskq_wait(arc_prune_taskq);
 	taskq_destroy(arc_prune_taskq);
 
+	if (arc_evict_taskq != NULL) {
+		taskq_destroy(arc_evict_taskq);
+		arc_evict_taskq = NULL;
+	}
+
 	mutex_enter(&arc_prune_mtx);
 	while ((p = list_head(&arc_prune_list)) != NULL) {
 		list_remove(&arc_prune_list, p);
@@ -6806,10 +7080,14 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	/*
+	 * If we were unable to find any usable vdevs, return NULL.  Devices
+	 * whose headers are still being rebuilt are left alone, as writing
+	 * to them could overwrite the log blocks being read.
+	 */
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -6862,6 +7140,7 @@ l2arc_write_done(zio_t *zio)
 	l2arc_dev_t *dev;
 	list_t *buflist;
 	arc_buf_hdr_t *head, *hdr, *hdr_prev;
+	l2arc_lb_abd_buf_t *abd_buf;
 	kmutex_t *hash_lock;
 	int64_t bytes_dropped = 0;
 
@@ -6964,6 +7243,15 @@ top:
 	kmem_cache_free(hdr_l2only_cache, head);
 	mutex_exit(&dev->l2ad_mtx);
 
+	/*
+	 * Free the buffers of the log blocks written along with this batch.
+	 */
+	while ((abd_buf = list_remove_head(&cb->l2wcb_abd_list)) != NULL) {
+		abd_free(abd_buf->lbb_abd);
+		kmem_free(abd_buf, sizeof (l2arc_lb_abd_buf_t));
+	}
+	list_destroy(&cb->l2wcb_abd_list);
+
 	vdev_space_update(dev->l2ad_vdev, -bytes_dropped, 0, 0);
 
 	l2arc_do_free_on_write();
@@ -7090,11 +7378,31 @@ l2arc_sublist_lock(int list_num)
 	return (multilist_sublist_lock(ml, idx));
 }
 
+/*
+ * Worst case space taken up by the log blocks written along with
+ * write_sz bytes of buffers.
+ */
+static uint64_t
+l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev)
+{
+	uint64_t log_blocks;
+
+	log_blocks = (write_sz >> SPA_MINBLOCKSHIFT) /
+	    L2ARC_LOG_BLK_MAX_ENTRIES + 1;
+
+	return (log_blocks * vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)));
+}
+
 /*
  * Evict buffers from the device write hand to the distance specified in
  * bytes.  This distance may span populated buffers, it may span nothing.
  * This is clearing a region on the L2ARC device ready for writing.
  * If the 'all' boolean is set, every buffer is evicted.
+ *
+ * When there is not enough room left before the end of the device, the
+ * device is evicted to the end and the write hand jumps back to the start,
+ * from where the requested distance is then evicted.
  */
 static void
 l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
@@ -7103,26 +7411,45 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	arc_buf_hdr_t *hdr, *hdr_prev;
 	kmutex_t *hash_lock;
 	uint64_t taddr;
+	boolean_t rerun;
 
 	buflist = &dev->l2ad_buflist;
 
-	if (!all && dev->l2ad_first) {
-		/*
-		 * This is the first sweep through the device.  There is
-		 * nothing to evict.
-		 */
-		return;
-	}
+	/*
+	 * Leave room for the log blocks written along with the buffers.
+	 */
+	if (!all)
+		distance += l2arc_log_blk_overhead(distance, dev);
 
-	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance))) {
+top_evict:
+	if (dev->l2ad_hand + distance >= dev->l2ad_end) {
 		/*
 		 * When nearing the end of the device, evict to the end
 		 * before the device write hand jumps to the start.
 		 */
+		rerun = B_TRUE;
 		taddr = dev->l2ad_end;
 	} else {
+		rerun = B_FALSE;
 		taddr = dev->l2ad_hand + distance;
 	}
+
+	if (!all) {
+		/*
+		 * l2arc_write_buffers() won't write past this point, which
+		 * is also recorded in the device header so that log blocks
+		 * in the evicted region are not trusted by a rebuild.
+		 */
+		dev->l2ad_evict = taddr;
+
+		if (dev->l2ad_first) {
+			/*
+			 * This is the first sweep through the device.
+			 * There is nothing to evict.
+			 */
+			goto out;
+		}
+	}
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
@@ -7201,6 +7528,162 @@ top:
 		mutex_exit(hash_lock);
 	}
 	mutex_exit(&dev->l2ad_mtx);
+
+out:
+	/*
+	 * Bump the device hand to the device start once the end has been
+	 * evicted, then make room there.  A device smaller than the distance
+	 * simply stops at its end.
+	 */
+	if (!all && rerun && dev->l2ad_hand != dev->l2ad_start) {
+		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
+		dev->l2ad_first = B_FALSE;
+		goto top_evict;
+	}
+}
+
+/*
+ * Write the in-core device header to the start of the cache device.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	abd_t *abd;
+	int err;
+
+	l2dhdr->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dhdr->dh_version = L2ARC_PERSISTENT_VERSION;
+	l2dhdr->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	l2dhdr->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	l2dhdr->dh_flags = dev->l2ad_first ? L2ARC_DEV_HDR_EVICT_FIRST : 0;
+	l2dhdr->dh_start = dev->l2ad_start;
+	l2dhdr->dh_end = dev->l2ad_end;
+	l2dhdr->dh_evict = dev->l2ad_evict;
+
+	abd = abd_get_from_buf(l2dhdr, dev->l2ad_dev_hdr_asize);
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, dev->l2ad_dev_hdr_asize, abd,
+	    ZIO_CHECKSUM_LABEL, NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_put(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC IO error (%d) while writing device header, "
+		    "vdev guid: %llu", err,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+	}
+}
+
+/*
+ * Record a buffer that is being written to the device in the log block
+ * being built.  Returns B_TRUE once the log block is full, at which point
+ * it must be committed before any more buffers are added.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, arc_buf_hdr_t *hdr)
+{
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT3S(dev->l2ad_log_ent_idx, <, L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	if (dev->l2ad_log_ent_idx == 0)
+		dev->l2ad_log_blk_payload_start = hdr->b_l2hdr.b_daddr;
+
+	le = &dev->l2ad_log_blk->lb_entries[dev->l2ad_log_ent_idx++];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	L2BLK_SET_LSIZE(le->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE(le->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS(le->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE(le->le_prop, hdr->b_type);
+	L2BLK_SET_COMPRESSED_ARC(le->le_prop, !!HDR_COMPRESSION_ENABLED(hdr));
+
+	dev->l2ad_log_blk_payload_asize += vdev_psize_to_asize(dev->l2ad_vdev,
+	    arc_hdr_size(hdr));
+
+	return (dev->l2ad_log_ent_idx == L2ARC_LOG_BLK_MAX_ENTRIES);
+}
+
+/*
+ * Write the full log block at the device write hand as a child of pio, and
+ * make it the newest log block referenced by the device header.  The
+ * header itself is only written once the whole batch has made it to disk.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio, l2arc_write_callback_t *cb)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_log_blkptr_t *lbp = &dev->l2ad_dev_hdr->dh_start_lbp;
+	l2arc_lb_abd_buf_t *abd_buf;
+	enum zio_compress compress;
+	uint64_t psize, asize;
+	abd_t *abd;
+	void *tmpbuf;
+	zio_t *wzio;
+
+	ASSERT3S(dev->l2ad_log_ent_idx, ==, L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev_lbp = *lbp;
+
+	/*
+	 * Log blocks compress well, as most of each entry is the same from
+	 * one buffer to the next.  Fall back to writing the block as is if
+	 * compression does not save at least one sector.
+	 */
+	tmpbuf = zio_buf_alloc(sizeof (*lb));
+	abd = abd_get_from_buf(lb, sizeof (*lb));
+	psize = zio_compress_data(ZIO_COMPRESS_LZ4, abd, tmpbuf,
+	    sizeof (*lb), 0);
+	abd_put(abd);
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	if (psize != 0 && asize < sizeof (*lb)) {
+		bzero((char *)tmpbuf + psize, asize - psize);
+		compress = ZIO_COMPRESS_LZ4;
+	} else {
+		bcopy(lb, tmpbuf, sizeof (*lb));
+		asize = vdev_psize_to_asize(dev->l2ad_vdev, sizeof (*lb));
+		compress = ZIO_COMPRESS_OFF;
+	}
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, tmpbuf, asize);
+	zio_buf_free(tmpbuf, sizeof (*lb));
+
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_payload_asize = dev->l2ad_log_blk_payload_asize;
+	lbp->lbp_payload_start = dev->l2ad_log_blk_payload_start;
+	lbp->lbp_prop = 0;
+	L2BLK_SET_LSIZE(lbp->lbp_prop, sizeof (*lb));
+	L2BLK_SET_PSIZE(lbp->lbp_prop, asize);
+	L2BLK_SET_COMPRESS(lbp->lbp_prop, compress);
+	L2BLK_SET_CHECKSUM(lbp->lbp_prop, ZIO_CHECKSUM_FLETCHER_4);
+	abd_fletcher_4_native(abd, asize, NULL, &lbp->lbp_cksum);
+
+	/* The buffer is freed by l2arc_write_done(). */
+	abd_buf = kmem_alloc(sizeof (l2arc_lb_abd_buf_t), KM_SLEEP);
+	abd_buf->lbb_abd = abd;
+	list_insert_tail(&cb->l2wcb_abd_list, abd_buf);
+
+	wzio = zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand, asize,
+	    abd, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE);
+	DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev, zio_t *, wzio);
+	(void) zio_nowait(wzio);
+
+	dev->l2ad_hand += asize;
+
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+	ARCSTAT_F_AVG(arcstat_l2_log_blk_avg_asize, asize);
+	ARCSTAT_INCR(arcstat_l2_write_bytes, asize);
+
+	dev->l2ad_log_ent_idx = 0;
+	dev->l2ad_log_blk_payload_asize = 0;
+	dev->l2ad_log_blk_payload_start = 0;
 }
 
 /*
@@ -7218,15 +7701,20 @@ static uint64_t
 l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 {
 	arc_buf_hdr_t *hdr, *hdr_prev, *head;
-	uint64_t write_asize, write_psize, write_sz, headroom;
+	uint64_t write_asize, write_psize, write_sz, headroom, lb_asize;
 	boolean_t full;
-	l2arc_write_callback_t *cb;
+	l2arc_write_callback_t *cb = NULL;
+	l2arc_log_blkptr_t start_lbp;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_load_guid(spa);
 	int try;
 
 	ASSERT3P(dev->l2ad_vdev, !=, NULL);
 
+	lb_asize = vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t));
+	start_lbp = dev->l2ad_dev_hdr->dh_start_lbp;
+
 	pio = NULL;
 	write_sz = write_asize = write_psize = 0;
 	full = B_FALSE;
@@ -7261,6 +7749,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			kmutex_t *hash_lock;
 			uint64_t asize, size;
 			abd_t *to_write;
+			boolean_t commit;
 
 			if (arc_warm == B_FALSE)
 				hdr_prev = multilist_sublist_next(mls, hdr);
@@ -7295,6 +7784,18 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				break;
 			}
 
+			/*
+			 * Never write past the region cleared by
+			 * l2arc_evict(), leaving room for a log block.
+			 */
+			if (dev->l2ad_hand + lb_asize +
+			    vdev_psize_to_asize(dev->l2ad_vdev,
+			    arc_hdr_size(hdr)) > dev->l2ad_evict) {
+				full = B_TRUE;
+				mutex_exit(hash_lock);
+				break;
+			}
+
 			if (pio == NULL) {
 				/*
 				 * Insert a dummy header on the buflist so
@@ -7309,6 +7810,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				    sizeof (l2arc_write_callback_t), KM_SLEEP);
 				cb->l2wcb_dev = dev;
 				cb->l2wcb_head = head;
+				list_create(&cb->l2wcb_abd_list,
+				    sizeof (l2arc_lb_abd_buf_t),
+				    offsetof(l2arc_lb_abd_buf_t, lbb_node));
 				pio = zio_root(spa, l2arc_write_done, cb,
 				    ZIO_FLAG_CANFAIL);
 			}
@@ -7375,9 +7879,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			write_psize += asize;
 			dev->l2ad_hand += asize;
 
+			commit = l2arc_log_blk_insert(dev, hdr);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			if (commit)
+				l2arc_log_blk_commit(dev, pio, cb);
 		}
 
 		multilist_sublist_unlock(mls);
@@ -7401,17 +7910,24 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	ARCSTAT_INCR(arcstat_l2_asize, write_asize);
 	vdev_space_update(dev->l2ad_vdev, write_asize, 0, 0);
 
-	/*
-	 * Bump device hand to the device start if it is approaching the end.
-	 * l2arc_evict() will already have evicted ahead for this case.
-	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
-		dev->l2ad_hand = dev->l2ad_start;
-		dev->l2ad_first = B_FALSE;
-	}
-
 	dev->l2ad_writing = B_TRUE;
-	(void) zio_wait(pio);
+	if (zio_wait(pio) == 0) {
+		/*
+		 * Only point the device header at log blocks once they,
+		 * and the buffers they describe, are on the device.
+		 */
+		l2arc_dev_hdr_update(dev);
+	} else {
+		/*
+		 * l2arc_write_done() dropped the buffers of this batch, so
+		 * forget the log blocks written with them and start the
+		 * log block being built afresh.
+		 */
+		dev->l2ad_dev_hdr->dh_start_lbp = start_lbp;
+		dev->l2ad_log_ent_idx = 0;
+		dev->l2ad_log_blk_payload_asize = 0;
+		dev->l2ad_log_blk_payload_start = 0;
+	}
 	dev->l2ad_writing = B_FALSE;
 
 	return (write_asize);
@@ -7517,8 +8033,428 @@ l2arc_feed_thread(void)
 	thread_exit();
 }
 
-boolean_t
-l2arc_vdev_present(vdev_t *vd)
+/*
+ * Returns B_TRUE if check lies within [bottom, top], a range which wraps
+ * around the end of the device when top is below bottom.
+ */
+static boolean_t
+l2arc_range_check_overlap(uint64_t bottom, uint64_t top, uint64_t check)
+{
+	if (bottom < top)
+		return (bottom <= check && check <= top);
+	else if (bottom > top)
+		return (check <= top || bottom <= check);
+	else
+		return (check == top);
+}
+
+/*
+ * Returns B_TRUE if the log block pointer points to a plausible log block
+ * whose payload has not been overwritten since it was written, that is, one
+ * which doesn't overlap the region between the write hand and the evict
+ * hand recorded in the device header.
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t asize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	uint64_t start = lbp->lbp_payload_start;
+	uint64_t end = lbp->lbp_daddr + asize - 1;
+	boolean_t evicted;
+
+	if (lbp->lbp_daddr < dev->l2ad_start ||
+	    lbp->lbp_daddr + asize > dev->l2ad_end ||
+	    start < dev->l2ad_start || start >= dev->l2ad_end ||
+	    asize > sizeof (l2arc_log_blk_phys_t) ||
+	    L2BLK_GET_LSIZE(lbp->lbp_prop) != sizeof (l2arc_log_blk_phys_t) ||
+	    L2BLK_GET_CHECKSUM(lbp->lbp_prop) != ZIO_CHECKSUM_FLETCHER_4)
+		return (B_FALSE);
+
+	evicted =
+	    l2arc_range_check_overlap(start, end, dev->l2ad_hand) ||
+	    l2arc_range_check_overlap(start, end, dev->l2ad_evict) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, start) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, end);
+
+	return (!evicted || dev->l2ad_first);
+}
+
+/*
+ * Read the device header from the cache device and check that it was
+ * written for this device, in this pool, with the current layout.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	vdev_t *vd = dev->l2ad_vdev;
+	abd_t *abd;
+	int err;
+
+	abd = abd_get_from_buf(l2dhdr, dev->l2ad_dev_hdr_asize);
+	err = zio_wait(zio_read_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    dev->l2ad_dev_hdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
+	    ZIO_FLAG_SPECULATIVE, B_FALSE));
+	abd_put(abd);
+
+	if (err != 0) {
+		/*
+		 * A checksum error is expected on a device which has never
+		 * had a header written to it.
+		 */
+		if (err != ECKSUM) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_dh_errors);
+			zfs_dbgmsg("L2ARC IO error (%d) while reading device "
+			    "header, vdev guid: %llu", err,
+			    (u_longlong_t)vd->vdev_guid);
+		}
+		return (err);
+	}
+
+	if (l2dhdr->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    l2dhdr->dh_version != L2ARC_PERSISTENT_VERSION ||
+	    l2dhdr->dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    l2dhdr->dh_vdev_guid != vd->vdev_guid ||
+	    l2dhdr->dh_start != dev->l2ad_start ||
+	    l2dhdr->dh_end != dev->l2ad_end ||
+	    l2dhdr->dh_evict > dev->l2ad_end)
+		return (SET_ERROR(ENOTSUP));
+
+	return (0);
+}
+
+/*
+ * Issue the read of a log block into abd.
+ */
+static zio_t *
+l2arc_log_blk_fetch(vdev_t *vd, const l2arc_log_blkptr_t *lbp, abd_t *abd)
+{
+	zio_t *pio;
+
+	pio = zio_root(vd->vdev_spa, NULL, NULL, ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY);
+	zio_nowait(zio_read_phys(pio, vd, lbp->lbp_daddr,
+	    L2BLK_GET_PSIZE(lbp->lbp_prop), abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_RETRY, B_FALSE));
+
+	return (pio);
+}
+
+/*
+ * Wait for the read of a log block issued by l2arc_log_blk_fetch(), then
+ * verify it against its log block pointer and decompress it into lb.
+ */
+static int
+l2arc_log_blk_read(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    zio_t *zio, abd_t *abd, l2arc_log_blk_phys_t *lb)
+{
+	uint64_t asize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	zio_cksum_t cksum;
+	int err;
+
+	if ((err = zio_wait(zio)) != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		zfs_dbgmsg("L2ARC IO error (%d) while reading log block, "
+		    "offset: %llu, vdev guid: %llu", err,
+		    (u_longlong_t)lbp->lbp_daddr,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+		return (err);
+	}
+
+	abd_fletcher_4_native(abd, asize, NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		zfs_dbgmsg("L2ARC log block cksum failed, offset: %llu, "
+		    "vdev guid: %llu", (u_longlong_t)lbp->lbp_daddr,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	switch (L2BLK_GET_COMPRESS(lbp->lbp_prop)) {
+	case ZIO_COMPRESS_OFF:
+		if (asize != sizeof (*lb))
+			return (SET_ERROR(EINVAL));
+		abd_copy_to_buf(lb, abd, sizeof (*lb));
+		break;
+	case ZIO_COMPRESS_LZ4:
+		if ((err = zio_decompress_data(ZIO_COMPRESS_LZ4, abd, lb,
+		    asize, sizeof (*lb))) != 0)
+			return (SET_ERROR(EINVAL));
+		break;
+	default:
+		return (SET_ERROR(EINVAL));
+	}
+
+	if (lb->lb_magic != L2ARC_LOG_BLK_MAGIC)
+		return (SET_ERROR(EINVAL));
+
+	return (0);
+}
+
+/*
+ * Recreate an L2-only header for a buffer described by a log entry, unless
+ * the buffer is already cached.
+ */
+static void
+l2arc_hdr_restore(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le)
+{
+	arc_buf_contents_t type = L2BLK_GET_TYPE(le->le_prop);
+	uint64_t lsize = L2BLK_GET_LSIZE(le->le_prop);
+	uint64_t psize = L2BLK_GET_PSIZE(le->le_prop);
+	enum zio_compress compress = L2BLK_GET_COMPRESS(le->le_prop);
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	uint64_t size, asize;
+
+	if (DVA_IS_EMPTY(&le->le_dva) || le->le_birth == 0 ||
+	    type >= ARC_BUFC_NUMTYPES || compress >= ZIO_COMPRESS_FUNCTIONS ||
+	    lsize > SPA_MAXBLOCKSIZE || psize > lsize ||
+	    le->le_daddr < dev->l2ad_start || le->le_daddr >= dev->l2ad_end)
+		return;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	ASSERT(HDR_EMPTY(hdr));
+	ASSERT3P(hdr->b_hash_next, ==, NULL);
+
+	/*
+	 * The header isn't visible to anyone else until it is inserted in
+	 * the hash table below, so it can be set up without any locks.
+	 */
+	hdr->b_flags = arc_bufc_to_flags(type);
+	if (L2BLK_GET_COMPRESSED_ARC(le->le_prop))
+		hdr->b_flags |= ARC_FLAG_COMPRESSED_ARC;
+	HDR_SET_COMPRESS(hdr, compress);
+	HDR_SET_LSIZE(hdr, lsize);
+	HDR_SET_PSIZE(hdr, psize);
+	hdr->b_type = type;
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+	hdr->b_l2hdr.b_hits = 0;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/*
+		 * The buffer was read into the ARC while the rebuild was
+		 * running.  Keep the existing header.
+		 */
+		mutex_exit(hash_lock);
+		arc_hdr_destroy(hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	arc_hdr_set_flags(hdr, ARC_FLAG_HAS_L2HDR);
+	size = arc_hdr_size(hdr);
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, size);
+
+	/*
+	 * Log entries are restored from the newest to the oldest, so adding
+	 * them at the tail keeps the buflist in the order l2arc_evict()
+	 * expects.
+	 */
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) refcount_add_many(&dev->l2ad_alloc, size, hdr);
+	mutex_exit(&dev->l2ad_mtx);
+
+	mutex_exit(hash_lock);
+
+	ARCSTAT_INCR(arcstat_l2_size, lsize);
+	ARCSTAT_INCR(arcstat_l2_asize, size);
+	vdev_space_update(dev->l2ad_vdev, size, 0, 0);
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, lsize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+}
+
+/*
+ * Take the SCL_L2ARC config lock as reader without queueing behind a
+ * writer, which may be l2arc_remove_vdev() waiting for the rebuild.
+ */
+static boolean_t
+l2arc_rebuild_config_enter(l2arc_dev_t *dev)
+{
+	while (!spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+	    RW_READER)) {
+		if (dev->l2ad_rebuild_cancel)
+			return (B_FALSE);
+		delay(1);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Restore the L2-only headers of the buffers on a cache device by walking
+ * its chain of log blocks from the newest to the oldest.  The walk stops
+ * at the first log block which is missing, damaged or whose payload has
+ * since been overwritten; the buffers it described are simply not cached.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	spa_t *spa = dev->l2ad_spa;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	l2arc_log_blk_phys_t *this_lb, *next_lb;
+	abd_t *this_abd, *next_abd;
+	zio_t *this_io = NULL, *next_io = NULL;
+	l2arc_log_blkptr_t lbp;
+	int err, i;
+
+	if (!l2arc_rebuild_config_enter(dev))
+		return (SET_ERROR(ECANCELED));
+
+	if ((err = l2arc_dev_hdr_read(dev)) != 0) {
+		/* Start afresh, new log blocks will begin a new chain. */
+		bzero(l2dhdr, dev->l2ad_dev_hdr_asize);
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		return (err);
+	}
+
+	/*
+	 * Resume writing right after the newest log block, as the buffers
+	 * written after it can't be restored.
+	 */
+	lbp = l2dhdr->dh_start_lbp;
+	if (lbp.lbp_daddr == 0) {
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		return (0);
+	}
+	dev->l2ad_hand = MIN(lbp.lbp_daddr + L2BLK_GET_PSIZE(lbp.lbp_prop),
+	    dev->l2ad_end);
+	dev->l2ad_evict = MAX(l2dhdr->dh_evict, dev->l2ad_start);
+	dev->l2ad_first = !!(l2dhdr->dh_flags & L2ARC_DEV_HDR_EVICT_FIRST);
+
+	this_lb = vmem_zalloc(sizeof (l2arc_log_blk_phys_t), KM_SLEEP);
+	next_lb = vmem_zalloc(sizeof (l2arc_log_blk_phys_t), KM_SLEEP);
+	this_abd = abd_alloc_for_io(sizeof (l2arc_log_blk_phys_t), B_TRUE);
+	next_abd = abd_alloc_for_io(sizeof (l2arc_log_blk_phys_t), B_TRUE);
+
+	for (;;) {
+		l2arc_log_blk_phys_t *tmp_lb;
+		abd_t *tmp_abd;
+
+		if (!l2arc_log_blkptr_valid(dev, &lbp))
+			break;
+
+		if (this_io == NULL)
+			this_io = l2arc_log_blk_fetch(vd, &lbp, this_abd);
+		err = l2arc_log_blk_read(dev, &lbp, this_io, this_abd,
+		    this_lb);
+		this_io = NULL;
+		if (err != 0)
+			break;
+
+		/*
+		 * Start reading the previous log block while the entries
+		 * of this one are restored.
+		 */
+		if (l2arc_log_blkptr_valid(dev, &this_lb->lb_prev_lbp)) {
+			next_io = l2arc_log_blk_fetch(vd,
+			    &this_lb->lb_prev_lbp, next_abd);
+		}
+
+		/*
+		 * Don't add to memory pressure; the rest of the device is
+		 * left to be overwritten.
+		 */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			zfs_dbgmsg("L2ARC rebuild aborted, low memory, "
+			    "vdev guid: %llu", (u_longlong_t)vd->vdev_guid);
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		/*
+		 * Let device removal proceed while the headers are restored,
+		 * it cancels the rebuild and waits for it.
+		 */
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		for (i = L2ARC_LOG_BLK_MAX_ENTRIES - 1; i >= 0; i--)
+			l2arc_hdr_restore(dev, &this_lb->lb_entries[i]);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+
+		if (dev->l2ad_rebuild_cancel ||
+		    !l2arc_rebuild_config_enter(dev)) {
+			if (next_io != NULL)
+				(void) zio_wait(next_io);
+			next_io = NULL;
+			err = SET_ERROR(ECANCELED);
+			goto out;
+		}
+
+		lbp = this_lb->lb_prev_lbp;
+		tmp_lb = this_lb;
+		this_lb = next_lb;
+		next_lb = tmp_lb;
+		tmp_abd = this_abd;
+		this_abd = next_abd;
+		next_abd = tmp_abd;
+		this_io = next_io;
+		next_io = NULL;
+	}
+
+	if (next_io != NULL)
+		(void) zio_wait(next_io);
+	spa_config_exit(spa, SCL_L2ARC, dev);
+
+out:
+	ASSERT3P(this_io, ==, NULL);
+	vmem_free(this_lb, sizeof (l2arc_log_blk_phys_t));
+	vmem_free(next_lb, sizeof (l2arc_log_blk_phys_t));
+	abd_free(this_abd);
+	abd_free(next_abd);
+
+	return (err);
+}
+
+/*
+ * Rebuild thread for a single cache device, started by
+ * l2arc_spa_rebuild_start().
+ */
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+	hrtime_t start = gethrtime();
+	fstrans_cookie_t cookie;
+	int err;
+
+	cookie = spl_fstrans_mark();
+	ARCSTAT_BUMP(arcstat_l2_rebuild_active);
+
+	err = l2arc_rebuild(dev);
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+
+	ARCSTAT_INCR(arcstat_l2_rebuild_time_ms,
+	    NSEC2MSEC(gethrtime() - start));
+	ARCSTAT_BUMPDOWN(arcstat_l2_rebuild_active);
+	spl_fstrans_unmark(cookie);
+
+	/*
+	 * Hand the device over to the feed thread.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild = B_FALSE;
+	dev->l2ad_rebuild_began = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
+}
+
+static l2arc_dev_t *
+l2arc_vdev_get(vdev_t *vd)
 {
 	l2arc_dev_t *dev;
 
@@ -7530,7 +8466,13 @@ l2arc_vdev_present(vdev_t *vd)
 	}
 	mutex_exit(&l2arc_dev_mtx);
 
-	return (dev != NULL);
+	return (dev);
+}
+
+boolean_t
+l2arc_vdev_present(vdev_t *vd)
+{
+	return (l2arc_vdev_get(vd) != NULL);
 }
 
 /*
@@ -7550,13 +8492,32 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* leave room for the device header */
+	adddev->l2ad_dev_hdr_asize = vdev_psize_to_asize(vd,
+	    sizeof (l2arc_dev_hdr_phys_t));
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE +
+	    adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_dev_hdr = kmem_zalloc(adddev->l2ad_dev_hdr_asize,
+	    KM_SLEEP);
+	adddev->l2ad_log_blk = vmem_zalloc(sizeof (l2arc_log_blk_phys_t),
+	    KM_SLEEP);
 	list_link_init(&adddev->l2ad_node);
 
+	/*
+	 * Devices which are part of a pool being opened or imported may
+	 * hold the headers of a previous session.  The rebuild is started
+	 * by l2arc_spa_rebuild_start() once the pool is loaded, until then
+	 * the feed thread leaves the device alone.  Devices added to a
+	 * running pool start out empty.
+	 */
+	adddev->l2ad_rebuild = l2arc_rebuild_enabled &&
+	    spa->spa_load_state != SPA_LOAD_NONE;
+
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
 	/*
 	 * This is a list of all ARC buffers that are still valid on the
@@ -7606,6 +8567,15 @@ l2arc_remove_vdev(vdev_t *vd)
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	/*
+	 * Cancel any rebuild of the device and wait for it to stop.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild_began)
+		cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
@@ -7613,9 +8583,79 @@ l2arc_remove_vdev(vdev_t *vd)
 	list_destroy(&remdev->l2ad_buflist);
 	mutex_destroy(&remdev->l2ad_mtx);
 	refcount_destroy(&remdev->l2ad_alloc);
+	kmem_free(remdev->l2ad_dev_hdr, remdev->l2ad_dev_hdr_asize);
+	vmem_free(remdev->l2ad_log_blk, sizeof (l2arc_log_blk_phys_t));
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
+/*
+ * Start rebuilding the L2ARC headers of the pool's cache devices, each in
+ * its own thread.  Called once the pool has been loaded.
+ */
+void
+l2arc_spa_rebuild_start(spa_t *spa)
+{
+	int i;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	for (i = 0; i < spa->spa_l2cache.sav_count; i++) {
+		l2arc_dev_t *dev =
+		    l2arc_vdev_get(spa->spa_l2cache.sav_vdevs[i]);
+
+		if (dev == NULL)
+			continue;
+
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		if (dev->l2ad_rebuild && !dev->l2ad_rebuild_began &&
+		    !dev->l2ad_rebuild_cancel) {
+			dev->l2ad_rebuild_began = B_TRUE;
+			(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+			    dev, 0, &p0, TS_RUN, minclsyspri);
+		}
+		mutex_exit(&l2arc_rebuild_thr_lock);
+	}
+}
+
+/*
+ * Cancel the rebuilds of the pool's cache devices and wait for them to
+ * stop.  Called before the pool is unloaded.
+ */
+void
+l2arc_spa_rebuild_stop(spa_t *spa)
+{
+	int i;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	for (i = 0; i < spa->spa_l2cache.sav_count; i++) {
+		l2arc_dev_t *dev =
+		    l2arc_vdev_get(spa->spa_l2cache.sav_vdevs[i]);
+
+		if (dev == NULL)
+			continue;
+
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		dev->l2ad_rebuild_cancel = B_TRUE;
+		mutex_exit(&l2arc_rebuild_thr_lock);
+	}
+
+	for (i = 0; i < spa->spa_l2cache.sav_count; i++) {
+		l2arc_dev_t *dev =
+		    l2arc_vdev_get(spa->spa_l2cache.sav_vdevs[i]);
+
+		if (dev == NULL)
+			continue;
+
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		while (dev->l2ad_rebuild_began) {
+			cv_wait(&l2arc_rebuild_thr_cv,
+			    &l2arc_rebuild_thr_lock);
+		}
+		mutex_exit(&l2arc_rebuild_thr_lock);
+	}
+}
+
 void
 l2arc_init(void)
 {
@@ -7626,6 +8666,8 @@ l2arc_init(void)
 
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -7650,6 +8692,8 @@ l2arc_fini(void)
 
 	mutex_destroy(&l2arc_feed_thr_lock);
 	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -7732,6 +8776,9 @@ MODULE_PARM_DESC(zfs_arc_shrink_shift, "log2(fraction of arc to reclaim)");
 module_param(zfs_arc_p_min_shift, int, 0644);
 MODULE_PARM_DESC(zfs_arc_p_min_shift, "arc_c shift to calc min/max arc_p");
 
+module_param(zfs_arc_evict_threads, int, 0444);
+MODULE_PARM_DESC(zfs_arc_evict_threads, "Number of threads evicting the arc");
+
 module_param(zfs_arc_average_blocksize, int, 0444);
 MODULE_PARM_DESC(zfs_arc_average_blocksize, "Target average block size");
 
@@ -7768,6 +8815,10 @@ MODULE_PARM_DESC(l2arc_feed_again, "Turbo L2ARC warmup");
 module_param(l2arc_norw, int, 0644);
 MODULE_PARM_DESC(l2arc_norw, "No reads during writes");
 
+module_param(l2arc_rebuild_enabled, int, 0644);
+MODULE_PARM_DESC(l2arc_rebuild_enabled,
+	"Rebuild the L2ARC when importing a pool");
+
 module_param(zfs_arc_lotsfree_percent, int, 0644);
 MODULE_PARM_DESC(zfs_arc_lotsfree_percent,
 	"System free memory I/O throttle in bytes");
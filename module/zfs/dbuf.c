@@ -188,7 +188,57 @@ dbuf_dest(void *vdb, void *unused)
  */
 static dbuf_hash_table_t dbuf_hash_table;
 
-static uint64_t dbuf_hash_count;
+/*
+ * The hash table starts out at DBUF_HASH_MIN_SIZE buckets and is resized
+ * by the dbuf evict thread to keep the average chain length between
+ * 1/dbuf_hash_shrink_ratio and dbuf_hash_grow_ratio.  It never grows
+ * beyond the size needed to fill all of physical memory with blocks of
+ * zfs_arc_average_blocksize, dbuf_hash_max_size.
+ */
+#define	DBUF_HASH_MIN_SIZE	(1ULL << 16)
+static uint64_t dbuf_hash_max_size;
+int dbuf_hash_grow_ratio = 2;
+int dbuf_hash_shrink_ratio = 8;
+
+typedef struct dbuf_hash_stats {
+	kstat_named_t hash_elements;
+	kstat_named_t hash_elements_max;
+	kstat_named_t hash_buckets;
+	kstat_named_t hash_collisions;
+	kstat_named_t hash_chains;
+	kstat_named_t hash_chain_max;
+	kstat_named_t hash_lock_contended;
+	kstat_named_t hash_insert_race;
+	kstat_named_t hash_grows;
+	kstat_named_t hash_shrinks;
+} dbuf_hash_stats_t;
+
+static dbuf_hash_stats_t dbuf_hash_stats = {
+	{ "hash_elements",		KSTAT_DATA_UINT64 },
+	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
+	{ "hash_buckets",		KSTAT_DATA_UINT64 },
+	{ "hash_collisions",		KSTAT_DATA_UINT64 },
+	{ "hash_chains",		KSTAT_DATA_UINT64 },
+	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_lock_contended",	KSTAT_DATA_UINT64 },
+	{ "hash_insert_race",		KSTAT_DATA_UINT64 },
+	{ "hash_grows",			KSTAT_DATA_UINT64 },
+	{ "hash_shrinks",		KSTAT_DATA_UINT64 },
+};
+
+#define	DBUF_HASH_STAT(stat)	(dbuf_hash_stats.stat.value.ui64)
+#define	DBUF_HASH_STAT_BUMP(stat) \
+	atomic_inc_64(&dbuf_hash_stats.stat.value.ui64)
+#define	DBUF_HASH_STAT_BUMPDOWN(stat) \
+	atomic_dec_64(&dbuf_hash_stats.stat.value.ui64)
+#define	DBUF_HASH_STAT_MAX(stat, val) {					\
+	uint64_t m;							\
+	while ((val) > (m = dbuf_hash_stats.stat.value.ui64) &&		\
+	    (m != atomic_cas_64(&dbuf_hash_stats.stat.value.ui64, m, (val)))) \
+		continue;						\
+}
+
+static kstat_t *dbuf_hash_ksp;
 
 static uint64_t
 dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
@@ -215,29 +265,47 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	(dbuf)->db_level == (level) &&			\
 	(dbuf)->db_blkid == (blkid))
 
+/*
+ * Acquire a hash table stripe lock, counting how often it is not
+ * immediately available.
+ */
+static inline void
+dbuf_hash_enter(dbuf_hash_lock_t *dhl, krw_t rw)
+{
+	if (!rw_tryenter(&dhl->dhl_lock, rw)) {
+		DBUF_HASH_STAT_BUMP(hash_lock_contended);
+		rw_enter(&dhl->dhl_lock, rw);
+	}
+}
+
+/*
+ * Lookups only take the stripe lock as reader, so concurrent lookups of
+ * the same or neighbouring buckets never wait on each other.
+ */
 dmu_buf_impl_t *
 dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
+	dbuf_hash_lock_t *dhl;
 	uint64_t hv;
-	uint64_t idx;
 	dmu_buf_impl_t *db;
 
 	hv = dbuf_hash(os, obj, level, blkid);
-	idx = hv & h->hash_table_mask;
+	dhl = DBUF_HASH_LOCK(h, hv);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
+	dbuf_hash_enter(dhl, RW_READER);
+	for (db = dhl->dhl_table[hv & dhl->dhl_mask]; db != NULL;
+	    db = db->db_hash_next) {
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
 			mutex_enter(&db->db_mtx);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				rw_exit(&dhl->dhl_lock);
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	rw_exit(&dhl->dhl_lock);
 	return (NULL);
 }
 
@@ -269,22 +337,27 @@ static dmu_buf_impl_t *
 dbuf_hash_insert(dmu_buf_impl_t *db)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
+	dbuf_hash_lock_t *dhl;
 	objset_t *os = db->db_objset;
 	uint64_t obj = db->db.db_object;
 	int level = db->db_level;
 	uint64_t blkid, hv, idx;
 	dmu_buf_impl_t *dbf;
+	uint32_t i;
 
 	blkid = db->db_blkid;
 	hv = dbuf_hash(os, obj, level, blkid);
-	idx = hv & h->hash_table_mask;
+	dhl = DBUF_HASH_LOCK(h, hv);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
+	dbuf_hash_enter(dhl, RW_WRITER);
+	idx = hv & dhl->dhl_mask;
+	for (dbf = dhl->dhl_table[idx], i = 0; dbf != NULL;
+	    dbf = dbf->db_hash_next, i++) {
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				rw_exit(&dhl->dhl_lock);
+				DBUF_HASH_STAT_BUMP(hash_insert_race);
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
@@ -292,10 +365,21 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	}
 
 	mutex_enter(&db->db_mtx);
-	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_inc_64(&dbuf_hash_count);
+	db->db_hash_next = dhl->dhl_table[idx];
+	dhl->dhl_table[idx] = db;
+	rw_exit(&dhl->dhl_lock);
+
+	/* collect some hash table performance data */
+	if (i > 0) {
+		DBUF_HASH_STAT_BUMP(hash_collisions);
+		if (i == 1)
+			DBUF_HASH_STAT_BUMP(hash_chains);
+
+		DBUF_HASH_STAT_MAX(hash_chain_max, i);
+	}
+
+	DBUF_HASH_STAT_BUMP(hash_elements);
+	DBUF_HASH_STAT_MAX(hash_elements_max, DBUF_HASH_STAT(hash_elements));
 
 	return (NULL);
 }
@@ -307,31 +391,170 @@ static void
 dbuf_hash_remove(dmu_buf_impl_t *db)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
+	dbuf_hash_lock_t *dhl;
 	uint64_t hv, idx;
 	dmu_buf_impl_t *dbf, **dbp;
 
 	hv = dbuf_hash(db->db_objset, db->db.db_object,
 	    db->db_level, db->db_blkid);
-	idx = hv & h->hash_table_mask;
+	dhl = DBUF_HASH_LOCK(h, hv);
 
 	/*
 	 * We mustn't hold db_mtx to maintain lock ordering:
-	 * DBUF_HASH_MUTEX > db_mtx.
+	 * DBUF_HASH_LOCK > db_mtx.
 	 */
 	ASSERT(refcount_is_zero(&db->db_holds));
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	dbp = &h->hash_table[idx];
+	dbuf_hash_enter(dhl, RW_WRITER);
+	idx = hv & dhl->dhl_mask;
+	dbp = &dhl->dhl_table[idx];
 	while ((dbf = *dbp) != db) {
 		dbp = &dbf->db_hash_next;
 		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_dec_64(&dbuf_hash_count);
+
+	/* collect some hash table performance data */
+	if (dhl->dhl_table[idx] != NULL &&
+	    dhl->dhl_table[idx]->db_hash_next == NULL)
+		DBUF_HASH_STAT_BUMPDOWN(hash_chains);
+	rw_exit(&dhl->dhl_lock);
+
+	DBUF_HASH_STAT_BUMPDOWN(hash_elements);
+}
+
+static dmu_buf_impl_t **
+dbuf_hash_table_alloc(uint64_t hsize, int kmflag)
+{
+#if defined(_KERNEL) && defined(HAVE_SPL)
+	/*
+	 * Large allocations which do not require contiguous pages
+	 * should be using vmem_alloc() in the linux kernel
+	 */
+	return (vmem_zalloc(hsize * sizeof (void *), kmflag));
+#else
+	return (kmem_zalloc(hsize * sizeof (void *), kmflag));
+#endif
+}
+
+static void
+dbuf_hash_table_free(dmu_buf_impl_t **table, uint64_t hsize)
+{
+#if defined(_KERNEL) && defined(HAVE_SPL)
+	vmem_free(table, hsize * sizeof (void *));
+#else
+	kmem_free(table, hsize * sizeof (void *));
+#endif
+}
+
+/*
+ * Return the number of buckets the hash table should be resized to, or
+ * zero when its current size is adequate.
+ */
+static uint64_t
+dbuf_hash_target_size(void)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	uint64_t hsize = h->hash_table_mask + 1;
+	uint64_t count = DBUF_HASH_STAT(hash_elements);
+	uint64_t target;
+
+	if (dbuf_hash_grow_ratio > 0 &&
+	    count > hsize * dbuf_hash_grow_ratio && hsize < dbuf_hash_max_size)
+		target = MIN(1ULL << highbit64(count), dbuf_hash_max_size);
+	else if (dbuf_hash_shrink_ratio > 0 &&
+	    count < hsize / dbuf_hash_shrink_ratio &&
+	    hsize > DBUF_HASH_MIN_SIZE)
+		target = MAX(1ULL << highbit64(count), DBUF_HASH_MIN_SIZE);
+	else
+		return (0);
+
+	return (target == hsize ? 0 : target);
+}
+
+/*
+ * Move every dbuf into a newly allocated table of the target size.  The
+ * table is rehashed one stripe at a time: since a bucket's stripe is
+ * selected by the low bits of its hash, a stripe of the old table only
+ * ever maps to the same stripe of the new one.  Lookups in the other
+ * stripes proceed normally while a stripe is being moved.
+ */
+static void
+dbuf_hash_resize(void)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	dmu_buf_impl_t **table, **otable, *db;
+	uint64_t hsize, ohsize, mask, chain_max = 0;
+	int s;
+
+	mutex_enter(&h->hash_resize_lock);
+	hsize = dbuf_hash_target_size();
+	if (hsize == 0) {
+		mutex_exit(&h->hash_resize_lock);
+		return;
+	}
+
+	table = dbuf_hash_table_alloc(hsize, KM_NOSLEEP);
+	if (table == NULL) {
+		mutex_exit(&h->hash_resize_lock);
+		return;
+	}
+	mask = hsize - 1;
+	otable = h->hash_table;
+	ohsize = h->hash_table_mask + 1;
+
+	for (s = 0; s < DBUF_HASH_LOCKS; s++) {
+		dbuf_hash_lock_t *dhl = &h->hash_locks[s];
+		int64_t ochains = 0, nchains = 0;
+		uint64_t idx;
+
+		rw_enter(&dhl->dhl_lock, RW_WRITER);
+		ASSERT3P(dhl->dhl_table, ==, otable);
+		for (idx = s; idx < ohsize; idx += DBUF_HASH_LOCKS) {
+			if (otable[idx] != NULL &&
+			    otable[idx]->db_hash_next != NULL)
+				ochains++;
+			while ((db = otable[idx]) != NULL) {
+				uint64_t nidx = dbuf_hash(db->db_objset,
+				    db->db.db_object, db->db_level,
+				    db->db_blkid) & mask;
+
+				otable[idx] = db->db_hash_next;
+				db->db_hash_next = table[nidx];
+				table[nidx] = db;
+			}
+		}
+		for (idx = s; idx < hsize; idx += DBUF_HASH_LOCKS) {
+			uint64_t len = 0;
+
+			for (db = table[idx]; db != NULL; db = db->db_hash_next)
+				len++;
+			if (len > 1)
+				nchains++;
+			chain_max = MAX(chain_max, len);
+		}
+		dhl->dhl_table = table;
+		dhl->dhl_mask = mask;
+		rw_exit(&dhl->dhl_lock);
+
+		atomic_add_64(&DBUF_HASH_STAT(hash_chains), nchains - ochains);
+	}
+
+	h->hash_table = table;
+	h->hash_table_mask = mask;
+	mutex_exit(&h->hash_resize_lock);
+
+	DBUF_HASH_STAT(hash_buckets) = hsize;
+	DBUF_HASH_STAT(hash_chain_max) = chain_max > 0 ? chain_max - 1 : 0;
+	if (hsize > ohsize)
+		DBUF_HASH_STAT_BUMP(hash_grows);
+	else
+		DBUF_HASH_STAT_BUMP(hash_shrinks);
+
+	dbuf_hash_table_free(otable, ohsize);
 }
 
 typedef enum {
@@ -435,6 +658,25 @@ dbuf_is_metadata(dmu_buf_impl_t *db)
 	}
 }
 
+/*
+ * Returns true if the data of this dbuf is stored encrypted on disk.
+ */
+boolean_t
+dbuf_is_encrypted(dmu_buf_impl_t *db)
+{
+	boolean_t is_encrypted;
+
+	if (!db->db_objset->os_encrypted || db->db_level > 0 ||
+	    db->db_blkid == DMU_SPILL_BLKID || db->db_blkid == DMU_BONUS_BLKID)
+		return (B_FALSE);
+
+	DB_DNODE_ENTER(db);
+	is_encrypted = DMU_OT_IS_ENCRYPTED(DB_DNODE(db)->dn_type);
+	DB_DNODE_EXIT(db);
+
+	return (is_encrypted);
+}
+
 
 /*
  * This function *must* return indices evenly distributed between all
@@ -548,6 +790,13 @@ dbuf_evict_thread(void)
 		}
 		mutex_exit(&dbuf_evict_lock);
 
+		/*
+		 * The hash table is checked about once a second and resized
+		 * when its chains have become too long or too sparse.
+		 */
+		if (dbuf_hash_target_size() != 0)
+			dbuf_hash_resize();
+
 		/*
 		 * Keep evicting as long as we're above the low water mark
 		 * for the cache. We do this without holding the locks to
@@ -618,44 +867,47 @@ dbuf_evict_notify(void)
 void
 dbuf_init(void)
 {
-	uint64_t hsize = 1ULL << 16;
+	uint64_t hsize = DBUF_HASH_MIN_SIZE;
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	int i;
 
 	/*
-	 * The hash table is big enough to fill all of physical memory
-	 * with an average block size of zfs_arc_average_blocksize (default 8K).
-	 * By default, the table will take up
-	 * totalmem * sizeof(void*) / 8K (1MB per GB with 8-byte pointers).
+	 * The hash table may grow until it is big enough to fill all of
+	 * physical memory with an average block size of
+	 * zfs_arc_average_blocksize (default 8K).  At that size the table
+	 * takes up totalmem * sizeof(void*) / 8K (1MB per GB with 8-byte
+	 * pointers).
 	 */
-	while (hsize * zfs_arc_average_blocksize < physmem * PAGESIZE)
-		hsize <<= 1;
+	dbuf_hash_max_size = DBUF_HASH_MIN_SIZE;
+	while (dbuf_hash_max_size * zfs_arc_average_blocksize <
+	    physmem * PAGESIZE)
+		dbuf_hash_max_size <<= 1;
 
-retry:
 	h->hash_table_mask = hsize - 1;
-#if defined(_KERNEL) && defined(HAVE_SPL)
-	/*
-	 * Large allocations which do not require contiguous pages
-	 * should be using vmem_alloc() in the linux kernel
-	 */
-	h->hash_table = vmem_zalloc(hsize * sizeof (void *), KM_SLEEP);
-#else
-	h->hash_table = kmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
-#endif
-	if (h->hash_table == NULL) {
-		/* XXX - we should really return an error instead of assert */
-		ASSERT(hsize > (1ULL << 10));
-		hsize >>= 1;
-		goto retry;
+	h->hash_table = dbuf_hash_table_alloc(hsize, KM_SLEEP);
+	mutex_init(&h->hash_resize_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	for (i = 0; i < DBUF_HASH_LOCKS; i++) {
+		dbuf_hash_lock_t *dhl = &h->hash_locks[i];
+
+		rw_init(&dhl->dhl_lock, NULL, RW_DEFAULT, NULL);
+		dhl->dhl_table = h->hash_table;
+		dhl->dhl_mask = h->hash_table_mask;
+	}
+	DBUF_HASH_STAT(hash_buckets) = hsize;
+
+	dbuf_hash_ksp = kstat_create("zfs", 0, "dbuf_hash_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_hash_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (dbuf_hash_ksp != NULL) {
+		dbuf_hash_ksp->ks_data = &dbuf_hash_stats;
+		kstat_install(dbuf_hash_ksp);
 	}
 
 	dbuf_kmem_cache = kmem_cache_create("dmu_buf_impl_t",
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
-
 	dbuf_stats_init(h);
 
 	/*
@@ -692,20 +944,7 @@ dbuf_fini(void)
 
 	dbuf_stats_destroy();
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_destroy(&h->hash_mutexes[i]);
-#if defined(_KERNEL) && defined(HAVE_SPL)
-	/*
-	 * Large allocations which do not require contiguous pages
-	 * should be using vmem_free() in the linux kernel
-	 */
-	vmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
-#else
-	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
-#endif
-	kmem_cache_destroy(dbuf_kmem_cache);
-	taskq_destroy(dbu_evict_taskq);
-
+	/* Stop the evict thread first, it resizes the hash table. */
 	mutex_enter(&dbuf_evict_lock);
 	dbuf_evict_thread_exit = B_TRUE;
 	while (dbuf_evict_thread_exit) {
@@ -713,6 +952,19 @@ dbuf_fini(void)
 		cv_wait(&dbuf_evict_cv, &dbuf_evict_lock);
 	}
 	mutex_exit(&dbuf_evict_lock);
+
+	if (dbuf_hash_ksp != NULL) {
+		kstat_delete(dbuf_hash_ksp);
+		dbuf_hash_ksp = NULL;
+	}
+
+	for (i = 0; i < DBUF_HASH_LOCKS; i++)
+		rw_destroy(&h->hash_locks[i].dhl_lock);
+	mutex_destroy(&h->hash_resize_lock);
+	dbuf_hash_table_free(h->hash_table, h->hash_table_mask + 1);
+
+	kmem_cache_destroy(dbuf_kmem_cache);
+	taskq_destroy(dbu_evict_taskq);
 	tsd_destroy(&zfs_dbuf_evict_key);
 
 	mutex_destroy(&dbuf_evict_lock);
@@ -1002,8 +1254,13 @@ dbuf_read_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 	dbuf_rele_and_unlock(db, NULL);
 }
 
+/*
+ * Start reading an uncached dbuf.  *missed is set when the block has to
+ * come from disk, i.e. was neither in the ARC nor being read into it.
+ */
 static int
-dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
+dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
+    boolean_t *missed)
 {
 	dnode_t *dn;
 	zbookmark_phys_t zb;
@@ -1099,6 +1356,7 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	    dbuf_read_done, db, ZIO_PRIORITY_SYNC_READ,
 	    (flags & DB_RF_CANFAIL) ? ZIO_FLAG_CANFAIL : ZIO_FLAG_MUSTSUCCEED,
 	    &aflags, &zb);
+	*missed = ((aflags & ARC_FLAG_CACHED) == 0);
 
 	return (err);
 }
@@ -1168,10 +1426,23 @@ dbuf_fix_old_data(dmu_buf_impl_t *db, uint64_t txg)
 
 int
 dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
+{
+	return (dbuf_read_missed(db, zio, flags, NULL));
+}
+
+/*
+ * dbuf_read(), also telling the caller through 'missedp' whether the
+ * block had to be read from disk.  The predictive prefetcher uses this to
+ * tell the blocks it prefetched in time from those evicted before use.
+ */
+int
+dbuf_read_missed(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
+    boolean_t *missedp)
 {
 	int err = 0;
 	boolean_t havepzio = (zio != NULL);
 	boolean_t prefetch;
+	boolean_t missed = B_FALSE;
 	dnode_t *dn;
 
 	/*
@@ -1207,8 +1478,10 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 			dbuf_set_data(db, db->db_buf);
 		}
 		mutex_exit(&db->db_mtx);
-		if (prefetch)
-			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE);
+		if (prefetch) {
+			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE,
+			    B_FALSE);
+		}
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
 		DB_DNODE_EXIT(db);
@@ -1219,12 +1492,14 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		    db->db_blkptr != NULL && !BP_IS_HOLE(db->db_blkptr))
 			zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
 
-		err = dbuf_read_impl(db, zio, flags);
+		err = dbuf_read_impl(db, zio, flags, &missed);
 
 		/* dbuf_read_impl has dropped db_mtx for us */
 
-		if (!err && prefetch)
-			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE);
+		if (!err && prefetch) {
+			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE,
+			    missed);
+		}
 
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
@@ -1242,8 +1517,10 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		 * occurred and the dbuf went to UNCACHED.
 		 */
 		mutex_exit(&db->db_mtx);
-		if (prefetch)
-			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE);
+		if (prefetch) {
+			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE,
+			    B_FALSE);
+		}
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
 		DB_DNODE_EXIT(db);
@@ -1266,6 +1543,8 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	}
 
 	ASSERT(err || havepzio || db->db_state == DB_CACHED);
+	if (missedp != NULL)
+		*missedp = missed;
 	return (err);
 }
 
@@ -1304,6 +1583,9 @@ dbuf_unoverride(dbuf_dirty_record_t *dr)
 	ASSERT(dr->dt.dl.dr_override_state != DR_IN_DMU_SYNC);
 	ASSERT(db->db_level == 0);
 
+	/* the parameters of a raw block do not survive a modification */
+	dr->dt.dl.dr_has_raw_params = B_FALSE;
+
 	if (db->db_blkid == DMU_BONUS_BLKID ||
 	    dr->dt.dl.dr_override_state == DR_NOT_OVERRIDDEN)
 		return;
@@ -2093,6 +2375,32 @@ dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx)
 	dmu_buf_fill_done(&db->db, tx);
 }
 
+/*
+ * Mark the dirty data of a dbuf as an already encrypted block, to be
+ * written out as is with the given encryption parameters.  This is used
+ * by raw receives right after assigning the block's data to the dbuf.
+ */
+void
+dbuf_set_raw_params(dmu_buf_impl_t *db, const uint8_t *salt,
+    const uint8_t *iv, const uint8_t *mac, dmu_tx_t *tx)
+{
+	dbuf_dirty_record_t *dr;
+
+	ASSERT0(db->db_level);
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+
+	mutex_enter(&db->db_mtx);
+	dr = db->db_last_dirty;
+	ASSERT(dr != NULL && dr->dr_txg == tx->tx_txg);
+	ASSERT3P(dr->dt.dl.dr_data, ==, db->db_buf);
+
+	dr->dt.dl.dr_has_raw_params = B_TRUE;
+	bcopy(salt, dr->dt.dl.dr_salt, ZIO_DATA_SALT_LEN);
+	bcopy(iv, dr->dt.dl.dr_iv, ZIO_DATA_IV_LEN);
+	bcopy(mac, dr->dt.dl.dr_mac, ZIO_DATA_MAC_LEN);
+	mutex_exit(&db->db_mtx);
+}
+
 void
 dbuf_destroy(dmu_buf_impl_t *db)
 {
@@ -2432,7 +2740,7 @@ dbuf_prefetch_indirect_done(zio_t *zio, arc_buf_t *abuf, void *private)
 	 */
 	if (zio != NULL) {
 		ASSERT3S(BP_GET_LEVEL(zio->io_bp), ==, dpa->dpa_curlevel);
-		if (zio->io_flags & ZIO_FLAG_RAW) {
+		if (zio->io_flags & ZIO_FLAG_RAW_COMPRESS) {
 			ASSERT3U(BP_GET_PSIZE(zio->io_bp), ==, zio->io_size);
 		} else {
 			ASSERT3U(BP_GET_LSIZE(zio->io_bp), ==, zio->io_size);
@@ -3446,7 +3754,7 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 	DB_DNODE_EXIT(db);
 
 	if (!BP_IS_EMBEDDED(bp))
-		bp->blk_fill = fill;
+		BP_SET_FILL(bp, fill);
 
 	mutex_exit(&db->db_mtx);
 
@@ -3673,6 +3981,7 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 	zio_prop_t zp;
 	zio_t *zio;
 	int wp_flag = 0;
+	int zio_flags = ZIO_FLAG_MUSTSUCCEED;
 
 	ASSERT(dmu_tx_is_syncing(tx));
 
@@ -3736,6 +4045,20 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 	    arc_get_compression(data) : ZIO_COMPRESS_INHERIT, &zp);
 	DB_DNODE_EXIT(db);
 
+	/*
+	 * Raw blocks are written exactly as they were received, so their
+	 * compression must not be changed either.
+	 */
+	if (db->db_level == 0 && dr->dt.dl.dr_has_raw_params) {
+		ASSERT(zp.zp_encrypt);
+		ASSERT3P(data, !=, NULL);
+		zp.zp_compress = arc_get_compression(data);
+		bcopy(dr->dt.dl.dr_salt, zp.zp_salt, ZIO_DATA_SALT_LEN);
+		bcopy(dr->dt.dl.dr_iv, zp.zp_iv, ZIO_DATA_IV_LEN);
+		bcopy(dr->dt.dl.dr_mac, zp.zp_mac, ZIO_DATA_MAC_LEN);
+		zio_flags |= ZIO_FLAG_RAW_ENCRYPT;
+	}
+
 	/*
 	 * We copy the blkptr now (rather than when we instantiate the dirty
 	 * record), because its value can change between open context and
@@ -3789,7 +4112,7 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 		    &zp, dbuf_write_ready,
 		    children_ready_cb, dbuf_write_physdone,
 		    dbuf_write_done, db, ZIO_PRIORITY_ASYNC_WRITE,
-		    ZIO_FLAG_MUSTSUCCEED, &zb);
+		    zio_flags, &zb);
 	}
 }
 
@@ -3846,5 +4169,13 @@ MODULE_PARM_DESC(dbuf_cache_lowater_pct,
 module_param(dbuf_cache_max_shift, int, 0644);
 MODULE_PARM_DESC(dbuf_cache_max_shift,
 	"Cap the size of the dbuf cache to a log2 fraction of arc size.");
+
+module_param(dbuf_hash_grow_ratio, int, 0644);
+MODULE_PARM_DESC(dbuf_hash_grow_ratio,
+	"Grow the dbuf hash table when its average chain exceeds this length.");
+
+module_param(dbuf_hash_shrink_ratio, int, 0644);
+MODULE_PARM_DESC(dbuf_hash_shrink_ratio,
+	"Shrink the dbuf hash table when it has this many buckets per dbuf.");
 /* END CSTYLED */
 #endif
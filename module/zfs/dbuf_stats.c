@@ -129,15 +129,25 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 {
 	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
 	dbuf_hash_table_t *h = dsh->hash;
+	dbuf_hash_lock_t *dhl = DBUF_HASH_LOCK(h, dsh->idx);
 	dmu_buf_impl_t *db;
 	int length, error = 0;
 
 	ASSERT3S(dsh->idx, >=, 0);
-	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
 	memset(buf, 0, size);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
-	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
+	/*
+	 * The table may be resized between calls, in which case buckets
+	 * beyond the end of the current table are simply skipped.
+	 */
+	rw_enter(&dhl->dhl_lock, RW_READER);
+	if (dsh->idx > dhl->dhl_mask) {
+		rw_exit(&dhl->dhl_lock);
+		return (0);
+	}
+
+	for (db = dhl->dhl_table[dsh->idx]; db != NULL;
+	    db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
 		 * to be called with a larger scratch buffers.
@@ -157,7 +167,7 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 
 		mutex_exit(&db->db_mtx);
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+	rw_exit(&dhl->dhl_lock);
 
 	return (error);
 }
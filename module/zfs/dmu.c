@@ -68,60 +68,60 @@ int zfs_nopwrite_enabled = 1;
 unsigned long zfs_per_txg_dirty_frees_percent = 30;
 
 const dmu_object_type_info_t dmu_ot[DMU_OT_NUMTYPES] = {
-	{	DMU_BSWAP_UINT8,	TRUE,	"unallocated"		},
-	{	DMU_BSWAP_ZAP,		TRUE,	"object directory"	},
-	{	DMU_BSWAP_UINT64,	TRUE,	"object array"		},
-	{	DMU_BSWAP_UINT8,	TRUE,	"packed nvlist"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"packed nvlist size"	},
-	{	DMU_BSWAP_UINT64,	TRUE,	"bpobj"			},
-	{	DMU_BSWAP_UINT64,	TRUE,	"bpobj header"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"SPA space map header"	},
-	{	DMU_BSWAP_UINT64,	TRUE,	"SPA space map"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"ZIL intent log"	},
-	{	DMU_BSWAP_DNODE,	TRUE,	"DMU dnode"		},
-	{	DMU_BSWAP_OBJSET,	TRUE,	"DMU objset"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"DSL directory"		},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL directory child map"},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL dataset snap map"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL props"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"DSL dataset"		},
-	{	DMU_BSWAP_ZNODE,	TRUE,	"ZFS znode"		},
-	{	DMU_BSWAP_OLDACL,	TRUE,	"ZFS V0 ACL"		},
-	{	DMU_BSWAP_UINT8,	FALSE,	"ZFS plain file"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"ZFS directory"		},
-	{	DMU_BSWAP_ZAP,		TRUE,	"ZFS master node"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"ZFS delete queue"	},
-	{	DMU_BSWAP_UINT8,	FALSE,	"zvol object"		},
-	{	DMU_BSWAP_ZAP,		TRUE,	"zvol prop"		},
-	{	DMU_BSWAP_UINT8,	FALSE,	"other uint8[]"		},
-	{	DMU_BSWAP_UINT64,	FALSE,	"other uint64[]"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"other ZAP"		},
-	{	DMU_BSWAP_ZAP,		TRUE,	"persistent error log"	},
-	{	DMU_BSWAP_UINT8,	TRUE,	"SPA history"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"SPA history offsets"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"Pool properties"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL permissions"	},
-	{	DMU_BSWAP_ACL,		TRUE,	"ZFS ACL"		},
-	{	DMU_BSWAP_UINT8,	TRUE,	"ZFS SYSACL"		},
-	{	DMU_BSWAP_UINT8,	TRUE,	"FUID table"		},
-	{	DMU_BSWAP_UINT64,	TRUE,	"FUID table size"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL dataset next clones"},
-	{	DMU_BSWAP_ZAP,		TRUE,	"scan work queue"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"ZFS user/group used"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"ZFS user/group quota"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"snapshot refcount tags"},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DDT ZAP algorithm"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DDT statistics"	},
-	{	DMU_BSWAP_UINT8,	TRUE,	"System attributes"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"SA master node"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"SA attr registration"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"SA attr layouts"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"scan translations"	},
-	{	DMU_BSWAP_UINT8,	FALSE,	"deduplicated block"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL deadlist map"	},
-	{	DMU_BSWAP_UINT64,	TRUE,	"DSL deadlist map hdr"	},
-	{	DMU_BSWAP_ZAP,		TRUE,	"DSL dir clones"	},
-	{	DMU_BSWAP_UINT64,	TRUE,	"bpobj subobj"		}
+	{ DMU_BSWAP_UINT8,  TRUE,  FALSE, "unallocated"			},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "object directory"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "object array"		},
+	{ DMU_BSWAP_UINT8,  TRUE,  FALSE, "packed nvlist"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "packed nvlist size"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "bpobj"			},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "bpobj header"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "SPA space map header"	},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "SPA space map"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "ZIL intent log"		},
+	{ DMU_BSWAP_DNODE,  TRUE,  FALSE, "DMU dnode"			},
+	{ DMU_BSWAP_OBJSET, TRUE,  FALSE, "DMU objset"			},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "DSL directory"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL directory child map"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL dataset snap map"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL props"			},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "DSL dataset"			},
+	{ DMU_BSWAP_ZNODE,  TRUE,  FALSE, "ZFS znode"			},
+	{ DMU_BSWAP_OLDACL, TRUE,  FALSE, "ZFS V0 ACL"			},
+	{ DMU_BSWAP_UINT8,  FALSE, TRUE,  "ZFS plain file"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  TRUE,  "ZFS directory"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "ZFS master node"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "ZFS delete queue"		},
+	{ DMU_BSWAP_UINT8,  FALSE, TRUE,  "zvol object"			},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "zvol prop"			},
+	{ DMU_BSWAP_UINT8,  FALSE, TRUE,  "other uint8[]"		},
+	{ DMU_BSWAP_UINT64, FALSE, TRUE,  "other uint64[]"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  TRUE,  "other ZAP"			},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "persistent error log"	},
+	{ DMU_BSWAP_UINT8,  TRUE,  FALSE, "SPA history"			},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "SPA history offsets"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "Pool properties"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL permissions"		},
+	{ DMU_BSWAP_ACL,    TRUE,  FALSE, "ZFS ACL"			},
+	{ DMU_BSWAP_UINT8,  TRUE,  FALSE, "ZFS SYSACL"			},
+	{ DMU_BSWAP_UINT8,  TRUE,  FALSE, "FUID table"			},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "FUID table size"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL dataset next clones"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "scan work queue"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "ZFS user/group used"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "ZFS user/group quota"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "snapshot refcount tags"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DDT ZAP algorithm"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DDT statistics"		},
+	{ DMU_BSWAP_UINT8,  TRUE,  FALSE, "System attributes"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "SA master node"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "SA attr registration"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "SA attr layouts"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "scan translations"		},
+	{ DMU_BSWAP_UINT8,  FALSE, FALSE, "deduplicated block"		},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL deadlist map"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "DSL deadlist map hdr"	},
+	{ DMU_BSWAP_ZAP,    TRUE,  FALSE, "DSL dir clones"		},
+	{ DMU_BSWAP_UINT64, TRUE,  FALSE, "bpobj subobj"		},
 };
 
 const dmu_object_byteswap_info_t dmu_ot_byteswap[DMU_BSWAP_NUMFUNCS] = {
@@ -450,6 +450,7 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 	dmu_buf_t **dbp;
 	uint64_t blkid, nblks, i;
 	uint32_t dbuf_flags;
+	boolean_t missed = B_FALSE;
 	int err;
 	zio_t *zio;
 
@@ -495,15 +496,20 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 		}
 
 		/* initiate async i/o */
-		if (read)
-			(void) dbuf_read(db, zio, dbuf_flags);
+		if (read) {
+			boolean_t db_missed;
+
+			if (dbuf_read_missed(db, zio, dbuf_flags,
+			    &db_missed) == 0 && db_missed)
+				missed = B_TRUE;
+		}
 		dbp[i] = &db->db;
 	}
 
 	if ((flags & DMU_READ_NO_PREFETCH) == 0 &&
 	    DNODE_META_IS_CACHEABLE(dn) && length <= zfetch_array_rd_sz) {
 		dmu_zfetch(&dn->dn_zfetch, blkid, nblks,
-		    read && DNODE_IS_CACHEABLE(dn));
+		    read && DNODE_IS_CACHEABLE(dn), missed);
 	}
 	rw_exit(&dn->dn_struct_rwlock);
 
@@ -1508,6 +1514,41 @@ dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
 	}
 }
 
+/*
+ * Assign an already encrypted block to the dbuf at the given offset, to
+ * be written out unchanged with the given encryption parameters.  Since
+ * ciphertext cannot be partially copied, the buf must cover the block.
+ */
+int
+dmu_assign_arcbuf_raw(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
+    const uint8_t *salt, const uint8_t *iv, const uint8_t *mac, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *dbuf = (dmu_buf_impl_t *)handle;
+	dnode_t *dn;
+	dmu_buf_impl_t *db;
+	uint64_t blkid;
+
+	DB_DNODE_ENTER(dbuf);
+	dn = DB_DNODE(dbuf);
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	blkid = dbuf_whichblock(dn, 0, offset);
+	VERIFY((db = dbuf_hold(dn, blkid, FTAG)) != NULL);
+	rw_exit(&dn->dn_struct_rwlock);
+	DB_DNODE_EXIT(dbuf);
+
+	if (offset != db->db.db_offset ||
+	    arc_buf_lsize(buf) != db->db.db_size ||
+	    dbuf_is_metadata(db) != arc_is_metadata(buf)) {
+		dbuf_rele(db, FTAG);
+		return (SET_ERROR(EINVAL));
+	}
+
+	dbuf_assign_arcbuf(db, buf, tx);
+	dbuf_set_raw_params(db, salt, iv, mac, tx);
+	dbuf_rele(db, FTAG);
+	return (0);
+}
+
 typedef struct {
 	dbuf_dirty_record_t	*dsa_dr;
 	dmu_sync_cb_t		*dsa_done;
@@ -1532,7 +1573,7 @@ dmu_sync_ready(zio_t *zio, arc_buf_t *buf, void *varg)
 			BP_SET_LSIZE(bp, db->db_size);
 		} else if (!BP_IS_EMBEDDED(bp)) {
 			ASSERT(BP_GET_LEVEL(bp) == 0);
-			bp->blk_fill = 1;
+			BP_SET_FILL(bp, 1);
 		}
 	}
 }
@@ -1879,10 +1920,12 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp,
 	    (wp & WP_SPILL));
 	enum zio_checksum checksum = os->os_checksum;
 	enum zio_compress compress = os->os_compress;
+	uint64_t complevel = os->os_complevel;
 	enum zio_checksum dedup_checksum = os->os_dedup_checksum;
 	boolean_t dedup = B_FALSE;
 	boolean_t nopwrite = B_FALSE;
 	boolean_t dedup_verify = os->os_dedup_verify;
+	boolean_t encrypt = B_FALSE;
 	int copies = os->os_copies;
 
 	/*
@@ -1970,6 +2013,19 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp,
 		    compress != ZIO_COMPRESS_OFF && zfs_nopwrite_enabled);
 	}
 
+	/*
+	 * Only level 0 blocks of the object types that hold user data are
+	 * encrypted.  Since every encrypted block has a random IV, two
+	 * copies of the same data never have the same checksum, so dedup
+	 * and nopwrite can never apply to them.
+	 */
+	if (os->os_encrypted && level == 0 && !(wp & (WP_NOFILL | WP_SPILL)) &&
+	    DMU_OT_IS_ENCRYPTED(type)) {
+		encrypt = B_TRUE;
+		dedup = B_FALSE;
+		nopwrite = B_FALSE;
+	}
+
 	zp->zp_checksum = checksum;
 
 	/*
@@ -1980,13 +2036,21 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp,
 	zp->zp_compress = override_compress != ZIO_COMPRESS_INHERIT
 	    ? override_compress : compress;
 	ASSERT3U(zp->zp_compress, !=, ZIO_COMPRESS_INHERIT);
+	zp->zp_complevel = (zp->zp_compress == os->os_compress) ?
+	    complevel : 0;
 
 	zp->zp_type = (wp & WP_SPILL) ? dn->dn_bonustype : type;
 	zp->zp_level = level;
 	zp->zp_copies = MIN(copies, spa_max_replication(os->os_spa));
+	zp->zp_zpl_smallblk = (zp->zp_type == DMU_OT_PLAIN_FILE_CONTENTS ||
+	    zp->zp_type == DMU_OT_ZVOL) ? os->os_zpl_special_smallblock : 0;
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
 	zp->zp_nopwrite = nopwrite;
+	zp->zp_encrypt = encrypt;
+	bzero(zp->zp_salt, ZIO_DATA_SALT_LEN);
+	bzero(zp->zp_iv, ZIO_DATA_IV_LEN);
+	bzero(zp->zp_mac, ZIO_DATA_MAC_LEN);
 }
 
 int
@@ -2225,6 +2289,7 @@ EXPORT_SYMBOL(dmu_sync);
 EXPORT_SYMBOL(dmu_request_arcbuf);
 EXPORT_SYMBOL(dmu_return_arcbuf);
 EXPORT_SYMBOL(dmu_assign_arcbuf);
+EXPORT_SYMBOL(dmu_assign_arcbuf_raw);
 EXPORT_SYMBOL(dmu_buf_hold);
 EXPORT_SYMBOL(dmu_ot);
 
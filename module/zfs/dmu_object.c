@@ -40,6 +40,116 @@ dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
 	    0, tx);
 }
 
+/*
+ * Each CPU allocates new objects from its own chunk of
+ * 2^dmu_object_alloc_chunk_shift object numbers, so concurrent creates in
+ * the same objset only contend on os_obj_lock once per chunk.  The default
+ * of 128 objects is four dnode blocks' worth, which keeps CPUs off each
+ * other's dnode blocks.  The chunk is clamped to at least one dnode block
+ * and at most one L1 block's worth of dnodes, so that the "move on to a
+ * sparse L1 block" logic in dmu_object_alloc_refill() keeps working.
+ */
+int dmu_object_alloc_chunk_shift = 7;
+
+/*
+ * Return B_TRUE if the chunk containing "object" is currently owned by a
+ * CPU other than "self".  Called with os_obj_lock held, which prevents any
+ * CPU from taking a new chunk, so a chunk can only be released while we
+ * look at the unlocked doa_next and doa_end fields.
+ */
+static boolean_t
+dmu_object_chunk_busy(objset_t *os, dmu_obj_alloc_t *self, uint64_t object,
+    uint64_t chunk)
+{
+	int i;
+
+	ASSERT(MUTEX_HELD(&os->os_obj_lock));
+
+	for (i = 0; i < os->os_obj_alloc_count; i++) {
+		dmu_obj_alloc_t *doa = &os->os_obj_alloc[i];
+
+		if (doa == self || doa->doa_next >= doa->doa_end)
+			continue;
+		if (P2ALIGN(doa->doa_end - 1, chunk) == P2ALIGN(object, chunk))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Hand this CPU a new chunk of object numbers, starting at os_obj_next or
+ * at "hint" if that is further along.
+ */
+static void
+dmu_object_alloc_refill(objset_t *os, dmu_obj_alloc_t *doa, uint64_t hint,
+    uint64_t chunk, uint64_t L1_dnode_count, boolean_t *restarted)
+{
+	uint64_t object;
+
+	mutex_enter(&os->os_obj_lock);
+	if (hint > os->os_obj_next)
+		os->os_obj_next = hint;
+	object = os->os_obj_next;
+
+	/*
+	 * Each time we polish off a L1 bp worth of dnodes (2^12
+	 * objects), move to another L1 bp that's still
+	 * reasonably sparse (at most 1/4 full). Look from the
+	 * beginning at most once per txg. If we still can't
+	 * allocate from that L1 block, search for an empty L0
+	 * block, which will quickly skip to the end of the
+	 * metadnode if the no nearby L0 blocks are empty. This
+	 * fallback avoids a pathology where full dnode blocks
+	 * containing large dnodes appear sparse because they
+	 * have a low blk_fill, leading to many failed
+	 * allocation attempts. In the long term a better
+	 * mechanism to search for sparse metadnode regions,
+	 * such as spacemaps, could be implemented.
+	 *
+	 * os_scan_dnodes is set during txg sync if enough objects
+	 * have been freed since the previous rescan to justify
+	 * backfilling again.
+	 *
+	 * Note that dmu_traverse depends on the behavior that we use
+	 * multiple blocks of the dnode object before going back to
+	 * reuse objects.  Any change to this algorithm should preserve
+	 * that property or find another solution to the issues
+	 * described in traverse_visitbp.
+	 */
+	if (P2PHASE(object, L1_dnode_count) == 0) {
+		uint64_t offset;
+		uint64_t blkfill;
+		int minlvl;
+		int error;
+		if (os->os_rescan_dnodes) {
+			offset = 0;
+			os->os_rescan_dnodes = B_FALSE;
+		} else {
+			offset = object << DNODE_SHIFT;
+		}
+		blkfill = *restarted ? 1 : DNODES_PER_BLOCK >> 2;
+		minlvl = *restarted ? 1 : 2;
+		*restarted = B_TRUE;
+		error = dnode_next_offset(DMU_META_DNODE(os),
+		    DNODE_FIND_HOLE, &offset, minlvl, blkfill, 0);
+		if (error == 0)
+			object = offset >> DNODE_SHIFT;
+	}
+
+	/*
+	 * The search may have led us back into a chunk another CPU is
+	 * still allocating from; never share a chunk.
+	 */
+	while (dmu_object_chunk_busy(os, doa, object, chunk))
+		object = P2ALIGN(object, chunk) + chunk;
+
+	doa->doa_next = object;
+	doa->doa_end = P2ALIGN(object, chunk) + chunk;
+	os->os_obj_next = doa->doa_end;
+	mutex_exit(&os->os_obj_lock);
+}
+
 uint64_t
 dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot, int blocksize,
     dmu_object_type_t bonustype, int bonuslen, int dnodesize, dmu_tx_t *tx)
@@ -47,6 +157,9 @@ dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot, int blocksize,
 	uint64_t object;
 	uint64_t L1_dnode_count = DNODES_PER_BLOCK <<
 	    (DMU_META_DNODE(os)->dn_indblkshift - SPA_BLKPTRSHIFT);
+	uint64_t chunk = 1ULL << dmu_object_alloc_chunk_shift;
+	uint64_t hint = 0;
+	dmu_obj_alloc_t *doa;
 	dnode_t *dn = NULL;
 	int dn_slots = dnodesize >> DNODE_SHIFT;
 	boolean_t restarted = B_FALSE;
@@ -58,54 +171,21 @@ dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot, int blocksize,
 		ASSERT3S(dn_slots, <=, DNODE_MAX_SLOTS);
 	}
 
-	mutex_enter(&os->os_obj_lock);
+	chunk = MAX(chunk, DNODES_PER_BLOCK);
+	chunk = MIN(chunk, L1_dnode_count);
+
+	kpreempt_disable();
+	doa = &os->os_obj_alloc[CPU_SEQID % os->os_obj_alloc_count];
+	kpreempt_enable();
+
+	mutex_enter(&doa->doa_lock);
 	for (;;) {
-		object = os->os_obj_next;
-		/*
-		 * Each time we polish off a L1 bp worth of dnodes (2^12
-		 * objects), move to another L1 bp that's still
-		 * reasonably sparse (at most 1/4 full). Look from the
-		 * beginning at most once per txg. If we still can't
-		 * allocate from that L1 block, search for an empty L0
-		 * block, which will quickly skip to the end of the
-		 * metadnode if the no nearby L0 blocks are empty. This
-		 * fallback avoids a pathology where full dnode blocks
-		 * containing large dnodes appear sparse because they
-		 * have a low blk_fill, leading to many failed
-		 * allocation attempts. In the long term a better
-		 * mechanism to search for sparse metadnode regions,
-		 * such as spacemaps, could be implemented.
-		 *
-		 * os_scan_dnodes is set during txg sync if enough objects
-		 * have been freed since the previous rescan to justify
-		 * backfilling again.
-		 *
-		 * Note that dmu_traverse depends on the behavior that we use
-		 * multiple blocks of the dnode object before going back to
-		 * reuse objects.  Any change to this algorithm should preserve
-		 * that property or find another solution to the issues
-		 * described in traverse_visitbp.
-		 */
-		if (P2PHASE(object, L1_dnode_count) == 0) {
-			uint64_t offset;
-			uint64_t blkfill;
-			int minlvl;
-			int error;
-			if (os->os_rescan_dnodes) {
-				offset = 0;
-				os->os_rescan_dnodes = B_FALSE;
-			} else {
-				offset = object << DNODE_SHIFT;
-			}
-			blkfill = restarted ? 1 : DNODES_PER_BLOCK >> 2;
-			minlvl = restarted ? 1 : 2;
-			restarted = B_TRUE;
-			error = dnode_next_offset(DMU_META_DNODE(os),
-			    DNODE_FIND_HOLE, &offset, minlvl, blkfill, 0);
-			if (error == 0)
-				object = offset >> DNODE_SHIFT;
+		if (doa->doa_next + dn_slots > doa->doa_end) {
+			dmu_object_alloc_refill(os, doa, hint, chunk,
+			    L1_dnode_count, &restarted);
+			hint = 0;
 		}
-		os->os_obj_next = object + dn_slots;
+		object = doa->doa_next;
 
 		/*
 		 * XXX We should check for an i/o error here and return
@@ -118,18 +198,33 @@ dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot, int blocksize,
 		if (dn)
 			break;
 
-		if (dmu_object_next(os, &object, B_TRUE, 0) == 0)
-			os->os_obj_next = object;
-		else
+		if (dmu_object_next(os, &object, B_TRUE, 0) != 0)
 			/*
 			 * Skip to next known valid starting point for a dnode.
 			 */
-			os->os_obj_next = P2ROUNDUP(object + 1,
-			    DNODES_PER_BLOCK);
+			object = P2ROUNDUP(object + 1, DNODES_PER_BLOCK);
+
+		/*
+		 * Stay within our chunk; a starting point beyond it is
+		 * passed on to the global allocator as a hint.
+		 */
+		if (object < doa->doa_end) {
+			doa->doa_next = object;
+		} else {
+			hint = object;
+			doa->doa_next = doa->doa_end;
+		}
 	}
 
+	/*
+	 * A dnode never spans dnode blocks and chunks are made of whole
+	 * dnode blocks, so the allocated slots are all within our chunk.
+	 */
+	ASSERT3U(object + dn_slots, <=, doa->doa_end);
+	doa->doa_next = object + dn_slots;
+
 	dnode_allocate(dn, ot, blocksize, 0, bonustype, bonuslen, dn_slots, tx);
-	mutex_exit(&os->os_obj_lock);
+	mutex_exit(&doa->doa_lock);
 
 	dmu_tx_add_new_object(tx, dn);
 	dnode_rele(dn, FTAG);
@@ -341,4 +436,10 @@ EXPORT_SYMBOL(dmu_object_free);
 EXPORT_SYMBOL(dmu_object_next);
 EXPORT_SYMBOL(dmu_object_zapify);
 EXPORT_SYMBOL(dmu_object_free_zapified);
+
+/* BEGIN CSTYLED */
+module_param(dmu_object_alloc_chunk_shift, int, 0444);
+MODULE_PARM_DESC(dmu_object_alloc_chunk_shift,
+	"CPU-specific allocator grabs 2^N objects at once");
+/* END CSTYLED */
 #endif
@@ -56,6 +56,7 @@
 #include <sys/vdev.h>
 #include <sys/policy.h>
 #include <sys/spa_impl.h>
+#include <sys/dsl_crypt.h>
 
 /*
  * Needed to close a window in dnode_move() that allows the objset to be freed
@@ -183,10 +184,11 @@ compression_changed_cb(void *arg, uint64_t newval)
 	/*
 	 * Inheritance and range checking should have been done by now.
 	 */
-	ASSERT(newval != ZIO_COMPRESS_INHERIT);
+	ASSERT(ZIO_COMPRESS_ALGO(newval) != ZIO_COMPRESS_INHERIT);
 
-	os->os_compress = zio_compress_select(os->os_spa, newval,
-	    ZIO_COMPRESS_ON);
+	os->os_compress = zio_compress_select(os->os_spa,
+	    ZIO_COMPRESS_ALGO(newval), ZIO_COMPRESS_ON);
+	os->os_complevel = ZIO_COMPRESS_LEVEL(newval);
 }
 
 static void
@@ -327,6 +329,20 @@ recordsize_changed_cb(void *arg, uint64_t newval)
 	os->os_recordsize = newval;
 }
 
+static void
+smallblk_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval <= SPA_OLD_MAXBLOCKSIZE);
+	ASSERT(ISP2(newval));
+
+	os->os_zpl_special_smallblock = newval;
+}
+
 void
 dmu_objset_byteswap(void *buf, size_t size)
 {
@@ -356,6 +372,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	os->os_dsl_dataset = ds;
 	os->os_spa = spa;
 	os->os_rootbp = bp;
+	os->os_encrypted = (ds != NULL && ds->ds_dir->dd_crypto_obj != 0);
 	if (!BP_IS_HOLE(os->os_rootbp)) {
 		arc_flags_t aflags = ARC_FLAG_WAIT;
 		zbookmark_phys_t zb;
@@ -473,6 +490,12 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    zfs_prop_to_name(ZFS_PROP_DNODESIZE),
 				    dnodesize_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(
+				    ZFS_PROP_SPECIAL_SMALL_BLOCKS),
+				    smallblk_changed_cb, os);
+			}
 		}
 		if (needlock)
 			dsl_pool_config_exit(dmu_objset_pool(os), FTAG);
@@ -514,6 +537,13 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 
 	mutex_init(&os->os_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
+	os->os_obj_alloc_count = boot_ncpus;
+	os->os_obj_alloc = kmem_zalloc(os->os_obj_alloc_count *
+	    sizeof (dmu_obj_alloc_t), KM_SLEEP);
+	for (i = 0; i < os->os_obj_alloc_count; i++) {
+		mutex_init(&os->os_obj_alloc[i].doa_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
 	mutex_init(&os->os_user_ptr_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	dnode_special_open(os, &os->os_phys->os_meta_dnode,
@@ -594,7 +624,7 @@ dmu_objset_hold(const char *name, void *tag, objset_t **osp)
 
 static int
 dmu_objset_own_impl(dsl_dataset_t *ds, dmu_objset_type_t type,
-    boolean_t readonly, void *tag, objset_t **osp)
+    boolean_t readonly, boolean_t decrypt, void *tag, objset_t **osp)
 {
 	int err;
 
@@ -607,6 +637,15 @@ dmu_objset_own_impl(dsl_dataset_t *ds, dmu_objset_type_t type,
 	} else if (!readonly && dsl_dataset_is_snapshot(ds)) {
 		dsl_dataset_disown(ds, tag);
 		return (SET_ERROR(EROFS));
+	} else if (decrypt && ds->ds_dir->dd_crypto_obj != 0) {
+		/*
+		 * Owners that access user data need the dataset's key, which
+		 * the zio pipeline finds through a key mapping.
+		 */
+		err = spa_keystore_create_mapping(dsl_dataset_get_spa(ds),
+		    ds, tag);
+		if (err != 0)
+			dsl_dataset_disown(ds, tag);
 	}
 	return (err);
 }
@@ -618,7 +657,7 @@ dmu_objset_own_impl(dsl_dataset_t *ds, dmu_objset_type_t type,
  */
 int
 dmu_objset_own(const char *name, dmu_objset_type_t type,
-    boolean_t readonly, void *tag, objset_t **osp)
+    boolean_t readonly, boolean_t decrypt, void *tag, objset_t **osp)
 {
 	dsl_pool_t *dp;
 	dsl_dataset_t *ds;
@@ -632,7 +671,7 @@ dmu_objset_own(const char *name, dmu_objset_type_t type,
 		dsl_pool_rele(dp, FTAG);
 		return (err);
 	}
-	err = dmu_objset_own_impl(ds, type, readonly, tag, osp);
+	err = dmu_objset_own_impl(ds, type, readonly, decrypt, tag, osp);
 	dsl_pool_rele(dp, FTAG);
 
 	if (err == 0 && dmu_objset_userobjspace_upgradable(*osp))
@@ -643,7 +682,7 @@ dmu_objset_own(const char *name, dmu_objset_type_t type,
 
 int
 dmu_objset_own_obj(dsl_pool_t *dp, uint64_t obj, dmu_objset_type_t type,
-    boolean_t readonly, void *tag, objset_t **osp)
+    boolean_t readonly, boolean_t decrypt, void *tag, objset_t **osp)
 {
 	dsl_dataset_t *ds;
 	int err;
@@ -652,7 +691,7 @@ dmu_objset_own_obj(dsl_pool_t *dp, uint64_t obj, dmu_objset_type_t type,
 	if (err != 0)
 		return (err);
 
-	return (dmu_objset_own_impl(ds, type, readonly, tag, osp));
+	return (dmu_objset_own_impl(ds, type, readonly, decrypt, tag, osp));
 }
 
 void
@@ -689,20 +728,28 @@ dmu_objset_refresh_ownership(objset_t *os, void *tag)
 	dsl_dataset_name(ds, name);
 	dp = dmu_objset_pool(os);
 	dsl_pool_config_enter(dp, FTAG);
-	dmu_objset_disown(os, tag);
+	/* the key mapping (if any) stays with the new ownership */
+	dmu_objset_disown(os, B_FALSE, tag);
 	VERIFY0(dsl_dataset_own(dp, name, tag, &newds));
 	VERIFY3P(newds, ==, os->os_dsl_dataset);
 	dsl_pool_config_exit(dp, FTAG);
 }
 
 void
-dmu_objset_disown(objset_t *os, void *tag)
+dmu_objset_disown(objset_t *os, boolean_t decrypt, void *tag)
 {
+	dsl_dataset_t *ds = os->os_dsl_dataset;
+
 	/*
 	 * Stop upgrading thread
 	 */
 	dmu_objset_upgrade_stop(os);
-	dsl_dataset_disown(os->os_dsl_dataset, tag);
+
+	if (decrypt && ds->ds_dir->dd_crypto_obj != 0) {
+		spa_keystore_remove_mapping(dsl_dataset_get_spa(ds),
+		    ds->ds_object, tag);
+	}
+	dsl_dataset_disown(ds, tag);
 }
 
 void
@@ -790,6 +837,8 @@ dmu_objset_evict(objset_t *os)
 void
 dmu_objset_evict_done(objset_t *os)
 {
+	int i;
+
 	ASSERT3P(list_head(&os->os_dnodes), ==, NULL);
 
 	dnode_special_close(&os->os_meta_dnode);
@@ -812,6 +861,10 @@ dmu_objset_evict_done(objset_t *os)
 
 	mutex_destroy(&os->os_lock);
 	mutex_destroy(&os->os_obj_lock);
+	for (i = 0; i < os->os_obj_alloc_count; i++)
+		mutex_destroy(&os->os_obj_alloc[i].doa_lock);
+	kmem_free(os->os_obj_alloc, os->os_obj_alloc_count *
+	    sizeof (dmu_obj_alloc_t));
 	mutex_destroy(&os->os_user_ptr_lock);
 	spa_evicting_os_deregister(os->os_spa, os);
 	kmem_free(os, sizeof (objset_t));
@@ -904,6 +957,7 @@ typedef struct dmu_objset_create_arg {
 	void *doca_userarg;
 	dmu_objset_type_t doca_type;
 	uint64_t doca_flags;
+	dsl_crypto_params_t *doca_dcp;
 } dmu_objset_create_arg_t;
 
 /*ARGSUSED*/
@@ -931,6 +985,12 @@ dmu_objset_create_check(void *arg, dmu_tx_t *tx)
 	}
 	error = dsl_fs_ss_limit_check(pdd, 1, ZFS_PROP_FILESYSTEM_LIMIT, NULL,
 	    doca->doca_cred);
+	if (error != 0) {
+		dsl_dir_rele(pdd, FTAG);
+		return (error);
+	}
+
+	error = dmu_objset_create_crypt_check(pdd, NULL, doca->doca_dcp);
 	dsl_dir_rele(pdd, FTAG);
 
 	return (error);
@@ -951,7 +1011,7 @@ dmu_objset_create_sync(void *arg, dmu_tx_t *tx)
 	VERIFY0(dsl_dir_hold(dp, doca->doca_name, FTAG, &pdd, &tail));
 
 	obj = dsl_dataset_create_sync(pdd, tail, NULL, doca->doca_flags,
-	    doca->doca_cred, tx);
+	    doca->doca_cred, doca->doca_dcp, tx);
 
 	VERIFY0(dsl_dataset_hold_obj(pdd->dd_pool, obj, FTAG, &ds));
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
@@ -974,7 +1034,8 @@ dmu_objset_create_sync(void *arg, dmu_tx_t *tx)
 
 int
 dmu_objset_create(const char *name, dmu_objset_type_t type, uint64_t flags,
-    void (*func)(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx), void *arg)
+    dsl_crypto_params_t *dcp, void (*func)(objset_t *os, void *arg,
+    cred_t *cr, dmu_tx_t *tx), void *arg)
 {
 	dmu_objset_create_arg_t doca;
 
@@ -984,6 +1045,7 @@ dmu_objset_create(const char *name, dmu_objset_type_t type, uint64_t flags,
 	doca.doca_userfunc = func;
 	doca.doca_userarg = arg;
 	doca.doca_type = type;
+	doca.doca_dcp = dcp;
 
 	return (dsl_sync_task(name,
 	    dmu_objset_create_check, dmu_objset_create_sync, &doca,
@@ -1027,20 +1089,25 @@ dmu_objset_clone_check(void *arg, dmu_tx_t *tx)
 		dsl_dir_rele(pdd, FTAG);
 		return (SET_ERROR(EDQUOT));
 	}
-	dsl_dir_rele(pdd, FTAG);
 
 	error = dsl_dataset_hold(dp, doca->doca_origin, FTAG, &origin);
-	if (error != 0)
+	if (error != 0) {
+		dsl_dir_rele(pdd, FTAG);
 		return (error);
+	}
 
 	/* You can only clone snapshots, not the head datasets. */
 	if (!origin->ds_is_snapshot) {
 		dsl_dataset_rele(origin, FTAG);
+		dsl_dir_rele(pdd, FTAG);
 		return (SET_ERROR(EINVAL));
 	}
+
+	error = dmu_objset_create_crypt_check(pdd, origin, NULL);
+	dsl_dir_rele(pdd, FTAG);
 	dsl_dataset_rele(origin, FTAG);
 
-	return (0);
+	return (error);
 }
 
 static void
@@ -1058,7 +1125,7 @@ dmu_objset_clone_sync(void *arg, dmu_tx_t *tx)
 	VERIFY0(dsl_dataset_hold(dp, doca->doca_origin, FTAG, &origin));
 
 	obj = dsl_dataset_create_sync(pdd, tail, origin, 0,
-	    doca->doca_cred, tx);
+	    doca->doca_cred, NULL, tx);
 
 	VERIFY0(dsl_dataset_hold_obj(pdd->dd_pool, obj, FTAG, &ds));
 	dsl_dataset_name(origin, namebuf);
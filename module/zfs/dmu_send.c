@@ -45,6 +45,7 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/zap.h>
 #include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
 #include <sys/zfs_znode.h>
 #include <zfs_fletcher.h>
 #include <sys/avl.h>
@@ -58,6 +59,7 @@
 #include <sys/bqueue.h>
 #include <sys/zvol.h>
 #include <sys/policy.h>
+#include <sys/dsl_crypt.h>
 
 /* Set this tunable to TRUE to replace corrupt data with 0x2f5baddb10c */
 int zfs_send_corrupt_data = B_FALSE;
@@ -287,6 +289,8 @@ dump_write(dmu_sendarg_t *dsp, dmu_object_type_t type,
     void *data)
 {
 	uint64_t payload_size;
+	boolean_t raw = ((dsp->dsa_featureflags & DMU_BACKUP_FEATURE_RAW) &&
+	    bp != NULL && BP_IS_ENCRYPTED(bp));
 	struct drr_write *drrw = &(dsp->dsa_drr->drr_u.drr_write);
 
 	/*
@@ -319,12 +323,19 @@ dump_write(dmu_sendarg_t *dsp, dmu_object_type_t type,
 	drrw->drr_toguid = dsp->dsa_toguid;
 	drrw->drr_logical_size = lsize;
 
+	/* encrypted blocks of raw streams carry their encryption parameters */
+	if (raw) {
+		drrw->drr_flags |= DRR_RAW_ENCRYPTED;
+		zio_crypt_decode_params_bp(bp, drrw->drr_salt, drrw->drr_iv);
+		zio_crypt_decode_mac_bp(bp, drrw->drr_mac);
+	}
+
 	/* only set the compression fields if the buf is compressed */
 	if (lsize != psize) {
 		ASSERT(dsp->dsa_featureflags & DMU_BACKUP_FEATURE_COMPRESSED);
 		ASSERT(!BP_IS_EMBEDDED(bp));
 		ASSERT(!BP_SHOULD_BYTESWAP(bp));
-		ASSERT(!DMU_OT_IS_METADATA(BP_GET_TYPE(bp)));
+		ASSERT(raw || !DMU_OT_IS_METADATA(BP_GET_TYPE(bp)));
 		ASSERT3U(BP_GET_COMPRESS(bp), !=, ZIO_COMPRESS_OFF);
 		ASSERT3S(psize, >, 0);
 		ASSERT3S(lsize, >=, psize);
@@ -346,8 +357,9 @@ dump_write(dmu_sendarg_t *dsp, dmu_object_type_t type,
 		drrw->drr_checksumtype = ZIO_CHECKSUM_OFF;
 	} else {
 		drrw->drr_checksumtype = BP_GET_CHECKSUM(bp);
-		if (zio_checksum_table[drrw->drr_checksumtype].ci_flags &
-		    ZCHECKSUM_FLAG_DEDUP)
+		/* the checksum of an encrypted block is not of its contents */
+		if ((zio_checksum_table[drrw->drr_checksumtype].ci_flags &
+		    ZCHECKSUM_FLAG_DEDUP) && !BP_IS_ENCRYPTED(bp))
 			drrw->drr_checksumflags |= DRR_CHECKSUM_DEDUP;
 		DDK_SET_LSIZE(&drrw->drr_key, BP_GET_LSIZE(bp));
 		DDK_SET_PSIZE(&drrw->drr_key, BP_GET_PSIZE(bp));
@@ -534,6 +546,10 @@ backup_do_embed(dmu_sendarg_t *dsp, const blkptr_t *bp)
 	    !(dsp->dsa_featureflags & DMU_BACKUP_FEATURE_LZ4)))
 		return (B_FALSE);
 
+	if (BP_GET_COMPRESS(bp) == ZIO_COMPRESS_ZSTD &&
+	    !(dsp->dsa_featureflags & DMU_BACKUP_FEATURE_ZSTD))
+		return (B_FALSE);
+
 	/*
 	 * Embed type must be explicitly enabled.
 	 */
@@ -693,6 +709,33 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		ASSERT0(zb->zb_level);
 		err = dump_write_embedded(dsa, zb->zb_object,
 		    zb->zb_blkid * blksz, blksz, bp);
+	} else if ((dsa->dsa_featureflags & DMU_BACKUP_FEATURE_RAW) &&
+	    BP_IS_ENCRYPTED(bp)) {
+		/*
+		 * An encrypted level-0 block of a raw send.  It is sent
+		 * exactly as it is on disk, so it is read around the ARC
+		 * (which only caches plaintext) and can't be byteswapped.
+		 */
+		int blksz = dblkszsec << SPA_MINBLOCKSHIFT;
+		uint64_t psize = BP_GET_PSIZE(bp);
+		abd_t *abd;
+
+		ASSERT0(zb->zb_level);
+		ASSERT3U(BP_GET_LSIZE(bp), ==, blksz);
+		if (BP_SHOULD_BYTESWAP(bp))
+			return (SET_ERROR(ENOTSUP));
+
+		abd = abd_alloc_linear(psize, B_FALSE);
+		if (zio_wait(zio_read(NULL, spa, bp, abd, psize, NULL, NULL,
+		    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL | ZIO_FLAG_RAW,
+		    zb)) != 0) {
+			abd_free(abd);
+			return (SET_ERROR(EIO));
+		}
+
+		err = dump_write(dsa, type, zb->zb_object, zb->zb_blkid * blksz,
+		    blksz, psize, bp, abd_to_buf(abd));
+		abd_free(abd);
 	} else {
 		/* it's a level-0 block of a regular object */
 		arc_flags_t aflags = ARC_FLAG_WAIT;
@@ -718,11 +761,14 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		 *  - this isn't an embedded block
 		 *  - this isn't metadata (if receiving on a different endian
 		 *    system it can be byteswapped more easily)
+		 *  - the stream allows the block's compression algorithm
 		 */
 		boolean_t request_compressed =
 		    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
 		    !split_large_blocks && !BP_SHOULD_BYTESWAP(bp) &&
-		    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp));
+		    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp)) &&
+		    (BP_GET_COMPRESS(bp) != ZIO_COMPRESS_ZSTD ||
+		    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_ZSTD));
 
 		ASSERT0(zb->zb_level);
 		ASSERT(zb->zb_object > dsa->dsa_resume_object ||
@@ -730,7 +776,7 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		    zb->zb_blkid * blksz >= dsa->dsa_resume_offset));
 
 		if (request_compressed)
-			zioflags |= ZIO_FLAG_RAW;
+			zioflags |= ZIO_FLAG_RAW_COMPRESS;
 
 		if (arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
 		    ZIO_PRIORITY_ASYNC_READ, zioflags,
@@ -795,7 +841,7 @@ static int
 dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
     zfs_bookmark_phys_t *ancestor_zb, boolean_t is_clone,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    int outfd, uint64_t resumeobj, uint64_t resumeoff,
+    boolean_t rawok, int outfd, uint64_t resumeobj, uint64_t resumeoff,
     vnode_t *vp, offset_t *off)
 {
 	objset_t *os;
@@ -807,6 +853,9 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	struct send_thread_arg to_arg;
 	void *payload = NULL;
 	size_t payload_len = 0;
+	nvlist_t *nvl = NULL;
+	nvlist_t *keynvl = NULL;
+	boolean_t key_mapped = B_FALSE;
 	struct send_block_record *to_data;
 
 	err = dmu_objset_from_ds(to_ds, &os);
@@ -837,6 +886,16 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	}
 #endif
 
+	/*
+	 * Encrypted blocks of a raw send are sent as they are on disk, so
+	 * they can neither be decompressed nor split into smaller blocks.
+	 */
+	if (rawok && os->os_encrypted) {
+		featureflags |= DMU_BACKUP_FEATURE_RAW;
+		compressok = B_TRUE;
+		large_block_ok = B_TRUE;
+	}
+
 	if (large_block_ok && to_ds->ds_feature_inuse[SPA_FEATURE_LARGE_BLOCKS])
 		featureflags |= DMU_BACKUP_FEATURE_LARGE_BLOCKS;
 	if (to_ds->ds_feature_inuse[SPA_FEATURE_LARGE_DNODE])
@@ -853,11 +912,32 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	    0 && spa_feature_is_active(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS)) {
 		featureflags |= DMU_BACKUP_FEATURE_LZ4;
 	}
+	if ((featureflags &
+	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED)) !=
+	    0 && to_ds->ds_feature_inuse[SPA_FEATURE_ZSTD_COMPRESS]) {
+		featureflags |= DMU_BACKUP_FEATURE_ZSTD;
+	}
 
 	if (resumeobj != 0 || resumeoff != 0) {
 		featureflags |= DMU_BACKUP_FEATURE_RESUMING;
 	}
 
+	/*
+	 * A raw stream carries the wrapped master key of the dataset, while
+	 * anything else needs the key to decrypt the blocks being sent.
+	 */
+	if (featureflags & DMU_BACKUP_FEATURE_RAW) {
+		err = dsl_crypto_populate_key_nvlist(to_ds, &keynvl);
+	} else if (os->os_encrypted) {
+		err = spa_keystore_create_mapping(dp->dp_spa, to_ds, FTAG);
+		key_mapped = (err == 0);
+	}
+	if (err != 0) {
+		kmem_free(drr, sizeof (dmu_replay_record_t));
+		dsl_pool_rele(dp, tag);
+		return (err);
+	}
+
 	DMU_SET_FEATUREFLAGS(drr->drr_u.drr_begin.drr_versioninfo,
 	    featureflags);
 
@@ -906,7 +986,6 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 
 	if (resumeobj != 0 || resumeoff != 0) {
 		dmu_object_info_t to_doi;
-		nvlist_t *nvl;
 		err = dmu_object_info(os, resumeobj, &to_doi);
 		if (err != 0)
 			goto out;
@@ -916,13 +995,23 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 		nvl = fnvlist_alloc();
 		fnvlist_add_uint64(nvl, "resume_object", resumeobj);
 		fnvlist_add_uint64(nvl, "resume_offset", resumeoff);
+	}
+
+	if (keynvl != NULL) {
+		if (nvl == NULL)
+			nvl = fnvlist_alloc();
+		fnvlist_add_nvlist(nvl, "crypt_keydata", keynvl);
+	}
+
+	if (nvl != NULL) {
 		payload = fnvlist_pack(nvl, &payload_len);
 		drr->drr_payloadlen = payload_len;
 		fnvlist_free(nvl);
 	}
 
 	err = dump_record(dsp, payload, payload_len);
-	fnvlist_pack_free(payload, payload_len);
+	if (payload != NULL)
+		fnvlist_pack_free(payload, payload_len);
 	if (err != 0) {
 		err = dsp->dsa_err;
 		goto out;
@@ -991,6 +1080,13 @@ out:
 	kmem_free(drr, sizeof (dmu_replay_record_t));
 	kmem_free(dsp, sizeof (dmu_sendarg_t));
 
+	if (keynvl != NULL)
+		fnvlist_free(keynvl);
+	if (key_mapped) {
+		spa_keystore_remove_mapping(dsl_dataset_get_spa(to_ds),
+		    to_ds->ds_object, FTAG);
+	}
+
 	dsl_dataset_long_rele(to_ds, FTAG);
 
 	return (err);
@@ -999,7 +1095,7 @@ out:
 int
 dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    int outfd, vnode_t *vp, offset_t *off)
+    boolean_t rawok, int outfd, vnode_t *vp, offset_t *off)
 {
 	dsl_pool_t *dp;
 	dsl_dataset_t *ds;
@@ -1035,10 +1131,12 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 		is_clone = (fromds->ds_dir != ds->ds_dir);
 		dsl_dataset_rele(fromds, FTAG);
 		err = dmu_send_impl(FTAG, dp, ds, &zb, is_clone,
-		    embedok, large_block_ok, compressok, outfd, 0, 0, vp, off);
+		    embedok, large_block_ok, compressok, rawok, outfd,
+		    0, 0, vp, off);
 	} else {
 		err = dmu_send_impl(FTAG, dp, ds, NULL, B_FALSE,
-		    embedok, large_block_ok, compressok, outfd, 0, 0, vp, off);
+		    embedok, large_block_ok, compressok, rawok, outfd,
+		    0, 0, vp, off);
 	}
 	dsl_dataset_rele(ds, FTAG);
 	return (err);
@@ -1046,8 +1144,8 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
-    boolean_t large_block_ok, boolean_t compressok, int outfd,
-    uint64_t resumeobj, uint64_t resumeoff,
+    boolean_t large_block_ok, boolean_t compressok, boolean_t rawok,
+    int outfd, uint64_t resumeobj, uint64_t resumeoff,
     vnode_t *vp, offset_t *off)
 {
 	dsl_pool_t *dp;
@@ -1115,11 +1213,11 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 			return (err);
 		}
 		err = dmu_send_impl(FTAG, dp, ds, &zb, is_clone,
-		    embedok, large_block_ok, compressok,
+		    embedok, large_block_ok, compressok, rawok,
 		    outfd, resumeobj, resumeoff, vp, off);
 	} else {
 		err = dmu_send_impl(FTAG, dp, ds, NULL, B_FALSE,
-		    embedok, large_block_ok, compressok,
+		    embedok, large_block_ok, compressok, rawok,
 		    outfd, resumeobj, resumeoff, vp, off);
 	}
 	if (owned)
@@ -1285,7 +1383,7 @@ typedef struct dmu_recv_begin_arg {
 
 static int
 recv_begin_check_existing_impl(dmu_recv_begin_arg_t *drba, dsl_dataset_t *ds,
-    uint64_t fromguid)
+    uint64_t fromguid, uint64_t featureflags)
 {
 	uint64_t val;
 	int error;
@@ -1365,6 +1463,21 @@ recv_begin_check_existing_impl(dmu_recv_begin_arg_t *drba, dsl_dataset_t *ds,
 		    dp->dp_origin_snap->ds_object : 0;
 	}
 
+	if (featureflags & DMU_BACKUP_FEATURE_RAW) {
+		/*
+		 * A raw stream can only add to a dataset that already has
+		 * the key it was sent with, i.e. an incremental onto an
+		 * encrypted dataset; the key guid is verified on receive.
+		 */
+		if (fromguid == 0 || ds->ds_dir->dd_crypto_obj == 0)
+			return (SET_ERROR(EINVAL));
+	} else if (ds->ds_dir->dd_crypto_obj != 0 &&
+	    dsl_dataset_get_keystatus(ds->ds_dir) !=
+	    ZFS_KEYSTATUS_AVAILABLE) {
+		/* the received data gets encrypted with the dataset's key */
+		return (SET_ERROR(EACCES));
+	}
+
 	return (0);
 
 }
@@ -1405,7 +1518,8 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	 * The receiving code doesn't know how to translate a WRITE_EMBEDDED
 	 * record to a plain WRITE record, so the pool must have the
 	 * EMBEDDED_DATA feature enabled if the stream has WRITE_EMBEDDED
-	 * records.  Same with WRITE_EMBEDDED records that use LZ4 compression.
+	 * records.  Same with WRITE_EMBEDDED records that use LZ4 or zstd
+	 * compression, and compressed WRITE records using zstd.
 	 */
 	if ((featureflags & DMU_BACKUP_FEATURE_EMBED_DATA) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_EMBEDDED_DATA))
@@ -1413,6 +1527,10 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ZSTD_COMPRESS) ||
+	    !zstd_available()))
+		return (SET_ERROR(ENOTSUP));
 
 	/*
 	 * The receiving code doesn't know how to translate large blocks
@@ -1432,6 +1550,14 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LARGE_DNODE))
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Raw streams carry encrypted blocks along with the key needed to
+	 * read them, which only pools with encryption enabled can store.
+	 */
+	if ((featureflags & DMU_BACKUP_FEATURE_RAW) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ENCRYPTION))
+		return (SET_ERROR(ENOTSUP));
+
 	error = dsl_dataset_hold(dp, tofs, FTAG, &ds);
 	if (error == 0) {
 		/* target fs already exists; recv into temp clone */
@@ -1442,7 +1568,8 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 			return (SET_ERROR(EINVAL));
 		}
 
-		error = recv_begin_check_existing_impl(drba, ds, fromguid);
+		error = recv_begin_check_existing_impl(drba, ds, fromguid,
+		    featureflags);
 		dsl_dataset_rele(ds, FTAG);
 	} else if (error == ENOENT) {
 		/* target fs does not exist; must be a full backup or clone */
@@ -1510,10 +1637,28 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 				dsl_dataset_rele(ds, FTAG);
 				return (SET_ERROR(ENODEV));
 			}
+
+			/* raw clones must share the key of their origin */
+			if ((featureflags & DMU_BACKUP_FEATURE_RAW) &&
+			    origin->ds_dir->dd_crypto_obj == 0)
+				error = SET_ERROR(EINVAL);
+			if (error == 0) {
+				error = dmu_objset_create_crypt_check(
+				    ds->ds_dir, origin, NULL);
+			}
 			dsl_dataset_rele(origin, FTAG);
+		} else if (featureflags & DMU_BACKUP_FEATURE_RAW) {
+			dsl_crypto_params_t dcp = { 0 };
+
+			dcp.cp_cmd = DCP_CMD_RAW_RECV;
+			dcp.cp_crypt = ZIO_CRYPT_INHERIT;
+			error = dmu_objset_create_crypt_check(ds->ds_dir, NULL,
+			    &dcp);
+		} else {
+			error = dmu_objset_create_crypt_check(ds->ds_dir, NULL,
+			    NULL);
 		}
 		dsl_dataset_rele(ds, FTAG);
-		error = 0;
 	}
 	return (error);
 }
@@ -1530,9 +1675,12 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 	uint64_t dsobj;
 	int error;
 	uint64_t crflags = 0;
+	uint64_t featureflags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+	dsl_crypto_params_t dcp = { 0 };
 
 	if (drrb->drr_flags & DRR_FLAG_CI_DATA)
 		crflags |= DS_FLAG_CI_DATASET;
+	dcp.cp_crypt = ZIO_CRYPT_INHERIT;
 
 	error = dsl_dataset_hold(dp, tofs, FTAG, &ds);
 	if (error == 0) {
@@ -1542,8 +1690,13 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 			VERIFY0(dsl_dataset_hold_obj(dp,
 			    drba->drba_snapobj, FTAG, &snap));
 		}
+		/*
+		 * The temporary clone uses the key of the dataset it will
+		 * be swapped into (its origin's key, if it has an origin).
+		 */
+		dcp.cp_cmd = DCP_CMD_SHARE_KEY;
 		dsobj = dsl_dataset_create_sync(ds->ds_dir, recv_clone_name,
-		    snap, crflags, drba->drba_cred, tx);
+		    snap, crflags, drba->drba_cred, &dcp, tx);
 		if (drba->drba_snapobj != 0)
 			dsl_dataset_rele(snap, FTAG);
 		dsl_dataset_rele(ds, FTAG);
@@ -1559,10 +1712,14 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 			    FTAG, &origin));
 		}
 
+		/* raw receives get their key from the stream */
+		if (featureflags & DMU_BACKUP_FEATURE_RAW)
+			dcp.cp_cmd = DCP_CMD_RAW_RECV;
+
 		/* Create new dataset. */
 		dsobj = dsl_dataset_create_sync(dd,
 		    strrchr(tofs, '/') + 1,
-		    origin, crflags, drba->drba_cred, tx);
+		    origin, crflags, drba->drba_cred, &dcp, tx);
 		if (origin != NULL)
 			dsl_dataset_rele(origin, FTAG);
 		dsl_dir_rele(dd, FTAG);
@@ -1604,6 +1761,10 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 			VERIFY0(zap_add(mos, dsobj, DS_FIELD_RESUME_COMPRESSOK,
 			    8, 1, &one, tx));
 		}
+		if (featureflags & DMU_BACKUP_FEATURE_RAW) {
+			VERIFY0(zap_add(mos, dsobj, DS_FIELD_RESUME_RAWOK,
+			    8, 1, &one, tx));
+		}
 	}
 
 	dmu_buf_will_dirty(newds->ds_dbuf, tx);
@@ -1658,7 +1819,8 @@ dmu_recv_resume_begin_check(void *arg, dmu_tx_t *tx)
 	 * The receiving code doesn't know how to translate a WRITE_EMBEDDED
 	 * record to a plain WRITE record, so the pool must have the
 	 * EMBEDDED_DATA feature enabled if the stream has WRITE_EMBEDDED
-	 * records.  Same with WRITE_EMBEDDED records that use LZ4 compression.
+	 * records.  Same with WRITE_EMBEDDED records that use LZ4 or zstd
+	 * compression, and compressed WRITE records using zstd.
 	 */
 	if ((featureflags & DMU_BACKUP_FEATURE_EMBED_DATA) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_EMBEDDED_DATA))
@@ -1666,6 +1828,13 @@ dmu_recv_resume_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ZSTD_COMPRESS) ||
+	    !zstd_available()))
+		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_RAW) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ENCRYPTION))
+		return (SET_ERROR(ENOTSUP));
 
 	(void) snprintf(recvname, sizeof (recvname), "%s/%s",
 	    tofs, recv_clone_name);
@@ -1848,6 +2017,7 @@ struct receive_writer_arg {
 	/* A map from guid to dataset to help handle dedup'd streams. */
 	avl_tree_t *guid_to_ds_map;
 	boolean_t resumable;
+	boolean_t raw;
 	uint64_t last_object, last_offset;
 	uint64_t bytes_read; /* bytes read when current record created */
 };
@@ -2228,12 +2398,34 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 	return (0);
 }
 
+/*
+ * Encrypted blocks can only be received by a raw receive, which writes
+ * them out unchanged.  Conversely, a raw receive has no key to encrypt
+ * anything with, so it can't write the blocks of encrypted object types
+ * from anything but raw records.
+ */
+static int
+receive_check_raw(struct receive_writer_arg *rwa, dmu_object_type_t type,
+    boolean_t raw)
+{
+	if (raw) {
+		if (!rwa->raw || !rwa->os->os_encrypted ||
+		    !DMU_OT_IS_ENCRYPTED(type))
+			return (SET_ERROR(EINVAL));
+	} else if (rwa->raw && DMU_OT_IS_ENCRYPTED(type)) {
+		return (SET_ERROR(EINVAL));
+	}
+	return (0);
+}
+
 noinline static int
 receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
     arc_buf_t *abuf)
 {
 	dmu_tx_t *tx;
 	dmu_buf_t *bonus;
+	dmu_object_info_t doi;
+	boolean_t raw = DRR_IS_RAW_ENCRYPTED(drrw->drr_flags);
 	int err;
 
 	if (drrw->drr_offset + drrw->drr_logical_size < drrw->drr_offset ||
@@ -2252,9 +2444,13 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	rwa->last_object = drrw->drr_object;
 	rwa->last_offset = drrw->drr_offset;
 
-	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
+	if (dmu_object_info(rwa->os, drrw->drr_object, &doi) != 0)
 		return (SET_ERROR(EINVAL));
 
+	err = receive_check_raw(rwa, doi.doi_type, raw);
+	if (err != 0)
+		return (err);
+
 	tx = dmu_tx_create(rwa->os);
 
 	dmu_tx_hold_write(tx, drrw->drr_object,
@@ -2267,6 +2463,7 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	if (rwa->byteswap) {
 		dmu_object_byteswap_t byteswap =
 		    DMU_OT_BYTESWAP(drrw->drr_type);
+		ASSERT(!raw);
 		dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
 		    DRR_WRITE_PAYLOAD_SIZE(drrw));
 	}
@@ -2274,7 +2471,17 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	/* use the bonus buf to look up the dnode in dmu_assign_arcbuf */
 	if (dmu_bonus_hold(rwa->os, drrw->drr_object, FTAG, &bonus) != 0)
 		return (SET_ERROR(EINVAL));
-	dmu_assign_arcbuf(bonus, drrw->drr_offset, abuf, tx);
+	if (raw) {
+		err = dmu_assign_arcbuf_raw(bonus, drrw->drr_offset, abuf,
+		    drrw->drr_salt, drrw->drr_iv, drrw->drr_mac, tx);
+		if (err != 0) {
+			dmu_tx_commit(tx);
+			dmu_buf_rele(bonus, FTAG);
+			return (err);
+		}
+	} else {
+		dmu_assign_arcbuf(bonus, drrw->drr_offset, abuf, tx);
+	}
 
 	/*
 	 * Note: If the receive fails, we want the resume stream to start
@@ -2311,6 +2518,10 @@ receive_write_byref(struct receive_writer_arg *rwa,
 	if (drrwbr->drr_offset + drrwbr->drr_length < drrwbr->drr_offset)
 		return (SET_ERROR(EINVAL));
 
+	/* the referenced data of a raw stream would be ciphertext */
+	if (rwa->raw)
+		return (SET_ERROR(EINVAL));
+
 	/*
 	 * If the GUID of the referenced dataset is different from the
 	 * GUID of the target dataset, find the referenced dataset.
@@ -2351,11 +2562,57 @@ receive_write_byref(struct receive_writer_arg *rwa,
 	return (0);
 }
 
+static int
+receive_write_embedded_encrypted(struct receive_writer_arg *rwa,
+    struct drr_write_embedded *drrwe, void *data)
+{
+	dmu_tx_t *tx;
+	void *buf = data;
+	int err;
+
+	if (drrwe->drr_etype != BP_EMBEDDED_TYPE_DATA || rwa->byteswap ||
+	    drrwe->drr_lsize > drrwe->drr_length ||
+	    drrwe->drr_lsize > SPA_MAXBLOCKSIZE)
+		return (SET_ERROR(EINVAL));
+
+	if (drrwe->drr_compression != ZIO_COMPRESS_OFF) {
+		buf = zio_data_buf_alloc(drrwe->drr_lsize);
+		err = zio_decompress_data_buf(drrwe->drr_compression, data,
+		    buf, drrwe->drr_psize, drrwe->drr_lsize);
+		if (err != 0) {
+			zio_data_buf_free(buf, drrwe->drr_lsize);
+			return (SET_ERROR(EINVAL));
+		}
+	} else if (drrwe->drr_psize != drrwe->drr_lsize) {
+		return (SET_ERROR(EINVAL));
+	}
+
+	tx = dmu_tx_create(rwa->os);
+	dmu_tx_hold_write(tx, drrwe->drr_object,
+	    drrwe->drr_offset, drrwe->drr_length);
+	err = dmu_tx_assign(tx, TXG_WAIT);
+	if (err == 0) {
+		dmu_write(rwa->os, drrwe->drr_object, drrwe->drr_offset,
+		    drrwe->drr_lsize, buf, tx);
+		/* See comment in restore_write. */
+		save_resume_state(rwa, drrwe->drr_object, drrwe->drr_offset,
+		    tx);
+		dmu_tx_commit(tx);
+	} else {
+		dmu_tx_abort(tx);
+	}
+
+	if (buf != data)
+		zio_data_buf_free(buf, drrwe->drr_lsize);
+	return (err);
+}
+
 static int
 receive_write_embedded(struct receive_writer_arg *rwa,
     struct drr_write_embedded *drrwe, void *data)
 {
 	dmu_tx_t *tx;
+	dmu_object_info_t doi;
 	int err;
 
 	if (drrwe->drr_offset + drrwe->drr_length < drrwe->drr_offset)
@@ -2369,6 +2626,19 @@ receive_write_embedded(struct receive_writer_arg *rwa,
 	if (drrwe->drr_compression >= ZIO_COMPRESS_FUNCTIONS)
 		return (EINVAL);
 
+	if (dmu_object_info(rwa->os, drrwe->drr_object, &doi) != 0)
+		return (SET_ERROR(EINVAL));
+	err = receive_check_raw(rwa, doi.doi_type, B_FALSE);
+	if (err != 0)
+		return (err);
+
+	/*
+	 * Embedded block pointers hold their data in the clear, so data
+	 * received into an encrypted dataset is written as a regular block.
+	 */
+	if (rwa->os->os_encrypted && DMU_OT_IS_ENCRYPTED(doi.doi_type))
+		return (receive_write_embedded_encrypted(rwa, drrwe, data));
+
 	tx = dmu_tx_create(rwa->os);
 
 	dmu_tx_hold_write(tx, drrwe->drr_object,
@@ -2689,7 +2959,13 @@ receive_read_record(struct receive_arg *ra)
 		struct drr_write *drrw = &ra->rrd->header.drr_u.drr_write;
 		arc_buf_t *abuf;
 		boolean_t is_meta = DMU_OT_IS_METADATA(drrw->drr_type);
-		if (DRR_WRITE_COMPRESSED(drrw)) {
+		if (DRR_IS_RAW_ENCRYPTED(drrw->drr_flags)) {
+			/* raw blocks may be compressed metadata as well */
+			abuf = arc_loan_raw_buf(dmu_objset_spa(ra->os),
+			    is_meta, DRR_WRITE_PAYLOAD_SIZE(drrw),
+			    drrw->drr_logical_size,
+			    drrw->drr_compressiontype);
+		} else if (DRR_WRITE_COMPRESSED(drrw)) {
 			ASSERT3U(drrw->drr_compressed_size, >, 0);
 			ASSERT3U(drrw->drr_logical_size, >=,
 			    drrw->drr_compressed_size);
@@ -2931,6 +3207,8 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	uint32_t payloadlen;
 	void *payload;
 	nvlist_t *begin_nvl = NULL;
+	nvlist_t *keynvl;
+	boolean_t key_mapped = B_FALSE;
 
 	ra = kmem_zalloc(sizeof (*ra), KM_SLEEP);
 	rwa = kmem_zalloc(sizeof (*rwa), KM_SLEEP);
@@ -3021,6 +3299,35 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 			goto out;
 	}
 
+	/*
+	 * A raw stream carries the key its blocks are encrypted with, which
+	 * the dataset either gets or must already have.  Other streams into
+	 * an encrypted dataset get encrypted with its key as they are
+	 * written, so it must be loaded for the duration of the receive.
+	 */
+	if (featureflags & DMU_BACKUP_FEATURE_RAW) {
+		/* ciphertext can't be byteswapped */
+		if (drc->drc_byteswap) {
+			err = SET_ERROR(ENOTSUP);
+			goto out;
+		}
+		if (begin_nvl == NULL || nvlist_lookup_nvlist(begin_nvl,
+		    "crypt_keydata", &keynvl) != 0) {
+			err = SET_ERROR(EINVAL);
+			goto out;
+		}
+		err = dsl_crypto_recv_key(spa_name(dmu_objset_spa(ra->os)),
+		    drc->drc_ds->ds_object, keynvl);
+		if (err != 0)
+			goto out;
+	} else if (drc->drc_ds->ds_dir->dd_crypto_obj != 0) {
+		err = spa_keystore_create_mapping(dmu_objset_spa(ra->os),
+		    drc->drc_ds, dmu_recv_tag);
+		if (err != 0)
+			goto out;
+		key_mapped = B_TRUE;
+	}
+
 	(void) bqueue_init(&rwa->q, zfs_recv_queue_length,
 	    offsetof(struct receive_record_arg, node));
 	cv_init(&rwa->cv, NULL, CV_DEFAULT, NULL);
@@ -3028,6 +3335,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	rwa->os = ra->os;
 	rwa->byteswap = drc->drc_byteswap;
 	rwa->resumable = drc->drc_resumable;
+	rwa->raw = !!(featureflags & DMU_BACKUP_FEATURE_RAW);
 
 	(void) thread_create(NULL, 0, receive_writer_thread, rwa, 0, curproc,
 	    TS_RUN, minclsyspri);
@@ -3085,11 +3393,25 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	if (err == 0)
 		err = rwa->err;
 
+	/*
+	 * The dbufs of a raw receive hold ciphertext, which must not be
+	 * mistaken for plaintext once the blocks have been written out.
+	 */
+	if (err == 0 && rwa->raw) {
+		txg_wait_synced(dmu_objset_pool(ra->os), 0);
+		dmu_objset_evict_dbufs(ra->os);
+	}
+
 out:
 	nvlist_free(begin_nvl);
 	if ((featureflags & DMU_BACKUP_FEATURE_DEDUP) && (cleanup_fd != -1))
 		zfs_onexit_fd_rele(cleanup_fd);
 
+	if (key_mapped) {
+		spa_keystore_remove_mapping(dmu_objset_spa(ra->os),
+		    drc->drc_ds->ds_object, dmu_recv_tag);
+	}
+
 	if (err != 0) {
 		/*
 		 * Clean up references. If receive is not resumable,
@@ -50,6 +50,8 @@ unsigned int	zfetch_max_streams = 8;
 unsigned int	zfetch_min_sec_reap = 2;
 /* max bytes to prefetch per stream (default 8MB) */
 unsigned int	zfetch_max_distance = 8 * 1024 * 1024;
+/* min bytes a stream prefetches once it has hits (default 2MB) */
+unsigned int	zfetch_min_distance = 2 * 1024 * 1024;
 /* max bytes to prefetch indirects for per stream (default 64MB) */
 unsigned int	zfetch_max_idistance = 64 * 1024 * 1024;
 /* max number of bytes in an array_read in which we allow prefetching (1MB) */
@@ -59,16 +61,28 @@ typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_stride_hits;	/* hits of strided streams */
+	kstat_named_t zfetchstat_reverse_hits;	/* hits of backward streams */
+	kstat_named_t zfetchstat_io_issued;	/* data blocks prefetched */
+	kstat_named_t zfetchstat_io_useful;	/* ... then found in memory */
+	kstat_named_t zfetchstat_io_wasted;	/* ... then evicted unused */
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "reverse_hits",		KSTAT_DATA_UINT64 },
+	{ "io_issued",			KSTAT_DATA_UINT64 },
+	{ "io_useful",			KSTAT_DATA_UINT64 },
+	{ "io_wasted",			KSTAT_DATA_UINT64 },
 };
 
 #define	ZFETCHSTAT_BUMP(stat) \
 	atomic_inc_64(&zfetch_stats.stat.value.ui64);
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val));
 
 kstat_t		*zfetch_ksp;
 
@@ -144,18 +158,26 @@ dmu_zfetch_fini(zfetch_t *zf)
 }
 
 /*
- * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * If there aren't too many streams already, create a new stream for an
+ * access of nblks blocks at blkid which no stream expected.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
+ *
+ * The new stream expects the next access right after this one, unless
+ * the access relates to the last access of a stream without hits yet:
+ * right before it starts a backward stream, and a bit past it (with the
+ * same size) a strided one.
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
 {
 	zstream_t *zs;
 	zstream_t *zs_next;
 	int numstreams = 0;
 	uint32_t max_streams;
+	uint64_t max_stride;
+	uint64_t stride = 0;
+	boolean_t backward = B_FALSE;
 
 	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
 
@@ -188,16 +210,58 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 		return;
 	}
 
+	/*
+	 * Strides longer than the prefetch distance leave nothing to
+	 * prefetch.
+	 */
+	max_stride = zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+	for (zs = list_head(&zf->zf_stream); zs != NULL;
+	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_accesses != 0)
+			continue;
+		if (blkid + nblks == zs->zs_last_blkid) {
+			backward = B_TRUE;
+			break;
+		}
+		if (blkid > zs->zs_last_blkid + nblks &&
+		    blkid - zs->zs_last_blkid <= max_stride &&
+		    nblks == zs->zs_nblks) {
+			stride = blkid - zs->zs_last_blkid;
+			break;
+		}
+	}
+
 	zs = kmem_zalloc(sizeof (*zs), KM_SLEEP);
-	zs->zs_blkid = blkid;
-	zs->zs_pf_blkid = blkid;
-	zs->zs_ipf_blkid = blkid;
+	if (backward)
+		zs->zs_blkid = blkid;
+	else if (stride != 0)
+		zs->zs_blkid = blkid + stride;
+	else
+		zs->zs_blkid = blkid + nblks;
+	zs->zs_pf_blkid = zs->zs_blkid;
+	zs->zs_ipf_blkid = zs->zs_blkid;
+	zs->zs_backward = backward;
+	zs->zs_stride = stride;
+	zs->zs_nblks = nblks;
+	zs->zs_last_blkid = blkid;
+	zs->zs_max_dist = MIN(zfetch_min_distance, zfetch_max_distance);
 	zs->zs_atime = gethrtime();
 	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	list_insert_head(&zf->zf_stream, zs);
 }
 
+/*
+ * Whether an access of nblks blocks at blkid is the one zs expects next.
+ */
+static boolean_t
+dmu_zfetch_stream_match(zstream_t *zs, uint64_t blkid, uint64_t nblks)
+{
+	if (zs->zs_backward)
+		return (blkid + nblks == zs->zs_blkid);
+	return (blkid == zs->zs_blkid);
+}
+
 /*
  * This is the predictive prefetch entry point.  It associates dnode access
  * specified with blkid and nblks arguments with prefetch stream, predicts
@@ -205,15 +269,20 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
  * fetch_data argument specifies whether actual data blocks should be fetched:
  *   FALSE -- prefetch only indirect blocks for predicted data blocks;
  *   TRUE -- prefetch predicted data blocks plus following indirect blocks.
+ * missed argument tells whether the access had to read the blocks from
+ * disk, which for blocks the stream prefetched means they were evicted
+ * before being used.
  */
 void
-dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
+dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
+    boolean_t missed)
 {
 	zstream_t *zs;
 	int64_t pf_start, ipf_start, ipf_istart, ipf_iend;
-	int64_t pf_ahead_blks, max_blks, iblk;
-	int epbs, max_dist_blks, pf_nblks, ipf_nblks, i;
-	uint64_t end_of_access_blkid;
+	int64_t pf_ahead_blks, max_blks, iblk, pf_step;
+	int epbs, max_dist_blks, pf_nblks, ipf_nblks, i, j;
+	uint64_t end_of_access_blkid, pf_unit, blkshift;
+	boolean_t prefetched;
 	end_of_access_blkid = blkid + nblks;
 
 	if (zfs_prefetch_disable)
@@ -230,13 +299,13 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
-		if (blkid == zs->zs_blkid) {
+		if (dmu_zfetch_stream_match(zs, blkid, nblks)) {
 			mutex_enter(&zs->zs_lock);
 			/*
 			 * zs_blkid could have changed before we
 			 * acquired zs_lock; re-check them here.
 			 */
-			if (blkid != zs->zs_blkid) {
+			if (!dmu_zfetch_stream_match(zs, blkid, nblks)) {
 				mutex_exit(&zs->zs_lock);
 				continue;
 			}
@@ -251,70 +320,154 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 		 */
 		ZFETCHSTAT_BUMP(zfetchstat_misses);
 		if (rw_tryupgrade(&zf->zf_rwlock))
-			dmu_zfetch_stream_create(zf, end_of_access_blkid);
+			dmu_zfetch_stream_create(zf, blkid, nblks);
 		rw_exit(&zf->zf_rwlock);
 		return;
 	}
 
 	/*
-	 * This access was to a block that we issued a prefetch for on
-	 * behalf of this stream. Issue further prefetches for this stream.
-	 *
-	 * Normally, we start prefetching where we stopped
-	 * prefetching last (zs_pf_blkid).  But when we get our first
-	 * hit on this stream, zs_pf_blkid == zs_blkid, we don't
-	 * want to prefetch the block we just accessed.  In this case,
-	 * start just after the block we just accessed.
+	 * Adapt the prefetch distance to how the blocks we prefetched for
+	 * this access fared: grow it by the access when they were still in
+	 * memory (or on their way), halve it when they had been evicted.
 	 */
-	pf_start = MAX(zs->zs_pf_blkid, end_of_access_blkid);
+	blkshift = zf->zf_dnode->dn_datablkshift;
+	if (zs->zs_backward)
+		prefetched = (blkid >= zs->zs_pf_blkid);
+	else
+		prefetched = (blkid < zs->zs_pf_blkid);
+	if (prefetched && fetch_data) {
+		if (missed) {
+			zs->zs_wasted++;
+			ZFETCHSTAT_BUMP(zfetchstat_io_wasted);
+			zs->zs_max_dist = MAX(zs->zs_max_dist / 2,
+			    MIN(zfetch_min_distance, zfetch_max_distance));
+		} else {
+			zs->zs_useful++;
+			ZFETCHSTAT_BUMP(zfetchstat_io_useful);
+			zs->zs_max_dist = MIN(zs->zs_max_dist +
+			    (nblks << blkshift), zfetch_max_distance);
+		}
+	}
+	zs->zs_accesses++;
+	zs->zs_last_blkid = blkid;
+	zs->zs_nblks = nblks;
+	max_dist_blks = MAX(zs->zs_max_dist >> blkshift, 1);
 
-	/*
-	 * Double our amount of prefetched data, but don't let the
-	 * prefetch get further ahead than zfetch_max_distance.
-	 */
-	if (fetch_data) {
-		max_dist_blks =
-		    zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+	ipf_istart = ipf_iend = 0;
+	if (zs->zs_backward) {
+		/*
+		 * Prefetch the blocks below the lowest one prefetched so
+		 * far (or below this access), doubling how far ahead we are
+		 * as forward streams do.
+		 */
+		pf_start = MIN(zs->zs_pf_blkid, blkid);
+		if (fetch_data) {
+			pf_ahead_blks = end_of_access_blkid -
+			    zs->zs_pf_blkid + nblks;
+			max_blks = max_dist_blks - (blkid - pf_start);
+			pf_nblks = MIN(MIN(pf_ahead_blks, max_blks), pf_start);
+			pf_nblks = MAX(pf_nblks, 0);
+		} else {
+			pf_nblks = 0;
+		}
+		zs->zs_pf_blkid = pf_start - pf_nblks;
+		zs->zs_blkid = blkid;
+
+		pf_start--;
+		pf_step = -1;
+		pf_unit = 1;
+		ZFETCHSTAT_BUMP(zfetchstat_reverse_hits);
+	} else if (zs->zs_stride != 0) {
 		/*
-		 * Previously, we were (zs_pf_blkid - blkid) ahead.  We
-		 * want to now be double that, so read that amount again,
-		 * plus the amount we are catching up by (i.e. the amount
-		 * read just now).
+		 * Prefetch the accesses to come, nblks blocks every
+		 * zs_stride blocks, twice as many as were prefetched
+		 * ahead of the next access.
 		 */
-		pf_ahead_blks = zs->zs_pf_blkid - blkid + nblks;
-		max_blks = max_dist_blks - (pf_start - end_of_access_blkid);
-		pf_nblks = MIN(pf_ahead_blks, max_blks);
+		uint64_t next = blkid + zs->zs_stride;
+		int64_t ahead;
+
+		pf_start = MAX(zs->zs_pf_blkid, next);
+		ahead = (pf_start - next) / zs->zs_stride;
+		if (fetch_data) {
+			pf_nblks = MIN(MAX(2 * ahead, 1),
+			    MAX((int64_t)(max_dist_blks / nblks), 1)) - ahead;
+			pf_nblks = MAX(pf_nblks, 0);
+		} else {
+			pf_nblks = 0;
+		}
+		zs->zs_pf_blkid = pf_start + pf_nblks * zs->zs_stride;
+		zs->zs_blkid = next;
+
+		pf_step = zs->zs_stride;
+		pf_unit = nblks;
+		ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
 	} else {
-		pf_nblks = 0;
-	}
+		/*
+		 * This access was to a block that we issued a prefetch for
+		 * on behalf of this stream. Issue further prefetches for
+		 * this stream.
+		 *
+		 * Normally, we start prefetching where we stopped
+		 * prefetching last (zs_pf_blkid).  But when we get our first
+		 * hit on this stream, zs_pf_blkid == zs_blkid, we don't
+		 * want to prefetch the block we just accessed.  In this
+		 * case, start just after the block we just accessed.
+		 */
+		pf_start = MAX(zs->zs_pf_blkid, end_of_access_blkid);
 
-	zs->zs_pf_blkid = pf_start + pf_nblks;
+		/*
+		 * Double our amount of prefetched data, but don't let the
+		 * prefetch get further ahead than the stream's distance.
+		 */
+		if (fetch_data) {
+			/*
+			 * Previously, we were (zs_pf_blkid - blkid) ahead.
+			 * We want to now be double that, so read that amount
+			 * again, plus the amount we are catching up by
+			 * (i.e. the amount read just now).
+			 */
+			pf_ahead_blks = zs->zs_pf_blkid - blkid + nblks;
+			max_blks = max_dist_blks -
+			    (pf_start - end_of_access_blkid);
+			pf_nblks = MIN(pf_ahead_blks, max_blks);
+			pf_nblks = MAX(pf_nblks, 0);
+		} else {
+			pf_nblks = 0;
+		}
 
-	/*
-	 * Do the same for indirects, starting from where we stopped last,
-	 * or where we will stop reading data blocks (and the indirects
-	 * that point to them).
-	 */
-	ipf_start = MAX(zs->zs_ipf_blkid, zs->zs_pf_blkid);
-	max_dist_blks = zfetch_max_idistance >> zf->zf_dnode->dn_datablkshift;
-	/*
-	 * We want to double our distance ahead of the data prefetch
-	 * (or reader, if we are not prefetching data).  Previously, we
-	 * were (zs_ipf_blkid - blkid) ahead.  To double that, we read
-	 * that amount again, plus the amount we are catching up by
-	 * (i.e. the amount read now + the amount of data prefetched now).
-	 */
-	pf_ahead_blks = zs->zs_ipf_blkid - blkid + nblks + pf_nblks;
-	max_blks = max_dist_blks - (ipf_start - end_of_access_blkid);
-	ipf_nblks = MIN(pf_ahead_blks, max_blks);
-	zs->zs_ipf_blkid = ipf_start + ipf_nblks;
+		zs->zs_pf_blkid = pf_start + pf_nblks;
+
+		/*
+		 * Do the same for indirects, starting from where we stopped
+		 * last, or where we will stop reading data blocks (and the
+		 * indirects that point to them).
+		 */
+		ipf_start = MAX(zs->zs_ipf_blkid, zs->zs_pf_blkid);
+		max_dist_blks = zfetch_max_idistance >> blkshift;
+		/*
+		 * We want to double our distance ahead of the data prefetch
+		 * (or reader, if we are not prefetching data).  Previously,
+		 * we were (zs_ipf_blkid - blkid) ahead.  To double that, we
+		 * read that amount again, plus the amount we are catching up
+		 * by (i.e. the amount read now + the amount of data
+		 * prefetched now).
+		 */
+		pf_ahead_blks = zs->zs_ipf_blkid - blkid + nblks + pf_nblks;
+		max_blks = max_dist_blks - (ipf_start - end_of_access_blkid);
+		ipf_nblks = MIN(pf_ahead_blks, max_blks);
+		zs->zs_ipf_blkid = ipf_start + ipf_nblks;
 
-	epbs = zf->zf_dnode->dn_indblkshift - SPA_BLKPTRSHIFT;
-	ipf_istart = P2ROUNDUP(ipf_start, 1 << epbs) >> epbs;
-	ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
+		epbs = zf->zf_dnode->dn_indblkshift - SPA_BLKPTRSHIFT;
+		ipf_istart = P2ROUNDUP(ipf_start, 1 << epbs) >> epbs;
+		ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
+
+		zs->zs_blkid = end_of_access_blkid;
+
+		pf_step = 1;
+		pf_unit = 1;
+	}
 
 	zs->zs_atime = gethrtime();
-	zs->zs_blkid = end_of_access_blkid;
 	mutex_exit(&zs->zs_lock);
 	rw_exit(&zf->zf_rwlock);
 
@@ -325,9 +478,14 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	 */
 
 	for (i = 0; i < pf_nblks; i++) {
-		dbuf_prefetch(zf->zf_dnode, 0, pf_start + i,
-		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
+		for (j = 0; j < pf_unit; j++) {
+			dbuf_prefetch(zf->zf_dnode, 0,
+			    pf_start + i * pf_step + j,
+			    ZIO_PRIORITY_ASYNC_READ,
+			    ARC_FLAG_PREDICTIVE_PREFETCH);
+		}
 	}
+	ZFETCHSTAT_INCR(zfetchstat_io_issued, pf_nblks * pf_unit);
 	for (iblk = ipf_istart; iblk < ipf_iend; iblk++) {
 		dbuf_prefetch(zf->zf_dnode, 1, iblk,
 		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
@@ -350,6 +508,10 @@ module_param(zfetch_max_distance, uint, 0644);
 MODULE_PARM_DESC(zfetch_max_distance,
 	"Max bytes to prefetch per stream (default 8MB)");
 
+module_param(zfetch_min_distance, uint, 0644);
+MODULE_PARM_DESC(zfetch_min_distance,
+	"Min bytes to prefetch per stream (default 2MB)");
+
 module_param(zfetch_array_rd_sz, ulong, 0644);
 MODULE_PARM_DESC(zfetch_array_rd_sz, "Number of bytes in a array_read");
 /* END CSTYLED */
@@ -0,0 +1,1761 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/dsl_crypt.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_dir.h>
+#include <sys/dsl_dataset.h>
+#include <sys/dsl_prop.h>
+#include <sys/dsl_synctask.h>
+#include <sys/dmu_objset.h>
+#include <sys/spa_impl.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
+#include <sys/zfs_context.h>
+
+/*
+ * Dataset encryption keys
+ *
+ * Every encrypted dsl_dir refers (through DD_FIELD_CRYPTO_KEY_OBJ) to a
+ * DSL crypto key object in the MOS.  The object holds the dataset's master
+ * key, wrapped with the wrapping key of the dataset's encryption root, along
+ * with the suite and guid of the master key and the dsl_dir object of the
+ * encryption root.  The key object of an encryption root additionally
+ * records how its wrapping key is derived from what the user provides.
+ *
+ * A newly created dataset gets a new master key, wrapped with either a new
+ * wrapping key (making it an encryption root) or the wrapping key of its
+ * parent's encryption root.  Clones, and the temporary datasets created
+ * by rollback and receive, share the key object of their origin instead,
+ * since their blocks were encrypted with it; key objects are refcounted
+ * for that reason.  Changing the wrapping key of an encryption root only
+ * rewraps the master keys of the datasets beneath it, so no user data is
+ * ever rewritten.
+ *
+ * In memory, the keystore of a pool holds three trees:
+ *
+ *  - the loaded wrapping keys, indexed by the dsl_dir of their encryption
+ *    root.  These are added by "zfs load-key" and may only be removed when
+ *    no master key unwrapped with them is still in use.
+ *
+ *  - the unwrapped master keys, indexed by DSL crypto key object.
+ *
+ *  - the key mappings, which map a dataset object to its master key.  The
+ *    zio pipeline finds the key of a block from the objset in its bookmark
+ *    through these.  Mappings are held by the owners of a dataset (see
+ *    dmu_objset_own()) and by each txg in which the dataset has dirty data
+ *    (see dsl_dataset_dirty()), so a key can never go away while there are
+ *    blocks waiting to be encrypted with it.
+ */
+
+static void
+dsl_wrapping_key_hold(dsl_wrapping_key_t *wkey, void *tag)
+{
+	(void) refcount_add(&wkey->wk_refcnt, tag);
+}
+
+static void
+dsl_wrapping_key_rele(dsl_wrapping_key_t *wkey, void *tag)
+{
+	(void) refcount_remove(&wkey->wk_refcnt, tag);
+}
+
+static void
+dsl_wrapping_key_free(dsl_wrapping_key_t *wkey)
+{
+	ASSERT0(refcount_count(&wkey->wk_refcnt));
+
+	bzero(wkey->wk_keydata, WRAPPING_KEY_LEN);
+	refcount_destroy(&wkey->wk_refcnt);
+	kmem_free(wkey, sizeof (dsl_wrapping_key_t));
+}
+
+static dsl_wrapping_key_t *
+dsl_wrapping_key_create(uint8_t *wkeydata, zfs_keyformat_t keyformat,
+    uint64_t salt, uint64_t iters)
+{
+	dsl_wrapping_key_t *wkey;
+
+	wkey = kmem_zalloc(sizeof (dsl_wrapping_key_t), KM_SLEEP);
+	bcopy(wkeydata, wkey->wk_keydata, WRAPPING_KEY_LEN);
+	wkey->wk_key.ck_format = CRYPTO_KEY_RAW;
+	wkey->wk_key.ck_data = wkey->wk_keydata;
+	wkey->wk_key.ck_length = CRYPTO_BYTES2BITS(WRAPPING_KEY_LEN);
+	wkey->wk_keyformat = keyformat;
+	wkey->wk_salt = salt;
+	wkey->wk_iters = iters;
+	refcount_create(&wkey->wk_refcnt);
+
+	return (wkey);
+}
+
+/*
+ * Build the crypto parameters of a create, load-key or change-key request
+ * from its properties and hidden arguments.  The encryption properties
+ * that are stored in the DSL crypto key object rather than as regular
+ * properties are removed from 'props'.
+ */
+int
+dsl_crypto_params_create_nvlist(dcp_cmd_t cmd, nvlist_t *props,
+    nvlist_t *crypto_args, dsl_crypto_params_t **dcp_out)
+{
+	dsl_crypto_params_t *dcp;
+	uint64_t crypt = ZIO_CRYPT_INHERIT;
+	uint64_t keyformat = ZFS_KEYFORMAT_NONE;
+	uint64_t salt = 0, iters = 0;
+	uint8_t *wkeydata = NULL;
+	uint_t wkeydata_len = 0;
+	char *keylocation = NULL;
+
+	if (props != NULL) {
+		(void) nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_ENCRYPTION), &crypt);
+		(void) nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), &keyformat);
+		(void) nvlist_lookup_string(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYLOCATION), &keylocation);
+		(void) nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT), &salt);
+		(void) nvlist_lookup_uint64(props,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS), &iters);
+	}
+
+	if (crypto_args != NULL) {
+		(void) nvlist_lookup_uint8_array(crypto_args, "wkeydata",
+		    &wkeydata, &wkeydata_len);
+	}
+
+	if (crypt >= ZIO_CRYPT_FUNCTIONS || keyformat >= ZFS_KEYFORMAT_FORMATS)
+		return (SET_ERROR(EINVAL));
+
+	if (wkeydata != NULL && wkeydata_len != WRAPPING_KEY_LEN)
+		return (SET_ERROR(EINVAL));
+
+	/* turning encryption off excludes every other encryption parameter */
+	if (crypt == ZIO_CRYPT_OFF && (wkeydata != NULL ||
+	    keyformat != ZFS_KEYFORMAT_NONE ||
+	    (keylocation != NULL && strcmp(keylocation, "none") != 0)))
+		return (SET_ERROR(EINVAL));
+
+	/* a key format is only meaningful along with a key */
+	if (keyformat != ZFS_KEYFORMAT_NONE && wkeydata == NULL)
+		return (SET_ERROR(EINVAL));
+
+	/* pbkdf2 parameters are required for, and only for, passphrases */
+	if (keyformat == ZFS_KEYFORMAT_PASSPHRASE) {
+		if (salt == 0 || iters < MIN_PBKDF2_ITERATIONS)
+			return (SET_ERROR(EINVAL));
+	} else if (salt != 0 || iters != 0) {
+		return (SET_ERROR(EINVAL));
+	}
+
+	switch (cmd) {
+	case DCP_CMD_NONE:
+		if (wkeydata != NULL && keyformat != ZFS_KEYFORMAT_NONE)
+			cmd = DCP_CMD_NEW_KEY;
+		break;
+	case DCP_CMD_NEW_KEY:
+		if (wkeydata == NULL || keyformat == ZFS_KEYFORMAT_NONE ||
+		    crypt != ZIO_CRYPT_INHERIT)
+			return (SET_ERROR(EINVAL));
+		break;
+	case DCP_CMD_INHERIT:
+		if (wkeydata != NULL || crypt != ZIO_CRYPT_INHERIT)
+			return (SET_ERROR(EINVAL));
+		break;
+	default:
+		return (SET_ERROR(EINVAL));
+	}
+
+	if (crypt == ZIO_CRYPT_ON)
+		crypt = ZIO_CRYPT_ON_VALUE;
+
+	dcp = kmem_zalloc(sizeof (dsl_crypto_params_t), KM_SLEEP);
+	dcp->cp_cmd = cmd;
+	dcp->cp_crypt = crypt;
+	if (wkeydata != NULL) {
+		dcp->cp_wkey = dsl_wrapping_key_create(wkeydata, keyformat,
+		    salt, iters);
+	}
+
+	if (props != NULL) {
+		(void) nvlist_remove_all(props,
+		    zfs_prop_to_name(ZFS_PROP_ENCRYPTION));
+		(void) nvlist_remove_all(props,
+		    zfs_prop_to_name(ZFS_PROP_KEYFORMAT));
+		(void) nvlist_remove_all(props,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT));
+		(void) nvlist_remove_all(props,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS));
+	}
+
+	*dcp_out = dcp;
+	return (0);
+}
+
+/*
+ * Free crypto parameters.  Once the wrapping key has been handed to the
+ * keystore it belongs to it, so 'unload' must only be set if the operation
+ * using the parameters did not succeed.
+ */
+void
+dsl_crypto_params_free(dsl_crypto_params_t *dcp, boolean_t unload)
+{
+	if (dcp == NULL)
+		return;
+
+	if (unload && dcp->cp_wkey != NULL)
+		dsl_wrapping_key_free(dcp->cp_wkey);
+
+	kmem_free(dcp, sizeof (dsl_crypto_params_t));
+}
+
+static int
+spa_crypto_key_compare(const void *a, const void *b)
+{
+	const dsl_crypto_key_t *dcka = a;
+	const dsl_crypto_key_t *dckb = b;
+
+	return (AVL_CMP(dcka->dck_obj, dckb->dck_obj));
+}
+
+static int
+spa_key_mapping_compare(const void *a, const void *b)
+{
+	const dsl_key_mapping_t *kma = a;
+	const dsl_key_mapping_t *kmb = b;
+
+	return (AVL_CMP(kma->km_dsobj, kmb->km_dsobj));
+}
+
+static int
+spa_wkey_compare(const void *a, const void *b)
+{
+	const dsl_wrapping_key_t *wka = a;
+	const dsl_wrapping_key_t *wkb = b;
+
+	return (AVL_CMP(wka->wk_ddobj, wkb->wk_ddobj));
+}
+
+void
+spa_keystore_init(spa_keystore_t *sk)
+{
+	rw_init(&sk->sk_dk_lock, NULL, RW_DEFAULT, NULL);
+	rw_init(&sk->sk_km_lock, NULL, RW_DEFAULT, NULL);
+	rw_init(&sk->sk_wkeys_lock, NULL, RW_DEFAULT, NULL);
+	avl_create(&sk->sk_dsl_keys, spa_crypto_key_compare,
+	    sizeof (dsl_crypto_key_t),
+	    offsetof(dsl_crypto_key_t, dck_avl_link));
+	avl_create(&sk->sk_key_mappings, spa_key_mapping_compare,
+	    sizeof (dsl_key_mapping_t),
+	    offsetof(dsl_key_mapping_t, km_avl_link));
+	avl_create(&sk->sk_wkeys, spa_wkey_compare, sizeof (dsl_wrapping_key_t),
+	    offsetof(dsl_wrapping_key_t, wk_avl_link));
+}
+
+/*
+ * By the time the pool is removed all datasets have been disowned, so
+ * only the wrapping keys that were loaded by the user are left.
+ */
+void
+spa_keystore_fini(spa_keystore_t *sk)
+{
+	dsl_wrapping_key_t *wkey;
+	void *cookie = NULL;
+
+	ASSERT(avl_is_empty(&sk->sk_dsl_keys));
+	ASSERT(avl_is_empty(&sk->sk_key_mappings));
+
+	while ((wkey = avl_destroy_nodes(&sk->sk_wkeys, &cookie)) != NULL)
+		dsl_wrapping_key_free(wkey);
+
+	avl_destroy(&sk->sk_wkeys);
+	avl_destroy(&sk->sk_key_mappings);
+	avl_destroy(&sk->sk_dsl_keys);
+	rw_destroy(&sk->sk_wkeys_lock);
+	rw_destroy(&sk->sk_km_lock);
+	rw_destroy(&sk->sk_dk_lock);
+}
+
+int
+dsl_dir_get_encryption_root_ddobj(dsl_dir_t *dd, uint64_t *rddobj)
+{
+	if (dd->dd_crypto_obj == 0)
+		return (SET_ERROR(ENOENT));
+
+	return (zap_lookup(dd->dd_pool->dp_meta_objset, dd->dd_crypto_obj,
+	    DSL_CRYPTO_KEY_ROOT_DDOBJ, sizeof (uint64_t), 1, rddobj));
+}
+
+static int
+spa_keystore_wkey_hold_ddobj_impl(spa_t *spa, uint64_t ddobj, void *tag,
+    dsl_wrapping_key_t **wkey_out)
+{
+	dsl_wrapping_key_t search_wkey;
+	dsl_wrapping_key_t *found_wkey;
+
+	ASSERT(RW_LOCK_HELD(&spa->spa_keystore.sk_wkeys_lock));
+
+	search_wkey.wk_ddobj = ddobj;
+	found_wkey = avl_find(&spa->spa_keystore.sk_wkeys, &search_wkey, NULL);
+	if (found_wkey == NULL)
+		return (SET_ERROR(ENOENT));
+
+	dsl_wrapping_key_hold(found_wkey, tag);
+	*wkey_out = found_wkey;
+	return (0);
+}
+
+/*
+ * Hold the wrapping key that the master key of 'dd' is wrapped with.
+ * Returns EACCES if it has not been loaded.
+ */
+static int
+spa_keystore_wkey_hold_dd(spa_t *spa, dsl_dir_t *dd, void *tag,
+    dsl_wrapping_key_t **wkey_out)
+{
+	uint64_t rddobj;
+	int ret;
+
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &rddobj);
+	if (ret != 0)
+		return (ret);
+
+	rw_enter(&spa->spa_keystore.sk_wkeys_lock, RW_READER);
+	ret = spa_keystore_wkey_hold_ddobj_impl(spa, rddobj, tag, wkey_out);
+	rw_exit(&spa->spa_keystore.sk_wkeys_lock);
+
+	return ((ret == ENOENT) ? SET_ERROR(EACCES) : ret);
+}
+
+zfs_keystatus_t
+dsl_dataset_get_keystatus(dsl_dir_t *dd)
+{
+	dsl_wrapping_key_t *wkey;
+
+	if (dd->dd_crypto_obj == 0)
+		return (ZFS_KEYSTATUS_NONE);
+
+	if (spa_keystore_wkey_hold_dd(dd->dd_pool->dp_spa, dd, FTAG,
+	    &wkey) != 0)
+		return (ZFS_KEYSTATUS_UNAVAILABLE);
+
+	dsl_wrapping_key_rele(wkey, FTAG);
+	return (ZFS_KEYSTATUS_AVAILABLE);
+}
+
+/*
+ * Read the wrapped master key of DSL crypto key object 'dckobj'.
+ */
+static int
+dsl_crypto_key_read(objset_t *mos, uint64_t dckobj, uint64_t *crypt,
+    uint64_t *guid, uint8_t *iv, uint8_t *mac, uint8_t *keydata)
+{
+	int ret;
+
+	ret = zap_lookup(mos, dckobj, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    sizeof (uint64_t), 1, crypt);
+	if (ret != 0)
+		return (ret);
+
+	ret = zap_lookup(mos, dckobj, DSL_CRYPTO_KEY_GUID,
+	    sizeof (uint64_t), 1, guid);
+	if (ret != 0)
+		return (ret);
+
+	ret = zap_lookup(mos, dckobj, DSL_CRYPTO_KEY_IV, 1,
+	    WRAPPING_IV_LEN, iv);
+	if (ret != 0)
+		return (ret);
+
+	ret = zap_lookup(mos, dckobj, DSL_CRYPTO_KEY_MAC, 1,
+	    WRAPPING_MAC_LEN, mac);
+	if (ret != 0)
+		return (ret);
+
+	return (zap_lookup(mos, dckobj, DSL_CRYPTO_KEY_MASTER_KEY, 1,
+	    MASTER_KEY_MAX_LEN, keydata));
+}
+
+/*
+ * Unwrap the master key of DSL crypto key object 'dckobj' with 'wkey'.
+ * A wrong wrapping key results in EACCES.
+ */
+static int
+dsl_crypto_key_unwrap_obj(objset_t *mos, dsl_wrapping_key_t *wkey,
+    uint64_t dckobj, zio_crypt_key_t *key)
+{
+	uint64_t crypt, guid;
+	uint8_t iv[WRAPPING_IV_LEN];
+	uint8_t mac[WRAPPING_MAC_LEN];
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+	int ret;
+
+	ret = dsl_crypto_key_read(mos, dckobj, &crypt, &guid, iv, mac,
+	    keydata);
+	if (ret != 0)
+		return (ret);
+
+	ret = zio_crypt_key_unwrap(&wkey->wk_key, crypt, guid, keydata, iv,
+	    mac, key);
+	bzero(keydata, sizeof (keydata));
+
+	return ((ret == ECKSUM) ? SET_ERROR(EACCES) : ret);
+}
+
+static void
+dsl_crypto_key_free(dsl_crypto_key_t *dck)
+{
+	ASSERT0(refcount_count(&dck->dck_holds));
+
+	if (dck->dck_wkey != NULL)
+		dsl_wrapping_key_rele(dck->dck_wkey, dck);
+
+	zio_crypt_key_destroy(&dck->dck_key);
+	refcount_destroy(&dck->dck_holds);
+	kmem_free(dck, sizeof (dsl_crypto_key_t));
+}
+
+static int
+dsl_crypto_key_open(objset_t *mos, dsl_wrapping_key_t *wkey,
+    uint64_t dckobj, void *tag, dsl_crypto_key_t **dck_out)
+{
+	dsl_crypto_key_t *dck;
+	int ret;
+
+	dck = kmem_zalloc(sizeof (dsl_crypto_key_t), KM_SLEEP);
+
+	ret = dsl_crypto_key_unwrap_obj(mos, wkey, dckobj, &dck->dck_key);
+	if (ret != 0) {
+		kmem_free(dck, sizeof (dsl_crypto_key_t));
+		return (ret);
+	}
+
+	dsl_wrapping_key_hold(wkey, dck);
+	dck->dck_wkey = wkey;
+	dck->dck_obj = dckobj;
+	refcount_create(&dck->dck_holds);
+	(void) refcount_add(&dck->dck_holds, tag);
+
+	*dck_out = dck;
+	return (0);
+}
+
+/*
+ * Hold the master key of 'dd', unwrapping it if it isn't loaded yet.
+ */
+static int
+spa_keystore_dsl_key_hold_dd(spa_t *spa, dsl_dir_t *dd, void *tag,
+    dsl_crypto_key_t **dck_out)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_wrapping_key_t *wkey;
+	dsl_crypto_key_t search_dck;
+	dsl_crypto_key_t *dck;
+	int ret;
+
+	ASSERT(dsl_pool_config_held(dd->dd_pool));
+
+	ret = spa_keystore_wkey_hold_dd(spa, dd, FTAG, &wkey);
+	if (ret != 0)
+		return (ret);
+
+	rw_enter(&sk->sk_dk_lock, RW_WRITER);
+
+	search_dck.dck_obj = dd->dd_crypto_obj;
+	dck = avl_find(&sk->sk_dsl_keys, &search_dck, NULL);
+	if (dck != NULL) {
+		(void) refcount_add(&dck->dck_holds, tag);
+	} else {
+		ret = dsl_crypto_key_open(dd->dd_pool->dp_meta_objset, wkey,
+		    dd->dd_crypto_obj, tag, &dck);
+		if (ret == 0)
+			avl_add(&sk->sk_dsl_keys, dck);
+	}
+
+	rw_exit(&sk->sk_dk_lock);
+	dsl_wrapping_key_rele(wkey, FTAG);
+
+	if (ret == 0)
+		*dck_out = dck;
+	return (ret);
+}
+
+void
+spa_keystore_dsl_key_rele(spa_t *spa, dsl_crypto_key_t *dck, void *tag)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+
+	rw_enter(&sk->sk_dk_lock, RW_WRITER);
+	if (refcount_remove(&dck->dck_holds, tag) == 0) {
+		avl_remove(&sk->sk_dsl_keys, dck);
+		rw_exit(&sk->sk_dk_lock);
+		dsl_crypto_key_free(dck);
+		return;
+	}
+	rw_exit(&sk->sk_dk_lock);
+}
+
+/*
+ * Load the wrapping key of the encryption root 'dsname'.  The key is
+ * verified by unwrapping the master key of the root with it.  With 'noop'
+ * the key is only verified.  On success (and without 'noop') the keystore
+ * takes over the wrapping key of 'dcp'.
+ */
+int
+spa_keystore_load_wkey(const char *dsname, dsl_crypto_params_t *dcp,
+    boolean_t noop)
+{
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	dsl_dir_t *dd;
+	objset_t *mos;
+	spa_keystore_t *sk;
+	dsl_wrapping_key_t *wkey = dcp->cp_wkey;
+	zio_crypt_key_t key;
+	uint64_t rddobj, keyformat;
+	int ret;
+
+	if (wkey == NULL)
+		return (SET_ERROR(EINVAL));
+
+	ret = dsl_pool_hold(dsname, FTAG, &dp);
+	if (ret != 0)
+		return (ret);
+
+	if (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ENCRYPTION)) {
+		dsl_pool_rele(dp, FTAG);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	ret = dsl_dataset_hold(dp, dsname, FTAG, &ds);
+	if (ret != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return (ret);
+	}
+
+	dd = ds->ds_dir;
+	mos = dp->dp_meta_objset;
+	sk = &dp->dp_spa->spa_keystore;
+
+	/* keys may only be loaded for encryption roots */
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &rddobj);
+	if (ret == 0 && rddobj != dd->dd_object)
+		ret = SET_ERROR(EINVAL);
+	if (ret != 0) {
+		ret = (ret == ENOENT) ? SET_ERROR(EINVAL) : ret;
+		goto out;
+	}
+
+	ret = zap_lookup(mos, dd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), sizeof (uint64_t), 1,
+	    &keyformat);
+	if (ret != 0)
+		goto out;
+	wkey->wk_keyformat = keyformat;
+	(void) zap_lookup(mos, dd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT), sizeof (uint64_t), 1,
+	    &wkey->wk_salt);
+	(void) zap_lookup(mos, dd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS), sizeof (uint64_t), 1,
+	    &wkey->wk_iters);
+	wkey->wk_ddobj = dd->dd_object;
+
+	ret = dsl_crypto_key_unwrap_obj(mos, wkey, dd->dd_crypto_obj, &key);
+	if (ret != 0)
+		goto out;
+	zio_crypt_key_destroy(&key);
+
+	if (noop)
+		goto out;
+
+	rw_enter(&sk->sk_wkeys_lock, RW_WRITER);
+	if (avl_find(&sk->sk_wkeys, wkey, NULL) != NULL)
+		ret = SET_ERROR(EEXIST);
+	else
+		avl_add(&sk->sk_wkeys, wkey);
+	rw_exit(&sk->sk_wkeys_lock);
+
+out:
+	dsl_dataset_rele(ds, FTAG);
+	dsl_pool_rele(dp, FTAG);
+	return (ret);
+}
+
+/*
+ * Unload the wrapping key of the encryption root 'dsname'.  This fails
+ * with EBUSY while any dataset using the key is owned, so filesystems must
+ * be unmounted and volumes closed first.
+ */
+int
+spa_keystore_unload_wkey(const char *dsname)
+{
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	spa_t *spa;
+	spa_keystore_t *sk;
+	dsl_wrapping_key_t search_wkey;
+	dsl_wrapping_key_t *wkey;
+	uint64_t rddobj;
+	int ret;
+
+	ret = dsl_pool_hold(dsname, FTAG, &dp);
+	if (ret != 0)
+		return (ret);
+
+	ret = dsl_dataset_hold(dp, dsname, FTAG, &ds);
+	if (ret != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return (ret);
+	}
+
+	ret = dsl_dir_get_encryption_root_ddobj(ds->ds_dir, &rddobj);
+	if (ret == 0 && rddobj != ds->ds_dir->dd_object)
+		ret = SET_ERROR(EINVAL);
+	if (ret == ENOENT)
+		ret = SET_ERROR(EINVAL);
+	dsl_dataset_rele(ds, FTAG);
+
+	spa = dp->dp_spa;
+	spa_open_ref(spa, FTAG);
+	dsl_pool_rele(dp, FTAG);
+	if (ret != 0)
+		goto out;
+
+	/*
+	 * Let the data dirtied by datasets that were just disowned be
+	 * written out, so the mappings its txgs hold are dropped.
+	 */
+	txg_wait_synced(spa_get_dsl(spa), 0);
+
+	sk = &spa->spa_keystore;
+	rw_enter(&sk->sk_wkeys_lock, RW_WRITER);
+	search_wkey.wk_ddobj = rddobj;
+	wkey = avl_find(&sk->sk_wkeys, &search_wkey, NULL);
+	if (wkey == NULL) {
+		ret = SET_ERROR(EACCES);
+	} else if (refcount_count(&wkey->wk_refcnt) != 0) {
+		ret = SET_ERROR(EBUSY);
+	} else {
+		avl_remove(&sk->sk_wkeys, wkey);
+	}
+	rw_exit(&sk->sk_wkeys_lock);
+
+	if (ret == 0)
+		dsl_wrapping_key_free(wkey);
+
+out:
+	spa_close(spa, FTAG);
+	return (ret);
+}
+
+/*
+ * Create the key mapping of dataset 'ds', or add a hold to it if it exists.
+ * Fails with EACCES if the dataset's key isn't loaded.
+ */
+int
+spa_keystore_create_mapping(spa_t *spa, dsl_dataset_t *ds, void *tag)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_key_mapping_t *km, *found_km;
+	avl_index_t where;
+	int ret;
+
+	km = kmem_zalloc(sizeof (dsl_key_mapping_t), KM_SLEEP);
+	refcount_create(&km->km_refcnt);
+	km->km_dsobj = ds->ds_object;
+
+	ret = spa_keystore_dsl_key_hold_dd(spa, ds->ds_dir, km, &km->km_key);
+	if (ret != 0) {
+		refcount_destroy(&km->km_refcnt);
+		kmem_free(km, sizeof (dsl_key_mapping_t));
+		return (ret);
+	}
+
+	rw_enter(&sk->sk_km_lock, RW_WRITER);
+	found_km = avl_find(&sk->sk_key_mappings, km, &where);
+	if (found_km != NULL) {
+		(void) refcount_add(&found_km->km_refcnt, tag);
+	} else {
+		(void) refcount_add(&km->km_refcnt, tag);
+		avl_insert(&sk->sk_key_mappings, km, where);
+	}
+	rw_exit(&sk->sk_km_lock);
+
+	if (found_km != NULL) {
+		spa_keystore_dsl_key_rele(spa, km->km_key, km);
+		refcount_destroy(&km->km_refcnt);
+		kmem_free(km, sizeof (dsl_key_mapping_t));
+	}
+
+	return (0);
+}
+
+/*
+ * Add a hold to the existing key mapping of dataset 'dsobj'.
+ */
+int
+spa_keystore_hold_mapping(spa_t *spa, uint64_t dsobj, void *tag)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_key_mapping_t search_km;
+	dsl_key_mapping_t *km;
+	int ret = 0;
+
+	rw_enter(&sk->sk_km_lock, RW_READER);
+	search_km.km_dsobj = dsobj;
+	km = avl_find(&sk->sk_key_mappings, &search_km, NULL);
+	if (km == NULL)
+		ret = SET_ERROR(ENOENT);
+	else
+		(void) refcount_add(&km->km_refcnt, tag);
+	rw_exit(&sk->sk_km_lock);
+
+	return (ret);
+}
+
+void
+spa_keystore_remove_mapping(spa_t *spa, uint64_t dsobj, void *tag)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_key_mapping_t search_km;
+	dsl_key_mapping_t *km;
+
+	rw_enter(&sk->sk_km_lock, RW_WRITER);
+	search_km.km_dsobj = dsobj;
+	km = avl_find(&sk->sk_key_mappings, &search_km, NULL);
+	VERIFY3P(km, !=, NULL);
+	if (refcount_remove(&km->km_refcnt, tag) != 0) {
+		rw_exit(&sk->sk_km_lock);
+		return;
+	}
+	avl_remove(&sk->sk_key_mappings, km);
+	rw_exit(&sk->sk_km_lock);
+
+	spa_keystore_dsl_key_rele(spa, km->km_key, km);
+	refcount_destroy(&km->km_refcnt);
+	kmem_free(km, sizeof (dsl_key_mapping_t));
+}
+
+/*
+ * Hold the master key that the blocks of dataset 'dsobj' are encrypted
+ * with.  This is what the zio pipeline uses; it fails with EACCES if
+ * there is no mapping for the dataset.
+ */
+int
+spa_keystore_lookup_key(spa_t *spa, uint64_t dsobj, void *tag,
+    dsl_crypto_key_t **dck_out)
+{
+	spa_keystore_t *sk = &spa->spa_keystore;
+	dsl_key_mapping_t search_km;
+	dsl_key_mapping_t *km;
+
+	rw_enter(&sk->sk_km_lock, RW_READER);
+	search_km.km_dsobj = dsobj;
+	km = avl_find(&sk->sk_key_mappings, &search_km, NULL);
+	if (km == NULL) {
+		rw_exit(&sk->sk_km_lock);
+		return (SET_ERROR(EACCES));
+	}
+
+	(void) refcount_add(&km->km_key->dck_holds, tag);
+	*dck_out = km->km_key;
+	rw_exit(&sk->sk_km_lock);
+
+	return (0);
+}
+
+void
+dsl_dataset_crypt_stats(dsl_dataset_t *ds, nvlist_t *nv)
+{
+	dsl_dir_t *dd = ds->ds_dir;
+	dsl_pool_t *dp = dd->dd_pool;
+	objset_t *mos = dp->dp_meta_objset;
+	dsl_dir_t *rdd;
+	uint64_t intval, rddobj;
+	char buf[ZFS_MAX_DATASET_NAME_LEN];
+
+	if (dd->dd_crypto_obj == 0)
+		return;
+
+	if (zap_lookup(mos, dd->dd_crypto_obj, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    sizeof (uint64_t), 1, &intval) == 0)
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_ENCRYPTION, intval);
+
+	dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_KEYSTATUS,
+	    dsl_dataset_get_keystatus(dd));
+
+	if (dsl_dir_get_encryption_root_ddobj(dd, &rddobj) != 0 ||
+	    dsl_dir_hold_obj(dp, rddobj, NULL, FTAG, &rdd) != 0)
+		return;
+
+	dsl_dir_name(rdd, buf);
+	dsl_prop_nvlist_add_string(nv, ZFS_PROP_ENCRYPTION_ROOT, buf);
+
+	if (zap_lookup(mos, rdd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), sizeof (uint64_t), 1,
+	    &intval) == 0)
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_KEYFORMAT, intval);
+	if (zap_lookup(mos, rdd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT), sizeof (uint64_t), 1,
+	    &intval) == 0)
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_PBKDF2_SALT, intval);
+	if (zap_lookup(mos, rdd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS), sizeof (uint64_t), 1,
+	    &intval) == 0)
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_PBKDF2_ITERS, intval);
+
+	dsl_dir_rele(rdd, FTAG);
+}
+
+/*
+ * Check the crypto parameters of a dataset being created under 'parentdd',
+ * as a clone of 'origin' if that is not NULL.
+ */
+int
+dmu_objset_create_crypt_check(dsl_dir_t *parentdd, dsl_dataset_t *origin,
+    dsl_crypto_params_t *dcp)
+{
+	spa_t *spa = parentdd->dd_pool->dp_spa;
+	dcp_cmd_t cmd = (dcp != NULL) ? dcp->cp_cmd : DCP_CMD_NONE;
+	uint64_t crypt = (dcp != NULL) ? dcp->cp_crypt : ZIO_CRYPT_INHERIT;
+	dsl_wrapping_key_t *wkey = (dcp != NULL) ? dcp->cp_wkey : NULL;
+	boolean_t pencrypted = (parentdd->dd_crypto_obj != 0);
+	uint64_t prddobj, ordddobj;
+	int ret;
+
+	/*
+	 * Clones share the key of their origin, and must stay within its
+	 * encryption root so that changing the root's key reaches them.
+	 */
+	if (origin != NULL) {
+		if (cmd != DCP_CMD_NONE || wkey != NULL ||
+		    (crypt != ZIO_CRYPT_INHERIT && crypt != ZIO_CRYPT_OFF))
+			return (SET_ERROR(EINVAL));
+
+		if (origin->ds_dir->dd_crypto_obj == 0)
+			return (pencrypted ? SET_ERROR(EINVAL) : 0);
+
+		if (crypt == ZIO_CRYPT_OFF || !pencrypted)
+			return (SET_ERROR(EINVAL));
+
+		ret = dsl_dir_get_encryption_root_ddobj(parentdd, &prddobj);
+		if (ret != 0)
+			return (ret);
+		ret = dsl_dir_get_encryption_root_ddobj(origin->ds_dir,
+		    &ordddobj);
+		if (ret != 0)
+			return (ret);
+
+		return ((prddobj == ordddobj) ? 0 : SET_ERROR(EINVAL));
+	}
+
+	switch (cmd) {
+	case DCP_CMD_RAW_RECV:
+		if (!spa_feature_is_enabled(spa, SPA_FEATURE_ENCRYPTION))
+			return (SET_ERROR(ENOTSUP));
+		return (0);
+	case DCP_CMD_SHARE_KEY:
+		return (0);
+	case DCP_CMD_NEW_KEY:
+		if (!spa_feature_is_enabled(spa, SPA_FEATURE_ENCRYPTION))
+			return (SET_ERROR(ENOTSUP));
+		if (wkey == NULL || wkey->wk_keyformat == ZFS_KEYFORMAT_NONE)
+			return (SET_ERROR(EINVAL));
+		return (0);
+	case DCP_CMD_NONE:
+		break;
+	default:
+		return (SET_ERROR(EINVAL));
+	}
+
+	/* unencrypted datasets may not be created under encrypted ones */
+	if (crypt == ZIO_CRYPT_OFF)
+		return (pencrypted ? SET_ERROR(EINVAL) : 0);
+
+	/* an explicit suite needs a key, from the user or the parent */
+	if (!pencrypted)
+		return ((crypt == ZIO_CRYPT_INHERIT) ? 0 : SET_ERROR(EINVAL));
+
+	/* the new master key gets wrapped with the parent's wrapping key */
+	ret = spa_keystore_wkey_hold_dd(spa, parentdd, FTAG, &wkey);
+	if (ret != 0)
+		return (ret);
+	dsl_wrapping_key_rele(wkey, FTAG);
+
+	return (0);
+}
+
+static void
+dsl_crypto_key_sync_impl(objset_t *mos, uint64_t dckobj, uint64_t crypt,
+    uint64_t root_ddobj, uint64_t guid, uint8_t *iv, uint8_t *mac,
+    uint8_t *keydata, dmu_tx_t *tx)
+{
+	VERIFY0(zap_update(mos, dckobj, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    sizeof (uint64_t), 1, &crypt, tx));
+	VERIFY0(zap_update(mos, dckobj, DSL_CRYPTO_KEY_ROOT_DDOBJ,
+	    sizeof (uint64_t), 1, &root_ddobj, tx));
+	VERIFY0(zap_update(mos, dckobj, DSL_CRYPTO_KEY_GUID,
+	    sizeof (uint64_t), 1, &guid, tx));
+	VERIFY0(zap_update(mos, dckobj, DSL_CRYPTO_KEY_IV,
+	    1, WRAPPING_IV_LEN, iv, tx));
+	VERIFY0(zap_update(mos, dckobj, DSL_CRYPTO_KEY_MAC,
+	    1, WRAPPING_MAC_LEN, mac, tx));
+	VERIFY0(zap_update(mos, dckobj, DSL_CRYPTO_KEY_MASTER_KEY,
+	    1, MASTER_KEY_MAX_LEN, keydata, tx));
+}
+
+/*
+ * Record (or, with a NULL 'wkey', remove) the wrapping key parameters of
+ * an encryption root in its key object.
+ */
+static void
+dsl_crypto_key_sync_wkey_params(objset_t *mos, uint64_t dckobj,
+    dsl_wrapping_key_t *wkey, dmu_tx_t *tx)
+{
+	const char *keyformat = zfs_prop_to_name(ZFS_PROP_KEYFORMAT);
+	const char *salt = zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT);
+	const char *iters = zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS);
+	uint64_t val;
+
+	if (wkey == NULL) {
+		(void) zap_remove(mos, dckobj, keyformat, tx);
+		(void) zap_remove(mos, dckobj, salt, tx);
+		(void) zap_remove(mos, dckobj, iters, tx);
+		return;
+	}
+
+	val = wkey->wk_keyformat;
+	VERIFY0(zap_update(mos, dckobj, keyformat, sizeof (uint64_t), 1,
+	    &val, tx));
+	VERIFY0(zap_update(mos, dckobj, salt, sizeof (uint64_t), 1,
+	    &wkey->wk_salt, tx));
+	VERIFY0(zap_update(mos, dckobj, iters, sizeof (uint64_t), 1,
+	    &wkey->wk_iters, tx));
+}
+
+/*
+ * Wrap 'key' with 'wkey' and store it in DSL crypto key object 'dckobj'.
+ */
+static void
+dsl_crypto_key_wrap_sync(objset_t *mos, uint64_t dckobj, zio_crypt_key_t *key,
+    dsl_wrapping_key_t *wkey, dmu_tx_t *tx)
+{
+	uint8_t iv[WRAPPING_IV_LEN];
+	uint8_t mac[WRAPPING_MAC_LEN];
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+
+	bzero(keydata, sizeof (keydata));
+	VERIFY0(zio_crypt_key_wrap(&wkey->wk_key, key, iv, mac, keydata));
+	dsl_crypto_key_sync_impl(mos, dckobj, key->zk_crypt, wkey->wk_ddobj,
+	    key->zk_guid, iv, mac, keydata, tx);
+	bzero(keydata, sizeof (keydata));
+}
+
+static uint64_t
+dsl_crypto_key_create_sync(uint64_t crypt, dsl_wrapping_key_t *wkey,
+    dmu_tx_t *tx)
+{
+	objset_t *mos = tx->tx_pool->dp_meta_objset;
+	zio_crypt_key_t key;
+	uint64_t dckobj, one = 1;
+
+	VERIFY0(zio_crypt_key_init(crypt, &key));
+
+	dckobj = zap_create(mos, DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+	dsl_crypto_key_wrap_sync(mos, dckobj, &key, wkey, tx);
+	VERIFY0(zap_add(mos, dckobj, DSL_CRYPTO_KEY_REFCOUNT,
+	    sizeof (uint64_t), 1, &one, tx));
+
+	zio_crypt_key_destroy(&key);
+	return (dckobj);
+}
+
+static void
+dsl_dir_set_crypto_obj_sync(dsl_dir_t *dd, uint64_t dckobj, dmu_tx_t *tx)
+{
+	dsl_dir_zapify(dd, tx);
+	VERIFY0(zap_add(dd->dd_pool->dp_meta_objset, dd->dd_object,
+	    DD_FIELD_CRYPTO_KEY_OBJ, sizeof (uint64_t), 1, &dckobj, tx));
+	dd->dd_crypto_obj = dckobj;
+}
+
+static void
+dsl_crypto_key_share_sync(dsl_dir_t *dd, uint64_t dckobj, dmu_tx_t *tx)
+{
+	VERIFY0(zap_increment(dd->dd_pool->dp_meta_objset, dckobj,
+	    DSL_CRYPTO_KEY_REFCOUNT, 1, tx));
+	dsl_dir_set_crypto_obj_sync(dd, dckobj, tx);
+}
+
+/*
+ * Set up the encryption of new dataset 'dsobj' in the new dsl_dir 'dd',
+ * according to crypto parameters already validated by
+ * dmu_objset_create_crypt_check().
+ */
+void
+dsl_dataset_create_crypt_sync(uint64_t dsobj, dsl_dir_t *dd,
+    dsl_dataset_t *origin, dsl_crypto_params_t *dcp, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = dd->dd_pool;
+	spa_keystore_t *sk = &dp->dp_spa->spa_keystore;
+	dcp_cmd_t cmd = (dcp != NULL) ? dcp->cp_cmd : DCP_CMD_NONE;
+	uint64_t crypt = (dcp != NULL) ? dcp->cp_crypt : ZIO_CRYPT_INHERIT;
+	dsl_dir_t *pdd = dd->dd_parent;
+	dsl_wrapping_key_t *wkey;
+	uint64_t pcrypt;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+	ASSERT0(dd->dd_crypto_obj);
+
+	/* clones get the features of their origin along with its key */
+	if (origin != NULL && origin->ds_dir->dd_crypto_obj != 0) {
+		dsl_crypto_key_share_sync(dd, origin->ds_dir->dd_crypto_obj,
+		    tx);
+		return;
+	}
+
+	/* a raw receive gets its key from the stream later */
+	if (cmd == DCP_CMD_RAW_RECV)
+		return;
+
+	/*
+	 * The temporary clone of a receive into an existing dataset uses
+	 * the key of that dataset, even when it starts from $ORIGIN.
+	 */
+	if (cmd == DCP_CMD_SHARE_KEY) {
+		if (pdd->dd_crypto_obj == 0)
+			return;
+		dsl_crypto_key_share_sync(dd, pdd->dd_crypto_obj, tx);
+		dsl_dataset_activate_feature(dsobj, SPA_FEATURE_ENCRYPTION, tx);
+		return;
+	}
+
+	/* clones of unencrypted origins stay unencrypted */
+	if (origin != NULL)
+		return;
+
+	pcrypt = ZIO_CRYPT_OFF;
+	if (pdd != NULL && pdd->dd_crypto_obj != 0) {
+		VERIFY0(zap_lookup(dp->dp_meta_objset, pdd->dd_crypto_obj,
+		    DSL_CRYPTO_KEY_CRYPTO_SUITE, sizeof (uint64_t), 1,
+		    &pcrypt));
+	}
+
+	if (crypt == ZIO_CRYPT_INHERIT)
+		crypt = pcrypt;
+
+	if (cmd == DCP_CMD_NEW_KEY) {
+		/* the new dataset becomes an encryption root */
+		if (crypt == ZIO_CRYPT_OFF)
+			crypt = ZIO_CRYPT_ON_VALUE;
+		wkey = dcp->cp_wkey;
+		wkey->wk_ddobj = dd->dd_object;
+		dsl_wrapping_key_hold(wkey, FTAG);
+
+		rw_enter(&sk->sk_wkeys_lock, RW_WRITER);
+		avl_add(&sk->sk_wkeys, wkey);
+		rw_exit(&sk->sk_wkeys_lock);
+	} else {
+		/* encryption is inherited from the parent, if it has any */
+		if (crypt == ZIO_CRYPT_OFF)
+			return;
+		VERIFY0(spa_keystore_wkey_hold_dd(dp->dp_spa, pdd, FTAG,
+		    &wkey));
+	}
+
+	dsl_dir_set_crypto_obj_sync(dd, dsl_crypto_key_create_sync(crypt,
+	    wkey, tx), tx);
+	if (cmd == DCP_CMD_NEW_KEY) {
+		dsl_crypto_key_sync_wkey_params(dp->dp_meta_objset,
+		    dd->dd_crypto_obj, wkey, tx);
+	}
+	dsl_wrapping_key_rele(wkey, FTAG);
+
+	dsl_dataset_activate_feature(dsobj, SPA_FEATURE_ENCRYPTION, tx);
+}
+
+/*
+ * An encryption root may not be destroyed while its key object is still
+ * shared, e.g. with a clone that was promoted.
+ */
+int
+dsl_dir_destroy_crypt_check(dsl_dir_t *dd)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	uint64_t rddobj, refcnt;
+	int ret;
+
+	if (dd->dd_crypto_obj == 0)
+		return (0);
+
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &rddobj);
+	if (ret != 0)
+		return (ret);
+	if (rddobj != dd->dd_object)
+		return (0);
+
+	ret = zap_lookup(mos, dd->dd_crypto_obj, DSL_CRYPTO_KEY_REFCOUNT,
+	    sizeof (uint64_t), 1, &refcnt);
+	if (ret != 0)
+		return (ret);
+
+	return ((refcnt > 1) ? SET_ERROR(EBUSY) : 0);
+}
+
+void
+dsl_dir_destroy_crypt(dsl_dir_t *dd, dmu_tx_t *tx)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	spa_keystore_t *sk = &dd->dd_pool->dp_spa->spa_keystore;
+	dsl_wrapping_key_t search_wkey;
+	dsl_wrapping_key_t *wkey;
+	uint64_t refcnt;
+
+	if (dd->dd_crypto_obj == 0)
+		return;
+
+	/*
+	 * Drop the wrapping key of a destroyed encryption root, unless it
+	 * is still in use by loaded keys; those are released on export.
+	 */
+	rw_enter(&sk->sk_wkeys_lock, RW_WRITER);
+	search_wkey.wk_ddobj = dd->dd_object;
+	wkey = avl_find(&sk->sk_wkeys, &search_wkey, NULL);
+	if (wkey != NULL && refcount_count(&wkey->wk_refcnt) == 0)
+		avl_remove(&sk->sk_wkeys, wkey);
+	else
+		wkey = NULL;
+	rw_exit(&sk->sk_wkeys_lock);
+	if (wkey != NULL)
+		dsl_wrapping_key_free(wkey);
+
+	VERIFY0(zap_lookup(mos, dd->dd_crypto_obj, DSL_CRYPTO_KEY_REFCOUNT,
+	    sizeof (uint64_t), 1, &refcnt));
+	if (refcnt == 1) {
+		VERIFY0(zap_destroy(mos, dd->dd_crypto_obj, tx));
+	} else {
+		VERIFY0(zap_increment(mos, dd->dd_crypto_obj,
+		    DSL_CRYPTO_KEY_REFCOUNT, -1, tx));
+	}
+	dd->dd_crypto_obj = 0;
+}
+
+/*
+ * Encrypted datasets may only be moved within their encryption root
+ * (encryption roots themselves may go anywhere) and unencrypted datasets
+ * may not be moved under encrypted ones.
+ */
+int
+dsl_crypt_rename_check(dsl_dir_t *dd, dsl_dir_t *newparent)
+{
+	uint64_t rddobj, prddobj;
+	int ret;
+
+	if (dd->dd_crypto_obj == 0) {
+		return ((newparent->dd_crypto_obj != 0) ?
+		    SET_ERROR(EINVAL) : 0);
+	}
+
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &rddobj);
+	if (ret != 0)
+		return (ret);
+	if (rddobj == dd->dd_object)
+		return (0);
+
+	if (newparent->dd_crypto_obj == 0)
+		return (SET_ERROR(EINVAL));
+
+	ret = dsl_dir_get_encryption_root_ddobj(newparent, &prddobj);
+	if (ret != 0)
+		return (ret);
+
+	return ((rddobj == prddobj) ? 0 : SET_ERROR(EINVAL));
+}
+
+/*
+ * The key location may only be set on encryption roots, and never to
+ * "none" there.
+ */
+int
+dsl_crypto_can_set_keylocation(const char *dsname, const char *keylocation)
+{
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	uint64_t rddobj;
+	int ret;
+
+	ret = dsl_pool_hold(dsname, FTAG, &dp);
+	if (ret != 0)
+		return (ret);
+
+	ret = dsl_dataset_hold(dp, dsname, FTAG, &ds);
+	if (ret != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return (ret);
+	}
+
+	if (ds->ds_dir->dd_crypto_obj == 0) {
+		if (strcmp(keylocation, "none") != 0)
+			ret = SET_ERROR(EINVAL);
+	} else if (dsl_dir_get_encryption_root_ddobj(ds->ds_dir,
+	    &rddobj) != 0 || rddobj != ds->ds_dir->dd_object) {
+		ret = SET_ERROR(EINVAL);
+	} else if (!zfs_prop_valid_keylocation(keylocation, B_TRUE)) {
+		ret = SET_ERROR(EINVAL);
+	}
+
+	dsl_dataset_rele(ds, FTAG);
+	dsl_pool_rele(dp, FTAG);
+	return (ret);
+}
+
+typedef int (dsl_crypt_dir_cb_t)(dsl_dir_t *dd, void *arg, dmu_tx_t *tx);
+
+/*
+ * Call 'func' on 'dd' and every dsl_dir beneath it, stopping at the first
+ * error.
+ */
+static int
+dsl_crypt_walk_dirs(dsl_dir_t *dd, dsl_crypt_dir_cb_t *func, void *arg,
+    dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = dd->dd_pool;
+	zap_cursor_t *zc;
+	zap_attribute_t *za;
+	dsl_dir_t *child;
+	int ret;
+
+	ret = func(dd, arg, tx);
+	if (ret != 0)
+		return (ret);
+
+	zc = kmem_alloc(sizeof (zap_cursor_t), KM_SLEEP);
+	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+
+	for (zap_cursor_init(zc, dp->dp_meta_objset,
+	    dsl_dir_phys(dd)->dd_child_dir_zapobj);
+	    zap_cursor_retrieve(zc, za) == 0; zap_cursor_advance(zc)) {
+		ret = dsl_dir_hold_obj(dp, za->za_first_integer, NULL, FTAG,
+		    &child);
+		if (ret != 0)
+			break;
+		ret = dsl_crypt_walk_dirs(child, func, arg, tx);
+		dsl_dir_rele(child, FTAG);
+		if (ret != 0)
+			break;
+	}
+	zap_cursor_fini(zc);
+
+	kmem_free(za, sizeof (zap_attribute_t));
+	kmem_free(zc, sizeof (zap_cursor_t));
+	return (ret);
+}
+
+typedef struct spa_keystore_change_key_args {
+	const char *skcka_dsname;
+	dsl_crypto_params_t *skcka_cp;
+} spa_keystore_change_key_args_t;
+
+typedef struct dsl_crypt_rewrap_arg {
+	/* encryption root the rewrapped keys currently belong to */
+	uint64_t dcra_old_rddobj;
+	dsl_wrapping_key_t *dcra_old_wkey;
+	dsl_wrapping_key_t *dcra_new_wkey;
+
+	/* key objects in the subtree, each with its number of users there */
+	nvlist_t *dcra_keys;
+} dsl_crypt_rewrap_arg_t;
+
+static void
+dsl_crypt_key_obj_name(uint64_t dckobj, char *buf, size_t len)
+{
+	(void) snprintf(buf, len, "%llx", (u_longlong_t)dckobj);
+}
+
+/* ARGSUSED */
+static int
+dsl_crypt_count_keys_cb(dsl_dir_t *dd, void *arg, dmu_tx_t *tx)
+{
+	dsl_crypt_rewrap_arg_t *dcra = arg;
+	uint64_t rddobj;
+	uint64_t *val;
+	uint64_t newval[2];
+	uint_t len;
+	char name[32];
+	int ret;
+
+	if (dd->dd_crypto_obj == 0)
+		return (0);
+
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &rddobj);
+	if (ret != 0)
+		return (ret);
+	if (rddobj != dcra->dcra_old_rddobj)
+		return (0);
+
+	dsl_crypt_key_obj_name(dd->dd_crypto_obj, name, sizeof (name));
+	newval[0] = dd->dd_crypto_obj;
+	newval[1] = 1;
+	if (nvlist_lookup_uint64_array(dcra->dcra_keys, name, &val,
+	    &len) == 0)
+		newval[1] += val[1];
+	fnvlist_add_uint64_array(dcra->dcra_keys, name, newval, 2);
+
+	return (0);
+}
+
+static int
+dsl_crypt_rewrap_cb(dsl_dir_t *dd, void *arg, dmu_tx_t *tx)
+{
+	dsl_crypt_rewrap_arg_t *dcra = arg;
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	zio_crypt_key_t key;
+	uint64_t rddobj;
+	char name[32];
+
+	if (dd->dd_crypto_obj == 0)
+		return (0);
+
+	/* shared key objects are only rewrapped once */
+	dsl_crypt_key_obj_name(dd->dd_crypto_obj, name, sizeof (name));
+	if (!nvlist_exists(dcra->dcra_keys, name))
+		return (0);
+	VERIFY0(dsl_dir_get_encryption_root_ddobj(dd, &rddobj));
+	ASSERT3U(rddobj, ==, dcra->dcra_old_rddobj);
+
+	VERIFY0(dsl_crypto_key_unwrap_obj(mos, dcra->dcra_old_wkey,
+	    dd->dd_crypto_obj, &key));
+	dsl_crypto_key_wrap_sync(mos, dd->dd_crypto_obj, &key,
+	    dcra->dcra_new_wkey, tx);
+	zio_crypt_key_destroy(&key);
+
+	fnvlist_remove(dcra->dcra_keys, name);
+	return (0);
+}
+
+/*
+ * Hold the dataset whose key is being changed, along with the wrapping
+ * keys involved, and check the keys beneath it.
+ */
+static int
+spa_keystore_change_key_hold(dsl_pool_t *dp,
+    spa_keystore_change_key_args_t *skcka, void *tag, dsl_dataset_t **dsp,
+    dsl_crypt_rewrap_arg_t *dcra)
+{
+	dsl_crypto_params_t *dcp = skcka->skcka_cp;
+	objset_t *mos = dp->dp_meta_objset;
+	spa_t *spa = dp->dp_spa;
+	dsl_dataset_t *ds;
+	dsl_dir_t *dd;
+	nvpair_t *pair;
+	int ret;
+
+	ret = dsl_dataset_hold(dp, skcka->skcka_dsname, tag, &ds);
+	if (ret != 0)
+		return (ret);
+	dd = ds->ds_dir;
+
+	bzero(dcra, sizeof (dsl_crypt_rewrap_arg_t));
+
+	if (dd->dd_crypto_obj == 0) {
+		ret = SET_ERROR(EINVAL);
+		goto error;
+	}
+
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &dcra->dcra_old_rddobj);
+	if (ret != 0)
+		goto error;
+
+	/* the current wrapping key is needed to unwrap the master keys */
+	ret = spa_keystore_wkey_hold_dd(spa, dd, tag, &dcra->dcra_old_wkey);
+	if (ret != 0)
+		goto error;
+
+	if (dcp->cp_cmd == DCP_CMD_INHERIT) {
+		/* only encryption roots can start inheriting their key */
+		if (dcra->dcra_old_rddobj != dd->dd_object ||
+		    dd->dd_parent->dd_crypto_obj == 0) {
+			ret = SET_ERROR(EINVAL);
+			goto error;
+		}
+		ret = spa_keystore_wkey_hold_dd(spa, dd->dd_parent, tag,
+		    &dcra->dcra_new_wkey);
+		if (ret != 0)
+			goto error;
+	} else {
+		ASSERT3U(dcp->cp_cmd, ==, DCP_CMD_NEW_KEY);
+		if (dcp->cp_wkey == NULL ||
+		    dcp->cp_wkey->wk_keyformat == ZFS_KEYFORMAT_NONE) {
+			ret = SET_ERROR(EINVAL);
+			goto error;
+		}
+		dcra->dcra_new_wkey = dcp->cp_wkey;
+		dsl_wrapping_key_hold(dcra->dcra_new_wkey, tag);
+	}
+
+	/*
+	 * Every user of a key object being rewrapped must be beneath 'dd',
+	 * otherwise the users outside of it would end up in a different
+	 * encryption root than the one they are in the namespace.
+	 */
+	dcra->dcra_keys = fnvlist_alloc();
+	ret = dsl_crypt_walk_dirs(dd, dsl_crypt_count_keys_cb, dcra, NULL);
+	for (pair = nvlist_next_nvpair(dcra->dcra_keys, NULL);
+	    ret == 0 && pair != NULL;
+	    pair = nvlist_next_nvpair(dcra->dcra_keys, pair)) {
+		uint64_t *val;
+		uint64_t refcnt;
+		uint_t len;
+
+		VERIFY0(nvpair_value_uint64_array(pair, &val, &len));
+		ret = zap_lookup(mos, val[0], DSL_CRYPTO_KEY_REFCOUNT,
+		    sizeof (uint64_t), 1, &refcnt);
+		if (ret == 0 && refcnt != val[1])
+			ret = SET_ERROR(EBUSY);
+	}
+	if (ret != 0)
+		goto error;
+
+	*dsp = ds;
+	return (0);
+
+error:
+	if (dcra->dcra_keys != NULL)
+		fnvlist_free(dcra->dcra_keys);
+	if (dcra->dcra_new_wkey != NULL)
+		dsl_wrapping_key_rele(dcra->dcra_new_wkey, tag);
+	if (dcra->dcra_old_wkey != NULL)
+		dsl_wrapping_key_rele(dcra->dcra_old_wkey, tag);
+	dsl_dataset_rele(ds, tag);
+	return (ret);
+}
+
+static void
+spa_keystore_change_key_rele(dsl_dataset_t *ds, dsl_crypt_rewrap_arg_t *dcra,
+    void *tag)
+{
+	fnvlist_free(dcra->dcra_keys);
+	dsl_wrapping_key_rele(dcra->dcra_new_wkey, tag);
+	dsl_wrapping_key_rele(dcra->dcra_old_wkey, tag);
+	dsl_dataset_rele(ds, tag);
+}
+
+static int
+spa_keystore_change_key_check(void *arg, dmu_tx_t *tx)
+{
+	spa_keystore_change_key_args_t *skcka = arg;
+	dsl_crypt_rewrap_arg_t dcra;
+	dsl_dataset_t *ds;
+	int ret;
+
+	ret = spa_keystore_change_key_hold(dmu_tx_pool(tx), skcka, FTAG, &ds,
+	    &dcra);
+	if (ret != 0)
+		return (ret);
+
+	spa_keystore_change_key_rele(ds, &dcra, FTAG);
+	return (0);
+}
+
+static void
+spa_keystore_change_key_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_keystore_change_key_args_t *skcka = arg;
+	dsl_crypto_params_t *dcp = skcka->skcka_cp;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	spa_keystore_t *sk = &dp->dp_spa->spa_keystore;
+	dsl_crypt_rewrap_arg_t dcra;
+	dsl_wrapping_key_t *old_wkey, *new_wkey;
+	dsl_crypto_key_t *dck;
+	dsl_dataset_t *ds;
+	dsl_dir_t *dd;
+	nvlist_t *keys;
+	boolean_t free_old_wkey = B_FALSE;
+	char name[32];
+
+	VERIFY0(spa_keystore_change_key_hold(dp, skcka, FTAG, &ds, &dcra));
+	dd = ds->ds_dir;
+	old_wkey = dcra.dcra_old_wkey;
+	new_wkey = dcra.dcra_new_wkey;
+	keys = fnvlist_dup(dcra.dcra_keys);
+
+	if (dcp->cp_cmd == DCP_CMD_NEW_KEY)
+		new_wkey->wk_ddobj = dd->dd_object;
+
+	VERIFY0(dsl_crypt_walk_dirs(dd, dsl_crypt_rewrap_cb, &dcra, tx));
+	ASSERT(nvlist_empty(dcra.dcra_keys));
+
+	dsl_crypto_key_sync_wkey_params(dp->dp_meta_objset, dd->dd_crypto_obj,
+	    (dcp->cp_cmd == DCP_CMD_NEW_KEY) ? new_wkey : NULL, tx);
+
+	/* swap the wrapping key in the keystore */
+	rw_enter(&sk->sk_wkeys_lock, RW_WRITER);
+	if (dcra.dcra_old_rddobj == dd->dd_object) {
+		avl_remove(&sk->sk_wkeys, old_wkey);
+		free_old_wkey = B_TRUE;
+	}
+	if (dcp->cp_cmd == DCP_CMD_NEW_KEY)
+		avl_add(&sk->sk_wkeys, new_wkey);
+	rw_exit(&sk->sk_wkeys_lock);
+
+	/* loaded master keys now belong to the new wrapping key */
+	rw_enter(&sk->sk_dk_lock, RW_WRITER);
+	for (dck = avl_first(&sk->sk_dsl_keys); dck != NULL;
+	    dck = AVL_NEXT(&sk->sk_dsl_keys, dck)) {
+		dsl_crypt_key_obj_name(dck->dck_obj, name, sizeof (name));
+		if (!nvlist_exists(keys, name))
+			continue;
+		ASSERT3P(dck->dck_wkey, ==, old_wkey);
+		dsl_wrapping_key_rele(old_wkey, dck);
+		dsl_wrapping_key_hold(new_wkey, dck);
+		dck->dck_wkey = new_wkey;
+	}
+	rw_exit(&sk->sk_dk_lock);
+
+	spa_history_log_internal_ds(ds, "change-key", tx, "%s",
+	    (dcp->cp_cmd == DCP_CMD_NEW_KEY) ? "new key" : "inherit");
+
+	fnvlist_free(keys);
+	spa_keystore_change_key_rele(ds, &dcra, FTAG);
+
+	if (free_old_wkey)
+		dsl_wrapping_key_free(old_wkey);
+}
+
+/*
+ * Change the wrapping key of 'dsname', either to a new one (making it an
+ * encryption root if it isn't one) or to the one of its parent's
+ * encryption root.  On success with a new key the keystore takes over the
+ * wrapping key of 'dcp'.
+ */
+int
+spa_keystore_change_key(const char *dsname, dsl_crypto_params_t *dcp)
+{
+	spa_keystore_change_key_args_t skcka;
+
+	skcka.skcka_dsname = dsname;
+	skcka.skcka_cp = dcp;
+
+	return (dsl_sync_task(dsname, spa_keystore_change_key_check,
+	    spa_keystore_change_key_sync, &skcka, 1,
+	    ZFS_SPACE_CHECK_RESERVED));
+}
+
+/*
+ * Describe the wrapped key of 'ds' for a raw send stream.
+ */
+int
+dsl_crypto_populate_key_nvlist(dsl_dataset_t *ds, nvlist_t **nvl_out)
+{
+	dsl_dir_t *dd = ds->ds_dir;
+	dsl_pool_t *dp = dd->dd_pool;
+	objset_t *mos = dp->dp_meta_objset;
+	dsl_dir_t *rdd;
+	nvlist_t *nvl;
+	uint64_t crypt, guid, rddobj;
+	uint64_t keyformat = ZFS_KEYFORMAT_NONE, salt = 0, iters = 0;
+	uint8_t iv[WRAPPING_IV_LEN];
+	uint8_t mac[WRAPPING_MAC_LEN];
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+	int ret;
+
+	ASSERT(dsl_pool_config_held(dp));
+
+	if (dd->dd_crypto_obj == 0)
+		return (SET_ERROR(EINVAL));
+
+	ret = dsl_crypto_key_read(mos, dd->dd_crypto_obj, &crypt, &guid, iv,
+	    mac, keydata);
+	if (ret != 0)
+		return (ret);
+
+	ret = dsl_dir_get_encryption_root_ddobj(dd, &rddobj);
+	if (ret != 0)
+		return (ret);
+	ret = dsl_dir_hold_obj(dp, rddobj, NULL, FTAG, &rdd);
+	if (ret != 0)
+		return (ret);
+	(void) zap_lookup(mos, rdd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT), sizeof (uint64_t), 1,
+	    &keyformat);
+	(void) zap_lookup(mos, rdd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT), sizeof (uint64_t), 1,
+	    &salt);
+	(void) zap_lookup(mos, rdd->dd_crypto_obj,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS), sizeof (uint64_t), 1,
+	    &iters);
+	dsl_dir_rele(rdd, FTAG);
+
+	nvl = fnvlist_alloc();
+	fnvlist_add_uint64(nvl, DSL_CRYPTO_KEY_CRYPTO_SUITE, crypt);
+	fnvlist_add_uint64(nvl, DSL_CRYPTO_KEY_GUID, guid);
+	fnvlist_add_uint8_array(nvl, DSL_CRYPTO_KEY_IV, iv, WRAPPING_IV_LEN);
+	fnvlist_add_uint8_array(nvl, DSL_CRYPTO_KEY_MAC, mac,
+	    WRAPPING_MAC_LEN);
+	fnvlist_add_uint8_array(nvl, DSL_CRYPTO_KEY_MASTER_KEY, keydata,
+	    MASTER_KEY_MAX_LEN);
+	fnvlist_add_uint64(nvl, zfs_prop_to_name(ZFS_PROP_KEYFORMAT),
+	    keyformat);
+	fnvlist_add_uint64(nvl, zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT), salt);
+	fnvlist_add_uint64(nvl, zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS),
+	    iters);
+
+	*nvl_out = nvl;
+	return (0);
+}
+
+typedef struct dsl_crypto_recv_key_arg {
+	uint64_t dcrka_dsobj;
+	nvlist_t *dcrka_nvl;
+} dsl_crypto_recv_key_arg_t;
+
+static int
+dsl_crypto_recv_key_check(void *arg, dmu_tx_t *tx)
+{
+	dsl_crypto_recv_key_arg_t *dcrka = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	nvlist_t *nvl = dcrka->dcrka_nvl;
+	dsl_dataset_t *ds;
+	uint64_t crypt, guid, keyformat, dguid;
+	uint8_t *buf;
+	uint_t len;
+	int ret;
+
+	if (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ENCRYPTION))
+		return (SET_ERROR(ENOTSUP));
+
+	if (nvlist_lookup_uint64(nvl, DSL_CRYPTO_KEY_CRYPTO_SUITE,
+	    &crypt) != 0 || crypt >= ZIO_CRYPT_FUNCTIONS ||
+	    zio_crypt_table[crypt].ci_crypt_type == ZC_TYPE_NONE ||
+	    nvlist_lookup_uint64(nvl, DSL_CRYPTO_KEY_GUID, &guid) != 0 ||
+	    nvlist_lookup_uint64(nvl, zfs_prop_to_name(ZFS_PROP_KEYFORMAT),
+	    &keyformat) != 0 || keyformat == ZFS_KEYFORMAT_NONE ||
+	    keyformat >= ZFS_KEYFORMAT_FORMATS ||
+	    nvlist_lookup_uint8_array(nvl, DSL_CRYPTO_KEY_IV, &buf,
+	    &len) != 0 || len != WRAPPING_IV_LEN ||
+	    nvlist_lookup_uint8_array(nvl, DSL_CRYPTO_KEY_MAC, &buf,
+	    &len) != 0 || len != WRAPPING_MAC_LEN ||
+	    nvlist_lookup_uint8_array(nvl, DSL_CRYPTO_KEY_MASTER_KEY, &buf,
+	    &len) != 0 || len != MASTER_KEY_MAX_LEN)
+		return (SET_ERROR(EINVAL));
+
+	ret = dsl_dataset_hold_obj(dp, dcrka->dcrka_dsobj, FTAG, &ds);
+	if (ret != 0)
+		return (ret);
+
+	/* a dataset that already has a key must be receiving that key */
+	if (ds->ds_dir->dd_crypto_obj != 0) {
+		ret = zap_lookup(dp->dp_meta_objset, ds->ds_dir->dd_crypto_obj,
+		    DSL_CRYPTO_KEY_GUID, sizeof (uint64_t), 1, &dguid);
+		if (ret == 0 && dguid != guid)
+			ret = SET_ERROR(EINVAL);
+	}
+
+	dsl_dataset_rele(ds, FTAG);
+	return (ret);
+}
+
+static void
+dsl_crypto_recv_key_sync(void *arg, dmu_tx_t *tx)
+{
+	dsl_crypto_recv_key_arg_t *dcrka = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	objset_t *mos = dp->dp_meta_objset;
+	nvlist_t *nvl = dcrka->dcrka_nvl;
+	dsl_wrapping_key_t wkey;
+	dsl_dataset_t *ds;
+	dsl_dir_t *dd;
+	uint64_t dckobj, one = 1;
+	uint8_t *iv, *mac, *keydata;
+	uint_t len;
+
+	VERIFY0(dsl_dataset_hold_obj(dp, dcrka->dcrka_dsobj, FTAG, &ds));
+	dd = ds->ds_dir;
+	if (dd->dd_crypto_obj != 0) {
+		dsl_dataset_rele(ds, FTAG);
+		return;
+	}
+
+	/* the received dataset becomes an encryption root */
+	VERIFY0(nvlist_lookup_uint8_array(nvl, DSL_CRYPTO_KEY_IV, &iv, &len));
+	VERIFY0(nvlist_lookup_uint8_array(nvl, DSL_CRYPTO_KEY_MAC, &mac,
+	    &len));
+	VERIFY0(nvlist_lookup_uint8_array(nvl, DSL_CRYPTO_KEY_MASTER_KEY,
+	    &keydata, &len));
+
+	dckobj = zap_create(mos, DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+	dsl_crypto_key_sync_impl(mos, dckobj,
+	    fnvlist_lookup_uint64(nvl, DSL_CRYPTO_KEY_CRYPTO_SUITE),
+	    dd->dd_object, fnvlist_lookup_uint64(nvl, DSL_CRYPTO_KEY_GUID),
+	    iv, mac, keydata, tx);
+	VERIFY0(zap_add(mos, dckobj, DSL_CRYPTO_KEY_REFCOUNT,
+	    sizeof (uint64_t), 1, &one, tx));
+
+	bzero(&wkey, sizeof (dsl_wrapping_key_t));
+	wkey.wk_keyformat = fnvlist_lookup_uint64(nvl,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT));
+	wkey.wk_salt = fnvlist_lookup_uint64(nvl,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT));
+	wkey.wk_iters = fnvlist_lookup_uint64(nvl,
+	    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS));
+	dsl_crypto_key_sync_wkey_params(mos, dckobj, &wkey, tx);
+
+	dsl_dir_set_crypto_obj_sync(dd, dckobj, tx);
+	dsl_dataset_activate_feature(ds->ds_object, SPA_FEATURE_ENCRYPTION,
+	    tx);
+	ds->ds_feature_inuse[SPA_FEATURE_ENCRYPTION] = B_TRUE;
+
+	mutex_enter(&ds->ds_opening_lock);
+	if (ds->ds_objset != NULL)
+		ds->ds_objset->os_encrypted = B_TRUE;
+	mutex_exit(&ds->ds_opening_lock);
+
+	dsl_dataset_rele(ds, FTAG);
+}
+
+/*
+ * Apply the key carried by a raw send stream to the dataset it is being
+ * received into.
+ */
+int
+dsl_crypto_recv_key(const char *poolname, uint64_t dsobj, nvlist_t *nvl)
+{
+	dsl_crypto_recv_key_arg_t dcrka;
+
+	dcrka.dcrka_dsobj = dsobj;
+	dcrka.dcrka_nvl = nvl;
+
+	return (dsl_sync_task(poolname, dsl_crypto_recv_key_check,
+	    dsl_crypto_recv_key_sync, &dcrka, 1, ZFS_SPACE_CHECK_NORMAL));
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(dsl_crypto_params_create_nvlist);
+EXPORT_SYMBOL(dsl_crypto_params_free);
+EXPORT_SYMBOL(spa_keystore_load_wkey);
+EXPORT_SYMBOL(spa_keystore_unload_wkey);
+EXPORT_SYMBOL(spa_keystore_change_key);
+EXPORT_SYMBOL(spa_keystore_create_mapping);
+EXPORT_SYMBOL(spa_keystore_remove_mapping);
+EXPORT_SYMBOL(dsl_dataset_get_keystatus);
+EXPORT_SYMBOL(dsl_dir_get_encryption_root_ddobj);
+#endif
@@ -48,6 +48,7 @@
 #include <sys/sa_impl.h>
 #include <sys/zfeature.h>
 #include <sys/abd.h>
+#include <sys/range_tree.h>
 #ifdef _KERNEL
 #include <sys/zfs_vfsops.h>
 #endif
@@ -59,6 +60,7 @@ static scan_cb_t dsl_scan_scrub_cb;
 static void dsl_scan_cancel_sync(void *, dmu_tx_t *);
 static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *);
 static boolean_t dsl_scan_restarting(dsl_scan_t *, dmu_tx_t *);
+static void scan_io_queues_drain(dsl_scan_t *);
 
 int zfs_top_maxinflight = 32;		/* maximum I/Os per top-level */
 int zfs_resilver_delay = 2;		/* number of ticks to delay resilver */
@@ -74,6 +76,42 @@ enum ddt_class zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 int dsl_scan_delay_completion = B_FALSE; /* set to delay scan completion */
 /* max number of blocks to free in a single TXG */
 unsigned long zfs_free_max_blocks = 100000;
+int zfs_scan_legacy = B_FALSE; /* set to issue scrub i/o in logical order */
+int zfs_scan_mem_lim_fact = 20; /* fraction of physmem for sorted scan i/o */
+
+/*
+ * Sorted scrub and resilver.
+ *
+ * Rather than issuing scrub/resilver reads in the logical order in which
+ * dsl_scan_visitbp() discovers block pointers, which on a fragmented pool
+ * is effectively random I/O, the reads are gathered on per top-level vdev
+ * queues sorted by the offset of the block's first DVA.  Each queue also
+ * tracks the queued extents in a range tree.  The queues are drained in
+ * offset order, round-robin across vdevs, when the traversal for the
+ * current txg pauses or when the memory consumed by queued I/Os exceeds
+ * physmem / zfs_scan_mem_lim_fact.  This turns the scan into a mostly
+ * sequential sweep of each vdev which the vdev_queue is then able to
+ * aggregate into large reads.
+ *
+ * The queues are always drained before the scan bookmark is synced so
+ * a paused or interrupted scan resumes exactly as before.
+ */
+typedef struct scan_io {
+	avl_node_t		sio_node;	/* linkage in q_ios */
+	uint64_t		sio_offset;	/* offset of first DVA */
+	uint64_t		sio_asize;	/* asize of first DVA */
+	int			sio_flags;	/* zio flags for the read */
+	blkptr_t		sio_bp;
+	zbookmark_phys_t	sio_zb;
+} scan_io_t;
+
+typedef struct dsl_scan_io_queue {
+	avl_node_t	q_node;		/* linkage in scn_queues */
+	uint64_t	q_vdev;		/* top-level vdev id */
+	kmutex_t	q_lock;		/* protects q_exts */
+	range_tree_t	*q_exts;	/* queued extents on this vdev */
+	avl_tree_t	q_ios;		/* scan_io_t sorted by offset */
+} dsl_scan_io_queue_t;
 
 #define	DSL_SCAN_IS_SCRUB_RESILVER(scn) \
 	((scn)->scn_phys.scn_func == POOL_SCAN_SCRUB || \
@@ -91,6 +129,24 @@ static scan_cb_t *scan_funcs[POOL_SCAN_FUNCS] = {
 	dsl_scan_scrub_cb,	/* POOL_SCAN_RESILVER */
 };
 
+static int
+scan_io_queue_compare(const void *x1, const void *x2)
+{
+	const dsl_scan_io_queue_t *q1 = x1;
+	const dsl_scan_io_queue_t *q2 = x2;
+
+	return (AVL_CMP(q1->q_vdev, q2->q_vdev));
+}
+
+static int
+scan_io_compare(const void *x1, const void *x2)
+{
+	const scan_io_t *sio1 = x1;
+	const scan_io_t *sio2 = x2;
+
+	return (AVL_CMP(sio1->sio_offset, sio2->sio_offset));
+}
+
 int
 dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 {
@@ -101,6 +157,8 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 
 	scn = dp->dp_scan = kmem_zalloc(sizeof (dsl_scan_t), KM_SLEEP);
 	scn->scn_dp = dp;
+	avl_create(&scn->scn_queues, scan_io_queue_compare,
+	    sizeof (dsl_scan_io_queue_t), offsetof(dsl_scan_io_queue_t, q_node));
 
 	/*
 	 * It's possible that we're resuming a scan after a reboot so
@@ -199,6 +257,8 @@ void
 dsl_scan_fini(dsl_pool_t *dp)
 {
 	if (dp->dp_scan) {
+		ASSERT0(avl_numnodes(&dp->dp_scan->scn_queues));
+		avl_destroy(&dp->dp_scan->scn_queues);
 		kmem_free(dp->dp_scan, sizeof (dsl_scan_t));
 		dp->dp_scan = NULL;
 	}
@@ -1709,9 +1769,12 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
 	    NULL, ZIO_FLAG_CANFAIL);
+	scn->scn_sorted = (DSL_SCAN_IS_SCRUB_RESILVER(scn) && !zfs_scan_legacy);
 	dsl_pool_config_enter(dp, FTAG);
 	dsl_scan_visit(scn, tx);
 	dsl_pool_config_exit(dp, FTAG);
+	scan_io_queues_drain(scn);
+	scn->scn_sorted = B_FALSE;
 	(void) zio_wait(scn->scn_zio_root);
 	scn->scn_zio_root = NULL;
 
@@ -1836,17 +1899,193 @@ dsl_scan_scrub_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Issue a single scrub/resilver read, throttled by the number of scan
+ * I/Os already in flight and by recent non-scan pool activity.
+ */
+static void
+scan_exec_io(dsl_pool_t *dp, const blkptr_t *bp, const zbookmark_phys_t *zb,
+    int zio_flags)
+{
+	dsl_scan_t *scn = dp->dp_scan;
+	spa_t *spa = dp->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+	size_t size = BP_GET_PSIZE(bp);
+	int scan_delay;
+
+	scan_delay = (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) ?
+	    zfs_scrub_delay : zfs_resilver_delay;
+
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_inflight >= maxinflight)
+		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+	spa->spa_scrub_inflight++;
+	mutex_exit(&spa->spa_scrub_lock);
+
+	/*
+	 * If we're seeing recent (zfs_scan_idle) "important" I/Os
+	 * then throttle our workload to limit the impact of a scan.
+	 */
+	if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
+		delay(scan_delay);
+
+	zio_nowait(zio_read(NULL, spa, bp,
+	    abd_alloc_for_io(size, B_FALSE), size, dsl_scan_scrub_done,
+	    NULL, ZIO_PRIORITY_SCRUB, zio_flags, zb));
+}
+
+static dsl_scan_io_queue_t *
+scan_io_queue_lookup(dsl_scan_t *scn, uint64_t vdev)
+{
+	dsl_scan_io_queue_t search, *q;
+	avl_index_t where;
+
+	search.q_vdev = vdev;
+	q = avl_find(&scn->scn_queues, &search, &where);
+	if (q != NULL)
+		return (q);
+
+	q = kmem_zalloc(sizeof (dsl_scan_io_queue_t), KM_SLEEP);
+	q->q_vdev = vdev;
+	mutex_init(&q->q_lock, NULL, MUTEX_DEFAULT, NULL);
+	q->q_exts = range_tree_create(NULL, NULL, &q->q_lock);
+	avl_create(&q->q_ios, scan_io_compare, sizeof (scan_io_t),
+	    offsetof(scan_io_t, sio_node));
+	avl_insert(&scn->scn_queues, q, where);
+
+	return (q);
+}
+
+static void
+scan_io_queue_destroy(dsl_scan_io_queue_t *q)
+{
+	ASSERT0(avl_numnodes(&q->q_ios));
+	avl_destroy(&q->q_ios);
+
+	mutex_enter(&q->q_lock);
+	range_tree_vacate(q->q_exts, NULL, NULL);
+	range_tree_destroy(q->q_exts);
+	mutex_exit(&q->q_lock);
+	mutex_destroy(&q->q_lock);
+
+	kmem_free(q, sizeof (dsl_scan_io_queue_t));
+}
+
+/*
+ * Issue every queued scan I/O.  Each queue is consumed in offset order
+ * and the vdevs are serviced round-robin so they are all kept busy.
+ */
+static void
+scan_io_queues_drain(dsl_scan_t *scn)
+{
+	dsl_scan_io_queue_t *q;
+	uint64_t issued = 0, exts = 0;
+	boolean_t more;
+	void *cookie = NULL;
+
+	if (avl_numnodes(&scn->scn_queues) == 0)
+		return;
+
+	for (q = avl_first(&scn->scn_queues); q != NULL;
+	    q = AVL_NEXT(&scn->scn_queues, q))
+		exts += avl_numnodes(&q->q_exts->rt_root);
+
+	do {
+		more = B_FALSE;
+		for (q = avl_first(&scn->scn_queues); q != NULL;
+		    q = AVL_NEXT(&scn->scn_queues, q)) {
+			scan_io_t *sio = avl_first(&q->q_ios);
+
+			if (sio == NULL)
+				continue;
+
+			avl_remove(&q->q_ios, sio);
+			mutex_enter(&q->q_lock);
+			range_tree_clear(q->q_exts, sio->sio_offset,
+			    sio->sio_asize);
+			mutex_exit(&q->q_lock);
+
+			scan_exec_io(scn->scn_dp, &sio->sio_bp, &sio->sio_zb,
+			    sio->sio_flags);
+			kmem_free(sio, sizeof (scan_io_t));
+			issued++;
+			more = B_TRUE;
+		}
+	} while (more);
+
+	while ((q = avl_destroy_nodes(&scn->scn_queues, &cookie)) != NULL)
+		scan_io_queue_destroy(q);
+	scn->scn_queues_mem = 0;
+
+	zfs_dbgmsg("issued %llu sorted scan i/os in %llu extents",
+	    (longlong_t)issued, (longlong_t)exts);
+}
+
+/*
+ * Queue a scrub/resilver read on the queue of the top-level vdev holding
+ * its first DVA.  Reads which would overlap an already queued extent are
+ * issued immediately.
+ */
+static void
+scan_io_queue_insert(dsl_scan_t *scn, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, int zio_flags)
+{
+	const dva_t *dva = &bp->blk_dva[0];
+	dsl_scan_io_queue_t *q;
+	scan_io_t *sio, *prev, *next;
+	avl_index_t where;
+	uint64_t limit;
+
+	sio = kmem_zalloc(sizeof (scan_io_t), KM_SLEEP);
+	sio->sio_offset = DVA_GET_OFFSET(dva);
+	sio->sio_asize = DVA_GET_ASIZE(dva);
+	sio->sio_flags = zio_flags;
+	sio->sio_bp = *bp;
+	sio->sio_zb = *zb;
+
+	q = scan_io_queue_lookup(scn, DVA_GET_VDEV(dva));
+
+	/*
+	 * An exact match leaves 'where' unset, and overlaps in any case.
+	 */
+	if (avl_find(&q->q_ios, sio, &where) != NULL) {
+		kmem_free(sio, sizeof (scan_io_t));
+		scan_exec_io(scn->scn_dp, bp, zb, zio_flags);
+		return;
+	}
+
+	prev = avl_nearest(&q->q_ios, where, AVL_BEFORE);
+	next = avl_nearest(&q->q_ios, where, AVL_AFTER);
+	if ((prev != NULL &&
+	    prev->sio_offset + prev->sio_asize > sio->sio_offset) ||
+	    (next != NULL &&
+	    sio->sio_offset + sio->sio_asize > next->sio_offset)) {
+		kmem_free(sio, sizeof (scan_io_t));
+		scan_exec_io(scn->scn_dp, bp, zb, zio_flags);
+		return;
+	}
+
+	avl_insert(&q->q_ios, sio, where);
+	mutex_enter(&q->q_lock);
+	range_tree_add(q->q_exts, sio->sio_offset, sio->sio_asize);
+	mutex_exit(&q->q_lock);
+	scn->scn_queues_mem += sizeof (scan_io_t);
+
+	limit = (physmem * PAGESIZE) / MAX(zfs_scan_mem_lim_fact, 1);
+	if (scn->scn_queues_mem > limit)
+		scan_io_queues_drain(scn);
+}
+
 static int
 dsl_scan_scrub_cb(dsl_pool_t *dp,
     const blkptr_t *bp, const zbookmark_phys_t *zb)
 {
 	dsl_scan_t *scn = dp->dp_scan;
-	size_t size = BP_GET_PSIZE(bp);
 	spa_t *spa = dp->dp_spa;
 	uint64_t phys_birth = BP_PHYSICAL_BIRTH(bp);
 	boolean_t needs_io = B_FALSE;
 	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
-	int scan_delay = 0;
 	int d;
 
 	if (phys_birth <= scn->scn_phys.scn_min_txg ||
@@ -1862,12 +2101,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	if (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) {
 		zio_flags |= ZIO_FLAG_SCRUB;
 		needs_io = B_TRUE;
-		scan_delay = zfs_scrub_delay;
 	} else {
 		ASSERT3U(scn->scn_phys.scn_func, ==, POOL_SCAN_RESILVER);
 		zio_flags |= ZIO_FLAG_RESILVER;
 		needs_io = B_FALSE;
-		scan_delay = zfs_resilver_delay;
 	}
 
 	/* If it's an intent log block, failure is expected. */
@@ -1897,6 +2134,12 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 				 * gang members reside on the same vdev.
 				 */
 				needs_io = B_TRUE;
+			} else if (vd->vdev_ops == &vdev_indirect_ops) {
+				/*
+				 * The copies of the segments of a removed
+				 * vdev may be anywhere, like gang members.
+				 */
+				needs_io = B_TRUE;
 			} else {
 				needs_io = vdev_dtl_contains(vd, DTL_PARTIAL,
 				    phys_birth, 1);
@@ -1905,25 +2148,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	}
 
 	if (needs_io && !zfs_no_scrub_io) {
-		vdev_t *rvd = spa->spa_root_vdev;
-		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
-
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight >= maxinflight)
-			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
-		spa->spa_scrub_inflight++;
-		mutex_exit(&spa->spa_scrub_lock);
-
-		/*
-		 * If we're seeing recent (zfs_scan_idle) "important" I/Os
-		 * then throttle our workload to limit the impact of a scan.
-		 */
-		if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
-			delay(scan_delay);
-
-		zio_nowait(zio_read(NULL, spa, bp,
-		    abd_alloc_for_io(size, B_FALSE), size, dsl_scan_scrub_done,
-		    NULL, ZIO_PRIORITY_SCRUB, zio_flags, zb));
+		if (scn->scn_sorted)
+			scan_io_queue_insert(scn, bp, zb, zio_flags);
+		else
+			scan_exec_io(dp, bp, zb, zio_flags);
 	}
 
 	/* do not relocate this block */
@@ -1993,4 +2221,10 @@ MODULE_PARM_DESC(zfs_free_max_blocks, "Max number of blocks freed in one txg");
 
 module_param(zfs_free_bpobj_enabled, int, 0644);
 MODULE_PARM_DESC(zfs_free_bpobj_enabled, "Enable processing of the free_bpobj");
+
+module_param(zfs_scan_legacy, int, 0644);
+MODULE_PARM_DESC(zfs_scan_legacy, "Issue scrub/resilver I/O in logical order");
+
+module_param(zfs_scan_mem_lim_fact, int, 0644);
+MODULE_PARM_DESC(zfs_scan_mem_lim_fact, "Fraction of RAM for sorted scan I/O");
 #endif
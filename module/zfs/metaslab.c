@@ -32,6 +32,9 @@
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 #include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/vdev_removal.h>
 #include <sys/zfeature.h>
 
 #define	WITH_DF_BLOCK_ALLOCATOR
@@ -180,6 +183,12 @@ int zfs_metaslab_segment_weight_enabled = B_TRUE;
  */
 int zfs_metaslab_switch_threshold = 2;
 
+/*
+ * Freed segments smaller than this are not worth discarding.  Rather than
+ * being trimmed they are returned to the metaslab's free tree right away.
+ */
+int zfs_trim_extent_bytes_min = 32 << 10;
+
 /*
  * Internal switch to enable/disable the metaslab allocation tracing
  * facility.
@@ -467,8 +476,8 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 	    !msp->ms_loaded)
 		return;
 
-	sm_free_space = msp->ms_size - space_map_allocated(msp->ms_sm) -
-	    space_map_alloc_delta(msp->ms_sm);
+	sm_free_space = msp->ms_size - msp->ms_allocated_space -
+	    msp->ms_allocated_this_txg;
 
 	/*
 	 * Account for future allocations since we would have already
@@ -480,7 +489,9 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 	}
 
 	msp_free_space = range_tree_space(msp->ms_tree) + allocated +
-	    msp->ms_deferspace + range_tree_space(msp->ms_freedtree);
+	    msp->ms_deferspace + range_tree_space(msp->ms_freedtree) +
+	    range_tree_space(msp->ms_trim) +
+	    range_tree_space(msp->ms_trimming);
 
 	VERIFY3U(sm_free_space, ==, msp_free_space);
 }
@@ -1373,10 +1384,33 @@ metaslab_load(metaslab_t *msp)
 		ASSERT3P(msp->ms_group, !=, NULL);
 		msp->ms_loaded = B_TRUE;
 
+		/*
+		 * Apply the changes that are still only in the log space
+		 * maps.  Those include the frees of the txg being synced,
+		 * which must not be allocatable before it's done syncing.
+		 */
+		range_tree_walk(msp->ms_unflushed_allocs,
+		    range_tree_remove, msp->ms_tree);
+		range_tree_walk(msp->ms_unflushed_frees,
+		    range_tree_add, msp->ms_tree);
+		if (msp->ms_freedtree != NULL) {
+			avl_tree_t *freed = &msp->ms_freedtree->rt_root;
+			range_seg_t *rs;
+
+			for (rs = avl_first(freed); rs != NULL;
+			    rs = AVL_NEXT(freed, rs)) {
+				range_tree_clear(msp->ms_tree, rs->rs_start,
+				    rs->rs_end - rs->rs_start);
+			}
+		}
+
 		for (t = 0; t < TXG_DEFER_SIZE; t++) {
 			range_tree_walk(msp->ms_defertree[t],
 			    range_tree_remove, msp->ms_tree);
 		}
+		range_tree_walk(msp->ms_trim, range_tree_remove, msp->ms_tree);
+		range_tree_walk(msp->ms_trimming,
+		    range_tree_remove, msp->ms_tree);
 		msp->ms_max_size = metaslab_block_maxsize(msp);
 	}
 	cv_broadcast(&msp->ms_load_cv);
@@ -1393,6 +1427,95 @@ metaslab_unload(metaslab_t *msp)
 	msp->ms_max_size = 0;
 }
 
+/*
+ * Whether the changes of this metaslab go to the log space maps.
+ */
+static boolean_t
+metaslab_unflushed_enabled(metaslab_t *msp)
+{
+	return (spa_log_sm_vdev_enabled(msp->ms_group->mg_vd));
+}
+
+/*
+ * Number of segments in the metaslab's unflushed trees, which bounds the
+ * memory they take and is what spa_log_sm_segs_update() accounts.
+ */
+static int64_t
+metaslab_unflushed_segs(metaslab_t *msp)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	return (avl_numnodes(&msp->ms_unflushed_allocs->rt_root) +
+	    avl_numnodes(&msp->ms_unflushed_frees->rt_root));
+}
+
+/*
+ * The changes in the unflushed trees have reached ms_sm; drop them.
+ */
+static void
+metaslab_unflushed_vacate(spa_t *spa, metaslab_t *msp)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	spa_log_sm_segs_update(spa, -metaslab_unflushed_segs(msp));
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+}
+
+/*
+ * Fold changes that went to a log space map into the unflushed trees.
+ * An allocation of space freed since the last flush cancels the free,
+ * and vice versa, so the two trees stay disjoint.
+ */
+static void
+metaslab_unflushed_add(spa_t *spa, metaslab_t *msp, maptype_t type,
+    range_tree_t *rt)
+{
+	int64_t segs = metaslab_unflushed_segs(msp);
+
+	if (type == SM_ALLOC) {
+		range_tree_remove_xor_add(rt, msp->ms_unflushed_frees,
+		    msp->ms_unflushed_allocs);
+	} else {
+		range_tree_remove_xor_add(rt, msp->ms_unflushed_allocs,
+		    msp->ms_unflushed_frees);
+	}
+	spa_log_sm_segs_update(spa, metaslab_unflushed_segs(msp) - segs);
+}
+
+/*
+ * Apply an entry of a log space map while opening the pool.  Only entries
+ * logged after the metaslab's last flush are passed in.
+ */
+void
+metaslab_unflushed_replay(metaslab_t *msp, maptype_t type, uint64_t start,
+    uint64_t size)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	int64_t segs;
+
+	mutex_enter(&msp->ms_lock);
+	segs = metaslab_unflushed_segs(msp);
+	if (type == SM_ALLOC) {
+		range_tree_remove_xor_add_segment(start, size,
+		    msp->ms_unflushed_frees, msp->ms_unflushed_allocs);
+		msp->ms_allocated_space += size;
+		vdev_space_update(vd, size, 0, 0);
+		if (msp->ms_loaded)
+			range_tree_remove(msp->ms_tree, start, size);
+	} else {
+		range_tree_remove_xor_add_segment(start, size,
+		    msp->ms_unflushed_allocs, msp->ms_unflushed_frees);
+		msp->ms_allocated_space -= size;
+		vdev_space_update(vd, -size, 0, 0);
+		if (msp->ms_loaded)
+			range_tree_add(msp->ms_tree, start, size);
+	}
+	spa_log_sm_segs_update(spa, metaslab_unflushed_segs(msp) - segs);
+	mutex_exit(&msp->ms_lock);
+}
+
 int
 metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
     metaslab_t **msp)
@@ -1405,6 +1528,7 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	ms = kmem_zalloc(sizeof (metaslab_t), KM_SLEEP);
 	mutex_init(&ms->ms_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&ms->ms_load_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&ms->ms_trim_cv, NULL, CV_DEFAULT, NULL);
 	ms->ms_id = id;
 	ms->ms_start = id << vd->vdev_ms_shift;
 	ms->ms_size = 1ULL << vd->vdev_ms_shift;
@@ -1425,6 +1549,21 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 		ASSERT(ms->ms_sm != NULL);
 	}
 
+	/*
+	 * When opening an existing pool, find out which of the logged
+	 * changes this metaslab's space map already reflects; the rest
+	 * are replayed by spa_ld_log_spacemaps().
+	 */
+	if (txg == 0) {
+		error = metaslab_unflushed_txg_load(vd, id,
+		    &ms->ms_unflushed_txg);
+		if (error != 0) {
+			space_map_close(ms->ms_sm);
+			kmem_free(ms, sizeof (metaslab_t));
+			return (error);
+		}
+	}
+
 	/*
 	 * We create the main range tree here, but we don't create the
 	 * other range trees until metaslab_sync_done().  This serves
@@ -1433,9 +1572,14 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
 	ms->ms_tree = range_tree_create(&metaslab_rt_ops, ms, &ms->ms_lock);
+	ms->ms_trim = range_tree_create(NULL, ms, &ms->ms_lock);
+	ms->ms_trimming = range_tree_create(NULL, ms, &ms->ms_lock);
+	ms->ms_unflushed_allocs = range_tree_create(NULL, ms, &ms->ms_lock);
+	ms->ms_unflushed_frees = range_tree_create(NULL, ms, &ms->ms_lock);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
+	ms->ms_allocated_this_txg = space_map_alloc_delta(ms->ms_sm);
 
 	/*
 	 * If we're opening an existing pool (txg == 0) or creating
@@ -1476,19 +1620,41 @@ metaslab_fini(metaslab_t *msp)
 	int t;
 
 	metaslab_group_t *mg = msp->ms_group;
+	spa_t *spa = mg->mg_vd->vdev_spa;
+
+	/*
+	 * Drop the pending trims so no further batch is issued once the
+	 * metaslab has left its group.
+	 */
+	mutex_enter(&msp->ms_lock);
+	range_tree_vacate(msp->ms_trim, NULL, NULL);
+	mutex_exit(&msp->ms_lock);
 
+	spa_log_sm_untrack_metaslab(msp);
 	metaslab_group_remove(mg, msp);
 
 	mutex_enter(&msp->ms_lock);
 	VERIFY(msp->ms_group == NULL);
-	vdev_space_update(mg->mg_vd, -space_map_allocated(msp->ms_sm),
+
+	/*
+	 * Wait for any trims in flight, their completion references msp.
+	 */
+	while (range_tree_space(msp->ms_trimming) != 0)
+		cv_wait(&msp->ms_trim_cv, &msp->ms_lock);
+
+	vdev_space_update(mg->mg_vd, -msp->ms_allocated_space,
 	    0, -msp->ms_size);
 	space_map_close(msp->ms_sm);
 
 	metaslab_unload(msp);
+	metaslab_unflushed_vacate(spa, msp);
+	range_tree_destroy(msp->ms_unflushed_allocs);
+	range_tree_destroy(msp->ms_unflushed_frees);
 	range_tree_destroy(msp->ms_tree);
 	range_tree_destroy(msp->ms_freeingtree);
 	range_tree_destroy(msp->ms_freedtree);
+	range_tree_destroy(msp->ms_trim);
+	range_tree_destroy(msp->ms_trimming);
 
 	for (t = 0; t < TXG_SIZE; t++) {
 		range_tree_destroy(msp->ms_alloctree[t]);
@@ -1502,6 +1668,7 @@ metaslab_fini(metaslab_t *msp)
 
 	mutex_exit(&msp->ms_lock);
 	cv_destroy(&msp->ms_load_cv);
+	cv_destroy(&msp->ms_trim_cv);
 	mutex_destroy(&msp->ms_lock);
 
 	kmem_free(msp, sizeof (metaslab_t));
@@ -1638,7 +1805,7 @@ metaslab_space_weight(metaslab_t *msp)
 	/*
 	 * The baseline weight is the metaslab's free space.
 	 */
-	space = msp->ms_size - space_map_allocated(msp->ms_sm);
+	space = msp->ms_size - msp->ms_allocated_space;
 
 	if (metaslab_fragmentation_factor_enabled &&
 	    msp->ms_fragmentation != ZFS_FRAG_INVALID) {
@@ -1775,7 +1942,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * The metaslab is completely free.
 	 */
-	if (space_map_allocated(msp->ms_sm) == 0) {
+	if (msp->ms_allocated_space == 0) {
 		int idx = highbit64(msp->ms_size) - 1;
 		int max_idx = SPACE_MAP_HISTOGRAM_SIZE + shift - 1;
 
@@ -1797,7 +1964,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * If the metaslab is fully allocated then just make the weight 0.
 	 */
-	if (space_map_allocated(msp->ms_sm) == msp->ms_size)
+	if (msp->ms_allocated_space == msp->ms_size)
 		return (0);
 	/*
 	 * If the metaslab is already loaded, then use the range tree to
@@ -1865,11 +2032,8 @@ metaslab_weight(metaslab_t *msp)
 	 * This vdev is in the process of being removed so there is nothing
 	 * for us to do here.
 	 */
-	if (vd->vdev_removing) {
-		ASSERT0(space_map_allocated(msp->ms_sm));
-		ASSERT0(vd->vdev_ms_shift);
+	if (vd->vdev_removing)
 		return (0);
-	}
 
 	metaslab_set_fragmentation(msp);
 
@@ -1895,6 +2059,17 @@ metaslab_weight(metaslab_t *msp)
 	return (weight);
 }
 
+/*
+ * Recompute the weight of the metaslab and reposition it in its group.
+ */
+void
+metaslab_recalculate_weight_and_sort(metaslab_t *msp)
+{
+	mutex_enter(&msp->ms_lock);
+	metaslab_group_sort(msp->ms_group, msp, metaslab_weight(msp));
+	mutex_exit(&msp->ms_lock);
+}
+
 static int
 metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
 {
@@ -2068,6 +2243,13 @@ metaslab_should_condense(metaslab_t *msp)
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 	ASSERT(msp->ms_loaded);
 
+	/*
+	 * Completed trims return their ranges to the ms_tree, which must
+	 * not change while the condensed space map is being written.
+	 */
+	if (range_tree_space(msp->ms_trimming) != 0)
+		return (B_FALSE);
+
 	/*
 	 * Use the ms_size_tree range tree, which is ordered by size, to
 	 * obtain the largest segment in the free tree. We always condense
@@ -2115,6 +2297,7 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 	ASSERT3U(spa_sync_pass(spa), ==, 1);
 	ASSERT(msp->ms_loaded);
+	ASSERT0(range_tree_space(msp->ms_trimming));
 
 
 	spa_dbgmsg(spa, "condensing: txg %llu, msp[%llu] %p, vdev id %llu, "
@@ -2183,6 +2366,7 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	range_tree_destroy(condense_tree);
 
 	space_map_write(sm, msp->ms_tree, SM_FREE, tx);
+	space_map_write(sm, msp->ms_trim, SM_FREE, tx);
 	msp->ms_condensing = B_FALSE;
 }
 
@@ -2197,6 +2381,8 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	spa_t *spa = vd->vdev_spa;
 	objset_t *mos = spa_meta_objset(spa);
 	range_tree_t *alloctree = msp->ms_alloctree[txg & TXG_MASK];
+	space_map_t *log_sm = NULL;
+	boolean_t unflushed, flush, flushed = B_FALSE;
 	dmu_tx_t *tx;
 	uint64_t object = space_map_object(msp->ms_sm);
 
@@ -2217,11 +2403,11 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	/*
 	 * Normally, we don't want to process a metaslab if there
 	 * are no allocations or frees to perform. However, if the metaslab
-	 * is being forced to condense we need to let it through.
+	 * is being forced to condense or flushed we need to let it through.
 	 */
 	if (range_tree_space(alloctree) == 0 &&
 	    range_tree_space(msp->ms_freeingtree) == 0 &&
-	    !msp->ms_condense_wanted)
+	    !msp->ms_condense_wanted && !msp->ms_flush_wanted)
 		return;
 
 	/*
@@ -2239,7 +2425,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	if (msp->ms_sm == NULL) {
 		uint64_t new_object;
 
-		new_object = space_map_alloc(mos, tx);
+		new_object = space_map_alloc(mos, space_map_blksz, tx);
 		VERIFY3U(new_object, !=, 0);
 
 		VERIFY0(space_map_open(&msp->ms_sm, mos, new_object,
@@ -2248,6 +2434,25 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		ASSERT(msp->ms_sm != NULL);
 	}
 
+	/*
+	 * With log space maps, the changes of this txg go to the pool-wide
+	 * log rather than to ms_sm, unless the metaslab is being flushed,
+	 * or condensed, which amounts to the same.  Once flushed in a txg,
+	 * the later sync passes write to ms_sm directly: the log of this
+	 * txg is no longer replayed for the metaslab.
+	 */
+	unflushed = B_FALSE;
+	flush = B_FALSE;
+	if (metaslab_unflushed_enabled(msp)) {
+		if (!msp->ms_unflushed_tracked)
+			spa_log_sm_track_metaslab(msp, txg - 1);
+		unflushed = (msp->ms_unflushed_txg != txg);
+		flush = (unflushed && msp->ms_flush_wanted &&
+		    spa_sync_pass(spa) == 1);
+		if (unflushed && !flush)
+			log_sm = spa_log_sm_syncing(spa, tx);
+	}
+
 	mutex_enter(&msp->ms_lock);
 
 	/*
@@ -2262,11 +2467,36 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	if (msp->ms_loaded && spa_sync_pass(spa) == 1 &&
 	    metaslab_should_condense(msp)) {
 		metaslab_condense(msp, txg, tx);
+		flushed = unflushed;
+	} else if (log_sm != NULL) {
+		space_map_write_log(log_sm, alloctree, SM_ALLOC,
+		    vd->vdev_id, tx);
+		space_map_write_log(log_sm, msp->ms_freeingtree, SM_FREE,
+		    vd->vdev_id, tx);
+		metaslab_unflushed_add(spa, msp, SM_ALLOC, alloctree);
+		metaslab_unflushed_add(spa, msp, SM_FREE, msp->ms_freeingtree);
 	} else {
+		/*
+		 * A flush first writes out the changes logged since the
+		 * previous one, the in-core trees are vacated once this
+		 * txg is synced.
+		 */
+		if (flush) {
+			space_map_write(msp->ms_sm, msp->ms_unflushed_allocs,
+			    SM_ALLOC, tx);
+			space_map_write(msp->ms_sm, msp->ms_unflushed_frees,
+			    SM_FREE, tx);
+			flushed = B_TRUE;
+		}
 		space_map_write(msp->ms_sm, alloctree, SM_ALLOC, tx);
 		space_map_write(msp->ms_sm, msp->ms_freeingtree, SM_FREE, tx);
 	}
 
+	if (flushed)
+		spa_log_sm_metaslab_flushed(msp, tx);
+	msp->ms_allocated_this_txg += range_tree_space(alloctree) -
+	    range_tree_space(msp->ms_freeingtree);
+
 	if (msp->ms_loaded) {
 		int t;
 
@@ -2299,6 +2529,12 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 			space_map_histogram_add(msp->ms_sm,
 			    msp->ms_defertree[t], tx);
 		}
+
+		/*
+		 * Likewise for free space waiting to be trimmed.
+		 */
+		space_map_histogram_add(msp->ms_sm, msp->ms_trim, tx);
+		space_map_histogram_add(msp->ms_sm, msp->ms_trimming, tx);
 	}
 
 	/*
@@ -2339,9 +2575,136 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
 		    msp->ms_id, sizeof (uint64_t), &object, tx);
 	}
+	if (flushed)
+		metaslab_unflushed_txg_sync(msp, tx);
 	dmu_tx_commit(tx);
 }
 
+static zio_t *metaslab_trim_issue(metaslab_t *msp);
+
+/*
+ * Return the ranges of a completed batch of trims to the free tree, and
+ * issue the next batch if more space was freed in the meantime.
+ */
+static void
+metaslab_trim_done(zio_t *zio)
+{
+	metaslab_t *msp = zio->io_private;
+	zio_t *trim_zio = NULL;
+
+	spa_config_exit(zio->io_spa, SCL_ZIO, msp);
+
+	mutex_enter(&msp->ms_lock);
+	range_tree_vacate(msp->ms_trimming,
+	    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
+	if (range_tree_space(msp->ms_trim) != 0)
+		trim_zio = metaslab_trim_issue(msp);
+	if (trim_zio == NULL)
+		cv_broadcast(&msp->ms_trim_cv);
+	mutex_exit(&msp->ms_lock);
+
+	if (trim_zio != NULL)
+		zio_nowait(trim_zio);
+}
+
+/*
+ * Issue trims for the ranges pending in the ms_trim and return the root
+ * zio, which the caller must zio_nowait() once it has dropped the ms_lock.
+ * Only one batch of trims is in flight per metaslab, space freed in the
+ * meantime stays pending and is merged into larger extents for the next
+ * batch.  Returns NULL when nothing was issued.
+ */
+static zio_t *
+metaslab_trim_issue(metaslab_t *msp)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	avl_tree_t *t;
+	range_seg_t *rs;
+	zio_t *zio;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT0(range_tree_space(msp->ms_trimming));
+
+	/*
+	 * The trims keep the vdev tree from changing until they complete.
+	 * If a configuration change is waiting don't hold it up, the ranges
+	 * are simply trimmed in a later txg.
+	 */
+	if (!spa_config_tryenter(spa, SCL_ZIO, msp, RW_READER))
+		return (NULL);
+
+	t = &msp->ms_trim->rt_root;
+	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
+		uint64_t size = rs->rs_end - rs->rs_start;
+
+		if (size >= zfs_trim_extent_bytes_min)
+			range_tree_add(msp->ms_trimming, rs->rs_start, size);
+		else if (msp->ms_loaded)
+			range_tree_add(msp->ms_tree, rs->rs_start, size);
+	}
+	range_tree_vacate(msp->ms_trim, NULL, NULL);
+
+	if (range_tree_space(msp->ms_trimming) == 0) {
+		spa_config_exit(spa, SCL_ZIO, msp);
+		return (NULL);
+	}
+
+	zio = zio_root(spa, metaslab_trim_done, msp, ZIO_FLAG_CANFAIL);
+
+	t = &msp->ms_trimming->rt_root;
+	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
+		uint64_t offset;
+
+		for (offset = rs->rs_start; offset < rs->rs_end;
+		    offset += SPA_MAXBLOCKSIZE) {
+			zio_nowait(zio_trim(zio, spa, vd, offset,
+			    MIN(rs->rs_end - offset, SPA_MAXBLOCKSIZE)));
+		}
+	}
+
+	return (zio);
+}
+
+/*
+ * Queue all of the free space of a loaded metaslab for trimming.  The
+ * trims are issued when the metaslab is synced in the given txg.
+ */
+void
+metaslab_trim_all(metaslab_t *msp, uint64_t txg)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+
+	mutex_enter(&msp->ms_lock);
+	metaslab_load_wait(msp);
+	ASSERT(!msp->ms_condensing);
+
+	if (msp->ms_loaded && range_tree_space(msp->ms_tree) != 0) {
+		range_tree_vacate(msp->ms_tree, range_tree_add, msp->ms_trim);
+		msp->ms_max_size = 0;
+		vdev_dirty(vd, VDD_METASLAB, msp, txg);
+	}
+
+	mutex_exit(&msp->ms_lock);
+}
+
+/*
+ * Return the free space which is still waiting to be trimmed to the
+ * metaslab.  Trims which have already been issued are left to complete.
+ */
+void
+metaslab_trim_cancel(metaslab_t *msp)
+{
+	mutex_enter(&msp->ms_lock);
+	metaslab_load_wait(msp);
+	ASSERT(!msp->ms_condensing);
+
+	range_tree_vacate(msp->ms_trim,
+	    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
+
+	mutex_exit(&msp->ms_lock);
+}
+
 /*
  * Called after a transaction group has completely synced to mark
  * all of the metaslab's free space as usable.
@@ -2353,6 +2716,9 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	vdev_t *vd = mg->mg_vd;
 	spa_t *spa = vd->vdev_spa;
 	range_tree_t **defer_tree;
+	range_tree_t *free_tree;
+	range_tree_func_t *free_func;
+	zio_t *trim_zio = NULL;
 	int64_t alloc_delta, defer_delta;
 	uint64_t free_space;
 	boolean_t defer_allowed = B_TRUE;
@@ -2401,7 +2767,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	defer_delta = 0;
-	alloc_delta = space_map_alloc_delta(msp->ms_sm);
+	alloc_delta = msp->ms_allocated_this_txg;
 	if (defer_allowed) {
 		defer_delta = range_tree_space(msp->ms_freedtree) -
 		    range_tree_space(*defer_tree);
@@ -2421,26 +2787,53 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and the
 	 * defer_tree -- this is safe to do because we've just emptied out
-	 * the defer_tree.
+	 * the defer_tree.  With autotrim the frees are queued to be
+	 * trimmed instead, and only become allocatable once discarded.
 	 */
-	range_tree_vacate(*defer_tree,
-	    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
+	if (spa->spa_autotrim) {
+		free_tree = msp->ms_trim;
+		free_func = range_tree_add;
+	} else {
+		free_tree = msp->ms_tree;
+		free_func = msp->ms_loaded ? range_tree_add : NULL;
+	}
+
+	range_tree_vacate(*defer_tree, free_func, free_tree);
 	if (defer_allowed) {
 		range_tree_swap(&msp->ms_freedtree, defer_tree);
 	} else {
-		range_tree_vacate(msp->ms_freedtree,
-		    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
+		range_tree_vacate(msp->ms_freedtree, free_func, free_tree);
 	}
 
 	space_map_update(msp->ms_sm);
+	msp->ms_allocated_space += alloc_delta;
+	msp->ms_allocated_this_txg = 0;
+
+	/*
+	 * A flush of this txg has reached ms_sm, and any metaslab_load()
+	 * that could still have needed the unflushed changes is done.
+	 */
+	if (msp->ms_flushing) {
+		metaslab_unflushed_vacate(spa, msp);
+		msp->ms_flushing = B_FALSE;
+	}
+	msp->ms_flush_wanted = B_FALSE;
+
+	if (range_tree_space(msp->ms_trim) != 0 &&
+	    range_tree_space(msp->ms_trimming) == 0)
+		trim_zio = metaslab_trim_issue(msp);
 
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
 	ASSERT3S(msp->ms_deferspace, <=, msp->ms_size);
-	if (msp->ms_deferspace != 0) {
+	if (msp->ms_deferspace != 0 ||
+	    (range_tree_space(msp->ms_trim) != 0 &&
+	    range_tree_space(msp->ms_trimming) == 0)) {
 		/*
 		 * Keep syncing this metaslab until all deferred frees
-		 * are back in circulation.
+		 * are back in circulation, and until pending trims which
+		 * could not be issued have been.  Trims pending behind a
+		 * batch in flight are issued when that batch completes.
 		 */
 		vdev_dirty(vd, VDD_METASLAB, msp, txg + 1);
 	}
@@ -2468,6 +2861,9 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	mutex_exit(&msp->ms_lock);
+
+	if (trim_zio != NULL)
+		zio_nowait(trim_zio);
 }
 
 void
@@ -2789,7 +3185,7 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 				break;
 
 			target_distance = min_distance +
-			    (space_map_allocated(msp->ms_sm) != 0 ? 0 :
+			    (msp->ms_allocated_space != 0 ? 0 :
 			    min_distance >> 1);
 
 			for (i = 0; i < d; i++) {
@@ -3209,34 +3605,19 @@ next:
 }
 
 /*
- * Free the block represented by DVA in the context of the specified
- * transaction group.
+ * Free a segment of a vdev which has metaslabs, in the context of the
+ * specified transaction group.
  */
-static void
-metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
+void
+metaslab_free_concrete(vdev_t *vd, uint64_t offset, uint64_t size,
+    uint64_t txg, boolean_t now)
 {
-	uint64_t vdev = DVA_GET_VDEV(dva);
-	uint64_t offset = DVA_GET_OFFSET(dva);
-	uint64_t size = DVA_GET_ASIZE(dva);
-	vdev_t *vd;
+	spa_t *spa = vd->vdev_spa;
 	metaslab_t *msp;
 
-	if (txg > spa_freeze_txg(spa))
-		return;
-
-	if ((vd = vdev_lookup_top(spa, vdev)) == NULL || !DVA_IS_VALID(dva) ||
-	    (offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count) {
-		zfs_panic_recover("metaslab_free_dva(): bad DVA %llu:%llu:%llu",
-		    (u_longlong_t)vdev, (u_longlong_t)offset,
-		    (u_longlong_t)size);
-		return;
-	}
-
+	ASSERT3U(offset >> vd->vdev_ms_shift, <, vd->vdev_ms_count);
 	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
 
-	if (DVA_GET_GANG(dva))
-		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
-
 	mutex_enter(&msp->ms_lock);
 
 	if (now) {
@@ -3262,33 +3643,112 @@ metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
 	mutex_exit(&msp->ms_lock);
 }
 
+typedef struct metaslab_remap_arg {
+	uint64_t	mra_txg;
+	boolean_t	mra_now;
+	int		mra_error;
+} metaslab_remap_arg_t;
+
+static void metaslab_free_impl(vdev_t *, uint64_t, uint64_t, uint64_t,
+    boolean_t);
+
+static void
+metaslab_free_impl_cb(uint64_t split_offset, vdev_t *vd, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	metaslab_remap_arg_t *mra = arg;
+
+	if (vd == NULL) {
+		zfs_panic_recover("metaslab_free_impl_cb(): unmapped segment "
+		    "%llu:%llu", (u_longlong_t)offset, (u_longlong_t)size);
+		return;
+	}
+
+	metaslab_free_impl(vd, offset, size, mra->mra_txg, mra->mra_now);
+}
+
 /*
- * Intent log support: upon opening the pool after a crash, notify the SPA
- * of blocks that the intent log has allocated for immediate write, but
- * which are still considered free by the SPA because the last transaction
- * group didn't commit yet.
+ * Frees of removed vdevs go to where their data was copied, and frees
+ * of the vdev being removed must be coordinated with the copying.
  */
-static int
-metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
+static void
+metaslab_free_impl(vdev_t *vd, uint64_t offset, uint64_t size,
+    uint64_t txg, boolean_t now)
+{
+	if (vd->vdev_ops == &vdev_indirect_ops) {
+		metaslab_remap_arg_t mra = { txg, now, 0 };
+
+		vdev_indirect_remap(vd, offset, size, metaslab_free_impl_cb,
+		    &mra);
+		return;
+	}
+
+	if (!now && vd->vdev_removing && vdev_removal_free(vd, offset, size,
+	    txg))
+		return;
+
+	metaslab_free_concrete(vd, offset, size, txg, now);
+}
+
+/*
+ * Check that a DVA refers to a segment within the given top-level vdev.
+ */
+static boolean_t
+metaslab_dva_valid(vdev_t *vd, const dva_t *dva)
+{
+	uint64_t offset = DVA_GET_OFFSET(dva);
+
+	if (vd == NULL || !DVA_IS_VALID(dva))
+		return (B_FALSE);
+
+	if (vd->vdev_ops == &vdev_indirect_ops)
+		return (offset + DVA_GET_ASIZE(dva) <= vd->vdev_asize);
+
+	return ((offset >> vd->vdev_ms_shift) < vd->vdev_ms_count);
+}
+
+/*
+ * Free the block represented by DVA in the context of the specified
+ * transaction group.
+ */
+static void
+metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
 {
 	uint64_t vdev = DVA_GET_VDEV(dva);
 	uint64_t offset = DVA_GET_OFFSET(dva);
 	uint64_t size = DVA_GET_ASIZE(dva);
 	vdev_t *vd;
+
+	if (txg > spa_freeze_txg(spa))
+		return;
+
+	vd = vdev_lookup_top(spa, vdev);
+	if (!metaslab_dva_valid(vd, dva)) {
+		zfs_panic_recover("metaslab_free_dva(): bad DVA %llu:%llu:%llu",
+		    (u_longlong_t)vdev, (u_longlong_t)offset,
+		    (u_longlong_t)size);
+		return;
+	}
+
+	if (DVA_GET_GANG(dva))
+		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
+
+	metaslab_free_impl(vd, offset, size, txg, now);
+}
+
+static int
+metaslab_claim_concrete(vdev_t *vd, uint64_t offset, uint64_t size,
+    uint64_t txg)
+{
+	spa_t *spa = vd->vdev_spa;
 	metaslab_t *msp;
 	int error = 0;
 
-	ASSERT(DVA_IS_VALID(dva));
-
-	if ((vd = vdev_lookup_top(spa, vdev)) == NULL ||
-	    (offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
+	if ((offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
 		return (SET_ERROR(ENXIO));
 
 	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
 
-	if (DVA_GET_GANG(dva))
-		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
-
 	mutex_enter(&msp->ms_lock);
 
 	if ((txg != 0 && spa_writeable(spa)) || !msp->ms_loaded)
@@ -3319,6 +3779,86 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	return (0);
 }
 
+static int metaslab_claim_impl(vdev_t *, uint64_t, uint64_t, uint64_t);
+
+static void
+metaslab_claim_impl_cb(uint64_t split_offset, vdev_t *vd, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	metaslab_remap_arg_t *mra = arg;
+
+	if (mra->mra_error != 0)
+		return;
+
+	if (vd == NULL)
+		mra->mra_error = SET_ERROR(ENXIO);
+	else
+		mra->mra_error = metaslab_claim_impl(vd, offset, size,
+		    mra->mra_txg);
+}
+
+/*
+ * Claims of removed vdevs go to where their data was copied, like frees.
+ * A vdev being removed only keeps stale data below the part of its
+ * mapping which has been synced, so claims of that part go to the
+ * copies too.
+ */
+static int
+metaslab_claim_impl(vdev_t *vd, uint64_t offset, uint64_t size, uint64_t txg)
+{
+	metaslab_remap_arg_t mra = { txg, B_FALSE, 0 };
+	uint64_t synced;
+
+	if (vd->vdev_ops == &vdev_indirect_ops) {
+		vdev_indirect_remap(vd, offset, size, metaslab_claim_impl_cb,
+		    &mra);
+		return (mra.mra_error);
+	}
+
+	if (vd->vdev_indirect_mapping != NULL) {
+		synced = vdev_indirect_mapping_max_offset(
+		    vd->vdev_indirect_mapping);
+		if (offset < synced) {
+			uint64_t len = MIN(size, synced - offset);
+
+			vdev_indirect_remap(vd, offset, len,
+			    metaslab_claim_impl_cb, &mra);
+			if (mra.mra_error != 0 || len == size)
+				return (mra.mra_error);
+			offset += len;
+			size -= len;
+		}
+	}
+
+	return (metaslab_claim_concrete(vd, offset, size, txg));
+}
+
+/*
+ * Intent log support: upon opening the pool after a crash, notify the SPA
+ * of blocks that the intent log has allocated for immediate write, but
+ * which are still considered free by the SPA because the last transaction
+ * group didn't commit yet.
+ */
+static int
+metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
+{
+	uint64_t vdev = DVA_GET_VDEV(dva);
+	uint64_t offset = DVA_GET_OFFSET(dva);
+	uint64_t size = DVA_GET_ASIZE(dva);
+	vdev_t *vd;
+
+	ASSERT(DVA_IS_VALID(dva));
+
+	vd = vdev_lookup_top(spa, vdev);
+	if (!metaslab_dva_valid(vd, dva))
+		return (SET_ERROR(ENXIO));
+
+	if (DVA_GET_GANG(dva))
+		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
+
+	return (metaslab_claim_impl(vd, offset, size, txg));
+}
+
 /*
  * Reserve some allocation slots. The reservation system must be called
  * before we call into the allocator. If there aren't any available slots
@@ -3378,7 +3918,7 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
     zio_alloc_list_t *zal, zio_t *zio)
 {
 	dva_t *dva = bp->blk_dva;
-	dva_t *hintdva = hintbp->blk_dva;
+	dva_t *hintdva = (hintbp != NULL) ? hintbp->blk_dva : NULL;
 	int d, error = 0;
 
 	ASSERT(bp->blk_birth == 0);
@@ -3407,6 +3947,16 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 				bzero(&dva[d], sizeof (dva_t));
 			}
 			spa_config_exit(spa, SCL_ALLOC, FTAG);
+
+			/*
+			 * Fall back to the normal class when the special
+			 * class is full.
+			 */
+			if (error == ENOSPC && mc == spa_special_class(spa)) {
+				return (metaslab_alloc(spa,
+				    spa_normal_class(spa), psize, bp, ndvas,
+				    txg, hintbp, flags, zal, zio));
+			}
 			return (error);
 		} else {
 			/*
@@ -3539,13 +4089,19 @@ metaslab_check_free(spa_t *spa, const blkptr_t *bp)
 		vdev_t *vd = vdev_lookup_top(spa, vdev);
 		uint64_t offset = DVA_GET_OFFSET(&bp->blk_dva[i]);
 		uint64_t size = DVA_GET_ASIZE(&bp->blk_dva[i]);
-		metaslab_t *msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+		metaslab_t *msp;
+
+		if (vd->vdev_ops == &vdev_indirect_ops)
+			continue;
 
+		msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
 		if (msp->ms_loaded)
 			range_tree_verify(msp->ms_tree, offset, size);
 
 		range_tree_verify(msp->ms_freeingtree, offset, size);
 		range_tree_verify(msp->ms_freedtree, offset, size);
+		range_tree_verify(msp->ms_trim, offset, size);
+		range_tree_verify(msp->ms_trimming, offset, size);
 		for (j = 0; j < TXG_DEFER_SIZE; j++)
 			range_tree_verify(msp->ms_defertree[j], offset, size);
 	}
@@ -3601,4 +4157,8 @@ MODULE_PARM_DESC(zfs_metaslab_segment_weight_enabled,
 module_param(zfs_metaslab_switch_threshold, int, 0644);
 MODULE_PARM_DESC(zfs_metaslab_switch_threshold,
 	"segment-based metaslab selection maximum buckets before switching");
+
+module_param(zfs_trim_extent_bytes_min, int, 0644);
+MODULE_PARM_DESC(zfs_trim_extent_bytes_min,
+	"freed segments smaller than this are not trimmed");
 #endif /* _KERNEL && HAVE_SPL */
@@ -351,6 +351,66 @@ range_tree_clear(range_tree_t *rt, uint64_t start, uint64_t size)
 	}
 }
 
+/*
+ * Remove the part of [start, start + size) that is in removefrom from it,
+ * and add the rest of the range to addto.  Applying a metaslab's allocs
+ * and frees this way keeps two trees of pending changes disjoint: space
+ * freed after having been allocated simply drops out of the alloc tree.
+ */
+void
+range_tree_remove_xor_add_segment(uint64_t start, uint64_t size,
+    range_tree_t *removefrom, range_tree_t *addto)
+{
+	uint64_t end = start + size;
+
+	ASSERT(MUTEX_HELD(removefrom->rt_lock));
+	ASSERT(MUTEX_HELD(addto->rt_lock));
+
+	while (start < end) {
+		range_seg_t *rs, *prev;
+		uint64_t overlap_start, overlap_end;
+
+		rs = range_tree_find_impl(removefrom, start, end - start);
+		if (rs == NULL) {
+			range_tree_add(addto, start, end - start);
+			return;
+		}
+
+		/*
+		 * The search returns any overlapping segment; walk back
+		 * to the first one.
+		 */
+		while ((prev = AVL_PREV(&removefrom->rt_root, rs)) != NULL &&
+		    prev->rs_end > start)
+			rs = prev;
+
+		overlap_start = MAX(rs->rs_start, start);
+		overlap_end = MIN(rs->rs_end, end);
+
+		if (overlap_start > start)
+			range_tree_add(addto, start, overlap_start - start);
+		range_tree_remove(removefrom, overlap_start,
+		    overlap_end - overlap_start);
+		start = overlap_end;
+	}
+}
+
+/*
+ * Apply range_tree_remove_xor_add_segment() to every segment of rt.
+ */
+void
+range_tree_remove_xor_add(range_tree_t *rt, range_tree_t *removefrom,
+    range_tree_t *addto)
+{
+	range_seg_t *rs;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+
+	for (rs = avl_first(&rt->rt_root); rs; rs = AVL_NEXT(&rt->rt_root, rs))
+		range_tree_remove_xor_add_segment(rs->rs_start,
+		    rs->rs_end - rs->rs_start, removefrom, addto);
+}
+
 void
 range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 {
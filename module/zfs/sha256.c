@@ -29,14 +29,22 @@
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
 #include <sys/sha2.h>
+#include <sys/sha2_mb.h>
 #include <sys/abd.h>
 
-static int
-sha_incremental(void *buf, size_t size, void *arg)
+/*
+ * A prior implementation of SHA256 had a private SHA256 implementation
+ * which always wrote things out in Big Endian and there wasn't a byteswap
+ * variant of it. To preserve on disk compatibility we need to force that
+ * behavior.
+ */
+static inline void
+sha256_cksum_be(const zio_cksum_t *tmp, zio_cksum_t *zcp)
 {
-	SHA2_CTX *ctx = arg;
-	SHA2Update(ctx, buf, size);
-	return (0);
+	zcp->zc_word[0] = BE_64(tmp->zc_word[0]);
+	zcp->zc_word[1] = BE_64(tmp->zc_word[1]);
+	zcp->zc_word[2] = BE_64(tmp->zc_word[2]);
+	zcp->zc_word[3] = BE_64(tmp->zc_word[3]);
 }
 
 /*ARGSUSED*/
@@ -44,24 +52,26 @@ void
 abd_checksum_SHA256(abd_t *abd, uint64_t size,
     const void *ctx_template, zio_cksum_t *zcp)
 {
-	SHA2_CTX ctx;
 	zio_cksum_t tmp;
 
-	SHA2Init(SHA256, &ctx);
-	(void) abd_iterate_func(abd, 0, size, sha_incremental, &ctx);
-	SHA2Final(&tmp, &ctx);
+	sha2_mb_abd(SHA256, &abd, &size, 1, &tmp);
+	sha256_cksum_be(&tmp, zcp);
+}
 
-	/*
-	 * A prior implementation of this function had a
-	 * private SHA256 implementation always wrote things out in
-	 * Big Endian and there wasn't a byteswap variant of it.
-	 * To preserve on disk compatibility we need to force that
-	 * behavior.
-	 */
-	zcp->zc_word[0] = BE_64(tmp.zc_word[0]);
-	zcp->zc_word[1] = BE_64(tmp.zc_word[1]);
-	zcp->zc_word[2] = BE_64(tmp.zc_word[2]);
-	zcp->zc_word[3] = BE_64(tmp.zc_word[3]);
+/*
+ * Checksum @n buffers at once so that multi-buffer implementations can
+ * hash them side by side. Produces the same checksums as calling
+ * abd_checksum_SHA256() on each buffer.
+ */
+void
+abd_checksum_SHA256_batch(abd_t **abds, const uint64_t *sizes, uint_t n,
+    zio_cksum_t *zcp)
+{
+	uint_t i;
+
+	sha2_mb_abd(SHA256, abds, sizes, n, zcp);
+	for (i = 0; i < n; i++)
+		sha256_cksum_be(&zcp[i], &zcp[i]);
 }
 
 /*ARGSUSED*/
@@ -69,11 +79,17 @@ void
 abd_checksum_SHA512_native(abd_t *abd, uint64_t size,
     const void *ctx_template, zio_cksum_t *zcp)
 {
-	SHA2_CTX	ctx;
+	sha2_mb_abd(SHA512_256, &abd, &size, 1, zcp);
+}
 
-	SHA2Init(SHA512_256, &ctx);
-	(void) abd_iterate_func(abd, 0, size, sha_incremental, &ctx);
-	SHA2Final(zcp, &ctx);
+/*
+ * Batched variant of abd_checksum_SHA512_native().
+ */
+void
+abd_checksum_SHA512_native_batch(abd_t **abds, const uint64_t *sizes,
+    uint_t n, zio_cksum_t *zcp)
+{
+	sha2_mb_abd(SHA512_256, abds, sizes, n, zcp);
 }
 
 /*ARGSUSED*/
@@ -0,0 +1,662 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Multi-buffer SHA-2 for block checksums.
+ *
+ * SIMD implementations of SHA-2 either use dedicated instructions (SHA-NI)
+ * or hash one message per vector lane, which only pays off when several
+ * independent messages are hashed together. sha2_mb_abd() takes a batch of
+ * ABDs, walks them in lockstep with abd_iterate_multi_func() and hands the
+ * whole blocks of all messages to the selected implementation in one call.
+ * The head and tail of each segment, as well as the final padding, go
+ * through the regular SHA2Update()/SHA2Final() code, so every
+ * implementation produces exactly the digest of the generic code.
+ *
+ * The chaining state and bit count live in the SHA2_CTX of each message.
+ * This file therefore depends on the SHA2_CTX layout used by the SHA-2
+ * code in the ICP.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/abd.h>
+#include <sys/sha2_mb.h>
+
+const uint32_t sha256_mb_k[64] __attribute__((aligned(64))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint64_t sha512_mb_k[80] __attribute__((aligned(64))) = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static boolean_t
+sha2_mb_generic_valid(void)
+{
+	return (B_TRUE);
+}
+
+/* The ICP code, one message at a time */
+static const sha2_mb_ops_t sha2_mb_generic_ops = {
+	.sha256_blocks = NULL,
+	.sha256_lanes = 1,
+	.sha512_blocks = NULL,
+	.sha512_lanes = 1,
+	.valid = sha2_mb_generic_valid,
+	.name = "generic"
+};
+
+/* Combination of the fastest SHA-256 and SHA-512 implementations */
+static sha2_mb_ops_t sha2_mb_fastest_impl = {
+	.name = "fastest"
+};
+
+static const sha2_mb_ops_t *sha2_mb_impls[] = {
+	&sha2_mb_generic_ops,
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&sha2_mb_avx2_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+	&sha2_mb_shani_ops,
+#endif
+};
+
+/* Hold all supported implementations */
+static uint32_t sha2_mb_supp_impls_cnt = 0;
+static sha2_mb_ops_t *sha2_mb_supp_impls[ARRAY_SIZE(sha2_mb_impls)];
+
+/* Select sha2 implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+#define	IMPL_GENERIC	(0)
+
+static uint32_t sha2_mb_impl_chosen = IMPL_FASTEST;
+
+#define	IMPL_READ(i)	(*(volatile uint32_t *) &(i))
+
+static struct sha2_mb_impl_selector {
+	const char	*sis_name;
+	uint32_t	sis_sel;
+} sha2_mb_impl_selectors[] = {
+#if !defined(_KERNEL)
+	{ "cycle",	IMPL_CYCLE },
+#endif
+	{ "fastest",	IMPL_FASTEST },
+	{ "generic",	IMPL_GENERIC }
+};
+
+static kstat_t *sha2_mb_kstat;
+
+static struct sha2_mb_kstat {
+	uint64_t sha256;
+	uint64_t sha512;
+} sha2_mb_stat_data[ARRAY_SIZE(sha2_mb_impls) + 1];
+
+/* Indicate that benchmark has been completed */
+static boolean_t sha2_mb_initialized = B_FALSE;
+
+int
+sha2_mb_impl_set(const char *val)
+{
+	int err = -EINVAL;
+	uint32_t impl = IMPL_READ(sha2_mb_impl_chosen);
+	size_t i, val_len;
+
+	val_len = strlen(val);
+	while ((val_len > 0) && !!isspace(val[val_len-1])) /* trim '\n' */
+		val_len--;
+
+	/* check mandatory implementations */
+	for (i = 0; i < ARRAY_SIZE(sha2_mb_impl_selectors); i++) {
+		const char *name = sha2_mb_impl_selectors[i].sis_name;
+
+		if (val_len == strlen(name) &&
+		    strncmp(val, name, val_len) == 0) {
+			impl = sha2_mb_impl_selectors[i].sis_sel;
+			err = 0;
+			break;
+		}
+	}
+
+	if (err != 0 && sha2_mb_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < sha2_mb_supp_impls_cnt; i++) {
+			const char *name = sha2_mb_supp_impls[i]->name;
+
+			if (val_len == strlen(name) &&
+			    strncmp(val, name, val_len) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		atomic_swap_32(&sha2_mb_impl_chosen, impl);
+		membar_producer();
+	}
+
+	return (err);
+}
+
+static inline const sha2_mb_ops_t *
+sha2_mb_impl_get(void)
+{
+	const sha2_mb_ops_t *ops = NULL;
+	const uint32_t impl = IMPL_READ(sha2_mb_impl_chosen);
+
+	/* checksums may be needed before the benchmark has run */
+	if (!sha2_mb_initialized)
+		return (&sha2_mb_generic_ops);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = &sha2_mb_fastest_impl;
+		break;
+#if !defined(_KERNEL)
+	case IMPL_CYCLE: {
+		ASSERT3U(sha2_mb_supp_impls_cnt, >, 0);
+
+		static uint32_t cycle_count = 0;
+		uint32_t idx = (++cycle_count) % sha2_mb_supp_impls_cnt;
+		ops = sha2_mb_supp_impls[idx];
+	}
+	break;
+#endif
+	default:
+		ASSERT3U(sha2_mb_supp_impls_cnt, >, 0);
+		ASSERT3U(impl, <, sha2_mb_supp_impls_cnt);
+
+		ops = sha2_mb_supp_impls[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+/*
+ * Number of messages worth batching for the given SHA2 mechanism. Callers
+ * may always pass more or fewer messages to sha2_mb_abd().
+ */
+uint_t
+sha2_mb_lanes(uint64_t mech)
+{
+	const sha2_mb_ops_t *ops;
+
+#if !defined(_KERNEL)
+	/* batch as much as possible so that every implementation is used */
+	if (IMPL_READ(sha2_mb_impl_chosen) == IMPL_CYCLE)
+		return (SHA2_MB_MAX_LANES);
+#endif
+	ops = sha2_mb_impl_get();
+
+	return (mech < SHA384 ? ops->sha256_lanes : ops->sha512_lanes);
+}
+
+/*
+ * Account for whole blocks hashed outside of SHA2Update(), using the same
+ * arithmetic as SHA2Update().
+ */
+static inline void
+sha2_mb_count(SHA2_CTX *ctx, size_t len)
+{
+	if (ctx->algotype < SHA384) {
+		if ((ctx->count.c32[1] += (len << 3)) < (len << 3))
+			ctx->count.c32[0]++;
+		ctx->count.c32[0] += (len >> 29);
+	} else {
+		if ((ctx->count.c64[1] += (len << 3)) < (len << 3))
+			ctx->count.c64[0]++;
+		ctx->count.c64[0] += (len >> 29);
+	}
+}
+
+/* Number of bytes SHA2Update() holds back waiting for a whole block */
+static inline size_t
+sha2_mb_pending(SHA2_CTX *ctx)
+{
+	if (ctx->algotype < SHA384)
+		return ((ctx->count.c32[1] >> 3) & 0x3f);
+	else
+		return ((ctx->count.c64[1] >> 3) & 0x7f);
+}
+
+typedef struct sha2_mb_arg {
+	const sha2_mb_ops_t	*sma_ops;
+	SHA2_CTX		*sma_ctx;	/* one per message */
+	uint_t			sma_n;
+	boolean_t		sma_sha512;
+} sha2_mb_arg_t;
+
+static int
+sha2_mb_iter(void **bufs, size_t len, void *private)
+{
+	sha2_mb_arg_t *arg = private;
+	const sha2_mb_ops_t *ops = arg->sma_ops;
+	SHA2_CTX *ctx[SHA2_MB_MAX_LANES];
+	const uint8_t *in[SHA2_MB_MAX_LANES];
+	sha2_mb_blocks_f blocks;
+	size_t blksz, head, bulk;
+	uint_t i, n, lanes;
+
+	if (arg->sma_sha512) {
+		blocks = ops->sha512_blocks;
+		lanes = ops->sha512_lanes;
+		blksz = SHA512_HMAC_BLOCK_SIZE;
+	} else {
+		blocks = ops->sha256_blocks;
+		lanes = ops->sha256_lanes;
+		blksz = SHA256_HMAC_BLOCK_SIZE;
+	}
+
+	for (i = 0, n = 0; i < arg->sma_n; i++) {
+		if (bufs[i] == NULL)
+			continue;
+		ctx[n] = &arg->sma_ctx[i];
+		in[n] = bufs[i];
+		n++;
+	}
+	ASSERT3U(n, >, 0);
+
+	/*
+	 * All messages that are still being hashed have consumed the same
+	 * number of bytes, so they all hold back the same partial block.
+	 */
+	head = sha2_mb_pending(ctx[0]);
+	if (head != 0)
+		head = MIN(len, blksz - head);
+	bulk = P2ALIGN(len - head, blksz);
+
+	/* Mostly idle vector lanes are slower than the scalar code */
+	if (blocks == NULL || bulk == 0 || n * 2 < lanes) {
+		for (i = 0; i < n; i++)
+			SHA2Update(ctx[i], in[i], len);
+		return (0);
+	}
+
+	for (i = 0; i < n; i++) {
+		SHA2Update(ctx[i], in[i], head);
+		in[i] += head;
+	}
+
+	for (i = 0; i < n; i += lanes)
+		blocks(&ctx[i], &in[i], MIN(lanes, n - i), bulk / blksz);
+
+	for (i = 0; i < n; i++) {
+		sha2_mb_count(ctx[i], bulk);
+		SHA2Update(ctx[i], in[i] + bulk, len - head - bulk);
+	}
+
+	return (0);
+}
+
+/*
+ * @ctx must have room for MIN(@n, ABD_ITER_MULTI_MAX) contexts.
+ */
+static void
+sha2_mb_abd_impl(const sha2_mb_ops_t *ops, uint64_t mech, abd_t **abds,
+    const uint64_t *sizes, uint_t n, zio_cksum_t *digests, SHA2_CTX *ctx)
+{
+	sha2_mb_arg_t arg;
+	uint_t i, j, c;
+
+	arg.sma_ops = ops;
+	arg.sma_ctx = ctx;
+	arg.sma_sha512 = (mech >= SHA384);
+
+	for (i = 0; i < n; i += c) {
+		c = MIN(n - i, ABD_ITER_MULTI_MAX);
+		arg.sma_n = c;
+
+		for (j = 0; j < c; j++)
+			SHA2Init(mech, &ctx[j]);
+
+		(void) abd_iterate_multi_func(&abds[i], &sizes[i], c,
+		    sha2_mb_iter, &arg);
+
+		for (j = 0; j < c; j++)
+			SHA2Final(&digests[i + j], &ctx[j]);
+	}
+}
+
+/*
+ * Compute the SHA2 digests of @n ABDs. Only the first 32 bytes of each
+ * digest are kept, which covers SHA-256 and SHA-512/256.
+ */
+void
+sha2_mb_abd(uint64_t mech, abd_t **abds, const uint64_t *sizes, uint_t n,
+    zio_cksum_t *digests)
+{
+	SHA2_CTX ctx1, *ctx = &ctx1;
+	size_t ctxsize = MIN(n, ABD_ITER_MULTI_MAX) * sizeof (SHA2_CTX);
+
+	ASSERT(mech == SHA256 || mech == SHA512_256);
+
+	if (n > 1)
+		ctx = kmem_alloc(ctxsize, KM_SLEEP);
+
+	sha2_mb_abd_impl(sha2_mb_impl_get(), mech, abds, sizes, n, digests,
+	    ctx);
+
+	if (n > 1)
+		kmem_free(ctx, ctxsize);
+}
+
+/* SHA2 kstats */
+
+static int
+sha2_mb_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	off += snprintf(buf + off, size - off, "%-15s", "sha256");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "sha512");
+
+	return (0);
+}
+
+static int
+sha2_mb_kstat_data(char *buf, size_t size, void *data)
+{
+	struct sha2_mb_kstat *fastest_stat =
+	    &sha2_mb_stat_data[sha2_mb_supp_impls_cnt];
+	struct sha2_mb_kstat *curr_stat = (struct sha2_mb_kstat *)data;
+	ssize_t off = 0;
+
+	if (curr_stat == fastest_stat) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		off += snprintf(buf + off, size - off, "%-15s",
+		    sha2_mb_supp_impls[fastest_stat->sha256]->name);
+		off += snprintf(buf + off, size - off, "%-15s\n",
+		    sha2_mb_supp_impls[fastest_stat->sha512]->name);
+	} else {
+		ptrdiff_t id = curr_stat - sha2_mb_stat_data;
+
+		off += snprintf(buf + off, size - off, "%-17s",
+		    sha2_mb_supp_impls[id]->name);
+		off += snprintf(buf + off, size - off, "%-15llu",
+		    (u_longlong_t)curr_stat->sha256);
+		off += snprintf(buf + off, size - off, "%-15llu\n",
+		    (u_longlong_t)curr_stat->sha512);
+	}
+
+	return (0);
+}
+
+static void *
+sha2_mb_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= sha2_mb_supp_impls_cnt)
+		ksp->ks_private = (void *) (sha2_mb_stat_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	SHA2_MB_FASTEST_FN_COPY(type, src)				\
+{									\
+	sha2_mb_fastest_impl.type ## _blocks = src->type ## _blocks;	\
+	sha2_mb_fastest_impl.type ## _lanes = src->type ## _lanes;	\
+}
+
+#define	SHA2_MB_BENCH_NS	(MSEC2NSEC(50))		/* 50ms */
+
+/*
+ * Measure each implementation hashing a full batch of blocks at once,
+ * which is what the zio pipeline hands to it.
+ */
+static void
+sha2_mb_benchmark_impl(uint64_t mech, abd_t **abds, const uint64_t *sizes,
+    SHA2_CTX *ctx)
+{
+	struct sha2_mb_kstat *fastest_stat =
+	    &sha2_mb_stat_data[sha2_mb_supp_impls_cnt];
+	zio_cksum_t zc[SHA2_MB_MAX_LANES];
+	hrtime_t start;
+	uint64_t run_bw, run_time_ns, best_run = 0;
+	uint32_t i, l;
+
+	for (i = 0; i < sha2_mb_supp_impls_cnt; i++) {
+		struct sha2_mb_kstat *stat = &sha2_mb_stat_data[i];
+		const sha2_mb_ops_t *ops = sha2_mb_supp_impls[i];
+		uint64_t run_count = 0;
+
+		kpreempt_disable();
+		start = gethrtime();
+		do {
+			for (l = 0; l < 4; l++, run_count++) {
+				sha2_mb_abd_impl(ops, mech, abds, sizes,
+				    SHA2_MB_MAX_LANES, zc, ctx);
+			}
+
+			run_time_ns = gethrtime() - start;
+		} while (run_time_ns < SHA2_MB_BENCH_NS);
+		kpreempt_enable();
+
+		run_bw = sizes[0] * SHA2_MB_MAX_LANES * run_count * NANOSEC;
+		run_bw /= run_time_ns;	/* B/s */
+
+		if (mech == SHA256)
+			stat->sha256 = run_bw;
+		else
+			stat->sha512 = run_bw;
+
+		if (run_bw > best_run) {
+			best_run = run_bw;
+
+			if (mech == SHA256) {
+				fastest_stat->sha256 = i;
+				SHA2_MB_FASTEST_FN_COPY(sha256, ops);
+			} else {
+				fastest_stat->sha512 = i;
+				SHA2_MB_FASTEST_FN_COPY(sha512, ops);
+			}
+		}
+	}
+}
+
+void
+sha2_mb_init(void)
+{
+	static const size_t data_size = 1 << SPA_OLD_MAXBLOCKSHIFT; /* 128kiB */
+	abd_t *abds[SHA2_MB_MAX_LANES];
+	uint64_t sizes[SHA2_MB_MAX_LANES];
+	sha2_mb_ops_t *curr_impl;
+	SHA2_CTX *ctx;
+	char *databuf;
+	int i, c;
+
+	/* move supported impl into sha2_mb_supp_impls */
+	for (i = 0, c = 0; i < ARRAY_SIZE(sha2_mb_impls); i++) {
+		curr_impl = (sha2_mb_ops_t *)sha2_mb_impls[i];
+
+		if (curr_impl->valid && curr_impl->valid())
+			sha2_mb_supp_impls[c++] = curr_impl;
+	}
+	membar_producer();	/* complete sha2_mb_supp_impls[] init */
+	sha2_mb_supp_impls_cnt = c;	/* number of supported impl */
+
+#if !defined(_KERNEL)
+	/*
+	 * Skip benchmarking and use the last implementation of each
+	 * algorithm as fastest.
+	 */
+	for (i = 0; i < sha2_mb_supp_impls_cnt; i++) {
+		curr_impl = sha2_mb_supp_impls[i];
+
+		if (i == 0 || curr_impl->sha256_blocks != NULL)
+			SHA2_MB_FASTEST_FN_COPY(sha256, curr_impl);
+		if (i == 0 || curr_impl->sha512_blocks != NULL)
+			SHA2_MB_FASTEST_FN_COPY(sha512, curr_impl);
+	}
+	membar_producer();
+
+	sha2_mb_initialized = B_TRUE;
+
+	/* Use 'cycle' selection method for userspace */
+	VERIFY0(sha2_mb_impl_set("cycle"));
+	return;
+#endif
+	/* Benchmark all supported implementations */
+	databuf = vmem_alloc(data_size * SHA2_MB_MAX_LANES, KM_SLEEP);
+	for (i = 0; i < data_size * SHA2_MB_MAX_LANES / sizeof (uint64_t); i++)
+		((uint64_t *)databuf)[i] = (uintptr_t)(databuf+i); /* warm-up */
+
+	for (i = 0; i < SHA2_MB_MAX_LANES; i++) {
+		abds[i] = abd_get_from_buf(databuf + i * data_size, data_size);
+		sizes[i] = data_size;
+	}
+
+	ctx = kmem_alloc(ABD_ITER_MULTI_MAX * sizeof (SHA2_CTX), KM_SLEEP);
+
+	sha2_mb_benchmark_impl(SHA256, abds, sizes, ctx);
+	sha2_mb_benchmark_impl(SHA512_256, abds, sizes, ctx);
+
+	kmem_free(ctx, ABD_ITER_MULTI_MAX * sizeof (SHA2_CTX));
+	for (i = 0; i < SHA2_MB_MAX_LANES; i++)
+		abd_put(abds[i]);
+	vmem_free(databuf, data_size * SHA2_MB_MAX_LANES);
+
+	/* install kstats for all implementations */
+	sha2_mb_kstat = kstat_create("zfs", 0, "sha2_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (sha2_mb_kstat != NULL) {
+		sha2_mb_kstat->ks_data = NULL;
+		sha2_mb_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(sha2_mb_kstat,
+		    sha2_mb_kstat_headers,
+		    sha2_mb_kstat_data,
+		    sha2_mb_kstat_addr);
+		kstat_install(sha2_mb_kstat);
+	}
+
+	/* Finish initialization */
+	sha2_mb_initialized = B_TRUE;
+}
+
+void
+sha2_mb_fini(void)
+{
+	if (sha2_mb_kstat != NULL) {
+		kstat_delete(sha2_mb_kstat);
+		sha2_mb_kstat = NULL;
+	}
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+#include <linux/mod_compat.h>
+
+static int
+sha2_mb_param_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	const uint32_t impl = IMPL_READ(sha2_mb_impl_chosen);
+	char *fmt;
+	int i, cnt = 0;
+
+	/* list fastest */
+	fmt = (impl == IMPL_FASTEST) ? "[%s] " : "%s ";
+	cnt += sprintf(buffer + cnt, fmt, "fastest");
+
+	/* list all supported implementations */
+	for (i = 0; i < sha2_mb_supp_impls_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt,
+		    sha2_mb_supp_impls[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+sha2_mb_param_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (sha2_mb_impl_set(val));
+}
+
+/*
+ * Choose a SHA-256/SHA-512 implementation in ZFS.
+ * Users can choose "cycle" to exercise all implementations, but this is
+ * for testing purpose therefore it can only be set in user space.
+ */
+module_param_call(zfs_sha2_impl,
+    sha2_mb_param_set, sha2_mb_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_sha2_impl, "Select SHA-256/SHA-512 implementation.");
+#endif
@@ -0,0 +1,379 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/isa_defs.h>
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <sys/sha2_mb.h>
+#include <linux/simd_x86.h>
+
+/*
+ * AVX2 multi-buffer SHA-2: every 32 bit (SHA-256) or 64 bit (SHA-512)
+ * element of a ymm register belongs to a different message, so 8 SHA-256
+ * or 4 SHA-512 messages are hashed with the instructions the scalar code
+ * spends on one.
+ *
+ * Each block is first transposed from the message buffers into the
+ * message schedule, with one row per word and one column per message.
+ * The working variables a-h then stay in ymm0-ymm7 for all rounds;
+ * instead of moving them around, every round renames them by shifting
+ * the register arguments of the round macro.
+ */
+
+#define	__asm __asm__ __volatile__
+
+#define	Y(r)	"%%ymm" #r
+
+/* Byte order flip for every 32 or 64 bit word in a ymm register */
+static const uint8_t sha256_avx2_bswap[32] __attribute__((aligned(32))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static const uint8_t sha512_avx2_bswap[32] __attribute__((aligned(32))) = {
+	7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+	7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+};
+
+#define	AVX2_CLOBBERS							\
+	"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",	\
+	"xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14",	\
+	"xmm15", "rax", "memory"
+
+/* Load 32 bytes at @off of the block of message @l into ymm@l */
+#define	LOAD_ROW(l, off)						\
+	"movq 8*" #l "(%[p]), %%rax\n"					\
+	"vmovdqu " #off "(%%rax), " Y(l) "\n"				\
+	"vpshufb %%ymm8, " Y(l) ", " Y(l) "\n"
+
+/* acc = ROTR(src, r1) ^ ROTR(src, r2) ^ ROTR(src, r3) */
+#define	BSIG(S, B, src, r1, r2, r3, acc, tmp)				\
+	"vpsrl" S " $" #r1 ", " Y(src) ", " Y(acc) "\n"			\
+	"vpsll" S " $(" #B "-" #r1 "), " Y(src) ", " Y(tmp) "\n"	\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsrl" S " $" #r2 ", " Y(src) ", " Y(tmp) "\n"			\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsll" S " $(" #B "-" #r2 "), " Y(src) ", " Y(tmp) "\n"	\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsrl" S " $" #r3 ", " Y(src) ", " Y(tmp) "\n"			\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsll" S " $(" #B "-" #r3 "), " Y(src) ", " Y(tmp) "\n"	\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"
+
+/* acc = ROTR(src, r1) ^ ROTR(src, r2) ^ SHR(src, sh) */
+#define	SSIG(S, B, src, r1, r2, sh, acc, tmp)				\
+	"vpsrl" S " $" #sh ", " Y(src) ", " Y(acc) "\n"			\
+	"vpsrl" S " $" #r1 ", " Y(src) ", " Y(tmp) "\n"			\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsll" S " $(" #B "-" #r1 "), " Y(src) ", " Y(tmp) "\n"	\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsrl" S " $" #r2 ", " Y(src) ", " Y(tmp) "\n"			\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"			\
+	"vpsll" S " $(" #B "-" #r2 "), " Y(src) ", " Y(tmp) "\n"	\
+	"vpxor " Y(tmp) ", " Y(acc) ", " Y(acc) "\n"
+
+/* Address of W[t] in the 16 entry rolling message schedule */
+#define	W(t)	"32*((" #t ")&15)(%[w])"
+
+/*
+ * One round: T1 = h + S1(e) + Ch(e, f, g) + K[t] + W[t], d += T1,
+ * h = T1 + S0(a) + Maj(a, b, c)
+ */
+#define	ROUND(S, B, KSZ, a, b, c, d, e, f, g, h, t, s1, s0)		\
+	"vpbroadcast" S " " #KSZ "*(" #t ")(%[k]), %%ymm8\n"		\
+	"vpadd" S " " W(t) ", %%ymm8, %%ymm8\n"				\
+	"vpadd" S " " Y(h) ", %%ymm8, %%ymm8\n"				\
+	s1(e, 9, 10)							\
+	"vpadd" S " %%ymm9, %%ymm8, %%ymm8\n"				\
+	"vpand " Y(f) ", " Y(e) ", %%ymm9\n"				\
+	"vpandn " Y(g) ", " Y(e) ", %%ymm10\n"				\
+	"vpxor %%ymm10, %%ymm9, %%ymm9\n"				\
+	"vpadd" S " %%ymm9, %%ymm8, %%ymm8\n"				\
+	"vpadd" S " %%ymm8, " Y(d) ", " Y(d) "\n"			\
+	s0(a, 9, 10)							\
+	"vpor " Y(b) ", " Y(a) ", %%ymm10\n"				\
+	"vpand " Y(c) ", %%ymm10, %%ymm10\n"				\
+	"vpand " Y(b) ", " Y(a) ", %%ymm11\n"				\
+	"vpor %%ymm11, %%ymm10, %%ymm10\n"				\
+	"vpadd" S " %%ymm10, %%ymm9, %%ymm9\n"				\
+	"vpadd" S " %%ymm9, %%ymm8, " Y(h) "\n"
+
+/* W[t] = s1(W[t - 2]) + W[t - 7] + s0(W[t - 15]) + W[t - 16] */
+#define	SCHED(S, t, s1, s0)						\
+	"vmovdqu " W((t) - 15) ", %%ymm12\n"				\
+	s0(12, 13, 14)							\
+	"vmovdqu " W((t) - 2) ", %%ymm12\n"				\
+	s1(12, 15, 14)							\
+	"vpadd" S " %%ymm15, %%ymm13, %%ymm13\n"			\
+	"vpadd" S " " W((t) - 7) ", %%ymm13, %%ymm13\n"			\
+	"vpadd" S " " W(t) ", %%ymm13, %%ymm13\n"			\
+	"vmovdqu %%ymm13, " W(t) "\n"
+
+/* Eight rounds, after which a-h are back in their original registers */
+#define	ROUNDS8(R, t)							\
+	R(0, 1, 2, 3, 4, 5, 6, 7, (t) + 0)				\
+	R(7, 0, 1, 2, 3, 4, 5, 6, (t) + 1)				\
+	R(6, 7, 0, 1, 2, 3, 4, 5, (t) + 2)				\
+	R(5, 6, 7, 0, 1, 2, 3, 4, (t) + 3)				\
+	R(4, 5, 6, 7, 0, 1, 2, 3, (t) + 4)				\
+	R(3, 4, 5, 6, 7, 0, 1, 2, (t) + 5)				\
+	R(2, 3, 4, 5, 6, 7, 0, 1, (t) + 6)				\
+	R(1, 2, 3, 4, 5, 6, 7, 0, (t) + 7)
+
+/* Load the state from row @j of %[s], and add it back after the rounds */
+#define	STATE_LOAD(j)	"vmovdqu 32*" #j "(%[s]), " Y(j) "\n"
+#define	STATE_ADD(S, j)							\
+	"vpadd" S " 32*" #j "(%[s]), " Y(j) ", " Y(j) "\n"		\
+	"vmovdqu " Y(j) ", 32*" #j "(%[s])\n"
+
+#define	STATE(M)							\
+	M(0) M(1) M(2) M(3) M(4) M(5) M(6) M(7)
+
+/*
+ * SHA-256, 8 messages
+ */
+#define	S256_BSIG1(src, acc, tmp)	BSIG("d", 32, src, 6, 11, 25, acc, tmp)
+#define	S256_BSIG0(src, acc, tmp)	BSIG("d", 32, src, 2, 13, 22, acc, tmp)
+#define	S256_SSIG1(src, acc, tmp)	SSIG("d", 32, src, 17, 19, 10, acc, tmp)
+#define	S256_SSIG0(src, acc, tmp)	SSIG("d", 32, src, 7, 18, 3, acc, tmp)
+
+#define	S256_ROUND(a, b, c, d, e, f, g, h, t)				\
+	ROUND("d", 32, 4, a, b, c, d, e, f, g, h, t,			\
+	    S256_BSIG1, S256_BSIG0)
+#define	S256_SROUND(a, b, c, d, e, f, g, h, t)				\
+	SCHED("d", t, S256_SSIG1, S256_SSIG0)				\
+	S256_ROUND(a, b, c, d, e, f, g, h, t)
+#define	S256_STATE_ADD(j)	STATE_ADD("d", j)
+
+/*
+ * Transpose 8 words of all 8 messages (ymm0-ymm7, one message each) into
+ * W[t..t+7] (one word each).
+ */
+#define	S256_TRANSPOSE(off, t)						\
+	LOAD_ROW(0, off) LOAD_ROW(1, off) LOAD_ROW(2, off)		\
+	LOAD_ROW(3, off) LOAD_ROW(4, off) LOAD_ROW(5, off)		\
+	LOAD_ROW(6, off) LOAD_ROW(7, off)				\
+	"vpunpckldq %%ymm1, %%ymm0, %%ymm9\n"				\
+	"vpunpckhdq %%ymm1, %%ymm0, %%ymm10\n"				\
+	"vpunpckldq %%ymm3, %%ymm2, %%ymm0\n"				\
+	"vpunpckhdq %%ymm3, %%ymm2, %%ymm1\n"				\
+	"vpunpckldq %%ymm5, %%ymm4, %%ymm2\n"				\
+	"vpunpckhdq %%ymm5, %%ymm4, %%ymm3\n"				\
+	"vpunpckldq %%ymm7, %%ymm6, %%ymm4\n"				\
+	"vpunpckhdq %%ymm7, %%ymm6, %%ymm5\n"				\
+	"vpunpcklqdq %%ymm0, %%ymm9, %%ymm6\n"				\
+	"vpunpckhqdq %%ymm0, %%ymm9, %%ymm7\n"				\
+	"vpunpcklqdq %%ymm1, %%ymm10, %%ymm9\n"				\
+	"vpunpckhqdq %%ymm1, %%ymm10, %%ymm0\n"				\
+	"vpunpcklqdq %%ymm4, %%ymm2, %%ymm10\n"				\
+	"vpunpckhqdq %%ymm4, %%ymm2, %%ymm1\n"				\
+	"vpunpcklqdq %%ymm5, %%ymm3, %%ymm2\n"				\
+	"vpunpckhqdq %%ymm5, %%ymm3, %%ymm4\n"				\
+	"vperm2i128 $0x20, %%ymm10, %%ymm6, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 0) "\n"				\
+	"vperm2i128 $0x31, %%ymm10, %%ymm6, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 4) "\n"				\
+	"vperm2i128 $0x20, %%ymm1, %%ymm7, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 1) "\n"				\
+	"vperm2i128 $0x31, %%ymm1, %%ymm7, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 5) "\n"				\
+	"vperm2i128 $0x20, %%ymm2, %%ymm9, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 2) "\n"				\
+	"vperm2i128 $0x31, %%ymm2, %%ymm9, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 6) "\n"				\
+	"vperm2i128 $0x20, %%ymm4, %%ymm0, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 3) "\n"				\
+	"vperm2i128 $0x31, %%ymm4, %%ymm0, %%ymm3\n"			\
+	"vmovdqu %%ymm3, " W((t) + 7) "\n"
+
+typedef struct sha256_avx2 {
+	uint32_t s[8][8];	/* state, one row per word */
+	uint32_t w[16][8];	/* message schedule, one row per word */
+} sha256_avx2_t;
+
+static void
+sha2_mb_avx2_sha256(SHA2_CTX **ctx, const uint8_t **in, uint_t n,
+    size_t nblks)
+{
+	sha256_avx2_t st;
+	const uint8_t *p[8];
+	uint_t i, j;
+
+	ASSERT3U(n, >, 0);
+	ASSERT3U(n, <=, 8);
+
+	/* idle lanes hash the first message again */
+	for (i = 0; i < 8; i++) {
+		uint_t l = (i < n) ? i : 0;
+
+		p[i] = in[l];
+		for (j = 0; j < 8; j++)
+			st.s[j][i] = ctx[l]->state.s32[j];
+	}
+
+	kfpu_begin();
+	for (; nblks > 0; nblks--) {
+		__asm(
+		    "vmovdqa %[bswap], %%ymm8\n"
+		    S256_TRANSPOSE(0, 0)
+		    S256_TRANSPOSE(32, 8)
+		    STATE(STATE_LOAD)
+		    ROUNDS8(S256_ROUND, 0)
+		    ROUNDS8(S256_ROUND, 8)
+		    ROUNDS8(S256_SROUND, 16)
+		    ROUNDS8(S256_SROUND, 24)
+		    ROUNDS8(S256_SROUND, 32)
+		    ROUNDS8(S256_SROUND, 40)
+		    ROUNDS8(S256_SROUND, 48)
+		    ROUNDS8(S256_SROUND, 56)
+		    STATE(S256_STATE_ADD)
+		    "vzeroupper\n"
+		    : : [s] "r" (st.s), [w] "r" (st.w), [p] "r" (p),
+		    [k] "r" (sha256_mb_k), [bswap] "m" (sha256_avx2_bswap)
+		    : AVX2_CLOBBERS);
+
+		for (i = 0; i < 8; i++)
+			p[i] += SHA256_HMAC_BLOCK_SIZE;
+	}
+	kfpu_end();
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 8; j++)
+			ctx[i]->state.s32[j] = st.s[j][i];
+	}
+}
+
+/*
+ * SHA-512, 4 messages
+ */
+#define	S512_BSIG1(src, acc, tmp)	BSIG("q", 64, src, 14, 18, 41, acc, tmp)
+#define	S512_BSIG0(src, acc, tmp)	BSIG("q", 64, src, 28, 34, 39, acc, tmp)
+#define	S512_SSIG1(src, acc, tmp)	SSIG("q", 64, src, 19, 61, 6, acc, tmp)
+#define	S512_SSIG0(src, acc, tmp)	SSIG("q", 64, src, 1, 8, 7, acc, tmp)
+
+#define	S512_ROUND(a, b, c, d, e, f, g, h, t)				\
+	ROUND("q", 64, 8, a, b, c, d, e, f, g, h, t,			\
+	    S512_BSIG1, S512_BSIG0)
+#define	S512_SROUND(a, b, c, d, e, f, g, h, t)				\
+	SCHED("q", t, S512_SSIG1, S512_SSIG0)				\
+	S512_ROUND(a, b, c, d, e, f, g, h, t)
+#define	S512_STATE_ADD(j)	STATE_ADD("q", j)
+
+/*
+ * Transpose 4 words of all 4 messages (ymm0-ymm3, one message each) into
+ * W[t..t+3] (one word each).
+ */
+#define	S512_TRANSPOSE(off, t)						\
+	LOAD_ROW(0, off) LOAD_ROW(1, off)				\
+	LOAD_ROW(2, off) LOAD_ROW(3, off)				\
+	"vpunpcklqdq %%ymm1, %%ymm0, %%ymm4\n"				\
+	"vpunpckhqdq %%ymm1, %%ymm0, %%ymm5\n"				\
+	"vpunpcklqdq %%ymm3, %%ymm2, %%ymm6\n"				\
+	"vpunpckhqdq %%ymm3, %%ymm2, %%ymm7\n"				\
+	"vperm2i128 $0x20, %%ymm6, %%ymm4, %%ymm0\n"			\
+	"vmovdqu %%ymm0, " W((t) + 0) "\n"				\
+	"vperm2i128 $0x31, %%ymm6, %%ymm4, %%ymm0\n"			\
+	"vmovdqu %%ymm0, " W((t) + 2) "\n"				\
+	"vperm2i128 $0x20, %%ymm7, %%ymm5, %%ymm0\n"			\
+	"vmovdqu %%ymm0, " W((t) + 1) "\n"				\
+	"vperm2i128 $0x31, %%ymm7, %%ymm5, %%ymm0\n"			\
+	"vmovdqu %%ymm0, " W((t) + 3) "\n"
+
+typedef struct sha512_avx2 {
+	uint64_t s[8][4];	/* state, one row per word */
+	uint64_t w[16][4];	/* message schedule, one row per word */
+} sha512_avx2_t;
+
+static void
+sha2_mb_avx2_sha512(SHA2_CTX **ctx, const uint8_t **in, uint_t n,
+    size_t nblks)
+{
+	sha512_avx2_t st;
+	const uint8_t *p[4];
+	uint_t i, j;
+
+	ASSERT3U(n, >, 0);
+	ASSERT3U(n, <=, 4);
+
+	/* idle lanes hash the first message again */
+	for (i = 0; i < 4; i++) {
+		uint_t l = (i < n) ? i : 0;
+
+		p[i] = in[l];
+		for (j = 0; j < 8; j++)
+			st.s[j][i] = ctx[l]->state.s64[j];
+	}
+
+	kfpu_begin();
+	for (; nblks > 0; nblks--) {
+		__asm(
+		    "vmovdqa %[bswap], %%ymm8\n"
+		    S512_TRANSPOSE(0, 0)
+		    S512_TRANSPOSE(32, 4)
+		    S512_TRANSPOSE(64, 8)
+		    S512_TRANSPOSE(96, 12)
+		    STATE(STATE_LOAD)
+		    ROUNDS8(S512_ROUND, 0)
+		    ROUNDS8(S512_ROUND, 8)
+		    ROUNDS8(S512_SROUND, 16)
+		    ROUNDS8(S512_SROUND, 24)
+		    ROUNDS8(S512_SROUND, 32)
+		    ROUNDS8(S512_SROUND, 40)
+		    ROUNDS8(S512_SROUND, 48)
+		    ROUNDS8(S512_SROUND, 56)
+		    ROUNDS8(S512_SROUND, 64)
+		    ROUNDS8(S512_SROUND, 72)
+		    STATE(S512_STATE_ADD)
+		    "vzeroupper\n"
+		    : : [s] "r" (st.s), [w] "r" (st.w), [p] "r" (p),
+		    [k] "r" (sha512_mb_k), [bswap] "m" (sha512_avx2_bswap)
+		    : AVX2_CLOBBERS);
+
+		for (i = 0; i < 4; i++)
+			p[i] += SHA512_HMAC_BLOCK_SIZE;
+	}
+	kfpu_end();
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 8; j++)
+			ctx[i]->state.s64[j] = st.s[j][i];
+	}
+}
+
+static boolean_t
+sha2_mb_avx2_valid(void)
+{
+	return (zfs_avx_available() && zfs_avx2_available());
+}
+
+const sha2_mb_ops_t sha2_mb_avx2_ops = {
+	.sha256_blocks = sha2_mb_avx2_sha256,
+	.sha256_lanes = 8,
+	.sha512_blocks = sha2_mb_avx2_sha512,
+	.sha512_lanes = 4,
+	.valid = sha2_mb_avx2_valid,
+	.name = "avx2"
+};
+
+#endif /* defined(__x86_64) && defined(HAVE_AVX2) */
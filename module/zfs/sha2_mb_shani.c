@@ -0,0 +1,165 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/isa_defs.h>
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <sys/sha2_mb.h>
+#include <linux/simd_x86.h>
+
+/*
+ * SHA-256 using the x86 SHA extensions. The sha256rnds2 instruction already
+ * does two rounds of a single message per cycle or so, which beats hashing
+ * several messages side by side in vector registers; this implementation
+ * therefore has a single lane and is only multi-buffer in name. There are
+ * no SHA-512 instructions, so SHA-512 is left to the generic code.
+ *
+ * The state is kept as ABEF/CDGH in xmm1/xmm2, the four most recent
+ * message schedule words in xmm3-xmm6, and the byte flip mask in xmm8.
+ */
+
+#define	__asm __asm__ __volatile__
+
+#define	X(r)	"%%xmm" #r
+
+static const uint8_t sha256_shani_bswap[16] __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+/* Load message words 4g..4g+3 into xmm@m */
+#define	LOAD(g, m)							\
+	"movdqu " #g "*16(%[p]), " X(m) "\n"				\
+	"pshufb %%xmm8, " X(m) "\n"
+
+/* Rounds 4g..4g+1, leaving K + W for rounds 4g+2..4g+3 in xmm0 */
+#define	RNDS_LO(g, m)							\
+	"movdqa " X(m) ", %%xmm0\n"					\
+	"paddd " #g "*16(%[k]), %%xmm0\n"				\
+	"sha256rnds2 %%xmm1, %%xmm2\n"
+
+/* Rounds 4g+2..4g+3 */
+#define	RNDS_HI								\
+	"pshufd $0x0e, %%xmm0, %%xmm0\n"				\
+	"sha256rnds2 %%xmm2, %%xmm1\n"
+
+/* Finish the message words 4 groups ahead of @m in xmm@n */
+#define	MSG2(m, p, n)							\
+	"movdqa " X(m) ", %%xmm7\n"					\
+	"palignr $4, " X(p) ", %%xmm7\n"				\
+	"paddd %%xmm7, " X(n) "\n"					\
+	"sha256msg2 " X(m) ", " X(n) "\n"
+
+/* Start the message words 3 groups ahead of @m in xmm@p */
+#define	MSG1(m, p)							\
+	"sha256msg1 " X(m) ", " X(p) "\n"
+
+#define	GROUP_LOAD(g, m)	LOAD(g, m) RNDS_LO(g, m) RNDS_HI
+#define	GROUP_LOAD1(g, m, p)	LOAD(g, m) RNDS_LO(g, m) RNDS_HI MSG1(m, p)
+#define	GROUP_LOAD2(g, m, p, n)						\
+	LOAD(g, m) RNDS_LO(g, m) MSG2(m, p, n) RNDS_HI MSG1(m, p)
+#define	GROUP(g, m, p, n)						\
+	RNDS_LO(g, m) MSG2(m, p, n) RNDS_HI MSG1(m, p)
+#define	GROUP2(g, m, p, n)	RNDS_LO(g, m) MSG2(m, p, n) RNDS_HI
+#define	GROUP0(g, m)		RNDS_LO(g, m) RNDS_HI
+
+static void
+sha2_mb_shani_sha256(SHA2_CTX **ctx, const uint8_t **in, uint_t n,
+    size_t nblks)
+{
+	const uint8_t *p = in[0];
+
+	ASSERT3U(n, ==, 1);
+
+	if (nblks == 0)
+		return;
+
+	kfpu_begin();
+	__asm(
+	    /* DCBA, HGFE -> ABEF, CDGH */
+	    "movdqu 0*16(%[s]), %%xmm1\n"
+	    "movdqu 1*16(%[s]), %%xmm2\n"
+	    "pshufd $0xb1, %%xmm1, %%xmm1\n"
+	    "pshufd $0x1b, %%xmm2, %%xmm2\n"
+	    "movdqa %%xmm1, %%xmm7\n"
+	    "palignr $8, %%xmm2, %%xmm1\n"
+	    "pblendw $0xf0, %%xmm7, %%xmm2\n"
+	    "movdqa %[bswap], %%xmm8\n"
+
+	    "1:\n"
+	    "movdqa %%xmm1, %%xmm9\n"
+	    "movdqa %%xmm2, %%xmm10\n"
+	    GROUP_LOAD(0, 3)
+	    GROUP_LOAD1(1, 4, 3)
+	    GROUP_LOAD1(2, 5, 4)
+	    GROUP_LOAD2(3, 6, 5, 3)
+	    GROUP(4, 3, 6, 4)
+	    GROUP(5, 4, 3, 5)
+	    GROUP(6, 5, 4, 6)
+	    GROUP(7, 6, 5, 3)
+	    GROUP(8, 3, 6, 4)
+	    GROUP(9, 4, 3, 5)
+	    GROUP(10, 5, 4, 6)
+	    GROUP(11, 6, 5, 3)
+	    GROUP(12, 3, 6, 4)
+	    GROUP2(13, 4, 3, 5)
+	    GROUP2(14, 5, 4, 6)
+	    GROUP0(15, 6)
+	    "paddd %%xmm9, %%xmm1\n"
+	    "paddd %%xmm10, %%xmm2\n"
+	    "add $64, %[p]\n"
+	    "dec %[n]\n"
+	    "jnz 1b\n"
+
+	    /* ABEF, CDGH -> DCBA, HGFE */
+	    "pshufd $0x1b, %%xmm1, %%xmm1\n"
+	    "pshufd $0xb1, %%xmm2, %%xmm2\n"
+	    "movdqa %%xmm1, %%xmm7\n"
+	    "pblendw $0xf0, %%xmm2, %%xmm1\n"
+	    "palignr $8, %%xmm7, %%xmm2\n"
+	    "movdqu %%xmm1, 0*16(%[s])\n"
+	    "movdqu %%xmm2, 1*16(%[s])\n"
+	    : [p] "+r" (p), [n] "+r" (nblks)
+	    : [s] "r" (ctx[0]->state.s32), [k] "r" (sha256_mb_k),
+	    [bswap] "m" (sha256_shani_bswap)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+	    "xmm8", "xmm9", "xmm10", "cc", "memory");
+	kfpu_end();
+}
+
+static boolean_t
+sha2_mb_shani_valid(void)
+{
+	return (zfs_shani_available() && zfs_sse4_1_available());
+}
+
+const sha2_mb_ops_t sha2_mb_shani_ops = {
+	.sha256_blocks = sha2_mb_shani_sha256,
+	.sha256_lanes = 1,
+	.sha512_blocks = NULL,
+	.sha512_lanes = 1,
+	.valid = sha2_mb_shani_valid,
+	.name = "shani"
+};
+
+#endif /* defined(__x86_64) && defined(HAVE_SHA_NI) */
@@ -49,6 +49,9 @@
 #include <sys/ddt.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_disk.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_removal.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
 #include <sys/uberblock_impl.h>
@@ -208,8 +211,10 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 	ASSERT(MUTEX_HELD(&spa->spa_props_lock));
 
 	if (rvd != NULL) {
-		alloc = metaslab_class_get_alloc(spa_normal_class(spa));
-		size = metaslab_class_get_space(spa_normal_class(spa));
+		alloc = metaslab_class_get_alloc(spa_normal_class(spa)) +
+		    metaslab_class_get_alloc(spa_special_class(spa));
+		size = metaslab_class_get_space(spa_normal_class(spa)) +
+		    metaslab_class_get_space(spa_special_class(spa));
 		spa_prop_add_list(*nvp, ZPOOL_PROP_NAME, spa_name(spa), 0, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_SIZE, NULL, size, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_ALLOCATED, NULL, alloc, src);
@@ -477,6 +482,7 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 		case ZPOOL_PROP_AUTOREPLACE:
 		case ZPOOL_PROP_LISTSNAPS:
 		case ZPOOL_PROP_AUTOEXPAND:
+		case ZPOOL_PROP_AUTOTRIM:
 			error = nvpair_value_uint64(elem, &intval);
 			if (!error && intval > 1)
 				error = SET_ERROR(EINVAL);
@@ -1097,6 +1103,7 @@ spa_activate(spa_t *spa, int mode)
 
 	spa->spa_normal_class = metaslab_class_create(spa, zfs_metaslab_ops);
 	spa->spa_log_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_special_class = metaslab_class_create(spa, zfs_metaslab_ops);
 
 	/* Try to create a covering process */
 	mutex_enter(&spa->spa_proc_lock);
@@ -1222,6 +1229,9 @@ spa_deactivate(spa_t *spa)
 	metaslab_class_destroy(spa->spa_log_class);
 	spa->spa_log_class = NULL;
 
+	metaslab_class_destroy(spa->spa_special_class);
+	spa->spa_special_class = NULL;
+
 	/*
 	 * If this was part of an import or the open otherwise failed, we may
 	 * still have errors left in the queues.  Empty them just in case.
@@ -1322,6 +1332,18 @@ spa_unload(spa_t *spa)
 	 */
 	spa_async_suspend(spa);
 
+	/*
+	 * Stop any ongoing L2ARC rebuild.
+	 */
+	l2arc_spa_rebuild_stop(spa);
+
+	/*
+	 * Stop any raidz expansion or vdev removal, which need txgs to sync.
+	 */
+	if (spa->spa_root_vdev != NULL)
+		vdev_raidz_expand_stop(spa);
+	spa_vdev_removal_stop(spa);
+
 	/*
 	 * Stop syncing.
 	 */
@@ -1355,6 +1377,8 @@ spa_unload(spa_t *spa)
 
 	bpobj_close(&spa->spa_deferred_bpobj);
 
+	spa_vdev_removal_unload(spa);
+
 	spa_config_enter(spa, SCL_ALL, FTAG, RW_WRITER);
 
 	/*
@@ -1363,6 +1387,7 @@ spa_unload(spa_t *spa)
 	if (spa->spa_root_vdev)
 		vdev_free(spa->spa_root_vdev);
 	ASSERT(spa->spa_root_vdev == NULL);
+	spa_unload_log_sm_metadata(spa);
 
 	/*
 	 * Close the dsl pool.
@@ -2526,6 +2551,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	 */
 	spa->spa_state = POOL_STATE_ACTIVE;
 	spa->spa_ubsync = spa->spa_uberblock;
+	vdev_raidz_expand_load(spa);
 	spa->spa_verify_min_txg = spa->spa_extreme_rewind ?
 	    TXG_INITIAL - 1 : spa_last_synced_txg(spa) - TXG_DEFER_SIZE - 1;
 	spa->spa_first_txg = spa->spa_last_ubsync_txg ?
@@ -2538,6 +2564,11 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 	spa->spa_meta_objset = spa->spa_dsl_pool->dp_meta_objset;
 
+	/*
+	 * Reads of blocks on removed vdevs go through their mappings.
+	 */
+	vdev_indirect_load(spa);
+
 	if (spa_dir_prop(spa, DMU_POOL_CONFIG, &spa->spa_config_object) != 0)
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 
@@ -2847,6 +2878,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa_prop_find(spa, ZPOOL_PROP_DELEGATION, &spa->spa_delegation);
 		spa_prop_find(spa, ZPOOL_PROP_FAILUREMODE, &spa->spa_failmode);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
+		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &spa->spa_autotrim);
 		spa_prop_find(spa, ZPOOL_PROP_DEDUPDITTO,
 		    &spa->spa_dedup_ditto);
 
@@ -2878,6 +2910,20 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	 */
 	vdev_load(rvd);
 
+	/*
+	 * Apply the metaslab changes that are only in the log space maps.
+	 */
+	error = spa_ld_log_spacemaps(spa);
+	if (error != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, error));
+
+	/*
+	 * Load the state of any top-level vdev removal.
+	 */
+	error = spa_vdev_removal_load(spa);
+	if (error != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, error));
+
 	/*
 	 * Propagate the leaf DTLs we just loaded all the way up the tree.
 	 */
@@ -3034,8 +3080,20 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		 * Clean up any stale temporary dataset userrefs.
 		 */
 		dsl_pool_clean_tmp_userrefs(spa->spa_dsl_pool);
+
+		/*
+		 * Resume any raidz expansion or vdev removal.
+		 */
+		vdev_raidz_expand_start(spa);
+		spa_vdev_removal_resume(spa);
 	}
 
+	/*
+	 * Restore the contents of the L2ARC from the cache devices.
+	 */
+	if (state != SPA_LOAD_TRYIMPORT)
+		l2arc_spa_rebuild_start(spa);
+
 	return (0);
 }
 
@@ -3623,7 +3681,12 @@ spa_validate_aux_devs(spa_t *spa, nvlist_t *nvroot, uint64_t crtxg, int mode,
 		    mode)) != 0)
 			goto out;
 
-		if (!vd->vdev_ops->vdev_op_leaf) {
+		/*
+		 * Distributed spares are only added along with their
+		 * dRAID vdev.
+		 */
+		if (!vd->vdev_ops->vdev_op_leaf ||
+		    vd->vdev_ops == &vdev_draid_spare_ops) {
 			vdev_free(vd);
 			error = SET_ERROR(EINVAL);
 			goto out;
@@ -3750,6 +3813,22 @@ spa_l2cache_drop(spa_t *spa)
 	}
 }
 
+/*
+ * Does 'vd', a root vdev, have dRAID top-level vdevs?
+ */
+static boolean_t
+spa_has_draid(vdev_t *vd)
+{
+	int c;
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		if (vd->vdev_child[c]->vdev_ops == &vdev_draid_ops)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * Pool Creation
  */
@@ -3852,6 +3931,18 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	if (error == 0 && !zfs_allocatable_devs(nvroot))
 		error = SET_ERROR(EINVAL);
 
+	/*
+	 * dRAID vdevs need the draid feature to be enabled by the props.
+	 */
+	if (error == 0 && spa_has_draid(rvd)) {
+		char *fname = kmem_asprintf("feature@%s",
+		    spa_feature_table[SPA_FEATURE_DRAID].fi_uname);
+
+		if (props == NULL || !nvlist_exists(props, fname))
+			error = SET_ERROR(ENOTSUP);
+		strfree(fname);
+	}
+
 	if (error == 0 &&
 	    (error = vdev_create(rvd, txg, B_FALSE)) == 0 &&
 	    (error = spa_validate_aux(spa, nvroot, txg,
@@ -3859,6 +3950,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 		for (c = 0; c < rvd->vdev_children; c++) {
 			vdev_metaslab_set_size(rvd->vdev_child[c]);
 			vdev_expand(rvd->vdev_child[c], txg);
+			vdev_draid_spare_create(nvroot, rvd->vdev_child[c]);
 		}
 	}
 
@@ -3983,6 +4075,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_delegation = zpool_prop_default_numeric(ZPOOL_PROP_DELEGATION);
 	spa->spa_failmode = zpool_prop_default_numeric(ZPOOL_PROP_FAILUREMODE);
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
+	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
@@ -4492,10 +4585,30 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	if (vd->vdev_children == 0 && nspares == 0 && nl2cache == 0)
 		return (spa_vdev_exit(spa, vd, txg, EINVAL));
 
+	if (spa_has_draid(vd) &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_DRAID))
+		return (spa_vdev_exit(spa, vd, txg, ENOTSUP));
+
 	if (vd->vdev_children != 0 &&
 	    (error = vdev_create(vd, txg, B_FALSE)) != 0)
 		return (spa_vdev_exit(spa, vd, txg, error));
 
+	/*
+	 * The data of a vdev being removed can only be copied to vdevs of
+	 * the same kind and ashift.
+	 */
+	if (spa->spa_vdev_removal != NULL) {
+		for (c = 0; c < vd->vdev_children; c++) {
+			tvd = vd->vdev_child[c];
+			if (!tvd->vdev_islog &&
+			    (tvd->vdev_ops == &vdev_raidz_ops ||
+			    tvd->vdev_ops == &vdev_draid_ops ||
+			    tvd->vdev_ashift !=
+			    spa->spa_vdev_removal->svr_vdev->vdev_ashift))
+				return (spa_vdev_exit(spa, vd, txg, EINVAL));
+		}
+	}
+
 	/*
 	 * We must validate the spares and l2cache devices after checking the
 	 * children.  Otherwise, vdev_inuse() will blindly overwrite the spare.
@@ -4522,8 +4635,17 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 		tvd->vdev_id = id;
 		vdev_add_child(rvd, tvd);
 		vdev_config_dirty(tvd);
+
+		/*
+		 * Distributed spares are named after the id of their vdev.
+		 */
+		vdev_draid_spare_create(nvroot, tvd);
 	}
 
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES, &spares,
+	    &nspares) != 0)
+		nspares = 0;
+
 	if (nspares != 0) {
 		spa_set_aux_vdevs(&spa->spa_spares, spares, nspares,
 		    ZPOOL_CONFIG_SPARES);
@@ -4561,10 +4683,103 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	return (0);
 }
 
+/*
+ * Attach a new child to a raidz vdev to widen it.  The data already on the
+ * vdev is reflowed over the new child in the background.
+ */
+static int
+spa_vdev_attach_raidz(spa_t *spa, vdev_t *tvd, nvlist_t *nvroot,
+    int replacing, uint64_t txg)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *newrootvd, *newvd;
+	char *newvdpath;
+	uint64_t c;
+	int error;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_RAIDZ_EXPANSION) ||
+	    replacing || tvd->vdev_parent != rvd)
+		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+	/*
+	 * The durable reflow offset in the uberblock covers a single
+	 * expansion at a time.
+	 */
+	for (c = 0; c < rvd->vdev_children; c++) {
+		if (vdev_raidz_expanding(rvd->vdev_child[c]))
+			return (spa_vdev_exit(spa, NULL, txg, EALREADY));
+	}
+
+	/*
+	 * The reflow relies on every child holding its data.
+	 */
+	if (tvd->vdev_state != VDEV_STATE_HEALTHY ||
+	    !vdev_dtl_empty(tvd, DTL_MISSING))
+		return (spa_vdev_exit(spa, NULL, txg, ENXIO));
+
+	if (spa_config_parse(spa, &newrootvd, nvroot, NULL, 0,
+	    VDEV_ALLOC_ATTACH) != 0)
+		return (spa_vdev_exit(spa, NULL, txg, EINVAL));
+
+	if (newrootvd->vdev_children != 1)
+		return (spa_vdev_exit(spa, newrootvd, txg, EINVAL));
+
+	newvd = newrootvd->vdev_child[0];
+
+	if (!newvd->vdev_ops->vdev_op_leaf)
+		return (spa_vdev_exit(spa, newrootvd, txg, EINVAL));
+
+	if (newvd->vdev_ops == &vdev_draid_spare_ops || newvd->vdev_isspare)
+		return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
+
+	if ((error = vdev_create(newrootvd, txg, B_FALSE)) != 0)
+		return (spa_vdev_exit(spa, newrootvd, txg, error));
+
+	/*
+	 * Make sure the new device is big enough.
+	 */
+	if (newvd->vdev_asize < vdev_get_min_asize(tvd->vdev_child[0]))
+		return (spa_vdev_exit(spa, newrootvd, txg, EOVERFLOW));
+
+	/*
+	 * The new device cannot have a higher alignment requirement
+	 * than the top-level vdev.
+	 */
+	if (newvd->vdev_ashift > tvd->vdev_ashift)
+		return (spa_vdev_exit(spa, newrootvd, txg, EDOM));
+
+	vdev_remove_child(newrootvd, newvd);
+	newvd->vdev_id = tvd->vdev_children;
+	newvd->vdev_crtxg = txg;
+	vdev_add_child(tvd, newvd);
+	vdev_raidz_expand_attach(tvd, txg);
+
+	vdev_propagate_state(tvd);
+	vdev_config_dirty(tvd);
+	vdev_dirty(tvd, 0, NULL, txg);
+
+	spa_event_notify(spa, newvd, ESC_ZFS_VDEV_ATTACH);
+
+	newvdpath = spa_strdup(newvd->vdev_path);
+
+	vdev_raidz_expand_start(spa);
+
+	(void) spa_vdev_exit(spa, newrootvd, txg, 0);
+
+	spa_history_log_internal(spa, "vdev attach", NULL,
+	    "expand vdev=%llu with vdev=%s", (u_longlong_t)tvd->vdev_id,
+	    newvdpath);
+
+	spa_strfree(newvdpath);
+
+	return (0);
+}
+
 /*
  * Attach a device to a mirror.  The arguments are the path to any device
  * in the mirror, and the nvroot for the new device.  If the path specifies
  * a device that is not mirrored, we automatically insert the mirror vdev.
+ * If it specifies a raidz vdev, the device is added to it as a new child.
  *
  * If 'replacing' is specified, the new device is intended to replace the
  * existing device; in this case the two devices are made into their own
@@ -4594,6 +4809,17 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (oldvd == NULL)
 		return (spa_vdev_exit(spa, NULL, txg, ENODEV));
 
+	/*
+	 * The vdev being removed is copied as it stands.
+	 */
+	if (spa->spa_vdev_removal != NULL)
+		return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+
+	if (oldvd->vdev_ops == &vdev_raidz_ops) {
+		return (spa_vdev_attach_raidz(spa, oldvd, nvroot, replacing,
+		    txg));
+	}
+
 	if (!oldvd->vdev_ops->vdev_op_leaf)
 		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
 
@@ -4611,6 +4837,13 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (!newvd->vdev_ops->vdev_op_leaf)
 		return (spa_vdev_exit(spa, newrootvd, txg, EINVAL));
 
+	/*
+	 * A distributed spare can only replace a child of its dRAID vdev.
+	 */
+	if (newvd->vdev_ops == &vdev_draid_spare_ops && (!replacing ||
+	    vdev_draid_spare_get_parent(newvd) != oldvd->vdev_top))
+		return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
+
 	if ((error = vdev_create(newrootvd, txg, replacing)) != 0)
 		return (spa_vdev_exit(spa, newrootvd, txg, error));
 
@@ -5062,8 +5295,16 @@ spa_vdev_split_mirror(spa_t *spa, char *newname, nvlist_t *config,
 	    &children) != 0)
 		return (spa_vdev_exit(spa, NULL, txg, EINVAL));
 
-	/* first, check to ensure we've got the right child count */
+	/* the data of removed vdevs can't go along with the split */
 	rvd = spa->spa_root_vdev;
+	if (spa->spa_vdev_removal != NULL)
+		return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+	for (c = 0; c < rvd->vdev_children; c++) {
+		if (rvd->vdev_child[c]->vdev_ops == &vdev_indirect_ops)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+	}
+
+	/* first, check to ensure we've got the right child count */
 	lastlog = 0;
 	for (c = 0; c < rvd->vdev_children; c++) {
 		vdev_t *vd = rvd->vdev_child[c];
@@ -5451,8 +5692,9 @@ spa_vdev_remove_from_namespace(spa_t *spa, vdev_t *vd)
  * grab and release the spa_config_lock while still holding the namespace
  * lock.  During each step the configuration is synced out.
  *
- * Currently, this supports removing only hot spares, slogs, and level 2 ARC
- * devices.
+ * This supports removing hot spares, slogs, level 2 ARC devices, and
+ * top-level mirror and disk vdevs.  The latter are only started here, their
+ * data is copied elsewhere in the background (see vdev_removal.c).
  */
 int
 spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
@@ -5476,11 +5718,19 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 	    nvlist_lookup_nvlist_array(spa->spa_spares.sav_config,
 	    ZPOOL_CONFIG_SPARES, &spares, &nspares) == 0 &&
 	    (nv = spa_nvlist_lookup_by_guid(spares, nspares, guid)) != NULL) {
+		char *type;
+
 		/*
 		 * Only remove the hot spare if it's not currently in use
-		 * in this pool.
+		 * in this pool.  Distributed spares are part of their dRAID
+		 * vdev and only go away once they permanently replace a
+		 * failed child.
 		 */
-		if (vd == NULL || unspare) {
+		if (!unspare &&
+		    nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0 &&
+		    strcmp(type, VDEV_TYPE_DRAID_SPARE) == 0) {
+			error = SET_ERROR(ENOTSUP);
+		} else if (vd == NULL || unspare) {
 			if (vd == NULL)
 				vd = spa_lookup_by_guid(spa, guid, B_TRUE);
 			spa_event_notify(spa, vd, ESC_ZFS_VDEV_REMOVE_AUX);
@@ -5543,9 +5793,18 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		spa_event_notify(spa, vd, ESC_ZFS_VDEV_REMOVE_DEV);
 		spa_vdev_remove_from_namespace(spa, vd);
 
+	} else if (vd != NULL && vd == vd->vdev_top &&
+	    vd->vdev_ops != &vdev_indirect_ops) {
+		ASSERT(!locked);
+
+		/*
+		 * Copy the data of a top-level vdev elsewhere, and replace
+		 * it with an indirect vdev once done.
+		 */
+		error = spa_vdev_remove_top(vd, &txg);
 	} else if (vd != NULL) {
 		/*
-		 * Normal vdevs cannot be removed (yet).
+		 * Other vdevs cannot be removed.
 		 */
 		error = SET_ERROR(ENOTSUP);
 	} else {
@@ -5767,6 +6026,52 @@ spa_scan(spa_t *spa, pool_scan_func_t func)
 	return (dsl_scan(spa->spa_dsl_pool, func));
 }
 
+/*
+ * ==========================================================================
+ * SPA Trimming
+ * ==========================================================================
+ */
+
+static void
+spa_trim_sync(void *arg, dmu_tx_t *tx)
+{
+	pool_trim_func_t *funcp = arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t c, m;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		for (m = 0; m < vd->vdev_ms_count; m++) {
+			if (*funcp == POOL_TRIM_START)
+				metaslab_trim_all(vd->vdev_ms[m],
+				    dmu_tx_get_txg(tx));
+			else
+				metaslab_trim_cancel(vd->vdev_ms[m]);
+		}
+	}
+
+	spa_history_log_internal(spa, "trim", tx, "func=%u", *funcp);
+}
+
+/*
+ * Trim the free space of all loaded metaslabs, or stop trimming the space
+ * which has not been trimmed yet.  The trims themselves are issued as the
+ * metaslabs are synced and complete asynchronously.
+ */
+int
+spa_trim(spa_t *spa, pool_trim_func_t func)
+{
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == 0);
+
+	if (func >= POOL_TRIM_FUNCS)
+		return (SET_ERROR(ENOTSUP));
+
+	return (dsl_sync_task(spa_name(spa), NULL, spa_trim_sync, &func, 0,
+	    ZFS_SPACE_CHECK_NONE));
+}
+
 /*
  * ==========================================================================
  * SPA async task processing
@@ -5908,6 +6213,12 @@ spa_async_thread(spa_t *spa)
 	if (tasks & SPA_ASYNC_RESILVER)
 		dsl_resilver_restart(spa->spa_dsl_pool, 0);
 
+	/*
+	 * Replace a vdev which is done being removed by an indirect vdev.
+	 */
+	if (tasks & SPA_ASYNC_REMOVE_DONE)
+		spa_vdev_remove_complete(spa);
+
 	/*
 	 * Let the world know that we're done.
 	 */
@@ -6393,6 +6704,9 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 					spa_async_request(spa,
 					    SPA_ASYNC_AUTOEXPAND);
 				break;
+			case ZPOOL_PROP_AUTOTRIM:
+				spa->spa_autotrim = intval;
+				break;
 			case ZPOOL_PROP_DEDUPDITTO:
 				spa->spa_dedup_ditto = intval;
 				break;
@@ -6599,6 +6913,8 @@ spa_sync(spa_t *spa, uint64_t txg)
 	ASSERT3U(mc->mc_alloc_max_slots, <=,
 	    max_queue_depth * rvd->vdev_children);
 
+	spa_log_sm_sync_start(spa, tx);
+
 	/*
 	 * Iterate to convergence.
 	 */
@@ -6661,9 +6977,11 @@ spa_sync(spa_t *spa, uint64_t txg)
 				break;
 			}
 			spa_sync_deferred_frees(spa, tx);
+			spa_log_sm_cleanup(spa, tx);
 		}
 
 	} while (dmu_objset_is_dirty(mos, txg));
+	spa_log_sm_sync_done(spa, txg);
 
 #ifdef ZFS_DEBUG
 	if (!list_is_empty(&spa->spa_config_dirty_list)) {
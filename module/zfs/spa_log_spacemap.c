@@ -0,0 +1,668 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/metaslab_impl.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/vdev_impl.h>
+#include <sys/zap.h>
+
+/*
+ * Log Space Maps
+ *
+ * Without log space maps, every metaslab that is changed in a txg appends
+ * its allocations and frees to its own space map object, so a txg that
+ * touches many metaslabs writes at least one block per metaslab, plus the
+ * indirect blocks and dnodes above them, however small the change.
+ *
+ * With the log_spacemap feature, the changes of all the metaslabs in a txg
+ * are appended to a single pool-wide space map instead: the log space map
+ * of that txg.  Its entries are two words long, so that they can record the
+ * top-level vdev they apply to.  The log space maps of a pool are kept in
+ * the DMU_POOL_LOG_SPACEMAP_ZAP, keyed by txg.
+ *
+ * In core, each metaslab keeps the net effect of the changes logged since
+ * its space map was last brought up to date in ms_unflushed_allocs and
+ * ms_unflushed_frees, and metaslab_load() applies them on top of its space
+ * map.  Every txg a few metaslabs are flushed: their unflushed changes are
+ * written to their own space map in one go, and the txg of the flush is
+ * recorded in ms_unflushed_txg and, persistently, in a per-vdev array
+ * referenced from the top-level vdev ZAP.  A log space map is destroyed
+ * once every metaslab has been flushed at or after its txg, as none of its
+ * entries is needed anymore.
+ *
+ * The metaslabs are kept sorted by the txg of their last flush, and each
+ * txg the ones flushed longest ago are picked, enough of them to get around
+ * all of the metaslabs in zfs_unflushed_log_txg_max txgs.  More are flushed
+ * when the unflushed trees take too much memory or the log space maps too
+ * many blocks, since the latter is what has to be read to open the pool.
+ *
+ * When opening the pool, spa_ld_log_spacemaps() reads the log space maps
+ * in txg order and applies to each metaslab the entries logged after its
+ * last flush.
+ */
+
+/*
+ * Maximum amount of memory, as an absolute size and as parts per million
+ * of physical memory, that the unflushed trees of all metaslabs may use
+ * before flushing is stepped up.
+ */
+unsigned long zfs_unflushed_max_mem_amt = 1ULL << 30;
+int zfs_unflushed_max_mem_ppm = 1000;
+
+/*
+ * Maximum number of blocks in the log space maps of a pool before
+ * flushing is stepped up.  This bounds the amount of data read when
+ * opening the pool.
+ */
+unsigned long zfs_unflushed_log_block_max = 1ULL << 17;
+
+/*
+ * Number of txgs within which every metaslab should have been flushed.
+ */
+int zfs_unflushed_log_txg_max = 1000;
+
+/*
+ * Minimum number of metaslabs flushed per txg.
+ */
+int zfs_min_metaslabs_to_flush = 1;
+
+/*
+ * Block size of the log space map objects.  They are written sequentially
+ * and once, so unlike metaslab space maps they benefit from large blocks.
+ */
+int zfs_log_sm_blksz = 1 << 17;
+
+static int
+spa_log_sm_compare(const void *va, const void *vb)
+{
+	const spa_log_sm_t *a = va;
+	const spa_log_sm_t *b = vb;
+
+	return (AVL_CMP(a->sls_txg, b->sls_txg));
+}
+
+static int
+spa_flushed_ms_compare(const void *va, const void *vb)
+{
+	const metaslab_t *a = va;
+	const metaslab_t *b = vb;
+	int cmp;
+
+	cmp = AVL_CMP(a->ms_unflushed_txg, b->ms_unflushed_txg);
+	if (likely(cmp))
+		return (cmp);
+
+	cmp = AVL_CMP(a->ms_group->mg_vd->vdev_id,
+	    b->ms_group->mg_vd->vdev_id);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(a->ms_id, b->ms_id));
+}
+
+void
+spa_log_sm_init(spa_t *spa)
+{
+	mutex_init(&spa->spa_flushed_ms_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&spa->spa_metaslabs_by_flushed, spa_flushed_ms_compare,
+	    sizeof (metaslab_t), offsetof(metaslab_t, ms_unflushed_node));
+	avl_create(&spa->spa_sm_logs_by_txg, spa_log_sm_compare,
+	    sizeof (spa_log_sm_t), offsetof(spa_log_sm_t, sls_node));
+}
+
+void
+spa_log_sm_fini(spa_t *spa)
+{
+	avl_destroy(&spa->spa_sm_logs_by_txg);
+	avl_destroy(&spa->spa_metaslabs_by_flushed);
+	mutex_destroy(&spa->spa_flushed_ms_lock);
+}
+
+boolean_t
+spa_log_sm_enabled(spa_t *spa)
+{
+	return (spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP));
+}
+
+/*
+ * Whether the changes of the metaslabs of this top-level vdev go to the
+ * log space maps.  Log devices keep writing to their own space maps, so
+ * that they can still be removed, and so do vdevs without a top-level ZAP
+ * to record their flushes in.
+ */
+boolean_t
+spa_log_sm_vdev_enabled(vdev_t *vd)
+{
+	return (spa_log_sm_enabled(vd->vdev_spa) && !vd->vdev_islog &&
+	    vd->vdev_top_zap != 0);
+}
+
+void
+spa_log_sm_track_metaslab(metaslab_t *msp, uint64_t txg)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(!msp->ms_unflushed_tracked);
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	msp->ms_unflushed_txg = txg;
+	avl_add(&spa->spa_metaslabs_by_flushed, msp);
+	msp->ms_unflushed_tracked = B_TRUE;
+	mutex_exit(&spa->spa_flushed_ms_lock);
+}
+
+void
+spa_log_sm_untrack_metaslab(metaslab_t *msp)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	if (!msp->ms_unflushed_tracked)
+		return;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	avl_remove(&spa->spa_metaslabs_by_flushed, msp);
+	msp->ms_unflushed_tracked = B_FALSE;
+	mutex_exit(&spa->spa_flushed_ms_lock);
+}
+
+/*
+ * The metaslab's unflushed changes have been written to its space map
+ * in this txg.  The unflushed trees are vacated in metaslab_sync_done().
+ */
+void
+spa_log_sm_metaslab_flushed(metaslab_t *msp, dmu_tx_t *tx)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT(msp->ms_unflushed_tracked);
+	ASSERT(!msp->ms_flushing);
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	avl_remove(&spa->spa_metaslabs_by_flushed, msp);
+	msp->ms_unflushed_txg = dmu_tx_get_txg(tx);
+	avl_add(&spa->spa_metaslabs_by_flushed, msp);
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	msp->ms_flushing = B_TRUE;
+	msp->ms_flush_wanted = B_FALSE;
+	spa->spa_log_sm_stats.slss_flushed++;
+	spa->spa_log_sm_stats.slss_flushed_txg++;
+}
+
+void
+spa_log_sm_segs_update(spa_t *spa, int64_t delta)
+{
+	atomic_add_64(&spa->spa_log_sm_stats.slss_nsegs, delta);
+}
+
+/*
+ * Look up the txg of the last flush of a metaslab, 0 if it has never been
+ * flushed.
+ */
+int
+metaslab_unflushed_txg_load(vdev_t *vd, uint64_t ms_id, uint64_t *txgp)
+{
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+	dmu_object_info_t doi;
+	uint64_t object;
+	int error;
+
+	*txgp = 0;
+	if (vd->vdev_top_zap == 0)
+		return (0);
+
+	error = zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1, &object);
+	if (error == ENOENT)
+		return (0);
+	if (error != 0)
+		return (error);
+
+	error = dmu_object_info(mos, object, &doi);
+	if (error != 0)
+		return (error);
+	if ((ms_id + 1) * sizeof (uint64_t) > doi.doi_max_offset)
+		return (0);
+
+	return (dmu_read(mos, object, ms_id * sizeof (uint64_t),
+	    sizeof (uint64_t), txgp, DMU_READ_PREFETCH));
+}
+
+/*
+ * Record the txg of the metaslab's flush on disk.
+ */
+void
+metaslab_unflushed_txg_sync(metaslab_t *msp, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	objset_t *mos = spa_meta_objset(vd->vdev_spa);
+	uint64_t txg = msp->ms_unflushed_txg;
+	uint64_t object;
+	int error;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+	ASSERT3U(vd->vdev_top_zap, !=, 0);
+
+	error = zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1, &object);
+	if (error == ENOENT) {
+		object = dmu_object_alloc(mos, DMU_OTN_UINT64_METADATA,
+		    SPA_MINBLOCKSIZE << 3, DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+		    &object, tx));
+	} else {
+		VERIFY0(error);
+	}
+
+	dmu_write(mos, object, msp->ms_id * sizeof (uint64_t),
+	    sizeof (uint64_t), &txg, tx);
+}
+
+/*
+ * A flush frees the blocks it rewrites, and those frees keep the metaslabs
+ * dirty for the next TXG_DEFER_SIZE txgs.  Flushing in txgs that carry
+ * nothing else would thus never let the pool go idle (txg_sync_stop()
+ * waits for the deferred frees to drain), so it's left for busy txgs.
+ */
+static boolean_t
+spa_log_sm_txg_idle(spa_t *spa, uint64_t txg)
+{
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+
+	return (txg_list_empty(&dp->dp_dirty_datasets, txg) &&
+	    txg_list_empty(&dp->dp_dirty_dirs, txg) &&
+	    txg_list_empty(&dp->dp_sync_tasks, txg));
+}
+
+/*
+ * Pick the metaslabs to flush in this txg, oldest flush first.  Beyond
+ * the share needed to cycle through all of them in
+ * zfs_unflushed_log_txg_max txgs, keep going while the unflushed trees
+ * or the log space maps are over their limits, counting what flushing
+ * the metaslabs picked so far would release.
+ */
+static void
+spa_flush_metaslabs(spa_t *spa, uint64_t txg)
+{
+	spa_log_sm_stats_t *stats = &spa->spa_log_sm_stats;
+	uint64_t nms, target, nflushed = 0;
+	uint64_t memlimit, nsegs, nblocks;
+	spa_log_sm_t *sls;
+	metaslab_t *msp;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	nms = avl_numnodes(&spa->spa_metaslabs_by_flushed);
+	if (nms == 0) {
+		mutex_exit(&spa->spa_flushed_ms_lock);
+		return;
+	}
+
+	target = MAX(zfs_min_metaslabs_to_flush,
+	    howmany(nms, MAX(zfs_unflushed_log_txg_max, 1)));
+	memlimit = MIN(zfs_unflushed_max_mem_amt,
+	    ptob(physmem) / 1000000 * zfs_unflushed_max_mem_ppm);
+	nsegs = stats->slss_nsegs;
+	nblocks = stats->slss_nblocks;
+	sls = avl_first(&spa->spa_sm_logs_by_txg);
+
+	for (msp = avl_first(&spa->spa_metaslabs_by_flushed); msp != NULL &&
+	    (nflushed < target || nsegs * sizeof (range_seg_t) > memlimit ||
+	    nblocks > zfs_unflushed_log_block_max);
+	    msp = AVL_NEXT(&spa->spa_metaslabs_by_flushed, msp)) {
+		metaslab_t *next;
+
+		ASSERT3U(msp->ms_unflushed_txg, <, txg);
+
+		msp->ms_flush_wanted = B_TRUE;
+		vdev_dirty(msp->ms_group->mg_vd, VDD_METASLAB, msp, txg);
+		nflushed++;
+
+		/*
+		 * The unflushed trees are only changed by spa_sync(), so
+		 * they can be looked at without the ms_lock.
+		 */
+		nsegs -= MIN(nsegs,
+		    avl_numnodes(&msp->ms_unflushed_allocs->rt_root) +
+		    avl_numnodes(&msp->ms_unflushed_frees->rt_root));
+
+		next = AVL_NEXT(&spa->spa_metaslabs_by_flushed, msp);
+		while (sls != NULL && (next == NULL ||
+		    sls->sls_txg <= next->ms_unflushed_txg)) {
+			nblocks -= MIN(nblocks, sls->sls_nblocks);
+			sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls);
+		}
+	}
+	mutex_exit(&spa->spa_flushed_ms_lock);
+}
+
+/*
+ * Called at the start of spa_sync(): activate the feature once enabled,
+ * and pick the metaslabs to flush in this txg.
+ */
+void
+spa_log_sm_sync_start(spa_t *spa, dmu_tx_t *tx)
+{
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	spa->spa_log_sm_stats.slss_flushed_txg = 0;
+
+	if (spa_log_sm_txg_idle(spa, txg))
+		return;
+
+	if (spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP) &&
+	    !spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+		spa_feature_incr(spa, SPA_FEATURE_LOG_SPACEMAP, tx);
+
+	if (spa_log_sm_enabled(spa))
+		spa_flush_metaslabs(spa, txg);
+}
+
+/*
+ * Return the log space map of the syncing txg, creating it on first use.
+ */
+space_map_t *
+spa_log_sm_syncing(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+	spa_log_sm_t *sls;
+	uint64_t object;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+	ASSERT(spa_log_sm_enabled(spa));
+
+	if (spa->spa_syncing_log_sm != NULL)
+		return (spa->spa_syncing_log_sm);
+
+	if (spa->spa_log_sm_zap == 0) {
+		spa->spa_log_sm_zap = zap_create(mos, DMU_OTN_ZAP_METADATA,
+		    DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (uint64_t), 1,
+		    &spa->spa_log_sm_zap, tx));
+	}
+
+	object = space_map_alloc(mos, zfs_log_sm_blksz, tx);
+	VERIFY0(zap_add_int_key(mos, spa->spa_log_sm_zap, txg, object, tx));
+	VERIFY0(space_map_open(&spa->spa_syncing_log_sm, mos, object, 0,
+	    UINT64_MAX, SPA_MINBLOCKSHIFT, NULL));
+
+	sls = kmem_zalloc(sizeof (spa_log_sm_t), KM_SLEEP);
+	sls->sls_sm_obj = object;
+	sls->sls_txg = txg;
+	avl_add(&spa->spa_sm_logs_by_txg, sls);
+
+	return (spa->spa_syncing_log_sm);
+}
+
+/*
+ * Destroy the log space maps that no metaslab needs anymore.  Called in
+ * the first sync pass, once this txg's flushes have been written.
+ */
+void
+spa_log_sm_cleanup(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t oldest;
+	spa_log_sm_t *sls;
+	metaslab_t *msp;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	msp = avl_first(&spa->spa_metaslabs_by_flushed);
+	oldest = (msp != NULL) ? msp->ms_unflushed_txg : txg;
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	while ((sls = avl_first(&spa->spa_sm_logs_by_txg)) != NULL &&
+	    sls->sls_txg < txg && sls->sls_txg <= oldest) {
+		space_map_t *sm = NULL;
+
+		VERIFY0(space_map_open(&sm, mos, sls->sls_sm_obj, 0,
+		    UINT64_MAX, SPA_MINBLOCKSHIFT, NULL));
+		space_map_free(sm, tx);
+		space_map_close(sm);
+		VERIFY0(zap_remove_int(mos, spa->spa_log_sm_zap,
+		    sls->sls_txg, tx));
+
+		spa->spa_log_sm_stats.slss_nblocks -= sls->sls_nblocks;
+		spa->spa_log_sm_stats.slss_destroyed++;
+		avl_remove(&spa->spa_sm_logs_by_txg, sls);
+		kmem_free(sls, sizeof (spa_log_sm_t));
+	}
+}
+
+/*
+ * The syncing txg is done with its log space map; account for its size.
+ */
+void
+spa_log_sm_sync_done(spa_t *spa, uint64_t txg)
+{
+	space_map_t *sm = spa->spa_syncing_log_sm;
+	spa_log_sm_t *sls;
+
+	if (sm == NULL)
+		return;
+
+	sls = avl_last(&spa->spa_sm_logs_by_txg);
+	ASSERT3U(sls->sls_txg, ==, txg);
+	ASSERT3U(sls->sls_sm_obj, ==, space_map_object(sm));
+
+	sls->sls_nblocks = howmany(sm->sm_phys->smp_objsize, sm->sm_blksz);
+	spa->spa_log_sm_stats.slss_nblocks += sls->sls_nblocks;
+
+	space_map_close(sm);
+	spa->spa_syncing_log_sm = NULL;
+}
+
+typedef struct spa_ld_log_sm_arg {
+	spa_t		*slls_spa;
+	uint64_t	slls_txg;
+} spa_ld_log_sm_arg_t;
+
+static int
+spa_ld_log_sm_cb(space_map_entry_t *sme, void *arg)
+{
+	spa_ld_log_sm_arg_t *slls = arg;
+	vdev_t *vd;
+	metaslab_t *msp;
+	uint64_t m;
+
+	if (sme->sme_vdev >= slls->slls_spa->spa_root_vdev->vdev_children)
+		return (SET_ERROR(EIO));
+
+	/*
+	 * The metaslabs of a vdev that could not be opened are not
+	 * loaded, and there's nothing to apply the entry to.
+	 */
+	vd = vdev_lookup_top(slls->slls_spa, sme->sme_vdev);
+	if (vd->vdev_ms == NULL || !spa_log_sm_vdev_enabled(vd))
+		return (0);
+
+	m = sme->sme_offset >> vd->vdev_ms_shift;
+	if (m >= vd->vdev_ms_count ||
+	    sme->sme_offset + sme->sme_run > (m + 1) << vd->vdev_ms_shift)
+		return (SET_ERROR(EIO));
+
+	msp = vd->vdev_ms[m];
+	if (slls->slls_txg <= msp->ms_unflushed_txg)
+		return (0);
+
+	metaslab_unflushed_replay(msp, sme->sme_type, sme->sme_offset,
+	    sme->sme_run);
+	return (0);
+}
+
+/*
+ * Read the log space maps of the pool and apply their entries to the
+ * metaslabs, which have been loaded by vdev_load().
+ */
+int
+spa_ld_log_spacemaps(spa_t *spa)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	vdev_t *rvd = spa->spa_root_vdev;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	spa_log_sm_t *sls;
+	uint64_t oldest, c, m;
+	int error;
+
+	if (!spa_log_sm_enabled(spa))
+		return (0);
+
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (uint64_t), 1,
+	    &spa->spa_log_sm_zap);
+	if (error == ENOENT) {
+		spa->spa_log_sm_zap = 0;
+		error = 0;
+	}
+	if (error != 0)
+		return (error);
+
+	if (spa->spa_log_sm_zap != 0) {
+		for (zap_cursor_init(&zc, mos, spa->spa_log_sm_zap);
+		    (error = zap_cursor_retrieve(&zc, &za)) == 0;
+		    zap_cursor_advance(&zc)) {
+			sls = kmem_zalloc(sizeof (spa_log_sm_t), KM_SLEEP);
+			sls->sls_txg = strtonum(za.za_name, NULL);
+			sls->sls_sm_obj = za.za_first_integer;
+			avl_add(&spa->spa_sm_logs_by_txg, sls);
+		}
+		zap_cursor_fini(&zc);
+		if (error != ENOENT)
+			return (error);
+	}
+
+	/*
+	 * A metaslab that was never flushed has no entries in the logs
+	 * older than the oldest one left, or in any log if none is left.
+	 */
+	sls = avl_first(&spa->spa_sm_logs_by_txg);
+	oldest = (sls != NULL) ? sls->sls_txg - 1 : spa_last_synced_txg(spa);
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (vd->vdev_ms == NULL || !spa_log_sm_vdev_enabled(vd))
+			continue;
+
+		for (m = 0; m < vd->vdev_ms_count; m++) {
+			metaslab_t *msp = vd->vdev_ms[m];
+
+			spa_log_sm_track_metaslab(msp,
+			    MAX(msp->ms_unflushed_txg, oldest));
+		}
+	}
+
+	for (sls = avl_first(&spa->spa_sm_logs_by_txg); sls != NULL;
+	    sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
+		spa_ld_log_sm_arg_t slls;
+		space_map_t *sm = NULL;
+
+		error = space_map_open(&sm, mos, sls->sls_sm_obj, 0,
+		    UINT64_MAX, SPA_MINBLOCKSHIFT, NULL);
+		if (error != 0)
+			return (error);
+
+		sls->sls_nblocks = howmany(sm->sm_phys->smp_objsize,
+		    sm->sm_blksz);
+		spa->spa_log_sm_stats.slss_nblocks += sls->sls_nblocks;
+
+		slls.slls_spa = spa;
+		slls.slls_txg = sls->sls_txg;
+		error = space_map_iterate(sm, spa_ld_log_sm_cb, &slls);
+		space_map_close(sm);
+		if (error != 0)
+			return (error);
+	}
+
+	/*
+	 * The weights were computed before the unflushed changes were
+	 * known.
+	 */
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (vd->vdev_ms == NULL || !spa_log_sm_vdev_enabled(vd))
+			continue;
+
+		for (m = 0; m < vd->vdev_ms_count; m++)
+			metaslab_recalculate_weight_and_sort(vd->vdev_ms[m]);
+	}
+
+	return (0);
+}
+
+/*
+ * Drop the in-core list of log space maps when the pool is unloaded.  The
+ * metaslabs have already left spa_metaslabs_by_flushed in metaslab_fini().
+ */
+void
+spa_unload_log_sm_metadata(spa_t *spa)
+{
+	spa_log_sm_t *sls;
+	void *cookie = NULL;
+
+	ASSERT3P(spa->spa_syncing_log_sm, ==, NULL);
+	ASSERT0(avl_numnodes(&spa->spa_metaslabs_by_flushed));
+
+	while ((sls = avl_destroy_nodes(&spa->spa_sm_logs_by_txg,
+	    &cookie)) != NULL)
+		kmem_free(sls, sizeof (spa_log_sm_t));
+
+	spa->spa_log_sm_zap = 0;
+	bzero(&spa->spa_log_sm_stats, sizeof (spa_log_sm_stats_t));
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_unflushed_max_mem_amt, ulong, 0644);
+MODULE_PARM_DESC(zfs_unflushed_max_mem_amt,
+	"memory for unflushed metaslab changes before flushing more");
+
+module_param(zfs_unflushed_max_mem_ppm, int, 0644);
+MODULE_PARM_DESC(zfs_unflushed_max_mem_ppm,
+	"share of memory (ppm) for unflushed changes before flushing more");
+
+module_param(zfs_unflushed_log_block_max, ulong, 0644);
+MODULE_PARM_DESC(zfs_unflushed_log_block_max,
+	"log space map blocks before flushing more metaslabs");
+
+module_param(zfs_unflushed_log_txg_max, int, 0644);
+MODULE_PARM_DESC(zfs_unflushed_log_txg_max,
+	"txgs within which every metaslab is flushed");
+
+module_param(zfs_min_metaslabs_to_flush, int, 0644);
+MODULE_PARM_DESC(zfs_min_metaslabs_to_flush,
+	"minimum number of metaslabs flushed per txg");
+
+module_param(zfs_log_sm_blksz, int, 0644);
+MODULE_PARM_DESC(zfs_log_sm_blksz,
+	"block size of the log space map objects");
+#endif
@@ -38,6 +38,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
 #include <sys/vdev_raidz.h>
+#include <sys/sha2_mb.h>
 #include <sys/metaslab.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
@@ -350,6 +351,14 @@ int spa_asize_inflation = 24;
 int spa_slop_shift = 5;
 uint64_t spa_min_slop = 128 * 1024 * 1024;
 
+/*
+ * Percentage of the special class which is kept for metadata.  Small file
+ * blocks (see the special_small_blocks property) are only placed in the
+ * special class while its allocated space is below the remainder, so that
+ * they can't crowd out the metadata it exists for.
+ */
+int zfs_special_class_metadata_reserve_pct = 25;
+
 /*
  * ==========================================================================
  * SPA config locking
@@ -602,7 +611,10 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 
 	refcount_create(&spa->spa_refcount);
 	spa_config_lock_init(spa);
+	spa_log_sm_init(spa);
 	spa_stats_init(spa);
+	spa_keystore_init(&spa->spa_keystore);
+	zio_checksum_batch_init(spa);
 
 	avl_add(&spa_namespace_avl, spa);
 
@@ -705,13 +717,16 @@ spa_remove(spa_t *spa)
 
 	refcount_destroy(&spa->spa_refcount);
 
+	spa_keystore_fini(&spa->spa_keystore);
 	spa_stats_destroy(spa);
+	spa_log_sm_fini(spa);
 	spa_config_lock_destroy(spa);
 
 	for (t = 0; t < TXG_SIZE; t++)
 		bplist_destroy(&spa->spa_free_bplist[t]);
 
 	zio_checksum_templates_free(spa);
+	zio_checksum_batch_fini(spa);
 
 	cv_destroy(&spa->spa_async_cv);
 	cv_destroy(&spa->spa_evicting_os_cv);
@@ -1097,6 +1112,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	 */
 	ASSERT(metaslab_class_validate(spa_normal_class(spa)) == 0);
 	ASSERT(metaslab_class_validate(spa_log_class(spa)) == 0);
+	ASSERT(metaslab_class_validate(spa_special_class(spa)) == 0);
 
 	spa_config_exit(spa, SCL_ALL, spa);
 
@@ -1644,7 +1660,20 @@ void
 spa_update_dspace(spa_t *spa)
 {
 	spa->spa_dspace = metaslab_class_get_dspace(spa_normal_class(spa)) +
+	    metaslab_class_get_dspace(spa_special_class(spa)) +
 	    ddt_get_dedup_dspace(spa);
+
+	/*
+	 * The space of a vdev being removed is still part of its class,
+	 * but can't be allocated from anymore.
+	 */
+	if (spa->spa_vdev_removal != NULL) {
+		vdev_t *vd = spa->spa_vdev_removal->svr_vdev;
+		uint64_t space = spa_deflate(spa) ?
+		    vd->vdev_stat.vs_dspace : vd->vdev_stat.vs_space;
+
+		spa->spa_dspace -= MIN(space, spa->spa_dspace);
+	}
 }
 
 /*
@@ -1687,6 +1716,43 @@ spa_log_class(spa_t *spa)
 	return (spa->spa_log_class);
 }
 
+metaslab_class_t *
+spa_special_class(spa_t *spa)
+{
+	return (spa->spa_special_class);
+}
+
+/*
+ * Locate an appropriate allocation class for a block.  When the pool has
+ * special vdevs, all metadata and any file data blocks no larger than the
+ * dataset's special_small_blocks are placed on them.  Everything else goes
+ * to the normal class, as does everything once the special class is full.
+ */
+metaslab_class_t *
+spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
+    uint_t level, uint_t special_smallblk)
+{
+	metaslab_class_t *special = spa_special_class(spa);
+	uint64_t space, limit;
+
+	if (!spa_has_special(spa))
+		return (spa_normal_class(spa));
+
+	if (level > 0 || DMU_OT_IS_METADATA(objtype))
+		return (special);
+
+	if (size > special_smallblk)
+		return (spa_normal_class(spa));
+
+	space = metaslab_class_get_space(special);
+	limit = space * (100 - MIN(zfs_special_class_metadata_reserve_pct,
+	    100)) / 100;
+	if (metaslab_class_get_alloc(special) >= limit)
+		return (spa_normal_class(spa));
+
+	return (special);
+}
+
 void
 spa_evicting_os_register(spa_t *spa, objset_t *os)
 {
@@ -1857,6 +1923,7 @@ spa_init(int mode)
 	zil_init();
 	vdev_cache_stat_init();
 	vdev_raidz_math_init();
+	sha2_mb_init();
 	vdev_file_init();
 	zfs_prop_init();
 	zpool_prop_init();
@@ -1875,6 +1942,7 @@ spa_fini(void)
 	vdev_file_fini();
 	vdev_cache_stat_fini();
 	vdev_raidz_math_fini();
+	sha2_mb_fini();
 	zil_fini();
 	dmu_fini();
 	zio_fini();
@@ -1906,6 +1974,12 @@ spa_has_slogs(spa_t *spa)
 	return (spa->spa_log_class->mc_rotor != NULL);
 }
 
+boolean_t
+spa_has_special(spa_t *spa)
+{
+	return (spa->spa_special_class->mc_rotor != NULL);
+}
+
 spa_log_state_t
 spa_get_log_state(spa_t *spa)
 {
@@ -2083,6 +2157,8 @@ EXPORT_SYMBOL(spa_update_dspace);
 EXPORT_SYMBOL(spa_deflate);
 EXPORT_SYMBOL(spa_normal_class);
 EXPORT_SYMBOL(spa_log_class);
+EXPORT_SYMBOL(spa_special_class);
+EXPORT_SYMBOL(spa_preferred_class);
 EXPORT_SYMBOL(spa_max_replication);
 EXPORT_SYMBOL(spa_prev_software_version);
 EXPORT_SYMBOL(spa_get_failmode);
@@ -2110,6 +2186,7 @@ EXPORT_SYMBOL(dva_get_dsize_sync);
 EXPORT_SYMBOL(bp_get_dsize_sync);
 EXPORT_SYMBOL(bp_get_dsize);
 EXPORT_SYMBOL(spa_has_slogs);
+EXPORT_SYMBOL(spa_has_special);
 EXPORT_SYMBOL(spa_is_root);
 EXPORT_SYMBOL(spa_writeable);
 EXPORT_SYMBOL(spa_mode);
@@ -2142,5 +2219,9 @@ MODULE_PARM_DESC(spa_asize_inflation,
 
 module_param(spa_slop_shift, int, 0644);
 MODULE_PARM_DESC(spa_slop_shift, "Reserved free space in pool");
+
+module_param(zfs_special_class_metadata_reserve_pct, int, 0644);
+MODULE_PARM_DESC(zfs_special_class_metadata_reserve_pct,
+	"Percentage of the special class reserved for metadata");
 /* END CSTYLED */
 #endif
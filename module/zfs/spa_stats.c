@@ -21,6 +21,7 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa_impl.h>
+#include <sys/metaslab_impl.h>
 
 /*
  * Keeps stats on last N reads per spa_t, disabled by default.
@@ -701,6 +702,113 @@ spa_io_history_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Log Space Map Routines
+ * ==========================================================================
+ */
+
+/*
+ * Log space map statistics - the size of the pool's log space maps and
+ * of the unflushed changes they hold, and how fast metaslabs get flushed.
+ */
+typedef struct spa_log_spacemap_stats {
+	kstat_named_t	log_spacemaps;
+	kstat_named_t	log_blocks;
+	kstat_named_t	unflushed_segments;
+	kstat_named_t	unflushed_bytes;
+	kstat_named_t	oldest_unflushed_txg;
+	kstat_named_t	metaslabs_tracked;
+	kstat_named_t	metaslabs_flushed;
+	kstat_named_t	metaslabs_flushed_last_txg;
+	kstat_named_t	log_spacemaps_destroyed;
+} spa_log_spacemap_stats_t;
+
+static spa_log_spacemap_stats_t spa_log_spacemap_stats_template = {
+	{ "log_spacemaps",			KSTAT_DATA_UINT64 },
+	{ "log_blocks",				KSTAT_DATA_UINT64 },
+	{ "unflushed_segments",			KSTAT_DATA_UINT64 },
+	{ "unflushed_bytes",			KSTAT_DATA_UINT64 },
+	{ "oldest_unflushed_txg",		KSTAT_DATA_UINT64 },
+	{ "metaslabs_tracked",			KSTAT_DATA_UINT64 },
+	{ "metaslabs_flushed",			KSTAT_DATA_UINT64 },
+	{ "metaslabs_flushed_last_txg",		KSTAT_DATA_UINT64 },
+	{ "log_spacemaps_destroyed",		KSTAT_DATA_UINT64 },
+};
+
+static int
+spa_log_spacemap_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_log_spacemap_stats_t *ks = ksp->ks_data;
+	spa_log_sm_stats_t *slss = &spa->spa_log_sm_stats;
+	metaslab_t *msp;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	ks->log_spacemaps.value.ui64 =
+	    avl_numnodes(&spa->spa_sm_logs_by_txg);
+	ks->log_blocks.value.ui64 = slss->slss_nblocks;
+	ks->unflushed_segments.value.ui64 = slss->slss_nsegs;
+	ks->unflushed_bytes.value.ui64 =
+	    slss->slss_nsegs * sizeof (range_seg_t);
+	ks->metaslabs_flushed.value.ui64 = slss->slss_flushed;
+	ks->metaslabs_flushed_last_txg.value.ui64 = slss->slss_flushed_txg;
+	ks->log_spacemaps_destroyed.value.ui64 = slss->slss_destroyed;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	msp = avl_first(&spa->spa_metaslabs_by_flushed);
+	ks->oldest_unflushed_txg.value.ui64 =
+	    (msp != NULL) ? msp->ms_unflushed_txg : 0;
+	ks->metaslabs_tracked.value.ui64 =
+	    avl_numnodes(&spa->spa_metaslabs_by_flushed);
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	return (0);
+}
+
+static void
+spa_log_spacemap_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.log_spacemap;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->size = sizeof (spa_log_spacemap_stats_t);
+	ssh->private = kmem_alloc(ssh->size, KM_SLEEP);
+	bcopy(&spa_log_spacemap_stats_template, ssh->private, ssh->size);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "log_spacemap", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (spa_log_spacemap_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->private;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_log_spacemap_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_log_spacemap_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.log_spacemap;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -708,11 +816,13 @@ spa_stats_init(spa_t *spa)
 	spa_txg_history_init(spa);
 	spa_tx_assign_init(spa);
 	spa_io_history_init(spa);
+	spa_log_spacemap_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_log_spacemap_destroy(spa);
 	spa_tx_assign_destroy(spa);
 	spa_txg_history_destroy(spa);
 	spa_read_history_destroy(spa);
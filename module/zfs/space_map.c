@@ -132,6 +132,87 @@ space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype)
 	return (error);
 }
 
+/*
+ * Call the callback for every alloc and free entry of the space map, in
+ * the order they were written.  Unlike space_map_load(), this handles the
+ * two-word entries of log space maps, and it neither uses sm_lock nor
+ * relies on space_map_update(): everything up to the on-disk length of
+ * the object is visited.  The iteration stops at the first non-zero
+ * return of the callback, which is passed back to the caller.
+ */
+int
+space_map_iterate(space_map_t *sm, sm_cb_t callback, void *arg)
+{
+	uint64_t *entry, *entry_map, *entry_map_end;
+	uint64_t bufsize, size, offset, end;
+	uint64_t first = 0;
+	boolean_t pending = B_FALSE;
+	int error = 0;
+
+	end = sm->sm_phys->smp_objsize;
+
+	bufsize = MAX(sm->sm_blksz, SPA_MINBLOCKSIZE);
+	entry_map = vmem_alloc(bufsize, KM_SLEEP);
+
+	if (end > bufsize) {
+		dmu_prefetch(sm->sm_os, space_map_object(sm), 0, bufsize,
+		    end - bufsize, ZIO_PRIORITY_SYNC_READ);
+	}
+
+	for (offset = 0; offset < end && error == 0; offset += bufsize) {
+		size = MIN(end - offset, bufsize);
+		VERIFY(P2PHASE(size, sizeof (uint64_t)) == 0);
+		VERIFY(size != 0);
+
+		error = dmu_read(sm->sm_os, space_map_object(sm), offset, size,
+		    entry_map, DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		entry_map_end = entry_map + (size / sizeof (uint64_t));
+		for (entry = entry_map; entry < entry_map_end; entry++) {
+			uint64_t e = *entry;
+			space_map_entry_t sme;
+
+			/*
+			 * The two words of an entry may be split across
+			 * two reads, so the first one is carried over.
+			 */
+			if (pending) {
+				pending = B_FALSE;
+				sme.sme_type = SM2_TYPE_DECODE(e);
+				sme.sme_vdev = SM2_VDEV_DECODE(first);
+				sme.sme_offset = (SM2_OFFSET_DECODE(e) <<
+				    sm->sm_shift) + sm->sm_start;
+				sme.sme_run = SM2_RUN_DECODE(first) <<
+				    sm->sm_shift;
+			} else if (SM_DEBUG_DECODE(e)) {
+				if (SM_PREFIX_DECODE(e) == SM2_PREFIX) {
+					first = e;
+					pending = B_TRUE;
+				}
+				continue;
+			} else {
+				sme.sme_type = SM_TYPE_DECODE(e);
+				sme.sme_vdev = SM_NO_VDEVID;
+				sme.sme_offset = (SM_OFFSET_DECODE(e) <<
+				    sm->sm_shift) + sm->sm_start;
+				sme.sme_run = SM_RUN_DECODE(e) << sm->sm_shift;
+			}
+
+			error = callback(&sme, arg);
+			if (error != 0)
+				break;
+		}
+	}
+
+	if (error == 0 && pending)
+		error = SET_ERROR(EIO);
+
+	vmem_free(entry_map, bufsize);
+	return (error);
+}
+
 void
 space_map_histogram_clear(space_map_t *sm)
 {
@@ -210,11 +291,12 @@ space_map_histogram_add(space_map_t *sm, range_tree_t *rt, dmu_tx_t *tx)
 }
 
 uint64_t
-space_map_entries(space_map_t *sm, range_tree_t *rt)
+space_map_entries(space_map_t *sm, range_tree_t *rt, boolean_t two_word)
 {
 	avl_tree_t *t = &rt->rt_root;
 	range_seg_t *rs;
 	uint64_t size, entries;
+	uint64_t run_max = two_word ? SM2_RUN_MAX : SM_RUN_MAX;
 
 	/*
 	 * All space_maps always have a debug entry so account for it here.
@@ -227,17 +309,23 @@ space_map_entries(space_map_t *sm, range_tree_t *rt)
 	 */
 	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
 		size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
-		entries += howmany(size, SM_RUN_MAX);
+		entries += howmany(size, run_max) * (two_word ? 2 : 1);
 	}
 	return (entries);
 }
 
 /*
- * Note: space_map_write() will drop sm_lock across dmu_write() calls.
+ * Write the range tree to the space map.  One-word entries are relative
+ * to sm_start.  When vdev_id is not SM_NO_VDEVID, two-word entries that
+ * record the vdev are written instead and the space map's allocated space
+ * is left alone; this is only done for log space maps, which track the
+ * changes of many metaslabs.
+ *
+ * Note: this will drop the range tree's lock across dmu_write() calls.
  */
-void
-space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
-    dmu_tx_t *tx)
+static void
+space_map_write_impl(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
+    uint64_t vdev_id, dmu_tx_t *tx)
 {
 	objset_t *os = sm->sm_os;
 	spa_t *spa = dmu_objset_spa(os);
@@ -246,9 +334,13 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	uint64_t size, total, rt_space, nodes;
 	uint64_t *entry, *entry_map, *entry_map_end;
 	uint64_t expected_entries, actual_entries = 1;
+	boolean_t two_word = (vdev_id != SM_NO_VDEVID);
+	uint64_t run_max = two_word ? SM2_RUN_MAX : SM_RUN_MAX;
+	int words = two_word ? 2 : 1;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 	ASSERT(dsl_pool_sync_context(dmu_objset_pool(os)));
+	ASSERT3U(vdev_id, <=, SM_NO_VDEVID);
 	VERIFY3U(space_map_object(sm), !=, 0);
 	dmu_buf_will_dirty(sm->sm_dbuf, tx);
 
@@ -264,12 +356,14 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 		return;
 	}
 
-	if (maptype == SM_ALLOC)
-		sm->sm_phys->smp_alloc += range_tree_space(rt);
-	else
-		sm->sm_phys->smp_alloc -= range_tree_space(rt);
+	if (!two_word) {
+		if (maptype == SM_ALLOC)
+			sm->sm_phys->smp_alloc += range_tree_space(rt);
+		else
+			sm->sm_phys->smp_alloc -= range_tree_space(rt);
+	}
 
-	expected_entries = space_map_entries(sm, rt);
+	expected_entries = space_map_entries(sm, rt, two_word);
 
 	entry_map = vmem_alloc(sm->sm_blksz, KM_SLEEP);
 	entry_map_end = entry_map + (sm->sm_blksz / sizeof (uint64_t));
@@ -294,25 +388,42 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 		while (size != 0) {
 			uint64_t run_len;
 
-			run_len = MIN(size, SM_RUN_MAX);
+			run_len = MIN(size, run_max);
+
+			/*
+			 * The two words of an entry may end up in different
+			 * blocks, since a write may start in the middle of
+			 * a block; space_map_iterate() copes with that.
+			 */
+			if (entry_map_end - entry < words) {
+				uint64_t len = (entry - entry_map) *
+				    sizeof (uint64_t);
 
-			if (entry == entry_map_end) {
 				mutex_exit(rt->rt_lock);
 				dmu_write(os, space_map_object(sm),
-				    sm->sm_phys->smp_objsize, sm->sm_blksz,
+				    sm->sm_phys->smp_objsize, len,
 				    entry_map, tx);
 				mutex_enter(rt->rt_lock);
-				sm->sm_phys->smp_objsize += sm->sm_blksz;
+				sm->sm_phys->smp_objsize += len;
 				entry = entry_map;
 			}
 
-			*entry++ = SM_OFFSET_ENCODE(start) |
-			    SM_TYPE_ENCODE(maptype) |
-			    SM_RUN_ENCODE(run_len);
+			if (two_word) {
+				*entry++ = SM_DEBUG_ENCODE(1) |
+				    BF64_ENCODE(SM2_PREFIX, 62, 2) |
+				    SM2_RUN_ENCODE(run_len) |
+				    SM2_VDEV_ENCODE(vdev_id);
+				*entry++ = SM2_TYPE_ENCODE(maptype) |
+				    SM2_OFFSET_ENCODE(start);
+			} else {
+				*entry++ = SM_OFFSET_ENCODE(start) |
+				    SM_TYPE_ENCODE(maptype) |
+				    SM_RUN_ENCODE(run_len);
+			}
 
 			start += run_len;
 			size -= run_len;
-			actual_entries++;
+			actual_entries += words;
 		}
 	}
 
@@ -337,6 +448,28 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	vmem_free(entry_map, sm->sm_blksz);
 }
 
+/*
+ * Note: space_map_write() will drop sm_lock across dmu_write() calls.
+ */
+void
+space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
+    dmu_tx_t *tx)
+{
+	space_map_write_impl(sm, rt, maptype, SM_NO_VDEVID, tx);
+}
+
+/*
+ * Append the range tree, which holds absolute offsets within the given
+ * top-level vdev, to a log space map.
+ */
+void
+space_map_write_log(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
+    uint64_t vdev_id, dmu_tx_t *tx)
+{
+	ASSERT3U(sm->sm_start, ==, 0);
+	space_map_write_impl(sm, rt, maptype, vdev_id, tx);
+}
+
 static int
 space_map_open_impl(space_map_t *sm)
 {
@@ -432,7 +565,7 @@ space_map_truncate(space_map_t *sm, dmu_tx_t *tx)
 		space_map_free(sm, tx);
 		dmu_buf_rele(sm->sm_dbuf, sm);
 
-		sm->sm_object = space_map_alloc(sm->sm_os, tx);
+		sm->sm_object = space_map_alloc(sm->sm_os, space_map_blksz, tx);
 		VERIFY0(space_map_open_impl(sm));
 	} else {
 		VERIFY0(dmu_free_range(os, space_map_object(sm), 0, -1ULL, tx));
@@ -467,7 +600,7 @@ space_map_update(space_map_t *sm)
 }
 
 uint64_t
-space_map_alloc(objset_t *os, dmu_tx_t *tx)
+space_map_alloc(objset_t *os, int blocksize, dmu_tx_t *tx)
 {
 	spa_t *spa = dmu_objset_spa(os);
 	uint64_t object;
@@ -482,25 +615,24 @@ space_map_alloc(objset_t *os, dmu_tx_t *tx)
 	}
 
 	object = dmu_object_alloc(os,
-	    DMU_OT_SPACE_MAP, space_map_blksz,
+	    DMU_OT_SPACE_MAP, blocksize,
 	    DMU_OT_SPACE_MAP_HEADER, bonuslen, tx);
 
 	return (object);
 }
 
+/*
+ * Free a space map object which isn't open.
+ */
 void
-space_map_free(space_map_t *sm, dmu_tx_t *tx)
+space_map_free_obj(objset_t *os, uint64_t smobj, dmu_tx_t *tx)
 {
-	spa_t *spa;
-
-	if (sm == NULL)
-		return;
+	spa_t *spa = dmu_objset_spa(os);
 
-	spa = dmu_objset_spa(sm->sm_os);
 	if (spa_feature_is_enabled(spa, SPA_FEATURE_SPACEMAP_HISTOGRAM)) {
 		dmu_object_info_t doi;
 
-		dmu_object_info_from_db(sm->sm_dbuf, &doi);
+		VERIFY0(dmu_object_info(os, smobj, &doi));
 		if (doi.doi_bonus_size != SPACE_MAP_SIZE_V0) {
 			VERIFY(spa_feature_is_active(spa,
 			    SPA_FEATURE_SPACEMAP_HISTOGRAM));
@@ -509,7 +641,16 @@ space_map_free(space_map_t *sm, dmu_tx_t *tx)
 		}
 	}
 
-	VERIFY3U(dmu_object_free(sm->sm_os, space_map_object(sm), tx), ==, 0);
+	VERIFY0(dmu_object_free(os, smobj, tx));
+}
+
+void
+space_map_free(space_map_t *sm, dmu_tx_t *tx)
+{
+	if (sm == NULL)
+		return;
+
+	space_map_free_obj(sm->sm_os, space_map_object(sm), tx);
 	sm->sm_object = 0;
 }
 
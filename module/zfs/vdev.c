@@ -32,6 +32,9 @@
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/vdev_raidz.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -45,6 +48,7 @@
 #include <sys/dsl_scan.h>
 #include <sys/abd.h>
 #include <sys/zvol.h>
+#include <sys/zfeature.h>
 #include <sys/zfs_ratelimit.h>
 
 /*
@@ -60,6 +64,8 @@ int metaslabs_per_vdev = 200;
 static vdev_ops_t *vdev_ops_table[] = {
 	&vdev_root_ops,
 	&vdev_raidz_ops,
+	&vdev_draid_ops,
+	&vdev_draid_spare_ops,
 	&vdev_mirror_ops,
 	&vdev_replacing_ops,
 	&vdev_spare_ops,
@@ -67,6 +73,7 @@ static vdev_ops_t *vdev_ops_table[] = {
 	&vdev_file_ops,
 	&vdev_missing_ops,
 	&vdev_hole_ops,
+	&vdev_indirect_ops,
 	NULL
 };
 
@@ -131,10 +138,17 @@ vdev_get_min_asize(vdev_t *vd)
 
 	/*
 	 * The allocatable space for a raidz vdev is N * sizeof(smallest child),
-	 * so each child must provide at least 1/Nth of its asize.
+	 * so each child must provide at least 1/Nth of its asize.  A child
+	 * attached by an expansion doesn't count until the reflow is done.
 	 */
 	if (pvd->vdev_ops == &vdev_raidz_ops)
-		return (pvd->vdev_min_asize / pvd->vdev_children);
+		return (pvd->vdev_min_asize / vdev_raidz_physical_width(pvd));
+
+	/*
+	 * A dRAID child must hold its share of every row.
+	 */
+	if (pvd->vdev_ops == &vdev_draid_ops)
+		return (vdev_draid_child_min_asize(pvd));
 
 	return (pvd->vdev_min_asize);
 }
@@ -389,7 +403,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 {
 	vdev_ops_t *ops;
 	char *type;
-	uint64_t guid = 0, islog, nparity;
+	uint64_t guid = 0, islog, isspecial, nparity;
+	vdev_draid_config_t *vdc = NULL;
 	vdev_t *vd;
 
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
@@ -438,9 +453,23 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (islog && spa_version(spa) < SPA_VERSION_SLOGS)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Determine whether we're a special allocation class vdev.
+	 */
+	isspecial = 0;
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL, &isspecial);
+	if (isspecial && islog)
+		return (SET_ERROR(EINVAL));
+
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Indirect vdevs are only created by removing a top-level vdev.
+	 */
+	if (ops == &vdev_indirect_ops && alloctype != VDEV_ALLOC_LOAD)
+		return (SET_ERROR(EINVAL));
+
 	/*
 	 * Set the nparity property for RAID-Z vdevs.
 	 */
@@ -472,14 +501,50 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 			 */
 			nparity = 1;
 		}
+	} else if (ops == &vdev_draid_ops) {
+		uint64_t ndata, nspares = 0;
+		nvlist_t **child;
+		uint_t children;
+		int error;
+
+		/*
+		 * dRAID vdevs are only allowed at the top level, and their
+		 * layout is fully described by the config.
+		 */
+		if (parent == NULL || parent->vdev_ops != &vdev_root_ops ||
+		    nvlist_lookup_uint64(nv, ZPOOL_CONFIG_NPARITY,
+		    &nparity) != 0 ||
+		    nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA,
+		    &ndata) != 0 ||
+		    nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+		    &child, &children) != 0)
+			return (SET_ERROR(EINVAL));
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES,
+		    &nspares);
+
+		/*
+		 * Distributed spares cannot replace log devices, so a dRAID
+		 * log would only waste them.
+		 */
+		if (islog)
+			return (SET_ERROR(ENOTSUP));
+
+		error = vdev_draid_config_alloc(ndata, nparity, nspares,
+		    children, &vdc);
+		if (error != 0)
+			return (error);
 	} else {
 		nparity = 0;
 	}
 	ASSERT(nparity != -1ULL);
 
 	vd = vdev_alloc_common(spa, id, guid, ops);
+	vd->vdev_tsd = vdc;
+	if (ops == &vdev_raidz_ops)
+		vd->vdev_tsd = vdev_raidz_expand_alloc(nv);
 
 	vd->vdev_islog = islog;
+	vd->vdev_isspecial = isspecial;
 	vd->vdev_nparity = nparity;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
@@ -538,6 +603,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    &vd->vdev_removing);
 		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_VDEV_TOP_ZAP,
 		    &vd->vdev_top_zap);
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_INDIRECT_OBJECT,
+		    &vd->vdev_im_object);
 	} else {
 		ASSERT0(vd->vdev_top_zap);
 	}
@@ -548,7 +615,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
 		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd);
+		    spa_log_class(spa) : isspecial ? spa_special_class(spa) :
+		    spa_normal_class(spa), vd);
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
@@ -686,6 +754,13 @@ vdev_free(vdev_t *vd)
 	if (vd->vdev_fru)
 		spa_strfree(vd->vdev_fru);
 
+	if (vd->vdev_ops == &vdev_draid_ops)
+		vdev_draid_config_free(vd->vdev_tsd);
+	if (vd->vdev_ops == &vdev_raidz_ops)
+		vdev_raidz_expand_free(vd);
+	if (vd->vdev_indirect_mapping != NULL)
+		vdev_indirect_mapping_close(vd->vdev_indirect_mapping);
+
 	if (vd->vdev_isspare)
 		spa_spare_remove(vd);
 	if (vd->vdev_isl2cache)
@@ -780,6 +855,9 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+
+	tvd->vdev_isspecial = svd->vdev_isspecial;
+	svd->vdev_isspecial = 0;
 }
 
 static void
@@ -888,7 +966,7 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 {
 	spa_t *spa = vd->vdev_spa;
 	objset_t *mos = spa->spa_meta_objset;
-	uint64_t m;
+	uint64_t m, asize;
 	uint64_t oldc = vd->vdev_ms_count;
 	uint64_t newc = vd->vdev_asize >> vd->vdev_ms_shift;
 	metaslab_t **mspp;
@@ -910,8 +988,11 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	 * Even though SPA_MAXBLOCKSIZE changed, this algorithm can not change,
 	 * otherwise it would inconsistently account for existing bp's.
 	 */
-	vd->vdev_deflate_ratio = (1 << 17) /
-	    (vdev_psize_to_asize(vd, 1 << 17) >> SPA_MINBLOCKSHIFT);
+	if (vd->vdev_ops == &vdev_raidz_ops)
+		asize = vdev_raidz_deflate_asize(vd, 1 << 17);
+	else
+		asize = vdev_psize_to_asize(vd, 1 << 17);
+	vd->vdev_deflate_ratio = (1 << 17) / (asize >> SPA_MINBLOCKSHIFT);
 
 	ASSERT(oldc <= newc);
 
@@ -1289,9 +1370,10 @@ vdev_open(vdev_t *vd)
 	}
 
 	/*
-	 * For hole or missing vdevs we just return success.
+	 * For hole, missing or indirect vdevs we just return success.
 	 */
-	if (vd->vdev_ishole || vd->vdev_ops == &vdev_missing_ops)
+	if (vd->vdev_ishole || vd->vdev_ops == &vdev_missing_ops ||
+	    vd->vdev_ops == &vdev_indirect_ops)
 		return (0);
 
 	for (c = 0; c < vd->vdev_children; c++) {
@@ -1438,9 +1520,10 @@ vdev_validate(vdev_t *vd, boolean_t strict)
 	/*
 	 * If the device has already failed, or was marked offline, don't do
 	 * any further validation.  Otherwise, label I/O will fail and we will
-	 * overwrite the previous state.
+	 * overwrite the previous state.  Distributed spares have no label.
 	 */
-	if (vd->vdev_ops->vdev_op_leaf && vdev_readable(vd)) {
+	if (vd->vdev_ops->vdev_op_leaf &&
+	    vd->vdev_ops != &vdev_draid_spare_ops && vdev_readable(vd)) {
 		uint64_t aux_guid = 0;
 		nvlist_t *nvl;
 		uint64_t txg = spa_last_synced_txg(spa) != 0 ?
@@ -1671,6 +1754,15 @@ vdev_create(vdev_t *vd, uint64_t txg, boolean_t isreplacing)
 void
 vdev_metaslab_set_size(vdev_t *vd)
 {
+	/*
+	 * The metaslab size of a dRAID vdev is part of its layout and was
+	 * set when it was opened.
+	 */
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		ASSERT(vd->vdev_ms_shift != 0);
+		return;
+	}
+
 	/*
 	 * Aim for roughly metaslabs_per_vdev (default 200) metaslabs per vdev.
 	 */
@@ -1875,7 +1967,8 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 		vdev_dtl_reassess(vd->vdev_child[c], txg,
 		    scrub_txg, scrub_done);
 
-	if (vd == spa->spa_root_vdev || vd->vdev_ishole || vd->vdev_aux)
+	if (vd == spa->spa_root_vdev || vd->vdev_ishole || vd->vdev_aux ||
+	    vd->vdev_ops == &vdev_indirect_ops)
 		return;
 
 	if (vd->vdev_ops->vdev_op_leaf) {
@@ -2051,6 +2144,7 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 	if (vd->vdev_ops != &vdev_hole_ops &&
 	    vd->vdev_ops != &vdev_missing_ops &&
 	    vd->vdev_ops != &vdev_root_ops &&
+	    vd->vdev_ops != &vdev_indirect_ops &&
 	    !vd->vdev_top->vdev_removing) {
 		if (vd->vdev_ops->vdev_op_leaf && vd->vdev_leaf_zap == 0) {
 			vd->vdev_leaf_zap = vdev_create_link_zap(vd, tx);
@@ -2105,7 +2199,7 @@ vdev_dtl_sync(vdev_t *vd, uint64_t txg)
 	if (vd->vdev_dtl_sm == NULL) {
 		uint64_t new_object;
 
-		new_object = space_map_alloc(mos, tx);
+		new_object = space_map_alloc(mos, space_map_blksz, tx);
 		VERIFY3U(new_object, !=, 0);
 
 		VERIFY0(space_map_open(&vd->vdev_dtl_sm, mos, new_object,
@@ -2266,7 +2360,10 @@ vdev_validate_aux(vdev_t *vd)
 	uint64_t guid, version;
 	uint64_t state;
 
-	if (!vdev_readable(vd))
+	/*
+	 * Distributed spares have no label.
+	 */
+	if (!vdev_readable(vd) || vd->vdev_ops == &vdev_draid_spare_ops)
 		return (0);
 
 	if ((label = vdev_label_read_config(vd, -1ULL)) == NULL) {
@@ -2386,13 +2483,25 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 		    DMU_OT_OBJECT_ARRAY, 0, DMU_OT_NONE, 0, tx);
 		ASSERT(vd->vdev_ms_array != 0);
 		vdev_config_dirty(vd);
+		if (vd->vdev_ops == &vdev_draid_ops &&
+		    !spa_feature_is_active(spa, SPA_FEATURE_DRAID))
+			spa_feature_incr(spa, SPA_FEATURE_DRAID, tx);
+		dmu_tx_commit(tx);
+	}
+
+	if (vd->vdev_ops == &vdev_raidz_ops && vd->vdev_tsd != NULL &&
+	    !spa_feature_is_active(spa, SPA_FEATURE_RAIDZ_EXPANSION)) {
+		tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+		spa_feature_incr(spa, SPA_FEATURE_RAIDZ_EXPANSION, tx);
 		dmu_tx_commit(tx);
 	}
 
 	/*
-	 * Remove the metadata associated with this vdev once it's empty.
+	 * Remove the metadata associated with this log vdev once it's empty.
+	 * Removed data vdevs are cleaned up by vdev_removal.c instead.
 	 */
-	if (vd->vdev_stat.vs_alloc == 0 && vd->vdev_removing)
+	if (vd->vdev_stat.vs_alloc == 0 && vd->vdev_removing &&
+	    vd->vdev_islog)
 		vdev_remove(vd, txg);
 
 	while ((msp = txg_list_remove(&vd->vdev_ms_list, txg)) != NULL) {
@@ -3162,7 +3271,7 @@ vdev_space_update(vdev_t *vd, int64_t alloc_delta, int64_t defer_delta,
 	vd->vdev_stat.vs_dspace += dspace_delta;
 	mutex_exit(&vd->vdev_stat_lock);
 
-	if (mc == spa_normal_class(spa)) {
+	if (mc == spa_normal_class(spa) || mc == spa_special_class(spa)) {
 		mutex_enter(&rvd->vdev_stat_lock);
 		rvd->vdev_stat.vs_alloc += alloc_delta;
 		rvd->vdev_stat.vs_space += space_delta;
@@ -3252,7 +3361,7 @@ vdev_config_dirty(vdev_t *vd)
 		ASSERT(vd == vd->vdev_top);
 
 		if (!list_link_active(&vd->vdev_config_dirty_node) &&
-		    !vd->vdev_ishole)
+		    !vd->vdev_ishole && vd->vdev_ops != &vdev_indirect_ops)
 			list_insert_head(&spa->spa_config_dirty_list, vd);
 	}
 }
@@ -3294,7 +3403,8 @@ vdev_state_dirty(vdev_t *vd)
 	    (dsl_pool_sync_context(spa_get_dsl(spa)) &&
 	    spa_config_held(spa, SCL_STATE, RW_READER)));
 
-	if (!list_link_active(&vd->vdev_state_dirty_node) && !vd->vdev_ishole)
+	if (!list_link_active(&vd->vdev_state_dirty_node) &&
+	    !vd->vdev_ishole && vd->vdev_ops != &vdev_indirect_ops)
 		list_insert_head(&spa->spa_state_dirty_list, vd);
 }
 
@@ -322,6 +322,9 @@ skip_open:
 	/* Inform the ZIO pipeline that we are non-rotational */
 	v->vdev_nonrot = blk_queue_nonrot(bdev_get_queue(vd->vd_bdev));
 
+	/* Only issue trims if the device supports discard */
+	v->vdev_notrim = !blk_queue_discard(bdev_get_queue(vd->vd_bdev));
+
 	/* Physical volume size in bytes */
 	*psize = bdev_capacity(vd->vd_bdev);
 
@@ -661,6 +664,27 @@ vdev_disk_io_flush(struct block_device *bdev, zio_t *zio)
 	return (0);
 }
 
+/*
+ * blkdev_issue_discard() waits for the discard to complete, so trims are
+ * dispatched to a taskq instead of blocking the issuing thread.  Trims are
+ * advisory and a failure is not reported.
+ */
+static void
+vdev_disk_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_t *v = zio->io_vd;
+	vdev_disk_t *vd = v->vdev_tsd;
+	int error;
+
+	error = -blkdev_issue_discard(vd->vd_bdev, zio->io_offset >> 9,
+	    zio->io_size >> 9, GFP_NOFS, 0);
+	if (error == EOPNOTSUPP)
+		v->vdev_notrim = B_TRUE;
+
+	zio_interrupt(zio);
+}
+
 static void
 vdev_disk_io_start(zio_t *zio)
 {
@@ -724,6 +748,11 @@ vdev_disk_io_start(zio_t *zio)
 #endif
 		break;
 
+	case ZIO_TYPE_FREE:
+		VERIFY3U(taskq_dispatch(system_taskq, vdev_disk_io_trim, zio,
+		    TQ_SLEEP), !=, TASKQID_INVALID);
+		return;
+
 	default:
 		zio->io_error = SET_ERROR(ENOTSUP);
 		zio_interrupt(zio);
@@ -0,0 +1,718 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/fs/zfs.h>
+
+/*
+ * Distributed spare RAID (dRAID)
+ *
+ * A RAID-Z vdev stripes every block over the same children, so when one of
+ * them fails its replacement has to be written in full, and rebuilding is
+ * limited by the speed of that one disk.  A dRAID vdev instead declusters
+ * fixed-width redundancy groups of ndata + nparity columns, and nspares
+ * columns of spare space, over all of its children.
+ *
+ * The address space of the vdev is made of slices of one metaslab each.
+ * Each slice is one redundancy group, and within it blocks are laid out
+ * exactly as on a RAID-Z vdev of groupwidth children (variable width
+ * stripes, skip sectors and all), so the RAID-Z I/O path and the
+ * vdev_raidz_math parity kernels are used as they are.  Since allocations
+ * never cross a metaslab, no block ever straddles two groups.
+ *
+ * Consecutive slices are packed into rows.  A row holds ngroups groups,
+ * lcm(groupwidth, ndisks) columns, where ndisks is the number of children
+ * less the spares, so that every child holds nslots group columns of the
+ * row.  The columns of the groups are dealt to the children in the order
+ * of a pseudo-random permutation of the children, which changes from one
+ * row to the next, and the children at the last nspares positions of the
+ * permutation hold the spare space of the row instead.  For example, with
+ * groups of 3 data and 1 parity columns over 7 children, one of which is
+ * spare space, a row holds 3 groups in 2 slots per child:
+ *
+ *	row 0 (perm 3 0 5 1 4 2 6):
+ *		child	3   0   5   1   4   2   6
+ *		slot 0	g0  g0  g0  g0  g1  g1  S
+ *		slot 1	g1  g1  g2  g2  g2  g2  S
+ *
+ * Because the permutations differ, the groups of a failed child have their
+ * surviving columns, and the spare space they are rebuilt into, spread over
+ * all the other children, which all take part in the rebuild.
+ *
+ * The spare space is presented as distributed spare vdevs ("dspare"),
+ * named draid<nparity>-<vdev id>-<spare id>, which are added to the spares
+ * of the pool when the dRAID vdev is created and are attached like any
+ * other hot spare.  Their I/O is redirected, row by row, to the child
+ * holding the spare column of that row.
+ */
+
+/*
+ * Typically metaslabs_per_vdev metaslabs per vdev, see vdev_draid_open().
+ */
+extern int metaslabs_per_vdev;
+
+static uint64_t
+vdev_draid_gcd(uint64_t a, uint64_t b)
+{
+	while (b != 0) {
+		uint64_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return (a);
+}
+
+/*
+ * xorshift64* pseudo-random generator for the permutations.  Its output
+ * is part of the on-disk format.
+ */
+static uint64_t
+vdev_draid_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+
+	return (*state * 0x2545f4914f6cdd1dULL);
+}
+
+int
+vdev_draid_config_alloc(uint64_t ndata, uint64_t nparity, uint64_t nspares,
+    uint64_t children, vdev_draid_config_t **vdcp)
+{
+	vdev_draid_config_t *vdc;
+	uint64_t seed, lcm, p, i;
+
+	if (nparity == 0 || nparity > VDEV_DRAID_MAXPARITY || ndata == 0 ||
+	    children > VDEV_DRAID_MAX_CHILDREN || nspares >= children ||
+	    ndata + nparity > children - nspares)
+		return (SET_ERROR(EINVAL));
+
+	vdc = kmem_zalloc(sizeof (vdev_draid_config_t), KM_SLEEP);
+	vdc->vdc_ndata = ndata;
+	vdc->vdc_nparity = nparity;
+	vdc->vdc_nspares = nspares;
+	vdc->vdc_children = children;
+	vdc->vdc_ndisks = children - nspares;
+	vdc->vdc_groupwidth = ndata + nparity;
+
+	lcm = vdc->vdc_groupwidth * vdc->vdc_ndisks /
+	    vdev_draid_gcd(vdc->vdc_groupwidth, vdc->vdc_ndisks);
+	vdc->vdc_ngroups = lcm / vdc->vdc_groupwidth;
+	vdc->vdc_nslots = lcm / vdc->vdc_ndisks;
+
+	/*
+	 * Fisher-Yates shuffles of the children.  The seed never ends up
+	 * zero, which xorshift cannot get out of.
+	 */
+	vdc->vdc_perms = kmem_alloc(VDEV_DRAID_NPERMS * children, KM_SLEEP);
+	seed = VDEV_DRAID_SEED ^ children;
+	for (p = 0; p < VDEV_DRAID_NPERMS; p++) {
+		uint8_t *perm = &vdc->vdc_perms[p * children];
+
+		for (i = 0; i < children; i++)
+			perm[i] = i;
+
+		for (i = children - 1; i > 0; i--) {
+			uint64_t j = vdev_draid_rand(&seed) % (i + 1);
+			uint8_t t = perm[i];
+
+			perm[i] = perm[j];
+			perm[j] = t;
+		}
+	}
+
+	*vdcp = vdc;
+	return (0);
+}
+
+void
+vdev_draid_config_free(vdev_draid_config_t *vdc)
+{
+	kmem_free(vdc->vdc_perms, VDEV_DRAID_NPERMS * vdc->vdc_children);
+	kmem_free(vdc, sizeof (vdev_draid_config_t));
+}
+
+static const uint8_t *
+vdev_draid_perm(const vdev_draid_config_t *vdc, uint64_t row)
+{
+	return (&vdc->vdc_perms[(row % VDEV_DRAID_NPERMS) * vdc->vdc_children]);
+}
+
+/*
+ * Size of a group column: a slice of 1 << ms_shift bytes spread over
+ * groupwidth columns.
+ */
+static uint64_t
+vdev_draid_col_size(const vdev_draid_config_t *vdc, uint64_t ms_shift,
+    uint64_t ashift)
+{
+	ASSERT3U(ms_shift, >, ashift);
+
+	return (howmany(1ULL << (ms_shift - ashift), vdc->vdc_groupwidth) <<
+	    ashift);
+}
+
+/*
+ * Space used by a row on each child.
+ */
+uint64_t
+vdev_draid_row_size(const vdev_draid_config_t *vdc, uint64_t ms_shift,
+    uint64_t ashift)
+{
+	return (vdc->vdc_nslots * vdev_draid_col_size(vdc, ms_shift, ashift));
+}
+
+/*
+ * Find the child holding column 'col' of the group of the slice which
+ * 'offset' falls in, and the offset of the start of that column on it.
+ */
+static void
+vdev_draid_col_to_child(const vdev_draid_config_t *vdc, uint64_t ms_shift,
+    uint64_t ashift, uint64_t offset, uint64_t col, uint64_t *cidxp,
+    uint64_t *coffp)
+{
+	uint64_t slice = offset >> ms_shift;
+	uint64_t row = slice / vdc->vdc_ngroups;
+	uint64_t pos = (slice % vdc->vdc_ngroups) * vdc->vdc_groupwidth + col;
+	uint64_t colsz = vdev_draid_col_size(vdc, ms_shift, ashift);
+
+	ASSERT3U(col, <, vdc->vdc_groupwidth);
+
+	*cidxp = vdev_draid_perm(vdc, row)[pos % vdc->vdc_ndisks];
+	*coffp = (row * vdc->vdc_nslots + pos / vdc->vdc_ndisks) * colsz;
+}
+
+/*
+ * Lay out the zio's block as RAID-Z does within its group, then move each
+ * column to the child and offset the permutation of the row gives it.
+ */
+raidz_map_t *
+vdev_draid_map_alloc(zio_t *zio, const vdev_draid_config_t *vdc,
+    uint64_t ms_shift, uint64_t ashift)
+{
+	uint64_t offset = P2PHASE(zio->io_offset, 1ULL << ms_shift);
+	raidz_map_t *rm;
+	int c;
+
+	ASSERT3U(offset + zio->io_size, <=, 1ULL << ms_shift);
+
+	rm = vdev_raidz_map_alloc_offset(zio, offset, ashift,
+	    vdc->vdc_groupwidth, vdc->vdc_nparity);
+
+	for (c = 0; c < rm->rm_scols; c++) {
+		raidz_col_t *rc = &rm->rm_col[c];
+		uint64_t cidx, coff;
+
+		vdev_draid_col_to_child(vdc, ms_shift, ashift, zio->io_offset,
+		    rc->rc_devidx, &cidx, &coff);
+		rc->rc_devidx = cidx;
+		rc->rc_offset += coff;
+	}
+
+	return (rm);
+}
+
+/*
+ * Space each child must provide for the dRAID vdev to be 'asize' bytes.
+ */
+static uint64_t
+vdev_draid_asize_to_child(vdev_t *vd, uint64_t asize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t rows;
+
+	if (vd->vdev_ms_shift == 0)
+		return (0);
+
+	rows = howmany(asize >> vd->vdev_ms_shift, vdc->vdc_ngroups);
+	return (rows * vdev_draid_row_size(vdc, vd->vdev_ms_shift,
+	    vd->vdev_ashift));
+}
+
+uint64_t
+vdev_draid_child_min_asize(vdev_t *vd)
+{
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+
+	return (vdev_draid_asize_to_child(vd, vd->vdev_min_asize));
+}
+
+/*
+ * The metaslab, and so group slice, size of a new dRAID vdev.  Like other
+ * vdevs it aims for metaslabs_per_vdev metaslabs, but it goes for smaller
+ * ones if that leaves too few rows to spread the spare space over.
+ */
+static uint64_t
+vdev_draid_ms_shift(vdev_draid_config_t *vdc, uint64_t casize,
+    uint64_t ashift)
+{
+	uint64_t shift;
+
+	shift = highbit64(vdc->vdc_ndisks * casize / metaslabs_per_vdev);
+	shift = MAX(shift, SPA_MAXBLOCKSHIFT);
+
+	while (shift > SPA_MAXBLOCKSHIFT && casize /
+	    vdev_draid_row_size(vdc, shift, ashift) < VDEV_DRAID_MIN_ROWS)
+		shift--;
+
+	return (shift);
+}
+
+static int
+vdev_draid_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
+    uint64_t *ashift)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t nparity = vd->vdev_nparity;
+	uint64_t casize = -1ULL, cmax_asize = -1ULL;
+	uint64_t rowsz, shift;
+	int lasterror = 0;
+	int numerrors = 0;
+	int c;
+
+	ASSERT(nparity > 0);
+
+	if (vdc == NULL || vd->vdev_children != vdc->vdc_children ||
+	    nparity != vdc->vdc_nparity) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_BAD_LABEL;
+		return (SET_ERROR(EINVAL));
+	}
+
+	vdev_open_children(vd);
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd->vdev_open_error != 0) {
+			lasterror = cvd->vdev_open_error;
+			numerrors++;
+			continue;
+		}
+
+		casize = MIN(casize - 1, cvd->vdev_asize - 1) + 1;
+		cmax_asize = MIN(cmax_asize - 1, cvd->vdev_max_asize - 1) + 1;
+		*ashift = MAX(*ashift, cvd->vdev_ashift);
+	}
+
+	if (numerrors > nparity) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_NO_REPLICAS;
+		return (lasterror);
+	}
+
+	/*
+	 * The metaslab size fixes the layout, so it is picked here when the
+	 * vdev is created rather than by vdev_metaslab_set_size().
+	 */
+	shift = vd->vdev_ashift != 0 ? vd->vdev_ashift : *ashift;
+	if (vd->vdev_ms_shift == 0)
+		vd->vdev_ms_shift = vdev_draid_ms_shift(vdc, casize, shift);
+
+	rowsz = vdev_draid_row_size(vdc, vd->vdev_ms_shift, shift);
+	if (casize < rowsz) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_TOO_SMALL;
+		return (SET_ERROR(EOVERFLOW));
+	}
+
+	*asize = (casize / rowsz * vdc->vdc_ngroups) << vd->vdev_ms_shift;
+	*max_asize = (cmax_asize / rowsz * vdc->vdc_ngroups) <<
+	    vd->vdev_ms_shift;
+
+	return (0);
+}
+
+static void
+vdev_draid_close(vdev_t *vd)
+{
+	int c;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_close(vd->vdev_child[c]);
+}
+
+static uint64_t
+vdev_draid_asize(vdev_t *vd, uint64_t psize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t asize;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t nparity = vdc->vdc_nparity;
+
+	asize = ((psize - 1) >> ashift) + 1;
+	asize += nparity * ((asize + vdc->vdc_ndata - 1) / vdc->vdc_ndata);
+	asize = roundup(asize, nparity + 1) << ashift;
+
+	return (asize);
+}
+
+/*
+ * Trim the ranges of the children which back the zio's range, which never
+ * crosses a slice.  As in vdev_raidz_io_trim(), each column's share of the
+ * range is contiguous.
+ */
+static void
+vdev_draid_io_trim(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t width = vdc->vdc_groupwidth;
+	uint64_t b = P2PHASE(zio->io_offset, 1ULL << vd->vdev_ms_shift) >>
+	    ashift;
+	uint64_t s = zio->io_size >> ashift;
+	uint64_t c;
+
+	ASSERT3U((b + s) << ashift, <=, 1ULL << vd->vdev_ms_shift);
+
+	for (c = 0; c < MIN(s, width); c++) {
+		uint64_t first = b + c;
+		uint64_t count = (s - c + width - 1) / width;
+		uint64_t cidx, coff;
+
+		vdev_draid_col_to_child(vdc, vd->vdev_ms_shift, ashift,
+		    zio->io_offset, first % width, &cidx, &coff);
+		zio_nowait(zio_vdev_child_io(zio, NULL, vd->vdev_child[cidx],
+		    coff + ((first / width) << ashift), NULL, count << ashift,
+		    ZIO_TYPE_FREE, zio->io_priority, 0, NULL, NULL));
+	}
+
+	zio_execute(zio);
+}
+
+static void
+vdev_draid_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	raidz_map_t *rm;
+
+	ASSERT3P(vd, ==, vd->vdev_top);
+
+	if (zio->io_type == ZIO_TYPE_FREE) {
+		vdev_draid_io_trim(zio);
+		return;
+	}
+
+	rm = vdev_draid_map_alloc(zio, vd->vdev_tsd, vd->vdev_ms_shift,
+	    vd->vdev_ashift);
+
+	vdev_raidz_io_start_map(zio, rm);
+}
+
+static void
+vdev_draid_state_change(vdev_t *vd, int faulted, int degraded)
+{
+	if (faulted > vd->vdev_nparity)
+		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
+		    VDEV_AUX_NO_REPLICAS);
+	else if (degraded + faulted != 0)
+		vdev_set_state(vd, B_FALSE, VDEV_STATE_DEGRADED, VDEV_AUX_NONE);
+	else
+		vdev_set_state(vd, B_FALSE, VDEV_STATE_HEALTHY, VDEV_AUX_NONE);
+}
+
+vdev_ops_t vdev_draid_ops = {
+	vdev_draid_open,
+	vdev_draid_close,
+	vdev_draid_asize,
+	vdev_draid_io_start,
+	vdev_raidz_io_done,
+	vdev_draid_state_change,
+	NULL,
+	NULL,
+	VDEV_TYPE_DRAID,	/* name of this vdev type */
+	B_FALSE			/* not a leaf vdev */
+};
+
+/*
+ * Distributed spares
+ */
+
+typedef struct vdev_draid_spare {
+	vdev_t		*vds_draid;	/* dRAID vdev the spare belongs to */
+	uint64_t	vds_spareid;	/* position in the spare columns */
+} vdev_draid_spare_t;
+
+static boolean_t
+vdev_draid_spare_parse(const char **sp, char delim, uint64_t *valp)
+{
+	const char *s = *sp;
+	uint64_t val = 0;
+
+	if (*s < '0' || *s > '9')
+		return (B_FALSE);
+	while (*s >= '0' && *s <= '9')
+		val = val * 10 + (*s++ - '0');
+	if (*s != delim)
+		return (B_FALSE);
+
+	*sp = (delim == '\0') ? s : s + 1;
+	*valp = val;
+	return (B_TRUE);
+}
+
+/*
+ * Find the dRAID vdev a distributed spare belongs to from its name,
+ * draid<nparity>-<vdev id>-<spare id>.
+ */
+static vdev_t *
+vdev_draid_spare_lookup(vdev_t *vd, uint64_t *spareidp)
+{
+	vdev_t *rvd = vd->vdev_spa->spa_root_vdev;
+	const char *s = vd->vdev_path;
+	uint64_t nparity, id, spareid;
+	vdev_t *tvd;
+
+	if (s == NULL || strncmp(s, VDEV_TYPE_DRAID,
+	    strlen(VDEV_TYPE_DRAID)) != 0)
+		return (NULL);
+	s += strlen(VDEV_TYPE_DRAID);
+
+	if (!vdev_draid_spare_parse(&s, '-', &nparity) ||
+	    !vdev_draid_spare_parse(&s, '-', &id) ||
+	    !vdev_draid_spare_parse(&s, '\0', &spareid))
+		return (NULL);
+
+	if (rvd == NULL || id >= rvd->vdev_children)
+		return (NULL);
+
+	tvd = rvd->vdev_child[id];
+	if (tvd->vdev_ops != &vdev_draid_ops || tvd->vdev_nparity != nparity ||
+	    spareid >= ((vdev_draid_config_t *)tvd->vdev_tsd)->vdc_nspares)
+		return (NULL);
+
+	*spareidp = spareid;
+	return (tvd);
+}
+
+vdev_t *
+vdev_draid_spare_get_parent(vdev_t *vd)
+{
+	uint64_t spareid;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_spare_ops);
+
+	return (vdev_draid_spare_lookup(vd, &spareid));
+}
+
+/*
+ * Add the distributed spares of the new dRAID vdev 'vd' to the spares
+ * of 'nvroot'.
+ */
+void
+vdev_draid_spare_create(nvlist_t *nvroot, vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	nvlist_t **spares, **newspares;
+	uint_t nspares = 0, total, i;
+
+	if (vd->vdev_ops != &vdev_draid_ops || vdc->vdc_nspares == 0)
+		return;
+
+	(void) nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
+	    &spares, &nspares);
+
+	total = nspares + vdc->vdc_nspares;
+	newspares = kmem_alloc(total * sizeof (void *), KM_SLEEP);
+	for (i = 0; i < nspares; i++)
+		newspares[i] = fnvlist_dup(spares[i]);
+
+	for (i = nspares; i < total; i++) {
+		char *name = kmem_asprintf("%s%llu-%llu-%llu",
+		    VDEV_TYPE_DRAID, (u_longlong_t)vdc->vdc_nparity,
+		    (u_longlong_t)vd->vdev_id, (u_longlong_t)(i - nspares));
+
+		newspares[i] = fnvlist_alloc();
+		fnvlist_add_string(newspares[i], ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_DRAID_SPARE);
+		fnvlist_add_string(newspares[i], ZPOOL_CONFIG_PATH, name);
+		fnvlist_add_uint64(newspares[i], ZPOOL_CONFIG_GUID,
+		    spa_generate_guid(NULL));
+		strfree(name);
+	}
+
+	(void) nvlist_remove(nvroot, ZPOOL_CONFIG_SPARES,
+	    DATA_TYPE_NVLIST_ARRAY);
+	fnvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES, newspares,
+	    total);
+
+	for (i = 0; i < total; i++)
+		nvlist_free(newspares[i]);
+	kmem_free(newspares, total * sizeof (void *));
+}
+
+/*
+ * Distributed spares have no label, so vdev_inuse() asks here instead.
+ * The spare is in use if it is not one of this pool's spares, or if it is
+ * already active.
+ */
+boolean_t
+vdev_draid_spare_inuse(vdev_t *vd, vdev_labeltype_t reason,
+    uint64_t *spare_guid)
+{
+	spa_aux_vdev_t *sav = &vd->vdev_spa->spa_spares;
+	uint64_t guid, spare_pool = 0ULL;
+	int i;
+
+	for (i = 0; i < sav->sav_count; i++) {
+		vdev_t *svd = sav->sav_vdevs[i];
+
+		if (svd->vdev_ops == &vdev_draid_spare_ops &&
+		    strcmp(svd->vdev_path, vd->vdev_path) == 0)
+			break;
+	}
+
+	if (i == sav->sav_count)
+		return (B_FALSE);
+
+	guid = sav->sav_vdevs[i]->vdev_guid;
+	if (spare_guid != NULL)
+		*spare_guid = guid;
+
+	if (reason == VDEV_LABEL_REPLACE) {
+		(void) spa_spare_exists(guid, &spare_pool, NULL);
+		return (spare_pool != 0ULL);
+	}
+
+	return (B_TRUE);
+}
+
+static int
+vdev_draid_spare_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
+    uint64_t *ashift)
+{
+	vdev_draid_spare_t *vds;
+	uint64_t spareid, asize;
+	vdev_t *tvd;
+
+	tvd = vdev_draid_spare_lookup(vd, &spareid);
+	if (tvd == NULL || tvd->vdev_asize == 0) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(ENXIO));
+	}
+
+	if (vd->vdev_tsd == NULL)
+		vd->vdev_tsd = kmem_alloc(sizeof (vdev_draid_spare_t),
+		    KM_SLEEP);
+	vds = vd->vdev_tsd;
+	vds->vds_draid = tvd;
+	vds->vds_spareid = spareid;
+
+	/*
+	 * As large as a child of the dRAID vdev needs to be, plus room for
+	 * the labels it does not have.
+	 */
+	asize = vdev_draid_asize_to_child(tvd, tvd->vdev_asize);
+	*psize = *max_psize = P2ROUNDUP(asize, sizeof (vdev_label_t)) +
+	    VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE;
+	*ashift = tvd->vdev_ashift;
+
+	return (0);
+}
+
+static void
+vdev_draid_spare_close(vdev_t *vd)
+{
+	if (vd->vdev_tsd == NULL)
+		return;
+
+	kmem_free(vd->vdev_tsd, sizeof (vdev_draid_spare_t));
+	vd->vdev_tsd = NULL;
+}
+
+static void
+vdev_draid_spare_child_done(zio_t *zio)
+{
+	zio_t *pio = zio->io_private;
+
+	pio->io_error = zio->io_error;
+}
+
+/*
+ * Redirect the I/O to the child of the dRAID vdev which holds the spare
+ * column of the row.  Reads of the label area return zeros and writes to
+ * it are dropped.
+ */
+static void
+vdev_draid_spare_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_draid_spare_t *vds = vd->vdev_tsd;
+	vdev_t *tvd = vds->vds_draid;
+	vdev_draid_config_t *vdc = tvd->vdev_tsd;
+	uint64_t offset = zio->io_offset;
+	uint64_t row;
+	vdev_t *cvd;
+
+	if (zio->io_type == ZIO_TYPE_IOCTL) {
+		zio_execute(zio);
+		return;
+	}
+
+	if (offset < VDEV_LABEL_START_SIZE ||
+	    offset >= vd->vdev_psize - VDEV_LABEL_END_SIZE) {
+		ASSERT(zio->io_type != ZIO_TYPE_FREE);
+		if (zio->io_type == ZIO_TYPE_READ)
+			abd_zero(zio->io_abd, zio->io_size);
+		zio_execute(zio);
+		return;
+	}
+
+	offset -= VDEV_LABEL_START_SIZE;
+	row = offset / vdev_draid_row_size(vdc, tvd->vdev_ms_shift,
+	    tvd->vdev_ashift);
+	cvd = tvd->vdev_child[vdev_draid_perm(vdc, row)[vdc->vdc_ndisks +
+	    vds->vds_spareid]];
+
+	zio_nowait(zio_vdev_child_io(zio, NULL, cvd, offset, zio->io_abd,
+	    zio->io_size, zio->io_type, zio->io_priority, 0,
+	    vdev_draid_spare_child_done, zio));
+
+	zio_execute(zio);
+}
+
+/* ARGSUSED */
+static void
+vdev_draid_spare_io_done(zio_t *zio)
+{
+}
+
+vdev_ops_t vdev_draid_spare_ops = {
+	vdev_draid_spare_open,
+	vdev_draid_spare_close,
+	vdev_default_asize,
+	vdev_draid_spare_io_start,
+	vdev_draid_spare_io_done,
+	NULL,
+	NULL,
+	NULL,
+	VDEV_TYPE_DRAID_SPARE,	/* name of this vdev type */
+	B_TRUE			/* leaf vdev */
+};
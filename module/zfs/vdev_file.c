@@ -63,6 +63,9 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	/* Rotational optimizations only make sense on block devices */
 	vd->vdev_nonrot = B_TRUE;
 
+	/* Trims punch holes, find out again if the file system can */
+	vd->vdev_notrim = B_FALSE;
+
 	/*
 	 * We must have a pathname, and it must be absolute.
 	 */
@@ -186,6 +189,34 @@ vdev_file_io_fsync(void *arg)
 	zio_interrupt(zio);
 }
 
+/*
+ * Trims are implemented by punching a hole over the range.  If the file
+ * system can't do that there is no point in trying again, but as trims
+ * are advisory the failure itself is not reported.
+ */
+static void
+vdev_file_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_file_t *vf = vd->vdev_tsd;
+	flock64_t bf;
+	int error;
+
+	bf.l_type = F_WRLCK;
+	bf.l_whence = SEEK_SET;
+	bf.l_start = zio->io_offset;
+	bf.l_len = zio->io_size;
+	bf.l_pid = 0;
+
+	error = VOP_SPACE(vf->vf_vnode, F_FREESP, &bf, FWRITE,
+	    zio->io_offset, kcred, NULL);
+	if (error == EOPNOTSUPP || error == ENOTSUP)
+		vd->vdev_notrim = B_TRUE;
+
+	zio_interrupt(zio);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -231,6 +262,12 @@ vdev_file_io_start(zio_t *zio)
 		return;
 	}
 
+	if (zio->io_type == ZIO_TYPE_FREE) {
+		VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_trim,
+		    zio, TQ_SLEEP), !=, TASKQID_INVALID);
+		return;
+	}
+
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
 	VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
@@ -0,0 +1,389 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/fs/zfs.h>
+#include <sys/abd.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+
+/*
+ * An indirect vdev takes the place of a top-level vdev once it has been
+ * removed (see vdev_removal.c).  It has no children and no storage of
+ * its own: its vdev_indirect_mapping records where each allocated
+ * segment of the removed vdev was copied to, and all I/O is redirected
+ * there.  Block pointers are never rewritten, so the mapping is kept
+ * for as long as the pool exists.
+ *
+ * A single block may have been split across several segments, which may
+ * live on different vdevs.  Such I/O is issued as one child per piece.
+ * The destination may itself be an indirect vdev, if it was removed
+ * later on, in which case the child is redirected again.
+ *
+ * The pieces of a split block can't be checked on their own, so a mirror
+ * could return a bad copy of one without noticing.  If the whole block
+ * doesn't verify, it is read again with each combination of the mirror
+ * children the pieces are read from, up to
+ * zfs_reconstruct_indirect_combinations_max of them.  If there are more
+ * combinations than that, the children are picked at random instead, so
+ * that every piece gets a chance to be read from each.  Once a combination
+ * verifies, the other children are repaired from it.  Scrubs and
+ * resilvers can't tell which of the other children are damaged either,
+ * so they always rewrite them.
+ */
+
+int zfs_reconstruct_indirect_combinations_max = 256;
+
+/*
+ * Call func for each piece of [offset, offset + size) of the removed or
+ * removing vdev vd, in offset order.  Pieces which are not mapped are
+ * passed with a NULL vdev.  split_offset is the position of the piece
+ * within the range.
+ */
+void
+vdev_indirect_remap(vdev_t *vd, uint64_t offset, uint64_t size,
+    vdev_remap_func_t *func, void *arg)
+{
+	vdev_indirect_mapping_t *vim = vd->vdev_indirect_mapping;
+	spa_t *spa = vd->vdev_spa;
+	uint64_t split_offset = 0;
+
+	ASSERT(vim != NULL);
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_READER) != 0);
+
+	rw_enter(&vim->vim_lock, RW_READER);
+	while (size > 0) {
+		vdev_indirect_mapping_entry_phys_t *vimep =
+		    vdev_indirect_mapping_entry_for_offset(vim, offset);
+		uint64_t src, len, inner;
+
+		if (vimep == NULL ||
+		    DVA_MAPPING_GET_SRC_OFFSET(vimep) >= offset + size) {
+			func(split_offset, NULL, offset, size, arg);
+			break;
+		}
+
+		src = DVA_MAPPING_GET_SRC_OFFSET(vimep);
+		if (src > offset) {
+			len = src - offset;
+			func(split_offset, NULL, offset, len, arg);
+			split_offset += len;
+			offset += len;
+			size -= len;
+		}
+
+		inner = offset - src;
+		len = MIN(size, DVA_MAPPING_GET_SIZE(vimep) - inner);
+		func(split_offset,
+		    vdev_lookup_top(spa, DVA_GET_VDEV(&vimep->vimep_dst)),
+		    DVA_GET_OFFSET(&vimep->vimep_dst) + inner, len, arg);
+		split_offset += len;
+		offset += len;
+		size -= len;
+	}
+	rw_exit(&vim->vim_lock);
+}
+
+/*
+ * Open the mappings of the removed vdevs and of the one being removed.
+ * This is done as soon as the MOS is, since any of its blocks may have
+ * been on a removed vdev.  The blocks of the mappings themselves never
+ * are (see vdev_remove_initiate_sync()), so they can be opened in any
+ * order.
+ */
+void
+vdev_indirect_load(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t c;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		if (tvd->vdev_im_object != 0 &&
+		    tvd->vdev_indirect_mapping == NULL) {
+			tvd->vdev_indirect_mapping =
+			    vdev_indirect_mapping_open(spa->spa_meta_objset,
+			    tvd->vdev_im_object);
+		}
+	}
+}
+
+/* ARGSUSED */
+static int
+vdev_indirect_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
+    uint64_t *ashift)
+{
+	/*
+	 * Being childless, the vdev is sized like a leaf by vdev_open().
+	 */
+	*psize = *max_psize = vd->vdev_asize +
+	    VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE;
+	*ashift = vd->vdev_ashift;
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+vdev_indirect_close(vdev_t *vd)
+{
+}
+
+typedef struct indirect_split {
+	zio_t		*is_zio;
+	int		is_count;	/* number of pieces */
+	boolean_t	is_missing;	/* some piece can't be read */
+	int		is_width;	/* widest vdev of the pieces */
+	uint64_t	is_combos;	/* combinations of children to try */
+	boolean_t	is_random;	/* combinations are picked at random */
+	uint64_t	is_combo;	/* combination being read */
+	uint64_t	is_div;		/* is_width ^ piece index */
+	int		is_piece;	/* index of the next piece */
+	int		*is_child;	/* child each piece is read from */
+	int		is_flags;	/* flags of the repair writes */
+} indirect_split_t;
+
+static void
+vdev_indirect_split_free(zio_t *zio)
+{
+	indirect_split_t *is = zio->io_vsd;
+
+	if (is->is_child != NULL)
+		kmem_free(is->is_child, is->is_count * sizeof (int));
+	kmem_free(is, sizeof (indirect_split_t));
+}
+
+static const zio_vsd_ops_t vdev_indirect_vsd_ops = {
+	vdev_indirect_split_free,
+	zio_vsd_default_cksum_report
+};
+
+static void
+vdev_indirect_count_split(uint64_t split_offset, vdev_t *vd,
+    uint64_t offset, uint64_t size, void *arg)
+{
+	indirect_split_t *is = arg;
+
+	if (vd == NULL || !vdev_readable(vd))
+		is->is_missing = B_TRUE;
+	else if (vd->vdev_ops == &vdev_mirror_ops)
+		is->is_width = MAX(is->is_width, vd->vdev_children);
+	is->is_count++;
+}
+
+/*
+ * Return the child of the mirror vd the next piece is read from.  If
+ * choose is set, it is first picked according to the current combination.
+ */
+static vdev_t *
+vdev_indirect_split_child(indirect_split_t *is, vdev_t *vd, boolean_t choose)
+{
+	int *cp = &is->is_child[is->is_piece++];
+
+	if (choose) {
+		uint64_t c;
+
+		if (is->is_random && is->is_combo != 0)
+			c = spa_get_random(is->is_width);
+		else
+			c = (is->is_combo / is->is_div) % is->is_width;
+		is->is_div *= is->is_width;
+		*cp = c % vd->vdev_children;
+	}
+	return (vd->vdev_child[*cp]);
+}
+
+static void
+vdev_indirect_child_io_done(zio_t *zio)
+{
+	zio_t *pio = zio->io_private;
+
+	mutex_enter(&pio->io_lock);
+	pio->io_error = zio_worst_error(pio->io_error, zio->io_error);
+	mutex_exit(&pio->io_lock);
+
+	abd_put(zio->io_abd);
+}
+
+static void
+vdev_indirect_issue_split(uint64_t split_offset, vdev_t *vd,
+    uint64_t offset, uint64_t size, void *arg)
+{
+	indirect_split_t *is = arg;
+	zio_t *zio = is->is_zio;
+
+	if (is->is_count > 1 && vd->vdev_ops == &vdev_mirror_ops)
+		vd = vdev_indirect_split_child(is, vd, B_TRUE);
+
+	/*
+	 * The child can verify the checksum only if it covers the whole
+	 * block.
+	 */
+	zio_nowait(zio_vdev_child_io(zio,
+	    is->is_count == 1 ? zio->io_bp : NULL, vd, offset,
+	    abd_get_offset(zio->io_abd, split_offset), size, zio->io_type,
+	    zio->io_priority, 0, vdev_indirect_child_io_done, zio));
+}
+
+static void
+vdev_indirect_repair_done(zio_t *zio)
+{
+	abd_put(zio->io_abd);
+}
+
+/*
+ * Write the piece to the children of its mirror it wasn't read from.
+ */
+static void
+vdev_indirect_repair_split(uint64_t split_offset, vdev_t *vd,
+    uint64_t offset, uint64_t size, void *arg)
+{
+	indirect_split_t *is = arg;
+	zio_t *zio = is->is_zio;
+	vdev_t *good;
+	uint64_t c;
+
+	if (vd->vdev_ops != &vdev_mirror_ops)
+		return;
+
+	good = vdev_indirect_split_child(is, vd, B_FALSE);
+	for (c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd == good || !vdev_writeable(cvd))
+			continue;
+
+		zio_nowait(zio_vdev_child_io(zio, NULL, cvd, offset,
+		    abd_get_offset(zio->io_abd, split_offset), size,
+		    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE, is->is_flags,
+		    vdev_indirect_repair_done, NULL));
+	}
+}
+
+static void
+vdev_indirect_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	indirect_split_t *is;
+	int i;
+
+	if (zio->io_type != ZIO_TYPE_READ && zio->io_type != ZIO_TYPE_WRITE) {
+		zio->io_error = SET_ERROR(ENOTSUP);
+		zio_execute(zio);
+		return;
+	}
+
+	is = kmem_zalloc(sizeof (*is), KM_SLEEP);
+	is->is_zio = zio;
+	is->is_width = 1;
+	is->is_div = 1;
+	zio->io_vsd = is;
+	zio->io_vsd_ops = &vdev_indirect_vsd_ops;
+
+	vdev_indirect_remap(vd, zio->io_offset, zio->io_size,
+	    vdev_indirect_count_split, is);
+
+	if (is->is_missing) {
+		zio->io_error = SET_ERROR(EIO);
+		zio_execute(zio);
+		return;
+	}
+
+	is->is_child = kmem_zalloc(is->is_count * sizeof (int), KM_SLEEP);
+	is->is_combos = 1;
+	for (i = 0; i < is->is_count; i++) {
+		if (is->is_combos * is->is_width >
+		    zfs_reconstruct_indirect_combinations_max) {
+			is->is_combos = MAX(1,
+			    zfs_reconstruct_indirect_combinations_max);
+			is->is_random = B_TRUE;
+			break;
+		}
+		is->is_combos *= is->is_width;
+	}
+
+	vdev_indirect_remap(vd, zio->io_offset, zio->io_size,
+	    vdev_indirect_issue_split, is);
+
+	zio_execute(zio);
+}
+
+static void
+vdev_indirect_io_done(zio_t *zio)
+{
+	indirect_split_t *is = zio->io_vsd;
+	zio_bad_cksum_t zbc;
+
+	if (zio->io_type != ZIO_TYPE_READ || zio->io_bp == NULL ||
+	    is->is_missing || is->is_count == 1 || is->is_flags != 0)
+		return;
+
+	is->is_div = 1;
+	is->is_piece = 0;
+	if (zio->io_error == 0 && zio_checksum_error(zio, &zbc) == 0) {
+		if (is->is_width == 1 || !spa_writeable(zio->io_spa))
+			return;
+		if (is->is_combo != 0)
+			is->is_flags = ZIO_FLAG_IO_REPAIR | ZIO_FLAG_SELF_HEAL;
+		else if (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))
+			is->is_flags = ZIO_FLAG_IO_REPAIR;
+		else
+			return;
+
+		zio_vdev_io_redone(zio);
+		vdev_indirect_remap(zio->io_vd, zio->io_offset, zio->io_size,
+		    vdev_indirect_repair_split, is);
+		return;
+	}
+
+	if (++is->is_combo >= is->is_combos) {
+		if (zio->io_error == 0)
+			zio->io_error = SET_ERROR(ECKSUM);
+		return;
+	}
+
+	zio->io_error = 0;
+	zio_vdev_io_redone(zio);
+	vdev_indirect_remap(zio->io_vd, zio->io_offset, zio->io_size,
+	    vdev_indirect_issue_split, is);
+}
+
+vdev_ops_t vdev_indirect_ops = {
+	vdev_indirect_open,
+	vdev_indirect_close,
+	vdev_default_asize,
+	vdev_indirect_io_start,
+	vdev_indirect_io_done,
+	NULL,
+	NULL,
+	NULL,
+	VDEV_TYPE_INDIRECT,	/* name of this vdev type */
+	B_FALSE			/* leaf vdev */
+};
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_reconstruct_indirect_combinations_max, int, 0644);
+MODULE_PARM_DESC(zfs_reconstruct_indirect_combinations_max,
+	"Max combinations of mirror children tried to read a split block");
+#endif
@@ -0,0 +1,276 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/dmu_tx.h>
+#include <sys/dnode.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/zfs_context.h>
+
+/*
+ * The indirect mapping of a removed vdev records where each of its
+ * allocated segments was copied to.  It is stored in a MOS object whose
+ * data is the array of entries, sorted by source offset, and whose bonus
+ * buffer holds a vdev_indirect_mapping_phys_t.  Entries are only ever
+ * appended, in syncing context, while the vdev is being evacuated.
+ *
+ * The whole array is kept in memory while the pool is open, so that
+ * reads of the removed vdev can be redirected without any I/O.
+ */
+
+#define	VIM_MIN_ALLOC	64
+
+static void
+vdev_indirect_mapping_verify(vdev_indirect_mapping_t *vim)
+{
+	ASSERT(vim != NULL);
+	ASSERT(vim->vim_object != 0);
+	ASSERT(vim->vim_objset != NULL);
+	ASSERT(vim->vim_phys != NULL);
+	ASSERT(vim->vim_dbuf != NULL);
+	ASSERT3U(vim->vim_alloc, >=, vim->vim_phys->vimp_num_entries);
+}
+
+uint64_t
+vdev_indirect_mapping_num_entries(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_phys->vimp_num_entries);
+}
+
+uint64_t
+vdev_indirect_mapping_max_offset(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_phys->vimp_max_offset);
+}
+
+uint64_t
+vdev_indirect_mapping_bytes_mapped(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_phys->vimp_bytes_mapped);
+}
+
+/*
+ * Memory used by the in-core copy of the mapping.
+ */
+uint64_t
+vdev_indirect_mapping_size(vdev_indirect_mapping_t *vim)
+{
+	return (vim->vim_alloc * sizeof (vdev_indirect_mapping_entry_phys_t));
+}
+
+/*
+ * Return the entry which contains the given offset, or the first entry
+ * past it if the offset is not mapped, or NULL if there is none.  The
+ * caller must hold vim_lock.
+ */
+vdev_indirect_mapping_entry_phys_t *
+vdev_indirect_mapping_entry_for_offset(vdev_indirect_mapping_t *vim,
+    uint64_t offset)
+{
+	uint64_t lo = 0, hi = vim->vim_phys->vimp_num_entries;
+
+	vdev_indirect_mapping_verify(vim);
+	ASSERT(RW_LOCK_HELD(&vim->vim_lock));
+
+	/*
+	 * Find the first entry which ends past the offset.
+	 */
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		vdev_indirect_mapping_entry_phys_t *vimep =
+		    &vim->vim_entries[mid];
+
+		if (DVA_MAPPING_GET_SRC_OFFSET(vimep) +
+		    DVA_MAPPING_GET_SIZE(vimep) <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == vim->vim_phys->vimp_num_entries)
+		return (NULL);
+
+	return (&vim->vim_entries[lo]);
+}
+
+uint64_t
+vdev_indirect_mapping_alloc(objset_t *os, dmu_tx_t *tx)
+{
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	return (dmu_object_alloc(os, DMU_OTN_UINT64_METADATA,
+	    SPA_OLD_MAXBLOCKSIZE, DMU_OTN_UINT64_METADATA,
+	    sizeof (vdev_indirect_mapping_phys_t), tx));
+}
+
+void
+vdev_indirect_mapping_free(objset_t *os, uint64_t object, dmu_tx_t *tx)
+{
+	VERIFY0(dmu_object_free(os, object, tx));
+}
+
+static void
+vdev_indirect_mapping_grow(vdev_indirect_mapping_t *vim, uint64_t count)
+{
+	vdev_indirect_mapping_entry_phys_t *entries;
+	uint64_t num = vim->vim_phys->vimp_num_entries;
+	uint64_t alloc = MAX(vim->vim_alloc, VIM_MIN_ALLOC);
+
+	ASSERT(RW_WRITE_HELD(&vim->vim_lock));
+
+	if (num + count <= vim->vim_alloc)
+		return;
+
+	while (alloc < num + count)
+		alloc *= 2;
+
+	entries = vmem_alloc(alloc * sizeof (*entries), KM_SLEEP);
+	if (vim->vim_entries != NULL) {
+		bcopy(vim->vim_entries, entries, num * sizeof (*entries));
+		vmem_free(vim->vim_entries,
+		    vim->vim_alloc * sizeof (*entries));
+	}
+	vim->vim_entries = entries;
+	vim->vim_alloc = alloc;
+}
+
+vdev_indirect_mapping_t *
+vdev_indirect_mapping_open(objset_t *os, uint64_t object)
+{
+	vdev_indirect_mapping_t *vim = kmem_zalloc(sizeof (*vim), KM_SLEEP);
+	dmu_object_info_t doi;
+	uint64_t num;
+
+	VERIFY0(dmu_object_info(os, object, &doi));
+
+	vim->vim_objset = os;
+	vim->vim_object = object;
+	rw_init(&vim->vim_lock, NULL, RW_DEFAULT, NULL);
+
+	VERIFY0(dmu_bonus_hold(os, object, vim, &vim->vim_dbuf));
+	ASSERT3U(doi.doi_bonus_size, >=,
+	    sizeof (vdev_indirect_mapping_phys_t));
+	vim->vim_phys = vim->vim_dbuf->db_data;
+
+	num = vim->vim_phys->vimp_num_entries;
+	if (num != 0) {
+		rw_enter(&vim->vim_lock, RW_WRITER);
+		vdev_indirect_mapping_grow(vim, num);
+		rw_exit(&vim->vim_lock);
+		VERIFY0(dmu_read(os, object, 0,
+		    num * sizeof (*vim->vim_entries), vim->vim_entries,
+		    DMU_READ_PREFETCH));
+	}
+
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim);
+}
+
+void
+vdev_indirect_mapping_close(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	if (vim->vim_entries != NULL) {
+		vmem_free(vim->vim_entries,
+		    vim->vim_alloc * sizeof (*vim->vim_entries));
+	}
+
+	dmu_buf_rele(vim->vim_dbuf, vim);
+	rw_destroy(&vim->vim_lock);
+	kmem_free(vim, sizeof (*vim));
+}
+
+/*
+ * Append the entries on the list, which must follow all of the existing
+ * ones, and free the list's elements.
+ */
+void
+vdev_indirect_mapping_add_entries(vdev_indirect_mapping_t *vim,
+    list_t *list, dmu_tx_t *tx)
+{
+	vdev_indirect_mapping_entry_t *vime;
+	uint64_t count = 0, num, bytes = 0;
+
+	vdev_indirect_mapping_verify(vim);
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	for (vime = list_head(list); vime != NULL;
+	    vime = list_next(list, vime))
+		count++;
+
+	if (count == 0)
+		return;
+
+	dmu_buf_will_dirty(vim->vim_dbuf, tx);
+	rw_enter(&vim->vim_lock, RW_WRITER);
+	vdev_indirect_mapping_grow(vim, count);
+
+	num = vim->vim_phys->vimp_num_entries;
+	while ((vime = list_remove_head(list)) != NULL) {
+		vdev_indirect_mapping_entry_phys_t *vimep = &vime->vime_mapping;
+
+		ASSERT3U(DVA_MAPPING_GET_SRC_OFFSET(vimep), >=,
+		    vim->vim_phys->vimp_max_offset);
+		vim->vim_entries[num] = *vimep;
+		bytes += DVA_MAPPING_GET_SIZE(vimep);
+		vim->vim_phys->vimp_max_offset =
+		    DVA_MAPPING_GET_SRC_OFFSET(vimep) +
+		    DVA_MAPPING_GET_SIZE(vimep);
+		num++;
+		kmem_free(vime, sizeof (*vime));
+	}
+
+	dmu_write(vim->vim_objset, vim->vim_object,
+	    (num - count) * sizeof (*vim->vim_entries),
+	    count * sizeof (*vim->vim_entries),
+	    &vim->vim_entries[num - count], tx);
+
+	vim->vim_phys->vimp_num_entries = num;
+	vim->vim_phys->vimp_bytes_mapped += bytes;
+	rw_exit(&vim->vim_lock);
+}
+
+/*
+ * Write out the whole mapping again, so that none of its blocks, nor the
+ * block of its dnode, are left on a vdev which is about to be removed.
+ */
+void
+vdev_indirect_mapping_rewrite(vdev_indirect_mapping_t *vim, dmu_tx_t *tx)
+{
+	uint64_t num;
+
+	vdev_indirect_mapping_verify(vim);
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	dmu_buf_will_dirty(vim->vim_dbuf, tx);
+	num = vim->vim_phys->vimp_num_entries;
+	if (num != 0) {
+		dmu_write(vim->vim_objset, vim->vim_object, 0,
+		    num * sizeof (*vim->vim_entries), vim->vim_entries, tx);
+	}
+}
@@ -141,6 +141,8 @@
 #include <sys/zap.h>
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
 #include <sys/zio.h>
@@ -384,8 +386,8 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_string(nv, ZPOOL_CONFIG_FRU, vd->vdev_fru);
 
 	if (vd->vdev_nparity != 0) {
-		ASSERT(strcmp(vd->vdev_ops->vdev_op_type,
-		    VDEV_TYPE_RAIDZ) == 0);
+		ASSERT(vd->vdev_ops == &vdev_raidz_ops ||
+		    vd->vdev_ops == &vdev_draid_ops);
 
 		/*
 		 * Make sure someone hasn't managed to sneak a fancy new vdev
@@ -405,6 +407,18 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_NPARITY, vd->vdev_nparity);
 	}
 
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+		fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA,
+		    vdc->vdc_ndata);
+		fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES,
+		    vdc->vdc_nspares);
+	}
+
+	if (vd->vdev_ops == &vdev_raidz_ops)
+		vdev_raidz_config_generate(vd, nv, getstats);
+
 	if (vd->vdev_wholedisk != -1ULL)
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_WHOLE_DISK,
 		    vd->vdev_wholedisk);
@@ -425,9 +439,15 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_ASIZE,
 		    vd->vdev_asize);
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_LOG, vd->vdev_islog);
+		if (vd->vdev_isspecial)
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_SPECIAL,
+			    vd->vdev_isspecial);
 		if (vd->vdev_removing)
 			fnvlist_add_uint64(nv, ZPOOL_CONFIG_REMOVING,
 			    vd->vdev_removing);
+		if (vd->vdev_im_object != 0)
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_INDIRECT_OBJECT,
+			    vd->vdev_im_object);
 	}
 
 	if (vd->vdev_dtl_sm != NULL) {
@@ -463,9 +483,21 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 			    ZPOOL_CONFIG_SCAN_STATS, (uint64_t *)&ps,
 			    sizeof (pool_scan_stat_t) / sizeof (uint64_t));
 		}
+
+		/* and likewise for top-level vdev removal */
+		if (vd == spa->spa_root_vdev) {
+			pool_removal_stat_t prs;
+
+			if (spa_removal_get_stats(spa, &prs) == 0) {
+				fnvlist_add_uint64_array(nv,
+				    ZPOOL_CONFIG_REMOVAL_STATS,
+				    (uint64_t *)&prs, sizeof (prs) /
+				    sizeof (uint64_t));
+			}
+		}
 	}
 
-	if (!vd->vdev_ops->vdev_op_leaf) {
+	if (!vd->vdev_ops->vdev_op_leaf && vd->vdev_children != 0) {
 		nvlist_t **child;
 		int c, idx;
 
@@ -500,7 +532,7 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 
 		kmem_free(child, vd->vdev_children * sizeof (nvlist_t *));
 
-	} else {
+	} else if (vd->vdev_ops->vdev_op_leaf) {
 		const char *aux = NULL;
 
 		if (vd->vdev_offline && !vd->vdev_tmpoffline)
@@ -544,8 +576,9 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 /*
  * Generate a view of the top-level vdevs.  If we currently have holes
  * in the namespace, then generate an array which contains a list of holey
- * vdevs.  Additionally, add the number of top-level children that currently
- * exist.
+ * vdevs.  Removed (indirect) vdevs have no labels either, so they are
+ * listed as holes too.  Additionally, add the number of top-level children
+ * that currently exist.
  */
 void
 vdev_top_config_generate(spa_t *spa, nvlist_t *config)
@@ -559,7 +592,7 @@ vdev_top_config_generate(spa_t *spa, nvlist_t *config)
 	for (c = 0, idx = 0; c < rvd->vdev_children; c++) {
 		vdev_t *tvd = rvd->vdev_child[c];
 
-		if (tvd->vdev_ishole)
+		if (tvd->vdev_ishole || tvd->vdev_ops == &vdev_indirect_ops)
 			array[idx++] = c;
 	}
 
@@ -672,6 +705,9 @@ vdev_inuse(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason,
 	if (l2cache_guid)
 		*l2cache_guid = 0ULL;
 
+	if (vd->vdev_ops == &vdev_draid_spare_ops)
+		return (vdev_draid_spare_inuse(vd, reason, spare_guid));
+
 	/*
 	 * Read the label, if any, and perform some basic sanity checks.
 	 */
@@ -1377,10 +1413,13 @@ retry:
 	 * If this isn't a resync due to I/O errors,
 	 * and nothing changed in this transaction group,
 	 * and the vdev configuration hasn't changed,
+	 * and no raidz reflow progress needs recording,
 	 * then there's nothing to do.
 	 */
 	if (ub->ub_txg < txg &&
 	    uberblock_update(ub, spa->spa_root_vdev, txg) == B_FALSE &&
+	    ub->ub_raidz_reflow_info ==
+	    spa->spa_ubsync.ub_raidz_reflow_info &&
 	    list_is_empty(&spa->spa_config_dirty_list))
 		return (0);
 
@@ -27,7 +27,13 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/dmu_tx.h>
+#include <sys/txg.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/abd.h>
@@ -130,6 +136,133 @@
 	VDEV_RAIDZ_64MUL_2((x), mask); \
 }
 
+/*
+ * RAIDZ expansion
+ *
+ * A device may be attached to an existing top-level raidz vdev to widen
+ * it by one child.  Each sector of the vdev has a logical address L (its
+ * offset in the raidz vdev in units of the sector size), and a vdev laid
+ * out over P children stores L on child L % P, at row L / P.  A block
+ * occupies a contiguous range of logical sectors, which is why the
+ * columns of its map sit on consecutive children.
+ *
+ * Attaching a child changes P, so a background thread copies ("reflows")
+ * the allocated sectors to their new locations in increasing order of L.
+ * The reflow offset splits the vdev: the sectors below it are laid out
+ * over all of the children, and the ones above it over all but the new
+ * one.  The data to parity ratio of a block is fixed by the number of
+ * children when it was born, so blocks born before an expansion took
+ * effect keep their original width.  A block whose width doesn't match
+ * the layout of the sectors it occupies is read and written as a set of
+ * runs, one per child, each of which holds every P-th sector of the block.
+ *
+ * The reflow offset is made durable in the uberblock once per txg, and a
+ * reflow interrupted by an export or a crash resumes from there.  The old
+ * location of every sector above the durable offset must survive until
+ * then.  So a batch never copies a sector to the old location of a sector
+ * above the durable offset, and writes to sectors between the durable and
+ * the in-core offsets also go to their old locations.  While a batch is
+ * being copied, the I/Os to its range are deferred until it's done.
+ */
+
+/*
+ * Maximum amount of data copied by one reflow batch.
+ */
+unsigned long raidz_expand_max_copy_bytes = 16 << 20;
+
+typedef struct raidz_deferred {
+	zio_t		*rd_zio;
+	list_node_t	rd_node;
+} raidz_deferred_t;
+
+typedef struct vdev_raidz_expand {
+	kmutex_t	vre_lock;
+	kcondvar_t	vre_cv;
+	uint64_t	vre_nexpand;	/* number of expansions */
+	uint64_t	*vre_txgs;	/* first txg of each expansion */
+	boolean_t	vre_reflowing;	/* last expansion is being reflowed */
+	uint64_t	vre_offset;	/* reflowed and flushed up to here */
+	uint64_t	vre_synced;	/* durable reflow offset */
+	uint64_t	vre_pending;	/* offset recorded in vre_pending_txg */
+	uint64_t	vre_pending_txg;
+	uint64_t	vre_record_txg;	/* txg of the last recording task */
+	uint64_t	vre_copy_start;	/* range of the batch being copied */
+	uint64_t	vre_copy_end;
+	boolean_t	vre_waiting;	/* reflow is waiting for I/O to drain */
+	list_t		vre_inflight;	/* I/Os of a reflowing vdev */
+	list_t		vre_deferred;	/* I/Os waiting for the batch */
+	kthread_t	*vre_thread;
+	boolean_t	vre_thread_exit;
+} vdev_raidz_expand_t;
+
+typedef struct raidz_expand_run {
+	uint64_t	rr_child;	/* child vdev holding the run */
+	uint64_t	rr_first;	/* logical sector of the first sector */
+	uint64_t	rr_width;	/* width of the layout of the run */
+	uint64_t	rr_count;	/* number of sectors */
+	abd_t		*rr_abd;
+	int		rr_error;
+	boolean_t	rr_tried;
+	boolean_t	rr_skipped;
+	boolean_t	rr_bad;		/* contents need to be reconstructed */
+	boolean_t	rr_shadow;	/* write to the sectors' old location */
+} raidz_expand_run_t;
+
+typedef struct raidz_expand_io {
+	vdev_raidz_expand_t *rei_vre;
+	list_node_t	rei_node;
+	boolean_t	rei_registered;	/* on vre_inflight */
+	uint64_t	rei_start;	/* byte range of the I/O */
+	uint64_t	rei_end;
+	uint64_t	rei_shadow;	/* old copies written from here */
+	uint64_t	rei_ashift;
+	uint64_t	rei_b;		/* first logical sector */
+	uint64_t	rei_width;	/* logical width of the block */
+	uint64_t	rei_split;	/* first sector laid out the old way */
+	uint64_t	rei_pnew;	/* children in the new layout */
+	uint64_t	rei_pold;	/* children in the old layout */
+	uint64_t	rei_nnew;	/* runs in the new layout */
+	uint64_t	rei_nold;	/* runs in the old layout */
+	uint64_t	rei_nruns;	/* all runs, shadow ones included */
+	boolean_t	rei_swapped;	/* map columns 0 and 1 swapped */
+	raidz_expand_run_t *rei_runs;
+} raidz_expand_io_t;
+
+/*
+ * The I/O no longer touches the vdev, so the reflow may copy its range.
+ */
+static void
+vdev_raidz_expand_io_end(raidz_expand_io_t *rei)
+{
+	vdev_raidz_expand_t *vre = rei->rei_vre;
+
+	if (!rei->rei_registered)
+		return;
+
+	mutex_enter(&vre->vre_lock);
+	list_remove(&vre->vre_inflight, rei);
+	rei->rei_registered = B_FALSE;
+	if (vre->vre_waiting)
+		cv_broadcast(&vre->vre_cv);
+	mutex_exit(&vre->vre_lock);
+}
+
+static void
+vdev_raidz_expand_io_free(raidz_expand_io_t *rei)
+{
+	uint64_t i;
+
+	ASSERT(!rei->rei_registered);
+
+	for (i = 0; i < rei->rei_nruns; i++)
+		abd_free(rei->rei_runs[i].rr_abd);
+	if (rei->rei_runs != NULL) {
+		kmem_free(rei->rei_runs,
+		    rei->rei_nruns * sizeof (raidz_expand_run_t));
+	}
+	kmem_free(rei, sizeof (raidz_expand_io_t));
+}
+
 void
 vdev_raidz_map_free(raidz_map_t *rm)
 {
@@ -153,6 +286,9 @@ vdev_raidz_map_free(raidz_map_t *rm)
 	if (rm->rm_abd_copy != NULL)
 		abd_free(rm->rm_abd_copy);
 
+	if (rm->rm_expand != NULL)
+		vdev_raidz_expand_io_free(rm->rm_expand);
+
 	kmem_free(rm, offsetof(raidz_map_t, rm_col[rm->rm_scols]));
 }
 
@@ -164,6 +300,9 @@ vdev_raidz_map_free_vsd(zio_t *zio)
 	ASSERT0(rm->rm_freed);
 	rm->rm_freed = 1;
 
+	if (rm->rm_expand != NULL)
+		vdev_raidz_expand_io_end(rm->rm_expand);
+
 	if (rm->rm_reports == 0)
 		vdev_raidz_map_free(rm);
 }
@@ -330,18 +469,20 @@ static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
 
 /*
  * Divides the IO evenly across all child vdevs; usually, dcols is
- * the number of children in the target vdev.
+ * the number of children in the target vdev.  The block is laid out as
+ * if it were at the given offset of the RAIDZ vdev, which for dRAID is
+ * the offset of the block within its redundancy group.
  *
- * Avoid inlining the function to keep vdev_raidz_io_start(), which
- * is this functions only caller, as small as possible on the stack.
+ * Avoid inlining the function to keep vdev_raidz_io_start() and
+ * vdev_draid_io_start() as small as possible on the stack.
  */
 noinline raidz_map_t *
-vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
-    uint64_t nparity)
+vdev_raidz_map_alloc_offset(zio_t *zio, uint64_t offset, uint64_t unit_shift,
+    uint64_t dcols, uint64_t nparity)
 {
 	raidz_map_t *rm;
 	/* The starting RAIDZ (parent) vdev sector of the block. */
-	uint64_t b = zio->io_offset >> unit_shift;
+	uint64_t b = offset >> unit_shift;
 	/* The zio's size in units of the vdev's minimum sector size. */
 	uint64_t s = zio->io_size >> unit_shift;
 	/* The first column for this stripe. */
@@ -398,6 +539,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	rm->rm_reports = 0;
 	rm->rm_freed = 0;
 	rm->rm_ecksuminjected = 0;
+	rm->rm_expand = NULL;
 
 	asize = 0;
 
@@ -469,7 +611,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	ASSERT(rm->rm_cols >= 2);
 	ASSERT(rm->rm_col[0].rc_size == rm->rm_col[1].rc_size);
 
-	if (rm->rm_firstdatacol == 1 && (zio->io_offset & (1ULL << 20))) {
+	if (rm->rm_firstdatacol == 1 && (offset & (1ULL << 20))) {
 		devidx = rm->rm_col[0].rc_devidx;
 		o = rm->rm_col[0].rc_offset;
 		rm->rm_col[0].rc_devidx = rm->rm_col[1].rc_devidx;
@@ -490,6 +632,14 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	return (rm);
 }
 
+raidz_map_t *
+vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
+    uint64_t nparity)
+{
+	return (vdev_raidz_map_alloc_offset(zio, zio->io_offset, unit_shift,
+	    dcols, nparity));
+}
+
 struct pqr_struct {
 	uint64_t *p;
 	uint64_t *q;
@@ -1602,8 +1752,8 @@ vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
 		*ashift = MAX(*ashift, cvd->vdev_ashift);
 	}
 
-	*asize *= vd->vdev_children;
-	*max_asize *= vd->vdev_children;
+	*asize *= vdev_raidz_physical_width(vd);
+	*max_asize *= vdev_raidz_physical_width(vd);
 
 	if (numerrors > nparity) {
 		vd->vdev_stat.vs_aux = VDEV_AUX_NO_REPLICAS;
@@ -1623,11 +1773,10 @@ vdev_raidz_close(vdev_t *vd)
 }
 
 static uint64_t
-vdev_raidz_asize(vdev_t *vd, uint64_t psize)
+vdev_raidz_asize_width(vdev_t *vd, uint64_t psize, uint64_t cols)
 {
 	uint64_t asize;
 	uint64_t ashift = vd->vdev_top->vdev_ashift;
-	uint64_t cols = vd->vdev_children;
 	uint64_t nparity = vd->vdev_nparity;
 
 	asize = ((psize - 1) >> ashift) + 1;
@@ -1637,6 +1786,25 @@ vdev_raidz_asize(vdev_t *vd, uint64_t psize)
 	return (asize);
 }
 
+static uint64_t
+vdev_raidz_asize(vdev_t *vd, uint64_t psize)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t asize = vdev_raidz_asize_width(vd, psize, vd->vdev_children);
+
+	/*
+	 * Blocks born before the last expansion took effect are one column
+	 * narrower, and an allocation may be for one of them until then.
+	 */
+	if (vre != NULL && spa_last_synced_txg(vd->vdev_spa) <
+	    vre->vre_txgs[vre->vre_nexpand - 1]) {
+		asize = MAX(asize, vdev_raidz_asize_width(vd, psize,
+		    vd->vdev_children - 1));
+	}
+
+	return (asize);
+}
+
 static void
 vdev_raidz_child_done(zio_t *zio)
 {
@@ -1647,6 +1815,343 @@ vdev_raidz_child_done(zio_t *zio)
 	rc->rc_skipped = 0;
 }
 
+/*
+ * Trim the ranges of the children which back the zio's range of the RAIDZ
+ * vdev.  Sectors are striped across the children in order, so each child's
+ * share of a contiguous range is itself contiguous.  Parity and padding
+ * sectors are free whenever the data they cover is, so no map is needed.
+ */
+static void
+vdev_raidz_io_trim(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t dcols = vd->vdev_children;
+	uint64_t b = zio->io_offset >> ashift;
+	uint64_t s = zio->io_size >> ashift;
+	uint64_t c;
+
+	for (c = 0; c < MIN(s, dcols); c++) {
+		uint64_t first = b + c;
+		uint64_t count = (s - c + dcols - 1) / dcols;
+
+		zio_nowait(zio_vdev_child_io(zio, NULL,
+		    vd->vdev_child[first % dcols], (first / dcols) << ashift,
+		    NULL, count << ashift, ZIO_TYPE_FREE, zio->io_priority,
+		    0, NULL, NULL));
+	}
+
+	zio_execute(zio);
+}
+
+/*
+ * The number of children the vdev had when the block was born, which
+ * fixes the block's data to parity ratio.
+ */
+static uint64_t
+vdev_raidz_block_width(vdev_t *vd, zio_t *zio)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t birth, width = vd->vdev_children;
+	uint64_t i;
+
+	birth = (zio->io_bp != NULL) ? BP_PHYSICAL_BIRTH(zio->io_bp) :
+	    zio->io_txg;
+
+	for (i = 0; i < vre->vre_nexpand; i++) {
+		if (vre->vre_txgs[i] > birth)
+			width--;
+	}
+
+	return (width);
+}
+
+/*
+ * Set up the runs holding the logical sectors [lo, hi) of a layout over
+ * width children.
+ */
+static void
+vdev_raidz_expand_init_runs(raidz_expand_io_t *rei, raidz_expand_run_t *rr,
+    uint64_t lo, uint64_t hi, uint64_t width, boolean_t shadow)
+{
+	uint64_t k;
+
+	for (k = 0; k < MIN(hi - lo, width); k++, rr++) {
+		rr->rr_first = lo + k;
+		rr->rr_child = rr->rr_first % width;
+		rr->rr_width = width;
+		rr->rr_count = (hi - rr->rr_first + width - 1) / width;
+		rr->rr_shadow = shadow;
+		rr->rr_abd = abd_alloc_linear(rr->rr_count << rei->rei_ashift,
+		    B_FALSE);
+	}
+}
+
+/*
+ * Return the run holding logical sector l, and the index of the sector
+ * in it.
+ */
+static raidz_expand_run_t *
+vdev_raidz_expand_run(raidz_expand_io_t *rei, uint64_t l, uint64_t *idx)
+{
+	raidz_expand_run_t *rr;
+
+	if (l < rei->rei_split) {
+		rr = &rei->rei_runs[(l - rei->rei_b) % rei->rei_pnew];
+	} else {
+		rr = &rei->rei_runs[rei->rei_nnew +
+		    (l - rei->rei_split) % rei->rei_pold];
+	}
+
+	*idx = (l - rr->rr_first) / rr->rr_width;
+	return (rr);
+}
+
+static boolean_t
+vdev_raidz_expand_run_bad(raidz_expand_run_t *rr, const uint64_t *tgts,
+    int ntgts)
+{
+	int t;
+
+	if (rr->rr_bad)
+		return (B_TRUE);
+
+	for (t = 0; t < ntgts; t++) {
+		if (rr->rr_child == tgts[t])
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Copy the sectors of the map's columns into the runs, or back from the
+ * runs into the columns.  The padding sectors of a block are written as
+ * zeroes.  Scattering skips the runs which are bad or held by one of
+ * the children in tgts, leaving those sectors to be reconstructed.
+ */
+static void
+vdev_raidz_expand_xfer(raidz_map_t *rm, boolean_t gather,
+    const uint64_t *tgts, int ntgts)
+{
+	raidz_expand_io_t *rei = rm->rm_expand;
+	uint64_t ashift = rei->rei_ashift;
+	uint64_t size = 1ULL << ashift;
+	uint64_t w = rei->rei_width;
+	uint64_t shadow = rei->rei_shadow >> ashift;
+	uint64_t i, c, r, l, idx;
+	raidz_expand_run_t *rr;
+	raidz_col_t *rc;
+
+	for (i = 0; i < rm->rm_asize >> ashift; i++) {
+		c = i % w;
+		r = i / w;
+		l = rei->rei_b + i;
+		rr = vdev_raidz_expand_run(rei, l, &idx);
+
+		rc = NULL;
+		if (c < rm->rm_cols) {
+			rc = &rm->rm_col[(rei->rei_swapped && c < 2) ?
+			    c ^ 1 : c];
+			if ((r << ashift) >= rc->rc_size)
+				rc = NULL;
+		}
+
+		if (!gather) {
+			if (rc != NULL &&
+			    !vdev_raidz_expand_run_bad(rr, tgts, ntgts)) {
+				abd_copy_off(rc->rc_abd, rr->rr_abd,
+				    r << ashift, idx << ashift, size);
+			}
+			continue;
+		}
+
+		if (rc != NULL) {
+			abd_copy_off(rr->rr_abd, rc->rc_abd, idx << ashift,
+			    r << ashift, size);
+		} else {
+			abd_zero_off(rr->rr_abd, idx << ashift, size);
+		}
+
+		if (l >= shadow && l < rei->rei_split) {
+			uint64_t lo = MAX(rei->rei_b, shadow);
+			raidz_expand_run_t *sr = &rei->rei_runs[rei->rei_nnew +
+			    rei->rei_nold + (l - lo) % rei->rei_pold];
+
+			abd_copy_off(sr->rr_abd, rr->rr_abd,
+			    ((l - sr->rr_first) / sr->rr_width) << ashift,
+			    idx << ashift, size);
+		}
+	}
+}
+
+static void
+vdev_raidz_expand_child_done(zio_t *zio)
+{
+	raidz_expand_run_t *rr = zio->io_private;
+
+	rr->rr_error = zio->io_error;
+	rr->rr_tried = B_TRUE;
+	rr->rr_skipped = B_FALSE;
+}
+
+static void
+vdev_raidz_expand_run_io(zio_t *zio, raidz_expand_run_t *rr, zio_type_t type,
+    zio_priority_t priority, enum zio_flag flags, zio_done_func_t *done)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	uint64_t ashift = rm->rm_expand->rei_ashift;
+
+	zio_nowait(zio_vdev_child_io(zio, NULL,
+	    zio->io_vd->vdev_child[rr->rr_child],
+	    (rr->rr_first / rr->rr_width) << ashift, rr->rr_abd,
+	    rr->rr_count << ashift, type, priority, flags, done, rr));
+}
+
+static const zio_vsd_ops_t vdev_raidz_expand_vsd_ops = {
+	vdev_raidz_map_free_vsd,
+	zio_vsd_default_cksum_report
+};
+
+/*
+ * Start an I/O to a vdev which has been expanded.  The map is built for
+ * the width the block was born with, and if that doesn't match the
+ * layout of the sectors it occupies the columns are moved in and out of
+ * per-child runs.
+ */
+static void
+vdev_raidz_expand_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t children = vd->vdev_children;
+	uint64_t b, e, lo, nshadow;
+	raidz_expand_io_t *rei;
+	raidz_expand_run_t *rr;
+	raidz_deferred_t *rd;
+	raidz_map_t *rm;
+	uint64_t i;
+
+	rei = kmem_zalloc(sizeof (raidz_expand_io_t), KM_SLEEP);
+	rei->rei_vre = vre;
+	rei->rei_ashift = ashift;
+	rei->rei_width = vdev_raidz_block_width(vd, zio);
+	rei->rei_shadow = UINT64_MAX;
+
+	rm = vdev_raidz_map_alloc(zio, ashift, rei->rei_width,
+	    vd->vdev_nparity);
+	rm->rm_expand = rei;
+
+	b = zio->io_offset >> ashift;
+	e = b + (rm->rm_asize >> ashift);
+	rei->rei_start = zio->io_offset;
+	rei->rei_end = zio->io_offset + rm->rm_asize;
+	rei->rei_b = b;
+	rei->rei_swapped = (rm->rm_firstdatacol == 1 &&
+	    (zio->io_offset & (1ULL << 20)));
+
+	rd = kmem_alloc(sizeof (raidz_deferred_t), KM_SLEEP);
+
+	mutex_enter(&vre->vre_lock);
+	if (vre->vre_reflowing && rei->rei_start < vre->vre_copy_end &&
+	    rei->rei_end > vre->vre_copy_start) {
+		rd->rd_zio = zio;
+		list_insert_tail(&vre->vre_deferred, rd);
+		zio->io_vsd = NULL;
+		zio->io_vsd_ops = NULL;
+		mutex_exit(&vre->vre_lock);
+		vdev_raidz_map_free(rm);
+		return;
+	}
+	kmem_free(rd, sizeof (raidz_deferred_t));
+
+	if (vre->vre_reflowing) {
+		rei->rei_split = MIN(MAX(vre->vre_offset >> ashift, b), e);
+		list_insert_tail(&vre->vre_inflight, rei);
+		rei->rei_registered = B_TRUE;
+		if (zio->io_type == ZIO_TYPE_WRITE &&
+		    MAX(b, vre->vre_synced >> ashift) < rei->rei_split)
+			rei->rei_shadow = vre->vre_synced;
+	} else {
+		rei->rei_split = e;
+	}
+	mutex_exit(&vre->vre_lock);
+
+	if (rei->rei_shadow == UINT64_MAX &&
+	    ((rei->rei_split == e && rei->rei_width == children) ||
+	    (rei->rei_split == b && rei->rei_width == children - 1))) {
+		vdev_raidz_io_start_map(zio, rm);
+		return;
+	}
+
+	zio->io_vsd_ops = &vdev_raidz_expand_vsd_ops;
+
+	lo = MAX(b, rei->rei_shadow >> ashift);
+	nshadow = (rei->rei_shadow == UINT64_MAX) ? 0 :
+	    MIN(rei->rei_split - lo, children - 1);
+	rei->rei_pnew = children;
+	rei->rei_pold = children - 1;
+	rei->rei_nnew = MIN(rei->rei_split - b, children);
+	rei->rei_nold = MIN(e - rei->rei_split, children - 1);
+	rei->rei_nruns = rei->rei_nnew + rei->rei_nold + nshadow;
+	rei->rei_runs = kmem_zalloc(rei->rei_nruns *
+	    sizeof (raidz_expand_run_t), KM_SLEEP);
+
+	vdev_raidz_expand_init_runs(rei, &rei->rei_runs[0], b,
+	    rei->rei_split, children, B_FALSE);
+	vdev_raidz_expand_init_runs(rei, &rei->rei_runs[rei->rei_nnew],
+	    rei->rei_split, e, children - 1, B_FALSE);
+	if (nshadow != 0) {
+		vdev_raidz_expand_init_runs(rei,
+		    &rei->rei_runs[rei->rei_nnew + rei->rei_nold], lo,
+		    rei->rei_split, children - 1, B_TRUE);
+	}
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		vdev_raidz_generate_parity(rm);
+		vdev_raidz_expand_xfer(rm, B_TRUE, NULL, 0);
+
+		for (i = 0; i < rei->rei_nruns; i++) {
+			vdev_raidz_expand_run_io(zio, &rei->rei_runs[i],
+			    ZIO_TYPE_WRITE, zio->io_priority, 0,
+			    vdev_raidz_expand_child_done);
+		}
+
+		zio_execute(zio);
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+
+	/*
+	 * Every run is read, parity included, since a row of the block may
+	 * span both layouts.
+	 */
+	for (i = 0; i < rei->rei_nnew + rei->rei_nold; i++) {
+		vdev_t *cvd;
+
+		rr = &rei->rei_runs[i];
+		cvd = vd->vdev_child[rr->rr_child];
+		if (!vdev_readable(cvd)) {
+			rr->rr_error = SET_ERROR(ENXIO);
+			rr->rr_tried = B_TRUE;	/* don't even try */
+			rr->rr_skipped = B_TRUE;
+			continue;
+		}
+		if (vdev_dtl_contains(cvd, DTL_MISSING, zio->io_txg, 1)) {
+			rr->rr_error = SET_ERROR(ESTALE);
+			rr->rr_skipped = B_TRUE;
+			continue;
+		}
+		vdev_raidz_expand_run_io(zio, rr, ZIO_TYPE_READ,
+		    zio->io_priority, 0, vdev_raidz_expand_child_done);
+	}
+
+	zio_execute(zio);
+}
+
+
 /*
  * Start an IO operation on a RAIDZ VDev
  *
@@ -1668,17 +2173,46 @@ static void
 vdev_raidz_io_start(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
-	vdev_t *tvd = vd->vdev_top;
-	vdev_t *cvd;
 	raidz_map_t *rm;
-	raidz_col_t *rc;
-	int c, i;
 
-	rm = vdev_raidz_map_alloc(zio, tvd->vdev_ashift, vd->vdev_children,
-	    vd->vdev_nparity);
+	if (zio->io_type == ZIO_TYPE_FREE) {
+		/*
+		 * The old and new layouts of a reflowing vdev overlap on
+		 * the children, so trims wait for the reflow to finish.
+		 */
+		if (vdev_raidz_expanding(vd))
+			zio_execute(zio);
+		else
+			vdev_raidz_io_trim(zio);
+		return;
+	}
+
+	if (vd->vdev_tsd != NULL) {
+		vdev_raidz_expand_io_start(zio);
+		return;
+	}
 
+	rm = vdev_raidz_map_alloc(zio, vd->vdev_top->vdev_ashift,
+	    vd->vdev_children, vd->vdev_nparity);
 	ASSERT3U(rm->rm_asize, ==, vdev_psize_to_asize(vd, zio->io_size));
 
+	vdev_raidz_io_start_map(zio, rm);
+}
+
+/*
+ * Issue the child I/Os for the columns of a map built by the caller.  The
+ * columns' rc_devidx and rc_offset name the child vdev and the offset on
+ * it, which lets dRAID reuse this for its permuted layout.
+ */
+void
+vdev_raidz_io_start_map(zio_t *zio, raidz_map_t *rm)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_t *tvd = vd->vdev_top;
+	vdev_t *cvd;
+	raidz_col_t *rc;
+	int c, i;
+
 	if (zio->io_type == ZIO_TYPE_WRITE) {
 		vdev_raidz_generate_parity(rm);
 
@@ -2014,6 +2548,271 @@ done:
 	return (ret);
 }
 
+/*
+ * Report a checksum error for a run of an expanded RAID-Z device.  The
+ * run's buffer holds the good data.
+ */
+static void
+vdev_raidz_expand_checksum_error(zio_t *zio, raidz_expand_run_t *rr,
+    abd_t *bad)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	uint64_t ashift = rm->rm_expand->rei_ashift;
+	uint64_t size = rr->rr_count << ashift;
+	vdev_t *vd = zio->io_vd->vdev_child[rr->rr_child];
+	void *good_buf, *bad_buf;
+	zio_bad_cksum_t zbc;
+
+	if (zio->io_flags & ZIO_FLAG_SPECULATIVE)
+		return;
+
+	mutex_enter(&vd->vdev_stat_lock);
+	vd->vdev_stat.vs_checksum_errors++;
+	mutex_exit(&vd->vdev_stat_lock);
+
+	zbc.zbc_has_cksum = 0;
+	zbc.zbc_injected = rm->rm_ecksuminjected;
+
+	good_buf = abd_borrow_buf_copy(rr->rr_abd, size);
+	bad_buf = abd_borrow_buf_copy(bad, size);
+	zfs_ereport_post_checksum(zio->io_spa, vd, zio,
+	    (rr->rr_first / rr->rr_width) << ashift, size, good_buf, bad_buf,
+	    &zbc);
+	abd_return_buf(bad, bad_buf, size);
+	abd_return_buf(rr->rr_abd, good_buf, size);
+}
+
+/*
+ * Fill in the map's columns from the runs which were read, and
+ * reconstruct the sectors of the bad runs and of the runs held by the
+ * children in tgts.  Each row of the block is reconstructed by itself,
+ * since the columns of a row may come from runs on different layouts.
+ */
+static int
+vdev_raidz_expand_reconstruct(zio_t *zio, const uint64_t *tgts, int ntgts)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	raidz_expand_io_t *rei = rm->rm_expand;
+	uint64_t ashift = rei->rei_ashift;
+	uint64_t nrows = rm->rm_col[0].rc_size >> ashift;
+	uint64_t r, c, nc, idx;
+	raidz_expand_run_t *rr;
+	raidz_col_t *rc, *rrc;
+	raidz_map_t *row;
+	int nbad, ndata, error = 0;
+
+	vdev_raidz_expand_xfer(rm, B_FALSE, tgts, ntgts);
+
+	row = kmem_zalloc(offsetof(raidz_map_t, rm_col[rm->rm_cols]),
+	    KM_SLEEP);
+	row->rm_firstdatacol = rm->rm_firstdatacol;
+	row->rm_ops = rm->rm_ops;
+
+	for (r = 0; r < nrows && error == 0; r++) {
+		nbad = ndata = 0;
+		row->rm_cols = 0;
+
+		for (c = 0; c < rm->rm_cols; c++) {
+			rc = &rm->rm_col[c];
+			if ((r << ashift) >= rc->rc_size)
+				break;
+
+			nc = (rei->rei_swapped && c < 2) ? c ^ 1 : c;
+			rr = vdev_raidz_expand_run(rei,
+			    rei->rei_b + r * rei->rei_width + nc, &idx);
+
+			rrc = &row->rm_col[row->rm_cols++];
+			rrc->rc_abd = abd_get_offset_size(rc->rc_abd,
+			    r << ashift, 1ULL << ashift);
+			rrc->rc_size = 1ULL << ashift;
+			rrc->rc_error = 0;
+			if (vdev_raidz_expand_run_bad(rr, tgts, ntgts)) {
+				rrc->rc_error = (rr->rr_error != 0) ?
+				    rr->rr_error : SET_ERROR(ECKSUM);
+				nbad++;
+				if (c >= rm->rm_firstdatacol)
+					ndata++;
+			}
+		}
+		row->rm_scols = row->rm_cols;
+
+		if (nbad > rm->rm_firstdatacol)
+			error = vdev_raidz_worst_error(row);
+		else if (ndata != 0)
+			(void) vdev_raidz_reconstruct(row, NULL, 0);
+
+		for (c = 0; c < row->rm_cols; c++)
+			abd_put(row->rm_col[c].rc_abd);
+	}
+
+	kmem_free(row, offsetof(raidz_map_t, rm_col[rm->rm_cols]));
+
+	return (error);
+}
+
+/*
+ * Regenerate the runs from the map's (good) data and parity, and report
+ * the ones which don't match what was read.  The runs are left holding
+ * the regenerated contents.
+ */
+static int
+vdev_raidz_expand_verify(zio_t *zio)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	raidz_expand_io_t *rei = rm->rm_expand;
+	raidz_expand_run_t *rr;
+	abd_t **orig;
+	uint64_t i;
+	int n = 0;
+
+	orig = kmem_alloc(rei->rei_nruns * sizeof (abd_t *), KM_SLEEP);
+	for (i = 0; i < rei->rei_nruns; i++) {
+		rr = &rei->rei_runs[i];
+		orig[i] = rr->rr_abd;
+		rr->rr_abd = abd_alloc_linear(rr->rr_count << rei->rei_ashift,
+		    B_FALSE);
+	}
+
+	vdev_raidz_generate_parity(rm);
+	vdev_raidz_expand_xfer(rm, B_TRUE, NULL, 0);
+
+	for (i = 0; i < rei->rei_nruns; i++) {
+		rr = &rei->rei_runs[i];
+		if (!rr->rr_shadow && rr->rr_tried && rr->rr_error == 0 &&
+		    abd_cmp(orig[i], rr->rr_abd) != 0) {
+			vdev_raidz_expand_checksum_error(zio, rr, orig[i]);
+			rr->rr_error = SET_ERROR(ECKSUM);
+			rr->rr_bad = B_TRUE;
+			n++;
+		}
+		abd_free(orig[i]);
+	}
+
+	kmem_free(orig, rei->rei_nruns * sizeof (abd_t *));
+
+	return (n);
+}
+
+/*
+ * Try reconstructing the block with every combination of up to nparity
+ * children assumed to have returned bad data.
+ */
+static boolean_t
+vdev_raidz_expand_combrec(zio_t *zio)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	uint64_t children = zio->io_vd->vdev_children;
+	uint64_t tgts[VDEV_RAIDZ_MAXPARITY];
+	int n, i;
+
+	for (n = 1; n <= rm->rm_firstdatacol && n <= children; n++) {
+		for (i = 0; i < n; i++)
+			tgts[i] = i;
+
+		for (;;) {
+			if (vdev_raidz_expand_reconstruct(zio, tgts, n) == 0 &&
+			    raidz_checksum_verify(zio) == 0)
+				return (B_TRUE);
+
+			for (i = n - 1; i >= 0 && tgts[i] == children - n + i;
+			    i--)
+				;
+			if (i < 0)
+				break;
+			tgts[i]++;
+			for (i++; i < n; i++)
+				tgts[i] = tgts[i - 1] + 1;
+		}
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Complete an I/O which was split into runs.  It follows the same steps
+ * as vdev_raidz_io_done(), but every run has already been read.
+ */
+static void
+vdev_raidz_expand_io_done(zio_t *zio)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	raidz_expand_io_t *rei = rm->rm_expand;
+	raidz_expand_run_t *rr;
+	uint64_t nruns = rei->rei_nnew + rei->rei_nold;
+	int unexpected_errors = 0;
+	int error = 0;
+	int nbad = 0;
+	uint64_t i, j;
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		/*
+		 * As for any raidz write, a partial write is good enough
+		 * if the data can be reconstructed later.  The old copies
+		 * are only a fallback, so their errors are ignored.
+		 */
+		for (i = 0; i < nruns; i++) {
+			rr = &rei->rei_runs[i];
+			if (rr->rr_error == 0)
+				continue;
+			error = zio_worst_error(error, rr->rr_error);
+			for (j = 0; j < i; j++) {
+				if (rei->rei_runs[j].rr_error != 0 &&
+				    rei->rei_runs[j].rr_child == rr->rr_child)
+					break;
+			}
+			if (j == i)
+				nbad++;
+		}
+		if (nbad > rm->rm_firstdatacol)
+			zio->io_error = error;
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+
+	for (i = 0; i < nruns; i++) {
+		rr = &rei->rei_runs[i];
+		if (rr->rr_error != 0) {
+			rr->rr_bad = B_TRUE;
+			if (!rr->rr_skipped)
+				unexpected_errors++;
+		}
+	}
+
+	error = vdev_raidz_expand_reconstruct(zio, NULL, 0);
+	if (error == 0 && raidz_checksum_verify(zio) == 0) {
+		if (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))
+			unexpected_errors += vdev_raidz_expand_verify(zio);
+	} else if (vdev_raidz_expand_combrec(zio)) {
+		unexpected_errors += vdev_raidz_expand_verify(zio);
+	} else {
+		zio->io_error = (error != 0) ? error : SET_ERROR(ECKSUM);
+	}
+
+	zio_checksum_verified(zio);
+
+	if (zio->io_error == 0 && spa_writeable(zio->io_spa) &&
+	    (unexpected_errors || (zio->io_flags & ZIO_FLAG_RESILVER))) {
+		/*
+		 * Use the good data we have in hand to repair damaged runs.
+		 */
+		vdev_raidz_generate_parity(rm);
+		vdev_raidz_expand_xfer(rm, B_TRUE, NULL, 0);
+
+		for (i = 0; i < nruns; i++) {
+			rr = &rei->rei_runs[i];
+			if (rr->rr_error == 0)
+				continue;
+
+			vdev_raidz_expand_run_io(zio, rr, ZIO_TYPE_WRITE,
+			    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_IO_REPAIR |
+			    (unexpected_errors ? ZIO_FLAG_SELF_HEAL : 0),
+			    NULL);
+		}
+	}
+}
+
+
 /*
  * Complete an IO operation on a RAIDZ VDev
  *
@@ -2035,7 +2834,7 @@ done:
  *   3. If there were unexpected errors or this is a resilver operation,
  *      rewrite the vdevs that had errors.
  */
-static void
+void
 vdev_raidz_io_done(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
@@ -2051,6 +2850,15 @@ vdev_raidz_io_done(zio_t *zio)
 	int tgts[VDEV_RAIDZ_MAXPARITY];
 	int code;
 
+	/* Trims are advisory, so child failures are ignored. */
+	if (zio->io_type == ZIO_TYPE_FREE)
+		return;
+
+	if (rm->rm_expand != NULL && rm->rm_expand->rei_runs != NULL) {
+		vdev_raidz_expand_io_done(zio);
+		return;
+	}
+
 	ASSERT(zio->io_bp != NULL);  /* XXX need to add code to enforce this */
 
 	ASSERT(rm->rm_missingparity <= rm->rm_firstdatacol);
@@ -2297,6 +3105,638 @@ done:
 	}
 }
 
+static vdev_raidz_expand_t *
+vdev_raidz_expand_create(const uint64_t *txgs, uint64_t nexpand)
+{
+	vdev_raidz_expand_t *vre;
+
+	vre = kmem_zalloc(sizeof (vdev_raidz_expand_t), KM_SLEEP);
+	mutex_init(&vre->vre_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vre->vre_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&vre->vre_inflight, sizeof (raidz_expand_io_t),
+	    offsetof(raidz_expand_io_t, rei_node));
+	list_create(&vre->vre_deferred, sizeof (raidz_deferred_t),
+	    offsetof(raidz_deferred_t, rd_node));
+
+	vre->vre_nexpand = nexpand;
+	vre->vre_txgs = kmem_alloc(nexpand * sizeof (uint64_t), KM_SLEEP);
+	bcopy(txgs, vre->vre_txgs, nexpand * sizeof (uint64_t));
+
+	return (vre);
+}
+
+/*
+ * Build the expansion state of a raidz vdev from its config, or return
+ * NULL if it has never been expanded.
+ */
+void *
+vdev_raidz_expand_alloc(nvlist_t *nv)
+{
+	vdev_raidz_expand_t *vre;
+	uint64_t *txgs;
+	uint64_t expanding = 0;
+	uint_t nexpand;
+
+	if (nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS,
+	    &txgs, &nexpand) != 0 || nexpand == 0)
+		return (NULL);
+
+	vre = vdev_raidz_expand_create(txgs, nexpand);
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_RAIDZ_EXPANDING,
+	    &expanding);
+	vre->vre_reflowing = (expanding != 0);
+
+	return (vre);
+}
+
+void
+vdev_raidz_expand_free(vdev_t *vd)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+
+	if (vre == NULL)
+		return;
+
+	ASSERT3P(vre->vre_thread, ==, NULL);
+	ASSERT(list_is_empty(&vre->vre_inflight));
+	ASSERT(list_is_empty(&vre->vre_deferred));
+
+	list_destroy(&vre->vre_inflight);
+	list_destroy(&vre->vre_deferred);
+	cv_destroy(&vre->vre_cv);
+	mutex_destroy(&vre->vre_lock);
+	kmem_free(vre->vre_txgs, vre->vre_nexpand * sizeof (uint64_t));
+	kmem_free(vre, sizeof (vdev_raidz_expand_t));
+	vd->vdev_tsd = NULL;
+}
+
+void
+vdev_raidz_config_generate(vdev_t *vd, nvlist_t *nv, boolean_t getstats)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t stats[2];
+
+	if (vre == NULL)
+		return;
+
+	fnvlist_add_uint64_array(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS,
+	    vre->vre_txgs, vre->vre_nexpand);
+
+	if (!vre->vre_reflowing)
+		return;
+
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_RAIDZ_EXPANDING, 1);
+
+	if (getstats) {
+		mutex_enter(&vre->vre_lock);
+		stats[0] = vre->vre_offset;
+		mutex_exit(&vre->vre_lock);
+		stats[1] = vd->vdev_ms_count << vd->vdev_ms_shift;
+		fnvlist_add_uint64_array(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_STATS,
+		    stats, 2);
+	}
+}
+
+/*
+ * Returns true if the vdev's last expansion is still being reflowed.
+ */
+boolean_t
+vdev_raidz_expanding(vdev_t *vd)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+
+	return (vd->vdev_ops == &vdev_raidz_ops && vre != NULL &&
+	    vre->vre_reflowing);
+}
+
+/*
+ * The number of children the vdev's space is spread over.  A child
+ * attached by an expansion only adds space once the reflow is done.
+ */
+uint64_t
+vdev_raidz_physical_width(vdev_t *vd)
+{
+	return (vd->vdev_children - (vdev_raidz_expanding(vd) ? 1 : 0));
+}
+
+/*
+ * The allocated size of psize as the vdev was created, which keeps the
+ * deflate ratio of its space accounting stable across expansions.
+ */
+uint64_t
+vdev_raidz_deflate_asize(vdev_t *vd, uint64_t psize)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t nexpand = (vre != NULL) ? vre->vre_nexpand : 0;
+
+	return (vdev_raidz_asize_width(vd, psize,
+	    vd->vdev_children - nexpand));
+}
+
+/*
+ * Record the attach of a new child, which is already in the vdev tree.
+ * Blocks born from the txg after the ones currently in flight on use the
+ * new width.
+ */
+void
+vdev_raidz_expand_attach(vdev_t *vd, uint64_t txg)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t etxg = txg + TXG_CONCURRENT_STATES;
+	uint64_t *txgs;
+
+	if (vre == NULL) {
+		vre = vdev_raidz_expand_create(&etxg, 1);
+		vd->vdev_tsd = vre;
+	} else {
+		ASSERT(!vre->vre_reflowing);
+		txgs = kmem_alloc((vre->vre_nexpand + 1) * sizeof (uint64_t),
+		    KM_SLEEP);
+		bcopy(vre->vre_txgs, txgs,
+		    vre->vre_nexpand * sizeof (uint64_t));
+		txgs[vre->vre_nexpand] = etxg;
+		kmem_free(vre->vre_txgs,
+		    vre->vre_nexpand * sizeof (uint64_t));
+		vre->vre_txgs = txgs;
+		vre->vre_nexpand++;
+	}
+
+	/* The first row of sectors is in the same place in both layouts. */
+	vre->vre_reflowing = B_TRUE;
+	vre->vre_offset = (vd->vdev_children - 1) << vd->vdev_ashift;
+	vre->vre_synced = vre->vre_offset;
+	vre->vre_pending_txg = 0;
+	vre->vre_record_txg = 0;
+}
+
+/*
+ * Pick up the durable reflow offset from the uberblock.
+ */
+void
+vdev_raidz_expand_load(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_raidz_expand_t *vre;
+	vdev_t *vd;
+	uint64_t c;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vd = rvd->vdev_child[c];
+		if (!vdev_raidz_expanding(vd))
+			continue;
+
+		vre = vd->vdev_tsd;
+		vre->vre_offset = MAX(spa->spa_uberblock.ub_raidz_reflow_info,
+		    (vd->vdev_children - 1) << vd->vdev_ashift);
+		vre->vre_synced = vre->vre_offset;
+	}
+}
+
+/*
+ * The reflow may only proceed while every child is present and up to
+ * date, since the copies have no redundancy of their own.
+ */
+static boolean_t
+vdev_raidz_reflow_ready(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_t *cvd;
+	uint64_t c;
+
+	if (spa->spa_freeze_txg != UINT64_MAX || !spa_writeable(spa))
+		return (B_FALSE);
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		cvd = vd->vdev_child[c];
+		if (!cvd->vdev_ops->vdev_op_leaf || !vdev_readable(cvd) ||
+		    !vdev_writeable(cvd) || !vdev_dtl_empty(cvd, DTL_MISSING))
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Copy the logical sectors [start, end) from the old layout to the new.
+ */
+static int
+vdev_raidz_reflow_copy(vdev_t *vd, uint64_t start, uint64_t end)
+{
+	spa_t *spa = vd->vdev_spa;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t size = 1ULL << ashift;
+	uint64_t pnew = vd->vdev_children;
+	uint64_t pold = pnew - 1;
+	uint64_t a = start >> ashift;
+	uint64_t z = end >> ashift;
+	uint64_t nr = MIN(z - a, pold);
+	uint64_t nw = MIN(z - a, pnew);
+	uint64_t i, l, first, count;
+	abd_t **rabd, **wabd;
+	zio_t *zio;
+	int error;
+
+	rabd = kmem_alloc(nr * sizeof (abd_t *), KM_SLEEP);
+	wabd = kmem_zalloc(nw * sizeof (abd_t *), KM_SLEEP);
+
+	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (i = 0; i < nr; i++) {
+		first = a + i;
+		count = (z - first + pold - 1) / pold;
+		rabd[i] = abd_alloc_linear(count << ashift, B_FALSE);
+		zio_nowait(zio_read_phys(zio, vd->vdev_child[first % pold],
+		    ((first / pold) << ashift) + VDEV_LABEL_START_SIZE,
+		    count << ashift, rabd[i], ZIO_CHECKSUM_OFF, NULL, NULL,
+		    ZIO_PRIORITY_SCRUB, ZIO_FLAG_CANFAIL, B_FALSE));
+	}
+	error = zio_wait(zio);
+
+	if (error == 0) {
+		for (i = 0; i < nw; i++) {
+			first = a + i;
+			count = (z - first + pnew - 1) / pnew;
+			wabd[i] = abd_alloc_linear(count << ashift, B_FALSE);
+		}
+
+		for (l = a; l < z; l++) {
+			abd_copy_off(wabd[(l - a) % pnew], rabd[(l - a) % pold],
+			    ((l - a) / pnew) << ashift,
+			    ((l - a) / pold) << ashift, size);
+		}
+
+		zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (i = 0; i < nw; i++) {
+			first = a + i;
+			count = (z - first + pnew - 1) / pnew;
+			zio_nowait(zio_write_phys(zio,
+			    vd->vdev_child[first % pnew],
+			    ((first / pnew) << ashift) + VDEV_LABEL_START_SIZE,
+			    count << ashift, wabd[i], ZIO_CHECKSUM_OFF, NULL,
+			    NULL, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL,
+			    B_FALSE));
+		}
+		error = zio_wait(zio);
+	}
+
+	for (i = 0; i < nr; i++)
+		abd_free(rabd[i]);
+	for (i = 0; i < nw; i++) {
+		if (wabd[i] != NULL)
+			abd_free(wabd[i]);
+	}
+	kmem_free(rabd, nr * sizeof (abd_t *));
+	kmem_free(wabd, nw * sizeof (abd_t *));
+
+	return (error);
+}
+
+static boolean_t
+vdev_raidz_reflow_busy(vdev_raidz_expand_t *vre)
+{
+	raidz_expand_io_t *rei;
+
+	for (rei = list_head(&vre->vre_inflight); rei != NULL;
+	    rei = list_next(&vre->vre_inflight, rei)) {
+		if ((rei->rei_start < vre->vre_copy_end &&
+		    rei->rei_end > vre->vre_copy_start) ||
+		    rei->rei_shadow < vre->vre_synced)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Reflow the next batch of the vdev, which lies within one metaslab.
+ * Returns ENOENT once the whole vdev is done, and ERESTART if the batch
+ * would overwrite the old copies of sectors above the durable offset.
+ */
+static int
+vdev_raidz_reflow_batch(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t n = vd->vdev_children - 1;
+	uint64_t offset, end, limit, s, q, r;
+	range_seg_t *rs, rsearch;
+	avl_index_t where;
+	list_t deferred;
+	raidz_deferred_t *rd;
+	metaslab_t *msp;
+	range_tree_t *rt;
+	kmutex_t lock;
+	int error = 0;
+
+	mutex_enter(&vre->vre_lock);
+	offset = vre->vre_offset;
+	s = vre->vre_synced >> ashift;
+	mutex_exit(&vre->vre_lock);
+
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	if (offset >= vd->vdev_ms_count << vd->vdev_ms_shift) {
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return (SET_ERROR(ENOENT));
+	}
+	if (!vdev_raidz_reflow_ready(vd)) {
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return (SET_ERROR(EBUSY));
+	}
+	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	/*
+	 * Sector l lands where the old layout keeps sector
+	 * (l / (n + 1)) * n + l % (n + 1), unless it goes to the new child.
+	 * The limit is the first sector landing on the old copy of a
+	 * sector which isn't durably reflowed yet.
+	 */
+	q = (s - 1) / n;
+	r = (s - 1) % n;
+	limit = (q * (n + 1) + r + 1 + (r == n - 1 ? 1 : 0)) << ashift;
+
+	end = MIN(msp->ms_start + msp->ms_size,
+	    offset + P2ALIGN(raidz_expand_max_copy_bytes, 1ULL << ashift));
+	end = MIN(end, limit);
+	if (end <= offset)
+		return (SET_ERROR(ERESTART));
+
+	/*
+	 * Hold off new I/O to the batch, and wait for the I/O already
+	 * using it, or writing old copies the batch may overwrite.
+	 */
+	mutex_enter(&vre->vre_lock);
+	vre->vre_copy_start = offset;
+	vre->vre_copy_end = end;
+	vre->vre_waiting = B_TRUE;
+	while (vdev_raidz_reflow_busy(vre))
+		cv_wait(&vre->vre_cv, &vre->vre_lock);
+	vre->vre_waiting = B_FALSE;
+	mutex_exit(&vre->vre_lock);
+
+	/*
+	 * Only the allocated parts of the batch are copied.
+	 */
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	rt = range_tree_create(NULL, NULL, &lock);
+
+	mutex_enter(&msp->ms_lock);
+	metaslab_load_wait(msp);
+	if (!msp->ms_loaded)
+		error = metaslab_load(msp);
+	if (error == 0) {
+		avl_tree_t *t = &msp->ms_tree->rt_root;
+
+		mutex_enter(&lock);
+		range_tree_add(rt, offset, end - offset);
+		rsearch.rs_start = offset;
+		rsearch.rs_end = offset + 1;
+		rs = avl_find(t, &rsearch, &where);
+		if (rs == NULL)
+			rs = avl_nearest(t, where, AVL_AFTER);
+		for (; rs != NULL && rs->rs_start < end; rs = AVL_NEXT(t, rs)) {
+			uint64_t lo = MAX(rs->rs_start, offset);
+			uint64_t hi = MIN(rs->rs_end, end);
+
+			range_tree_remove(rt, lo, hi - lo);
+		}
+		mutex_exit(&lock);
+	}
+	mutex_exit(&msp->ms_lock);
+
+	if (error == 0) {
+		spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+		if (!vdev_raidz_reflow_ready(vd))
+			error = SET_ERROR(EBUSY);
+
+		mutex_enter(&lock);
+		for (rs = avl_first(&rt->rt_root); rs != NULL && error == 0;
+		    rs = AVL_NEXT(&rt->rt_root, rs)) {
+			error = vdev_raidz_reflow_copy(vd, rs->rs_start,
+			    rs->rs_end);
+		}
+		mutex_exit(&lock);
+
+		if (error == 0) {
+			zio_t *zio = zio_root(spa, NULL, NULL, 0);
+			uint64_t c;
+
+			for (c = 0; c < vd->vdev_children; c++)
+				zio_flush(zio, vd->vdev_child[c]);
+			(void) zio_wait(zio);
+		}
+		spa_config_exit(spa, SCL_STATE, FTAG);
+	}
+
+	mutex_enter(&lock);
+	range_tree_vacate(rt, NULL, NULL);
+	mutex_exit(&lock);
+	range_tree_destroy(rt);
+	mutex_destroy(&lock);
+
+	/*
+	 * Let the I/O held off by the batch go, to the new layout if the
+	 * batch was copied.
+	 */
+	list_create(&deferred, sizeof (raidz_deferred_t),
+	    offsetof(raidz_deferred_t, rd_node));
+	mutex_enter(&vre->vre_lock);
+	if (error == 0)
+		vre->vre_offset = end;
+	vre->vre_copy_start = 0;
+	vre->vre_copy_end = 0;
+	list_move_tail(&deferred, &vre->vre_deferred);
+	mutex_exit(&vre->vre_lock);
+
+	while ((rd = list_remove_head(&deferred)) != NULL) {
+		vdev_raidz_io_start(rd->rd_zio);
+		kmem_free(rd, sizeof (raidz_deferred_t));
+	}
+	list_destroy(&deferred);
+
+	return (error);
+}
+
+static void
+vdev_raidz_expand_record_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = arg;
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	spa_t *spa = vd->vdev_spa;
+
+	mutex_enter(&vre->vre_lock);
+	vre->vre_pending = vre->vre_offset;
+	vre->vre_pending_txg = dmu_tx_get_txg(tx);
+	spa->spa_uberblock.ub_raidz_reflow_info = vre->vre_offset;
+	mutex_exit(&vre->vre_lock);
+}
+
+/*
+ * Have the next txg make the reflow offset durable.
+ */
+static void
+vdev_raidz_expand_record(vdev_t *vd)
+{
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	dsl_pool_t *dp = spa_get_dsl(vd->vdev_spa);
+	dmu_tx_t *tx;
+	uint64_t txg;
+
+	tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	txg = dmu_tx_get_txg(tx);
+	if (txg != vre->vre_record_txg) {
+		vre->vre_record_txg = txg;
+		dsl_sync_task_nowait(dp, vdev_raidz_expand_record_sync, vd,
+		    0, ZFS_SPACE_CHECK_NONE, tx);
+	}
+	dmu_tx_commit(tx);
+}
+
+static void
+vdev_raidz_expand_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = arg;
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	spa_t *spa = vd->vdev_spa;
+
+	mutex_enter(&vre->vre_lock);
+	vre->vre_reflowing = B_FALSE;
+	vre->vre_pending_txg = 0;
+	mutex_exit(&vre->vre_lock);
+
+	spa->spa_uberblock.ub_raidz_reflow_info = 0;
+	vdev_config_dirty(vd);
+
+	spa_history_log_internal(spa, "raidz expansion completed", tx,
+	    "vdev=%llu children=%llu", (u_longlong_t)vd->vdev_id,
+	    (u_longlong_t)vd->vdev_children);
+}
+
+/*
+ * The reflow is done, so the new child can add its space to the vdev.
+ */
+static void
+vdev_raidz_expand_complete(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dmu_tx_t *tx;
+	uint64_t txg;
+
+	tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	txg = dmu_tx_get_txg(tx);
+	dsl_sync_task_nowait(dp, vdev_raidz_expand_complete_sync, vd,
+	    0, ZFS_SPACE_CHECK_NONE, tx);
+	dmu_tx_commit(tx);
+	txg_wait_synced(dp, txg);
+
+	spa_vdev_state_enter(spa, SCL_NONE);
+	vd->vdev_expanding = B_TRUE;
+	vdev_reopen(vd);
+	vd->vdev_expanding = B_FALSE;
+	(void) spa_vdev_state_exit(spa, NULL, 0);
+
+	spa_async_request(spa, SPA_ASYNC_CONFIG_UPDATE);
+}
+
+static void
+vdev_raidz_expand_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	vdev_raidz_expand_t *vre = vd->vdev_tsd;
+	spa_t *spa = vd->vdev_spa;
+	int error;
+
+	mutex_enter(&vre->vre_lock);
+	while (!vre->vre_thread_exit) {
+		if (vre->vre_pending_txg != 0 &&
+		    spa_last_synced_txg(spa) >= vre->vre_pending_txg) {
+			vre->vre_synced = vre->vre_pending;
+			vre->vre_pending_txg = 0;
+		}
+		mutex_exit(&vre->vre_lock);
+
+		error = vdev_raidz_reflow_batch(vd);
+		if (error == 0) {
+			vdev_raidz_expand_record(vd);
+		} else if (error == ERESTART) {
+			txg_wait_synced(spa_get_dsl(spa), vre->vre_record_txg);
+		} else if (error == ENOENT) {
+			vdev_raidz_expand_complete(vd);
+			mutex_enter(&vre->vre_lock);
+			break;
+		}
+
+		mutex_enter(&vre->vre_lock);
+		if (error != 0 && error != ERESTART && !vre->vre_thread_exit) {
+			(void) cv_timedwait(&vre->vre_cv, &vre->vre_lock,
+			    ddi_get_lbolt() + SEC_TO_TICK(1));
+		}
+	}
+
+	vre->vre_thread = NULL;
+	cv_broadcast(&vre->vre_cv);
+	mutex_exit(&vre->vre_lock);
+
+	thread_exit();
+}
+
+/*
+ * Start the reflow threads of any expansions in progress.
+ */
+void
+vdev_raidz_expand_start(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_raidz_expand_t *vre;
+	vdev_t *vd;
+	uint64_t c;
+
+	if (!spa_writeable(spa))
+		return;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vd = rvd->vdev_child[c];
+		if (!vdev_raidz_expanding(vd))
+			continue;
+
+		vre = vd->vdev_tsd;
+		mutex_enter(&vre->vre_lock);
+		if (vre->vre_thread == NULL) {
+			vre->vre_thread_exit = B_FALSE;
+			vre->vre_thread = thread_create(NULL, 0,
+			    vdev_raidz_expand_thread, vd, 0, &p0, TS_RUN,
+			    minclsyspri);
+		}
+		mutex_exit(&vre->vre_lock);
+	}
+}
+
+void
+vdev_raidz_expand_stop(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_raidz_expand_t *vre;
+	uint64_t c;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vre = rvd->vdev_child[c]->vdev_tsd;
+		if (rvd->vdev_child[c]->vdev_ops != &vdev_raidz_ops ||
+		    vre == NULL)
+			continue;
+
+		mutex_enter(&vre->vre_lock);
+		vre->vre_thread_exit = B_TRUE;
+		cv_broadcast(&vre->vre_cv);
+		while (vre->vre_thread != NULL)
+			cv_wait(&vre->vre_cv, &vre->vre_lock);
+		mutex_exit(&vre->vre_lock);
+	}
+}
+
+
 static void
 vdev_raidz_state_change(vdev_t *vd, int faulted, int degraded)
 {
@@ -2321,3 +3761,9 @@ vdev_ops_t vdev_raidz_ops = {
 	VDEV_TYPE_RAIDZ,	/* name of this vdev type */
 	B_FALSE			/* not a leaf vdev */
 };
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(raidz_expand_max_copy_bytes, ulong, 0644);
+MODULE_PARM_DESC(raidz_expand_max_copy_bytes,
+	"Max amount of data copied by one raidz expansion batch");
+#endif
@@ -0,0 +1,1125 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/dmu.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab.h>
+#include <sys/metaslab_impl.h>
+#include <sys/txg.h>
+#include <sys/abd.h>
+#include <sys/zio.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/dsl_dir.h>
+#include <sys/space_map.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/vdev_removal.h>
+#include <sys/zfeature.h>
+#include <sys/fs/zfs.h>
+
+/*
+ * Removing a top-level vdev
+ *
+ * The allocated segments of the vdev are copied elsewhere in the pool by
+ * a thread, in offset order, one metaslab at a time.  Each copied segment
+ * gets an entry in the vdev's indirect mapping, which is synced in the
+ * same txg as the allocation of its copy.  Once everything is copied, the
+ * vdev is replaced in the namespace by an indirect vdev (see
+ * vdev_indirect.c) which keeps the mapping, so that block pointers never
+ * need to be rewritten.
+ *
+ * While the removal is in progress, the vdev is no longer allocated from
+ * and frees must be coordinated with the copying (see vdev_removal_free()):
+ * a segment freed while it is being copied is freed from the vdev, and
+ * from its copy once the copy's mapping entry has synced.  Since no frees
+ * reach the vdev once all of its data is mapped, its metaslabs quiesce
+ * and can be torn down.
+ *
+ * Only mirrors and plain disks can be removed, and only from pools whose
+ * top-level vdevs are all of this kind and share the same ashift, so that
+ * a segment copied to another vdev takes up exactly the same space.
+ */
+
+/*
+ * Maximum number of bytes copied by one batch of the removal thread.
+ */
+unsigned long zfs_remove_max_copy_bytes = 64 * 1024 * 1024;
+
+/*
+ * Maximum size of a segment, and so of one entry of the mapping.
+ */
+int zfs_remove_max_segment = SPA_MAXBLOCKSIZE;
+
+/*
+ * A segment is read from each child of the vdev separately, and each child
+ * of the destination gets the copy of one of them: a child which silently
+ * returned bad data only taints its own copies, which the reads can then
+ * tell apart (see vdev_indirect_io_done()).
+ */
+typedef struct vdev_copy_child {
+	abd_t		*vcc_abd;
+	int		vcc_error;
+} vdev_copy_child_t;
+
+typedef struct vdev_copy_seg {
+	uint64_t	vcs_offset;
+	uint64_t	vcs_size;
+	uint64_t	vcs_children;
+	vdev_copy_child_t *vcs_child;
+	list_node_t	vcs_node;
+} vdev_copy_seg_t;
+
+typedef struct vdev_copy_arg {
+	kmutex_t	vca_lock;
+	int		vca_error;
+} vdev_copy_arg_t;
+
+static void spa_vdev_remove_thread(void *arg);
+
+static spa_vdev_removal_t *
+spa_vdev_removal_create(vdev_t *vd)
+{
+	spa_vdev_removal_t *svr = kmem_zalloc(sizeof (*svr), KM_SLEEP);
+	int t;
+
+	mutex_init(&svr->svr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&svr->svr_cv, NULL, CV_DEFAULT, NULL);
+	svr->svr_vdev = vd;
+	svr->svr_allocd_segs = range_tree_create(NULL, NULL, &svr->svr_lock);
+	svr->svr_frees = range_tree_create(NULL, NULL, &svr->svr_lock);
+
+	for (t = 0; t < TXG_SIZE; t++) {
+		list_create(&svr->svr_new_segments[t],
+		    sizeof (vdev_indirect_mapping_entry_t),
+		    offsetof(vdev_indirect_mapping_entry_t, vime_node));
+		list_create(&svr->svr_unalloc[t],
+		    sizeof (vdev_indirect_mapping_entry_t),
+		    offsetof(vdev_indirect_mapping_entry_t, vime_node));
+	}
+
+	return (svr);
+}
+
+static void
+spa_vdev_removal_destroy(spa_vdev_removal_t *svr)
+{
+	vdev_indirect_mapping_entry_t *vime;
+	int t;
+
+	ASSERT3P(svr->svr_thread, ==, NULL);
+
+	mutex_enter(&svr->svr_lock);
+	range_tree_vacate(svr->svr_allocd_segs, NULL, NULL);
+	range_tree_vacate(svr->svr_frees, NULL, NULL);
+	mutex_exit(&svr->svr_lock);
+	range_tree_destroy(svr->svr_allocd_segs);
+	range_tree_destroy(svr->svr_frees);
+
+	for (t = 0; t < TXG_SIZE; t++) {
+		while ((vime = list_remove_head(&svr->svr_new_segments[t])) !=
+		    NULL)
+			kmem_free(vime, sizeof (*vime));
+		while ((vime = list_remove_head(&svr->svr_unalloc[t])) != NULL)
+			kmem_free(vime, sizeof (*vime));
+		list_destroy(&svr->svr_new_segments[t]);
+		list_destroy(&svr->svr_unalloc[t]);
+	}
+
+	cv_destroy(&svr->svr_cv);
+	mutex_destroy(&svr->svr_lock);
+	kmem_free(svr, sizeof (*svr));
+}
+
+static void
+spa_removing_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	VERIFY0(zap_update(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_REMOVING, sizeof (uint64_t),
+	    sizeof (spa_removing_phys_t) / sizeof (uint64_t),
+	    &spa->spa_removing_phys, tx));
+}
+
+static void
+spa_vdev_removal_free_copy(uint64_t split_offset, vdev_t *vd,
+    uint64_t offset, uint64_t size, void *arg)
+{
+	uint64_t txg = *(uint64_t *)arg;
+
+	if (vd == NULL) {
+		zfs_panic_recover("vdev removal: free of unmapped segment "
+		    "%llu:%llu", (u_longlong_t)offset, (u_longlong_t)size);
+		return;
+	}
+
+	metaslab_free_concrete(vd, offset, size, txg, B_FALSE);
+}
+
+/*
+ * Handle the free of a segment of the vdev being removed, in syncing
+ * context.  Returns B_FALSE if the vdev isn't being removed after all.
+ */
+boolean_t
+vdev_removal_free(vdev_t *vd, uint64_t offset, uint64_t size, uint64_t txg)
+{
+	spa_vdev_removal_t *svr = vd->vdev_spa->spa_vdev_removal;
+	uint64_t end = offset + size;
+	uint64_t synced, start;
+
+	if (svr == NULL || svr->svr_vdev != vd)
+		return (B_FALSE);
+
+	mutex_enter(&svr->svr_lock);
+	synced = vdev_indirect_mapping_max_offset(vd->vdev_indirect_mapping);
+
+	/*
+	 * Above the synced mapping, the vdev still holds the data.  The
+	 * part which isn't being copied yet just won't be, and the copy
+	 * of the part in flight is freed once its mapping has synced.
+	 */
+	if (end > synced) {
+		start = MAX(offset, synced);
+		metaslab_free_concrete(vd, start, end - start, txg, B_FALSE);
+
+		if (end > svr->svr_inflight_end) {
+			uint64_t s = MAX(start, svr->svr_inflight_end);
+
+			range_tree_clear(svr->svr_allocd_segs, s, end - s);
+		}
+		if (start < svr->svr_inflight_end) {
+			range_tree_add(svr->svr_frees, start,
+			    MIN(end, svr->svr_inflight_end) - start);
+		}
+		size = start - offset;
+	}
+
+	/*
+	 * Below it, the data only lives on at its copies.
+	 */
+	if (size != 0) {
+		vdev_indirect_remap(vd, offset, size,
+		    spa_vdev_removal_free_copy, &txg);
+	}
+	mutex_exit(&svr->svr_lock);
+
+	return (B_TRUE);
+}
+
+static void
+spa_vdev_copy_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_vdev_removal_t *svr = arg;
+	vdev_t *vd = svr->svr_vdev;
+	spa_t *spa = vd->vdev_spa;
+	vdev_indirect_mapping_t *vim = vd->vdev_indirect_mapping;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	vdev_indirect_mapping_entry_t *vime;
+	uint64_t synced;
+	range_seg_t *rs;
+
+	mutex_enter(&svr->svr_lock);
+	while ((vime = list_remove_head(&svr->svr_unalloc[txg & TXG_MASK])) !=
+	    NULL) {
+		dva_t *dva = &vime->vime_mapping.vimep_dst;
+
+		metaslab_free_concrete(vdev_lookup_top(spa, DVA_GET_VDEV(dva)),
+		    DVA_GET_OFFSET(dva), DVA_GET_ASIZE(dva), txg, B_FALSE);
+		kmem_free(vime, sizeof (*vime));
+	}
+
+	vdev_indirect_mapping_add_entries(vim,
+	    &svr->svr_new_segments[txg & TXG_MASK], tx);
+	spa->spa_removing_phys.sr_copied += svr->svr_bytes_done[txg & TXG_MASK];
+	svr->svr_bytes_done[txg & TXG_MASK] = 0;
+
+	/*
+	 * Free the copies of the segments freed while they were copied.
+	 */
+	synced = vdev_indirect_mapping_max_offset(vim);
+	while ((rs = avl_first(&svr->svr_frees->rt_root)) != NULL &&
+	    rs->rs_start < synced) {
+		uint64_t start = rs->rs_start;
+		uint64_t size = MIN(rs->rs_end, synced) - start;
+
+		range_tree_remove(svr->svr_frees, start, size);
+		vdev_indirect_remap(vd, start, size,
+		    spa_vdev_removal_free_copy, &txg);
+	}
+	mutex_exit(&svr->svr_lock);
+
+	spa_removing_sync(spa, tx);
+}
+
+static void
+spa_vdev_copy_read_done(zio_t *zio)
+{
+	vdev_copy_child_t *vcc = zio->io_private;
+
+	vcc->vcc_error = zio->io_error;
+}
+
+static void
+spa_vdev_copy_done(zio_t *zio)
+{
+	vdev_copy_arg_t *vca = zio->io_private;
+
+	mutex_enter(&vca->vca_lock);
+	vca->vca_error = zio_worst_error(vca->vca_error, zio->io_error);
+	mutex_exit(&vca->vca_lock);
+
+	abd_put(zio->io_abd);
+}
+
+/*
+ * Return the copy of the segment read from child c of the vdev, or from
+ * the next one if that failed.  Child c of a destination mirror thus gets
+ * its data from child c of the removed one.
+ */
+static vdev_copy_child_t *
+spa_vdev_copy_source(vdev_copy_seg_t *vcs, uint64_t c)
+{
+	uint64_t i;
+
+	for (i = 0; i < vcs->vcs_children; i++) {
+		vdev_copy_child_t *vcc =
+		    &vcs->vcs_child[(c + i) % vcs->vcs_children];
+
+		if (vcc->vcc_error == 0)
+			return (vcc);
+	}
+
+	return (NULL);
+}
+
+static void
+spa_vdev_remove_clear_cb(void *arg, uint64_t start, uint64_t size)
+{
+	range_tree_clear(arg, start, size);
+}
+
+/*
+ * Gather the allocated segments of the metaslab which holds the first
+ * offset not yet copied.  Returns ENOENT once the whole vdev is done.
+ */
+static int
+spa_vdev_remove_load_segs(spa_vdev_removal_t *svr)
+{
+	vdev_t *vd = svr->svr_vdev;
+	spa_t *spa = vd->vdev_spa;
+	uint64_t offset, end;
+	metaslab_t *msp;
+	int error = 0;
+	int t;
+
+	mutex_enter(&svr->svr_lock);
+	offset = svr->svr_inflight_end;
+	mutex_exit(&svr->svr_lock);
+
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	if ((offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count) {
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		return (SET_ERROR(ENOENT));
+	}
+	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	end = msp->ms_start + msp->ms_size;
+
+	mutex_enter(&msp->ms_lock);
+	metaslab_load_wait(msp);
+	if (!msp->ms_loaded)
+		error = metaslab_load(msp);
+	mutex_exit(&msp->ms_lock);
+	if (error != 0)
+		return (error);
+
+	/*
+	 * The metaslab may have been unloaded in the meantime, in which
+	 * case the caller just tries again.
+	 */
+	mutex_enter(&svr->svr_lock);
+	mutex_enter(&msp->ms_lock);
+	if (msp->ms_loaded) {
+		range_tree_t *allocd = svr->svr_allocd_segs;
+
+		ASSERT0(range_tree_space(allocd));
+		range_tree_add(allocd, offset, end - offset);
+		range_tree_walk(msp->ms_tree, spa_vdev_remove_clear_cb,
+		    allocd);
+		range_tree_walk(msp->ms_freeingtree, spa_vdev_remove_clear_cb,
+		    allocd);
+		range_tree_walk(msp->ms_freedtree, spa_vdev_remove_clear_cb,
+		    allocd);
+		for (t = 0; t < TXG_DEFER_SIZE; t++) {
+			range_tree_walk(msp->ms_defertree[t],
+			    spa_vdev_remove_clear_cb, allocd);
+		}
+		range_tree_walk(msp->ms_trim, spa_vdev_remove_clear_cb,
+		    allocd);
+		range_tree_walk(msp->ms_trimming, spa_vdev_remove_clear_cb,
+		    allocd);
+
+		/*
+		 * Nothing else is allocated from this metaslab, so the rest
+		 * of it can be skipped as a whole.
+		 */
+		if (range_tree_space(allocd) == 0)
+			svr->svr_inflight_end = end;
+	}
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&svr->svr_lock);
+
+	return (0);
+}
+
+/*
+ * Allocate a copy of the part of the segment starting at *offp, or of as
+ * much of it as fits, and write it out.  The mapping entry is added to
+ * the list even on failure, so that the copy gets freed.
+ */
+static int
+spa_vdev_copy_segment(vdev_t *vd, vdev_copy_seg_t *vcs, uint64_t *offp,
+    uint64_t txg, zio_t *zio, vdev_copy_arg_t *vca, list_t *entries)
+{
+	spa_t *spa = vd->vdev_spa;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t minseg = MAX(SPA_MINBLOCKSIZE, 1ULL << ashift);
+	uint64_t len = vcs->vcs_offset + vcs->vcs_size - *offp;
+	vdev_indirect_mapping_entry_t *vime;
+	vdev_t *dvd;
+	dva_t *dva;
+	zio_alloc_list_t zal;
+	blkptr_t bp;
+	uint64_t c;
+	int error;
+
+	for (;;) {
+		bzero(&bp, sizeof (bp));
+		metaslab_trace_init(&zal);
+		error = metaslab_alloc(spa, vd->vdev_mg->mg_class, len, &bp, 1,
+		    txg, NULL, 0, &zal, NULL);
+		metaslab_trace_fini(&zal);
+		if (error != ENOSPC || len <= minseg)
+			break;
+		len = P2ROUNDUP(len / 2, 1ULL << ashift);
+	}
+	if (error != 0)
+		return (error);
+
+	dva = &bp.blk_dva[0];
+	vime = kmem_zalloc(sizeof (*vime), KM_SLEEP);
+	vime->vime_mapping.vimep_src = *offp;
+	vime->vime_mapping.vimep_dst = *dva;
+	list_insert_tail(entries, vime);
+
+	if (DVA_GET_ASIZE(dva) != len)
+		return (SET_ERROR(EINVAL));
+
+	/*
+	 * A child which can't be written to now misses the copy for good,
+	 * as resilvering goes by birth txg; scrubs repair it.
+	 */
+	dvd = vdev_lookup_top(spa, DVA_GET_VDEV(dva));
+	for (c = 0; c < MAX(dvd->vdev_children, 1); c++) {
+		vdev_t *cvd = dvd->vdev_children != 0 ?
+		    dvd->vdev_child[c] : dvd;
+		vdev_copy_child_t *vcc = spa_vdev_copy_source(vcs, c);
+
+		if (!vdev_writeable(cvd))
+			continue;
+
+		zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
+		    DVA_GET_OFFSET(dva), abd_get_offset(vcc->vcc_abd,
+		    *offp - vcs->vcs_offset), len, ZIO_TYPE_WRITE,
+		    ZIO_PRIORITY_ASYNC_WRITE, 0, spa_vdev_copy_done, vca));
+	}
+	*offp += len;
+
+	return (0);
+}
+
+/*
+ * Copy the next batch of segments.  The copies are allocated, written
+ * and mapped in a single txg, so that they are either all durable along
+ * with their mapping entries, or not at all.  If the batch fails, its
+ * segments are put back to be tried again.
+ */
+static int
+spa_vdev_remove_batch(spa_vdev_removal_t *svr)
+{
+	vdev_t *vd = svr->svr_vdev;
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t maxseg = MAX(P2ALIGN((uint64_t)zfs_remove_max_segment,
+	    1ULL << ashift), 1ULL << ashift);
+	uint64_t width = MAX(vd->vdev_children, 1);
+	uint64_t start, bytes = 0, txg, c;
+	vdev_copy_seg_t *vcs;
+	vdev_copy_arg_t vca;
+	list_t segs, entries;
+	range_seg_t *rs;
+	dmu_tx_t *tx;
+	zio_t *zio;
+	int error;
+
+	mutex_enter(&svr->svr_lock);
+	if (range_tree_space(svr->svr_allocd_segs) == 0) {
+		mutex_exit(&svr->svr_lock);
+		return (spa_vdev_remove_load_segs(svr));
+	}
+
+	list_create(&segs, sizeof (vdev_copy_seg_t),
+	    offsetof(vdev_copy_seg_t, vcs_node));
+	start = svr->svr_inflight_end;
+	while (bytes * width < zfs_remove_max_copy_bytes &&
+	    (rs = avl_first(&svr->svr_allocd_segs->rt_root)) != NULL) {
+		vcs = kmem_zalloc(sizeof (*vcs), KM_SLEEP);
+		vcs->vcs_offset = rs->rs_start;
+		vcs->vcs_size = MIN(rs->rs_end - rs->rs_start, maxseg);
+		range_tree_remove(svr->svr_allocd_segs, vcs->vcs_offset,
+		    vcs->vcs_size);
+		svr->svr_inflight_end = vcs->vcs_offset + vcs->vcs_size;
+		bytes += vcs->vcs_size;
+		list_insert_tail(&segs, vcs);
+	}
+	mutex_exit(&svr->svr_lock);
+
+	mutex_init(&vca.vca_lock, NULL, MUTEX_DEFAULT, NULL);
+	vca.vca_error = 0;
+	list_create(&entries, sizeof (vdev_indirect_mapping_entry_t),
+	    offsetof(vdev_indirect_mapping_entry_t, vime_node));
+
+	/*
+	 * Read the batch from every child which can be read from.  Each
+	 * segment must be read from at least one of them.
+	 */
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (vcs = list_head(&segs); vcs != NULL;
+	    vcs = list_next(&segs, vcs)) {
+		vcs->vcs_children = MAX(vd->vdev_children, 1);
+		vcs->vcs_child = kmem_zalloc(vcs->vcs_children *
+		    sizeof (vdev_copy_child_t), KM_SLEEP);
+		for (c = 0; c < vcs->vcs_children; c++) {
+			vdev_copy_child_t *vcc = &vcs->vcs_child[c];
+			vdev_t *cvd = vd->vdev_children != 0 ?
+			    vd->vdev_child[c] : vd;
+
+			if (!vdev_readable(cvd)) {
+				vcc->vcc_error = SET_ERROR(ENXIO);
+				continue;
+			}
+			vcc->vcc_abd = abd_alloc_for_io(vcs->vcs_size,
+			    B_FALSE);
+			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
+			    vcs->vcs_offset, vcc->vcc_abd, vcs->vcs_size,
+			    ZIO_TYPE_READ, ZIO_PRIORITY_SCRUB, 0,
+			    spa_vdev_copy_read_done, vcc));
+		}
+	}
+	(void) zio_wait(zio);
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	error = 0;
+	for (vcs = list_head(&segs); vcs != NULL && error == 0;
+	    vcs = list_next(&segs, vcs)) {
+		if (spa_vdev_copy_source(vcs, 0) == NULL)
+			error = SET_ERROR(EIO);
+	}
+
+	tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	txg = dmu_tx_get_txg(tx);
+
+	/*
+	 * Allocate the copies, splitting segments which don't fit in the
+	 * free space left, and write them out.
+	 */
+	if (error == 0) {
+		spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+		zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (vcs = list_head(&segs); vcs != NULL && error == 0;
+		    vcs = list_next(&segs, vcs)) {
+			uint64_t off = vcs->vcs_offset;
+
+			while (off < vcs->vcs_offset + vcs->vcs_size &&
+			    error == 0) {
+				error = spa_vdev_copy_segment(vd, vcs, &off,
+				    txg, zio, &vca, &entries);
+			}
+		}
+		(void) zio_wait(zio);
+		spa_config_exit(spa, SCL_STATE, FTAG);
+		if (error == 0)
+			error = vca.vca_error;
+	}
+
+	mutex_enter(&svr->svr_lock);
+	if (list_is_empty(&svr->svr_new_segments[txg & TXG_MASK]) &&
+	    list_is_empty(&svr->svr_unalloc[txg & TXG_MASK]) &&
+	    !list_is_empty(&entries)) {
+		dsl_sync_task_nowait(dp, spa_vdev_copy_sync, svr,
+		    0, ZFS_SPACE_CHECK_NONE, tx);
+	}
+	if (error == 0) {
+		list_move_tail(&svr->svr_new_segments[txg & TXG_MASK],
+		    &entries);
+		svr->svr_bytes_done[txg & TXG_MASK] += bytes;
+	} else {
+		/*
+		 * Put the batch back, except for what was freed meanwhile.
+		 * Its copies are freed once the txg they were allocated in
+		 * syncs.
+		 */
+		list_move_tail(&svr->svr_unalloc[txg & TXG_MASK], &entries);
+		for (vcs = list_head(&segs); vcs != NULL;
+		    vcs = list_next(&segs, vcs)) {
+			range_tree_add(svr->svr_allocd_segs, vcs->vcs_offset,
+			    vcs->vcs_size);
+		}
+		for (rs = avl_first(&svr->svr_frees->rt_root); rs != NULL; ) {
+			range_seg_t *next = AVL_NEXT(&svr->svr_frees->rt_root,
+			    rs);
+
+			if (rs->rs_end > start) {
+				uint64_t s = MAX(rs->rs_start, start);
+				uint64_t size = rs->rs_end - s;
+
+				range_tree_remove(svr->svr_frees, s, size);
+				range_tree_clear(svr->svr_allocd_segs, s, size);
+			}
+			rs = next;
+		}
+		svr->svr_inflight_end = start;
+	}
+	mutex_exit(&svr->svr_lock);
+	dmu_tx_commit(tx);
+
+	while ((vcs = list_remove_head(&segs)) != NULL) {
+		for (c = 0; c < vcs->vcs_children; c++) {
+			if (vcs->vcs_child[c].vcc_abd != NULL)
+				abd_free(vcs->vcs_child[c].vcc_abd);
+		}
+		kmem_free(vcs->vcs_child,
+		    vcs->vcs_children * sizeof (vdev_copy_child_t));
+		kmem_free(vcs, sizeof (*vcs));
+	}
+	list_destroy(&segs);
+	list_destroy(&entries);
+	mutex_destroy(&vca.vca_lock);
+
+	return (error);
+}
+
+static void
+spa_vdev_remove_thread(void *arg)
+{
+	spa_t *spa = arg;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	boolean_t done = B_FALSE;
+	int error;
+
+	mutex_enter(&svr->svr_lock);
+	while (!svr->svr_thread_exit) {
+		mutex_exit(&svr->svr_lock);
+
+		error = spa_vdev_remove_batch(svr);
+
+		mutex_enter(&svr->svr_lock);
+		if (error == ENOENT) {
+			done = B_TRUE;
+			break;
+		}
+		if (error != 0 && !svr->svr_thread_exit) {
+			(void) cv_timedwait(&svr->svr_cv, &svr->svr_lock,
+			    ddi_get_lbolt() + SEC_TO_TICK(1));
+		}
+	}
+	mutex_exit(&svr->svr_lock);
+
+	if (done)
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+	mutex_enter(&svr->svr_lock);
+	svr->svr_thread = NULL;
+	cv_broadcast(&svr->svr_cv);
+	mutex_exit(&svr->svr_lock);
+
+	/*
+	 * Once the whole mapping has synced, the vdev can be swapped for
+	 * an indirect one.
+	 */
+	if (done)
+		spa_async_request(spa, SPA_ASYNC_REMOVE_DONE);
+
+	thread_exit();
+}
+
+static void
+vdev_remove_initiate_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	spa_removing_phys_t *srp = &spa->spa_removing_phys;
+	spa_vdev_removal_t *svr;
+	uint64_t c;
+
+	ASSERT3P(spa->spa_vdev_removal, ==, NULL);
+	ASSERT0(vd->vdev_im_object);
+
+	/*
+	 * The mappings are opened before anything else is read from the
+	 * MOS, so they must not depend on one another: move those of the
+	 * vdevs removed earlier off this one.  New allocations already
+	 * avoid it.
+	 */
+	for (c = 0; c < spa->spa_root_vdev->vdev_children; c++) {
+		vdev_t *tvd = spa->spa_root_vdev->vdev_child[c];
+
+		if (tvd->vdev_indirect_mapping != NULL)
+			vdev_indirect_mapping_rewrite(
+			    tvd->vdev_indirect_mapping, tx);
+	}
+
+	spa_feature_incr(spa, SPA_FEATURE_DEVICE_REMOVAL, tx);
+	vd->vdev_im_object = vdev_indirect_mapping_alloc(mos, tx);
+	vd->vdev_indirect_mapping = vdev_indirect_mapping_open(mos,
+	    vd->vdev_im_object);
+	vdev_config_dirty(vd);
+
+	bzero(srp, sizeof (*srp));
+	srp->sr_state = DSS_SCANNING;
+	srp->sr_removing_vdev = vd->vdev_id;
+	srp->sr_start_time = gethrestime_sec();
+	srp->sr_to_copy = vd->vdev_stat.vs_alloc;
+	spa_removing_sync(spa, tx);
+
+	svr = spa_vdev_removal_create(vd);
+	spa->spa_vdev_removal = svr;
+	spa_update_dspace(spa);
+	svr->svr_thread = thread_create(NULL, 0, spa_vdev_remove_thread, spa,
+	    0, &p0, TS_RUN, minclsyspri);
+
+	spa_history_log_internal(spa, "vdev remove started", tx,
+	    "%s vdev %llu %s", spa_name(spa), (u_longlong_t)vd->vdev_id,
+	    (vd->vdev_path != NULL) ? vd->vdev_path : "-");
+}
+
+static int
+spa_vdev_remove_top_check(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	metaslab_class_t *mc = vd->vdev_mg->mg_class;
+	uint64_t available = 0;
+	boolean_t others = B_FALSE;
+	uint64_t c;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REMOVAL))
+		return (SET_ERROR(ENOTSUP));
+
+	if (spa->spa_vdev_removal != NULL || vd->vdev_removing)
+		return (SET_ERROR(EBUSY));
+
+	if (vd->vdev_ops != &vdev_mirror_ops && !vd->vdev_ops->vdev_op_leaf)
+		return (SET_ERROR(EINVAL));
+
+	/*
+	 * Every child must be there to read from, and hold all the data.
+	 */
+	if (vd->vdev_state != VDEV_STATE_HEALTHY ||
+	    !vdev_dtl_empty(vd, DTL_MISSING))
+		return (SET_ERROR(EBUSY));
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *cvd = rvd->vdev_child[c];
+
+		if (cvd == vd || cvd->vdev_ishole || cvd->vdev_islog ||
+		    cvd->vdev_ops == &vdev_indirect_ops)
+			continue;
+
+		if (cvd->vdev_ops == &vdev_raidz_ops ||
+		    cvd->vdev_ops == &vdev_draid_ops ||
+		    cvd->vdev_ashift != vd->vdev_ashift)
+			return (SET_ERROR(EINVAL));
+
+		if (cvd->vdev_mg->mg_class == mc ||
+		    cvd->vdev_mg->mg_class == spa_normal_class(spa)) {
+			others = B_TRUE;
+			available += cvd->vdev_stat.vs_space -
+			    cvd->vdev_stat.vs_alloc;
+		}
+	}
+
+	if (!others)
+		return (SET_ERROR(EINVAL));
+	if (available < vd->vdev_stat.vs_alloc)
+		return (SET_ERROR(ENOSPC));
+
+	/*
+	 * The vdev's space stops counting towards the pool's as soon as the
+	 * removal starts, so what the DSL has handed out must still fit,
+	 * with the slop space to spare for syncing.
+	 */
+	if (dsl_dir_space_available(spa->spa_dsl_pool->dp_root_dir, NULL, 0,
+	    B_TRUE) < vd->vdev_stat.vs_dspace + spa_get_slop_space(spa))
+		return (SET_ERROR(ENOSPC));
+
+	return (0);
+}
+
+/*
+ * Start removing the top-level vdev vd.  The caller holds the vdev
+ * namespace lock through spa_vdev_enter(), and *txg is updated when the
+ * config lock has been dropped and taken again.
+ */
+int
+spa_vdev_remove_top(vdev_t *vd, uint64_t *txg)
+{
+	spa_t *spa = vd->vdev_spa;
+	metaslab_group_t *mg = vd->vdev_mg;
+	dmu_tx_t *tx;
+	int error;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
+	ASSERT(vd == vd->vdev_top);
+
+	if ((error = spa_vdev_remove_top_check(vd)) != 0)
+		return (error);
+
+	/*
+	 * Stop allocating from the vdev, and get rid of the intent log
+	 * blocks which may be on it: they can be written to at any time,
+	 * and so can't be copied.
+	 */
+	metaslab_group_passivate(mg);
+	spa_vdev_config_exit(spa, NULL, *txg + TXG_CONCURRENT_STATES, 0,
+	    FTAG);
+	error = spa_offline_log(spa);
+	*txg = spa_vdev_config_enter(spa);
+
+	/*
+	 * Things may have changed while the config lock was dropped.
+	 */
+	if (error == 0)
+		error = spa_vdev_remove_top_check(vd);
+	if (error != 0) {
+		metaslab_group_activate(mg);
+		return (error);
+	}
+
+	vd->vdev_removing = B_TRUE;
+	vdev_dirty_leaves(vd, VDD_DTL, *txg);
+	vdev_config_dirty(vd);
+
+	tx = dmu_tx_create_assigned(spa->spa_dsl_pool, *txg);
+	dsl_sync_task_nowait(spa->spa_dsl_pool, vdev_remove_initiate_sync, vd,
+	    0, ZFS_SPACE_CHECK_NONE, tx);
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+static void
+vdev_remove_leaf_zaps(vdev_t *vd, dmu_tx_t *tx)
+{
+	uint64_t c;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_remove_leaf_zaps(vd->vdev_child[c], tx);
+
+	if (vd->vdev_leaf_zap != 0) {
+		vdev_destroy_unlink_zap(vd, vd->vdev_leaf_zap, tx);
+		vd->vdev_leaf_zap = 0;
+	}
+}
+
+/*
+ * Free the space maps and ZAPs of the removed vdev, which has already
+ * been detached from the namespace.
+ */
+static void
+vdev_remove_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_vdev_removal_t *svr = arg;
+	vdev_t *vd = svr->svr_vdev;
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t m, object;
+
+	if (vd->vdev_ms_array != 0) {
+		for (m = 0; m < vd->vdev_asize >> vd->vdev_ms_shift; m++) {
+			VERIFY0(dmu_read(mos, vd->vdev_ms_array,
+			    m * sizeof (uint64_t), sizeof (uint64_t), &object,
+			    DMU_READ_PREFETCH));
+			if (object != 0)
+				space_map_free_obj(mos, object, tx);
+		}
+		VERIFY0(dmu_object_free(mos, vd->vdev_ms_array, tx));
+		vd->vdev_ms_array = 0;
+	}
+
+	if (vd->vdev_top_zap != 0) {
+		if (zap_lookup(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+		    &object) == 0)
+			VERIFY0(dmu_object_free(mos, object, tx));
+		vdev_destroy_unlink_zap(vd, vd->vdev_top_zap, tx);
+		vd->vdev_top_zap = 0;
+	}
+	vdev_remove_leaf_zaps(vd, tx);
+
+	spa->spa_removing_phys.sr_state = DSS_FINISHED;
+	spa->spa_removing_phys.sr_end_time = gethrestime_sec();
+	spa_removing_sync(spa, tx);
+
+	spa_history_log_internal(spa, "vdev remove completed", tx,
+	    "%s vdev %llu", spa_name(spa), (u_longlong_t)vd->vdev_id);
+
+	spa_vdev_removal_destroy(svr);
+}
+
+/*
+ * The vdev can only be torn down once its metaslabs and DTLs have
+ * nothing left to sync.
+ */
+static boolean_t
+vdev_remove_busy(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	int t;
+
+	for (t = 0; t < TXG_SIZE; t++) {
+		if (!txg_list_empty(&vd->vdev_ms_list, t) ||
+		    !txg_list_empty(&vd->vdev_dtl_list, t) ||
+		    txg_list_member(&spa->spa_vdev_txg_list, vd, t))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Called by the async thread once the removal thread has copied and
+ * mapped all of the vdev: replace the vdev by an indirect vdev which
+ * keeps its mapping.
+ */
+void
+spa_vdev_remove_complete(spa_t *spa)
+{
+	spa_vdev_removal_t *svr;
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *vd, *ivd;
+	dmu_tx_t *tx;
+	uint64_t txg;
+
+	txg = spa_vdev_enter(spa);
+	svr = spa->spa_vdev_removal;
+	if (svr == NULL || svr->svr_thread != NULL ||
+	    svr->svr_inflight_end < (svr->svr_vdev->vdev_ms_count <<
+	    svr->svr_vdev->vdev_ms_shift)) {
+		(void) spa_vdev_exit(spa, NULL, txg, 0);
+		return;
+	}
+	vd = svr->svr_vdev;
+
+	/*
+	 * Wait for the last frees to make it out of the vdev's metaslabs.
+	 */
+	while (vdev_remove_busy(vd)) {
+		spa_vdev_config_exit(spa, NULL, txg, 0, FTAG);
+		txg = spa_vdev_config_enter(spa);
+	}
+
+	ASSERT0(range_tree_space(svr->svr_frees));
+	ASSERT3U(vdev_indirect_mapping_max_offset(vd->vdev_indirect_mapping),
+	    <=, vd->vdev_ms_count << vd->vdev_ms_shift);
+
+	vdev_metaslab_fini(vd);
+	metaslab_group_destroy(vd->vdev_mg);
+	vd->vdev_mg = NULL;
+	ASSERT0(vd->vdev_stat.vs_space);
+	ASSERT0(vd->vdev_stat.vs_alloc);
+
+	ivd = vdev_alloc_common(spa, vd->vdev_id, vd->vdev_guid,
+	    &vdev_indirect_ops);
+	ivd->vdev_asize = vd->vdev_asize;
+	ivd->vdev_ashift = vd->vdev_ashift;
+	ivd->vdev_isspecial = vd->vdev_isspecial;
+	ivd->vdev_im_object = vd->vdev_im_object;
+	ivd->vdev_indirect_mapping = vd->vdev_indirect_mapping;
+	vd->vdev_im_object = 0;
+	vd->vdev_indirect_mapping = NULL;
+	ivd->vdev_mg = metaslab_group_create(vd->vdev_isspecial ?
+	    spa_special_class(spa) : spa_normal_class(spa), ivd);
+
+	if (list_link_active(&vd->vdev_state_dirty_node))
+		vdev_state_clean(vd);
+	if (list_link_active(&vd->vdev_config_dirty_node))
+		vdev_config_clean(vd);
+
+	vdev_remove_child(rvd, vd);
+	vdev_add_child(rvd, ivd);
+	(void) vdev_open(ivd);
+	vdev_config_dirty(rvd);
+
+	spa->spa_vdev_removal = NULL;
+	tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+	dsl_sync_task_nowait(spa->spa_dsl_pool, vdev_remove_complete_sync, svr,
+	    0, ZFS_SPACE_CHECK_NONE, tx);
+	dmu_tx_commit(tx);
+
+	/*
+	 * Only wipe the labels once the config without the vdev is synced.
+	 */
+	spa_vdev_config_exit(spa, NULL, txg, 0, FTAG);
+	txg = spa_vdev_config_enter(spa);
+	(void) vdev_label_init(vd, 0, VDEV_LABEL_REMOVE);
+	spa_event_notify(spa, vd, ESC_ZFS_VDEV_REMOVE_DEV);
+	(void) spa_vdev_exit(spa, vd, txg, 0);
+
+	spa_async_request(spa, SPA_ASYNC_CONFIG_UPDATE);
+}
+
+int
+spa_removal_get_stats(spa_t *spa, pool_removal_stat_t *prs)
+{
+	spa_removing_phys_t *srp = &spa->spa_removing_phys;
+
+	if (srp->sr_state == DSS_NONE)
+		return (SET_ERROR(ENOENT));
+
+	bzero(prs, sizeof (*prs));
+	prs->prs_state = srp->sr_state;
+	prs->prs_removing_vdev = srp->sr_removing_vdev;
+	prs->prs_start_time = srp->sr_start_time;
+	prs->prs_end_time = srp->sr_end_time;
+	prs->prs_to_copy = srp->sr_to_copy;
+	prs->prs_copied = srp->sr_copied;
+
+	return (0);
+}
+
+/*
+ * Load the state of the last removal, and set up the in-core state of
+ * the one in progress if any.
+ */
+int
+spa_vdev_removal_load(spa_t *spa)
+{
+	spa_removing_phys_t *srp = &spa->spa_removing_phys;
+	spa_vdev_removal_t *svr;
+	vdev_t *vd;
+	int error;
+
+	ASSERT3P(spa->spa_vdev_removal, ==, NULL);
+
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_REMOVING, sizeof (uint64_t),
+	    sizeof (spa_removing_phys_t) / sizeof (uint64_t), srp);
+	if (error == ENOENT) {
+		bzero(srp, sizeof (*srp));
+		srp->sr_state = DSS_NONE;
+		return (0);
+	} else if (error != 0) {
+		return (error);
+	}
+
+	if (srp->sr_state != DSS_SCANNING)
+		return (0);
+
+	vd = vdev_lookup_top(spa, srp->sr_removing_vdev);
+	if (vd == NULL || !vd->vdev_removing ||
+	    vd->vdev_indirect_mapping == NULL)
+		return (SET_ERROR(EINVAL));
+
+	svr = spa_vdev_removal_create(vd);
+	svr->svr_inflight_end =
+	    vdev_indirect_mapping_max_offset(vd->vdev_indirect_mapping);
+	spa->spa_vdev_removal = svr;
+
+	return (0);
+}
+
+/*
+ * Start the removal thread of the removal in progress, if any.
+ */
+void
+spa_vdev_removal_resume(spa_t *spa)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+
+	if (svr == NULL || !spa_writeable(spa))
+		return;
+
+	mutex_enter(&svr->svr_lock);
+	if (svr->svr_thread == NULL) {
+		svr->svr_thread_exit = B_FALSE;
+		svr->svr_thread = thread_create(NULL, 0,
+		    spa_vdev_remove_thread, spa, 0, &p0, TS_RUN, minclsyspri);
+	}
+	mutex_exit(&svr->svr_lock);
+}
+
+void
+spa_vdev_removal_stop(spa_t *spa)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+
+	if (svr == NULL)
+		return;
+
+	mutex_enter(&svr->svr_lock);
+	svr->svr_thread_exit = B_TRUE;
+	cv_broadcast(&svr->svr_cv);
+	while (svr->svr_thread != NULL)
+		cv_wait(&svr->svr_cv, &svr->svr_lock);
+	mutex_exit(&svr->svr_lock);
+}
+
+/*
+ * Tear down the in-core state once nothing is synced anymore.
+ */
+void
+spa_vdev_removal_unload(spa_t *spa)
+{
+	if (spa->spa_vdev_removal != NULL) {
+		spa_vdev_removal_destroy(spa->spa_vdev_removal);
+		spa->spa_vdev_removal = NULL;
+	}
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_remove_max_copy_bytes, ulong, 0644);
+MODULE_PARM_DESC(zfs_remove_max_copy_bytes,
+	"Max bytes copied by one batch of a vdev removal");
+
+module_param(zfs_remove_max_segment, int, 0644);
+MODULE_PARM_DESC(zfs_remove_max_segment,
+	"Largest contiguous segment copied by a vdev removal");
+#endif
@@ -504,7 +504,14 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 
 	slogging = spa_has_slogs(zilog->zl_spa) &&
 	    (zilog->zl_logbias == ZFS_LOGBIAS_LATENCY);
-	if (resid > immediate_write_sz && !slogging && resid <= zp->z_blksz)
+	/*
+	 * Log records are not encrypted, so the data of a write to an
+	 * encrypted dataset always reaches the log through dmu_sync().
+	 */
+	if (zilog->zl_os->os_encrypted)
+		write_state = WR_INDIRECT;
+	else if (resid > immediate_write_sz && !slogging &&
+	    resid <= zp->z_blksz)
 		write_state = WR_INDIRECT;
 	else if (ioflag & (FSYNC | FDSYNC))
 		write_state = WR_COPIED;
@@ -525,6 +532,8 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 		 */
 		if (write_state != WR_INDIRECT && resid > ZIL_MAX_LOG_DATA)
 			len = SPA_OLD_MAXBLOCKSIZE >> 1;
+		else if (write_state == WR_INDIRECT && resid > zp->z_blksz)
+			len = MIN(resid, zp->z_blksz - (off % zp->z_blksz));
 		else
 			len = resid;
 
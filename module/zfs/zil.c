@@ -85,6 +85,7 @@ zil_stats_t zil_stats = {
 	{ "zil_itx_metaslab_normal_bytes",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_count",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_bytes",	KSTAT_DATA_UINT64 },
+	/* zil_commit_latency and zil_lwb_latency are named in zil_init() */
 };
 
 static kstat_t *zil_ksp;
@@ -101,7 +102,15 @@ int zil_replay_disable = 0;
  */
 int zfs_nocacheflush = 0;
 
+/*
+ * A commit waiter whose lwb is still open issues the lwb itself after
+ * waiting for this percentage of the latency of the last completed lwb,
+ * unless other threads have filled and issued it by then.
+ */
+int zfs_commit_timeout_pct = 5;
+
 static kmem_cache_t *zil_lwb_cache;
+static kmem_cache_t *zil_zcw_cache;
 
 static void zil_async_to_sync(zilog_t *zilog, uint64_t foid);
 
@@ -466,10 +475,13 @@ zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, uint64_t txg, boolean_t fastwrite)
 	lwb->lwb_zilog = zilog;
 	lwb->lwb_blk = *bp;
 	lwb->lwb_fastwrite = fastwrite;
+	lwb->lwb_state = LWB_STATE_CLOSED;
 	lwb->lwb_buf = zio_buf_alloc(BP_GET_LSIZE(bp));
 	lwb->lwb_max_txg = txg;
-	lwb->lwb_zio = NULL;
+	lwb->lwb_write_zio = NULL;
+	lwb->lwb_root_zio = NULL;
 	lwb->lwb_tx = NULL;
+	lwb->lwb_issued_timestamp = 0;
 	if (BP_GET_CHECKSUM(bp) == ZIO_CHECKSUM_ZILOG2) {
 		lwb->lwb_nused = sizeof (zil_chain_t);
 		lwb->lwb_sz = BP_GET_LSIZE(bp);
@@ -482,9 +494,37 @@ zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, uint64_t txg, boolean_t fastwrite)
 	list_insert_tail(&zilog->zl_lwb_list, lwb);
 	mutex_exit(&zilog->zl_lock);
 
+	ASSERT(!MUTEX_HELD(&lwb->lwb_vdev_lock));
+	ASSERT(avl_is_empty(&lwb->lwb_vdev_tree));
+	VERIFY(list_is_empty(&lwb->lwb_waiters));
+	VERIFY(list_is_empty(&lwb->lwb_itxs));
+
 	return (lwb);
 }
 
+static void
+zil_free_lwb(zilog_t *zilog, lwb_t *lwb)
+{
+	ASSERT(MUTEX_HELD(&zilog->zl_lock));
+	ASSERT(!MUTEX_HELD(&lwb->lwb_vdev_lock));
+	VERIFY(list_is_empty(&lwb->lwb_waiters));
+	VERIFY(list_is_empty(&lwb->lwb_itxs));
+	ASSERT(avl_is_empty(&lwb->lwb_vdev_tree));
+	ASSERT3P(lwb->lwb_write_zio, ==, NULL);
+	ASSERT3P(lwb->lwb_root_zio, ==, NULL);
+	ASSERT(lwb->lwb_state == LWB_STATE_CLOSED ||
+	    lwb->lwb_state == LWB_STATE_FLUSH_DONE);
+
+	/*
+	 * Clear the zilog's field to indicate this lwb is no longer
+	 * valid, and prevent use-after-free errors.
+	 */
+	if (zilog->zl_last_lwb_opened == lwb)
+		zilog->zl_last_lwb_opened = NULL;
+
+	kmem_cache_free(zil_lwb_cache, lwb);
+}
+
 /*
  * Called when we create in-memory log transactions so that we know
  * to cleanup the itxs at the end of spa_sync().
@@ -502,6 +542,8 @@ zilog_dirty(zilog_t *zilog, uint64_t txg)
 		/* up the hold count until we can be written out */
 		dmu_buf_add_ref(ds->ds_dbuf, zilog);
 	}
+
+	zilog->zl_dirty_max_txg = MAX(txg, zilog->zl_dirty_max_txg);
 }
 
 boolean_t
@@ -628,7 +670,6 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 		ASSERT(zh->zh_claim_txg == 0);
 		VERIFY(!keep_first);
 		while ((lwb = list_head(&zilog->zl_lwb_list)) != NULL) {
-			ASSERT(lwb->lwb_zio == NULL);
 			if (lwb->lwb_fastwrite)
 				metaslab_fastwrite_unmark(zilog->zl_spa,
 				    &lwb->lwb_blk);
@@ -636,7 +677,7 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 			if (lwb->lwb_buf != NULL)
 				zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
 			zio_free_zil(zilog->zl_spa, txg, &lwb->lwb_blk);
-			kmem_cache_free(zil_lwb_cache, lwb);
+			zil_free_lwb(zilog, lwb);
 		}
 	} else if (!keep_first) {
 		zil_destroy_sync(zilog, tx);
@@ -665,7 +706,7 @@ zil_claim(dsl_pool_t *dp, dsl_dataset_t *ds, void *txarg)
 	int error;
 
 	error = dmu_objset_own_obj(dp, ds->ds_object,
-	    DMU_OST_ANY, B_FALSE, FTAG, &os);
+	    DMU_OST_ANY, B_FALSE, B_FALSE, FTAG, &os);
 	if (error != 0) {
 		/*
 		 * EBUSY indicates that the objset is inconsistent, in which
@@ -687,7 +728,7 @@ zil_claim(dsl_pool_t *dp, dsl_dataset_t *ds, void *txarg)
 			zio_free_zil(zilog->zl_spa, first_txg, &zh->zh_log);
 		BP_ZERO(&zh->zh_log);
 		dsl_dataset_dirty(dmu_objset_ds(os), tx);
-		dmu_objset_disown(os, FTAG);
+		dmu_objset_disown(os, B_FALSE, FTAG);
 		return (0);
 	}
 
@@ -712,7 +753,7 @@ zil_claim(dsl_pool_t *dp, dsl_dataset_t *ds, void *txarg)
 	}
 
 	ASSERT3U(first_txg, ==, (spa_last_synced_txg(zilog->zl_spa) + 1));
-	dmu_objset_disown(os, FTAG);
+	dmu_objset_disown(os, B_FALSE, FTAG);
 	return (0);
 }
 
@@ -784,10 +825,54 @@ zil_vdev_compare(const void *x1, const void *x2)
 	return (AVL_CMP(v1, v2));
 }
 
+/*ARGSUSED*/
+static int
+zil_lwb_cons(void *vbuf, void *unused, int kmflag)
+{
+	lwb_t *lwb = vbuf;
+
+	list_create(&lwb->lwb_itxs, sizeof (itx_t), offsetof(itx_t, itx_node));
+	list_create(&lwb->lwb_waiters, sizeof (zil_commit_waiter_t),
+	    offsetof(zil_commit_waiter_t, zcw_node));
+	avl_create(&lwb->lwb_vdev_tree, zil_vdev_compare,
+	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
+	mutex_init(&lwb->lwb_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
+	return (0);
+}
+
+/*ARGSUSED*/
+static void
+zil_lwb_dest(void *vbuf, void *unused)
+{
+	lwb_t *lwb = vbuf;
+
+	mutex_destroy(&lwb->lwb_vdev_lock);
+	avl_destroy(&lwb->lwb_vdev_tree);
+	list_destroy(&lwb->lwb_waiters);
+	list_destroy(&lwb->lwb_itxs);
+}
+
+/*
+ * Account for one event in a zil_stats_t latency histogram.
+ */
+static void
+zil_latency_histo_add(kstat_named_t *histo, hrtime_t delta)
+{
+	uint64_t us = MAX(delta, 0) / (NANOSEC / MICROSEC);
+	int b = MIN(highbit64(us), ZIL_LATENCY_BUCKETS - 1);
+
+	atomic_inc_64(&histo[b].value.ui64);
+}
+
+/*
+ * Record the vdevs of a block written on behalf of this lwb (the log
+ * block itself, or a dmu_sync()ed block of an indirect write record), so
+ * their write caches are flushed once the lwb write completes.
+ */
 void
-zil_add_block(zilog_t *zilog, const blkptr_t *bp)
+zil_lwb_add_block(lwb_t *lwb, const blkptr_t *bp)
 {
-	avl_tree_t *t = &zilog->zl_vdev_tree;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
 	avl_index_t where;
 	zil_vdev_node_t *zv, zvsearch;
 	int ndvas = BP_GET_NDVAS(bp);
@@ -796,14 +881,12 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 	if (zfs_nocacheflush)
 		return;
 
-	ASSERT(zilog->zl_writer);
-
 	/*
-	 * Even though we're zl_writer, we still need a lock because the
-	 * zl_get_data() callbacks may have dmu_sync() done callbacks
-	 * that will run concurrently.
+	 * The zl_get_data() callbacks may have dmu_sync() done callbacks
+	 * that will run concurrently, so we need a lock even though the
+	 * lwb has not been issued yet.
 	 */
-	mutex_enter(&zilog->zl_vdev_lock);
+	mutex_enter(&lwb->lwb_vdev_lock);
 	for (i = 0; i < ndvas; i++) {
 		zvsearch.zv_vdev = DVA_GET_VDEV(&bp->blk_dva[i]);
 		if (avl_find(t, &zvsearch, &where) == NULL) {
@@ -812,56 +895,101 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 			avl_insert(t, zv, where);
 		}
 	}
-	mutex_exit(&zilog->zl_vdev_lock);
+	mutex_exit(&lwb->lwb_vdev_lock);
 }
 
+/*
+ * Called once the lwb's write and the cache flushes of all the vdevs it
+ * touched have completed (or as soon as the write completes when
+ * zfs_nocacheflush is set).  Since every lwb root zio is a parent of the
+ * root zio of the lwb opened before it, this also means that all earlier
+ * lwbs are done.  The contents of the lwb are now stable, so the itxs it
+ * holds are released and its commit waiters are signalled.
+ */
 static void
-zil_flush_vdevs(zilog_t *zilog)
+zil_lwb_flush_vdevs_done(zio_t *zio)
 {
-	spa_t *spa = zilog->zl_spa;
-	avl_tree_t *t = &zilog->zl_vdev_tree;
-	void *cookie = NULL;
-	zil_vdev_node_t *zv;
-	zio_t *zio;
+	lwb_t *lwb = zio->io_private;
+	zilog_t *zilog = lwb->lwb_zilog;
+	dmu_tx_t *tx = lwb->lwb_tx;
+	zil_commit_waiter_t *zcw;
+	hrtime_t latency;
+	itx_t *itx;
+
+	spa_config_exit(zilog->zl_spa, SCL_STATE, lwb);
+
+	latency = gethrtime() - lwb->lwb_issued_timestamp;
+	zil_latency_histo_add(zil_stats.zil_lwb_latency, latency);
+
+	mutex_enter(&zilog->zl_lock);
+
+	zilog->zl_last_lwb_latency = latency;
 
-	ASSERT(zilog->zl_writer);
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_WRITE_DONE);
+	lwb->lwb_state = LWB_STATE_FLUSH_DONE;
+	lwb->lwb_root_zio = NULL;
+	lwb->lwb_tx = NULL;
 
 	/*
-	 * We don't need zl_vdev_lock here because we're the zl_writer,
-	 * and all zl_get_data() callbacks are done.
+	 * Remember the highest committed log sequence number for ztest.
+	 * We only update this value when all the log writes succeeded,
+	 * because ztest wants to ASSERT that it got the whole log chain.
+	 * Records are only sequenced into the most recently opened lwb,
+	 * so once that lwb is done every sequenced record is stable.
 	 */
-	if (avl_numnodes(t) == 0)
-		return;
+	if (zio->io_error == 0 && zilog->zl_last_lwb_opened == lwb)
+		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
 
-	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	while ((itx = list_head(&lwb->lwb_itxs)) != NULL) {
+		list_remove(&lwb->lwb_itxs, itx);
+		zil_itx_destroy(itx);
+	}
 
-	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	while ((zcw = list_head(&lwb->lwb_waiters)) != NULL) {
+		mutex_enter(&zcw->zcw_lock);
 
-	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
-		vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
-		if (vd != NULL)
-			zio_flush(zio, vd);
-		kmem_free(zv, sizeof (*zv));
+		ASSERT(list_link_active(&zcw->zcw_node));
+		list_remove(&lwb->lwb_waiters, zcw);
+
+		ASSERT3P(zcw->zcw_lwb, ==, lwb);
+		zcw->zcw_lwb = NULL;
+		zcw->zcw_zio_error = zio->io_error;
+
+		ASSERT(!zcw->zcw_done);
+		zcw->zcw_done = B_TRUE;
+		cv_broadcast(&zcw->zcw_cv);
+
+		mutex_exit(&zcw->zcw_lock);
 	}
 
+	mutex_exit(&zilog->zl_lock);
+
 	/*
-	 * Wait for all the flushes to complete.  Not all devices actually
-	 * support the DKIOCFLUSHWRITECACHE ioctl, so it's OK if it fails.
+	 * Now that we've written this log block, we have a stable pointer
+	 * to the next block in the chain, so it's OK to let the txg in
+	 * which we allocated the next block sync.  Holding the txg open
+	 * until here also guarantees that a txg_wait_synced() issued
+	 * after this lwb only returns once the lwb is done.
 	 */
-	(void) zio_wait(zio);
-
-	spa_config_exit(spa, SCL_STATE, FTAG);
+	dmu_tx_commit(tx);
 }
 
 /*
- * Function called when a log block write completes
+ * Function called when a log block write completes.  The write cache of
+ * each vdev the lwb touched is flushed as a child of the lwb's root zio;
+ * the lwb is done once those flushes complete.
  */
 static void
 zil_lwb_write_done(zio_t *zio)
 {
 	lwb_t *lwb = zio->io_private;
+	spa_t *spa = zio->io_spa;
 	zilog_t *zilog = lwb->lwb_zilog;
-	dmu_tx_t *tx = lwb->lwb_tx;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
+	void *cookie = NULL;
+	zil_vdev_node_t *zv;
+
+	ASSERT3S(spa_config_held(spa, SCL_STATE, RW_READER), !=, 0);
 
 	ASSERT(BP_GET_COMPRESS(zio->io_bp) == ZIO_COMPRESS_OFF);
 	ASSERT(BP_GET_TYPE(zio->io_bp) == DMU_OT_INTENT_LOG);
@@ -871,62 +999,86 @@ zil_lwb_write_done(zio_t *zio)
 	ASSERT(!BP_IS_HOLE(zio->io_bp));
 	ASSERT(BP_GET_FILL(zio->io_bp) == 0);
 
-	/*
-	 * Ensure the lwb buffer pointer is cleared before releasing
-	 * the txg. If we have had an allocation failure and
-	 * the txg is waiting to sync then we want want zil_sync()
-	 * to remove the lwb so that it's not picked up as the next new
-	 * one in zil_commit_writer(). zil_sync() will only remove
-	 * the lwb if lwb_buf is null.
-	 */
 	abd_put(zio->io_abd);
 	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
+
 	mutex_enter(&zilog->zl_lock);
-	lwb->lwb_zio = NULL;
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_ISSUED);
+	lwb->lwb_state = LWB_STATE_WRITE_DONE;
+	lwb->lwb_write_zio = NULL;
 	lwb->lwb_fastwrite = FALSE;
 	lwb->lwb_buf = NULL;
-	lwb->lwb_tx = NULL;
 	mutex_exit(&zilog->zl_lock);
 
 	/*
-	 * Now that we've written this log block, we have a stable pointer
-	 * to the next block in the chain, so it's OK to let the txg in
-	 * which we allocated the next block sync.
+	 * All zl_get_data() callbacks are children of the write zio and
+	 * are done, so we don't need lwb_vdev_lock here.  If the write
+	 * failed there is no point in flushing; the error propagates to
+	 * the root zio and the waiters fall back to txg_wait_synced().
 	 */
-	dmu_tx_commit(tx);
+	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
+		vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
+		if (vd != NULL && zio->io_error == 0)
+			zio_flush(lwb->lwb_root_zio, vd);
+		kmem_free(zv, sizeof (*zv));
+	}
 }
 
 /*
- * Initialize the io for a log block.
+ * Initialize the io for a log block and "open" the lwb, so that itxs
+ * can be committed to it.  This is a no-op if the lwb is already open.
+ *
+ * Each newly opened lwb's root zio is made the parent of the root zio of
+ * the lwb opened before it, unless that one is already done.  The commit
+ * waiters are signalled from the root zio's done callback, so this chain
+ * ensures no waiter is woken before all earlier lwbs are stable, even
+ * though lwbs are written concurrently.
  */
 static void
-zil_lwb_write_init(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_open(zilog_t *zilog, lwb_t *lwb)
 {
+	lwb_t *prev;
 	zbookmark_phys_t zb;
 
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	EQUIV(lwb->lwb_root_zio == NULL, lwb->lwb_state == LWB_STATE_CLOSED);
+	EQUIV(lwb->lwb_root_zio != NULL, lwb->lwb_state == LWB_STATE_OPENED);
+
 	SET_BOOKMARK(&zb, lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_OBJSET],
 	    ZB_ZIL_OBJECT, ZB_ZIL_LEVEL,
 	    lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_SEQ]);
 
-	if (zilog->zl_root_zio == NULL) {
-		zilog->zl_root_zio = zio_root(zilog->zl_spa, NULL, NULL,
-		    ZIO_FLAG_CANFAIL);
-	}
-
 	/* Lock so zil_sync() doesn't fastwrite_unmark after zio is created */
 	mutex_enter(&zilog->zl_lock);
-	if (lwb->lwb_zio == NULL) {
+	if (lwb->lwb_root_zio == NULL) {
 		abd_t *lwb_abd = abd_get_from_buf(lwb->lwb_buf,
 		    BP_GET_LSIZE(&lwb->lwb_blk));
 		if (!lwb->lwb_fastwrite) {
 			metaslab_fastwrite_mark(zilog->zl_spa, &lwb->lwb_blk);
 			lwb->lwb_fastwrite = 1;
 		}
-		lwb->lwb_zio = zio_rewrite(zilog->zl_root_zio, zilog->zl_spa,
-		    0, &lwb->lwb_blk, lwb_abd, BP_GET_LSIZE(&lwb->lwb_blk),
-		    zil_lwb_write_done, lwb, ZIO_PRIORITY_SYNC_WRITE,
-		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+		lwb->lwb_root_zio = zio_root(zilog->zl_spa,
+		    zil_lwb_flush_vdevs_done, lwb, ZIO_FLAG_CANFAIL);
+		lwb->lwb_write_zio = zio_rewrite(lwb->lwb_root_zio,
+		    zilog->zl_spa, 0, &lwb->lwb_blk, lwb_abd,
+		    BP_GET_LSIZE(&lwb->lwb_blk), zil_lwb_write_done, lwb,
+		    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL |
 		    ZIO_FLAG_FASTWRITE, &zb);
+		lwb->lwb_state = LWB_STATE_OPENED;
+
+		/*
+		 * The previous lwb's state is only advanced past "write
+		 * done" under zl_lock, so its root zio can't complete and
+		 * be freed while we add it as a child.
+		 */
+		prev = zilog->zl_last_lwb_opened;
+		if (prev != NULL && prev->lwb_state != LWB_STATE_FLUSH_DONE) {
+			ASSERT(prev->lwb_state == LWB_STATE_ISSUED ||
+			    prev->lwb_state == LWB_STATE_WRITE_DONE);
+			ASSERT3P(prev->lwb_root_zio, !=, NULL);
+			zio_add_child(lwb->lwb_root_zio, prev->lwb_root_zio);
+		}
+		zilog->zl_last_lwb_opened = lwb;
 	}
 	mutex_exit(&zilog->zl_lock);
 }
@@ -956,10 +1108,11 @@ unsigned long zil_slog_limit = 1024 * 1024;
 
 /*
  * Start a log block write and advance to the next log block.
- * Calls are serialized.
+ * Calls are serialized by zl_issuer_lock.  The write is not waited
+ * for; the lwb's commit waiters are signalled when it completes.
  */
 static lwb_t *
-zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 {
 	lwb_t *nlwb = NULL;
 	zil_chain_t *zilc;
@@ -971,6 +1124,9 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	int i, error;
 	boolean_t use_slog;
 
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
+
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
 		zilc = (zil_chain_t *)lwb->lwb_buf;
 		bp = &zilc->zc_next_blk;
@@ -986,7 +1142,8 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 * before writing it in order to establish the log chain.
 	 * Note that if the allocation of nlwb synced before we wrote
 	 * the block that points at it (lwb), we'd leak it if we crashed.
-	 * Therefore, we don't do dmu_tx_commit() until zil_lwb_write_done().
+	 * Therefore, we don't do dmu_tx_commit() until the lwb is done
+	 * (see zil_lwb_flush_vdevs_done()).
 	 * We dirty the dataset to ensure that zil_sync() will be called
 	 * to clean up in the event of allocation failure or I/O failure.
 	 */
@@ -1044,16 +1201,16 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 		 * Allocate a new log write buffer (lwb).
 		 */
 		nlwb = zil_alloc_lwb(zilog, bp, txg, TRUE);
-
-		/* Record the block for later vdev flushing */
-		zil_add_block(zilog, &lwb->lwb_blk);
 	}
 
+	/* Record the block for later vdev flushing */
+	zil_lwb_add_block(lwb, &lwb->lwb_blk);
+
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
 		/* For Slim ZIL only write what is used. */
 		wsz = P2ROUNDUP_TYPED(lwb->lwb_nused, ZIL_MIN_BLKSZ, uint64_t);
 		ASSERT3U(wsz, <=, lwb->lwb_sz);
-		zio_shrink(lwb->lwb_zio, wsz);
+		zio_shrink(lwb->lwb_write_zio, wsz);
 
 	} else {
 		wsz = lwb->lwb_sz;
@@ -1068,7 +1225,20 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 */
 	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
 
-	zio_nowait(lwb->lwb_zio); /* Kick off the write for the old log block */
+	/*
+	 * The config lock is held until the lwb is done, so the vdevs it
+	 * is written to can be looked up to flush them.
+	 */
+	spa_config_enter(spa, SCL_STATE, lwb, RW_READER);
+
+	mutex_enter(&zilog->zl_lock);
+	lwb->lwb_state = LWB_STATE_ISSUED;
+	lwb->lwb_issued_timestamp = gethrtime();
+	mutex_exit(&zilog->zl_lock);
+
+	/* Kick off the write for the old log block */
+	zio_nowait(lwb->lwb_write_zio);
+	zio_nowait(lwb->lwb_root_zio);
 
 	/*
 	 * If there was an allocation failure then nlwb will be null which
@@ -1077,6 +1247,42 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	return (nlwb);
 }
 
+/*
+ * Mark a commit waiter done without attaching it to an lwb, because
+ * everything it waits for is already stable (or was made stable with
+ * txg_wait_synced()).
+ */
+static void
+zil_commit_waiter_skip(zil_commit_waiter_t *zcw)
+{
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!zcw->zcw_done);
+	zcw->zcw_done = B_TRUE;
+	cv_broadcast(&zcw->zcw_cv);
+	mutex_exit(&zcw->zcw_lock);
+}
+
+/*
+ * Attach a commit waiter to an lwb; it is signalled by
+ * zil_lwb_flush_vdevs_done() once the lwb is stable.
+ */
+static void
+zil_commit_waiter_link_lwb(zil_commit_waiter_t *zcw, lwb_t *lwb)
+{
+	ASSERT(MUTEX_HELD(&lwb->lwb_zilog->zl_lock));
+	ASSERT(lwb->lwb_state == LWB_STATE_OPENED ||
+	    lwb->lwb_state == LWB_STATE_ISSUED ||
+	    lwb->lwb_state == LWB_STATE_WRITE_DONE);
+
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	ASSERT(!zcw->zcw_done);
+	list_insert_tail(&lwb->lwb_waiters, zcw);
+	zcw->zcw_lwb = lwb;
+	mutex_exit(&zcw->zcw_lock);
+}
+
 static lwb_t *
 zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 {
@@ -1087,10 +1293,34 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	uint64_t reclen = lrc->lrc_reclen;
 	uint64_t dlen = 0;
 
-	if (lwb == NULL)
-		return (NULL);
-
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT3P(lwb, !=, NULL);
 	ASSERT(lwb->lwb_buf != NULL);
+
+	/*
+	 * A commit itx has no log record.  Its waiter is attached to the
+	 * lwb holding the records committed before it, which is the open
+	 * lwb if there is one, and otherwise the last lwb issued.  If all
+	 * of those are already done the waiter is done as well.
+	 */
+	if (lrc->lrc_txtype == TX_COMMIT) {
+		zil_commit_waiter_t *zcw = itx->itx_private;
+		lwb_t *last;
+
+		mutex_enter(&zilog->zl_lock);
+		last = zilog->zl_last_lwb_opened;
+		if (lwb->lwb_state == LWB_STATE_OPENED)
+			zil_commit_waiter_link_lwb(zcw, lwb);
+		else if (last != NULL && last->lwb_state != LWB_STATE_FLUSH_DONE)
+			zil_commit_waiter_link_lwb(zcw, last);
+		else
+			zil_commit_waiter_skip(zcw);
+		mutex_exit(&zilog->zl_lock);
+		itx->itx_private = NULL;
+
+		return (lwb);
+	}
+
 	ASSERT(zilog_is_dirty(zilog) ||
 	    spa_freeze_txg(zilog->zl_spa) != UINT64_MAX);
 
@@ -1100,16 +1330,16 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 
 	zilog->zl_cur_used += (reclen + dlen);
 
-	zil_lwb_write_init(zilog, lwb);
+	zil_lwb_write_open(zilog, lwb);
 
 	/*
 	 * If this record won't fit in the current log block, start a new one.
 	 */
 	if (lwb->lwb_nused + reclen + dlen > lwb->lwb_sz) {
-		lwb = zil_lwb_write_start(zilog, lwb);
+		lwb = zil_lwb_write_issue(zilog, lwb);
 		if (lwb == NULL)
 			return (NULL);
-		zil_lwb_write_init(zilog, lwb);
+		zil_lwb_write_open(zilog, lwb);
 		ASSERT(LWB_EMPTY(lwb));
 		if (lwb->lwb_nused + reclen + dlen > lwb->lwb_sz) {
 			txg_wait_synced(zilog->zl_dmu_pool, txg);
@@ -1151,8 +1381,8 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 				ZIL_STAT_INCR(zil_itx_indirect_bytes,
 				    lrw->lr_length);
 			}
-			error = zilog->zl_get_data(
-			    itx->itx_private, lrw, dbuf, lwb->lwb_zio);
+			error = zilog->zl_get_data(itx->itx_private, lrw,
+			    dbuf, lwb, lwb->lwb_write_zio);
 			if (error == EIO) {
 				txg_wait_synced(zilog->zl_dmu_pool, txg);
 				return (lwb);
@@ -1199,9 +1429,17 @@ zil_itx_create(uint64_t txtype, size_t lrsize)
 	return (itx);
 }
 
+/*
+ * Free an itx once it is no longer needed, i.e. its record is stable,
+ * either in the log or because its txg synced; its callback, if any, is
+ * called at this point.
+ */
 void
 zil_itx_destroy(itx_t *itx)
 {
+	if (itx->itx_callback != NULL)
+		itx->itx_callback(itx->itx_callback_data);
+
 	zio_data_buf_free(itx, offsetof(itx_t, itx_lr)+itx->itx_lr.lrc_reclen);
 }
 
@@ -1220,8 +1458,14 @@ zil_itxg_clean(itxs_t *itxs)
 
 	list = &itxs->i_sync_list;
 	while ((itx = list_head(list)) != NULL) {
-		if (itx->itx_callback != NULL)
-			itx->itx_callback(itx->itx_callback_data);
+		/*
+		 * Commit itxs are normally taken off this list by a writer
+		 * in zil_commit(), but the txg can sync before that happens
+		 * (e.g. when the writer waits in zil_create()).  The waiter
+		 * is done then, as its txg is on disk.
+		 */
+		if (itx->itx_lr.lrc_txtype == TX_COMMIT)
+			zil_commit_waiter_skip(itx->itx_private);
 		list_remove(list, itx);
 		zil_itx_destroy(itx);
 	}
@@ -1231,8 +1475,6 @@ zil_itxg_clean(itxs_t *itxs)
 	while ((ian = avl_destroy_nodes(t, &cookie)) != NULL) {
 		list = &ian->ia_list;
 		while ((itx = list_head(list)) != NULL) {
-			if (itx->itx_callback != NULL)
-				itx->itx_callback(itx->itx_callback_data);
 			list_remove(list, itx);
 			zil_itx_destroy(itx);
 		}
@@ -1378,7 +1620,7 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 	}
 
 	itx->itx_lr.lrc_txg = dmu_tx_get_txg(tx);
-	zilog_dirty(zilog, txg);
+	zilog_dirty(zilog, dmu_tx_get_txg(tx));
 	mutex_exit(&itxg->itxg_lock);
 
 	/* Release the old itxs now we've dropped the lock */
@@ -1406,7 +1648,6 @@ zil_clean(zilog_t *zilog, uint64_t synced_txg)
 	}
 	ASSERT3U(itxg->itxg_txg, <=, synced_txg);
 	ASSERT(itxg->itxg_txg != 0);
-	ASSERT(zilog->zl_clean_taskq != NULL);
 	atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
 	itxg->itxg_sod = 0;
 	clean_me = itxg->itxg_itxs;
@@ -1419,7 +1660,7 @@ zil_clean(zilog_t *zilog, uint64_t synced_txg)
 	 * free it in-line. This should be rare. Note, using TQ_SLEEP
 	 * created a bad performance problem.
 	 */
-	if (taskq_dispatch(zilog->zl_clean_taskq,
+	if (taskq_dispatch(zilog->zl_dmu_pool->dp_zil_clean_taskq,
 	    (void (*)(void *))zil_itxg_clean, clean_me, TQ_NOSLEEP) == 0)
 		zil_itxg_clean(clean_me);
 }
@@ -1509,86 +1750,332 @@ zil_async_to_sync(zilog_t *zilog, uint64_t foid)
 	}
 }
 
+/*
+ * Called with zl_issuer_lock held when the log chain ended at the last
+ * issued lwb, because zio_alloc_zil() failed or the log is suspended.
+ * Waiting for the open txg to sync ensures that every issued lwb is done
+ * (each one holds a tx until then) and that zil_sync() has freed them, so
+ * the next writer starts a new chain with zil_create().  Another writer
+ * must not allocate a block after the end of the broken chain in the
+ * meantime, as it could be leaked on a crash; holding zl_issuer_lock
+ * across the wait prevents that.
+ */
 static void
-zil_commit_writer(zilog_t *zilog)
+zil_commit_writer_stall(zilog_t *zilog)
 {
-	uint64_t txg;
-	itx_t *itx;
-	lwb_t *lwb;
-	spa_t *spa = zilog->zl_spa;
-	int error = 0;
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 
-	ASSERT(zilog->zl_root_zio == NULL);
+	txg_wait_synced(zilog->zl_dmu_pool, 0);
+}
 
-	mutex_exit(&zilog->zl_lock);
+/*
+ * Write out the itxs on zl_itx_commit_list.  Each itx is copied into the
+ * current lwb, and an lwb is issued to disk as soon as it is full, so that
+ * log blocks are written while the following records are still being
+ * gathered.  The last lwb is normally left open; it is issued either by a
+ * later call with more itxs, or by a commit waiter whose timeout expires
+ * (see zil_commit_waiter()).
+ */
+static void
+zil_process_commit_list(zilog_t *zilog)
+{
+	spa_t *spa = zilog->zl_spa;
+	list_t nolwb_itxs;
+	list_t nolwb_waiters;
+	zil_commit_waiter_t *zcw;
+	lwb_t *lwb;
+	itx_t *itx;
 
-	zil_get_commit_list(zilog);
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 
 	/*
 	 * Return if there's nothing to commit before we dirty the fs by
 	 * calling zil_create().
 	 */
-	if (list_head(&zilog->zl_itx_commit_list) == NULL) {
-		mutex_enter(&zilog->zl_lock);
+	if (list_head(&zilog->zl_itx_commit_list) == NULL)
 		return;
-	}
+
+	list_create(&nolwb_itxs, sizeof (itx_t), offsetof(itx_t, itx_node));
+	list_create(&nolwb_waiters, sizeof (zil_commit_waiter_t),
+	    offsetof(zil_commit_waiter_t, zcw_node));
+
+	mutex_enter(&zilog->zl_lock);
+	lwb = list_tail(&zilog->zl_lwb_list);
+	mutex_exit(&zilog->zl_lock);
 
 	if (zilog->zl_suspend) {
+		/*
+		 * While suspended we only rely on txg_wait_synced(), but
+		 * an lwb opened before the suspend began must still be
+		 * written out, so that zil_destroy() never finds it open.
+		 */
+		if (lwb != NULL && lwb->lwb_state == LWB_STATE_OPENED)
+			(void) zil_lwb_write_issue(zilog, lwb);
 		lwb = NULL;
+	} else if (lwb == NULL) {
+		lwb = zil_create(zilog);
 	} else {
-		lwb = list_tail(&zilog->zl_lwb_list);
-		if (lwb == NULL)
-			lwb = zil_create(zilog);
+		ASSERT(lwb->lwb_state == LWB_STATE_CLOSED ||
+		    lwb->lwb_state == LWB_STATE_OPENED);
 	}
 
 	DTRACE_PROBE1(zil__cw1, zilog_t *, zilog);
-	for (itx = list_head(&zilog->zl_itx_commit_list); itx != NULL;
-	    itx = list_next(&zilog->zl_itx_commit_list, itx)) {
-		txg = itx->itx_lr.lrc_txg;
+	while ((itx = list_head(&zilog->zl_itx_commit_list)) != NULL) {
+		lr_t *lrc = &itx->itx_lr;
+		uint64_t txg = lrc->lrc_txg;
+
 		ASSERT(txg);
+		list_remove(&zilog->zl_itx_commit_list, itx);
+
+		if (lrc->lrc_txtype == TX_COMMIT) {
+			if (lwb != NULL) {
+				lwb = zil_lwb_commit(zilog, itx, lwb);
+			} else {
+				list_insert_tail(&nolwb_waiters,
+				    itx->itx_private);
+				itx->itx_private = NULL;
+			}
+			zil_itx_destroy(itx);
+			continue;
+		}
+
+		if (txg <= spa_last_synced_txg(spa) &&
+		    txg <= spa_freeze_txg(spa)) {
+			zil_itx_destroy(itx);
+			continue;
+		}
 
-		if (txg > spa_last_synced_txg(spa) || txg > spa_freeze_txg(spa))
+		if (lwb != NULL)
 			lwb = zil_lwb_commit(zilog, itx, lwb);
+
+		/*
+		 * Keep the itx until the lwb it was copied into is stable,
+		 * so its callback isn't called too early.
+		 */
+		if (lwb != NULL)
+			list_insert_tail(&lwb->lwb_itxs, itx);
+		else
+			list_insert_tail(&nolwb_itxs, itx);
 	}
 	DTRACE_PROBE1(zil__cw2, zilog_t *, zilog);
 
-	/* write the last block out */
-	if (lwb != NULL && lwb->lwb_zio != NULL)
-		lwb = zil_lwb_write_start(zilog, lwb);
-
 	zilog->zl_cur_used = 0;
 
+	if (lwb == NULL) {
+		/*
+		 * Either the log is suspended, or zio_alloc_zil() failed to
+		 * allocate the next log block, so the chain ends at the last
+		 * issued lwb.  Fall back to txg_wait_synced() for whatever
+		 * didn't make it into an lwb; see zil_commit_writer_stall().
+		 */
+		zil_commit_writer_stall(zilog);
+
+		while ((itx = list_head(&nolwb_itxs)) != NULL) {
+			list_remove(&nolwb_itxs, itx);
+			zil_itx_destroy(itx);
+		}
+
+		while ((zcw = list_head(&nolwb_waiters)) != NULL) {
+			list_remove(&nolwb_waiters, zcw);
+			zil_commit_waiter_skip(zcw);
+		}
+	}
+
 	/*
-	 * Wait if necessary for the log blocks to be on stable storage.
+	 * Otherwise the last lwb is either still closed, because nothing
+	 * was committed to it, or open.  An open lwb is intentionally not
+	 * issued here: if more itxs are committed soon it fills up and is
+	 * issued by zil_lwb_commit(), making good use of its size; if not,
+	 * the waiters attached to it issue it after a short timeout.
 	 */
-	if (zilog->zl_root_zio) {
-		error = zio_wait(zilog->zl_root_zio);
-		zilog->zl_root_zio = NULL;
-		zil_flush_vdevs(zilog);
+	list_destroy(&nolwb_itxs);
+	list_destroy(&nolwb_waiters);
+}
+
+/*
+ * Take the issuer role and write out all pending itxs, unless another
+ * thread already did so for our commit itx while we waited for the lock.
+ */
+static void
+zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	boolean_t processed;
+
+	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
+	ASSERT(spa_writeable(zilog->zl_spa));
+
+	mutex_enter(&zilog->zl_issuer_lock);
+
+	mutex_enter(&zcw->zcw_lock);
+	processed = (zcw->zcw_lwb != NULL || zcw->zcw_done);
+	mutex_exit(&zcw->zcw_lock);
+
+	if (!processed) {
+		ZIL_STAT_BUMP(zil_commit_writer_count);
+
+		zil_get_commit_list(zilog);
+		zil_process_commit_list(zilog);
 	}
 
-	if (error || lwb == NULL)
-		txg_wait_synced(zilog->zl_dmu_pool, 0);
+	mutex_exit(&zilog->zl_issuer_lock);
+}
 
-	while ((itx = list_head(&zilog->zl_itx_commit_list))) {
-		txg = itx->itx_lr.lrc_txg;
-		ASSERT(txg);
+/*
+ * Called by a commit waiter whose lwb is still open after the timeout:
+ * no further itxs filled the lwb, so issue it now.
+ */
+static void
+zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	lwb_t *lwb;
 
-		if (itx->itx_callback != NULL)
-			itx->itx_callback(itx->itx_callback_data);
-		list_remove(&zilog->zl_itx_commit_list, itx);
-		zil_itx_destroy(itx);
+	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
+
+	/*
+	 * zl_issuer_lock ranks above zcw_lock, and issuing the lwb takes
+	 * zl_lock, so drop the waiter's lock while we do this.  Once we
+	 * hold zl_issuer_lock an open lwb can neither be issued by anyone
+	 * else nor be freed.
+	 */
+	mutex_exit(&zcw->zcw_lock);
+	mutex_enter(&zilog->zl_issuer_lock);
+
+	mutex_enter(&zcw->zcw_lock);
+	lwb = zcw->zcw_done ? NULL : zcw->zcw_lwb;
+	mutex_exit(&zcw->zcw_lock);
+
+	if (lwb != NULL && lwb->lwb_state == LWB_STATE_OPENED) {
+		ASSERT3P(lwb, ==, zilog->zl_last_lwb_opened);
+		if (zil_lwb_write_issue(zilog, lwb) == NULL)
+			zil_commit_writer_stall(zilog);
 	}
 
-	mutex_enter(&zilog->zl_lock);
+	mutex_exit(&zilog->zl_issuer_lock);
+	mutex_enter(&zcw->zcw_lock);
+}
+
+/*
+ * Wait for a commit waiter to be marked done.  While the waiter's lwb is
+ * still open, wait at most zfs_commit_timeout_pct percent of the latency
+ * of the last completed lwb before issuing it ourselves; this lets other
+ * threads add their itxs to the lwb first, without adding much latency
+ * for this one.
+ */
+static void
+zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	hrtime_t wakeup;
+	int pct = MAX(zfs_commit_timeout_pct, 1);
+
+	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
+	ASSERT(!MUTEX_HELD(&zilog->zl_issuer_lock));
+
+	wakeup = gethrtime() + (zilog->zl_last_lwb_latency * pct) / 100;
+
+	mutex_enter(&zcw->zcw_lock);
+	while (!zcw->zcw_done) {
+		lwb_t *lwb = zcw->zcw_lwb;
+
+		/*
+		 * The lwb can be NULL if the commit itx was found by
+		 * zil_itxg_clean() before any writer processed it; the
+		 * waiter is then skipped shortly, so no timeout is needed.
+		 * Likewise an lwb which has been issued needs no help.
+		 */
+		if (lwb == NULL || lwb->lwb_state != LWB_STATE_OPENED) {
+			cv_wait(&zcw->zcw_cv, &zcw->zcw_lock);
+			continue;
+		}
+
+		if (cv_timedwait_hires(&zcw->zcw_cv, &zcw->zcw_lock, wakeup,
+		    NANOSEC / MICROSEC, CALLOUT_FLAG_ABSOLUTE) >= 0 || zcw->zcw_done)
+			continue;
+
+		zil_commit_waiter_timeout(zilog, zcw);
+	}
+	mutex_exit(&zcw->zcw_lock);
+}
+
+static zil_commit_waiter_t *
+zil_alloc_commit_waiter(void)
+{
+	zil_commit_waiter_t *zcw = kmem_cache_alloc(zil_zcw_cache, KM_SLEEP);
+
+	cv_init(&zcw->zcw_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&zcw->zcw_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_link_init(&zcw->zcw_node);
+	zcw->zcw_lwb = NULL;
+	zcw->zcw_done = B_FALSE;
+	zcw->zcw_zio_error = 0;
+
+	return (zcw);
+}
+
+static void
+zil_free_commit_waiter(zil_commit_waiter_t *zcw)
+{
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	ASSERT(zcw->zcw_done);
+	mutex_destroy(&zcw->zcw_lock);
+	cv_destroy(&zcw->zcw_cv);
+	kmem_cache_free(zil_zcw_cache, zcw);
+}
+
+/*
+ * Assign a commit itx, carrying the given waiter, to the open txg.  It
+ * ends up on the commit list behind every itx this commit has to wait
+ * for.
+ */
+static void
+zil_commit_itx_assign(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	dmu_tx_t *tx = dmu_tx_create(zilog->zl_os);
+	itx_t *itx;
+
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+	itx = zil_itx_create(TX_COMMIT, sizeof (lr_t));
+	itx->itx_sync = B_TRUE;
+	itx->itx_private = zcw;
+
+	zil_itx_assign(zilog, itx, tx);
+
+	dmu_tx_commit(tx);
+}
+
+static void
+zil_commit_impl(zilog_t *zilog, uint64_t foid)
+{
+	zil_commit_waiter_t *zcw;
+	hrtime_t start = gethrtime();
+
+	ZIL_STAT_BUMP(zil_commit_count);
 
 	/*
-	 * Remember the highest committed log sequence number for ztest.
-	 * We only update this value when all the log writes succeeded,
-	 * because ztest wants to ASSERT that it got the whole log chain.
+	 * Move the async itxs for the foid to the sync queues.  This
+	 * must happen before the commit itx is assigned, so that they
+	 * are committed ahead of it.
 	 */
-	if (error == 0 && lwb != NULL)
-		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
+	zil_async_to_sync(zilog, foid);
+
+	zcw = zil_alloc_commit_waiter();
+	zil_commit_itx_assign(zilog, zcw);
+
+	zil_commit_writer(zilog, zcw);
+	zil_commit_waiter(zilog, zcw);
+
+	/*
+	 * If writing out the log blocks we were waiting for failed, rely
+	 * on spa_sync() instead.
+	 */
+	if (zcw->zcw_zio_error != 0)
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+
+	zil_free_commit_waiter(zcw);
+
+	zil_latency_histo_add(zil_stats.zil_commit_latency,
+	    gethrtime() - start);
 }
 
 /*
@@ -1596,61 +2083,48 @@ zil_commit_writer(zilog_t *zilog)
  * If foid is 0 push out all transactions, otherwise push only those
  * for that object or might reference that object.
  *
- * itxs are committed in batches. In a heavily stressed zil there will be
- * a commit writer thread who is writing out a bunch of itxs to the log
- * for a set of committing threads (cthreads) in the same batch as the writer.
- * Those cthreads are all waiting on the same cv for that batch.
+ * Each caller assigns a "commit itx" carrying a commit waiter, which
+ * ends up on the commit list behind all of the itxs the caller depends
+ * on.  One thread at a time (the holder of zl_issuer_lock) copies the
+ * pending itxs into log write blocks (lwbs), issuing each lwb as soon as
+ * it is full, and attaches each waiter to the lwb holding the records
+ * committed before it.  Threads whose commit itx was already processed
+ * by another writer don't take the issuer role at all.
  *
- * There will also be a different and growing batch of threads that are
- * waiting to commit (qthreads). When the committing batch completes
- * a transition occurs such that the cthreads exit and the qthreads become
- * cthreads. One of the new cthreads becomes the writer thread for the
- * batch. Any new threads arriving become new qthreads.
+ * Every lwb's root zio is a parent of the previous lwb's root zio, so an
+ * lwb completes only after all earlier lwbs are on stable storage.  When
+ * it completes, the waiters attached to it are woken; each fsync thus
+ * returns as soon as its own records are stable, rather than waiting for
+ * a whole batch written by another thread, and lwbs are written while
+ * later records are still being gathered.
  *
- * Only 2 condition variables are needed and there's no transition
- * between the two cvs needed. They just flip-flop between qthreads
- * and cthreads.
- *
- * Using this scheme we can efficiently wakeup up only those threads
- * that have been committed.
+ * The last lwb is left open, to be filled by other committers; if none
+ * come along, its waiters issue it after a short timeout.
  */
 void
 zil_commit(zilog_t *zilog, uint64_t foid)
 {
-	uint64_t mybatch;
-
 	if (zilog->zl_sync == ZFS_SYNC_DISABLED)
 		return;
 
-	ZIL_STAT_BUMP(zil_commit_count);
-
-	/* move the async itxs for the foid to the sync queues */
-	zil_async_to_sync(zilog, foid);
+	/*
+	 * Nothing can be committed on a read-only pool.
+	 */
+	if (!spa_writeable(zilog->zl_spa))
+		return;
 
-	mutex_enter(&zilog->zl_lock);
-	mybatch = zilog->zl_next_batch;
-	while (zilog->zl_writer) {
-		cv_wait(&zilog->zl_cv_batch[mybatch & 1], &zilog->zl_lock);
-		if (mybatch <= zilog->zl_com_batch) {
-			mutex_exit(&zilog->zl_lock);
-			return;
-		}
+	/*
+	 * While the log is suspended we don't write lwbs (nor dirty the
+	 * log with a commit itx); we rely on txg_wait_synced() to honor
+	 * the synchronous semantics.
+	 */
+	if (zilog->zl_suspend > 0) {
+		ZIL_STAT_BUMP(zil_commit_count);
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+		return;
 	}
 
-	zilog->zl_next_batch++;
-	zilog->zl_writer = B_TRUE;
-	ZIL_STAT_BUMP(zil_commit_writer_count);
-	zil_commit_writer(zilog);
-	zilog->zl_com_batch = mybatch;
-	zilog->zl_writer = B_FALSE;
-
-	/* wake up one thread to become the next writer */
-	cv_signal(&zilog->zl_cv_batch[(mybatch+1) & 1]);
-
-	/* wake up all threads waiting for this batch to be committed */
-	cv_broadcast(&zilog->zl_cv_batch[mybatch & 1]);
-
-	mutex_exit(&zilog->zl_lock);
+	zil_commit_impl(zilog, foid);
 }
 
 /*
@@ -1706,14 +2180,13 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 
 	while ((lwb = list_head(&zilog->zl_lwb_list)) != NULL) {
 		zh->zh_log = lwb->lwb_blk;
-		if (lwb->lwb_buf != NULL || lwb->lwb_max_txg > txg)
+		if (lwb->lwb_state != LWB_STATE_FLUSH_DONE ||
+		    lwb->lwb_max_txg > txg)
 			break;
 
-		ASSERT(lwb->lwb_zio == NULL);
-
 		list_remove(&zilog->zl_lwb_list, lwb);
 		zio_free_zil(spa, txg, &lwb->lwb_blk);
-		kmem_cache_free(zil_lwb_cache, lwb);
+		zil_free_lwb(zilog, lwb);
 
 		/*
 		 * If we don't have anything left in the lwb list then
@@ -1731,7 +2204,7 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 	 * unused, long-lived LWBs.
 	 */
 	for (; lwb != NULL; lwb = list_next(&zilog->zl_lwb_list, lwb)) {
-		if (lwb->lwb_fastwrite && !lwb->lwb_zio) {
+		if (lwb->lwb_fastwrite && lwb->lwb_state == LWB_STATE_CLOSED) {
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
 			lwb->lwb_fastwrite = 0;
 		}
@@ -1743,8 +2216,25 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 void
 zil_init(void)
 {
+	int i;
+
 	zil_lwb_cache = kmem_cache_create("zil_lwb_cache",
-	    sizeof (struct lwb), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	    sizeof (lwb_t), 0, zil_lwb_cons, zil_lwb_dest, NULL, NULL, NULL, 0);
+
+	zil_zcw_cache = kmem_cache_create("zil_zcw_cache",
+	    sizeof (zil_commit_waiter_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+
+	for (i = 0; i < ZIL_LATENCY_BUCKETS; i++) {
+		kstat_named_t *ckn = &zil_stats.zil_commit_latency[i];
+		kstat_named_t *lkn = &zil_stats.zil_lwb_latency[i];
+
+		(void) snprintf(ckn->name, KSTAT_STRLEN,
+		    "zil_commit_latency_%lluus", 1ULL << i);
+		ckn->data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(lkn->name, KSTAT_STRLEN,
+		    "zil_lwb_latency_%lluus", 1ULL << i);
+		lkn->data_type = KSTAT_DATA_UINT64;
+	}
 
 	zil_ksp = kstat_create("zfs", 0, "zil", "misc",
 	    KSTAT_TYPE_NAMED, sizeof (zil_stats) / sizeof (kstat_named_t),
@@ -1759,6 +2249,7 @@ zil_init(void)
 void
 zil_fini(void)
 {
+	kmem_cache_destroy(zil_zcw_cache);
 	kmem_cache_destroy(zil_lwb_cache);
 
 	if (zil_ksp != NULL) {
@@ -1794,9 +2285,10 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	zilog->zl_destroy_txg = TXG_INITIAL - 1;
 	zilog->zl_logbias = dmu_objset_logbias(os);
 	zilog->zl_sync = dmu_objset_syncprop(os);
-	zilog->zl_next_batch = 1;
+	zilog->zl_last_lwb_latency = 0;
 
 	mutex_init(&zilog->zl_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&zilog->zl_issuer_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	for (i = 0; i < TXG_SIZE; i++) {
 		mutex_init(&zilog->zl_itxg[i].itxg_lock, NULL,
@@ -1809,15 +2301,7 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	list_create(&zilog->zl_itx_commit_list, sizeof (itx_t),
 	    offsetof(itx_t, itx_node));
 
-	mutex_init(&zilog->zl_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
-
-	avl_create(&zilog->zl_vdev_tree, zil_vdev_compare,
-	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
-
-	cv_init(&zilog->zl_cv_writer, NULL, CV_DEFAULT, NULL);
 	cv_init(&zilog->zl_cv_suspend, NULL, CV_DEFAULT, NULL);
-	cv_init(&zilog->zl_cv_batch[0], NULL, CV_DEFAULT, NULL);
-	cv_init(&zilog->zl_cv_batch[1], NULL, CV_DEFAULT, NULL);
 
 	return (zilog);
 }
@@ -1835,9 +2319,6 @@ zil_free(zilog_t *zilog)
 	ASSERT(list_is_empty(&zilog->zl_lwb_list));
 	list_destroy(&zilog->zl_lwb_list);
 
-	avl_destroy(&zilog->zl_vdev_tree);
-	mutex_destroy(&zilog->zl_vdev_lock);
-
 	ASSERT(list_is_empty(&zilog->zl_itx_commit_list));
 	list_destroy(&zilog->zl_itx_commit_list);
 
@@ -1855,11 +2336,9 @@ zil_free(zilog_t *zilog)
 	}
 
 	mutex_destroy(&zilog->zl_lock);
+	mutex_destroy(&zilog->zl_issuer_lock);
 
-	cv_destroy(&zilog->zl_cv_writer);
 	cv_destroy(&zilog->zl_cv_suspend);
-	cv_destroy(&zilog->zl_cv_batch[0]);
-	cv_destroy(&zilog->zl_cv_batch[1]);
 
 	kmem_free(zilog, sizeof (zilog_t));
 }
@@ -1872,13 +2351,10 @@ zil_open(objset_t *os, zil_get_data_t *get_data)
 {
 	zilog_t *zilog = dmu_objset_zil(os);
 
-	ASSERT(zilog->zl_clean_taskq == NULL);
 	ASSERT(zilog->zl_get_data == NULL);
 	ASSERT(list_is_empty(&zilog->zl_lwb_list));
 
 	zilog->zl_get_data = get_data;
-	zilog->zl_clean_taskq = taskq_create("zil_clean", 1, defclsyspri,
-	    2, 2, TASKQ_PREPOPULATE);
 
 	return (zilog);
 }
@@ -1895,23 +2371,37 @@ zil_close(zilog_t *zilog)
 	zil_commit(zilog, 0); /* commit all itx */
 
 	/*
-	 * The lwb_max_txg for the stubby lwb will reflect the last activity
-	 * for the zil.  After a txg_wait_synced() on the txg we know all the
-	 * callbacks have occurred that may clean the zil.  Only then can we
-	 * destroy the zl_clean_taskq.
+	 * An lwb can be left open by a writer which found itxs behind its
+	 * own commit itx, e.g. when zil_commit() is now a no-op because
+	 * sync=disabled was set.  Issue it; the txg_wait_synced() below
+	 * then waits for it to complete.
 	 */
+	mutex_enter(&zilog->zl_issuer_lock);
 	mutex_enter(&zilog->zl_lock);
 	lwb = list_tail(&zilog->zl_lwb_list);
+	mutex_exit(&zilog->zl_lock);
+	if (lwb != NULL && lwb->lwb_state == LWB_STATE_OPENED)
+		(void) zil_lwb_write_issue(zilog, lwb);
+	mutex_exit(&zilog->zl_issuer_lock);
+
+	/*
+	 * The lwb_max_txg for the stubby lwb, and the highest txg any itx
+	 * (including the TX_COMMIT itxs, which never reach an lwb) dirtied
+	 * the zilog in, reflect the last activity for the zil.  After a
+	 * txg_wait_synced() on that txg we know all the callbacks have
+	 * occurred that may clean the zil.  Only then can we tear it down.
+	 */
+	mutex_enter(&zilog->zl_lock);
+	lwb = list_tail(&zilog->zl_lwb_list);
+	txg = zilog->zl_dirty_max_txg;
 	if (lwb != NULL)
-		txg = lwb->lwb_max_txg;
+		txg = MAX(txg, lwb->lwb_max_txg);
 	mutex_exit(&zilog->zl_lock);
 	if (txg)
 		txg_wait_synced(zilog->zl_dmu_pool, txg);
 	if (txg < spa_freeze_txg(zilog->zl_spa))
 		ASSERT(!zilog_is_dirty(zilog));
 
-	taskq_destroy(zilog->zl_clean_taskq);
-	zilog->zl_clean_taskq = NULL;
 	zilog->zl_get_data = NULL;
 
 	/*
@@ -1921,12 +2411,12 @@ zil_close(zilog_t *zilog)
 	lwb = list_head(&zilog->zl_lwb_list);
 	if (lwb != NULL) {
 		ASSERT(lwb == list_tail(&zilog->zl_lwb_list));
-		ASSERT(lwb->lwb_zio == NULL);
+		ASSERT3S(lwb->lwb_state, ==, LWB_STATE_CLOSED);
 		if (lwb->lwb_fastwrite)
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
 		list_remove(&zilog->zl_lwb_list, lwb);
 		zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
-		kmem_cache_free(zil_lwb_cache, lwb);
+		zil_free_lwb(zilog, lwb);
 	}
 	mutex_exit(&zilog->zl_lock);
 }
@@ -2028,7 +2518,16 @@ zil_suspend(const char *osname, void **cookiep)
 	zilog->zl_suspending = B_TRUE;
 	mutex_exit(&zilog->zl_lock);
 
-	zil_commit(zilog, 0);
+	/*
+	 * We need to use zil_commit_impl to ensure we wait for all
+	 * LWB_STATE_OPENED and LWB_STATE_ISSUED lwb's to be committed
+	 * to disk before proceeding. If we used zil_commit instead, it
+	 * would just call txg_wait_synced(), because zl_suspend is set.
+	 * txg_wait_synced() doesn't wait for these lwb's to be
+	 * LWB_STATE_FLUSH_DONE before returning.
+	 */
+	if (spa_writeable(zilog->zl_spa))
+		zil_commit_impl(zilog, 0);
 
 	zil_destroy(zilog, B_FALSE);
 
@@ -2259,7 +2758,7 @@ EXPORT_SYMBOL(zil_sync);
 EXPORT_SYMBOL(zil_clean);
 EXPORT_SYMBOL(zil_suspend);
 EXPORT_SYMBOL(zil_resume);
-EXPORT_SYMBOL(zil_add_block);
+EXPORT_SYMBOL(zil_lwb_add_block);
 EXPORT_SYMBOL(zil_bp_tree_add);
 EXPORT_SYMBOL(zil_set_sync);
 EXPORT_SYMBOL(zil_set_logbias);
@@ -2270,6 +2769,9 @@ MODULE_PARM_DESC(zil_replay_disable, "Disable intent logging replay");
 module_param(zfs_nocacheflush, int, 0644);
 MODULE_PARM_DESC(zfs_nocacheflush, "Disable cache flushes");
 
+module_param(zfs_commit_timeout_pct, int, 0644);
+MODULE_PARM_DESC(zfs_commit_timeout_pct, "ZIL block open timeout percentage");
+
 /* CSTYLED */
 module_param(zil_slog_limit, ulong, 0644);
 MODULE_PARM_DESC(zil_slog_limit, "Max commit bytes to separate log device");
@@ -34,6 +34,8 @@
 #include <sys/zio_impl.h>
 #include <sys/zio_compress.h>
 #include <sys/zio_checksum.h>
+#include <sys/zio_crypt.h>
+#include <sys/dsl_crypt.h>
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
@@ -58,6 +60,7 @@ const char *zio_type_name[ZIO_TYPES] = {
 };
 
 int zio_dva_throttle_enabled = B_TRUE;
+int zio_checksum_batch_enabled = B_TRUE;
 
 /*
  * ==========================================================================
@@ -200,6 +203,7 @@ zio_init(void)
 	zio_inject_init();
 
 	lz4_init();
+	zstd_init();
 }
 
 void
@@ -243,6 +247,7 @@ zio_fini(void)
 
 	zio_inject_fini();
 
+	zstd_fini();
 	lz4_fini();
 }
 
@@ -388,6 +393,46 @@ zio_decompress(zio_t *zio, abd_t *data, uint64_t size)
 	}
 }
 
+/*
+ * Decrypt the data read for an encrypted block.  This runs before the
+ * decompression transform (if any), since the data was compressed before
+ * it was encrypted.
+ */
+static void
+zio_decrypt(zio_t *zio, abd_t *data, uint64_t size)
+{
+	spa_t *spa = zio->io_spa;
+	blkptr_t *bp = zio->io_bp;
+	dsl_crypto_key_t *dck = NULL;
+	uint8_t salt[ZIO_DATA_SALT_LEN];
+	uint8_t iv[ZIO_DATA_IV_LEN];
+	uint8_t mac[ZIO_DATA_MAC_LEN];
+	int ret;
+
+	if (zio->io_error != 0)
+		return;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+	ASSERT3U(size, ==, zio->io_size);
+
+	ret = spa_keystore_lookup_key(spa, zio->io_bookmark.zb_objset, FTAG,
+	    &dck);
+	if (ret != 0) {
+		zio->io_error = SET_ERROR(EACCES);
+		return;
+	}
+
+	zio_crypt_decode_params_bp(bp, salt, iv);
+	zio_crypt_decode_mac_bp(bp, mac);
+
+	ret = zio_do_crypt_abd(B_FALSE, &dck->dck_key, salt, iv, mac,
+	    size, data, zio->io_abd);
+	spa_keystore_dsl_key_rele(spa, dck, FTAG);
+
+	if (ret != 0)
+		zio->io_error = ret;
+}
+
 /*
  * ==========================================================================
  * I/O parent/child relationships and pipeline interlocks
@@ -584,7 +629,7 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	ASSERT(!bp || !(flags & ZIO_FLAG_CONFIG_WRITER));
 	ASSERT(vd || stage == ZIO_STAGE_OPEN);
 
-	IMPLY(lsize != psize, (flags & ZIO_FLAG_RAW) != 0);
+	IMPLY(lsize != psize, (flags & ZIO_FLAG_RAW_COMPRESS) != 0);
 
 	zio = kmem_cache_alloc(zio_cache, KM_SLEEP);
 	bzero(zio, sizeof (zio_t));
@@ -983,6 +1028,27 @@ zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
 	return (zio);
 }
 
+/*
+ * Discard a range of allocatable space on a top-level vdev.  Trims are
+ * advisory, so they are issued at the lowest queueable priority and a
+ * failure is never propagated to the parent.
+ */
+zio_t *
+zio_trim(zio_t *pio, spa_t *spa, vdev_t *vd, uint64_t offset, uint64_t size)
+{
+	ASSERT(vd == vd->vdev_top);
+	ASSERT3U(offset + size, <=, vd->vdev_asize);
+
+	if (vd->vdev_children == 0)
+		offset += VDEV_LABEL_START_SIZE;
+
+	return (zio_create(pio, spa, 0, NULL, NULL, size, size, NULL, NULL,
+	    ZIO_TYPE_FREE, ZIO_PRIORITY_TRIM, ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
+	    ZIO_FLAG_DONT_AGGREGATE, vd, offset, NULL, ZIO_STAGE_OPEN,
+	    ZIO_TRIM_PIPELINE));
+}
+
 zio_t *
 zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
     abd_t *data, int checksum, zio_done_func_t *done, void *private,
@@ -1049,8 +1115,15 @@ zio_vdev_child_io(zio_t *pio, blkptr_t *bp, vdev_t *vd, uint64_t offset,
 	enum zio_stage pipeline = ZIO_VDEV_CHILD_PIPELINE;
 	zio_t *zio;
 
+	/*
+	 * Distributed spares redirect their I/O to a sibling of theirs,
+	 * and indirect vdevs to the top-level vdevs their data moved to.
+	 */
 	ASSERT(vd->vdev_parent ==
-	    (pio->io_vd ? pio->io_vd : pio->io_spa->spa_root_vdev));
+	    (pio->io_vd ? pio->io_vd : pio->io_spa->spa_root_vdev) ||
+	    (pio->io_vd != NULL &&
+	    (pio->io_vd->vdev_ops == &vdev_draid_spare_ops ||
+	    pio->io_vd->vdev_ops == &vdev_indirect_ops)));
 
 	if (type == ZIO_TYPE_READ && bp != NULL) {
 		/*
@@ -1063,7 +1136,7 @@ zio_vdev_child_io(zio_t *pio, blkptr_t *bp, vdev_t *vd, uint64_t offset,
 		pio->io_pipeline &= ~ZIO_STAGE_CHECKSUM_VERIFY;
 	}
 
-	if (vd->vdev_children == 0)
+	if (vd->vdev_ops->vdev_op_leaf)
 		offset += VDEV_LABEL_START_SIZE;
 
 	flags |= ZIO_VDEV_CHILD_FLAGS(pio) | ZIO_FLAG_DONT_PROPAGATE;
@@ -1167,13 +1240,25 @@ zio_read_bp_init(zio_t *zio)
 
 	if (BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF &&
 	    zio->io_child_type == ZIO_CHILD_LOGICAL &&
-	    !(zio->io_flags & ZIO_FLAG_RAW)) {
+	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS)) {
 		uint64_t psize =
 		    BP_IS_EMBEDDED(bp) ? BPE_GET_PSIZE(bp) : BP_GET_PSIZE(bp);
 		zio_push_transform(zio, abd_alloc_sametype(zio->io_abd, psize),
 		    psize, psize, zio_decompress);
 	}
 
+	/*
+	 * Transforms are undone in the reverse order they were pushed, so
+	 * pushing the decryption last makes it run before decompression.
+	 */
+	if (BP_IS_ENCRYPTED(bp) &&
+	    zio->io_child_type == ZIO_CHILD_LOGICAL &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_ENCRYPT)) {
+		uint64_t psize = BP_GET_PSIZE(bp);
+		zio_push_transform(zio, abd_alloc_sametype(zio->io_abd, psize),
+		    psize, psize, zio_decrypt);
+	}
+
 	if (BP_IS_EMBEDDED(bp) && BPE_GET_ETYPE(bp) == BP_EMBEDDED_TYPE_DATA) {
 		int psize = BPE_GET_PSIZE(bp);
 		void *data = abd_borrow_buf(zio->io_abd, psize);
@@ -1268,7 +1353,7 @@ zio_write_compress(zio_t *zio)
 	uint64_t psize = zio->io_size;
 	int pass = 1;
 
-	EQUIV(lsize != psize, (zio->io_flags & ZIO_FLAG_RAW) != 0);
+	EQUIV(lsize != psize, (zio->io_flags & ZIO_FLAG_RAW_COMPRESS) != 0);
 
 	/*
 	 * If our children haven't all reached the ready stage,
@@ -1319,13 +1404,16 @@ zio_write_compress(zio_t *zio)
 	}
 
 	/* If it's a compressed write that is not raw, compress the buffer. */
-	if (compress != ZIO_COMPRESS_OFF && psize == lsize) {
+	if (compress != ZIO_COMPRESS_OFF && psize == lsize &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_ENCRYPT)) {
 		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
+		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize,
+		    zp->zp_complevel);
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
-		} else if (!zp->zp_dedup && psize <= BPE_PAYLOAD_SIZE &&
+		} else if (!zp->zp_dedup && !zp->zp_encrypt &&
+		    psize <= BPE_PAYLOAD_SIZE &&
 		    zp->zp_level == 0 && !DMU_OT_HAS_FILL(zp->zp_type) &&
 		    spa_feature_is_enabled(spa, SPA_FEATURE_EMBEDDED_DATA)) {
 			encode_embedded_bp_compressed(bp,
@@ -2354,12 +2442,18 @@ zio_write_gang_block(zio_t *pio)
 
 		zp.zp_checksum = gio->io_prop.zp_checksum;
 		zp.zp_compress = ZIO_COMPRESS_OFF;
+		zp.zp_complevel = 0;
 		zp.zp_type = DMU_OT_NONE;
 		zp.zp_level = 0;
 		zp.zp_copies = gio->io_prop.zp_copies;
+		zp.zp_zpl_smallblk = 0;
 		zp.zp_dedup = B_FALSE;
 		zp.zp_dedup_verify = B_FALSE;
 		zp.zp_nopwrite = B_FALSE;
+		zp.zp_encrypt = B_FALSE;
+		bzero(zp.zp_salt, ZIO_DATA_SALT_LEN);
+		bzero(zp.zp_iv, ZIO_DATA_IV_LEN);
+		bzero(zp.zp_mac, ZIO_DATA_MAC_LEN);
 
 		cio = zio_write(zio, spa, txg, &gbh->zg_blkptr[g],
 		    abd_get_offset(pio->io_abd, pio->io_size - resid), lsize,
@@ -2465,6 +2559,80 @@ zio_nop_write(zio_t *zio)
 	return (ZIO_PIPELINE_CONTINUE);
 }
 
+/*
+ * ==========================================================================
+ * Encrypt blocks of encrypted datasets
+ * ==========================================================================
+ */
+static int
+zio_encrypt(zio_t *zio)
+{
+	zio_prop_t *zp = &zio->io_prop;
+	spa_t *spa = zio->io_spa;
+	blkptr_t *bp = zio->io_bp;
+	uint64_t psize = BP_GET_PSIZE(bp);
+	dsl_crypto_key_t *dck = NULL;
+	uint8_t salt[ZIO_DATA_SALT_LEN];
+	uint8_t iv[ZIO_DATA_IV_LEN];
+	uint8_t mac[ZIO_DATA_MAC_LEN];
+	abd_t *eabd;
+	int ret;
+
+	if (!zp->zp_encrypt || BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+		return (ZIO_PIPELINE_CONTINUE);
+
+	ASSERT0(zp->zp_level);
+	ASSERT(!zp->zp_dedup && !zp->zp_nopwrite);
+	ASSERT(DMU_OT_IS_ENCRYPTED(zp->zp_type));
+	ASSERT3U(psize, ==, zio->io_size);
+
+	BP_SET_ENCRYPTED(bp, B_TRUE);
+
+	/* raw writes already carry the ciphertext and its parameters */
+	if (zio->io_flags & ZIO_FLAG_RAW_ENCRYPT) {
+		zio_crypt_encode_params_bp(bp, zp->zp_salt, zp->zp_iv);
+		zio_crypt_encode_mac_bp(bp, zp->zp_mac);
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	/*
+	 * The dataset's key mapping is held for as long as it has dirty
+	 * data (see dsl_dataset_dirty()), so the key must be loaded here.
+	 */
+	ret = spa_keystore_lookup_key(spa, zio->io_bookmark.zb_objset, FTAG,
+	    &dck);
+	if (ret != 0) {
+		zio->io_error = ret;
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	ret = zio_crypt_key_get_salt(&dck->dck_key, salt);
+	if (ret == 0)
+		ret = zio_crypt_generate_iv(iv);
+	if (ret != 0) {
+		spa_keystore_dsl_key_rele(spa, dck, FTAG);
+		zio->io_error = ret;
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	eabd = abd_alloc_sametype(zio->io_abd, psize);
+	ret = zio_do_crypt_abd(B_TRUE, &dck->dck_key, salt, iv, mac, psize,
+	    zio->io_abd, eabd);
+	spa_keystore_dsl_key_rele(spa, dck, FTAG);
+
+	if (ret != 0) {
+		abd_free(eabd);
+		zio->io_error = ret;
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	zio_push_transform(zio, eabd, psize, psize, NULL);
+	zio_crypt_encode_params_bp(bp, salt, iv);
+	zio_crypt_encode_mac_bp(bp, mac);
+
+	return (ZIO_PIPELINE_CONTINUE);
+}
+
 /*
  * ==========================================================================
  * Dedup
@@ -2923,6 +3091,15 @@ zio_io_to_allocate(spa_t *spa)
 	return (zio);
 }
 
+static metaslab_class_t *
+zio_preferred_class(zio_t *zio)
+{
+	zio_prop_t *zp = &zio->io_prop;
+
+	return (spa_preferred_class(zio->io_spa, zio->io_size, zp->zp_type,
+	    zp->zp_level, zp->zp_zpl_smallblk));
+}
+
 static int
 zio_dva_throttle(zio_t *zio)
 {
@@ -2936,6 +3113,13 @@ zio_dva_throttle(zio_t *zio)
 		return (ZIO_PIPELINE_CONTINUE);
 	}
 
+	/*
+	 * The allocation throttle only covers the normal class.  Blocks
+	 * destined for the special class are allocated immediately.
+	 */
+	if (zio_preferred_class(zio) != spa_normal_class(spa))
+		return (ZIO_PIPELINE_CONTINUE);
+
 	ASSERT(zio->io_child_type > ZIO_CHILD_GANG);
 
 	ASSERT3U(zio->io_queued_timestamp, >, 0);
@@ -3013,6 +3197,16 @@ zio_dva_allocate(zio_t *zio)
 	if (zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE)
 		flags |= METASLAB_ASYNC_ALLOC;
 
+	/*
+	 * Throttled writes hold their reservation in the normal class,
+	 * everything else may be placed in the special class.
+	 */
+	if (!(zio->io_flags & ZIO_FLAG_IO_ALLOCATING)) {
+		mc = zio_preferred_class(zio);
+		if (mc != spa_normal_class(spa))
+			flags |= METASLAB_DONT_THROTTLE;
+	}
+
 	error = metaslab_alloc(spa, mc, zio->io_size, bp,
 	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
 	    &zio->io_alloc_list, zio);
@@ -3151,6 +3345,7 @@ zio_vdev_io_start(zio_t *zio)
 	vdev_t *vd = zio->io_vd;
 	uint64_t align;
 	spa_t *spa = zio->io_spa;
+	zio_t *pio;
 
 	zio->io_delay = 0;
 
@@ -3235,18 +3430,36 @@ zio_vdev_io_start(zio_t *zio)
 	 * discard unnecessary repairs as we work our way down the vdev tree.
 	 * The same logic applies to any form of nested replication:
 	 * ditto + mirror, RAID-Z + replacing, etc.  This covers them all.
+	 * A distributed spare checked its own DTL before redirecting the
+	 * repair to a child of its dRAID vdev, whose DTL does not cover it.
 	 */
 	if ((zio->io_flags & ZIO_FLAG_IO_REPAIR) &&
 	    !(zio->io_flags & ZIO_FLAG_SELF_HEAL) &&
 	    zio->io_txg != 0 &&	/* not a delegated i/o */
-	    !vdev_dtl_contains(vd, DTL_PARTIAL, zio->io_txg, 1)) {
+	    !vdev_dtl_contains(vd, DTL_PARTIAL, zio->io_txg, 1) &&
+	    !((pio = zio_unique_parent(zio)) != NULL && pio->io_vd != NULL &&
+	    pio->io_vd->vdev_ops == &vdev_draid_spare_ops)) {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 		zio_vdev_io_bypass(zio);
 		return (ZIO_PIPELINE_CONTINUE);
 	}
 
+	/*
+	 * Don't bother queueing trims for a device which can't discard.
+	 */
+	if (zio->io_type == ZIO_TYPE_FREE && vd->vdev_ops->vdev_op_leaf &&
+	    vd->vdev_notrim) {
+		zio_vdev_io_bypass(zio);
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
+	/*
+	 * Distributed spares are queued on the children they redirect to.
+	 */
 	if (vd->vdev_ops->vdev_op_leaf &&
-	    (zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE)) {
+	    vd->vdev_ops != &vdev_draid_spare_ops &&
+	    (zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE ||
+	    zio->io_type == ZIO_TYPE_FREE)) {
 
 		if (zio->io_type == ZIO_TYPE_READ && vdev_cache_read(zio))
 			return (ZIO_PIPELINE_CONTINUE);
@@ -3276,17 +3489,20 @@ zio_vdev_io_done(zio_t *zio)
 	if (zio_wait_for_children(zio, ZIO_CHILD_VDEV, ZIO_WAIT_DONE))
 		return (ZIO_PIPELINE_STOP);
 
-	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE ||
+	    zio->io_type == ZIO_TYPE_FREE);
 
 	if (zio->io_delay)
 		zio->io_delay = gethrtime() - zio->io_delay;
 
 	if (vd != NULL && vd->vdev_ops->vdev_op_leaf) {
 
-		vdev_queue_io_done(zio);
+		if (vd->vdev_ops != &vdev_draid_spare_ops) {
+			vdev_queue_io_done(zio);
 
-		if (zio->io_type == ZIO_TYPE_WRITE)
-			vdev_cache_write(zio);
+			if (zio->io_type == ZIO_TYPE_WRITE)
+				vdev_cache_write(zio);
+		}
 
 		if (zio_injection_enabled && zio->io_error == 0)
 			zio->io_error = zio_handle_device_injection(vd,
@@ -3448,6 +3664,124 @@ zio_vdev_io_bypass(zio_t *zio)
  * Generate and verify checksums
  * ==========================================================================
  */
+void
+zio_checksum_batch_init(spa_t *spa)
+{
+	int c;
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		zio_cksum_batch_t *zcb = &spa->spa_cksum_batch[c];
+
+		mutex_init(&zcb->zcb_lock, NULL, MUTEX_DEFAULT, NULL);
+		list_create(&zcb->zcb_zios, sizeof (zio_t),
+		    offsetof(zio_t, io_batch_node));
+		taskq_init_ent(&zcb->zcb_flush_ent);
+		zcb->zcb_spa = spa;
+		zcb->zcb_checksum = c;
+	}
+}
+
+void
+zio_checksum_batch_fini(spa_t *spa)
+{
+	int c;
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		zio_cksum_batch_t *zcb = &spa->spa_cksum_batch[c];
+
+		ASSERT0(zcb->zcb_count);
+		ASSERT(!zcb->zcb_flush_pending);
+		list_destroy(&zcb->zcb_zios);
+		mutex_destroy(&zcb->zcb_lock);
+	}
+}
+
+/*
+ * Remove all parked zios from the batch. Called with zcb_lock held.
+ */
+static uint_t
+zio_checksum_batch_take(zio_cksum_batch_t *zcb, zio_t **zios)
+{
+	uint_t n = 0;
+	zio_t *zio;
+
+	ASSERT(MUTEX_HELD(&zcb->zcb_lock));
+
+	while ((zio = list_remove_head(&zcb->zcb_zios)) != NULL)
+		zios[n++] = zio;
+	ASSERT3U(n, ==, zcb->zcb_count);
+	ASSERT3U(n, <=, ZIO_CHECKSUM_BATCH_MAX);
+	zcb->zcb_count = 0;
+
+	return (n);
+}
+
+/*
+ * Checksum whatever the batch holds once the issue taskq has worked
+ * through the writes queued ahead of this task, and send the zios on.
+ */
+static void
+zio_checksum_batch_flush(void *arg)
+{
+	zio_cksum_batch_t *zcb = arg;
+	zio_t *zios[ZIO_CHECKSUM_BATCH_MAX];
+	uint_t i, n;
+
+	mutex_enter(&zcb->zcb_lock);
+	zcb->zcb_flush_pending = B_FALSE;
+	n = zio_checksum_batch_take(zcb, zios);
+	mutex_exit(&zcb->zcb_lock);
+
+	if (n == 0)
+		return;
+
+	zio_checksum_compute_batch(zios, n, zcb->zcb_checksum);
+	for (i = 0; i < n; i++)
+		zio_taskq_dispatch(zios[i], ZIO_TASKQ_ISSUE, B_FALSE);
+}
+
+/*
+ * SIMD checksum implementations which hash several blocks side by side
+ * only help if several blocks are hashed at once. Async writes are
+ * therefore parked in a per-pool batch until enough of them have arrived
+ * to fill all lanes; the zio completing the batch checksums all of them
+ * and carries on while the others are dispatched to the issue taskq.
+ *
+ * A flush task queued behind the parked zios on the issue taskq makes sure
+ * that a partial batch waits only for the writes already queued ahead of
+ * it, which are the ones likely to join the batch.
+ */
+static int
+zio_checksum_batch(zio_t *zio, enum zio_checksum checksum, uint_t lanes)
+{
+	zio_cksum_batch_t *zcb = &zio->io_spa->spa_cksum_batch[checksum];
+	zio_t *zios[ZIO_CHECKSUM_BATCH_MAX];
+	uint_t i, n;
+
+	mutex_enter(&zcb->zcb_lock);
+	list_insert_tail(&zcb->zcb_zios, zio);
+	if (++zcb->zcb_count < lanes) {
+		if (!zcb->zcb_flush_pending) {
+			zcb->zcb_flush_pending = B_TRUE;
+			spa_taskq_dispatch_ent(zio->io_spa, ZIO_TYPE_WRITE,
+			    ZIO_TASKQ_ISSUE, zio_checksum_batch_flush, zcb, 0,
+			    &zcb->zcb_flush_ent);
+		}
+		mutex_exit(&zcb->zcb_lock);
+		return (ZIO_PIPELINE_STOP);
+	}
+	n = zio_checksum_batch_take(zcb, zios);
+	mutex_exit(&zcb->zcb_lock);
+
+	zio_checksum_compute_batch(zios, n, checksum);
+	for (i = 0; i < n; i++) {
+		if (zios[i] != zio)
+			zio_taskq_dispatch(zios[i], ZIO_TASKQ_ISSUE, B_FALSE);
+	}
+
+	return (ZIO_PIPELINE_CONTINUE);
+}
+
 static int
 zio_checksum_generate(zio_t *zio)
 {
@@ -3470,7 +3804,18 @@ zio_checksum_generate(zio_t *zio)
 			ASSERT(!IO_IS_ALLOCATING(zio));
 			checksum = ZIO_CHECKSUM_GANG_HEADER;
 		} else {
+			uint_t lanes;
+
 			checksum = BP_GET_CHECKSUM(bp);
+			lanes = zio_checksum_batch_lanes(checksum);
+
+			if (lanes > 1 && zio_checksum_batch_enabled &&
+			    zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE &&
+			    !(zio->io_flags & (ZIO_FLAG_CONFIG_WRITER |
+			    ZIO_FLAG_PROBE))) {
+				return (zio_checksum_batch(zio, checksum,
+				    lanes));
+			}
 		}
 	}
 
@@ -3739,8 +4084,10 @@ zio_done(zio_t *zio)
 			ASSERT(zio->io_children[c][w] == 0);
 
 	if (zio->io_bp != NULL && !BP_IS_EMBEDDED(zio->io_bp)) {
-		ASSERT(zio->io_bp->blk_pad[0] == 0);
-		ASSERT(zio->io_bp->blk_pad[1] == 0);
+		ASSERT(BP_IS_ENCRYPTED(zio->io_bp) ||
+		    zio->io_bp->blk_pad[0] == 0);
+		ASSERT(BP_IS_ENCRYPTED(zio->io_bp) ||
+		    zio->io_bp->blk_pad[1] == 0);
 		ASSERT(bcmp(zio->io_bp, &zio->io_bp_copy,
 		    sizeof (blkptr_t)) == 0 ||
 		    (zio->io_bp == zio_unique_parent(zio)->io_bp));
@@ -3826,9 +4173,13 @@ zio_done(zio_t *zio)
 			zfs_ereport_post(FM_EREPORT_ZFS_IO, zio->io_spa,
 			    zio->io_vd, zio, 0, 0);
 
+		/*
+		 * A missing key is not damage to the pool, so it is not
+		 * recorded in the persistent error log.
+		 */
 		if ((zio->io_error == EIO || !(zio->io_flags &
 		    (ZIO_FLAG_SPECULATIVE | ZIO_FLAG_DONT_PROPAGATE))) &&
-		    zio == zio->io_logical) {
+		    zio->io_error != EACCES && zio == zio->io_logical) {
 			/*
 			 * For logical I/O requests, tell the SPA to log the
 			 * error and generate a logical data ereport.
@@ -4033,6 +4384,7 @@ static zio_pipe_stage_t *zio_pipeline[] = {
 	zio_free_bp_init,
 	zio_issue_async,
 	zio_write_compress,
+	zio_encrypt,
 	zio_checksum_generate,
 	zio_nop_write,
 	zio_ddt_read_start,
@@ -4206,4 +4558,8 @@ MODULE_PARM_DESC(zfs_sync_pass_rewrite,
 module_param(zio_dva_throttle_enabled, int, 0644);
 MODULE_PARM_DESC(zio_dva_throttle_enabled,
 	"Throttle block allocations in the ZIO pipeline");
+
+module_param(zio_checksum_batch_enabled, int, 0644);
+MODULE_PARM_DESC(zio_checksum_batch_enabled,
+	"Checksum async writes in batches for multi-buffer implementations");
 #endif
@@ -31,6 +31,7 @@
 #include <sys/zio_checksum.h>
 #include <sys/zil.h>
 #include <sys/abd.h>
+#include <sys/sha2_mb.h>
 #include <zfs_fletcher.h>
 
 /*
@@ -349,12 +350,83 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
 		    &cksum);
 		eck->zec_cksum = cksum;
+	} else if (bp != NULL && BP_IS_ENCRYPTED(bp)) {
+		/*
+		 * Encrypted blocks keep their MAC in the second half of
+		 * the checksum, so only the first half is stored.
+		 */
+		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
+		    &cksum);
+		bp->blk_cksum.zc_word[0] = cksum.zc_word[0];
+		bp->blk_cksum.zc_word[1] = cksum.zc_word[1];
 	} else {
 		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
 		    &bp->blk_cksum);
 	}
 }
 
+/*
+ * Number of blocks worth checksumming together with
+ * zio_checksum_compute_batch(), 1 if the algorithm has no multi-buffer
+ * implementation.
+ */
+uint_t
+zio_checksum_batch_lanes(enum zio_checksum checksum)
+{
+	switch (checksum) {
+	case ZIO_CHECKSUM_SHA256:
+		return (MIN(sha2_mb_lanes(SHA256), ZIO_CHECKSUM_BATCH_MAX));
+	case ZIO_CHECKSUM_SHA512:
+		return (MIN(sha2_mb_lanes(SHA512_256), ZIO_CHECKSUM_BATCH_MAX));
+	default:
+		return (1);
+	}
+}
+
+/*
+ * Compute the block checksums of up to ZIO_CHECKSUM_BATCH_MAX write zios
+ * which all use @checksum, exactly as zio_checksum_compute() would.
+ */
+void
+zio_checksum_compute_batch(zio_t **zios, uint_t n, enum zio_checksum checksum)
+{
+	abd_t *abds[ZIO_CHECKSUM_BATCH_MAX];
+	uint64_t sizes[ZIO_CHECKSUM_BATCH_MAX];
+	zio_cksum_t cksum[ZIO_CHECKSUM_BATCH_MAX];
+	uint_t i;
+
+	ASSERT3U(n, <=, ZIO_CHECKSUM_BATCH_MAX);
+
+	for (i = 0; i < n; i++) {
+		ASSERT3U(BP_GET_CHECKSUM(zios[i]->io_bp), ==, checksum);
+		abds[i] = zios[i]->io_abd;
+		sizes[i] = zios[i]->io_size;
+	}
+
+	switch (checksum) {
+	case ZIO_CHECKSUM_SHA256:
+		abd_checksum_SHA256_batch(abds, sizes, n, cksum);
+		break;
+	case ZIO_CHECKSUM_SHA512:
+		abd_checksum_SHA512_native_batch(abds, sizes, n, cksum);
+		break;
+	default:
+		panic("no batched checksum for %s",
+		    zio_checksum_table[checksum].ci_name);
+	}
+
+	for (i = 0; i < n; i++) {
+		blkptr_t *bp = zios[i]->io_bp;
+
+		if (BP_IS_ENCRYPTED(bp)) {
+			bp->blk_cksum.zc_word[0] = cksum[i].zc_word[0];
+			bp->blk_cksum.zc_word[1] = cksum[i].zc_word[1];
+		} else {
+			bp->blk_cksum = cksum[i];
+		}
+	}
+}
+
 int
 zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
     abd_t *abd, uint64_t size, uint64_t offset, zio_bad_cksum_t *info)
@@ -441,8 +513,13 @@ zio_checksum_error_impl(spa_t *spa, blkptr_t *bp, enum zio_checksum checksum,
 		info->zbc_has_cksum = 1;
 	}
 
-	if (!ZIO_CHECKSUM_EQUAL(actual_cksum, expected_cksum))
+	if (bp != NULL && BP_IS_ENCRYPTED(bp) &&
+	    !(ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED)) {
+		if (!ZIO_CHECKSUM_MAC_EQUAL(actual_cksum, expected_cksum))
+			return (SET_ERROR(ECKSUM));
+	} else if (!ZIO_CHECKSUM_EQUAL(actual_cksum, expected_cksum)) {
 		return (SET_ERROR(ECKSUM));
+	}
 
 	return (0);
 }
@@ -57,7 +57,9 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{"gzip-8",		8,	gzip_compress,	gzip_decompress},
 	{"gzip-9",		9,	gzip_compress,	gzip_decompress},
 	{"zle",			64,	zle_compress,	zle_decompress},
-	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs}
+	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs},
+	{"zstd",		ZIO_ZSTD_LEVEL_DEFAULT,	zfs_zstd_compress,
+	    zfs_zstd_decompress}
 };
 
 enum zio_compress
@@ -84,6 +86,21 @@ zio_compress_select(spa_t *spa, enum zio_compress child,
 	return (result);
 }
 
+/*
+ * Compression algorithms which are not part of the original pool format
+ * are enabled per-dataset, and activated once a block using them is born.
+ */
+spa_feature_t
+zio_compress_to_feature(enum zio_compress comp)
+{
+	switch (comp) {
+	case ZIO_COMPRESS_ZSTD:
+		return (SPA_FEATURE_ZSTD_COMPRESS);
+	default:
+		return (SPA_FEATURE_NONE);
+	}
+}
+
 /*ARGSUSED*/
 static int
 zio_compress_zeroed_cb(void *data, size_t len, void *private)
@@ -98,8 +115,14 @@ zio_compress_zeroed_cb(void *data, size_t len, void *private)
 	return (0);
 }
 
+/*
+ * Compress s_len bytes of src into dst.  The level is only consulted by
+ * algorithms which support more than one level (zstd), a level of zero
+ * selects the algorithm's default.
+ */
 size_t
-zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len,
+    uint64_t level)
 {
 	size_t c_len, d_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
@@ -123,7 +146,8 @@ zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 
 	/* No compression algorithms can read from ABDs directly */
 	tmp = abd_borrow_buf_copy(src, s_len);
-	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
+	c_len = ci->ci_compress(tmp, dst, s_len, d_len,
+	    c == ZIO_COMPRESS_ZSTD ? (int)level : ci->ci_level);
 	abd_return_buf(src, tmp, s_len);
 
 	if (c_len > d_len)
@@ -0,0 +1,730 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zio_crypt.h>
+#include <sys/dmu.h>
+#include <sys/uio.h>
+#include <sys/sha2.h>
+#include <sys/zfs_context.h>
+#include <sys/crypto/api.h>
+
+/*
+ * Block encryption
+ *
+ * Encryption is applied to level 0 blocks of the object types that hold
+ * user data (see DMU_OT_IS_ENCRYPTED()).  Each dataset (or rather each
+ * DSL crypto key object, see dsl_crypt.c) has a randomly generated master
+ * key.  Blocks are not encrypted with the master key directly; instead a
+ * key is derived from the master key and a random 64-bit salt with
+ * HKDF-SHA512.  The salt is replaced after zfs_key_max_salt_uses blocks
+ * (and whenever the key is loaded), so the 96-bit random IVs of the blocks
+ * encrypted with any one derived key are very unlikely to collide.
+ *
+ * The salt, IV, and MAC of a block are stored in its block pointer (see
+ * the comment above BP_IS_ENCRYPTED() in spa.h).  Encryption happens after
+ * compression in the write pipeline, so the checksum of a block covers the
+ * ciphertext and scrubs, resilvers, and raw sends never need a key.
+ *
+ * The data of a block is handed to the ICP as a uio describing the chunks
+ * of the ABD holding it, so scattered ABDs are encrypted and decrypted in
+ * place without first being copied into a linear buffer.  The MAC is
+ * appended to the ciphertext as an extra iovec.  Kernels with high memory
+ * cannot keep the pages of an ABD mapped for the duration of the operation
+ * so there the ABD is borrowed as a linear buffer instead.
+ *
+ * Master keys are stored on disk wrapped (encrypted) with AES-256-GCM
+ * under a user-provided 256-bit wrapping key.  The guid and suite of the
+ * master key are authenticated along with it.
+ */
+
+unsigned long zfs_key_max_salt_uses = ZFS_KEY_MAX_SALT_USES_DEFAULT;
+
+zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS] = {
+	{"",			ZC_TYPE_NONE,	0,	"inherit"},
+	{SUN_CKM_AES_GCM,	ZC_TYPE_GCM,	32,	"on"},
+	{"",			ZC_TYPE_NONE,	0,	"off"},
+	{SUN_CKM_AES_CCM,	ZC_TYPE_CCM,	16,	"aes-128-ccm"},
+	{SUN_CKM_AES_CCM,	ZC_TYPE_CCM,	24,	"aes-192-ccm"},
+	{SUN_CKM_AES_CCM,	ZC_TYPE_CCM,	32,	"aes-256-ccm"},
+	{SUN_CKM_AES_GCM,	ZC_TYPE_GCM,	16,	"aes-128-gcm"},
+	{SUN_CKM_AES_GCM,	ZC_TYPE_GCM,	24,	"aes-192-gcm"},
+	{SUN_CKM_AES_GCM,	ZC_TYPE_GCM,	32,	"aes-256-gcm"}
+};
+
+#if defined(_KERNEL) && defined(CONFIG_HIGHMEM)
+#define	ZIO_CRYPT_ABD_MAPPED	B_FALSE
+#else
+#define	ZIO_CRYPT_ABD_MAPPED	B_TRUE
+#endif
+
+/*
+ * HMAC-SHA512 of 'data' keyed with 'key', used by the HKDF below.
+ */
+static int
+zio_crypt_hmac_sha512(uint8_t *key, uint_t keylen, uint8_t *data,
+    uint_t datalen, uint8_t *out)
+{
+	crypto_mechanism_t mech;
+	crypto_key_t ckey;
+	crypto_data_t in_cd, out_cd;
+	int ret;
+
+	mech.cm_type = crypto_mech2id(SUN_CKM_SHA512_HMAC);
+	mech.cm_param = NULL;
+	mech.cm_param_len = 0;
+
+	ckey.ck_format = CRYPTO_KEY_RAW;
+	ckey.ck_length = CRYPTO_BYTES2BITS(keylen);
+	ckey.ck_data = key;
+
+	in_cd.cd_format = CRYPTO_DATA_RAW;
+	in_cd.cd_offset = 0;
+	in_cd.cd_length = datalen;
+	in_cd.cd_raw.iov_base = (char *)data;
+	in_cd.cd_raw.iov_len = datalen;
+
+	out_cd.cd_format = CRYPTO_DATA_RAW;
+	out_cd.cd_offset = 0;
+	out_cd.cd_length = SHA512_DIGEST_LENGTH;
+	out_cd.cd_raw.iov_base = (char *)out;
+	out_cd.cd_raw.iov_len = SHA512_DIGEST_LENGTH;
+
+	ret = crypto_mac(&mech, &in_cd, &ckey, NULL, &out_cd, NULL);
+	if (ret != CRYPTO_SUCCESS)
+		return (SET_ERROR(EIO));
+
+	return (0);
+}
+
+/*
+ * Derive the key for a given salt from a master key using HKDF-SHA512
+ * (RFC 5869) with an empty extract salt and the block salt as the info.
+ * The derived key is never longer than a single SHA512 digest.
+ */
+static int
+zio_crypt_derive_key(uint8_t *master, uint_t keylen, uint8_t *salt,
+    uint8_t *derived)
+{
+	uint8_t zeroes[SHA512_DIGEST_LENGTH];
+	uint8_t prk[SHA512_DIGEST_LENGTH];
+	uint8_t info[ZIO_DATA_SALT_LEN + 1];
+	uint8_t okm[SHA512_DIGEST_LENGTH];
+	int ret;
+
+	ASSERT3U(keylen, <=, SHA512_DIGEST_LENGTH);
+
+	bzero(zeroes, sizeof (zeroes));
+	ret = zio_crypt_hmac_sha512(zeroes, sizeof (zeroes), master, keylen,
+	    prk);
+	if (ret != 0)
+		goto out;
+
+	bcopy(salt, info, ZIO_DATA_SALT_LEN);
+	info[ZIO_DATA_SALT_LEN] = 1;
+	ret = zio_crypt_hmac_sha512(prk, sizeof (prk), info, sizeof (info),
+	    okm);
+	if (ret != 0)
+		goto out;
+
+	bcopy(okm, derived, keylen);
+
+out:
+	bzero(prk, sizeof (prk));
+	bzero(okm, sizeof (okm));
+	return (ret);
+}
+
+/*
+ * Generate a new salt for the key and derive the matching current key.
+ * The caller must hold zk_salt_lock as writer (or be the only user).
+ */
+static int
+zio_crypt_key_change_salt_impl(zio_crypt_key_t *key)
+{
+	crypto_mechanism_t mech;
+	uint_t keylen = zio_crypt_table[key->zk_crypt].ci_keylen;
+	int ret;
+
+	ret = random_get_pseudo_bytes(key->zk_salt, ZIO_DATA_SALT_LEN);
+	if (ret != 0)
+		return (ret);
+
+	ret = zio_crypt_derive_key(key->zk_master_keydata, keylen,
+	    key->zk_salt, key->zk_current_keydata);
+	if (ret != 0)
+		return (ret);
+
+	key->zk_current_key.ck_format = CRYPTO_KEY_RAW;
+	key->zk_current_key.ck_data = key->zk_current_keydata;
+	key->zk_current_key.ck_length = CRYPTO_BYTES2BITS(keylen);
+
+	if (key->zk_current_tmpl != NULL) {
+		crypto_destroy_ctx_template(key->zk_current_tmpl);
+		key->zk_current_tmpl = NULL;
+	}
+
+	/*
+	 * The context template caches the expanded key schedule.  It is
+	 * only an optimization, so failing to create one is not an error.
+	 */
+	mech.cm_type = crypto_mech2id(zio_crypt_table[key->zk_crypt].
+	    ci_mechname);
+	mech.cm_param = NULL;
+	mech.cm_param_len = 0;
+	if (crypto_create_ctx_template(&mech, &key->zk_current_key,
+	    &key->zk_current_tmpl, KM_SLEEP) != CRYPTO_SUCCESS)
+		key->zk_current_tmpl = NULL;
+
+	key->zk_salt_count = 0;
+
+	return (0);
+}
+
+void
+zio_crypt_key_destroy(zio_crypt_key_t *key)
+{
+	if (key->zk_current_tmpl != NULL)
+		crypto_destroy_ctx_template(key->zk_current_tmpl);
+	rw_destroy(&key->zk_salt_lock);
+
+	/* zero out sensitive data */
+	bzero(key, sizeof (zio_crypt_key_t));
+}
+
+/*
+ * Generate a new random master key for the given suite.
+ */
+int
+zio_crypt_key_init(uint64_t crypt, zio_crypt_key_t *key)
+{
+	uint_t keylen;
+	int ret;
+
+	ASSERT(key != NULL);
+	ASSERT3U(crypt, <, ZIO_CRYPT_FUNCTIONS);
+
+	keylen = zio_crypt_table[crypt].ci_keylen;
+	ASSERT3U(keylen, >, 0);
+	ASSERT3U(keylen, <=, MASTER_KEY_MAX_LEN);
+
+	bzero(key, sizeof (zio_crypt_key_t));
+	rw_init(&key->zk_salt_lock, NULL, RW_DEFAULT, NULL);
+	key->zk_crypt = crypt;
+
+	ret = random_get_bytes(key->zk_master_keydata, keylen);
+	if (ret != 0)
+		goto error;
+
+	ret = random_get_pseudo_bytes((uint8_t *)&key->zk_guid,
+	    sizeof (uint64_t));
+	if (ret != 0)
+		goto error;
+
+	ret = zio_crypt_key_change_salt_impl(key);
+	if (ret != 0)
+		goto error;
+
+	return (0);
+
+error:
+	zio_crypt_key_destroy(key);
+	return (ret);
+}
+
+/*
+ * Return the salt to encrypt a new block with, generating a new one if the
+ * current salt has been used for too many blocks.
+ */
+int
+zio_crypt_key_get_salt(zio_crypt_key_t *key, uint8_t *salt)
+{
+	uint64_t max = MIN(zfs_key_max_salt_uses,
+	    ZFS_KEY_MAX_SALT_USES_DEFAULT);
+	boolean_t salt_change;
+	int ret = 0;
+
+	rw_enter(&key->zk_salt_lock, RW_READER);
+	bcopy(key->zk_salt, salt, ZIO_DATA_SALT_LEN);
+	salt_change = (atomic_inc_64_nv(&key->zk_salt_count) >= max);
+	rw_exit(&key->zk_salt_lock);
+
+	if (salt_change) {
+		rw_enter(&key->zk_salt_lock, RW_WRITER);
+
+		/* someone else may have beaten us to it */
+		if (key->zk_salt_count >= max)
+			ret = zio_crypt_key_change_salt_impl(key);
+
+		rw_exit(&key->zk_salt_lock);
+	}
+
+	return (ret);
+}
+
+/*
+ * Encrypt or decrypt the data described by the two uios.  The last iovec
+ * of the ciphertext uio holds the MAC.
+ */
+static int
+zio_do_crypt_uio(boolean_t encrypt, uint64_t crypt, crypto_key_t *key,
+    crypto_ctx_template_t tmpl, uint8_t *ivbuf, uint_t datalen,
+    uio_t *puio, uio_t *cuio, uint8_t *authbuf, uint_t auth_len)
+{
+	zio_crypt_info_t *ci = &zio_crypt_table[crypt];
+	crypto_data_t plaindata, cipherdata;
+	CK_AES_CCM_PARAMS ccmp;
+	CK_AES_GCM_PARAMS gcmp;
+	crypto_mechanism_t mech;
+	uint_t maclen;
+	int ret;
+
+	ASSERT3U(crypt, <, ZIO_CRYPT_FUNCTIONS);
+	ASSERT3U(key->ck_format, ==, CRYPTO_KEY_RAW);
+
+	maclen = cuio->uio_iov[cuio->uio_iovcnt - 1].iov_len;
+	ASSERT3U(maclen, <=, ZIO_DATA_MAC_LEN);
+
+	mech.cm_type = crypto_mech2id(ci->ci_mechname);
+
+	if (ci->ci_crypt_type == ZC_TYPE_CCM) {
+		ccmp.ulNonceSize = ZIO_DATA_IV_LEN;
+		ccmp.ulAuthDataSize = auth_len;
+		ccmp.authData = authbuf;
+		ccmp.ulMACSize = maclen;
+		ccmp.nonce = ivbuf;
+		ccmp.ulDataSize = encrypt ? datalen : datalen + maclen;
+
+		mech.cm_param = (char *)(&ccmp);
+		mech.cm_param_len = sizeof (CK_AES_CCM_PARAMS);
+	} else {
+		ASSERT3U(ci->ci_crypt_type, ==, ZC_TYPE_GCM);
+		gcmp.ulIvLen = ZIO_DATA_IV_LEN;
+		gcmp.ulIvBits = CRYPTO_BYTES2BITS(ZIO_DATA_IV_LEN);
+		gcmp.ulAADLen = auth_len;
+		gcmp.pAAD = authbuf;
+		gcmp.ulTagBits = CRYPTO_BYTES2BITS(maclen);
+		gcmp.pIv = ivbuf;
+
+		mech.cm_param = (char *)(&gcmp);
+		mech.cm_param_len = sizeof (CK_AES_GCM_PARAMS);
+	}
+
+	plaindata.cd_format = CRYPTO_DATA_UIO;
+	plaindata.cd_offset = 0;
+	plaindata.cd_uio = puio;
+	plaindata.cd_miscdata = NULL;
+	plaindata.cd_length = datalen;
+
+	cipherdata.cd_format = CRYPTO_DATA_UIO;
+	cipherdata.cd_offset = 0;
+	cipherdata.cd_uio = cuio;
+	cipherdata.cd_miscdata = NULL;
+	cipherdata.cd_length = datalen + maclen;
+
+	if (encrypt) {
+		ret = crypto_encrypt(&mech, &plaindata, key, tmpl, &cipherdata,
+		    NULL);
+	} else {
+		ret = crypto_decrypt(&mech, &cipherdata, key, tmpl, &plaindata,
+		    NULL);
+	}
+
+	if (ret == CRYPTO_INVALID_MAC)
+		return (SET_ERROR(ECKSUM));
+	if (ret != CRYPTO_SUCCESS)
+		return (SET_ERROR(EIO));
+
+	return (0);
+}
+
+/*
+ * Wrap (encrypt) a master key with a wrapping key.  The guid and suite of
+ * the key are authenticated but not encrypted.
+ */
+int
+zio_crypt_key_wrap(crypto_key_t *cwkey, zio_crypt_key_t *key, uint8_t *iv,
+    uint8_t *mac, uint8_t *keydata_out)
+{
+	uint_t keylen = zio_crypt_table[key->zk_crypt].ci_keylen;
+	uint64_t aad[2];
+	iovec_t plain_iov, cipher_iovs[2];
+	uio_t puio, cuio;
+	int ret;
+
+	ret = random_get_pseudo_bytes(iv, WRAPPING_IV_LEN);
+	if (ret != 0)
+		return (ret);
+
+	aad[0] = LE_64(key->zk_guid);
+	aad[1] = LE_64(key->zk_crypt);
+
+	plain_iov.iov_base = (void *)key->zk_master_keydata;
+	plain_iov.iov_len = keylen;
+	cipher_iovs[0].iov_base = (void *)keydata_out;
+	cipher_iovs[0].iov_len = keylen;
+	cipher_iovs[1].iov_base = (void *)mac;
+	cipher_iovs[1].iov_len = WRAPPING_MAC_LEN;
+
+	bzero(&puio, sizeof (uio_t));
+	bzero(&cuio, sizeof (uio_t));
+	puio.uio_iov = &plain_iov;
+	puio.uio_iovcnt = 1;
+	puio.uio_segflg = UIO_SYSSPACE;
+	cuio.uio_iov = cipher_iovs;
+	cuio.uio_iovcnt = 2;
+	cuio.uio_segflg = UIO_SYSSPACE;
+
+	return (zio_do_crypt_uio(B_TRUE, ZIO_CRYPT_AES_256_GCM, cwkey, NULL,
+	    iv, keylen, &puio, &cuio, (uint8_t *)aad, sizeof (aad)));
+}
+
+/*
+ * Unwrap (decrypt) a master key.  A wrong wrapping key (or a tampered
+ * key) results in ECKSUM.
+ */
+int
+zio_crypt_key_unwrap(crypto_key_t *cwkey, uint64_t crypt, uint64_t guid,
+    uint8_t *keydata, uint8_t *iv, uint8_t *mac, zio_crypt_key_t *key)
+{
+	uint_t keylen;
+	uint64_t aad[2];
+	iovec_t plain_iov, cipher_iovs[2];
+	uio_t puio, cuio;
+	int ret;
+
+	if (crypt >= ZIO_CRYPT_FUNCTIONS ||
+	    zio_crypt_table[crypt].ci_crypt_type == ZC_TYPE_NONE)
+		return (SET_ERROR(EINVAL));
+
+	keylen = zio_crypt_table[crypt].ci_keylen;
+
+	bzero(key, sizeof (zio_crypt_key_t));
+	rw_init(&key->zk_salt_lock, NULL, RW_DEFAULT, NULL);
+	key->zk_crypt = crypt;
+	key->zk_guid = guid;
+
+	aad[0] = LE_64(guid);
+	aad[1] = LE_64(crypt);
+
+	plain_iov.iov_base = (void *)key->zk_master_keydata;
+	plain_iov.iov_len = keylen;
+	cipher_iovs[0].iov_base = (void *)keydata;
+	cipher_iovs[0].iov_len = keylen;
+	cipher_iovs[1].iov_base = (void *)mac;
+	cipher_iovs[1].iov_len = WRAPPING_MAC_LEN;
+
+	bzero(&puio, sizeof (uio_t));
+	bzero(&cuio, sizeof (uio_t));
+	puio.uio_iov = &plain_iov;
+	puio.uio_iovcnt = 1;
+	puio.uio_segflg = UIO_SYSSPACE;
+	cuio.uio_iov = cipher_iovs;
+	cuio.uio_iovcnt = 2;
+	cuio.uio_segflg = UIO_SYSSPACE;
+
+	ret = zio_do_crypt_uio(B_FALSE, ZIO_CRYPT_AES_256_GCM, cwkey, NULL,
+	    iv, keylen, &puio, &cuio, (uint8_t *)aad, sizeof (aad));
+	if (ret != 0)
+		goto error;
+
+	ret = zio_crypt_key_change_salt_impl(key);
+	if (ret != 0)
+		goto error;
+
+	return (0);
+
+error:
+	zio_crypt_key_destroy(key);
+	return (ret);
+}
+
+int
+zio_crypt_generate_iv(uint8_t *ivbuf)
+{
+	int ret;
+
+	/* randomly generate the IV */
+	ret = random_get_pseudo_bytes(ivbuf, ZIO_DATA_IV_LEN);
+	if (ret != 0)
+		bzero(ivbuf, ZIO_DATA_IV_LEN);
+
+	return (ret);
+}
+
+/*
+ * The salt and IV are stored as byte strings.  Block pointers are
+ * byteswapped as arrays of uint64_t when read on a host of the other
+ * endianness, so undo that here to get the original bytes back.
+ */
+void
+zio_crypt_encode_params_bp(blkptr_t *bp, uint8_t *salt, uint8_t *iv)
+{
+	uint64_t val64;
+	uint32_t val32;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	if (!BP_SHOULD_BYTESWAP(bp)) {
+		bcopy(salt, &bp->blk_pad[0], sizeof (uint64_t));
+		bcopy(iv, &bp->blk_pad[1], sizeof (uint64_t));
+		bcopy(iv + sizeof (uint64_t), &val32, sizeof (uint32_t));
+		BP_SET_IV2(bp, val32);
+	} else {
+		bcopy(salt, &val64, sizeof (uint64_t));
+		bp->blk_pad[0] = BSWAP_64(val64);
+
+		bcopy(iv, &val64, sizeof (uint64_t));
+		bp->blk_pad[1] = BSWAP_64(val64);
+
+		bcopy(iv + sizeof (uint64_t), &val32, sizeof (uint32_t));
+		BP_SET_IV2(bp, BSWAP_32(val32));
+	}
+}
+
+void
+zio_crypt_decode_params_bp(const blkptr_t *bp, uint8_t *salt, uint8_t *iv)
+{
+	uint64_t val64;
+	uint32_t val32;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	if (!BP_SHOULD_BYTESWAP(bp)) {
+		bcopy(&bp->blk_pad[0], salt, sizeof (uint64_t));
+		bcopy(&bp->blk_pad[1], iv, sizeof (uint64_t));
+
+		val32 = (uint32_t)BP_GET_IV2(bp);
+		bcopy(&val32, iv + sizeof (uint64_t), sizeof (uint32_t));
+	} else {
+		val64 = BSWAP_64(bp->blk_pad[0]);
+		bcopy(&val64, salt, sizeof (uint64_t));
+
+		val64 = BSWAP_64(bp->blk_pad[1]);
+		bcopy(&val64, iv, sizeof (uint64_t));
+
+		val32 = BSWAP_32((uint32_t)BP_GET_IV2(bp));
+		bcopy(&val32, iv + sizeof (uint64_t), sizeof (uint32_t));
+	}
+}
+
+void
+zio_crypt_encode_mac_bp(blkptr_t *bp, uint8_t *mac)
+{
+	uint64_t val64;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	if (!BP_SHOULD_BYTESWAP(bp)) {
+		bcopy(mac, &bp->blk_cksum.zc_word[2], sizeof (uint64_t));
+		bcopy(mac + sizeof (uint64_t), &bp->blk_cksum.zc_word[3],
+		    sizeof (uint64_t));
+	} else {
+		bcopy(mac, &val64, sizeof (uint64_t));
+		bp->blk_cksum.zc_word[2] = BSWAP_64(val64);
+
+		bcopy(mac + sizeof (uint64_t), &val64, sizeof (uint64_t));
+		bp->blk_cksum.zc_word[3] = BSWAP_64(val64);
+	}
+}
+
+void
+zio_crypt_decode_mac_bp(const blkptr_t *bp, uint8_t *mac)
+{
+	uint64_t val64;
+
+	ASSERT(BP_IS_ENCRYPTED(bp));
+
+	if (!BP_SHOULD_BYTESWAP(bp)) {
+		bcopy(&bp->blk_cksum.zc_word[2], mac, sizeof (uint64_t));
+		bcopy(&bp->blk_cksum.zc_word[3], mac + sizeof (uint64_t),
+		    sizeof (uint64_t));
+	} else {
+		val64 = BSWAP_64(bp->blk_cksum.zc_word[2]);
+		bcopy(&val64, mac, sizeof (uint64_t));
+
+		val64 = BSWAP_64(bp->blk_cksum.zc_word[3]);
+		bcopy(&val64, mac + sizeof (uint64_t), sizeof (uint64_t));
+	}
+}
+
+/*
+ * Describing an ABD as a uio.  When the chunks of the ABD can stay mapped
+ * each chunk becomes an iovec; otherwise the whole ABD is borrowed as a
+ * single linear buffer.  An extra iovec is added for the MAC if one is
+ * given.
+ */
+typedef struct zio_crypt_uio {
+	uio_t		zcu_uio;
+	iovec_t		*zcu_iovs;
+	uint_t		zcu_nvecs;
+	void		*zcu_buf;	/* borrowed linear buffer, if any */
+} zio_crypt_uio_t;
+
+/* ARGSUSED */
+static int
+zio_crypt_abd_count_cb(void *buf, size_t len, void *private)
+{
+	uint_t *nvecs = private;
+
+	(*nvecs)++;
+	return (0);
+}
+
+static int
+zio_crypt_abd_fill_cb(void *buf, size_t len, void *private)
+{
+	zio_crypt_uio_t *zcu = private;
+	iovec_t *iov = &zcu->zcu_iovs[zcu->zcu_uio.uio_iovcnt];
+
+	iov->iov_base = buf;
+	iov->iov_len = len;
+	zcu->zcu_uio.uio_iovcnt++;
+
+	return (0);
+}
+
+static void
+zio_crypt_abd_to_uio(abd_t *abd, uint_t datalen, uint8_t *mac,
+    boolean_t copy, zio_crypt_uio_t *zcu)
+{
+	uint_t nvecs = 0;
+
+	bzero(zcu, sizeof (zio_crypt_uio_t));
+
+	if (abd_is_linear(abd) || !ZIO_CRYPT_ABD_MAPPED) {
+		nvecs = 1;
+	} else {
+		(void) abd_iterate_func(abd, 0, datalen,
+		    zio_crypt_abd_count_cb, &nvecs);
+	}
+	if (mac != NULL)
+		nvecs++;
+
+	zcu->zcu_nvecs = nvecs;
+	zcu->zcu_iovs = kmem_alloc(nvecs * sizeof (iovec_t), KM_SLEEP);
+	zcu->zcu_uio.uio_iov = zcu->zcu_iovs;
+	zcu->zcu_uio.uio_iovcnt = 0;
+	zcu->zcu_uio.uio_segflg = UIO_SYSSPACE;
+	zcu->zcu_uio.uio_resid = datalen;
+
+	if (abd_is_linear(abd)) {
+		(void) zio_crypt_abd_fill_cb(abd_to_buf(abd), datalen, zcu);
+	} else if (!ZIO_CRYPT_ABD_MAPPED) {
+		zcu->zcu_buf = copy ? abd_borrow_buf_copy(abd, datalen) :
+		    abd_borrow_buf(abd, datalen);
+		(void) zio_crypt_abd_fill_cb(zcu->zcu_buf, datalen, zcu);
+	} else {
+		(void) abd_iterate_func(abd, 0, datalen,
+		    zio_crypt_abd_fill_cb, zcu);
+	}
+
+	if (mac != NULL) {
+		(void) zio_crypt_abd_fill_cb(mac, ZIO_DATA_MAC_LEN, zcu);
+		zcu->zcu_uio.uio_resid += ZIO_DATA_MAC_LEN;
+	}
+
+	ASSERT3U(zcu->zcu_uio.uio_iovcnt, ==, nvecs);
+}
+
+static void
+zio_crypt_uio_destroy(abd_t *abd, uint_t datalen, boolean_t copyback,
+    zio_crypt_uio_t *zcu)
+{
+	if (zcu->zcu_buf != NULL) {
+		if (copyback)
+			abd_return_buf_copy(abd, zcu->zcu_buf, datalen);
+		else
+			abd_return_buf(abd, zcu->zcu_buf, datalen);
+	}
+	kmem_free(zcu->zcu_iovs, zcu->zcu_nvecs * sizeof (iovec_t));
+}
+
+/*
+ * Encrypt 'datalen' bytes of 'pabd' into 'cabd' (or decrypt the other way
+ * around), using the key derived from the master key and 'salt'.  When
+ * encrypting, 'mac' receives the MAC of the data; when decrypting, it is
+ * verified against the data and ECKSUM is returned if it does not match.
+ */
+int
+zio_do_crypt_abd(boolean_t encrypt, zio_crypt_key_t *key, uint8_t *salt,
+    uint8_t *iv, uint8_t *mac, uint_t datalen, abd_t *pabd, abd_t *cabd)
+{
+	uint_t keylen = zio_crypt_table[key->zk_crypt].ci_keylen;
+	uint8_t derived_keydata[MASTER_KEY_MAX_LEN];
+	crypto_key_t derived_key, *ckey;
+	crypto_ctx_template_t tmpl;
+	zio_crypt_uio_t pzcu, czcu;
+	boolean_t locked = B_FALSE;
+	int ret;
+
+	/*
+	 * Use the current key if the salt matches it.  Otherwise the block
+	 * was written with an older salt (or the salt was just rotated)
+	 * and its key has to be derived again.
+	 */
+	rw_enter(&key->zk_salt_lock, RW_READER);
+	if (bcmp(salt, key->zk_salt, ZIO_DATA_SALT_LEN) == 0) {
+		ckey = &key->zk_current_key;
+		tmpl = key->zk_current_tmpl;
+		locked = B_TRUE;
+	} else {
+		rw_exit(&key->zk_salt_lock);
+
+		ret = zio_crypt_derive_key(key->zk_master_keydata, keylen,
+		    salt, derived_keydata);
+		if (ret != 0)
+			goto error;
+
+		derived_key.ck_format = CRYPTO_KEY_RAW;
+		derived_key.ck_data = derived_keydata;
+		derived_key.ck_length = CRYPTO_BYTES2BITS(keylen);
+		ckey = &derived_key;
+		tmpl = NULL;
+	}
+
+	zio_crypt_abd_to_uio(pabd, datalen, NULL, !encrypt ? B_FALSE : B_TRUE,
+	    &pzcu);
+	zio_crypt_abd_to_uio(cabd, datalen, mac, encrypt ? B_FALSE : B_TRUE,
+	    &czcu);
+
+	ret = zio_do_crypt_uio(encrypt, key->zk_crypt, ckey, tmpl, iv,
+	    datalen, &pzcu.zcu_uio, &czcu.zcu_uio, NULL, 0);
+
+	zio_crypt_uio_destroy(pabd, datalen, !encrypt && ret == 0, &pzcu);
+	zio_crypt_uio_destroy(cabd, datalen, encrypt && ret == 0, &czcu);
+
+error:
+	if (locked)
+		rw_exit(&key->zk_salt_lock);
+	bzero(derived_keydata, sizeof (derived_keydata));
+
+	return (ret);
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(zio_crypt_key_init);
+EXPORT_SYMBOL(zio_crypt_key_destroy);
+EXPORT_SYMBOL(zio_do_crypt_abd);
+
+module_param(zfs_key_max_salt_uses, ulong, 0644);
+MODULE_PARM_DESC(zfs_key_max_salt_uses, "Max number of times a salt value "
+	"can be used for generating encryption keys before it is rotated");
+#endif
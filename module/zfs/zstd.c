@@ -0,0 +1,362 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Zstandard compression.
+ *
+ * The compressor itself is provided by the kernel's lib/zstd or, in user
+ * space, by libzstd.  When neither is available zfs_zstd_compress() never
+ * compresses, so blocks are simply written uncompressed, and existing zstd
+ * blocks can not be read.
+ *
+ * zstd needs a sizable workspace for each compression or decompression.
+ * To keep allocations off the zio_write_compress() hot path a fixed pool
+ * of contexts, one per CPU, is created by zstd_init().  Each context owns
+ * its workspaces, which are grown on demand to fit the largest level and
+ * block size seen so far and are then reused for the life of the module.
+ * A context is normally selected by CPU_SEQID; if it is busy the remaining
+ * contexts are tried before blocking.
+ *
+ * Compressed blocks start with a small header holding the length of the
+ * compressed payload, which allows trailing padding added to round the
+ * block up to the allocation size to be ignored, and the property level
+ * used to compress the block.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+#if defined(_KERNEL) && defined(HAVE_KERNEL_ZSTD)
+#include <linux/zstd.h>
+#define	ZFS_HAVE_ZSTD
+#elif !defined(_KERNEL) && defined(HAVE_LIBZSTD)
+#define	ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+#define	ZFS_HAVE_ZSTD
+#endif
+
+/* Level used for "compression=zstd". */
+int zfs_zstd_default_level = 3;
+
+typedef struct zfs_zstd_header {
+	uint32_t	zh_c_len;	/* compressed payload length, BE */
+	uint32_t	zh_level;	/* property level used, BE */
+	char		zh_data[];
+} zfs_zstd_header_t;
+
+#ifdef ZFS_HAVE_ZSTD
+
+typedef struct zstd_ctx {
+	kmutex_t	zc_lock;
+	void		*zc_cws;	/* compression workspace */
+	size_t		zc_cws_size;
+	void		*zc_cctx;	/* compression context in zc_cws */
+	void		*zc_dws;	/* decompression workspace */
+	size_t		zc_dws_size;
+	void		*zc_dctx;	/* decompression context in zc_dws */
+} zstd_ctx_t;
+
+static zstd_ctx_t *zstd_ctxs;
+static int zstd_nctxs;
+
+/*
+ * Convert a compression property level into a zstd level.  Fast levels
+ * are only supported by libzstd; the kernel's zstd treats them as level 1.
+ */
+static int
+zstd_level(int level)
+{
+	if (level == ZIO_ZSTD_LEVEL_DEFAULT)
+		return (zfs_zstd_default_level);
+
+	if (level > ZIO_ZSTD_LEVEL_FAST) {
+#ifdef _KERNEL
+		return (1);
+#else
+		return (ZIO_ZSTD_LEVEL_FAST - level);
+#endif
+	}
+
+	return (MIN(level, ZIO_ZSTD_LEVEL_MAX));
+}
+
+#ifdef _KERNEL
+static size_t
+zstd_cws_bound(int level, size_t s_len)
+{
+	ZSTD_parameters params = ZSTD_getParams(level, s_len, 0);
+
+	return (ZSTD_CCtxWorkspaceBound(params.cParams));
+}
+
+static void *
+zstd_cctx_init(void *ws, size_t size)
+{
+	return (ZSTD_initCCtx(ws, size));
+}
+
+static size_t
+zstd_compress_cctx(void *cctx, void *dst, size_t d_len, const void *src,
+    size_t s_len, int level)
+{
+	ZSTD_parameters params = ZSTD_getParams(level, s_len, 0);
+
+	return (ZSTD_compressCCtx(cctx, dst, d_len, src, s_len, params));
+}
+
+static size_t
+zstd_dws_bound(void)
+{
+	return (ZSTD_DCtxWorkspaceBound());
+}
+
+static void *
+zstd_dctx_init(void *ws, size_t size)
+{
+	return (ZSTD_initDCtx(ws, size));
+}
+#else
+static size_t
+zstd_cws_bound(int level, size_t s_len)
+{
+	return (ZSTD_estimateCCtxSize_usingCParams(
+	    ZSTD_getCParams(level, s_len, 0)));
+}
+
+static void *
+zstd_cctx_init(void *ws, size_t size)
+{
+	return (ZSTD_initStaticCCtx(ws, size));
+}
+
+static size_t
+zstd_compress_cctx(void *cctx, void *dst, size_t d_len, const void *src,
+    size_t s_len, int level)
+{
+	return (ZSTD_compressCCtx(cctx, dst, d_len, src, s_len, level));
+}
+
+static size_t
+zstd_dws_bound(void)
+{
+	return (ZSTD_estimateDCtxSize());
+}
+
+static void *
+zstd_dctx_init(void *ws, size_t size)
+{
+	return (ZSTD_initStaticDCtx(ws, size));
+}
+#endif /* _KERNEL */
+
+static zstd_ctx_t *
+zstd_ctx_enter(void)
+{
+	int start, i;
+
+	kpreempt_disable();
+	start = CPU_SEQID % zstd_nctxs;
+	kpreempt_enable();
+
+	for (i = 0; i < zstd_nctxs; i++) {
+		zstd_ctx_t *zc = &zstd_ctxs[(start + i) % zstd_nctxs];
+
+		if (mutex_tryenter(&zc->zc_lock))
+			return (zc);
+	}
+
+	mutex_enter(&zstd_ctxs[start].zc_lock);
+	return (&zstd_ctxs[start]);
+}
+
+static void
+zstd_ctx_exit(zstd_ctx_t *zc)
+{
+	mutex_exit(&zc->zc_lock);
+}
+
+/*
+ * Make sure the context's compression workspace is large enough for the
+ * given level and block size.  This only allocates the first time a CPU
+ * compresses a block at a larger level or block size than before.
+ */
+static boolean_t
+zstd_ctx_reserve(zstd_ctx_t *zc, int level, size_t s_len)
+{
+	size_t size = zstd_cws_bound(level, s_len);
+
+	if (zc->zc_cctx != NULL && size <= zc->zc_cws_size)
+		return (B_TRUE);
+
+	if (zc->zc_cws != NULL)
+		vmem_free(zc->zc_cws, zc->zc_cws_size);
+
+	zc->zc_cctx = NULL;
+	zc->zc_cws_size = 0;
+	zc->zc_cws = vmem_alloc(size, KM_NOSLEEP);
+	if (zc->zc_cws == NULL)
+		return (B_FALSE);
+
+	zc->zc_cws_size = size;
+	zc->zc_cctx = zstd_cctx_init(zc->zc_cws, size);
+
+	return (zc->zc_cctx != NULL);
+}
+
+/*ARGSUSED*/
+size_t
+zfs_zstd_compress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	zfs_zstd_header_t *hdr = d_start;
+	int level = zstd_level(n);
+	zstd_ctx_t *zc;
+	size_t c_len;
+
+	ASSERT3U(d_len, >=, sizeof (*hdr));
+
+	zc = zstd_ctx_enter();
+	if (!zstd_ctx_reserve(zc, level, s_len)) {
+		zstd_ctx_exit(zc);
+		return (s_len);
+	}
+	c_len = zstd_compress_cctx(zc->zc_cctx, hdr->zh_data,
+	    d_len - sizeof (*hdr), s_start, s_len, level);
+	zstd_ctx_exit(zc);
+
+	/* Signal an error, or that the data did not fit, with s_len. */
+	if (ZSTD_isError(c_len))
+		return (s_len);
+
+	hdr->zh_c_len = BE_32(c_len);
+	hdr->zh_level = BE_32(n);
+
+	return (c_len + sizeof (*hdr));
+}
+
+/*ARGSUSED*/
+int
+zfs_zstd_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	const zfs_zstd_header_t *hdr = s_start;
+	uint32_t c_len = BE_IN32(&hdr->zh_c_len);
+	zstd_ctx_t *zc;
+	size_t ret;
+
+	if (s_len < sizeof (*hdr) || c_len > s_len - sizeof (*hdr))
+		return (-1);
+
+	zc = zstd_ctx_enter();
+	ret = ZSTD_decompressDCtx(zc->zc_dctx, d_start, d_len,
+	    hdr->zh_data, c_len);
+	zstd_ctx_exit(zc);
+
+	return (ZSTD_isError(ret) ? -1 : 0);
+}
+
+void
+zstd_init(void)
+{
+	int i;
+
+	zstd_nctxs = MAX(max_ncpus, 1);
+	zstd_ctxs = kmem_zalloc(zstd_nctxs * sizeof (zstd_ctx_t), KM_SLEEP);
+
+	for (i = 0; i < zstd_nctxs; i++) {
+		zstd_ctx_t *zc = &zstd_ctxs[i];
+
+		mutex_init(&zc->zc_lock, NULL, MUTEX_DEFAULT, NULL);
+		zc->zc_dws_size = zstd_dws_bound();
+		zc->zc_dws = vmem_alloc(zc->zc_dws_size, KM_SLEEP);
+		zc->zc_dctx = zstd_dctx_init(zc->zc_dws, zc->zc_dws_size);
+		VERIFY3P(zc->zc_dctx, !=, NULL);
+	}
+}
+
+void
+zstd_fini(void)
+{
+	int i;
+
+	if (zstd_ctxs == NULL)
+		return;
+
+	for (i = 0; i < zstd_nctxs; i++) {
+		zstd_ctx_t *zc = &zstd_ctxs[i];
+
+		if (zc->zc_cws != NULL)
+			vmem_free(zc->zc_cws, zc->zc_cws_size);
+		vmem_free(zc->zc_dws, zc->zc_dws_size);
+		mutex_destroy(&zc->zc_lock);
+	}
+
+	kmem_free(zstd_ctxs, zstd_nctxs * sizeof (zstd_ctx_t));
+	zstd_ctxs = NULL;
+	zstd_nctxs = 0;
+}
+
+boolean_t
+zstd_available(void)
+{
+	return (B_TRUE);
+}
+
+#else /* ZFS_HAVE_ZSTD */
+
+/*ARGSUSED*/
+size_t
+zfs_zstd_compress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	return (s_len);
+}
+
+/*ARGSUSED*/
+int
+zfs_zstd_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	return (-1);
+}
+
+void
+zstd_init(void)
+{
+}
+
+void
+zstd_fini(void)
+{
+}
+
+boolean_t
+zstd_available(void)
+{
+	return (B_FALSE);
+}
+
+#endif /* ZFS_HAVE_ZSTD */
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_zstd_default_level, int, 0644);
+MODULE_PARM_DESC(zfs_zstd_default_level, "Level used for compression=zstd");
+#endif